@@ -13,19 +13,69 @@
 #include "system_info.h"
 #include "ml307_ssl_transport.h"
 #include "audio_codec.h"
+#include "opus_packet_pool.h"
 #include "mqtt_protocol.h"
 #include "websocket_protocol.h"
+#if CONFIG_USE_REPLAY_PROTOCOL
+#include "replay_protocol.h"
+#endif
 #include "font_awesome_symbols.h"
 #include "iot/thing_manager.h"
 #include "assets/lang_config.h"
 #include "mcp_server.h"
+#include "settings.h"
+#include "latency_trace.h"
+#include "boot_profile.h"
+#include "power_profile.h"
+#if CONFIG_USE_ULP_SOUND_WAKE
+#include "sound_wake_standby.h"
+#endif
+#include "i2c_bus_scheduler.h"
+#include "task_factory.h"
+#include "trace_recorder.h"
+#include "audio_tap.h"
+#if CONFIG_USE_SESSION_SNAPSHOT
+#include "session_snapshot.h"
+#endif
+#if CONFIG_USE_PERF_MONITOR
+#include "perf_monitor.h"
+#endif
+#if CONFIG_USE_HEAP_MONITOR
+#include "heap_monitor.h"
+#endif
+#if CONFIG_USE_AUDIO_STALL_WATCHDOG
+#include "audio_stall_watchdog.h"
+#endif
+#if CONFIG_USE_METRICS
+#include "metrics.h"
+#endif
+#if CONFIG_USE_SOAK_TRIGGER
+#include "debug_http_server.h"
+#endif
+#if CONFIG_USE_POWER_GOVERNOR
+#include "power_governor.h"
+#endif
+#if CONFIG_USE_MEMORY_BUDGET
+#include "memory_budget.h"
+#endif
+#if CONFIG_USE_THERMAL_MONITOR
+#include "thermal_monitor.h"
+#endif
+#if CONFIG_USE_FLIGHT_RECORDER
+#include "flight_recorder.h"
+#endif
 
+#if CONFIG_USE_AUDIO_PROCESSOR || CONFIG_USE_WAKE_WORD_DETECT
+#include "afe_profile.h"
+#endif
 #if CONFIG_USE_AUDIO_PROCESSOR
 #include "afe_audio_processor.h"
 #else
 #include "dummy_audio_processor.h"
 #endif
 
+#include <algorithm>
+#include <cmath>
 #include <cstring>
 #include <esp_log.h>
 #include <cJSON.h>
@@ -36,6 +86,48 @@
 
 
 /** デバイス状態を表す文字列配列（デバッグ用） */
+#if CONFIG_USE_METRICS
+/** @brief 音声キューの統計は既存のカウンターを読み出し時に参照する */
+static MetricCallback metric_incoming_dropped("xiaozhi_audio_incoming_dropped_total",
+    "Downlink audio packets dropped because the decode queue was full", kMetricCounter, [](MetricSink& sink) {
+        sink.Sample("", "", Application::GetInstance().GetAudioQueueStats().incoming_dropped);
+    });
+static MetricCallback metric_outgoing_dropped("xiaozhi_audio_outgoing_dropped_total",
+    "Uplink audio packets dropped before sending", kMetricCounter, [](MetricSink& sink) {
+        sink.Sample("", "", Application::GetInstance().GetAudioQueueStats().outgoing_dropped);
+    });
+static MetricCallback metric_underruns("xiaozhi_audio_underruns_total",
+    "Playback underruns", kMetricCounter, [](MetricSink& sink) {
+        sink.Sample("", "", Application::GetInstance().GetAudioQueueStats().underruns);
+    });
+static MetricCallback metric_late_packets("xiaozhi_audio_late_packets_total",
+    "Downlink packets that arrived after their playback slot", kMetricCounter, [](MetricSink& sink) {
+        sink.Sample("", "", Application::GetInstance().GetAudioQueueStats().late_packets);
+    });
+static MetricCallback metric_decode_queue("xiaozhi_audio_decode_queue_depth",
+    "Packets waiting in the decode queue", kMetricGauge, [](MetricSink& sink) {
+        sink.Sample("", "", Application::GetInstance().GetAudioQueueStats().decode_queue_depth);
+    });
+static MetricCallback metric_rssi("xiaozhi_wifi_rssi_dbm",
+    "Signal strength of the current network connection", kMetricGauge, [](MetricSink& sink) {
+        int rssi;
+        if (Board::GetInstance().GetSignalStrength(rssi)) {
+            sink.Sample("", "", rssi);
+        }
+    });
+static MetricCounter metric_channel_opens("xiaozhi_audio_channel_opens_total", "Audio channels opened");
+static MetricCounter metric_network_errors("xiaozhi_network_errors_total", "Network errors reported by the protocol");
+#if CONFIG_USE_SPECULATIVE_CHANNEL_OPEN
+static MetricCounter metric_speculative_opens("xiaozhi_speculative_opens_total",
+    "Connections opened on speech onset before the wake word was confirmed");
+static MetricCounter metric_speculative_hits("xiaozhi_speculative_hits_total",
+    "Wake words confirmed while a speculative connection was still held");
+#endif
+static const uint32_t kSendAudioBoundsUs[] = {1000, 2000, 5000, 10000, 20000, 50000, 100000, 200000, 500000};
+static MetricHistogram metric_send_audio("xiaozhi_send_audio_duration_us", "Time spent in one SendAudio call",
+    kSendAudioBoundsUs, sizeof(kSendAudioBoundsUs) / sizeof(kSendAudioBoundsUs[0]));
+#endif
+
 static const char* const STATE_STRINGS[] = {
     "unknown",
     "starting",
@@ -61,8 +153,16 @@ Application::Application() {
     // FreeRTOSイベントグループを作成（状態同期用）
     event_group_ = xEventGroupCreate();
     
-    // バックグラウンドタスクを初期化（28KBスタック）
-    background_task_ = new BackgroundTask(4096 * 7);
+    // バックグラウンドワーカーを初期化（各28KBスタック）
+    // 上りエンコードはencode_group_で直列化され、下り（デコード）は AudioPlayer の専用タスクで処理する
+    background_task_ = new BackgroundTaskPool(CONFIG_AUDIO_WORKER_COUNT, 4096 * 7, "bg_worker",
+        CONFIG_AUDIO_ENCODE_TASK_PRIORITY);
+#if CONFIG_USE_CONTROL_MESSAGE_QUEUE
+    // 制御メッセージは設定の読み込みでフラッシュにアクセスするため、PSRAMスタックのbg_workerでは処理しない
+    control_task_ = new BackgroundTaskPool(1, 4096 * 2, "ctrl_worker", 2);
+#endif
+    audio_send_queue_.SetLimit(AUDIO_QUEUE_DURATION_MS / uplink_frame_duration_);
+    audio_player_.SetQueueLimit(MAX_AUDIO_PACKETS_IN_QUEUE);
 
 #if CONFIG_USE_AUDIO_PROCESSOR
     // 音響エコーキャンセレーション有効時
@@ -84,6 +184,32 @@ Application::Application() {
         .skip_unhandled_events = true
     };
     esp_timer_create(&clock_timer_args, &clock_timer_handle_);
+
+#if CONFIG_USE_CHAT_TEXT_REVEAL
+    esp_timer_create_args_t text_reveal_timer_args = {
+        .callback = [](void* arg) {
+            Application* app = (Application*)arg;
+            app->Schedule([app]() {
+                app->chat_text_reveal_.Update(app->audio_player_.played_samples());
+                if (!app->chat_text_reveal_.active()) {
+                    esp_timer_stop(app->text_reveal_timer_);
+                }
+            }, kSchedulePriorityUi);
+        },
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "text_reveal",
+        .skip_unhandled_events = true
+    };
+    esp_timer_create(&text_reveal_timer_args, &text_reveal_timer_);
+#endif
+
+    auto ret = esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "opus_encode", &encode_pm_lock_);
+    if (ret == ESP_ERR_NOT_SUPPORTED) {
+        encode_pm_lock_ = nullptr;
+    } else {
+        ESP_ERROR_CHECK(ret);
+    }
 }
 
 /**
@@ -98,25 +224,38 @@ Application::~Application() {
         esp_timer_stop(clock_timer_handle_);
         esp_timer_delete(clock_timer_handle_);
     }
+#if CONFIG_USE_CHAT_TEXT_REVEAL
+    if (text_reveal_timer_ != nullptr) {
+        esp_timer_stop(text_reveal_timer_);
+        esp_timer_delete(text_reveal_timer_);
+    }
+#endif
     
     // バックグラウンドタスクを削除
     if (background_task_ != nullptr) {
         delete background_task_;
     }
+#if CONFIG_USE_CONTROL_MESSAGE_QUEUE
+    if (control_task_ != nullptr) {
+        delete control_task_;
+    }
+#endif
     
     // イベントグループを削除
     vEventGroupDelete(event_group_);
 }
 
-void Application::CheckNewVersion() {
+void Application::CheckNewVersion(bool background) {
     const int MAX_RETRY = 10;
     int retry_count = 0;
     int retry_delay = 10; // 初始重试延迟为10秒
 
     while (true) {
-        SetDeviceState(kDeviceStateActivating);
         auto display = Board::GetInstance().GetDisplay();
-        display->SetStatus(Lang::Strings::CHECKING_NEW_VERSION);
+        if (!background) {
+            SetDeviceState(kDeviceStateActivating);
+            display->PostStatus(Lang::Strings::CHECKING_NEW_VERSION);
+        }
 
         if (!ota_.CheckVersion()) {
             retry_count++;
@@ -124,37 +263,55 @@ void Application::CheckNewVersion() {
                 ESP_LOGE(TAG, "Too many retries, exit version check");
                 return;
             }
+            if (background) {
+                // キャッシュした設定で動作中のため、利用者には知らせずに再試行する
+                ESP_LOGW(TAG, "Background version check failed, retry in %d seconds (%d/%d)", retry_delay, retry_count, MAX_RETRY);
+                vTaskDelay(pdMS_TO_TICKS(retry_delay * 1000));
+                retry_delay *= 2;
+                continue;
+            }
 
             char buffer[128];
             snprintf(buffer, sizeof(buffer), Lang::Strings::CHECK_NEW_VERSION_FAILED, retry_delay, ota_.GetCheckVersionUrl().c_str());
             Alert(Lang::Strings::ERROR, buffer, "sad", Lang::Sounds::P3_EXCLAMATION);
 
             ESP_LOGW(TAG, "Check new version failed, retry in %d seconds (%d/%d)", retry_delay, retry_count, MAX_RETRY);
-            for (int i = 0; i < retry_delay; i++) {
-                vTaskDelay(pdMS_TO_TICKS(1000));
-                if (device_state_ == kDeviceStateIdle) {
-                    break;
-                }
-            }
+            // 利用者が待機状態に戻したら（ボタン操作など）すぐに再試行する
+            xEventGroupWaitBits(event_group_, DEVICE_IDLE_EVENT, pdFALSE, pdFALSE, pdMS_TO_TICKS(retry_delay * 1000));
             retry_delay *= 2; // 每次重试后延迟时间翻倍
             continue;
         }
         retry_count = 0;
         retry_delay = 10; // 重置重试延迟时间
+        BootProfile::GetInstance().Mark(kBootOtaChecked);
 
         if (ota_.HasNewVersion()) {
-            Alert(Lang::Strings::OTA_UPGRADE, Lang::Strings::UPGRADING, "happy", Lang::Sounds::P3_UPGRADE);
-
-            vTaskDelay(pdMS_TO_TICKS(3000));
-
-            SetDeviceState(kDeviceStateUpgrading);
+            if (background) {
+                // 会話を中断しないよう、待機状態になるまで待ってから更新する
+                xEventGroupWaitBits(event_group_, DEVICE_IDLE_EVENT, pdFALSE, pdFALSE, portMAX_DELAY);
+                // 通知の表示と音はメインループで出し、鳴り終わる頃に同じループで状態を切り替える
+                xEventGroupClearBits(event_group_, UPGRADE_READY_EVENT);
+                Schedule([this]() {
+                    Alert(Lang::Strings::OTA_UPGRADE, Lang::Strings::UPGRADING, "happy", Lang::Sounds::P3_UPGRADE);
+                    ScheduleAfter(3000, [this]() {
+                        SetDeviceState(kDeviceStateUpgrading);
+                        xEventGroupSetBits(event_group_, UPGRADE_READY_EVENT);
+                    });
+                });
+                // 以降で音声タスクを止めるため、メインループが状態を切り替えるまで待つ
+                xEventGroupWaitBits(event_group_, UPGRADE_READY_EVENT, pdTRUE, pdFALSE, portMAX_DELAY);
+            } else {
+                // 起動中（メインループの開始前）は、このタスクで通知音を待ってよい
+                Alert(Lang::Strings::OTA_UPGRADE, Lang::Strings::UPGRADING, "happy", Lang::Sounds::P3_UPGRADE);
+                vTaskDelay(pdMS_TO_TICKS(3000));
+                SetDeviceState(kDeviceStateUpgrading);
+            }
             
             display->SetIcon(FONT_AWESOME_DOWNLOAD);
             std::string message = std::string(Lang::Strings::NEW_VERSION) + ota_.GetFirmwareVersion();
-            display->SetChatMessage("system", message.c_str());
+            display->PostChatMessage("system", message.c_str());
 
             auto& board = Board::GetInstance();
-            board.SetPowerSaveMode(false);
 #if CONFIG_USE_WAKE_WORD_DETECT
             wake_word_detect_.StopDetection();
 #endif
@@ -162,38 +319,80 @@ void Application::CheckNewVersion() {
             auto codec = board.GetAudioCodec();
             codec->EnableInput(false);
             codec->EnableOutput(false);
-            {
-                std::lock_guard<std::mutex> lock(mutex_);
-                audio_decode_queue_.clear();
-            }
+            audio_decode_queue_.RequestClear();
             background_task_->WaitForCompletion();
             delete background_task_;
             background_task_ = nullptr;
+#if CONFIG_USE_CONTROL_MESSAGE_QUEUE
+            control_task_->WaitForCompletion();
+            delete control_task_;
+            control_task_ = nullptr;
+#endif
             vTaskDelay(pdMS_TO_TICKS(1000));
 
             ota_.StartUpgrade([display](int progress, size_t speed) {
                 char buffer[64];
                 snprintf(buffer, sizeof(buffer), "%d%% %uKB/s", progress, speed / 1024);
-                display->SetChatMessage("system", buffer);
+                display->PostChatMessage("system", buffer);
             });
 
             // If upgrade success, the device will reboot and never reach here
-            display->SetStatus(Lang::Strings::UPGRADE_FAILED);
+            display->PostStatus(Lang::Strings::UPGRADE_FAILED);
             ESP_LOGI(TAG, "Firmware upgrade failed...");
             vTaskDelay(pdMS_TO_TICKS(3000));
             Reboot();
             return;
         }
 
+#if CONFIG_MODEL_OTA
+        if (ota_.HasNewModelVersion()) {
+            // 使っていない方のモデルパーティションへ書くため、音声処理を止めずにダウンロードできる
+            if (ota_.UpgradeModel(nullptr)) {
+                // 読み込み済みのモデルは差し替えられないので、再起動して反映する
+                ESP_LOGI(TAG, "Model %s installed, rebooting", ota_.GetModelVersion().c_str());
+                if (background) {
+                    xEventGroupWaitBits(event_group_, DEVICE_IDLE_EVENT, pdFALSE, pdFALSE, portMAX_DELAY);
+                }
+                Reboot();
+                return;
+            }
+            ESP_LOGW(TAG, "Model upgrade failed, keep the current model");
+        }
+#endif
+
+#if CONFIG_ASSET_OTA
+        if (ota_.HasNewAssetsVersion()) {
+            // アプリとは別に、使っていない方のアセットパーティションへ書く
+            if (ota_.UpgradeAssets(nullptr)) {
+                ESP_LOGI(TAG, "Assets %s installed, rebooting", ota_.GetAssetsVersion().c_str());
+                if (background) {
+                    xEventGroupWaitBits(event_group_, DEVICE_IDLE_EVENT, pdFALSE, pdFALSE, portMAX_DELAY);
+                }
+                Reboot();
+                return;
+            }
+            ESP_LOGW(TAG, "Assets upgrade failed, keep the current assets");
+        }
+#endif
+
         // No new version, mark the current version as valid
         ota_.MarkCurrentVersionValid();
+#if CONFIG_USE_SESSION_SNAPSHOT
+        SessionSnapshot::GetInstance().SetVersionChecked(ota_.HasServerTime());
+#endif
         if (!ota_.HasActivationCode() && !ota_.HasActivationChallenge()) {
             xEventGroupSetBits(event_group_, CHECK_NEW_VERSION_DONE_EVENT);
             // Exit the loop if done checking new version
             break;
         }
 
-        display->SetStatus(Lang::Strings::ACTIVATION);
+        if (background) {
+            // アクティベーションが必要になった場合のみ、バックグラウンドの確認から画面に出す
+            Schedule([this]() {
+                SetDeviceState(kDeviceStateActivating);
+            });
+        }
+        display->PostStatus(Lang::Strings::ACTIVATION);
         // Activation code is shown to the user and waiting for the user to input
         if (ota_.HasActivationCode()) {
             ShowActivationCode();
@@ -205,9 +404,17 @@ void Application::CheckNewVersion() {
             esp_err_t err = ota_.Activate();
             if (err == ESP_OK) {
                 xEventGroupSetBits(event_group_, CHECK_NEW_VERSION_DONE_EVENT);
+                if (background) {
+                    Schedule([this]() {
+                        SetDeviceState(kDeviceStateIdle);
+                    });
+                }
                 break;
             } else if (err == ESP_ERR_TIMEOUT) {
-                vTaskDelay(pdMS_TO_TICKS(3000));
+                // ロングポーリングではサーバーが待ってから202を返すため、すぐに再要求する
+                if (!ota_.IsActivationLongPoll()) {
+                    vTaskDelay(pdMS_TO_TICKS(3000));
+                }
             } else {
                 vTaskDelay(pdMS_TO_TICKS(10000));
             }
@@ -224,7 +431,7 @@ void Application::ShowActivationCode() {
 
     struct digit_sound {
         char digit;
-        const std::string_view& sound;
+        std::string_view sound;
     };
     static const std::array<digit_sound, 10> digit_sounds{{
         digit_sound{'0', Lang::Sounds::P3_0},
@@ -239,7 +446,7 @@ void Application::ShowActivationCode() {
         digit_sound{'9', Lang::Sounds::P3_9}
     }};
 
-    // This sentence uses 9KB of SRAM, so we need to wait for it to finish
+    // 案内と各桁の音声は再生待ちに積まれ、順に再生される
     Alert(Lang::Strings::ACTIVATION, message.c_str(), "happy", Lang::Sounds::P3_ACTIVATION);
 
     for (const auto& digit : code) {
@@ -254,11 +461,11 @@ void Application::ShowActivationCode() {
 void Application::Alert(const char* status, const char* message, const char* emotion, const std::string_view& sound) {
     ESP_LOGW(TAG, "Alert %s: %s [%s]", status, message, emotion);
     auto display = Board::GetInstance().GetDisplay();
-    display->SetStatus(status);
-    display->SetEmotion(emotion);
-    display->SetChatMessage("system", message);
+    display->PostStatus(status);
+    display->PostEmotion(emotion);
+    display->PostChatMessage("system", message);
     if (!sound.empty()) {
-        ResetDecoder();
+        // 通知音は再生中の発話を止めずに重ねる（発話はダッキングされる）
         PlaySound(sound);
     }
 }
@@ -266,39 +473,19 @@ void Application::Alert(const char* status, const char* message, const char* emo
 void Application::DismissAlert() {
     if (device_state_ == kDeviceStateIdle) {
         auto display = Board::GetInstance().GetDisplay();
-        display->SetStatus(Lang::Strings::STANDBY);
-        display->SetEmotion("neutral");
-        display->SetChatMessage("system", "");
+        display->PostStatus(Lang::Strings::STANDBY);
+        display->PostEmotion("neutral");
+        display->PostChatMessage("system", "");
     }
 }
 
-void Application::PlaySound(const std::string_view& sound) {
-    // Wait for the previous sound to finish
-    {
-        std::unique_lock<std::mutex> lock(mutex_);
-        audio_decode_cv_.wait(lock, [this]() {
-            return audio_decode_queue_.empty();
-        });
-    }
-    background_task_->WaitForCompletion();
-
-    // The assets are encoded at 16000Hz, 60ms frame duration
-    SetDecodeSampleRate(16000, 60);
-    const char* data = sound.data();
-    size_t size = sound.size();
-    for (const char* p = data; p < data + size; ) {
-        auto p3 = (BinaryProtocol3*)p;
-        p += sizeof(BinaryProtocol3);
-
-        auto payload_size = ntohs(p3->payload_size);
-        AudioStreamPacket packet;
-        packet.payload.resize(payload_size);
-        memcpy(packet.payload.data(), p3->payload, payload_size);
-        p += payload_size;
-
-        std::lock_guard<std::mutex> lock(mutex_);
-        audio_decode_queue_.emplace_back(std::move(packet));
+void Application::PlaySound(const std::string_view& sound, AudioVoice voice) {
+    // アセットは再生タスクがフラッシュ上から直接デコードするため、ここでは待たない
+    auto codec = Board::GetInstance().GetAudioCodec();
+    if (!codec->output_enabled()) {
+        codec->EnableOutput(true);
     }
+    audio_player_.PlayAsset(sound, voice);
 }
 
 void Application::ToggleChatState() {
@@ -313,10 +500,13 @@ void Application::ToggleChatState() {
     }
 
     if (device_state_ == kDeviceStateIdle) {
+        LatencyTrace::GetInstance().BeginSession();
         Schedule([this]() {
-            SetDeviceState(kDeviceStateConnecting);
-            if (!protocol_->OpenAudioChannel()) {
-                return;
+            if (!ReuseSessionChannel()) {
+                SetDeviceState(kDeviceStateConnecting);
+                if (!protocol_->OpenAudioChannel()) {
+                    return;
+                }
             }
 
             SetListeningMode(realtime_chat_enabled_ ? kListeningModeRealtime : kListeningModeAutoStop);
@@ -324,10 +514,10 @@ void Application::ToggleChatState() {
     } else if (device_state_ == kDeviceStateSpeaking) {
         Schedule([this]() {
             AbortSpeaking(kAbortReasonNone);
-        });
+        }, kSchedulePriorityAudio);
     } else if (device_state_ == kDeviceStateListening) {
         Schedule([this]() {
-            protocol_->CloseAudioChannel();
+            EndConversationTurn();
         });
     }
 }
@@ -344,6 +534,7 @@ void Application::StartListening() {
     }
     
     if (device_state_ == kDeviceStateIdle) {
+        LatencyTrace::GetInstance().BeginSession();
         Schedule([this]() {
             if (!protocol_->IsAudioChannelOpened()) {
                 SetDeviceState(kDeviceStateConnecting);
@@ -358,7 +549,7 @@ void Application::StartListening() {
         Schedule([this]() {
             AbortSpeaking(kAbortReasonNone);
             SetListeningMode(kListeningModeManualStop);
-        });
+        }, kSchedulePriorityAudio);
     }
 }
 
@@ -383,168 +574,318 @@ void Application::StopListening() {
 
 void Application::Start() {
     auto& board = Board::GetInstance();
+    BootProfile::GetInstance().Mark(kBootBoardConstructed);
     SetDeviceState(kDeviceStateStarting);
+    // パケットプールは最初の会話の音声経路ではなく、起動時に確保しておく
+    OpusPacketPool::GetInstance();
+#if CONFIG_USE_ULP_SOUND_WAKE
+    if (SoundWakeStandby::WokeBySound()) {
+        ESP_LOGI(TAG, "Woken from standby by sound (level %lu)", SoundWakeStandby::wake_level());
+    }
+#endif
+
+#if CONFIG_USE_PERF_MONITOR
+    PerfMonitor::GetInstance().Start();
+#endif
+#if CONFIG_USE_TRACE_SPANS
+    TraceRecorder::GetInstance().Start();
+#endif
+#if CONFIG_USE_AUDIO_TAP
+    AudioTap::GetInstance().Start();
+#endif
 
     /* Setup the display */
     auto display = board.GetDisplay();
 
     /* Setup the audio codec */
     auto codec = board.GetAudioCodec();
-    opus_decoder_ = std::make_unique<OpusDecoderWrapper>(codec->output_sample_rate(), 1, OPUS_FRAME_DURATION_MS);
-    opus_encoder_ = std::make_unique<OpusEncoderWrapper>(16000, 1, OPUS_FRAME_DURATION_MS);
+#if CONFIG_USE_SESSION_SNAPSHOT
+    // 温起動なら前回のhelloで決まったフレーム長で始め、最初の会話での切り替えを省く
+    auto& snapshot = SessionSnapshot::GetInstance();
+    int snapshot_sample_rate = 0, snapshot_frame_duration = 0, snapshot_uplink_duration = 0;
+    bool snapshot_audio = snapshot.Load() &&
+        snapshot.GetServerAudio(snapshot_sample_rate, snapshot_frame_duration, snapshot_uplink_duration);
+    if (snapshot_audio && snapshot_uplink_duration > 0) {
+        // エンコーダの初期化前なのでSetUplinkFrameDuration()は使わずに直接設定する
+        uplink_frame_duration_ = snapshot_uplink_duration;
+        uplink_frame_samples_ = 16000 * snapshot_uplink_duration / 1000;
+        audio_send_queue_.SetLimit(AUDIO_QUEUE_DURATION_MS / snapshot_uplink_duration);
+    }
+    server_time_restored_ = snapshot.time_synced();
+#endif
+    uplink_encoder_.Initialize(uplink_frame_duration_);
+    int complexity;
     if (realtime_chat_enabled_) {
         ESP_LOGI(TAG, "Realtime chat enabled, setting opus encoder complexity to 0");
-        opus_encoder_->SetComplexity(0);
+        complexity = 0;
     } else if (board.GetBoardType() == "ml307") {
         ESP_LOGI(TAG, "ML307 board detected, setting opus encoder complexity to 5");
-        opus_encoder_->SetComplexity(5);
+        complexity = 5;
     } else {
         ESP_LOGI(TAG, "WiFi board detected, setting opus encoder complexity to 0");
-        opus_encoder_->SetComplexity(0);
+        complexity = 0;
     }
+    uplink_encoder_.SetComplexity(complexity);
+    encoder_controller_.Initialize(complexity);
+
+    // 入出力が同じI2Sクロックを共有するボードでは、RXだけを16kHzにはできないため変換する。
+    // 24kHz 2チャンネル入力のチャンネル分離と3:2間引きはBuild()が1パスのカーネルへ融合する
+    input_pipeline_.Build({codec->input_sample_rate(), codec->input_channels()}, {
+        {kAudioStageTap, kAudioTapMicRaw},
+        {kAudioStageTap, kAudioTapReference, 1},
+        {kAudioStageResample, 16000},
+        {kAudioStageTap, kAudioTapResampled},
+    }, codec->input_sample_rate() * codec->input_channels() / 1000 * OPUS_FRAME_DURATION_MS);
+    codec->Start();
+    BootProfile::GetInstance().Mark(kBootCodecStarted);
+
+#if CONFIG_AUDIO_DSP_BENCHMARK
+    audio_dsp::RunBenchmark();
+    PolyphaseResampler::RunBenchmark();
+#endif
 
-    if (codec->input_sample_rate() != 16000) {
-        input_resampler_.Configure(codec->input_sample_rate(), 16000);
-        reference_resampler_.Configure(codec->input_sample_rate(), 16000);
+    /* Start the playback pipeline */
+#ifdef CONFIG_USE_SERVER_AEC
+    audio_player_.OnPacketDecoded([this](uint32_t timestamp, int64_t play_us) {
+        server_aec_aligner_.OnPlayback(timestamp, play_us);
+        last_output_timestamp_ = timestamp;
+    });
+#endif
+#if CONFIG_USE_SESSION_SNAPSHOT
+    if (snapshot_audio && snapshot_sample_rate > 0 && snapshot_frame_duration > 0) {
+        audio_player_.Start(codec, snapshot_sample_rate, snapshot_frame_duration);
+        audio_player_.SetQueueLimit(AUDIO_QUEUE_DURATION_MS / snapshot_frame_duration);
+    } else {
+        audio_player_.Start(codec, codec->output_sample_rate(), OPUS_FRAME_DURATION_MS);
     }
-    codec->Start();
+#else
+    audio_player_.Start(codec, codec->output_sample_rate(), OPUS_FRAME_DURATION_MS);
+#endif
+#if CONFIG_USE_OUTPUT_LIMITER
+    {
+        Settings settings("audio", false);
+        audio_player_.limiter().SetEnabled(settings.GetInt("limiter", 1) != 0);
+    }
+#endif
 
-#if CONFIG_USE_AUDIO_PROCESSOR
-    xTaskCreatePinnedToCore([](void* arg) {
+    // キャプチャタスク。再生はaudio_player_の専用タスクが行い、両者はキューとリングバッファのみで連携する
+    CreateTask([](void* arg) {
         Application* app = (Application*)arg;
         app->AudioLoop();
         vTaskDelete(NULL);
-    }, "audio_loop", 4096 * 2, this, 8, &audio_loop_task_handle_, 1);
-#else
-    xTaskCreate([](void* arg) {
+    }, "audio_loop", 4096 * 2, this, CONFIG_AUDIO_CAPTURE_TASK_PRIORITY, &audio_loop_task_handle_);
+
+    // 上り音声の送信タスク。TLSの書き込みが詰まってもメインタスクのスケジューラは止まらない
+    CreateTask([](void* arg) {
         Application* app = (Application*)arg;
-        app->AudioLoop();
+        app->AudioSendLoop();
         vTaskDelete(NULL);
-    }, "audio_loop", 4096 * 2, this, 8, &audio_loop_task_handle_);
-#endif
+    }, "audio_send", 4096 * 2, this, CONFIG_AUDIO_SEND_TASK_PRIORITY, &audio_send_task_handle_);
 
     /* Start the clock timer to update the status bar */
-    esp_timer_start_periodic(clock_timer_handle_, 1000000);
+    esp_timer_start_periodic(clock_timer_handle_, clock_interval_ * 1000000LL);
+
+    /* Load the AFE and WakeNet models on the other core while the network comes up */
+    StartAudioFrontEnd(codec);
 
     /* Wait for the network to be ready */
     board.StartNetwork();
 
     // Update the status bar immediately to show the network state
-    display->UpdateStatusBar(true);
+    display->PostStatusBarUpdate(true);
+#if CONFIG_USE_METRICS
+    Metrics::GetInstance().StartHttpEndpoint();
+#endif
+#if CONFIG_USE_SOAK_TRIGGER
+    // 耐久試験のサーバーから会話を開始する（待機中のみ。応答は現在の状態）
+    DebugHttpServer::GetInstance().RegisterHandler("/soak/wake", [](httpd_req_t* req) -> esp_err_t {
+        auto& app = Application::GetInstance();
+        auto state = app.GetDeviceState();
+        if (state == kDeviceStateIdle) {
+            app.ToggleChatState();
+        }
+        httpd_resp_set_type(req, "text/plain");
+        return httpd_resp_sendstr(req, STATE_STRINGS[state]);
+    }, nullptr);
+#endif
 
-    // Check for new firmware version or get the MQTT broker address
-    CheckNewVersion();
+    // 前回のOTA応答で保存した接続設定があれば、バージョン確認を待たずにプロトコルを開始する
+    bool cached_mqtt = !Settings("mqtt", false).GetString("endpoint").empty();
+    bool cached_websocket = !Settings("websocket", false).GetString("url").empty();
+    bool background_check = cached_mqtt || cached_websocket;
+#if CONFIG_USE_SESSION_SNAPSHOT
+    // 温起動で直前に確認を終えていれば、バックグラウンドの確認自体を省く
+    bool skip_version_check = background_check &&
+        snapshot.VersionCheckedWithin(CONFIG_SESSION_SNAPSHOT_VERSION_CHECK_MINUTES * 60);
+    // 前回と同じプロトコルの接続設定が残っていれば、そちらを優先する
+    auto snapshot_protocol = snapshot.protocol();
+    if (snapshot_protocol == kSessionProtocolMqtt && cached_mqtt) {
+        cached_websocket = false;
+    } else if (snapshot_protocol == kSessionProtocolWebsocket && cached_websocket) {
+        cached_mqtt = false;
+    }
+#endif
+    if (!background_check) {
+        // Check for new firmware version or get the MQTT broker address
+        CheckNewVersion();
+    }
 
     // Initialize the protocol
-    display->SetStatus(Lang::Strings::LOADING_PROTOCOL);
+    display->PostStatus(Lang::Strings::LOADING_PROTOCOL);
 
-    if (ota_.HasMqttConfig()) {
+#if CONFIG_USE_REPLAY_PROTOCOL
+    ESP_LOGW(TAG, "Using replay protocol, the server is not contacted");
+    protocol_ = std::make_unique<ReplayProtocol>();
+#else
+    if (ota_.HasMqttConfig() || (background_check && cached_mqtt)) {
         protocol_ = std::make_unique<MqttProtocol>();
-    } else if (ota_.HasWebsocketConfig()) {
+#if CONFIG_USE_SESSION_SNAPSHOT
+        snapshot.SetProtocol(kSessionProtocolMqtt);
+#endif
+    } else if (ota_.HasWebsocketConfig() || (background_check && cached_websocket)) {
         protocol_ = std::make_unique<WebsocketProtocol>();
+#if CONFIG_USE_SESSION_SNAPSHOT
+        snapshot.SetProtocol(kSessionProtocolWebsocket);
+#endif
     } else {
         ESP_LOGW(TAG, "No protocol specified in the OTA config, using MQTT");
         protocol_ = std::make_unique<MqttProtocol>();
     }
+#endif
 
+    // 下りをコーデックの出力レートで受け取れれば、再生時のリサンプルが不要になる
+    protocol_->SetPreferredOutputSampleRate(codec->output_sample_rate());
     protocol_->OnNetworkError([this](const std::string& message) {
+#if CONFIG_USE_METRICS
+        metric_network_errors.Increment();
+#endif
+#if CONFIG_USE_FLIGHT_RECORDER
+        FlightRecorder::GetInstance().Record(kFlightEventProtocol, kFlightProtocolNetworkError);
+#endif
         SetDeviceState(kDeviceStateIdle);
         Alert(Lang::Strings::ERROR, message.c_str(), "sad", Lang::Sounds::P3_EXCLAMATION);
     });
-    protocol_->OnIncomingAudio([this](AudioStreamPacket&& packet) {
-        std::lock_guard<std::mutex> lock(mutex_);
-        if (audio_decode_queue_.size() < MAX_AUDIO_PACKETS_IN_QUEUE) {
-            audio_decode_queue_.emplace_back(std::move(packet));
+    protocol_->OnIncomingAudio([this](const AudioStreamView& view) {
+#if CONFIG_USE_NET_BENCHMARK
+        if (net_benchmark_.running()) {
+            net_benchmark_.OnIncomingAudio(view);
+            return;
+        }
+#endif
+        // 受信バッファからSPSCキューのスロットへ直接コピーする（生産者が受信タスクだけなら排他しない）
+        LatencyTrace::GetInstance().MarkFirst(kLatencyFirstAudioReceived);
+#if CONFIG_USE_TTS_CACHE
+        if (tts_cache_skipping_) {
+            return;
+        }
+        tts_cache_.Record(view);
+        std::lock_guard<PriorityMutex> lock(audio_decode_mutex_);
+#endif
+        if (!audio_player_.Enqueue(view)) {
+            incoming_dropped_++;
         }
     });
-    protocol_->OnAudioChannelOpened([this, codec, &board]() {
-        board.SetPowerSaveMode(false);
+    protocol_->OnAudioChannelOpened([this, codec]() {
+#if CONFIG_USE_METRICS
+        metric_channel_opens.Increment();
+#endif
+#if CONFIG_USE_FLIGHT_RECORDER
+        FlightRecorder::GetInstance().Record(kFlightEventProtocol, kFlightProtocolChannelOpened);
+#endif
         if (protocol_->server_sample_rate() != codec->output_sample_rate()) {
             ESP_LOGW(TAG, "Server sample rate %d does not match device output sample rate %d, resampling may cause distortion",
                 protocol_->server_sample_rate(), codec->output_sample_rate());
+        } else {
+            ESP_LOGI(TAG, "Server streams at the output sample rate %d, no resampling", codec->output_sample_rate());
         }
-        SetDecodeSampleRate(protocol_->server_sample_rate(), protocol_->server_frame_duration());
+        audio_player_.SetDecodeSampleRate(protocol_->server_sample_rate(), protocol_->server_frame_duration());
+        if (protocol_->server_frame_duration() > 0) {
+            audio_player_.SetQueueLimit(AUDIO_QUEUE_DURATION_MS / protocol_->server_frame_duration());
+        }
+        SetUplinkFrameDuration(protocol_->uplink_frame_duration());
+#if CONFIG_USE_SESSION_SNAPSHOT
+        SessionSnapshot::GetInstance().SetServerAudio(protocol_->server_sample_rate(),
+            protocol_->server_frame_duration(), protocol_->uplink_frame_duration());
+#endif
 
 #if CONFIG_IOT_PROTOCOL_XIAOZHI
         auto& thing_manager = iot::ThingManager::GetInstance();
         protocol_->SendIotDescriptors(thing_manager.GetDescriptorsJson());
-        std::string states;
-        if (thing_manager.GetStatesJson(states, false)) {
-            protocol_->SendIotStates(states);
+        if (thing_manager.UpdateStatesJson(false)) {
+            protocol_->SendIotStates(thing_manager.states_json());
         }
 #endif
     });
-    protocol_->OnAudioChannelClosed([this, &board]() {
-        board.SetPowerSaveMode(true);
+    protocol_->OnAudioChannelClosed([this]() {
+#if CONFIG_USE_FLIGHT_RECORDER
+        FlightRecorder::GetInstance().Record(kFlightEventProtocol, kFlightProtocolChannelClosed);
+#endif
+#if CONFIG_IOT_PROTOCOL_MCP
+        // 会話が終わった後に届く応答は送らない（実行中のツール自体は最後まで走る）
+        McpServer::GetInstance().CancelPendingCalls();
+#endif
+#if CONFIG_USE_TTS_CACHE
+        tts_cache_.CancelRecording();
+        tts_cache_skipping_ = false;
+#endif
         Schedule([this]() {
             auto display = Board::GetInstance().GetDisplay();
-            display->SetChatMessage("system", "");
+            display->PostChatMessage("system", "");
             SetDeviceState(kDeviceStateIdle);
         });
     });
-    protocol_->OnIncomingJson([this, display](const cJSON* root) {
+    protocol_->OnIncomingJson([this](const cJSON* root) {
+        TRACE_SPAN("on_incoming_json");
         // Parse JSON data
         auto type = cJSON_GetObjectItem(root, "type");
+#if CONFIG_USE_FLIGHT_RECORDER
+        auto tts_state = cJSON_GetObjectItem(root, "state");
+        FlightRecorder::GetInstance().RecordMessage(type->valuestring,
+            cJSON_IsString(tts_state) ? tts_state->valuestring : nullptr);
+#endif
         if (strcmp(type->valuestring, "tts") == 0) {
             auto state = cJSON_GetObjectItem(root, "state");
-            if (strcmp(state->valuestring, "start") == 0) {
-                Schedule([this]() {
-                    aborted_ = false;
-                    if (device_state_ == kDeviceStateIdle || device_state_ == kDeviceStateListening) {
-                        SetDeviceState(kDeviceStateSpeaking);
-                    }
-                });
-            } else if (strcmp(state->valuestring, "stop") == 0) {
-                Schedule([this]() {
-                    background_task_->WaitForCompletion();
-                    if (device_state_ == kDeviceStateSpeaking) {
-                        if (listening_mode_ == kListeningModeManualStop) {
-                            SetDeviceState(kDeviceStateIdle);
-                        } else {
-                            SetDeviceState(kDeviceStateListening);
-                        }
-                    }
-                });
-            } else if (strcmp(state->valuestring, "sentence_start") == 0) {
-                auto text = cJSON_GetObjectItem(root, "text");
-                if (cJSON_IsString(text)) {
-                    ESP_LOGI(TAG, "<< %s", text->valuestring);
-                    Schedule([this, display, message = std::string(text->valuestring)]() {
-                        display->SetChatMessage("assistant", message.c_str());
-                    });
-                }
+            auto text = cJSON_GetObjectItem(root, "text");
+            auto id = cJSON_GetObjectItem(root, "id");
+            if (cJSON_IsString(state)) {
+                HandleTts(state->valuestring, cJSON_IsString(text) ? text->valuestring : nullptr,
+                    cJSON_IsString(id) ? id->valuestring : nullptr);
             }
         } else if (strcmp(type->valuestring, "stt") == 0) {
             auto text = cJSON_GetObjectItem(root, "text");
             if (cJSON_IsString(text)) {
-                ESP_LOGI(TAG, ">> %s", text->valuestring);
-                Schedule([this, display, message = std::string(text->valuestring)]() {
-                    display->SetChatMessage("user", message.c_str());
-                });
+                HandleStt(text->valuestring);
             }
         } else if (strcmp(type->valuestring, "llm") == 0) {
             auto emotion = cJSON_GetObjectItem(root, "emotion");
             if (cJSON_IsString(emotion)) {
-                Schedule([this, display, emotion_str = std::string(emotion->valuestring)]() {
-                    display->SetEmotion(emotion_str.c_str());
-                });
+                HandleLlmEmotion(emotion->valuestring);
             }
 #if CONFIG_IOT_PROTOCOL_MCP
         } else if (strcmp(type->valuestring, "mcp") == 0) {
             auto payload = cJSON_GetObjectItem(root, "payload");
-            if (cJSON_IsObject(payload)) {
+            if (cJSON_IsObject(payload) || cJSON_IsArray(payload)) {
+#if CONFIG_USE_CONTROL_MESSAGE_QUEUE
+                // 同期ツールの実行で下りの音声を止めないよう、制御キューへ渡す
+                PostControlMessage(payload, [](const cJSON* payload) {
+                    McpServer::GetInstance().ParseMessage(payload);
+                });
+#else
                 McpServer::GetInstance().ParseMessage(payload);
+#endif
             }
 #endif
 #if CONFIG_IOT_PROTOCOL_XIAOZHI
         } else if (strcmp(type->valuestring, "iot") == 0) {
             auto commands = cJSON_GetObjectItem(root, "commands");
             if (cJSON_IsArray(commands)) {
-                auto& thing_manager = iot::ThingManager::GetInstance();
-                for (int i = 0; i < cJSON_GetArraySize(commands); ++i) {
-                    auto command = cJSON_GetArrayItem(commands, i);
-                    thing_manager.Invoke(command);
-                }
+#if CONFIG_USE_CONTROL_MESSAGE_QUEUE
+                PostControlMessage(commands, [](const cJSON* commands) {
+                    iot::ThingManager::GetInstance().InvokeCommands(commands);
+                });
+#else
+                iot::ThingManager::GetInstance().InvokeCommands(commands);
+#endif
             }
 #endif
         } else if (strcmp(type->valuestring, "system") == 0) {
@@ -565,7 +906,15 @@ void Application::Start() {
             auto message = cJSON_GetObjectItem(root, "message");
             auto emotion = cJSON_GetObjectItem(root, "emotion");
             if (cJSON_IsString(status) && cJSON_IsString(message) && cJSON_IsString(emotion)) {
+#if CONFIG_USE_CONTROL_MESSAGE_QUEUE
+                // 表示の更新と通知音の読み込みを受信タスクで行わない
+                PostControlMessage(root, [this](const cJSON* root) {
+                    Alert(cJSON_GetObjectItem(root, "status")->valuestring, cJSON_GetObjectItem(root, "message")->valuestring,
+                        cJSON_GetObjectItem(root, "emotion")->valuestring, Lang::Sounds::P3_VIBRATION);
+                });
+#else
                 Alert(status->valuestring, message->valuestring, emotion->valuestring, Lang::Sounds::P3_VIBRATION);
+#endif
             } else {
                 ESP_LOGW(TAG, "Alert command requires status, message and emotion");
             }
@@ -573,40 +922,63 @@ void Application::Start() {
             ESP_LOGW(TAG, "Unknown message type: %s", type->valuestring);
         }
     });
+    // 頻繁に届くフラットなメッセージはcJSONのDOMを作らずに処理する
+    for (auto state : {"start", "stop", "sentence_start"}) {
+        protocol_->OnIncomingMessage("tts", state, [this, state](const JsonMessage& message) {
+            auto text = message.GetString("text");
+            auto id = message.GetString("id");
+            HandleTts(state, text.empty() ? nullptr : text.c_str(), id.empty() ? nullptr : id.c_str());
+        });
+    }
+    // sentence_endでは何もしない（cJSONの経路に回さないためだけに登録する）
+    protocol_->OnIncomingMessage("tts", "sentence_end", [](const JsonMessage& message) {});
+    protocol_->OnIncomingMessage("stt", nullptr, [this](const JsonMessage& message) {
+        HandleStt(message.GetString("text"));
+    });
+    protocol_->OnIncomingMessage("llm", nullptr, [this](const JsonMessage& message) {
+        auto emotion = message.GetString("emotion");
+        if (!emotion.empty()) {
+            HandleLlmEmotion(emotion);
+        }
+    });
+#if CONFIG_USE_NET_BENCHMARK
+    protocol_->OnIncomingMessage("net_bench", nullptr, [this](const JsonMessage& message) {
+        net_benchmark_.OnControl(message);
+    });
+#endif
+#if CONFIG_IOT_PROTOCOL_XIAOZHI
+    // 状態の変化は通知を受けてから読み、会話中なら変わったプロパティだけを送る
+    iot::ThingManager::GetInstance().OnStatesChanged([this]() {
+        Schedule([this]() {
+            auto& thing_manager = iot::ThingManager::GetInstance();
+            if (thing_manager.RefreshStates() && protocol_ && protocol_->IsAudioChannelOpened()) {
+                UpdateIotStates();
+            }
+        }, kSchedulePriorityHousekeeping);
+    });
+#endif
     bool protocol_started = protocol_->Start();
+    if (protocol_started) {
+        BootProfile::GetInstance().Mark(kBootProtocolStarted);
+    }
 
-    audio_processor_->Initialize(codec);
-    audio_processor_->OnOutput([this](std::vector<int16_t>&& data) {
-        background_task_->Schedule([this, data = std::move(data)]() mutable {
-            opus_encoder_->Encode(std::move(data), [this](std::vector<uint8_t>&& opus) {
-                AudioStreamPacket packet;
-                packet.payload = std::move(opus);
-#ifdef CONFIG_USE_SERVER_AEC
-                {
-                    std::lock_guard<std::mutex> lock(timestamp_mutex_);
-                    if (!timestamp_queue_.empty()) {
-                        packet.timestamp = timestamp_queue_.front();
-                        timestamp_queue_.pop_front();
-                    } else {
-                        packet.timestamp = 0;
-                    }
-
-                    if (timestamp_queue_.size() > 3) { // 限制队列长度3
-                        timestamp_queue_.pop_front(); // 该包发送前先出队保持队列长度
-                        return;
-                    }
-                }
-#endif
-                std::lock_guard<std::mutex> lock(mutex_);
-                if (audio_send_queue_.size() >= MAX_AUDIO_PACKETS_IN_QUEUE) {
-                    ESP_LOGW(TAG, "Too many audio packets in queue, drop the oldest packet");
-                    audio_send_queue_.pop_front();
-                }
-                audio_send_queue_.emplace_back(std::move(packet));
-                xEventGroupSetBits(event_group_, SEND_AUDIO_EVENT);
-            });
-        });
+    int64_t wait_start = esp_timer_get_time();
+    xEventGroupWaitBits(event_group_, AUDIO_FRONTEND_READY_EVENT, pdTRUE, pdFALSE, portMAX_DELAY);
+    ESP_LOGI(TAG, "Waited %lldms for the audio front-end", (esp_timer_get_time() - wait_start) / 1000);
+    audio_processor_->OnOutput([this](const int16_t* data, size_t samples) {
+        OnProcessedAudio(data, samples);
     });
+#if CONFIG_USE_LOCAL_ENDPOINTING
+    audio_processor_->OnEndOfUtterance([this]() {
+        Schedule([this]() {
+            // サーバーの無音判定を待たずに聞き取りを終え、上りの音声も止める
+            if (device_state_ == kDeviceStateListening && listening_mode_ == kListeningModeAutoStop) {
+                protocol_->SendStopListening();
+                SetDeviceState(kDeviceStateIdle);
+            }
+        }, kSchedulePriorityAudio);
+    });
+#endif
     audio_processor_->OnVadStateChange([this](bool speaking) {
         if (device_state_ == kDeviceStateListening) {
             Schedule([this, speaking]() {
@@ -622,50 +994,148 @@ void Application::Start() {
     });
 
 #if CONFIG_USE_WAKE_WORD_DETECT
-    wake_word_detect_.Initialize(codec);
+#if CONFIG_USE_WAKE_WORD_BARGE_IN
+    if (!codec->input_reference()) {
+        ESP_LOGW(TAG, "Barge-in without an AEC reference, playback may trigger false wake-ups");
+    }
+#endif
     wake_word_detect_.OnWakeWordDetected([this](const std::string& wake_word) {
+        if (device_state_ == kDeviceStateIdle) {
+            LatencyTrace::GetInstance().BeginSession(kLatencyWakeWordDetected);
+        }
+#if CONFIG_USE_WAKE_WORD_BARGE_IN
+        if (device_state_ == kDeviceStateSpeaking) {
+            // メインループを待たずに検出タスク上で再生を止め、受信済みの音声を破棄する
+            int64_t detected_us = esp_timer_get_time();
+            audio_player_.SetMuted(true);
+            audio_decode_queue_.RequestClear();
+            audio_player_.Reset();
+            Schedule([this, detected_us]() {
+                if (device_state_ == kDeviceStateSpeaking) {
+                    AbortSpeaking(kAbortReasonWakeWordDetected);
+                }
+                int elapsed_ms = (esp_timer_get_time() - detected_us) / 1000;
+                if (elapsed_ms > CONFIG_BARGE_IN_LATENCY_BUDGET_MS) {
+                    ESP_LOGW(TAG, "Barge-in took %d ms (budget %d ms)", elapsed_ms, CONFIG_BARGE_IN_LATENCY_BUDGET_MS);
+                } else {
+                    ESP_LOGI(TAG, "Barge-in in %d ms", elapsed_ms);
+                }
+            }, kSchedulePriorityAudio);
+            return;
+        }
+#endif
         Schedule([this, &wake_word]() {
             if (device_state_ == kDeviceStateIdle) {
-                SetDeviceState(kDeviceStateConnecting);
+#if CONFIG_USE_SPECULATIVE_CHANNEL_OPEN
+                RecordSpeculativeHit();
+#endif
+                bool reused = ReuseSessionChannel();
+                if (!reused) {
+                    SetDeviceState(kDeviceStateConnecting);
+                }
                 wake_word_detect_.EncodeWakeWordData();
 
-                if (!protocol_ || !protocol_->OpenAudioChannel()) {
+                if (!reused && (!protocol_ || !protocol_->OpenAudioChannel())) {
                     wake_word_detect_.StartDetection();
+                    WakeAudioLoop();
                     return;
                 }
                 
-                AudioStreamPacket packet;
-                // Encode and send the wake word data to the server
-                while (wake_word_detect_.GetWakeWordOpus(packet.payload)) {
-                    protocol_->SendAudio(packet);
+                // Send the wake word pre-roll to the server, AUDIO_BATCH_MAX_FRAMES packets per message
+                // 聞き取り開始前なので送信タスクとは競合しないが、バッファは別に用意する
+                std::vector<uint8_t> opus;
+                AudioStreamPacket batch[AUDIO_BATCH_MAX_FRAMES];
+                bool more = true;
+                while (more) {
+                    size_t count = 0;
+                    while (count < AUDIO_BATCH_MAX_FRAMES && (more = wake_word_detect_.GetWakeWordOpus(opus))) {
+                        batch[count++].payload.assign(opus.data(), opus.size());
+                    }
+                    if (count > 0 && protocol_->SendAudioBatch(batch, count)) {
+                        LatencyTrace::GetInstance().MarkFirst(kLatencyFirstAudioSent);
+                    }
+                    for (size_t i = 0; i < count; ++i) {
+                        batch[i].payload.Release();
+                    }
                 }
                 // Set the chat state to wake word detected
                 protocol_->SendWakeWordDetected(wake_word);
                 ESP_LOGI(TAG, "Wake word detected: %s", wake_word.c_str());
                 SetListeningMode(realtime_chat_enabled_ ? kListeningModeRealtime : kListeningModeAutoStop);
+#if CONFIG_USE_LOCAL_COMMAND
+                // 聞き取りと並行して端末上でもコマンドを認識する（サーバーへの送信は止めない）
+                local_command_detect_.Start();
+#endif
             } else if (device_state_ == kDeviceStateSpeaking) {
                 AbortSpeaking(kAbortReasonWakeWordDetected);
             } else if (device_state_ == kDeviceStateActivating) {
                 SetDeviceState(kDeviceStateIdle);
             }
-        });
+        }, kSchedulePriorityAudio);
+    });
+#if CONFIG_USE_SPECULATIVE_CHANNEL_OPEN
+    wake_word_detect_.OnSpeechOnset([this]() {
+        Schedule([this]() {
+            SpeculativeOpenAudioChannel();
+        }, kSchedulePriorityAudio);
     });
+#endif
     wake_word_detect_.StartDetection();
+    WakeAudioLoop();
+#endif
+
+#if CONFIG_USE_LOCAL_COMMAND
+    local_command_detect_.OnCommandDetected([this](const LocalCommand& command) {
+        // コマンドは静的な表の要素なので、参照先のポインタを値で渡す
+        const LocalCommand* cmd = &command;
+        Schedule([this, cmd]() {
+            if (device_state_ != kDeviceStateListening) {
+                return;
+            }
+            // ツールを実行できなければ何もせず、サーバーの応答に任せる
+            if (!McpServer::GetInstance().CallToolLocally(cmd->tool, cmd->arguments)) {
+                return;
+            }
+            ESP_LOGI(TAG, "Local command executed: %s %s", cmd->tool, cmd->arguments);
+            if (protocol_) {
+                protocol_->CloseAudioChannel();
+            }
+            PlaySound(Lang::Sounds::P3_SUCCESS);
+        }, kSchedulePriorityAudio);
+    });
 #endif
 
-    // Wait for the new version check to finish
-    xEventGroupWaitBits(event_group_, CHECK_NEW_VERSION_DONE_EVENT, pdTRUE, pdFALSE, portMAX_DELAY);
+#if CONFIG_USE_SESSION_SNAPSHOT
+    if (skip_version_check) {
+        ESP_LOGI(TAG, "Version checked within %d minutes before the restart, skipping",
+            CONFIG_SESSION_SNAPSHOT_VERSION_CHECK_MINUTES);
+    } else
+#endif
+    if (background_check) {
+        // 設定の更新・アップグレードの案内・アクティベーションはバックグラウンドで行う
+        xTaskCreate([](void* arg) {
+            auto app = (Application*)arg;
+            app->CheckNewVersion(true);
+            vTaskDelete(NULL);
+        }, "check_version", 4096 * 3, this, 2, nullptr);
+    } else {
+        // Wait for the new version check to finish
+        xEventGroupWaitBits(event_group_, CHECK_NEW_VERSION_DONE_EVENT, pdTRUE, pdFALSE, portMAX_DELAY);
+    }
     SetDeviceState(kDeviceStateIdle);
 
     if (protocol_started) {
         std::string message = std::string(Lang::Strings::VERSION) + ota_.GetCurrentVersion();
-        display->ShowNotification(message.c_str());
-        display->SetChatMessage("system", "");
+        display->PostNotification(message.c_str());
+        display->PostChatMessage("system", "");
         // Play the success sound to indicate the device is ready
         ResetDecoder();
         PlaySound(Lang::Sounds::P3_SUCCESS);
     }
 
+    // カメラやIoTの登録など、待ち受けに不要な初期化は待ち受け開始後に行う
+    board.InitializeDeferred();
+
     // Print heap stats
     SystemInfo::PrintHeapStats();
     
@@ -673,39 +1143,460 @@ void Application::Start() {
     MainEventLoop();
 }
 
-void Application::OnClockTimer() {
-    clock_ticks_++;
-
-    auto display = Board::GetInstance().GetDisplay();
-    display->UpdateStatusBar();
-
-    // Print the debug info every 10 seconds
-    if (clock_ticks_ % 10 == 0) {
-        // SystemInfo::PrintTaskCpuUsage(pdMS_TO_TICKS(1000));
-        // SystemInfo::PrintTaskList();
-        SystemInfo::PrintHeapStats();
-
-        // If we have synchronized server time, set the status to clock "HH:MM" if the device is idle
-        if (ota_.HasServerTime()) {
-            if (device_state_ == kDeviceStateIdle) {
-                Schedule([this]() {
-                    // Set status to clock "HH:MM"
-                    time_t now = time(NULL);
-                    char time_str[64];
-                    strftime(time_str, sizeof(time_str), "%H:%M  ", localtime(&now));
-                    Board::GetInstance().GetDisplay()->SetStatus(time_str);
-                });
+void Application::StartAudioFrontEnd(AudioCodec* codec) {
+    // モデルの読み込みとAFEの作成は時間がかかるため、ネットワーク接続とバージョン確認を
+    // 行うメインタスクとは別のコアで進める。完了はAUDIO_FRONTEND_READY_EVENTで通知する
+    struct Args {
+        Application* app;
+        AudioCodec* codec;
+    };
+    auto args = new Args{this, codec};
+    CreateTask([](void* arg) {
+        auto args = (Args*)arg;
+        Application* app = args->app;
+        AudioCodec* codec = args->codec;
+        delete args;
+
+        int64_t start = esp_timer_get_time();
+        app->audio_processor_->Initialize(codec);
+        {
+            Settings settings("audio", false);
+            if (settings.GetInt("agc", 1) == 0) {
+                app->audio_processor_->SetAgcEnabled(false);
             }
         }
-    }
+#if CONFIG_USE_WAKE_WORD_DETECT
+#if CONFIG_USE_SHARED_AUDIO_FRONTEND
+        // audio_processor_のAFEにWakeNetを同居させ、入力の経路を1つにする
+        app->wake_word_detect_.Initialize(codec, static_cast<AfeAudioProcessor*>(app->audio_processor_.get()));
+#else
+        app->wake_word_detect_.Initialize(codec);
+#endif
+#endif
+#if CONFIG_USE_LOCAL_COMMAND
+        app->local_command_detect_.Initialize();
+#endif
+        ESP_LOGI(TAG, "Audio front-end initialized in %lldms", (esp_timer_get_time() - start) / 1000);
+        xEventGroupSetBits(app->event_group_, AUDIO_FRONTEND_READY_EVENT);
+        vTaskDelete(NULL);
+    }, "afe_init", 4096 * 2, args, 2);
 }
 
-// Add a async task to MainLoop
-void Application::Schedule(std::function<void()> callback) {
-    {
-        std::lock_guard<std::mutex> lock(mutex_);
-        main_tasks_.push_back(std::move(callback));
+void Application::OnClockTimer() {
+    int interval = clock_interval_;
+    clock_ticks_ += interval;
+    // 間隔を延ばしている間も、周期の倍数をまたいだ回で実行する
+    auto every = [this, interval](int seconds) {
+        return clock_ticks_ / seconds != (clock_ticks_ - interval) / seconds;
+    };
+
+#if CONFIG_IOT_PROTOCOL_MCP
+    McpServer::GetInstance().CheckTimeouts();
+#endif
+#if CONFIG_IOT_PROTOCOL_XIAOZHI
+    // 変更を通知しないプロパティ（電池残量など）は低頻度で読み直す
+    if (every(CONFIG_IOT_STATE_POLL_SECONDS)) {
+        iot::ThingManager::GetInstance().MarkAllDirty();
+    }
+#endif
+
+    // 会話中・待機接続中の半開接続を、次の発話より前に検出する
+    if (protocol_) {
+        Schedule([this]() {
+            protocol_->Keepalive();
+        }, kSchedulePriorityHousekeeping);
+    }
+
+#if CONFIG_USE_TELEMETRY_UPLOAD
+    // スナップショットと圧縮はメインタスクで行い、時計のタイマーを止めない
+    if (every(CONFIG_TELEMETRY_SAMPLE_SECONDS)) {
+        Schedule([this]() {
+            Metrics::GetInstance().SampleTelemetry([this](std::string&& payload) {
+                if (protocol_ == nullptr || !protocol_->SendTelemetry(payload)) {
+                    ESP_LOGW(TAG, "Telemetry batch not uploaded (%u bytes)", (unsigned)payload.size());
+                }
+            });
+        }, kSchedulePriorityHousekeeping);
+    }
+#endif
+
+    // ステータスバーは音量やネットワークの変化時に更新されるため、ここでは低頻度の保険として読み直す
+    if (every(CONFIG_STATUS_BAR_POLL_INTERVAL_SECONDS)) {
+        auto display = Board::GetInstance().GetDisplay();
+        display->PostStatusBarUpdate(true);
+    }
+
+#if CONFIG_USE_ADAPTIVE_OPUS_ENCODER
+    // 回線品質とCPU負荷に応じてエンコーダ設定を調整する（エンコードと同じグループで適用）
+    if (device_state_ == kDeviceStateListening && background_task_ != nullptr) {
+        if (encoder_controller_.Update(audio_send_queue_.size(), audio_send_queue_.capacity(),
+                Board::GetInstance().IsNetworkWeak(), protocol_ ? protocol_->rtt_ms() : -1)) {
+            int complexity = encoder_controller_.complexity();
+            bool dtx = encoder_controller_.dtx();
+            background_task_->Schedule([this, complexity, dtx]() {
+                uplink_encoder_.SetComplexity(complexity);
+                uplink_encoder_.SetDtx(dtx);
+            }, &encode_group_);
+        }
+    }
+#endif
+
+#if CONFIG_USE_POWER_GOVERNOR
+    // 電池の状態から電力段階を決める。エンコーダはエンコードと同じグループで、
+    // 画面と通信はLVGLのロックを取るためメインタスクで切り替える
+    auto& governor = PowerGovernor::GetInstance();
+    if (governor.Sample()) {
+        auto limits = governor.limits();
+        encoder_controller_.SetComplexityLimit(limits.max_complexity);
+        if (background_task_ != nullptr) {
+            background_task_->Schedule([this, complexity = encoder_controller_.complexity(), bitrate = limits.bitrate]() {
+                uplink_encoder_.SetComplexity(complexity);
+                uplink_encoder_.SetBitrate(bitrate);
+            }, &encode_group_);
+        }
+        Schedule([&governor]() {
+            governor.Apply();
+        }, kSchedulePriorityHousekeeping);
+    }
+#endif
+
+#if CONFIG_USE_THERMAL_MONITOR
+    // チップ温度から温度段階を決める。描画周期とCPU周波数はメインタスクで切り替える
+    if (every(CONFIG_THERMAL_SAMPLE_SECONDS) && ThermalMonitor::GetInstance().Sample()) {
+        Schedule([]() {
+            ThermalMonitor::GetInstance().Apply();
+        }, kSchedulePriorityHousekeeping);
+    }
+#endif
+
+#if CONFIG_USE_AUDIO_PROCESSOR || CONFIG_USE_WAKE_WORD_DETECT
+    // 聞き取り中（AFEが動いている間）のCPU余裕から、自動モードで次回使うAFEプロファイルを決める
+    AfeProfile::GetInstance().Sample(device_state_ == kDeviceStateListening);
+#endif
+
+#if CONFIG_USE_MEMORY_BUDGET
+    // 空きメモリが水位を下回っていれば、優先度の低いキャッシュから縮小させる
+    MemoryBudget::GetInstance().Check();
+#endif
+
+#if CONFIG_USE_SESSION_CHANNEL_REUSE
+    // ターンの後に残した音声チャンネルは、次のターンが始まらないまま一定時間たてば閉じる
+    // session_idle_since_us_はSetDeviceState()と同じメインタスクで読み書きする
+    Schedule([this]() {
+        if (session_idle_since_us_ == 0 ||
+                esp_timer_get_time() - session_idle_since_us_ < CONFIG_SESSION_IDLE_SECONDS * 1000000LL) {
+            return;
+        }
+        session_idle_since_us_ = 0;
+        if (device_state_ == kDeviceStateIdle && protocol_ && protocol_->IsAudioChannelOpened()) {
+            ESP_LOGI(TAG, "Session idle for %d s, closing the audio channel", CONFIG_SESSION_IDLE_SECONDS);
+            protocol_->CloseAudioChannel();
+        }
+    }, kSchedulePriorityHousekeeping);
+#endif
+
+#if CONFIG_USE_FLIGHT_RECORDER
+    // 再起動の直前の様子を残すため、ヒープとキューの深さを毎秒記録する
+    FlightRecorder::GetInstance().RecordSample((uint8_t)std::min<size_t>(encode_group_.queue_depth(), UINT8_MAX),
+        (uint16_t)std::min<size_t>(audio_decode_queue_.size(), UINT16_MAX));
+#endif
+
+#if CONFIG_TASK_PLACEMENT_VALIDATE
+    // コアごとの負荷と配置表との不一致をログに出す
+    if (every(60)) {
+        LogTaskPlacement();
+    }
+#endif
+
+    // Print the debug info every 10 seconds
+    if (every(10)) {
+        // SystemInfo::PrintTaskCpuUsage(pdMS_TO_TICKS(1000));
+        // SystemInfo::PrintTaskList();
+#if CONFIG_USE_HEAP_MONITOR
+        HeapMonitor::GetInstance().Sample();
+#else
+        SystemInfo::PrintHeapStats();
+#endif
+        if (background_task_ != nullptr) {
+            auto codec = Board::GetInstance().GetAudioCodec();
+            ESP_LOGI(TAG, "Audio workers: encode depth %u (max %u), steals %u, decode queue %u (max %u, grown %lu), jitter %d (measured %d ms), underruns %lu, i2s rx overflow %lu, tx underrun %lu, uplink overruns %lu",
+                encode_group_.queue_depth(), encode_group_.max_queue_depth(), background_task_->steal_count(),
+                audio_decode_queue_.size(), audio_player_.max_queue_depth(), audio_player_.queue_grow_count(),
+                audio_player_.jitter_target(), audio_player_.measured_jitter_ms(), audio_player_.underrun_count(),
+                codec->input_overflow_count(), codec->output_underrun_count(), uplink_encoder_.overrun_count());
+        }
+        uint32_t send_messages = send_messages_.exchange(0);
+        uint32_t send_failures = send_failures_.exchange(0);
+        if (send_messages > 0 || send_failures > 0) {
+            ESP_LOGI(TAG, "Audio send: %lu packets in %lu messages, %lu failures, %lu trimmed, max %lu us, queue %u/%u",
+                send_packets_.exchange(0), send_messages, send_failures, send_trimmed_.exchange(0),
+                send_max_us_.exchange(0), audio_send_queue_.size(), audio_send_queue_.capacity());
+        }
+#if CONFIG_USE_CONTROL_MESSAGE_QUEUE
+        uint32_t control_max_delay_us = control_max_delay_us_.exchange(0);
+        if (control_max_delay_us > 0) {
+            ESP_LOGI(TAG, "Control queue: depth %u (max %u), max delay %lu us, buffer %u bytes, %lu fallbacks",
+                control_group_.queue_depth(), control_group_.max_queue_depth(), control_max_delay_us,
+                control_message_buffer_.capacity(), control_buffer_fallbacks_.load());
+        }
+#endif
+        main_tasks_.PrintStats();
+        I2cBusScheduler::PrintAllStats();
+#if CONFIG_USE_SERVER_AEC
+        server_aec_aligner_.PrintStats();
+#endif
+
+        // If we have synchronized server time, set the status to clock "HH:MM" if the device is idle
+        if (ota_.HasServerTime() || server_time_restored_) {
+            if (device_state_ == kDeviceStateIdle) {
+                Schedule([this]() {
+                    // Set status to clock "HH:MM"
+                    time_t now = time(NULL);
+                    char time_str[64];
+                    size_t length = strftime(time_str, sizeof(time_str), "%H:%M  ", localtime(&now));
+                    // サーバーとの接続がある間は往復遅延も表示する
+                    int rtt = protocol_ ? protocol_->rtt_ms() : -1;
+                    if (rtt >= 0) {
+                        snprintf(time_str + length, sizeof(time_str) - length, "%dms", rtt);
+                    }
+                    Board::GetInstance().GetDisplay()->PostStatus(time_str);
+                }, kSchedulePriorityHousekeeping);
+            }
+        }
+    }
+}
+
+void Application::OnProcessedAudio(const int16_t* data, size_t samples) {
+#if CONFIG_USE_AUDIO_LOOPBACK_PROBE
+    if (loopback_probe_.capturing()) {
+        // 計測中の掃引音はサーバーへ送らない
+        loopback_probe_.OnProcessed(data, samples);
+        return;
+    }
+#endif
+#if CONFIG_USE_NET_BENCHMARK
+    if (net_benchmark_.running()) {
+        // 計測中は回線を計測用のパケットだけに使う
+        return;
+    }
+#endif
+#if CONFIG_USE_LOCAL_COMMAND
+    local_command_detect_.Feed(data, samples);
+#endif
+    // data はコールバック中だけ有効なので、エンコーダのリングへ1回だけコピーする
+    uint32_t epoch = uplink_epoch_.load();
+    if (epoch != uplink_stream_epoch_) {
+        // 状態遷移前に途中までためた音声は前のストリームのもの
+        uplink_encoder_.DiscardPartial();
+        uplink_stream_epoch_ = epoch;
+    }
+    size_t frame_samples = uplink_frame_samples_.load();
+    while (samples > 0) {
+        PcmFrameRef frame;
+        if (uplink_encoder_.Accumulate(data, samples, frame_samples, frame)) {
+            background_task_->Schedule([this, frame, epoch]() {
+                EncodeUplinkFrame(frame, epoch);
+            }, &encode_group_);
+        }
+    }
+}
+
+void Application::EncodeUplinkFrame(const PcmFrameRef& frame, uint32_t epoch) {
+    // 投入後に状態が遷移していれば、このストリームの音声は不要なので破棄する
+    if (epoch != uplink_epoch_) {
+        uplink_encoder_.Skip(frame);
+        return;
+    }
+    if (encode_pm_lock_ != nullptr) {
+        esp_pm_lock_acquire(encode_pm_lock_);
+    }
+    AudioStreamPacket packet;
+    int size = uplink_encoder_.Encode(frame, packet.payload);
+    if (encode_pm_lock_ != nullptr) {
+        esp_pm_lock_release(encode_pm_lock_);
     }
+    if (size <= 0) {
+        return;
+    }
+#ifdef CONFIG_USE_SERVER_AEC
+    // フレームは揃った直後にエンコードされるため、収録開始は現在からフレーム長だけ前とみなす
+    int64_t capture_us = esp_timer_get_time() - (int64_t)frame.samples * 1000000 / 16000;
+    packet.timestamp = server_aec_aligner_.ForCapture(capture_us);
+#endif
+    if (!audio_send_queue_.Push(std::move(packet))) {
+        ESP_LOGW(TAG, "Too many audio packets in queue, drop the newest packet");
+        encoder_controller_.OnPacketDropped();
+        outgoing_dropped_++;
+    }
+    xTaskNotifyGive(audio_send_task_handle_);
+}
+
+AudioQueueStats Application::GetAudioQueueStats() const {
+    AudioQueueStats stats = {};
+    stats.decode_queue_depth = audio_decode_queue_.size();
+    stats.decode_queue_max = audio_player_.max_queue_depth();
+    stats.send_queue_depth = audio_send_queue_.size();
+    stats.incoming_dropped = incoming_dropped_.load();
+    stats.outgoing_dropped = outgoing_dropped_.load();
+    stats.underruns = audio_player_.underrun_count();
+    stats.late_packets = audio_player_.late_packet_count();
+    return stats;
+}
+
+bool Application::SetLevelControl(bool input_agc, bool output_limiter) {
+    Settings settings("audio", true);
+    settings.SetInt("agc", input_agc ? 1 : 0);
+    settings.SetInt("limiter", output_limiter ? 1 : 0);
+#if CONFIG_USE_OUTPUT_LIMITER
+    audio_player_.limiter().SetEnabled(output_limiter);
+#endif
+    // AFEの初期化前は失敗するが、初期化時に保存した設定が適用される
+    return audio_processor_->SetAgcEnabled(input_agc);
+}
+
+std::string Application::GetLevelControlJson() {
+    auto& limiter = audio_player_.limiter();
+    auto sample_rate = Board::GetInstance().GetAudioCodec()->output_sample_rate();
+    uint32_t cycles = limiter.cycles_per_second();
+    char json[256];
+    snprintf(json, sizeof(json),
+        "{\"input_agc\":%s,\"output_limiter\":%s,\"limiter_cycles_per_second\":%lu,"
+        "\"limiter_cpu_percent\":%.2f,\"limited_samples\":%lu,\"limiter_min_gain_db\":%.1f,\"sample_rate\":%d}",
+        audio_processor_->agc_enabled() ? "true" : "false",
+        limiter.enabled() ? "true" : "false", cycles,
+        cycles * 100.0f / (CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ * 1000000.0f), limiter.limited_samples(),
+        20.0f * log10f(std::max<int32_t>(limiter.TakeMinGain(), 1) / 32768.0f), sample_rate);
+    return json;
+}
+
+#if CONFIG_USE_AUDIO_LOOPBACK_PROBE
+std::string Application::MeasureAudioLoopback() {
+    auto codec = Board::GetInstance().GetAudioCodec();
+    // 再生中の音声と掃引音が重ならないよう、再生が終わるのを待つ
+    for (int i = 0; i < 50 && audio_player_.IsPlaying(); i++) {
+        vTaskDelay(pdMS_TO_TICKS(100));
+    }
+    if (audio_player_.IsPlaying()) {
+        return "{\"success\":false,\"message\":\"Audio is still playing\"}";
+    }
+    if (!loopback_probe_.Start(codec)) {
+        return "{\"success\":false,\"message\":\"Another measurement is running or out of memory\"}";
+    }
+
+    // 入力はaudio_loopが読み取るため、音声処理が止まっていれば動かす（AECの出力でERLEも測れる）
+    auto done = xSemaphoreCreateBinary();
+    bool started_processor = false;
+    Schedule([this, codec, done, &started_processor]() {
+        if (!audio_processor_->IsRunning()) {
+#if CONFIG_USE_WAKE_WORD_DETECT
+            wake_word_detect_.StopDetection();
+#endif
+            audio_processor_->Start();
+            started_processor = true;
+            WakeAudioLoop();
+        }
+        codec->EnableOutput(true);
+        codec->SetOutputMuted(false);
+        xSemaphoreGive(done);
+    }, kSchedulePriorityAudio);
+    xSemaphoreTake(done, portMAX_DELAY);
+
+    loopback_probe_.Play(codec);
+    bool interrupted = audio_player_.IsPlaying();
+    auto result = loopback_probe_.Finish();
+
+    Schedule([this, done, started_processor]() {
+        // 計測中に聞き取りへ移っていれば、状態遷移で開始した音声処理はそのまま使う
+        if (started_processor && device_state_ != kDeviceStateListening) {
+            audio_processor_->Stop();
+#if CONFIG_USE_WAKE_WORD_DETECT
+            wake_word_detect_.StartDetection();
+#endif
+            WakeAudioLoop();
+        }
+        xSemaphoreGive(done);
+    }, kSchedulePriorityAudio);
+    xSemaphoreTake(done, portMAX_DELAY);
+    vSemaphoreDelete(done);
+
+    if (interrupted) {
+        return "{\"success\":false,\"message\":\"Other audio was played during the measurement\"}";
+    }
+    return AudioLoopbackProbe::ToJson(result, codec);
+}
+
+void Application::StartAudioLoopbackMeasurement() {
+    // 計測は数秒間ブロックするため、エンコードや制御メッセージと共有するワーカーは使わず専用のタスクで行う
+    if (CreateTask([](void* arg) {
+        auto app = (Application*)arg;
+        auto json = app->MeasureAudioLoopback();
+        ESP_LOGI(TAG, "Audio loopback: %s", json.c_str());
+        vTaskDelete(NULL);
+    }, "loopback_probe", 4096 * 2, this, 2, nullptr) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to start the audio loopback measurement");
+    }
+}
+#endif
+
+#if CONFIG_USE_NET_BENCHMARK
+std::string Application::RunNetBenchmark() {
+    if (!protocol_ || net_benchmark_.running()) {
+        return "{\"success\":false,\"message\":\"Protocol not ready or a benchmark is running\"}";
+    }
+    auto done = xSemaphoreCreateBinary();
+    bool ready = false;
+    bool opened_here = false;
+    Schedule([this, done, &ready, &opened_here]() {
+        if (protocol_->IsAudioChannelOpened()) {
+            ready = true;
+        } else if (device_state_ == kDeviceStateIdle) {
+            ready = opened_here = protocol_->OpenAudioChannel();
+        }
+        xSemaphoreGive(done);
+    });
+    xSemaphoreTake(done, portMAX_DELAY);
+    if (!ready) {
+        vSemaphoreDelete(done);
+        return "{\"success\":false,\"message\":\"Failed to open the audio channel\"}";
+    }
+
+    auto result = net_benchmark_.Run(protocol_.get());
+    if (opened_here) {
+        Schedule([this, done]() {
+            protocol_->CloseAudioChannel();
+            xSemaphoreGive(done);
+        });
+        xSemaphoreTake(done, portMAX_DELAY);
+    }
+    vSemaphoreDelete(done);
+
+    NetBenchmark::PrintBenchLines(result);
+    Board::GetInstance().GetDisplay()->ShowNotification(NetBenchmark::ToSummary(result), 10000);
+    return NetBenchmark::ToJson(result);
+}
+
+void Application::StartNetBenchmark() {
+    // 計測は十数秒ブロックするため、共有のワーカーではなく専用のタスクで行う（送信でTLSを使う分のスタックを取る）
+    if (CreateTask([](void* arg) {
+        auto app = (Application*)arg;
+        auto json = app->RunNetBenchmark();
+        ESP_LOGI(TAG, "Network benchmark: %s", json.c_str());
+        vTaskDelete(NULL);
+    }, "net_bench", 4096 * 3, this, 2, nullptr) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to start the network benchmark");
+    }
+}
+#endif
+
+// Add a async task to MainLoop
+void Application::Schedule(TaskFunction callback, SchedulePriority priority) {
+    main_tasks_.Push(std::move(callback), priority);
+    xEventGroupSetBits(event_group_, SCHEDULE_EVENT);
+}
+
+void Application::ScheduleAfter(uint32_t delay_ms, TaskFunction callback, SchedulePriority priority) {
+    main_tasks_.PushAfter(std::move(callback), delay_ms, priority);
+    // メインループに次の期限までの待ち時間を計算し直させる
     xEventGroupSetBits(event_group_, SCHEDULE_EVENT);
 }
 
@@ -714,27 +1605,76 @@ void Application::Schedule(std::function<void()> callback) {
 // they should use Schedule to call this function
 void Application::MainEventLoop() {
     while (true) {
-        auto bits = xEventGroupWaitBits(event_group_, SCHEDULE_EVENT | SEND_AUDIO_EVENT, pdTRUE, pdFALSE, portMAX_DELAY);
-
-        if (bits & SEND_AUDIO_EVENT) {
-            std::unique_lock<std::mutex> lock(mutex_);
-            auto packets = std::move(audio_send_queue_);
-            lock.unlock();
-            for (auto& packet : packets) {
-                if (!protocol_->SendAudio(packet)) {
-                    break;
-                }
-            }
+        // 遅延タスクがあれば、その期限で起きる
+        xEventGroupWaitBits(event_group_, SCHEDULE_EVENT, pdTRUE, pdFALSE, main_tasks_.TicksUntilNextTimer());
+        main_tasks_.PromoteDueTimers();
+
+        // 優先度の高いタスクから1件ずつ実行する。音声の送信は専用タスクが行う
+        while (main_tasks_.RunNext()) {
         }
+    }
+}
 
-        if (bits & SCHEDULE_EVENT) {
-            std::unique_lock<std::mutex> lock(mutex_);
-            auto tasks = std::move(main_tasks_);
-            lock.unlock();
-            for (auto& task : tasks) {
-                task();
-            }
+void Application::AudioSendLoop() {
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        SendQueuedAudio();
+    }
+}
+
+void Application::SendQueuedAudio() {
+    while (true) {
+        // 回線の停滞で溜まりすぎた分は古いものから捨て、会話の遅れを上限内に戻す
+        size_t limit = std::max(AUDIO_SEND_MAX_BACKLOG_MS / uplink_frame_duration_, AUDIO_BATCH_MAX_FRAMES);
+        size_t trimmed = 0;
+        while (audio_send_queue_.size() > limit && audio_send_queue_.Pop(audio_send_batch_[0])) {
+            audio_send_batch_[0].payload.Release();
+            trimmed++;
+        }
+        if (trimmed > 0) {
+            ESP_LOGW(TAG, "Send backlog over %d ms, dropped %u oldest packets", AUDIO_SEND_MAX_BACKLOG_MS, trimmed);
+            send_trimmed_ += trimmed;
+            outgoing_dropped_ += trimmed;
+            encoder_controller_.OnPacketDropped();
+        }
+
+        // 送信待ちが溜まっている場合（Wi-Fiの停滞後）はまとめて送る
+        size_t count = 0;
+        while (count < AUDIO_BATCH_MAX_FRAMES && audio_send_queue_.Pop(audio_send_batch_[count])) {
+            count++;
+        }
+        if (count == 0) {
+            break;
+        }
+        int64_t start = esp_timer_get_time();
+        bool sent = count == 1 ? protocol_->SendAudio(audio_send_batch_[0])
+                               : protocol_->SendAudioBatch(audio_send_batch_, count);
+        uint32_t elapsed = esp_timer_get_time() - start;
+#if CONFIG_USE_TRACE_SPANS
+        TraceRecorder::GetInstance().Record("send_audio", start, start + elapsed);
+#endif
+#if CONFIG_USE_METRICS
+        metric_send_audio.Observe(elapsed);
+#endif
+        if (elapsed > send_max_us_) {
+            send_max_us_ = elapsed;
+        }
+        for (size_t i = 0; i < count; ++i) {
+            audio_send_batch_[i].payload.Release();
+        }
+        if (!sent) {
+            // 接続が失われている場合が多いため、残りも送らずに捨てる（件数は統計に残す）
+            size_t discarded = count + audio_send_queue_.size();
+            ESP_LOGW(TAG, "Failed to send audio, discarding %u packets", discarded);
+            encoder_controller_.OnSendFailed();
+            send_failures_++;
+            outgoing_dropped_ += discarded;
+            audio_send_queue_.Clear();
+            break;
         }
+        send_packets_ += count;
+        send_messages_++;
+        LatencyTrace::GetInstance().MarkFirst(kLatencyFirstAudioSent);
     }
 }
 
@@ -742,137 +1682,137 @@ void Application::MainEventLoop() {
 void Application::AudioLoop() {
     auto codec = Board::GetInstance().GetAudioCodec();
     while (true) {
-        OnAudioInput();
+        // 入力の読み取りはRX DMAの完了までドライバ内でブロックするため、そのペースで回る
+        if (!OnAudioInput()) {
+            // 入力の消費者がいない間はポーリングせず、WakeAudioLoop()の通知まで眠る
+            // 出力の無音判定のため一定間隔では起きる
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(AUDIO_LOOP_IDLE_TIMEOUT_MS));
+        }
+#if CONFIG_USE_AUDIO_STALL_WATCHDOG
+        AudioStallWatchdog::GetInstance().EnterStage(kAudioLoopStageOutput);
+#endif
         if (codec->output_enabled()) {
             OnAudioOutput();
         }
+#if CONFIG_USE_AUDIO_STALL_WATCHDOG
+        // 入力がなかった回（待機）は計測しない
+        AudioStallWatchdog::GetInstance().EndIteration();
+#endif
     }
 }
 
-void Application::OnAudioOutput() {
-    if (busy_decoding_audio_) {
-        return;
+// ウェイクワード検出や音声処理を開始した後に呼び出し、待機中のaudio_loopを起こす
+void Application::WakeAudioLoop() {
+    if (audio_loop_task_handle_ != nullptr) {
+        xTaskNotifyGive(audio_loop_task_handle_);
     }
+}
 
-    auto now = std::chrono::steady_clock::now();
+// 再生パイプラインに対する状態依存のポリシーを適用する（デコード自体はaudio_player_が行う）
+void AUDIO_HOT_ATTR Application::OnAudioOutput() {
     auto codec = Board::GetInstance().GetAudioCodec();
     const int max_silence_seconds = 10;
 
-    std::unique_lock<std::mutex> lock(mutex_);
-    if (audio_decode_queue_.empty()) {
-        // Disable the output if there is no audio data for a long time
-        if (device_state_ == kDeviceStateIdle) {
-            auto duration = std::chrono::duration_cast<std::chrono::seconds>(now - last_output_time_).count();
-            if (duration > max_silence_seconds) {
-                codec->EnableOutput(false);
-            }
+    if (device_state_ == kDeviceStateListening) {
+        // 聞き取り中に届いた音声は破棄する
+        if (!audio_decode_queue_.empty()) {
+            audio_decode_queue_.RequestClear();
         }
         return;
     }
 
-    if (device_state_ == kDeviceStateListening) {
-        audio_decode_queue_.clear();
-        audio_decode_cv_.notify_all();
+#if CONFIG_USE_AUDIO_LOOPBACK_PROBE
+    // 計測中はOutputDataへ直接書くため、再生の時刻が更新されない
+    if (loopback_probe_.capturing()) {
         return;
     }
+#endif
 
-    auto packet = std::move(audio_decode_queue_.front());
-    audio_decode_queue_.pop_front();
-    lock.unlock();
-    audio_decode_cv_.notify_all();
-
-    busy_decoding_audio_ = true;
-    background_task_->Schedule([this, codec, packet = std::move(packet)]() mutable {
-        busy_decoding_audio_ = false;
-        if (aborted_) {
-            return;
-        }
-
-        std::vector<int16_t> pcm;
-        if (!opus_decoder_->Decode(std::move(packet.payload), pcm)) {
-            return;
-        }
-        // Resample if the sample rate is different
-        if (opus_decoder_->sample_rate() != codec->output_sample_rate()) {
-            int target_size = output_resampler_.GetOutputSamples(pcm.size());
-            std::vector<int16_t> resampled(target_size);
-            output_resampler_.Process(pcm.data(), pcm.size(), resampled.data());
-            pcm = std::move(resampled);
+    // Disable the output if there is no audio data for a long time
+    if (device_state_ == kDeviceStateIdle && audio_decode_queue_.empty() && !audio_player_.IsPlaying()) {
+        auto duration = (esp_timer_get_time() - audio_player_.last_output_time_us()) / 1000000;
+        if (duration > max_silence_seconds) {
+            codec->EnableOutput(false);
         }
-        codec->OutputData(pcm);
-#ifdef CONFIG_USE_SERVER_AEC
-            std::lock_guard<std::mutex> lock(timestamp_mutex_);
-            timestamp_queue_.push_back(packet.timestamp);
-            last_output_timestamp_ = packet.timestamp;
-#endif
-        last_output_time_ = std::chrono::steady_clock::now();
-    });
+    }
 }
 
-void Application::OnAudioInput() {
+bool Application::OnAudioInput() {
 #if CONFIG_USE_WAKE_WORD_DETECT
     if (wake_word_detect_.IsDetectionRunning()) {
-        std::vector<int16_t> data;
+        auto& data = audio_input_buffer_;
         int samples = wake_word_detect_.GetFeedSize();
         if (samples > 0) {
+#if CONFIG_USE_AUDIO_STALL_WATCHDOG
+            AudioStallWatchdog::GetInstance().BeginIteration(samples * 1000000ULL / 16000);
+#endif
             ReadAudio(data, 16000, samples);
+#if CONFIG_USE_AUDIO_STALL_WATCHDOG
+            AudioStallWatchdog::GetInstance().EnterStage(kAudioLoopStageFeed);
+#endif
             wake_word_detect_.Feed(data);
-            return;
+            return true;
         }
     }
 #endif
     if (audio_processor_->IsRunning()) {
-        std::vector<int16_t> data;
+        auto& data = audio_input_buffer_;
         int samples = audio_processor_->GetFeedSize();
         if (samples > 0) {
+#if CONFIG_USE_AUDIO_STALL_WATCHDOG
+            AudioStallWatchdog::GetInstance().BeginIteration(samples * 1000000ULL / 16000);
+#endif
             ReadAudio(data, 16000, samples);
+#if CONFIG_USE_AUDIO_STALL_WATCHDOG
+            AudioStallWatchdog::GetInstance().EnterStage(kAudioLoopStageFeed);
+#endif
             audio_processor_->Feed(data);
-            return;
+            return true;
         }
     }
-
-    vTaskDelay(pdMS_TO_TICKS(OPUS_FRAME_DURATION_MS / 2));
+    return false;
 }
 
-void Application::ReadAudio(std::vector<int16_t>& data, int sample_rate, int samples) {
+// 定常動作中にヒープ確保を行わないよう、作業バッファはすべてメンバーを再利用する
+void AUDIO_HOT_ATTR Application::ReadAudio(std::vector<int16_t>& data, int sample_rate, int samples) {
     auto codec = Board::GetInstance().GetAudioCodec();
-    if (codec->input_sample_rate() != sample_rate) {
-        data.resize(samples * codec->input_sample_rate() / sample_rate);
-        if (!codec->InputData(data)) {
+    if (input_pipeline_.converts()) {
+        auto& raw = audio_input_raw_;
+        raw.resize(samples * codec->input_sample_rate() / sample_rate);
+        if (!codec->InputData(raw.data(), raw.size())) {
             return;
         }
-        if (codec->input_channels() == 2) {
-            auto mic_channel = std::vector<int16_t>(data.size() / 2);
-            auto reference_channel = std::vector<int16_t>(data.size() / 2);
-            for (size_t i = 0, j = 0; i < mic_channel.size(); ++i, j += 2) {
-                mic_channel[i] = data[j];
-                reference_channel[i] = data[j + 1];
-            }
-            auto resampled_mic = std::vector<int16_t>(input_resampler_.GetOutputSamples(mic_channel.size()));
-            auto resampled_reference = std::vector<int16_t>(reference_resampler_.GetOutputSamples(reference_channel.size()));
-            input_resampler_.Process(mic_channel.data(), mic_channel.size(), resampled_mic.data());
-            reference_resampler_.Process(reference_channel.data(), reference_channel.size(), resampled_reference.data());
-            data.resize(resampled_mic.size() + resampled_reference.size());
-            for (size_t i = 0, j = 0; i < resampled_mic.size(); ++i, j += 2) {
-                data[j] = resampled_mic[i];
-                data[j + 1] = resampled_reference[i];
-            }
-        } else {
-            auto resampled = std::vector<int16_t>(input_resampler_.GetOutputSamples(data.size()));
-            input_resampler_.Process(data.data(), data.size(), resampled.data());
-            data = std::move(resampled);
+#if CONFIG_USE_AUDIO_LOOPBACK_PROBE
+        if (loopback_probe_.capturing()) {
+            loopback_probe_.OnCapture(raw.data(), raw.size());
         }
+#endif
+#if CONFIG_USE_AUDIO_STALL_WATCHDOG
+        AudioStallWatchdog::GetInstance().EnterStage(kAudioLoopStageConvert);
+#endif
+        TRACE_SPAN("resample");
+        input_pipeline_.Process(raw.data(), raw.size(), data);
     } else {
         data.resize(samples);
         if (!codec->InputData(data)) {
             return;
         }
+#if CONFIG_USE_AUDIO_LOOPBACK_PROBE
+        if (loopback_probe_.capturing()) {
+            loopback_probe_.OnCapture(data.data(), data.size());
+        }
+#endif
+        input_pipeline_.Process(data.data(), data.size(), data);
     }
 }
 
 void Application::AbortSpeaking(AbortReason reason) {
     ESP_LOGI(TAG, "Abort speaking");
-    aborted_ = true;
+    audio_player_.SetMuted(true);
+#if CONFIG_USE_TTS_CACHE
+    // 途中で止めた文は保存しない
+    tts_cache_.CancelRecording();
+#endif
     protocol_->SendAbortSpeaking(reason);
 }
 
@@ -881,27 +1821,263 @@ void Application::SetListeningMode(ListeningMode mode) {
     SetDeviceState(kDeviceStateListening);
 }
 
+void Application::SetUplinkFrameDuration(int duration_ms) {
+    if (duration_ms == uplink_frame_duration_) {
+        return;
+    }
+    ESP_LOGI(TAG, "Uplink frame duration: %d ms -> %d ms", uplink_frame_duration_, duration_ms);
+    uplink_frame_duration_ = duration_ms;
+    uplink_frame_samples_ = 16000 * duration_ms / 1000;
+    // 保持時間が変わらないようキューの上限もフレーム長に合わせる
+    audio_send_queue_.SetLimit(AUDIO_QUEUE_DURATION_MS / duration_ms);
+    background_task_->Schedule([this, duration_ms]() {
+        // 古いフレーム長でためたフレームはEncode()で捨てられる。演算量とDTXは引き継がれる
+        uplink_encoder_.SetFrameDuration(duration_ms);
+    }, &encode_group_);
+}
+
+// 文の表示: 逐次表示が有効なら最初の1文字で気泡を作り、以降は再生位置に合わせて追記する
+void Application::HandleTts(const char* state, const char* text, const char* id) {
+    if (strcmp(state, "start") == 0) {
+        LatencyTrace::GetInstance().Mark(kLatencyTtsStart);
+        Schedule([this]() {
+            audio_player_.SetMuted(false);
+            // 最初の音声フレームより前にアンプを開いておく（待機から直接話し始める場合）
+            Board::GetInstance().GetAudioCodec()->WarmOutput();
+            if (device_state_ == kDeviceStateIdle || device_state_ == kDeviceStateListening) {
+                SetDeviceState(kDeviceStateSpeaking);
+            }
+        });
+    } else if (strcmp(state, "stop") == 0) {
+#if CONFIG_USE_TTS_CACHE
+        tts_cache_.EndRecording();
+        tts_cache_skipping_ = false;
+#endif
+        Schedule([this]() {
+            LatencyTrace::GetInstance().LogSession();
+            if (device_state_ == kDeviceStateSpeaking) {
+                if (listening_mode_ == kListeningModeManualStop) {
+                    SetDeviceState(kDeviceStateIdle);
+                } else {
+                    SetDeviceState(kDeviceStateListening);
+                }
+            }
+        });
+    } else if (strcmp(state, "sentence_start") == 0 && text != nullptr) {
+        ESP_LOGI(TAG, "<< %s", text);
+#if CONFIG_USE_TTS_CACHE
+        HandleTtsCache(text, id);
+#endif
+        Schedule([this, message = std::string(text)]() {
+            ShowAssistantSentence(message);
+        }, kSchedulePriorityUi);
+    }
+}
+
+#if CONFIG_USE_TTS_CACHE
+// 文の区切りで呼ぶ（受信タスク）。音声は文の開始メッセージの後に届くため、ここで記録先を切り替える
+void Application::HandleTtsCache(const char* text, const char* id) {
+    tts_cache_.EndRecording();
+    tts_cache_skipping_ = false;
+    if (!protocol_->tts_cache_enabled() || strlen(text) > CONFIG_TTS_CACHE_MAX_TEXT_BYTES) {
+        return;
+    }
+
+    auto key = id != nullptr ? std::string(id) : TtsCache::MakeKey(text);
+    bool hit = tts_cache_.Play(key, protocol_->server_sample_rate(), [this](const AudioStreamView& view) {
+        std::lock_guard<PriorityMutex> lock(audio_decode_mutex_);
+        if (!audio_player_.Enqueue(view)) {
+            incoming_dropped_++;
+        }
+    });
+    if (hit) {
+        // この文の音声はサーバーに省略してもらい、届いた分は捨てる
+        ESP_LOGI(TAG, "TTS cache hit: %s", key.c_str());
+        protocol_->SendTtsCached(key);
+        tts_cache_skipping_ = true;
+    } else {
+        tts_cache_.BeginRecording(key, protocol_->server_sample_rate());
+    }
+}
+#endif
+
+#if CONFIG_USE_CONTROL_MESSAGE_QUEUE
+void Application::PostControlMessage(const cJSON* item, std::function<void(const cJSON*)> handler) {
+    auto pool = control_task_;
+    if (pool == nullptr) {
+        // アップグレード中はワーカーがないため、従来どおり受信タスクで処理する
+        handler(item);
+        return;
+    }
+    // 本文を受信タスクのアリーナの外へ書き出す。再利用バッファに入らない場合だけヒープに確保する
+    size_t length = 0;
+    const char* text = control_message_buffer_.Write(item, length);
+    std::string fallback;
+    if (text == nullptr) {
+        auto printed = cJSON_PrintUnformatted(item);
+        if (printed == nullptr) {
+            return;
+        }
+        fallback = printed;
+        cJSON_free(printed);
+        control_buffer_fallbacks_++;
+    }
+    int64_t posted_us = esp_timer_get_time();
+    pool->Schedule([this, text, length, fallback = std::move(fallback), handler = std::move(handler), posted_us]() {
+        uint32_t delay_us = esp_timer_get_time() - posted_us;
+        if (delay_us > control_max_delay_us_.load(std::memory_order_relaxed)) {
+            control_max_delay_us_.store(delay_us, std::memory_order_relaxed);
+        }
+        TRACE_SPAN("control_message");
+        JSON_ARENA_SCOPE(control_json_arena_);
+        cJSON* root;
+        if (text != nullptr) {
+            // バッファ上の本文をそのまま解析し、解析が済んだら領域を返す（ノードは文字列を複製して持つ）
+            root = cJSON_ParseWithLength(text, length);
+            control_message_buffer_.Release(length);
+        } else {
+            root = cJSON_Parse(fallback.c_str());
+        }
+        if (root != nullptr) {
+            handler(root);
+            cJSON_Delete(root);
+        }
+    }, &control_group_);
+}
+#endif
+
+void Application::HandleStt(const std::string& text) {
+    ESP_LOGI(TAG, ">> %s", text.c_str());
+    Schedule([text]() {
+        auto display = Board::GetInstance().GetDisplay();
+        display->PostChatMessage("user", text.c_str());
+    }, kSchedulePriorityUi);
+}
+
+void Application::HandleLlmEmotion(const std::string& emotion) {
+    Schedule([emotion]() {
+        auto display = Board::GetInstance().GetDisplay();
+        display->PostEmotion(emotion.c_str());
+    }, kSchedulePriorityUi);
+}
+
+void Application::ShowAssistantSentence(const std::string& text) {
+    auto display = Board::GetInstance().GetDisplay();
+#if CONFIG_USE_CHAT_TEXT_REVEAL
+    auto codec = Board::GetInstance().GetAudioCodec();
+    chat_text_reveal_.Start(display, text, audio_player_.played_samples(), codec->output_sample_rate());
+    if (chat_text_reveal_.active() && !esp_timer_is_active(text_reveal_timer_)) {
+        esp_timer_start_periodic(text_reveal_timer_, TEXT_REVEAL_INTERVAL_MS * 1000);
+    }
+#else
+    display->PostChatMessage("assistant", text.c_str());
+#endif
+}
+
+void Application::FinishAssistantSentence() {
+#if CONFIG_USE_CHAT_TEXT_REVEAL
+    chat_text_reveal_.Finish();
+    esp_timer_stop(text_reveal_timer_);
+#endif
+}
+
+void Application::StartListeningInput() {
+    if (audio_processor_->IsRunning()) {
+        return;
+    }
+    // エンコーダはフレーム長の変更で作り直されることがあるため、エンコードと同じグループで操作する
+    background_task_->Schedule([this]() {
+        uplink_encoder_.ResetState();
+    }, &encode_group_);
+#if CONFIG_USE_WAKE_WORD_DETECT
+    wake_word_detect_.StopDetection();
+#endif
+    audio_processor_->Start();
+}
+
 void Application::SetDeviceState(DeviceState state) {
     if (device_state_ == state) {
         return;
     }
+#if CONFIG_USE_CHAT_TEXT_REVEAL
+    if (device_state_ == kDeviceStateSpeaking) {
+        // 再生が止まるため、表示しきれていない文字を出す
+        Schedule([this]() {
+            FinishAssistantSentence();
+        }, kSchedulePriorityUi);
+    }
+#endif
     
     clock_ticks_ = 0;
     auto previous_state = device_state_;
     device_state_ = state;
+#if CONFIG_USE_SESSION_CHANNEL_REUSE
+    session_idle_since_us_ = state == kDeviceStateIdle ? esp_timer_get_time() : 0;
+#endif
     ESP_LOGI(TAG, "STATE: %s", STATE_STRINGS[device_state_]);
-    // The state is changed, wait for all background tasks to finish
-    background_task_->WaitForCompletion();
+#if CONFIG_USE_FLIGHT_RECORDER
+    FlightRecorder::GetInstance().Record(kFlightEventState, previous_state, state);
+#endif
+    if (state == kDeviceStateIdle) {
+        xEventGroupSetBits(event_group_, DEVICE_IDLE_EVENT);
+    } else {
+        xEventGroupClearBits(event_group_, DEVICE_IDLE_EVENT);
+    }
+    // 待機せずに上りストリームの世代を進め、遷移前に投入されたエンコードジョブを自ら破棄させる
+    uplink_epoch_++;
 
     auto& board = Board::GetInstance();
     auto display = board.GetDisplay();
     auto led = board.GetLed();
     led->OnStateChanged();
+
+#if CONFIG_USE_LOCAL_COMMAND
+    if (state != kDeviceStateListening) {
+        local_command_detect_.Stop();
+    }
+#endif
+#if CONFIG_USE_LOCAL_ENDPOINTING
+    if (state != kDeviceStateListening) {
+        audio_processor_->SetEndpointing(false);
+    }
+#endif
+
+#if CONFIG_USE_WAKE_WORD_ENERGY_GATE
+    // 待機中だけ音量ゲートでWakeNetを止める（発話中の割り込み検出では使わない）
+    wake_word_detect_.SetEnergyGate(state == kDeviceStateIdle);
+#endif
+
+    // 通信の省電力方針とCPU周波数：待機中だけ下げ、会話中は遅延とスループットを優先する
+    switch (state) {
+        case kDeviceStateIdle:
+            BootProfile::GetInstance().Mark(kBootFirstIdle);
+            // 会話中に変えた音量などの設定は、待ち受けに入ったところで書き出す
+            Settings::Flush();
+            board.SetNetworkPowerProfile(kNetworkPowerSave);
+            PowerProfile::GetInstance().SetActive(false);
+            break;
+        case kDeviceStateConnecting:
+        case kDeviceStateListening:
+        case kDeviceStateActivating:
+            board.SetNetworkPowerProfile(kNetworkPowerLowLatency);
+            PowerProfile::GetInstance().SetActive(true);
+            break;
+        case kDeviceStateSpeaking:
+        case kDeviceStateUpgrading:
+            board.SetNetworkPowerProfile(kNetworkPowerThroughput);
+            PowerProfile::GetInstance().SetActive(true);
+            break;
+        default:
+            break;
+    }
+
     switch (state) {
         case kDeviceStateUnknown:
         case kDeviceStateIdle:
-            display->SetStatus(Lang::Strings::STANDBY);
-            display->SetEmotion("neutral");
+            display->PostStatus(Lang::Strings::STANDBY);
+            display->PostEmotion("neutral");
+            // 接続の確立や切断の後はここに戻るため、ネットワークアイコンを読み直す
+            display->PostStatusBarUpdate(true);
             audio_processor_->Stop();
             
 #if CONFIG_USE_WAKE_WORD_DETECT
@@ -909,16 +2085,28 @@ void Application::SetDeviceState(DeviceState state) {
 #endif
             break;
         case kDeviceStateConnecting:
-            display->SetStatus(Lang::Strings::CONNECTING);
-            display->SetEmotion("neutral");
-            display->SetChatMessage("system", "");
-            timestamp_queue_.clear();
+            display->PostStatus(Lang::Strings::CONNECTING);
+            display->PostEmotion("neutral");
+            display->PostChatMessage("system", "");
+#if CONFIG_USE_SERVER_AEC
+            server_aec_aligner_.Reset();
+#endif
             last_output_timestamp_ = 0;
+            // 会話の間は出力を開いたまま消音しておき、応答の再生をすぐ始められるようにする
+            board.GetAudioCodec()->WarmOutput();
+#if CONFIG_USE_ADAPTIVE_OPUS_ENCODER
+            // 新しいセッションは初期設定から始める
+            encoder_controller_.Reset();
+            background_task_->Schedule([this, complexity = encoder_controller_.complexity()]() {
+                uplink_encoder_.SetComplexity(complexity);
+                uplink_encoder_.SetDtx(false);
+            }, &encode_group_);
+#endif
             break;
         case kDeviceStateListening:
-            display->SetStatus(Lang::Strings::LISTENING);
-            display->SetEmotion("neutral");
-            // Update the IoT states before sending the start listening command
+            display->PostStatus(Lang::Strings::LISTENING);
+            display->PostEmotion("neutral");
+            // Send the IoT state changes already read on notification before the start listening command
 #if CONFIG_IOT_PROTOCOL_XIAOZHI
             UpdateIotStates();
 #endif
@@ -928,18 +2116,26 @@ void Application::SetDeviceState(DeviceState state) {
                 // Send the start listening command
                 protocol_->SendStartListening(listening_mode_);
                 if (previous_state == kDeviceStateSpeaking) {
-                    // FIXME: Wait for the speaker to empty the buffer
-                    vTaskDelay(pdMS_TO_TICKS(120));
+                    // スピーカーに残った音を拾わないよう、メインループを止めずに入力の開始を遅らせる
+                    ScheduleAfter(LISTEN_AFTER_SPEAKING_DELAY_MS, [this, epoch = uplink_epoch_.load()]() {
+                        if (uplink_epoch_ == epoch) {
+                            StartListeningInput();
+                        }
+                    }, kSchedulePriorityAudio);
+                } else {
+                    StartListeningInput();
                 }
-                opus_encoder_->ResetState();
-#if CONFIG_USE_WAKE_WORD_DETECT
-                wake_word_detect_.StopDetection();
-#endif
-                audio_processor_->Start();
             }
+#if CONFIG_USE_LOCAL_ENDPOINTING
+            audio_processor_->SetEndpointing(listening_mode_ == kListeningModeAutoStop);
+#endif
+#if CONFIG_USE_WAKE_WORD_BARGE_IN && CONFIG_USE_SHARED_AUDIO_FRONTEND
+            // リアルタイムモードで再生中に動かしていたWakeNetを止める
+            wake_word_detect_.StopDetection();
+#endif
             break;
         case kDeviceStateSpeaking:
-            display->SetStatus(Lang::Strings::SPEAKING);
+            display->PostStatus(Lang::Strings::SPEAKING);
 
             if (listening_mode_ != kListeningModeRealtime) {
                 audio_processor_->Stop();
@@ -947,45 +2143,36 @@ void Application::SetDeviceState(DeviceState state) {
                 wake_word_detect_.StartDetection();
 #endif
             }
+#if CONFIG_USE_WAKE_WORD_BARGE_IN && CONFIG_USE_SHARED_AUDIO_FRONTEND
+            else if (board.GetAudioCodec()->input_reference()) {
+                // 共有フロントエンドなら音声処理を止めずに、AEC済みの音声でWakeNetも動かせる
+                wake_word_detect_.StartDetection();
+            }
+#endif
             ResetDecoder();
             break;
         default:
             // Do nothing
             break;
     }
+    // 入力の消費者が変わった可能性があるため、待機中のaudio_loopを起こす
+    WakeAudioLoop();
 }
 
 void Application::ResetDecoder() {
-    std::lock_guard<std::mutex> lock(mutex_);
-    opus_decoder_->ResetState();
-    audio_decode_queue_.clear();
-    audio_decode_cv_.notify_all();
-    last_output_time_ = std::chrono::steady_clock::now();
-    auto codec = Board::GetInstance().GetAudioCodec();
-    codec->EnableOutput(true);
-}
-
-void Application::SetDecodeSampleRate(int sample_rate, int frame_duration) {
-    if (opus_decoder_->sample_rate() == sample_rate && opus_decoder_->duration_ms() == frame_duration) {
-        return;
-    }
-
-    opus_decoder_.reset();
-    opus_decoder_ = std::make_unique<OpusDecoderWrapper>(sample_rate, 1, frame_duration);
-
+    audio_decode_queue_.RequestClear();
+    audio_player_.Reset();
+    // 消音したまま準備し、最初のフレームで解除する（アンプの起動を再生の頭に重ねない）
     auto codec = Board::GetInstance().GetAudioCodec();
-    if (opus_decoder_->sample_rate() != codec->output_sample_rate()) {
-        ESP_LOGI(TAG, "Resampling audio from %d to %d", opus_decoder_->sample_rate(), codec->output_sample_rate());
-        output_resampler_.Configure(opus_decoder_->sample_rate(), codec->output_sample_rate());
-    }
+    codec->WarmOutput();
+    audio_player_.Notify();
 }
 
 void Application::UpdateIotStates() {
 #if CONFIG_IOT_PROTOCOL_XIAOZHI
     auto& thing_manager = iot::ThingManager::GetInstance();
-    std::string states;
-    if (thing_manager.GetStatesJson(states, true)) {
-        protocol_->SendIotStates(states);
+    if (thing_manager.UpdateStatesJson(true)) {
+        protocol_->SendIotStates(thing_manager.states_json());
     }
 #endif
 }
@@ -1006,16 +2193,50 @@ void Application::WakeWordInvoke(const std::string& wake_word) {
     } else if (device_state_ == kDeviceStateSpeaking) {
         Schedule([this]() {
             AbortSpeaking(kAbortReasonNone);
-        });
+        }, kSchedulePriorityAudio);
     } else if (device_state_ == kDeviceStateListening) {   
         Schedule([this]() {
             if (protocol_) {
-                protocol_->CloseAudioChannel();
+                EndConversationTurn();
             }
         });
     }
 }
 
+bool Application::ReuseSessionChannel() {
+#if CONFIG_USE_SESSION_CHANNEL_REUSE
+    if (protocol_ && protocol_->IsAudioChannelOpened()) {
+        // hello済みのチャンネルと音声パラメータをそのまま使い、listen startだけで次のターンを始める
+        ESP_LOGI(TAG, "Reusing the session audio channel");
+        return true;
+    }
+#endif
+    return false;
+}
+
+void Application::EndConversationTurn() {
+#if CONFIG_USE_SESSION_CHANNEL_REUSE
+    // 聞き取りだけ止め、チャンネルは次のターンのために一定時間残す（OnClockTimerで閉じる）
+    protocol_->SendStopListening();
+    SetDeviceState(kDeviceStateIdle);
+#else
+    protocol_->CloseAudioChannel();
+#endif
+}
+
+void Application::SetClockInterval(int seconds) {
+    if (seconds == clock_interval_) {
+        return;
+    }
+    clock_interval_ = seconds;
+    // Start()より前なら、Start()がこの間隔で開始する
+    if (esp_timer_is_active(clock_timer_handle_)) {
+        esp_timer_stop(clock_timer_handle_);
+        esp_timer_start_periodic(clock_timer_handle_, seconds * 1000000LL);
+    }
+    ESP_LOGI(TAG, "Clock interval: %d s", seconds);
+}
+
 bool Application::CanEnterSleepMode() {
     if (device_state_ != kDeviceStateIdle) {
         return false;
@@ -1036,3 +2257,53 @@ void Application::SendMcpMessage(const std::string& payload) {
         }
     });
 }
+
+#if CONFIG_USE_SPECULATIVE_CHANNEL_OPEN
+void Application::SpeculativeOpenAudioChannel() {
+    if (device_state_ != kDeviceStateIdle || !protocol_) {
+        return;
+    }
+    int64_t now = esp_timer_get_time();
+    if (now - speculative_hour_start_us_ >= 3600LL * 1000000) {
+        speculative_hour_start_us_ = now;
+        speculative_opens_ = 0;
+    }
+    if (speculative_opens_ >= CONFIG_SPECULATIVE_OPEN_MAX_PER_HOUR) {
+        ESP_LOGD(TAG, "Speculative open budget exhausted");
+        return;
+    }
+    if (!protocol_->PrewarmAudioChannel(CONFIG_SPECULATIVE_OPEN_WINDOW_SECONDS)) {
+        return;
+    }
+    speculative_opens_++;
+    speculative_open_us_ = now;
+#if CONFIG_USE_METRICS
+    metric_speculative_opens.Increment();
+#endif
+    ESP_LOGI(TAG, "Speech onset, opening connection ahead of the wake word (%d/%d this hour)",
+        speculative_opens_, CONFIG_SPECULATIVE_OPEN_MAX_PER_HOUR);
+}
+
+void Application::RecordSpeculativeHit() {
+    if (speculative_open_us_ == 0) {
+        return;
+    }
+    int64_t elapsed_ms = (esp_timer_get_time() - speculative_open_us_) / 1000;
+    speculative_open_us_ = 0;
+    if (elapsed_ms >= CONFIG_SPECULATIVE_OPEN_WINDOW_SECONDS * 1000) {
+        return;
+    }
+#if CONFIG_USE_METRICS
+    metric_speculative_hits.Increment();
+#endif
+    ESP_LOGI(TAG, "Wake word %lld ms after speculative open", elapsed_ms);
+}
+#endif
+
+void Application::SetStandbyAllowed(bool allowed) {
+    Schedule([this, allowed]() {
+        if (protocol_) {
+            protocol_->SetStandbyAllowed(allowed);
+        }
+    });
+}
@@ -13,31 +13,62 @@
 #include <freertos/event_groups.h>
 #include <freertos/task.h>
 #include <esp_timer.h>
+#include <esp_pm.h>
 
 #include <string>
 #include <mutex>
 #include <list>
 #include <vector>
-#include <condition_variable>
 #include <memory>
 
-#include <opus_encoder.h>
 #include <opus_decoder.h>
-#include <opus_resampler.h>
 
 #include "protocol.h"
 #include "ota.h"
 #include "background_task.h"
+#include "main_task_scheduler.h"
+#include "priority_mutex.h"
+#include "audio_packet_queue.h"
+#include "audio_player.h"
 #include "audio_processor.h"
+#include "audio_dsp.h"
+#include "audio_pipeline.h"
+#include "encoder_controller.h"
+#include "server_aec_aligner.h"
+#include "opus_stream_encoder.h"
+#include "chat_text_reveal.h"
+#if CONFIG_USE_CONTROL_MESSAGE_QUEUE
+#include "control_message_buffer.h"
+#endif
+#if CONFIG_USE_TTS_CACHE
+#include "tts_cache.h"
+#endif
+#if CONFIG_USE_AUDIO_LOOPBACK_PROBE
+#include "audio_loopback_probe.h"
+#endif
+#if CONFIG_USE_NET_BENCHMARK
+#include "net_benchmark.h"
+#endif
 
 #if CONFIG_USE_WAKE_WORD_DETECT
 #include "wake_word_detect.h"
+#if CONFIG_USE_LOCAL_COMMAND
+#include "local_command_detect.h"
+#endif
 #endif
 
 // FreeRTOSイベント群のビットマスク定義
 #define SCHEDULE_EVENT (1 << 0)                // タスクスケジューリングイベント
-#define SEND_AUDIO_EVENT (1 << 1)              // 音声送信イベント
 #define CHECK_NEW_VERSION_DONE_EVENT (1 << 2)  // バージョンチェック完了イベント
+#define AUDIO_FRONTEND_READY_EVENT (1 << 3)    // AFE/WakeNetの初期化完了イベント
+#define DEVICE_IDLE_EVENT (1 << 4)             // 待機状態の間だけ立つ
+#define UPGRADE_READY_EVENT (1 << 5)           // メインループがアップグレード状態へ切り替えた
+
+// 応答の再生から聞き取りへ移るとき、スピーカーに残った音を拾わないよう入力の開始を遅らせる時間（ミリ秒）
+#define LISTEN_AFTER_SPEAKING_DELAY_MS 120
+
+// 省電力スリープ中の時計タイマーの間隔（秒）。ステータスバーの時刻は分単位なので遅れは目立たない
+#define CLOCK_SLEEP_INTERVAL_SECONDS 10
 
 /**
  * @enum DeviceState
@@ -57,8 +88,33 @@ enum DeviceState {
 };
 
 // Opus音声エンコーディング設定
-#define OPUS_FRAME_DURATION_MS 60                           // Opusフレーム持続時間（ミリ秒）
-#define MAX_AUDIO_PACKETS_IN_QUEUE (2400 / OPUS_FRAME_DURATION_MS)  // キューの最大音声パケット数
+#define OPUS_FRAME_DURATION_MS 60                           // 既定のOpusフレーム持続時間（ミリ秒、ウェイクワード・音声アセット）
+#define MIN_OPUS_FRAME_DURATION_MS 20                       // 上りで選択できる最短のフレーム持続時間
+#define AUDIO_QUEUE_DURATION_MS 2400                        // キューに保持する音声の最大時間（ミリ秒）
+#define MAX_AUDIO_PACKETS_IN_QUEUE (AUDIO_QUEUE_DURATION_MS / OPUS_FRAME_DURATION_MS)  // 既定フレーム長でのキューの最大音声パケット数
+
+// audio_loopが入力の消費者を待つ間の最大スリープ時間（出力の無音判定の間隔）
+#define AUDIO_LOOP_IDLE_TIMEOUT_MS 1000
+
+// 送信待ちの音声がこの時間分を超えたら古いものから捨てて追いつく（回線の停滞後）
+#define AUDIO_SEND_MAX_BACKLOG_MS 1200
+
+// TTS再生に合わせてチャット文字列を追記する間隔
+#define TEXT_REVEAL_INTERVAL_MS 100
+
+/**
+ * @struct AudioQueueStats
+ * @brief 音声キューの統計（リプレイ計測・診断用）
+ */
+struct AudioQueueStats {
+    size_t decode_queue_depth;      // 受信キューの現在の深さ
+    size_t decode_queue_max;        // 受信キューの最大深さ
+    size_t send_queue_depth;        // 送信キューの現在の深さ
+    uint32_t incoming_dropped;      // 受信キューが満杯で捨てたパケット数
+    uint32_t outgoing_dropped;      // 送信キューが満杯で捨てたパケット数
+    uint32_t underruns;             // 再生のアンダーラン回数
+    uint32_t late_packets;          // 再生に間に合わなかったパケット数
+};
 
 /**
  * @class Application
@@ -84,7 +140,14 @@ public:
     void Start();
     DeviceState GetDeviceState() const { return device_state_; }
     bool IsVoiceDetected() const { return voice_detected_; }
-    void Schedule(std::function<void()> callback);
+    void Schedule(TaskFunction callback, SchedulePriority priority = kSchedulePriorityProtocol);
+    /**
+     * @brief delay_ms後にメインループでタスクを実行
+     *
+     * メインループで待つ代わりに継続として登録します。待っている間もメインループは
+     * ほかのタスクを処理します。実行時に状態が変わっていないかは呼び出し側で確認してください。
+     */
+    void ScheduleAfter(uint32_t delay_ms, TaskFunction callback, SchedulePriority priority = kSchedulePriorityProtocol);
     void SetDeviceState(DeviceState state);
     void Alert(const char* status, const char* message, const char* emotion = "", const std::string_view& sound = "");
     void DismissAlert();
@@ -95,9 +158,51 @@ public:
     void UpdateIotStates();
     void Reboot();
     void WakeWordInvoke(const std::string& wake_word);
-    void PlaySound(const std::string_view& sound);
+    void PlaySound(const std::string_view& sound, AudioVoice voice = kAudioVoiceNotification);
     bool CanEnterSleepMode();
+    /**
+     * @brief 時計タイマーの間隔を変更（定期処理はすべてこのタイマーにまとめている）
+     * @param seconds 間隔（秒）。省電力スリープ中はCLOCK_SLEEP_INTERVAL_SECONDSに延ばす
+     */
+    void SetClockInterval(int seconds);
     void SendMcpMessage(const std::string& payload);
+    void SetStandbyAllowed(bool allowed);
+#if CONFIG_USE_WAKE_WORD_DETECT
+    WakeWordDetect& GetWakeWordDetect() { return wake_word_detect_; }
+#endif
+    AudioQueueStats GetAudioQueueStats() const;
+
+    /**
+     * @brief 入力AGCと出力リミッターを切り替え（設定に保存）
+     * @return 入力AGCに対応していない場合false（リミッターは切り替える）
+     */
+    bool SetLevelControl(bool input_agc, bool output_limiter);
+    /** @brief 入力AGCと出力リミッターの状態とリミッターのCPU負荷をJSONで返す */
+    std::string GetLevelControlJson();
+#if CONFIG_USE_AUDIO_LOOPBACK_PROBE
+    /**
+     * @brief 掃引音を再生して、スピーカーからマイクまでの遅延・リファレンスのずれ・ERLEを測る
+     *
+     * 約3秒ブロックするため、MCPツールのタスクなどメインタスク以外から呼びます。
+     * ボタンから使う場合はStartAudioLoopbackMeasurement()を使います。
+     * @return 結果のJSON
+     */
+    std::string MeasureAudioLoopback();
+    /** @brief バックグラウンドで計測して結果をログに出力 */
+    void StartAudioLoopbackMeasurement();
+#endif
+#if CONFIG_USE_NET_BENCHMARK
+    /**
+     * @brief サーバーとの往復遅延・ジッタ・損失と上下のスループットを測り、画面に通知する
+     *
+     * 十数秒ブロックするため、メインタスク以外から呼びます。待機中で音声チャンネルが
+     * 閉じていれば計測の間だけ開きます。実行中は会話の音声を送受信しません。
+     * @return 結果のJSON
+     */
+    std::string RunNetBenchmark();
+    /** @brief バックグラウンドで計測（ボタン用） */
+    void StartNetBenchmark();
+#endif
 
 private:
     Application();
@@ -105,14 +210,20 @@ private:
 
 #if CONFIG_USE_WAKE_WORD_DETECT
     WakeWordDetect wake_word_detect_;
+#endif
+#if CONFIG_USE_LOCAL_COMMAND
+    LocalCommandDetect local_command_detect_;   // ウェイクワード直後の端末上コマンド認識
 #endif
     std::unique_ptr<AudioProcessor> audio_processor_;
     Ota ota_;
-    std::mutex mutex_;
-    std::list<std::function<void()>> main_tasks_;
+    MainTaskScheduler main_tasks_;          // 優先度付きのメインタスクキュー
     std::unique_ptr<Protocol> protocol_;
     EventGroupHandle_t event_group_ = nullptr;
     esp_timer_handle_t clock_timer_handle_ = nullptr;
+#if CONFIG_USE_CHAT_TEXT_REVEAL
+    esp_timer_handle_t text_reveal_timer_ = nullptr;
+    ChatTextReveal chat_text_reveal_;           // 再生中の文の逐次表示（メインタスク専用）
+#endif
     volatile DeviceState device_state_ = kDeviceStateUnknown;
     ListeningMode listening_mode_ = kListeningModeAutoStop;
 #if CONFIG_USE_DEVICE_AEC || CONFIG_USE_SERVER_AEC
@@ -120,43 +231,144 @@ private:
 #else
     bool realtime_chat_enabled_ = false;
 #endif
-    bool aborted_ = false;
     bool voice_detected_ = false;
-    bool busy_decoding_audio_ = false;
-    int clock_ticks_ = 0;
+    int clock_ticks_ = 0;                   // 最後の状態遷移からの秒数
+    volatile int clock_interval_ = 1;       // 時計タイマーの間隔（秒）
+    bool server_time_restored_ = false;  // 温起動で前回同期したシステム時刻が残っている
     TaskHandle_t check_new_version_task_handle_ = nullptr;
 
     // Audio encode / decode
     TaskHandle_t audio_loop_task_handle_ = nullptr;
-    BackgroundTask* background_task_ = nullptr;
-    std::chrono::steady_clock::time_point last_output_time_;
-    std::list<AudioStreamPacket> audio_send_queue_;
-    std::list<AudioStreamPacket> audio_decode_queue_;
-    std::condition_variable audio_decode_cv_;
-
-    // 追加：音声パケットのタイムスタンプキューを維持するため
-    std::list<uint32_t> timestamp_queue_;
-    std::mutex timestamp_mutex_;
+    TaskHandle_t audio_send_task_handle_ = nullptr;  // 上り音声の送信（ブロックする書き込みをメインタスクから切り離す）
+    BackgroundTaskPool* background_task_ = nullptr;
+    BackgroundTaskGroup encode_group_{"encode", true};  // 上りOpusエンコード（エンコーダを操作する処理は必ずこのグループで実行）
+    esp_pm_lock_handle_t encode_pm_lock_ = nullptr;     // DFS有効時、エンコード中だけCPUを最大周波数に保つ
+    std::atomic<uint32_t> uplink_epoch_{0};     // 上りストリームの世代（状態遷移ごとに進める）
+    std::atomic<uint32_t> incoming_dropped_{0}; // 受信キューが満杯で捨てたパケット数
+    std::atomic<uint32_t> outgoing_dropped_{0}; // 送信キューが満杯で捨てたパケット数
+    // 送信キュー: 生産者=エンコーダ（background_task_）、消費者=MainEventLoop
+    // 容量は最短フレーム長で確保し、実際の上限はフレーム長に合わせてSetLimit()で調整する
+    AudioPacketQueue audio_send_queue_{AUDIO_QUEUE_DURATION_MS / MIN_OPUS_FRAME_DURATION_MS};
+    // 受信キュー: 生産者=プロトコル受信、消費者=audio_player_（通知音はaudio_player_が直接再生する）
+    // 容量は一時的に広げられる最大値で確保し、通常の上限はaudio_player_が管理する
+    AudioPacketQueue audio_decode_queue_{AUDIO_PLAYER_QUEUE_MAX_MS / MIN_OPUS_FRAME_DURATION_MS};
+#if CONFIG_USE_TTS_CACHE
+    // 受信キューへのPushの排他（キャッシュの再生はMQTTではJSONの受信タスクから積むため生産者が2つになる）
+    PriorityMutex audio_decode_mutex_{"audio_decode"};
+    TtsCache tts_cache_;                        // 短い応答の下り音声（記録と再生は受信タスク）
+    std::atomic<bool> tts_cache_skipping_{false};   // キャッシュから再生中の文の受信音声を捨てる
+#endif
+#if CONFIG_USE_CONTROL_MESSAGE_QUEUE
+    // 受信タスクから渡されたMCP・IoTなどの制御メッセージを受信順に1件ずつ処理する
+    // ツールが設定（NVS）を読み書きするため、スタックが内部SRAMにある専用のワーカーで実行する
+    BackgroundTaskPool* control_task_ = nullptr;
+    BackgroundTaskGroup control_group_{"control", true};
+    JsonArena control_json_arena_{"control"};   // 制御メッセージの解析と処理（control_group_）
+    std::atomic<uint32_t> control_max_delay_us_{0}; // 受信から処理開始までの最長時間
+    // 制御メッセージの本文（受信タスクが書き、control_group_が解析して返す）
+    ControlMessageBuffer control_message_buffer_{CONFIG_CONTROL_MESSAGE_BUFFER_KB * 1024};
+    std::atomic<uint32_t> control_buffer_fallbacks_{0}; // バッファに入らずヒープへ確保した件数
+#endif
+    AudioStreamPacket audio_send_batch_[AUDIO_BATCH_MAX_FRAMES];  // 送信タスク用の再利用パケット
+    // 送信タスクの統計（10秒ごとに出力してリセット）
+    std::atomic<uint32_t> send_packets_{0};     // 送信したパケット数
+    std::atomic<uint32_t> send_messages_{0};    // 送信したメッセージ数（一括送信は1件）
+    std::atomic<uint32_t> send_failures_{0};    // 送信に失敗したメッセージ数
+    std::atomic<uint32_t> send_trimmed_{0};     // 遅延の上限を超えて捨てた古いパケット数
+    std::atomic<uint32_t> send_max_us_{0};      // 1回の送信にかかった最長時間
+    AudioPlayer audio_player_{audio_decode_queue_};  // デコード・再生パイプライン
+
+#if CONFIG_USE_SERVER_AEC
+    // 再生中の下りパケットのタイムスタンプを上りフレームへ付ける（デコードタスク→エンコードグループ）
+    ServerAecAligner server_aec_aligner_;
+#endif
     std::atomic<uint32_t> last_output_timestamp_ = 0;
+#if CONFIG_USE_AUDIO_LOOPBACK_PROBE
+    AudioLoopbackProbe loopback_probe_;     // 遅延・AECの計測（記録中は上りへ送らない）
+#endif
+#if CONFIG_USE_NET_BENCHMARK
+    NetBenchmark net_benchmark_;            // 回線の計測（実行中は会話の音声を送受信しない）
+#endif
+#if CONFIG_USE_SPECULATIVE_CHANNEL_OPEN
+    // 先行接続（メインタスク専用）
+    int64_t speculative_open_us_ = 0;           // 最後に先行接続を始めた時刻（0は未使用）
+    int64_t speculative_hour_start_us_ = 0;     // 回数を数えている1時間の始まり
+    int speculative_opens_ = 0;                 // この1時間に始めた先行接続の数
+#endif
+#if CONFIG_USE_SESSION_CHANNEL_REUSE
+    int64_t session_idle_since_us_ = 0;         // ターンが終わり待機に入った時刻（0は対象外、メインタスク専用）
+#endif
 
-    std::unique_ptr<OpusEncoderWrapper> opus_encoder_;
-    std::unique_ptr<OpusDecoderWrapper> opus_decoder_;
+    // 上りエンコーダ: 生産者=音声処理の出力コールバック、消費者=encode_group_
+    OpusStreamEncoder uplink_encoder_;
+    EncoderController encoder_controller_;      // 回線品質に応じたエンコーダ設定の調整
+    int uplink_frame_duration_ = CONFIG_UPLINK_FRAME_DURATION_MS;  // 現在のエンコーダのフレーム長
+    std::atomic<size_t> uplink_frame_samples_{16000 * CONFIG_UPLINK_FRAME_DURATION_MS / 1000};
+    uint32_t uplink_stream_epoch_ = 0;          // リングにためている音声の世代（出力コールバック専用）
 
-    OpusResampler input_resampler_;
-    OpusResampler reference_resampler_;
-    OpusResampler output_resampler_;
+    // コーデックの入力を16kHzへ変換する段の並び（audio_loopタスク専用）
+    AudioPipeline input_pipeline_{"input"};
+
+    // ReadAudio用の作業バッファ（audio_loopタスク専用、容量を再利用する）
+    std::vector<int16_t> audio_input_buffer_;   // 16kHzに変換済みの入力
+    // PIEカーネル向けに16バイト境界へ揃える
+    audio_dsp::AlignedPcmBuffer audio_input_raw_;   // コーデックから読み取った生データ
 
     void MainEventLoop();
-    void OnAudioInput();
+    /** @brief 音声処理の出力（借用）をエンコーダのリングにため、1フレームそろうごとにエンコードを投入 */
+    void OnProcessedAudio(const int16_t* data, size_t samples);
+    /** @brief 1フレームをエンコードして送信キューへ（エンコードグループで実行） */
+    void EncodeUplinkFrame(const PcmFrameRef& frame, uint32_t epoch);
+    /** @brief 上り音声の送信タスク。キューが空になるまで送ってから次の通知を待つ */
+    void AudioSendLoop();
+    void SendQueuedAudio();
+    bool OnAudioInput();
+    void WakeAudioLoop();
     void OnAudioOutput();
     void ReadAudio(std::vector<int16_t>& data, int sample_rate, int samples);
     void ResetDecoder();
-    void SetDecodeSampleRate(int sample_rate, int frame_duration);
-    void CheckNewVersion();
+    /** @brief 聞き取り用の入力（AFE）を開始（すでに動いていれば何もしない） */
+    void StartListeningInput();
+    /**
+     * @brief バージョン確認・アクティベーション
+     * @param background 保存済みの設定で動作中に実行する。失敗は通知せずに再試行し、
+     *                   アップグレードは待機状態になってから行う
+     */
+    void CheckNewVersion(bool background = false);
     void ShowActivationCode();
     void OnClockTimer();
+    /** @brief tts / stt / llmメッセージの処理（高速経路とcJSONの経路で共通） */
+    void HandleTts(const char* state, const char* text, const char* id = nullptr);
+#if CONFIG_USE_TTS_CACHE
+    void HandleTtsCache(const char* text, const char* id);
+#endif
+#if CONFIG_USE_CONTROL_MESSAGE_QUEUE
+    /**
+     * @brief 制御メッセージを受信タスクから制御キューへ渡す
+     *
+     * itemを control_message_buffer_ へ書き出して受信タスクのアリーナから切り離し、
+     * control_group_でバッファ上の本文をそのまま解析してhandlerを呼びます。
+     */
+    void PostControlMessage(const cJSON* item, std::function<void(const cJSON*)> handler);
+#endif
+    void HandleStt(const std::string& text);
+    void HandleLlmEmotion(const std::string& emotion);
+    void ShowAssistantSentence(const std::string& text);
+    void FinishAssistantSentence();
     void SetListeningMode(ListeningMode mode);
+    void SetUplinkFrameDuration(int duration_ms);
+    /** @brief 前のターンの音声チャンネルが開いたままならtrue（新しいターンでそのまま使う） */
+    bool ReuseSessionChannel();
+    /** @brief 聞き取り中のターンを終える（セッションを保つ設定ならチャンネルは閉じない） */
+    void EndConversationTurn();
+#if CONFIG_USE_SPECULATIVE_CHANNEL_OPEN
+    /** @brief 待機中に声が始まったとき、ウェイクワードの確認を待たずに接続を用意する（1時間あたりの回数に上限） */
+    void SpeculativeOpenAudioChannel();
+    /** @brief 確認されたウェイクワードが先行接続の時間内だったかを記録 */
+    void RecordSpeculativeHit();
+#endif
     void AudioLoop();
+    void StartAudioFrontEnd(AudioCodec* codec);
 };
 
 #endif // _APPLICATION_H_
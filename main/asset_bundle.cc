@@ -0,0 +1,134 @@
+/**
+ * @file asset_bundle.cc
+ * @brief アセットパーティションの読み出しの実装
+ */
+#include "asset_bundle.h"
+#include "settings.h"
+
+#include <esp_log.h>
+#include <esp_rom_crc.h>
+
+#include <cstring>
+
+#define TAG "AssetBundle"
+
+bool AssetBundle::CheckHeader(const Header& header, size_t partition_size) {
+    if (memcmp(header.magic, ASSET_BUNDLE_MAGIC, 4) != 0) {
+        return false;
+    }
+    if (header.format != ASSET_BUNDLE_FORMAT) {
+        ESP_LOGE(TAG, "Unsupported bundle format %u", header.format);
+        return false;
+    }
+    size_t index_end = sizeof(Header) + (size_t)header.count * sizeof(Entry);
+    if (header.size > partition_size || index_end > header.size) {
+        ESP_LOGE(TAG, "Bundle size %lu does not fit the partition (%u)", header.size, partition_size);
+        return false;
+    }
+    return true;
+}
+
+bool AssetBundle::Mount() {
+    if (mounted_) {
+        return data_ != nullptr;
+    }
+    mounted_ = true;
+
+    Settings settings("assets");
+    std::string label = settings.GetString("partition", ASSET_PARTITION_A);
+    auto partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label.c_str());
+    if (partition == nullptr) {
+        ESP_LOGE(TAG, "No %s partition", label.c_str());
+        return false;
+    }
+    Header header;
+    if (esp_partition_read(partition, 0, &header, sizeof(header)) != ESP_OK ||
+            !CheckHeader(header, partition->size)) {
+        ESP_LOGE(TAG, "No asset bundle in %s", label.c_str());
+        return false;
+    }
+
+    const void* mapped = nullptr;
+    if (esp_partition_mmap(partition, 0, header.size, ESP_PARTITION_MMAP_DATA, &mapped, &mmap_handle_) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to map %s", label.c_str());
+        return false;
+    }
+    data_ = (const uint8_t*)mapped;
+    header_ = (const Header*)data_;
+    entries_ = (const Entry*)(data_ + sizeof(Header));
+    ESP_LOGI(TAG, "Mapped %s: version %.16s, %u assets, %lu bytes", label.c_str(), header_->version,
+        header_->count, header_->size);
+    return true;
+}
+
+std::string_view AssetBundle::Find(const char* name) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!Mount()) {
+        return {};
+    }
+    // 索引は名前順なので二分探索する（マップした索引をそのまま読む）
+    int low = 0;
+    int high = (int)header_->count - 1;
+    while (low <= high) {
+        int mid = (low + high) / 2;
+        const auto& entry = entries_[mid];
+        int cmp = strncmp(name, entry.name, ASSET_NAME_SIZE);
+        if (cmp == 0) {
+            if (entry.offset > header_->size || entry.size > header_->size - entry.offset) {
+                ESP_LOGE(TAG, "Asset %s is out of range", name);
+                return {};
+            }
+            return std::string_view((const char*)data_ + entry.offset, entry.size);
+        }
+        if (cmp < 0) {
+            high = mid - 1;
+        } else {
+            low = mid + 1;
+        }
+    }
+    ESP_LOGW(TAG, "Asset %s not found", name);
+    return {};
+}
+
+std::string AssetBundle::version() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!Mount()) {
+        return "";
+    }
+    return std::string(header_->version, strnlen(header_->version, sizeof(header_->version)));
+}
+
+bool AssetBundle::Verify(const char* partition_label) {
+    auto partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, partition_label);
+    if (partition == nullptr) {
+        return false;
+    }
+    Header header;
+    if (esp_partition_read(partition, 0, &header, sizeof(header)) != ESP_OK ||
+            !CheckHeader(header, partition->size)) {
+        return false;
+    }
+    const void* mapped = nullptr;
+    esp_partition_mmap_handle_t mmap_handle;
+    if (esp_partition_mmap(partition, 0, header.size, ESP_PARTITION_MMAP_DATA, &mapped, &mmap_handle) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to map %s", partition_label);
+        return false;
+    }
+    auto data = (const uint8_t*)mapped;
+    bool ok = esp_rom_crc32_le(0, data + sizeof(Header), header.size - sizeof(Header)) == header.crc32;
+    if (!ok) {
+        ESP_LOGE(TAG, "CRC mismatch in %s", partition_label);
+    }
+    auto entries = (const Entry*)(data + sizeof(Header));
+    for (int i = 0; ok && i < header.count; ++i) {
+        const auto& entry = entries[i];
+        ok = entry.offset <= header.size && entry.size <= header.size - entry.offset &&
+            strnlen(entry.name, ASSET_NAME_SIZE) < ASSET_NAME_SIZE &&
+            (i == 0 || strncmp(entries[i - 1].name, entry.name, ASSET_NAME_SIZE) < 0);
+        if (!ok) {
+            ESP_LOGE(TAG, "Invalid index entry %d in %s", i, partition_label);
+        }
+    }
+    esp_partition_munmap(mmap_handle);
+    return ok;
+}
@@ -0,0 +1,116 @@
+/**
+ * @file asset_bundle.h
+ * @brief アセットパーティション（提示音などの索引付きバンドル）の読み出し
+ *
+ * 提示音（P3）をアプリのイメージに埋め込まず、scripts/gen_asset_bundle.py で作った
+ * バンドルを専用のパーティションに置きます。パーティションはesp_partition_mmap()で
+ * 一度だけマップし、Find()はマップした領域をそのまま指すstd::string_viewを返します（コピーなし）。
+ * アプリのOTAにアセットが含まれなくなり、アセットはOTAの "assets" で別に更新できます。
+ *
+ * バンドルの形式（リトルエンディアン）:
+ *   ヘッダ（32バイト）: "XZAS" | uint16 format(=1) | uint16 エントリ数 | uint32 全体のサイズ |
+ *                       uint32 ヘッダ以降のCRC32 | char version[16]
+ *   索引（エントリごとに40バイト、名前順）: char name[32] | uint32 offset（先頭から） | uint32 size
+ *   データ: 各エントリを4バイト境界に置く
+ */
+#ifndef ASSET_BUNDLE_H
+#define ASSET_BUNDLE_H
+
+#include <esp_partition.h>
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+/** @brief バンドルの先頭の識別子 */
+#define ASSET_BUNDLE_MAGIC "XZAS"
+
+/** @brief 対応するバンドルの形式 */
+#define ASSET_BUNDLE_FORMAT 1
+
+/** @brief アセットのA/Bパーティション */
+#define ASSET_PARTITION_A "assets"
+#define ASSET_PARTITION_B "assets_1"
+
+/** @brief 名前の最大長（終端を含む） */
+#define ASSET_NAME_SIZE 32
+
+/**
+ * @class AssetBundle
+ * @brief アセットパーティションのシングルトン
+ *
+ * 最初のFind()でSettings "assets" の partition（既定は ASSET_PARTITION_A）をマップします。
+ * マップは解放しないため、返したstd::string_viewは起動中ずっと有効です。
+ */
+class AssetBundle {
+public:
+    static AssetBundle& GetInstance() {
+        static AssetBundle instance;
+        return instance;
+    }
+
+    AssetBundle(const AssetBundle&) = delete;
+    AssetBundle& operator=(const AssetBundle&) = delete;
+
+    /**
+     * @brief 名前からアセットを探す
+     * @return マップした領域を指すビュー。見つからない場合やバンドルがない場合は空
+     */
+    std::string_view Find(const char* name);
+
+    /** @brief マップしたバンドルのバージョン（マップできていなければ空） */
+    std::string version();
+
+    /**
+     * @brief パーティションの内容がバンドルとして読める形式か確認（CRCまで照合する）
+     *
+     * OTAで書き込んだパーティションを切り替える前の確認に使います。
+     */
+    static bool Verify(const char* partition_label);
+
+private:
+    AssetBundle() = default;
+
+    struct Header {
+        char magic[4];
+        uint16_t format;
+        uint16_t count;
+        uint32_t size;
+        uint32_t crc32;
+        char version[16];
+    };
+
+    struct Entry {
+        char name[ASSET_NAME_SIZE];
+        uint32_t offset;
+        uint32_t size;
+    };
+
+    /** @brief 使うパーティションをマップ（初回のみ） */
+    bool Mount();
+
+    /** @brief ヘッダと索引の範囲を確かめる */
+    static bool CheckHeader(const Header& header, size_t partition_size);
+
+    std::mutex mutex_;
+    bool mounted_ = false;          /**< マップを試みた */
+    const uint8_t* data_ = nullptr; /**< マップしたバンドルの先頭（失敗したらnullptr） */
+    const Header* header_ = nullptr;
+    const Entry* entries_ = nullptr;
+    esp_partition_mmap_handle_t mmap_handle_ = 0;
+};
+
+/**
+ * @brief 名前で参照するアセット（std::string_viewへ変換したときに探す）
+ *
+ * 生成されるlang_config.hの提示音（Lang::Sounds::P3_*）に使います。
+ * 埋め込みの場合と同じくstd::string_viewを受け取る関数へそのまま渡せます。
+ */
+struct AssetRef {
+    const char* name;
+
+    operator std::string_view() const { return AssetBundle::GetInstance().Find(name); }
+};
+
+#endif // ASSET_BUNDLE_H
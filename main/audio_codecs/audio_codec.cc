@@ -9,9 +9,12 @@
 #include "audio_codec.h"
 #include "board.h"
 #include "settings.h"
+#include "display.h"
+#include "mcp_tool_cache.h"
 
 #include <esp_log.h>
 #include <cstring>
+#include <cassert>
 #include <driver/i2s_common.h>
 
 #define TAG "AudioCodec"
@@ -42,6 +45,27 @@ void AudioCodec::OutputData(std::vector<int16_t>& data) {
     Write(data.data(), data.size());
 }
 
+void AUDIO_HOT_ATTR AudioCodec::OutputData(const int16_t* data, size_t samples) {
+    Write(data, samples);
+}
+
+/**
+ * @brief 出力用の作業バッファを貸し出す
+ *
+ * 同じサイズで繰り返し呼ぶ限り再確保は発生しません。
+ */
+int16_t* AudioCodec::AcquireOutputBuffer(size_t samples) {
+    if (output_buffer_.size() < samples) {
+        output_buffer_.resize(samples);
+    }
+    return output_buffer_.data();
+}
+
+void AUDIO_HOT_ATTR AudioCodec::CommitOutputBuffer(size_t samples) {
+    assert(samples <= output_buffer_.size());
+    Write(output_buffer_.data(), samples);
+}
+
 /**
  * @brief 音声データを入力
  * @param data 入力音声データを格納するバッファ
@@ -50,8 +74,20 @@ void AudioCodec::OutputData(std::vector<int16_t>& data) {
  * コーデックから16ビット音声データを読み取ります。
  */
 bool AudioCodec::InputData(std::vector<int16_t>& data) {
-    int samples = Read(data.data(), data.size());
-    if (samples > 0) {
+    return InputData(data.data(), data.size());
+}
+
+/**
+ * @brief 音声データを入力
+ * @param data 入力音声データを格納するバッファ
+ * @param samples 読み取るサンプル数
+ * @return データが取得できた場合true
+ *
+ * アライメント指定のバッファなど、std::vector<int16_t>以外へ読み取る場合に使用します。
+ */
+bool AUDIO_HOT_ATTR AudioCodec::InputData(int16_t* data, size_t samples) {
+    int read = Read(data, samples);
+    if (read > 0) {
         return true;
     }
     return false;
@@ -65,6 +101,24 @@ void AudioCodec::Start() {
         output_volume_ = 10;
     }
 
+    // DMAイベントのコールバックはチャンネル有効化の前に登録する必要がある
+    if (rx_handle_ != nullptr) {
+        i2s_event_callbacks_t callbacks = {};
+        callbacks.on_recv_q_ovf = [](i2s_chan_handle_t handle, i2s_event_data_t* event, void* user_ctx) -> bool {
+            ((AudioCodec*)user_ctx)->input_overflow_count_++;
+            return false;
+        };
+        ESP_ERROR_CHECK(i2s_channel_register_event_callback(rx_handle_, &callbacks, this));
+    }
+    if (tx_handle_ != nullptr) {
+        i2s_event_callbacks_t callbacks = {};
+        callbacks.on_send_q_ovf = [](i2s_chan_handle_t handle, i2s_event_data_t* event, void* user_ctx) -> bool {
+            ((AudioCodec*)user_ctx)->output_underrun_count_++;
+            return false;
+        };
+        ESP_ERROR_CHECK(i2s_channel_register_event_callback(tx_handle_, &callbacks, this));
+    }
+
     ESP_ERROR_CHECK(i2s_channel_enable(tx_handle_));
     ESP_ERROR_CHECK(i2s_channel_enable(rx_handle_));
 
@@ -79,6 +133,25 @@ void AudioCodec::SetOutputVolume(int volume) {
     
     Settings settings("audio", true);
     settings.SetInt("output_volume", output_volume_);
+    McpToolCache::Invalidate();
+
+    // ミュートアイコンだけを更新する（バッテリーやネットワークは読み直さない）
+    auto display = Board::GetInstance().GetDisplay();
+    if (display != nullptr) {
+        display->PostStatusBarUpdate(false);
+    }
+}
+
+std::string AudioCodec::input_format() const {
+    int ref_num = input_reference_ ? 1 : 0;
+    std::string format(input_channels_ - ref_num, 'M');
+    format.append(ref_num, 'R');
+    return format;
+}
+
+int AudioCodec::input_reference_channel() const {
+    auto position = input_format().find('R');
+    return position == std::string::npos ? -1 : (int)position;
 }
 
 void AudioCodec::EnableInput(bool enable) {
@@ -94,5 +167,21 @@ void AudioCodec::EnableOutput(bool enable) {
         return;
     }
     output_enabled_ = enable;
+    if (!enable) {
+        output_muted_ = false;
+    }
     ESP_LOGI(TAG, "Set output enable to %s", enable ? "true" : "false");
 }
+
+void AudioCodec::SetOutputMuted(bool muted) {
+    output_muted_ = muted;
+}
+
+void AudioCodec::WarmOutput() {
+    if (!output_enabled_) {
+        EnableOutput(true);
+    }
+    if (!output_muted_) {
+        SetOutputMuted(true);
+    }
+}
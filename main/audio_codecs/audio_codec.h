@@ -12,16 +12,30 @@
 #include <freertos/FreeRTOS.h>
 #include <freertos/event_groups.h>
 #include <driver/i2s_std.h>
+#include <esp_attr.h>
 
 #include <vector>
 #include <string>
 #include <functional>
+#include <atomic>
 
 #include "board.h"
 
-// DMAバッファ設定
-#define AUDIO_CODEC_DMA_DESC_NUM 6    // DMAディスクリプタ数
-#define AUDIO_CODEC_DMA_FRAME_NUM 240 // フレームあたりのサンプル数
+/**
+ * @brief 音声の定常経路で毎フレーム呼ばれる関数の配置
+ *
+ * CONFIG_AUDIO_REALTIME_PROFILE ではIRAMに置き、OTAの書き込みやカメラDMAでフラッシュキャッシュが
+ * 混んでいる間もキャッシュミスで音声タスクが止まらないようにします（カーネルは linker.lf で配置）。
+ */
+#if CONFIG_AUDIO_REALTIME_PROFILE
+#define AUDIO_HOT_ATTR IRAM_ATTR
+#else
+#define AUDIO_HOT_ATTR
+#endif
+
+// DMAバッファ設定（ボードごとにKconfigで調整、遅延と欠落のしやすさのトレードオフ）
+#define AUDIO_CODEC_DMA_DESC_NUM CONFIG_AUDIO_CODEC_DMA_DESC_NUM    // DMAディスクリプタ数
+#define AUDIO_CODEC_DMA_FRAME_NUM CONFIG_AUDIO_CODEC_DMA_FRAME_NUM  // フレームあたりのサンプル数
 
 /**
  * @class AudioCodec
@@ -45,15 +59,63 @@ public:
     /** 音声出力を有効/無効化 */
     virtual void EnableOutput(bool enable);
 
+    /**
+     * @brief 出力を開いたまま消音/解除する
+     *
+     * EnableOutputのようにアンプを開き直さないため、すぐに切り替えられます。
+     * 既定はフラグだけを持ち、アンプに消音機能があるコーデックはオーバーライドします。
+     */
+    virtual void SetOutputMuted(bool muted);
+
+    /**
+     * @brief 出力を消音した状態で準備する
+     *
+     * 出力が無効なら有効にしてから消音します。会話の開始や再生の直前に呼んでおき、
+     * 最初のフレームを書くときにSetOutputMuted(false)で解除します。
+     * アンプを開く遅延とポップ音が再生の頭に重なりません。
+     */
+    void WarmOutput();
+
     /** オーディオコーデックを開始 */
     void Start();
     
     /** 音声データを出力（スピーカー再生） */
     void OutputData(std::vector<int16_t>& data);
+
+    /** 音声データを出力（呼び出し側のバッファから直接書き込む） */
+    void OutputData(const int16_t* data, size_t samples);
+
+    /**
+     * @brief 出力用のバッファを借りる
+     * @param samples 書き込むサンプル数
+     * @return samples分の書き込み先（次のCommitOutputBufferまで有効）
+     *
+     * 呼び出し側はリングバッファなどから直接このバッファへ書き込み、CommitOutputBufferで出力します。
+     * 中間のstd::vectorを持つ必要がなくなります。既定ではコーデックが保持する作業バッファを返し、
+     * DMAメモリへ直接書ける実装はオーバーライドできます。
+     */
+    virtual int16_t* AcquireOutputBuffer(size_t samples);
+
+    /** @brief AcquireOutputBufferで借りたバッファの先頭samples分を出力 */
+    virtual void CommitOutputBuffer(size_t samples);
     
     /** 音声データを入力（マイク録音） */
     bool InputData(std::vector<int16_t>& data);
 
+    /** 音声データを入力（呼び出し側が確保したバッファへ直接読み取る） */
+    bool InputData(int16_t* data, size_t samples);
+
+    /**
+     * @brief 入力チャンネルの並び（AFEの入力形式。Mはマイク、Rはリファレンス）
+     *
+     * 既定はマイクを先に、リファレンスを後ろに並べます（"MR"、"MMR"など）。
+     * TDMの時隙の順にそのまま読み出すコーデックは、その並びを返すようにオーバーライドします。
+     */
+    virtual std::string input_format() const;
+
+    /** @brief リファレンスのチャンネル位置（リファレンスがなければ-1） */
+    int input_reference_channel() const;
+
     // ゲッターメソッド群
     inline bool duplex() const { return duplex_; }                          /**< 全二重通信モードかどうか */
     inline bool input_reference() const { return input_reference_; }        /**< 入力リファレンスが有効かどうか */
@@ -64,6 +126,9 @@ public:
     inline int output_volume() const { return output_volume_; }             /**< 現在の出力ボリューム */
     inline bool input_enabled() const { return input_enabled_; }           /**< 入力が有効かどうか */
     inline bool output_enabled() const { return output_enabled_; }         /**< 出力が有効かどうか */
+    inline bool output_muted() const { return output_muted_; }             /**< 出力を開いたまま消音しているか */
+    inline uint32_t input_overflow_count() const { return input_overflow_count_; }    /**< 読み取りが間に合わず破棄されたRX DMAバッファ数 */
+    inline uint32_t output_underrun_count() const { return output_underrun_count_; }  /**< 書き込みが間に合わず再送されたTX DMAバッファ数 */
 
 protected:
     // I2Sハンドル
@@ -75,12 +140,18 @@ protected:
     bool input_reference_ = false;     /**< 入力リファレンス有効 */
     bool input_enabled_ = false;       /**< 入力有効フラグ */
     bool output_enabled_ = false;      /**< 出力有効フラグ */
+    volatile bool output_muted_ = false;    /**< 出力消音フラグ（出力が有効な間だけ意味を持つ） */
     int input_sample_rate_ = 0;        /**< 入力サンプリングレート */
     int output_sample_rate_ = 0;       /**< 出力サンプリングレート */
     int input_channels_ = 1;           /**< 入力チャンネル数（デフォルト：モノラル） */
     int output_channels_ = 1;          /**< 出力チャンネル数（デフォルト：モノラル） */
     int output_volume_ = 70;           /**< 出力ボリューム（パーセント、デフォルト：70%） */
 
+    std::atomic<uint32_t> input_overflow_count_{0};    /**< RX DMAキューのオーバーフロー回数（ISRから更新） */
+    std::atomic<uint32_t> output_underrun_count_{0};   /**< TX DMAキューのオーバーフロー回数（ISRから更新） */
+
+    std::vector<int16_t> output_buffer_;    /**< AcquireOutputBufferで貸し出す作業バッファ */
+
     /** コーデックから音声データを読み取り（サブクラスで実装） */
     virtual int Read(int16_t* dest, int samples) = 0;
     
@@ -14,6 +14,8 @@
 #include <driver/gpio.h>
 #include <driver/i2s_pdm.h>
 
+#include <vector>
+
 /**
  * @class NoAudioCodec
  * @brief オーディオコーデックチップなしの基底クラス
@@ -29,6 +31,12 @@ private:
     /** オーディオデータを読み取り（マイク入力） */
     virtual int Read(int16_t* dest, int samples) override;
 
+    // I2Sの32ビットスロットとの変換用（書き込みと読み取りは別タスクのため別々に持ち、容量を再利用する）
+    std::vector<int32_t> write_buffer_;
+    std::vector<int32_t> read_buffer_;
+    int gain_volume_ = -1;          /**< volume_gain_q16_を計算したときの音量 */
+    int32_t volume_gain_q16_ = 0;   /**< 音量から求めた倍率（65536で等倍） */
+
 public:
     virtual ~NoAudioCodec();
 };
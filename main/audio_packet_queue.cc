@@ -0,0 +1,93 @@
+/**
+ * @file audio_packet_queue.cc
+ * @brief 音声パケット用ロックフリーSPSCリングバッファの実装
+ */
+#include "audio_packet_queue.h"
+
+#include <utility>
+
+AudioPacketQueue::AudioPacketQueue(size_t capacity)
+    : capacity_(capacity), limit_(capacity), slot_count_(capacity + 1) {
+    slots_ = new AudioStreamPacket[slot_count_];
+}
+
+AudioPacketQueue::~AudioPacketQueue() {
+    delete[] slots_;
+}
+
+void AudioPacketQueue::SetLimit(size_t limit) {
+    limit_.store(limit < capacity_ ? limit : capacity_, std::memory_order_relaxed);
+}
+
+size_t AudioPacketQueue::size() const {
+    return Distance(head_.load(std::memory_order_acquire), tail_.load(std::memory_order_acquire));
+}
+
+bool AudioPacketQueue::Push(AudioStreamPacket&& packet) {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    size_t next = (tail + 1) % slot_count_;
+    if (Distance(head_.load(std::memory_order_acquire), tail) >= capacity()) {
+        return false;
+    }
+
+    slots_[tail] = std::move(packet);
+    tail_.store(next, std::memory_order_release);
+    return true;
+}
+
+bool AudioPacketQueue::Push(const uint8_t* payload, size_t size, uint32_t timestamp) {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    size_t next = (tail + 1) % slot_count_;
+    if (Distance(head_.load(std::memory_order_acquire), tail) >= capacity()) {
+        return false;
+    }
+
+    auto& slot = slots_[tail];
+    slot.timestamp = timestamp;
+    slot.payload.assign(payload, size);
+    tail_.store(next, std::memory_order_release);
+    return true;
+}
+
+bool AudioPacketQueue::Pop(AudioStreamPacket& packet) {
+    HandleClearRequest();
+
+    size_t head = head_.load(std::memory_order_relaxed);
+    if (head == tail_.load(std::memory_order_acquire)) {
+        return false;
+    }
+
+    packet = std::move(slots_[head]);
+    head_.store((head + 1) % slot_count_, std::memory_order_release);
+    return true;
+}
+
+void AudioPacketQueue::Clear() {
+    clear_requested_.store(false, std::memory_order_relaxed);
+    size_t tail = tail_.load(std::memory_order_acquire);
+    for (size_t i = head_.load(std::memory_order_relaxed); i != tail; i = (i + 1) % slot_count_) {
+        // バッファをプールへ返却する
+        slots_[i].payload.Release();
+    }
+    head_.store(tail, std::memory_order_release);
+}
+
+void AudioPacketQueue::RequestClear() {
+    clear_tail_.store(tail_.load(std::memory_order_acquire), std::memory_order_relaxed);
+    clear_requested_.store(true, std::memory_order_release);
+}
+
+void AudioPacketQueue::HandleClearRequest() {
+    if (!clear_requested_.exchange(false, std::memory_order_acquire)) {
+        return;
+    }
+    // 依頼時点のtailまでを破棄する。既に消費済みであれば何もしない
+    size_t head = head_.load(std::memory_order_relaxed);
+    size_t target = clear_tail_.load(std::memory_order_relaxed);
+    if (Distance(head, target) <= Distance(head, tail_.load(std::memory_order_acquire))) {
+        for (size_t i = head; i != target; i = (i + 1) % slot_count_) {
+            slots_[i].payload.Release();
+        }
+        head_.store(target, std::memory_order_release);
+    }
+}
@@ -0,0 +1,91 @@
+/**
+ * @file audio_packet_queue.h
+ * @brief 音声パケット用ロックフリーSPSCリングバッファ
+ *
+ * 1つの生産者タスクと1つの消費者タスクの間でOpusパケットを受け渡すための
+ * 固定容量リングバッファです。ペイロードは OpusPacketPool のバッファを
+ * ムーブで受け渡すため、定常動作中はヒープ確保もミューテックスも使用しません。
+ */
+#ifndef AUDIO_PACKET_QUEUE_H
+#define AUDIO_PACKET_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "protocol.h"
+
+/**
+ * @class AudioPacketQueue
+ * @brief 単一生産者/単一消費者の音声パケットキュー
+ *
+ * Push()系は生産者タスクのみ、Pop()/Clear()は消費者タスクのみが呼び出せます。
+ * 生産者側からキューを破棄したい場合は RequestClear() を使用し、
+ * 実際の破棄は消費者側の次回 Pop()/Clear() で行われます。
+ */
+class AudioPacketQueue {
+public:
+    /**
+     * @brief コンストラクタ
+     * @param capacity 格納可能なパケット数
+     */
+    explicit AudioPacketQueue(size_t capacity);
+    ~AudioPacketQueue();
+    AudioPacketQueue(const AudioPacketQueue&) = delete;
+    AudioPacketQueue& operator=(const AudioPacketQueue&) = delete;
+
+    /**
+     * @brief パケットをムーブして追加（生産者専用）
+     * @return 満杯の場合はfalse（packetはそのまま残ります）
+     */
+    bool Push(AudioStreamPacket&& packet);
+
+    /**
+     * @brief データをスロットのバッファへコピーして追加（生産者専用）
+     * @return 満杯の場合はfalse
+     */
+    bool Push(const uint8_t* payload, size_t size, uint32_t timestamp);
+
+    /**
+     * @brief 先頭パケットをムーブして取り出す（消費者専用）
+     * @return キューが空の場合はfalse
+     */
+    bool Pop(AudioStreamPacket& packet);
+
+    /** 全パケットを破棄（消費者専用） */
+    void Clear();
+
+    /** 現在までに追加されたパケットの破棄を消費者側に依頼（任意のタスクから呼び出し可） */
+    void RequestClear();
+
+    /**
+     * @brief 格納するパケット数の上限を変更（任意のタスクから呼び出し可）
+     * @param limit 上限（コンストラクタで指定した容量で切り詰めます）
+     * @note フレーム長が変わった場合に、キューの保持時間を一定に保つために使用します
+     */
+    void SetLimit(size_t limit);
+
+    bool empty() const { return size() == 0; }
+    bool full() const { return size() >= capacity(); }
+    size_t size() const;
+    /** @brief 現在の上限（SetLimit()で変更された値） */
+    size_t capacity() const { return limit_.load(std::memory_order_relaxed); }
+
+private:
+    const size_t capacity_;                 /**< 確保済みの最大パケット数 */
+    std::atomic<size_t> limit_;             /**< 現在の上限（capacity_以下） */
+    const size_t slot_count_;               /**< 内部スロット数（capacity_ + 1） */
+    AudioStreamPacket* slots_ = nullptr;    /**< パケットスロット配列 */
+
+    alignas(4) std::atomic<size_t> head_{0};      /**< 消費者側インデックス */
+    alignas(4) std::atomic<size_t> tail_{0};      /**< 生産者側インデックス */
+    std::atomic<size_t> clear_tail_{0};           /**< RequestClear時点のtail_ */
+    std::atomic<bool> clear_requested_{false};    /**< 破棄依頼フラグ */
+
+    size_t Distance(size_t from, size_t to) const {
+        return (to + slot_count_ - from) % slot_count_;
+    }
+    void HandleClearRequest();
+};
+
+#endif // AUDIO_PACKET_QUEUE_H
@@ -0,0 +1,863 @@
+/**
+ * @file audio_player.cc
+ * @brief 受信音声の再生パイプラインの実装
+ */
+#include "audio_player.h"
+#include "latency_trace.h"
+#include "task_factory.h"
+#include "trace_recorder.h"
+#include "audio_tap.h"
+#include "opus_memory.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <esp_heap_caps.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#define TAG "AudioPlayer"
+
+/** @brief ジッタ目標を1つ下げるまでにアンダーランなしで再生するパケット数 */
+#define AUDIO_PLAYER_STABLE_PACKETS 100
+
+/** @brief タイムスタンプがこれ以上逆行した場合はストリームの再開始とみなす（ミリ秒） */
+#define AUDIO_PLAYER_TIMESTAMP_RESTART_MS 1000
+
+/** @brief ジッタの計測に使う最小のバースト長（パケット数）。短い応答の遅れは無視する */
+#define AUDIO_PLAYER_JITTER_SAMPLE_PACKETS 10
+
+AudioPlayer::AudioPlayer(AudioPacketQueue& queue) : queue_(queue) {
+    auto ret = esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "audio_decode", &pm_lock_);
+    if (ret == ESP_ERR_NOT_SUPPORTED) {
+        pm_lock_ = nullptr;
+    } else {
+        ESP_ERROR_CHECK(ret);
+    }
+}
+
+AudioPlayer::~AudioPlayer() {
+    if (decode_task_handle_ != nullptr) {
+        DeleteTask(decode_task_handle_);
+    }
+    if (write_task_handle_ != nullptr) {
+        DeleteTask(write_task_handle_);
+    }
+    for (auto ring : voice_rings_) {
+        if (ring != nullptr) {
+            vStreamBufferDelete(ring);
+        }
+    }
+    heap_caps_free(ring_storage_);
+    for (auto& slot : decoders_) {
+        if (slot.decoder != nullptr) {
+            opus_decoder_destroy(slot.decoder);
+        }
+    }
+    if (asset_decoder_ != nullptr) {
+        opus_decoder_destroy(asset_decoder_);
+    }
+#if CONFIG_USE_SOUND_PCM_CACHE
+    for (auto& entry : pcm_cache_) {
+        EvictPcmCache(entry);
+    }
+#endif
+    if (pm_lock_ != nullptr) {
+        esp_pm_lock_delete(pm_lock_);
+    }
+}
+
+void AudioPlayer::Start(AudioCodec* codec, int sample_rate, int frame_duration) {
+    codec_ = codec;
+    SetDecodeSampleRate(sample_rate, frame_duration);
+
+    // PCMリングはボイスごとにコーデック出力レートで確保する（PSRAMがあればPSRAMに配置）
+    int output_rate = codec_->output_sample_rate();
+    write_chunk_bytes_ = output_rate * AUDIO_PLAYER_WRITE_CHUNK_MS / 1000 * sizeof(int16_t);
+    size_t ring_bytes = output_rate * AUDIO_PLAYER_PCM_RING_MS / 1000 * sizeof(int16_t);
+    size_t speech_ring_bytes = ring_bytes;
+#if CONFIG_USE_DECODE_AHEAD
+    // 話声のリングは、実時間より速く届いたTTSを先にデコードして溜めておけるよう広げる
+    speech_ring_bytes = std::max(ring_bytes, (size_t)output_rate * CONFIG_AUDIO_DECODE_AHEAD_MS / 1000 * sizeof(int16_t));
+#endif
+    size_t storage_bytes = (speech_ring_bytes + 1) + (ring_bytes + 1) * (kAudioVoiceCount - 1);
+    ring_storage_ = (uint8_t*)heap_caps_malloc(storage_bytes, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (ring_storage_ == nullptr) {
+        // 内部RAMへ置く場合は先行デコードの分を確保しない
+        speech_ring_bytes = ring_bytes;
+        storage_bytes = (ring_bytes + 1) * kAudioVoiceCount;
+        ring_storage_ = (uint8_t*)heap_caps_malloc(storage_bytes, MALLOC_CAP_8BIT);
+    }
+    assert(ring_storage_ != nullptr);
+    uint8_t* storage = ring_storage_;
+    for (int voice = 0; voice < kAudioVoiceCount; ++voice) {
+        size_t bytes = voice == kAudioVoiceSpeech ? speech_ring_bytes : ring_bytes;
+        voice_rings_[voice] = xStreamBufferCreateStatic(bytes, write_chunk_bytes_, storage, &voice_ring_structs_[voice]);
+        storage += bytes + 1;
+    }
+    SetDucking(CONFIG_AUDIO_MIXER_DUCK_PERCENT, CONFIG_AUDIO_MIXER_DUCK_RAMP_MS);
+#if CONFIG_USE_OUTPUT_LIMITER
+    limiter_.Configure(output_rate, CONFIG_OUTPUT_LIMITER_THRESHOLD_DBFS, CONFIG_OUTPUT_LIMITER_LOOKAHEAD_MS,
+        CONFIG_OUTPUT_LIMITER_RELEASE_MS);
+#else
+    limiter_.SetEnabled(false);
+#endif
+
+    CreateTask([](void* arg) {
+        AudioPlayer* player = (AudioPlayer*)arg;
+        player->DecodeLoop();
+        vTaskDelete(NULL);
+    }, "audio_decode", 4096 * 3, this, CONFIG_AUDIO_DECODE_TASK_PRIORITY, &decode_task_handle_);
+
+    CreateTask([](void* arg) {
+        AudioPlayer* player = (AudioPlayer*)arg;
+        player->WriteLoop();
+        vTaskDelete(NULL);
+    }, "audio_write", 4096, this, CONFIG_AUDIO_WRITE_TASK_PRIORITY, &write_task_handle_);
+
+    ESP_LOGI(TAG, "Audio player started, pcm ring %u bytes x %d voices, speech %u bytes", ring_bytes,
+        kAudioVoiceCount, speech_ring_bytes);
+}
+
+void AudioPlayer::SetDucking(int percent, int ramp_ms) {
+    mixer_.SetDucking(percent, ramp_ms, codec_->output_sample_rate());
+}
+
+void AudioPlayer::SetDecodeSampleRate(int sample_rate, int frame_duration) {
+    std::lock_guard<PriorityMutex> lock(decoder_mutex_);
+    if (active_decoder_ != nullptr && decode_sample_rate_ == sample_rate && decode_frame_duration_ == frame_duration) {
+        return;
+    }
+
+    // 同じ組み合わせのデコーダが残っていれば状態をリセットして再利用する
+    DecoderSlot* slot = nullptr;
+    for (auto& candidate : decoders_) {
+        if (candidate.decoder != nullptr && candidate.sample_rate == sample_rate &&
+            candidate.frame_duration == frame_duration) {
+            slot = &candidate;
+            break;
+        }
+    }
+    if (slot != nullptr) {
+        opus_decoder_ctl(slot->decoder, OPUS_RESET_STATE);
+        slot->resampler.Reset();
+    } else {
+        // 最も長く使われていないスロットを置き換える
+        slot = &decoders_[0];
+        for (auto& candidate : decoders_) {
+            if (candidate.decoder == nullptr) {
+                slot = &candidate;
+                break;
+            }
+            if (candidate.last_used < slot->last_used) {
+                slot = &candidate;
+            }
+        }
+        ESP_LOGI(TAG, "Creating decoder for %d Hz / %d ms", sample_rate, frame_duration);
+        int error = 0;
+        auto decoder = opus_memory::CreateDecoder(sample_rate, 1, &error);
+        if (decoder == nullptr) {
+            // 置き換えるスロットは壊さず、今のデコーダのまま続ける
+            ESP_LOGE(TAG, "Failed to create decoder for %d Hz: %d", sample_rate, error);
+            return;
+        }
+        if (slot->decoder != nullptr) {
+            opus_decoder_destroy(slot->decoder);
+        }
+        slot->decoder = decoder;
+        slot->sample_rate = sample_rate;
+        slot->frame_samples = sample_rate * frame_duration / 1000;
+        slot->frame_duration = frame_duration;
+        if (codec_ != nullptr && sample_rate != codec_->output_sample_rate()) {
+            ESP_LOGI(TAG, "Resampling audio from %d to %d", sample_rate, codec_->output_sample_rate());
+            slot->resampler.Configure(sample_rate, codec_->output_sample_rate());
+        }
+    }
+    slot->last_used = ++decoder_use_count_;
+    active_decoder_ = slot;
+    decode_sample_rate_ = sample_rate;
+    decode_frame_duration_ = frame_duration;
+}
+
+void AudioPlayer::SetQueueLimit(size_t packets) {
+    queue_base_limit_ = packets;
+    queue_.SetLimit(packets);
+}
+
+bool AudioPlayer::Enqueue(const AudioStreamView& view) {
+    MeasureArrival();
+    if (queue_.Push(view.payload, view.payload_size, view.timestamp)) {
+        Notify();
+        return true;
+    }
+
+    // 再生より速く届いている間は、メモリに余裕があればキューを広げて取りこぼさない
+    int frame_duration = decode_frame_duration_ > 0 ? decode_frame_duration_ : AUDIO_PLAYER_ASSET_FRAME_MS;
+    size_t max_limit = AUDIO_PLAYER_QUEUE_MAX_MS / frame_duration;
+    size_t limit = queue_.capacity();
+    if (limit >= max_limit || heap_caps_get_free_size(MALLOC_CAP_8BIT) < AUDIO_PLAYER_QUEUE_MIN_FREE_HEAP) {
+        return false;
+    }
+    queue_.SetLimit(std::min(max_limit, limit + AUDIO_PLAYER_QUEUE_GROW_MS / frame_duration));
+    if (queue_.capacity() == limit) {
+        // 確保済みのスロット数に達している
+        return false;
+    }
+    queue_grow_count_++;
+    ESP_LOGI(TAG, "Receive queue grown to %u packets", queue_.capacity());
+    if (!queue_.Push(view.payload, view.payload_size, view.timestamp)) {
+        return false;
+    }
+    Notify();
+    return true;
+}
+
+void AudioPlayer::MeasureArrival() {
+    int64_t now = esp_timer_get_time();
+    if (last_arrival_us_ == 0 || now - last_arrival_us_ > AUDIO_PLAYER_IDLE_TIMEOUT_MS * 1000) {
+        // 前のバーストで最も遅れた量が、再生開始前に溜めておくべき量。悪化はすぐ、改善は少しずつ反映する
+        if (arrival_count_ >= AUDIO_PLAYER_JITTER_SAMPLE_PACKETS) {
+            int late_ms = arrival_max_late_us_ / 1000;
+            int jitter = measured_jitter_ms_;
+            jitter = late_ms > jitter ? late_ms : jitter + (late_ms - jitter) / 4;
+            measured_jitter_ms_ = jitter;
+            ESP_LOGD(TAG, "Burst of %lu packets, max late %d ms, jitter %d ms", arrival_count_, late_ms, jitter);
+        }
+        arrival_start_us_ = now;
+        arrival_count_ = 0;
+        arrival_max_late_us_ = 0;
+    }
+    last_arrival_us_ = now;
+
+    // 最初のパケットから一定速度で届いた場合の予定時刻との差（早く届いた分は負になる）
+    int frame_duration = decode_frame_duration_ > 0 ? decode_frame_duration_ : AUDIO_PLAYER_ASSET_FRAME_MS;
+    int64_t late = now - arrival_start_us_ - (int64_t)arrival_count_ * frame_duration * 1000;
+    arrival_count_++;
+    if (late > arrival_max_late_us_) {
+        arrival_max_late_us_ = late;
+    }
+}
+
+int AudioPlayer::MeasuredJitterPackets() const {
+    int frame_duration = decode_frame_duration_ > 0 ? decode_frame_duration_ : AUDIO_PLAYER_ASSET_FRAME_MS;
+    int packets = (measured_jitter_ms_ + frame_duration - 1) / frame_duration;
+    return std::min(packets, AUDIO_PLAYER_JITTER_MAX_PACKETS);
+}
+
+void AudioPlayer::Reset() {
+    last_output_time_us_ = esp_timer_get_time();
+    reset_requested_ = true;
+    Notify();
+}
+
+void AudioPlayer::EnableOutput(bool enable) {
+    codec_->EnableOutput(enable);
+    if (enable) {
+        Notify();
+    }
+}
+
+void AudioPlayer::Notify() {
+    if (decode_task_handle_ != nullptr) {
+        xTaskNotifyGive(decode_task_handle_);
+    }
+}
+
+void AudioPlayer::DecodeLoop() {
+    while (true) {
+        if (reset_requested_.exchange(false)) {
+            {
+                std::lock_guard<PriorityMutex> lock(decoder_mutex_);
+                if (active_decoder_ != nullptr) {
+                    opus_decoder_ctl(active_decoder_->decoder, OPUS_RESET_STATE);
+                    active_decoder_->resampler.Reset();
+                }
+            }
+            state_ = kStateIdle;
+            starved_since_us_ = 0;
+            buffering_start_us_ = 0;
+            last_timestamp_ = 0;
+            flush_requested_ = true;
+        }
+
+        // 待つ間は周期的に起きず、Notify()かタイムアウトまで眠る
+        if (!codec_->output_enabled()) {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+
+        // アセットは受信ストリームと並行して、ボイスのリングに入るだけ先にデコードしておく
+        bool asset_progressed = StepAsset();
+
+        if (queue_.empty()) {
+            HandleStarvation();
+            if (!asset_progressed) {
+                ulTaskNotifyTake(pdTRUE, std::min(StarvationWaitTicks(), AssetWaitTicks()));
+            }
+            continue;
+        }
+
+        size_t depth = queue_.size();
+        if (depth > max_queue_depth_) {
+            max_queue_depth_ = depth;
+        }
+
+        if (muted_) {
+            // ミュート中はデコードせずに破棄する
+            while (queue_.Pop(packet_)) {
+            }
+            packet_.payload.Release();
+            if (on_queue_drained_) {
+                on_queue_drained_();
+            }
+            continue;
+        }
+
+        if (state_ != kStatePlaying && !WaitForJitterBuffer()) {
+            ulTaskNotifyTake(pdTRUE, std::min(JitterWaitTicks(), AssetWaitTicks()));
+            continue;
+        }
+
+#if CONFIG_USE_DECODE_AHEAD
+        // 受信が再生より先行していれば、リングに待たずに入る分までまとめてデコードする
+        int batch = AUDIO_PLAYER_DECODE_BATCH_PACKETS;
+#else
+        int batch = 1;
+#endif
+        for (int i = 0; i < batch; ++i) {
+            if (i > 0 && (reset_requested_ || muted_ || !HasRoomForFrame())) {
+                break;
+            }
+            bool popped = queue_.Pop(packet_);
+            if (queue_.empty() && on_queue_drained_) {
+                on_queue_drained_();
+            }
+            if (!popped) {
+                break;
+            }
+            DecodePacket();
+        }
+    }
+}
+
+bool AudioPlayer::HasRoomForFrame() const {
+    return last_render_bytes_ > 0 &&
+        xStreamBufferSpacesAvailable(voice_rings_[kAudioVoiceSpeech]) >= last_render_bytes_;
+}
+
+void AudioPlayer::HandleStarvation() {
+    int64_t now = esp_timer_get_time();
+    if (state_ == kStatePlaying) {
+        // 再生中にキューが枯渇した。続きが来ればアンダーランとして扱う
+        state_ = kStateBuffering;
+        starved_since_us_ = now;
+        buffering_start_us_ = 0;
+        if (on_queue_drained_) {
+            on_queue_drained_();
+        }
+    } else if (state_ == kStateBuffering && starved_since_us_ != 0 &&
+               now - starved_since_us_ > AUDIO_PLAYER_IDLE_TIMEOUT_MS * 1000) {
+        // 一定時間受信がなければ発話終了とみなす
+        state_ = kStateIdle;
+        starved_since_us_ = 0;
+        last_timestamp_ = 0;
+        // 一時的に広げた受信キューを基本の上限へ戻す（空なので破棄するパケットはない）
+        if (queue_base_limit_ != 0) {
+            queue_.SetLimit(queue_base_limit_);
+        }
+    }
+}
+
+TickType_t AudioPlayer::StarvationWaitTicks() const {
+    // 発話の途中で途切れている間は、発話終了とみなす時刻に起きる
+    int64_t since = starved_since_us_;
+    if (state_ != kStateBuffering || since == 0) {
+        return portMAX_DELAY;
+    }
+    int64_t remaining_us = since + AUDIO_PLAYER_IDLE_TIMEOUT_MS * 1000 - esp_timer_get_time();
+    return remaining_us > 0 ? pdMS_TO_TICKS(remaining_us / 1000) + 1 : 1;
+}
+
+TickType_t AudioPlayer::JitterWaitTicks() const {
+    // 目標量が溜まらなくても、待ち時間の上限で再生を始める
+    int64_t max_wait_us = (int64_t)jitter_target_ * decode_frame_duration_ * 1000;
+    int64_t remaining_us = buffering_start_us_ + max_wait_us - esp_timer_get_time();
+    return remaining_us > 0 ? pdMS_TO_TICKS(remaining_us / 1000) + 1 : 1;
+}
+
+TickType_t AudioPlayer::AssetWaitTicks() const {
+    // 書きかけのアセットは、ボイスのリングが1チャンク分空くころに続きを書く
+    return asset_.sound.empty() ? portMAX_DELAY : pdMS_TO_TICKS(AUDIO_PLAYER_WRITE_CHUNK_MS);
+}
+
+bool AudioPlayer::WaitForJitterBuffer() {
+    int64_t now = esp_timer_get_time();
+    if (state_ == kStateIdle) {
+        state_ = kStateBuffering;
+        buffering_start_us_ = now;
+    } else if (starved_since_us_ != 0) {
+#if CONFIG_USE_DECODE_AHEAD
+        if (xStreamBufferBytesAvailable(voice_rings_[kAudioVoiceSpeech]) >= write_chunk_bytes_) {
+            // 先にデコードした分が残っている間に続きが届いた: 音は途切れていないのでそのまま続ける
+            starved_since_us_ = 0;
+            state_ = kStatePlaying;
+            return true;
+        }
+#endif
+        // 発話の途中で途切れていた: 目標バッファ量を増やす
+        underrun_count_++;
+        stable_packets_ = 0;
+        if (jitter_target_ < AUDIO_PLAYER_JITTER_MAX_PACKETS) {
+            jitter_target_++;
+        }
+        ESP_LOGW(TAG, "Underrun, jitter target -> %d packets", jitter_target_.load());
+        starved_since_us_ = 0;
+        buffering_start_us_ = now;
+    }
+
+    // 目標量（アンダーランで決めた量と計測したジッタの大きい方）が溜まるか、
+    // 目標量分の時間が経過したら再生を開始する
+    int target = std::max<int>(jitter_target_, MeasuredJitterPackets());
+    int64_t max_wait_us = (int64_t)target * decode_frame_duration_ * 1000;
+    if (queue_.size() >= (size_t)target || now - buffering_start_us_ >= max_wait_us) {
+        state_ = kStatePlaying;
+        buffering_start_us_ = 0;
+        return true;
+    }
+    return false;
+}
+
+void AudioPlayer::DecodePacket() {
+    uint32_t timestamp = packet_.timestamp;
+    if (timestamp != 0) {
+        // タイムスタンプが逆行したパケットは遅延到着とみなして破棄する
+        int32_t delta = (int32_t)(timestamp - last_timestamp_);
+        if (last_timestamp_ != 0 && delta <= 0 && -delta < AUDIO_PLAYER_TIMESTAMP_RESTART_MS) {
+            late_packet_count_++;
+            packet_.payload.Release();
+            return;
+        }
+        last_timestamp_ = timestamp;
+    }
+
+    size_t samples = 0;
+    {
+        std::lock_guard<PriorityMutex> lock(decoder_mutex_);
+        if (pm_lock_ != nullptr) {
+            esp_pm_lock_acquire(pm_lock_);
+        }
+        // ペイロードはプールのバッファから直接デコードする
+        // 空のペイロードは欠落フレームを表し、opus_decode()のPLCで補間される
+        auto slot = active_decoder_;
+        if (slot != nullptr) {
+            bool resample = decode_sample_rate_ != codec_->output_sample_rate();
+            samples = RenderFrame(slot->decoder, resample ? &slot->resampler : nullptr,
+                packet_.payload.data(), packet_.payload.size(), slot->frame_samples, render_);
+        }
+        if (pm_lock_ != nullptr) {
+            esp_pm_lock_release(pm_lock_);
+        }
+    }
+    packet_.payload.Release();
+    if (samples == 0) {
+        return;
+    }
+    LatencyTrace::GetInstance().MarkFirst(kLatencyFirstAudioDecoded);
+
+    last_render_bytes_ = samples * sizeof(int16_t);
+    WritePcm(render_.data(), samples);
+
+    if (on_packet_decoded_) {
+        // このパケットより前にリングへ入っている分だけ、スピーカーから出るのが遅れる
+        size_t queued = xStreamBufferBytesAvailable(voice_rings_[kAudioVoiceSpeech]);
+        size_t written = samples * sizeof(int16_t);
+        size_t ahead = queued > written ? (queued - written) / sizeof(int16_t) : 0;
+        int64_t play_us = esp_timer_get_time() + (int64_t)ahead * 1000000 / codec_->output_sample_rate();
+        on_packet_decoded_(timestamp, play_us);
+    }
+
+    if (++stable_packets_ >= AUDIO_PLAYER_STABLE_PACKETS && jitter_target_ > AUDIO_PLAYER_JITTER_MIN_PACKETS) {
+        jitter_target_--;
+        stable_packets_ = 0;
+    }
+}
+
+size_t AudioPlayer::RenderFrame(OpusDecoder* decoder, PolyphaseResampler* resampler, const uint8_t* payload,
+    size_t payload_size, int max_samples, std::vector<int16_t>& output) {
+    if (decoder == nullptr || max_samples <= 0) {
+        return 0;
+    }
+    if (payload_size == 0) {
+        payload = nullptr;
+    }
+    if (resampler == nullptr) {
+        if (output.size() < (size_t)max_samples) {
+            output.resize(max_samples);
+        }
+        int decoded;
+        {
+            TRACE_SPAN("opus_decode");
+            decoded = opus_decode(decoder, payload, payload_size, output.data(), max_samples, 0);
+        }
+        if (decoded < 0) {
+            ESP_LOGW(TAG, "Failed to decode audio: %d", decoded);
+            return 0;
+        }
+        return decoded;
+    }
+
+    // リサンプラーの入力領域へ直接デコードし、出力レートのPCMだけをoutputへ書き込む
+    size_t max_output = resampler->GetOutputSamples(max_samples);
+    if (output.size() < max_output) {
+        output.resize(max_output);
+    }
+    int decoded;
+    {
+        TRACE_SPAN("opus_decode");
+        decoded = opus_decode(decoder, payload, payload_size, resampler->BeginInput(max_samples), max_samples, 0);
+    }
+    if (decoded < 0) {
+        ESP_LOGW(TAG, "Failed to decode audio: %d", decoded);
+        resampler->EndInput(0, output.data());
+        return 0;
+    }
+    TRACE_SPAN("resample");
+    return resampler->EndInput(decoded, output.data());
+}
+
+void AudioPlayer::WritePcm(const int16_t* pcm, size_t samples) {
+    AUDIO_TAP(kAudioTapDecoded, pcm, samples, codec_->output_sample_rate(), 1);
+    auto data = (const uint8_t*)pcm;
+    size_t bytes = samples * sizeof(int16_t);
+    size_t sent = 0;
+    while (sent < bytes && !reset_requested_) {
+        sent += xStreamBufferSend(voice_rings_[kAudioVoiceSpeech], data + sent, bytes - sent, pdMS_TO_TICKS(100));
+    }
+}
+
+bool AudioPlayer::HasOverlay() const {
+    for (int voice = kAudioVoiceSpeech + 1; voice < kAudioVoiceCount; ++voice) {
+        if (xStreamBufferBytesAvailable(voice_rings_[voice]) > 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool AudioPlayer::PlayAsset(std::string_view sound, AudioVoice voice) {
+    if (sound.empty()) {
+        return true;
+    }
+    {
+        std::lock_guard<std::mutex> lock(asset_mutex_);
+        if (pending_assets_ >= AUDIO_PLAYER_ASSET_QUEUE_SIZE) {
+            ESP_LOGW(TAG, "Asset queue full, dropping sound");
+            return false;
+        }
+        assets_[(asset_head_ + pending_assets_) % AUDIO_PLAYER_ASSET_QUEUE_SIZE] = {sound, voice};
+        pending_assets_++;
+    }
+    Notify();
+    return true;
+}
+
+/**
+ * @brief p3の先頭にヘッダフレームがあればサンプリングレートとフレーム長を読み取る
+ * @return 最初の音声フレームの位置
+ */
+static size_t ParseAssetHeader(std::string_view sound, int& sample_rate, int& frame_duration) {
+    auto data = (const uint8_t*)sound.data();
+    if (sound.size() < 4 || data[0] != P3_FRAME_TYPE_HEADER) {
+        return 0;
+    }
+    size_t size = (data[2] << 8) | data[3];
+    if (size >= 6 && 4 + size <= sound.size()) {
+        sample_rate = (data[4] << 24) | (data[5] << 16) | (data[6] << 8) | data[7];
+        frame_duration = (data[8] << 8) | data[9];
+    }
+    return 4 + size;
+}
+
+bool AudioPlayer::BeginNextAsset() {
+    QueuedAsset next;
+    {
+        std::lock_guard<std::mutex> lock(asset_mutex_);
+        if (pending_assets_ == 0) {
+            return false;
+        }
+        next = assets_[asset_head_];
+    }
+    asset_ = ActiveAsset();
+    asset_.sound = next.sound;
+    asset_.voice = next.voice;
+
+#if CONFIG_USE_SOUND_PCM_CACHE
+    // 2回目以降はデコードせず、キャッシュしたPCMをそのまま書き込む
+    PcmCacheEntry* cached = FindCachedPcm(next.sound);
+    if (cached != nullptr) {
+        cached->last_used = ++pcm_cache_use_count_;
+        asset_.cached = cached->pcm;
+        asset_.cached_samples = cached->samples;
+        return true;
+    }
+#endif
+
+    auto sound = next.sound;
+    int sample_rate = AUDIO_PLAYER_ASSET_SAMPLE_RATE;
+    int frame_duration = AUDIO_PLAYER_ASSET_FRAME_MS;
+    asset_.offset = ParseAssetHeader(sound, sample_rate, frame_duration);
+    asset_.sample_rate = sample_rate;
+    int output_rate = codec_->output_sample_rate();
+    // リサンプラーの位相によるフレームごとの端数の分だけ余裕を持たせる
+    size_t frame_samples = output_rate * frame_duration / 1000 + 2;
+    asset_.max_frame_bytes = std::max<size_t>(frame_samples, output_rate * AUDIO_PLAYER_ASSET_MAX_FRAME_MS / 1000 + 2)
+        * sizeof(int16_t);
+
+#if CONFIG_USE_SOUND_PCM_CACHE
+    // フレーム数から出力サンプル数の上限を求め、短い音だけをキャッシュする
+    size_t frames = 0;
+    for (size_t offset = asset_.offset; offset + 4 <= sound.size(); ) {
+        offset += 4 + (((uint8_t)sound[offset + 2] << 8) | (uint8_t)sound[offset + 3]);
+        frames++;
+    }
+    asset_.capacity = frames * frame_samples;
+    if (frames * frame_duration <= CONFIG_SOUND_PCM_CACHE_MAX_SOUND_MS) {
+        asset_.entry = ReservePcmCache(asset_.capacity);
+    }
+#endif
+
+    // 出力レートで作成したアセットはリサンプルしない。レートが変わったときだけデコーダを作り直す
+    if (asset_decoder_ != nullptr && asset_sample_rate_ != sample_rate) {
+        opus_decoder_destroy(asset_decoder_);
+        asset_decoder_ = nullptr;
+    }
+    if (asset_decoder_ == nullptr) {
+        int error = 0;
+        asset_decoder_ = opus_memory::CreateDecoder(sample_rate, 1, &error);
+        if (asset_decoder_ == nullptr) {
+            ESP_LOGE(TAG, "Failed to create asset decoder for %d Hz: %d", sample_rate, error);
+        }
+        asset_sample_rate_ = sample_rate;
+        if (sample_rate != output_rate) {
+            ESP_LOGI(TAG, "Resampling sound assets from %d to %d", sample_rate, output_rate);
+            asset_resampler_.Configure(sample_rate, output_rate);
+        }
+    }
+    if (asset_decoder_ != nullptr) {
+        opus_decoder_ctl(asset_decoder_, OPUS_RESET_STATE);
+        asset_resampler_.Reset();
+    }
+    return true;
+}
+
+bool AudioPlayer::StepAsset() {
+    if (asset_.sound.empty() && !BeginNextAsset()) {
+        return false;
+    }
+    auto ring = voice_rings_[asset_.voice];
+
+#if CONFIG_USE_SOUND_PCM_CACHE
+    if (asset_.cached != nullptr) {
+        size_t sent = xStreamBufferSend(ring, asset_.cached + asset_.offset,
+            (asset_.cached_samples - asset_.offset) * sizeof(int16_t), 0);
+        asset_.offset += sent / sizeof(int16_t);
+        if (asset_.offset >= asset_.cached_samples) {
+            FinishAsset();
+        }
+        return sent > 0;
+    }
+#endif
+
+    if (asset_decoder_ == nullptr) {
+        FinishAsset();
+        return false;
+    }
+
+    // p3はBinaryProtocol3と同じ4バイトヘッダ + Opusフレームの繰り返し
+    auto data = (const uint8_t*)asset_.sound.data();
+    size_t size = asset_.sound.size();
+    int output_rate = codec_->output_sample_rate();
+    bool progressed = false;
+    while (asset_.offset + 4 <= size && xStreamBufferSpacesAvailable(ring) >= asset_.max_frame_bytes) {
+        // フラッシュ上のアセットは2バイト境界に揃っているとは限らない
+        uint16_t payload_size = (data[asset_.offset + 2] << 8) | data[asset_.offset + 3];
+        size_t payload = asset_.offset + 4;
+        if (payload + payload_size > size) {
+            asset_.offset = size;
+            break;
+        }
+        asset_.offset = payload + payload_size;
+
+        if (pm_lock_ != nullptr) {
+            esp_pm_lock_acquire(pm_lock_);
+        }
+        size_t samples = RenderFrame(asset_decoder_, asset_.sample_rate != output_rate ? &asset_resampler_ : nullptr,
+            data + payload, payload_size, asset_.sample_rate * AUDIO_PLAYER_ASSET_MAX_FRAME_MS / 1000, asset_pcm_);
+        if (pm_lock_ != nullptr) {
+            esp_pm_lock_release(pm_lock_);
+        }
+        if (samples == 0) {
+            continue;
+        }
+
+        // 空き容量を確認済みで、書き込むのはこのタスクだけなので一度に収まる
+        xStreamBufferSend(ring, asset_pcm_.data(), samples * sizeof(int16_t), 0);
+        progressed = true;
+#if CONFIG_USE_SOUND_PCM_CACHE
+        if (asset_.entry != nullptr) {
+            if (asset_.filled + samples <= asset_.capacity) {
+                memcpy(asset_.entry->pcm + asset_.filled, asset_pcm_.data(), samples * sizeof(int16_t));
+                asset_.filled += samples;
+            } else {
+                asset_.complete = false;
+            }
+        }
+#endif
+    }
+
+    if (asset_.offset + 4 > size) {
+        FinishAsset();
+    }
+    return progressed;
+}
+
+void AudioPlayer::FinishAsset() {
+#if CONFIG_USE_SOUND_PCM_CACHE
+    auto entry = asset_.entry;
+    if (entry != nullptr) {
+        if (asset_decoder_ == nullptr || asset_.filled == 0 || !asset_.complete) {
+            // デコードに失敗した場合などは不完全なPCMを残さない
+            EvictPcmCache(*entry);
+        } else {
+            size_t filled = asset_.filled;
+            auto shrunk = (int16_t*)heap_caps_realloc(entry->pcm, filled * sizeof(int16_t), MALLOC_CAP_SPIRAM);
+            if (shrunk != nullptr) {
+                entry->pcm = shrunk;
+                pcm_cache_bytes_ -= entry->bytes - filled * sizeof(int16_t);
+                entry->bytes = filled * sizeof(int16_t);
+            }
+            entry->key = asset_.sound.data();
+            entry->samples = filled;
+            entry->last_used = ++pcm_cache_use_count_;
+        }
+    }
+#endif
+    asset_ = ActiveAsset();
+
+    std::lock_guard<std::mutex> lock(asset_mutex_);
+    asset_head_ = (asset_head_ + 1) % AUDIO_PLAYER_ASSET_QUEUE_SIZE;
+    pending_assets_--;
+}
+
+#if CONFIG_USE_SOUND_PCM_CACHE
+AudioPlayer::PcmCacheEntry* AudioPlayer::FindCachedPcm(std::string_view sound) {
+    for (auto& entry : pcm_cache_) {
+        if (entry.key == sound.data() && entry.pcm != nullptr) {
+            return &entry;
+        }
+    }
+    return nullptr;
+}
+
+AudioPlayer::PcmCacheEntry* AudioPlayer::ReservePcmCache(size_t samples) {
+    size_t bytes = samples * sizeof(int16_t);
+    if (bytes > CONFIG_SOUND_PCM_CACHE_SIZE_KB * 1024) {
+        return nullptr;
+    }
+    while (true) {
+        PcmCacheEntry* free_entry = nullptr;
+        PcmCacheEntry* oldest = nullptr;
+        for (auto& entry : pcm_cache_) {
+            if (entry.pcm == nullptr) {
+                free_entry = free_entry != nullptr ? free_entry : &entry;
+            } else if (oldest == nullptr || entry.last_used < oldest->last_used) {
+                oldest = &entry;
+            }
+        }
+        bool fits = pcm_cache_bytes_ + bytes <= CONFIG_SOUND_PCM_CACHE_SIZE_KB * 1024 &&
+            heap_caps_get_free_size(MALLOC_CAP_SPIRAM) >= bytes + AUDIO_PLAYER_PCM_CACHE_RESERVE_BYTES;
+        if (fits && free_entry != nullptr) {
+            free_entry->pcm = (int16_t*)heap_caps_malloc(bytes, MALLOC_CAP_SPIRAM);
+            if (free_entry->pcm != nullptr) {
+                free_entry->key = nullptr;
+                free_entry->samples = 0;
+                free_entry->bytes = bytes;
+                pcm_cache_bytes_ += bytes;
+                return free_entry;
+            }
+        }
+        if (oldest == nullptr) {
+            return nullptr;
+        }
+        EvictPcmCache(*oldest);
+    }
+}
+
+void AudioPlayer::EvictPcmCache(PcmCacheEntry& entry) {
+    if (entry.pcm == nullptr) {
+        return;
+    }
+    heap_caps_free(entry.pcm);
+    pcm_cache_bytes_ -= entry.bytes;
+    entry.pcm = nullptr;
+    entry.key = nullptr;
+    entry.samples = 0;
+    entry.bytes = 0;
+}
+#endif
+
+void AudioPlayer::WriteLoop() {
+    // 話声はリングバッファからコーデックの出力バッファへ直接受け取り、他のボイスを重ねる
+    size_t chunk_samples = write_chunk_bytes_ / sizeof(int16_t);
+    std::vector<int16_t> overlay_buffers[kAudioVoiceCount];
+    const int16_t* overlays[kAudioVoiceCount] = {};
+    size_t overlay_samples[kAudioVoiceCount] = {};
+    for (int voice = kAudioVoiceSpeech + 1; voice < kAudioVoiceCount; ++voice) {
+        overlay_buffers[voice].resize(chunk_samples);
+    }
+    auto speech_ring = voice_rings_[kAudioVoiceSpeech];
+    while (true) {
+        auto chunk_data = (uint8_t*)codec_->AcquireOutputBuffer(chunk_samples);
+        if (flush_requested_.exchange(false)) {
+            while (xStreamBufferReceive(speech_ring, chunk_data, write_chunk_bytes_, 0) > 0) {
+            }
+        }
+
+        // 重ねる音があれば話声を待たない（書き込みのペースはI2Sが決める）
+        bool overlay = HasOverlay();
+        size_t received = xStreamBufferReceive(speech_ring, chunk_data, write_chunk_bytes_,
+            overlay ? 0 : pdMS_TO_TICKS(AUDIO_PLAYER_WRITE_CHUNK_MS));
+        if (received == 0) {
+            // 再生開始後にデータが途切れた場合は無音を書き込み、I2Sを枯渇させない
+            if (!overlay && (state_ == kStateIdle || (state_ == kStateBuffering && starved_since_us_ == 0))) {
+                continue;
+            }
+            memset(chunk_data, 0, write_chunk_bytes_);
+        } else if (received < write_chunk_bytes_) {
+            memset(chunk_data + received, 0, write_chunk_bytes_ - received);
+        }
+
+        for (int voice = kAudioVoiceSpeech + 1; voice < kAudioVoiceCount; ++voice) {
+            size_t bytes = overlay ? xStreamBufferReceive(voice_rings_[voice], overlay_buffers[voice].data(), write_chunk_bytes_, 0) : 0;
+            overlay_samples[voice] = bytes / sizeof(int16_t);
+            overlays[voice] = bytes > 0 ? overlay_buffers[voice].data() : nullptr;
+        }
+        mixer_.Mix((int16_t*)chunk_data, chunk_samples, overlays, overlay_samples);
+        limiter_.Process((int16_t*)chunk_data, chunk_samples);
+
+        if (!codec_->output_enabled()) {
+            continue;
+        }
+        if (codec_->output_muted()) {
+            // WarmOutput()で準備した出力は、最初のフレームを書くときに消音を解除する
+            codec_->SetOutputMuted(false);
+        }
+        AUDIO_TAP(kAudioTapSpeaker, (const int16_t*)chunk_data, chunk_samples, codec_->output_sample_rate(), 1);
+        codec_->CommitOutputBuffer(chunk_samples);
+        last_output_time_us_ = esp_timer_get_time();
+        if (received > 0) {
+            played_samples_ += received / sizeof(int16_t);
+            LatencyTrace::GetInstance().MarkFirst(kLatencyFirstAudioOutput);
+        }
+    }
+}
@@ -0,0 +1,369 @@
+/**
+ * @file audio_player.h
+ * @brief 受信音声の再生パイプライン（ジッタバッファ + デコード + I2S書き込み）
+ *
+ * 受信キューからOpusパケットを取り出してデコードし、PCMリングバッファを
+ * 経由してI2Sへ書き込む専用タスク群を管理します。
+ * - デコードタスク: 適応ジッタバッファでパケットを蓄積してから連続デコード。
+ *   CONFIG_USE_DECODE_AHEAD では受信が先行した分を1回の起床でまとめてデコードし、
+ *   PSRAMに広げた話声のリングを満たしておく（入りきらない分はOpusのまま受信キューに残す）。
+ *   音声アセットも同じタスクでフレームずつデコードし、ボイスごとのリングへ書き込む
+ * - ライタータスク: 話声のリングに他のボイスをミキサーで重ねてコーデックへ書き込み、
+ *   アンダーラン時は無音で埋める
+ */
+#ifndef AUDIO_PLAYER_H
+#define AUDIO_PLAYER_H
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/stream_buffer.h>
+#include <esp_pm.h>
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+#include <opus.h>
+
+#include "audio_codec.h"
+#include "audio_packet_queue.h"
+#include "polyphase_resampler.h"
+#include "audio_mixer.h"
+#include "audio_limiter.h"
+#include "priority_mutex.h"
+
+/** @brief ジッタバッファの最小/最大/初期目標パケット数 */
+#define AUDIO_PLAYER_JITTER_MIN_PACKETS 1
+#define AUDIO_PLAYER_JITTER_MAX_PACKETS 8
+#define AUDIO_PLAYER_JITTER_INITIAL_PACKETS 2
+
+/** @brief 受信キューを一時的に広げられる上限（ミリ秒）。実時間より速く届くTTSを取りこぼさないため */
+#define AUDIO_PLAYER_QUEUE_MAX_MS 6000
+
+/** @brief 受信キューを一度に広げる量（ミリ秒） */
+#define AUDIO_PLAYER_QUEUE_GROW_MS 1200
+
+/** @brief 受信キューを広げるのに必要なヒープの空き（バイト） */
+#define AUDIO_PLAYER_QUEUE_MIN_FREE_HEAP (40 * 1024)
+
+/** @brief PCMリングバッファの長さ（ミリ秒、ボイスごと） */
+#define AUDIO_PLAYER_PCM_RING_MS 240
+
+/** @brief 先行デコード時に1回の起床でまとめてデコードする最大パケット数 */
+#define AUDIO_PLAYER_DECODE_BATCH_PACKETS 8
+
+/** @brief ライタータスクが1回に書き込む長さ（ミリ秒） */
+#define AUDIO_PLAYER_WRITE_CHUNK_MS 20
+
+/** @brief 受信が途切れてから発話終了とみなすまでの時間（ミリ秒） */
+#define AUDIO_PLAYER_IDLE_TIMEOUT_MS 500
+
+/** @brief 保持するデコーダ数（サーバーTTSのパラメータ変更時に再生成を避けるため2） */
+#define AUDIO_PLAYER_DECODER_CACHE_SIZE 2
+
+/** @brief 再生待ちにできる音声アセットの数（アクティベーションコードの読み上げが収まる数） */
+#define AUDIO_PLAYER_ASSET_QUEUE_SIZE 16
+
+/**
+ * @brief p3の先頭に置くヘッダフレームのtype
+ *
+ * ペイロードはサンプリングレート（uint32）とフレーム長（uint16、ミリ秒）のビッグエンディアン。
+ * scripts/p3_tools で出力レートに合わせて作成したアセットに付き、ない場合は下記の既定値とみなします。
+ */
+#define P3_FRAME_TYPE_HEADER 0x80
+
+/** @brief ヘッダのないアセットの形式（16kHz、60msフレーム、デコードバッファは最大120ms分） */
+#define AUDIO_PLAYER_ASSET_SAMPLE_RATE 16000
+#define AUDIO_PLAYER_ASSET_FRAME_MS 60
+#define AUDIO_PLAYER_ASSET_MAX_FRAME_MS 120
+
+/** @brief デコード済みPCMキャッシュのエントリ数 */
+#define AUDIO_PLAYER_PCM_CACHE_ENTRIES 16
+
+/** @brief キャッシュを追加するときにPSRAMへ残しておく空き容量 */
+#define AUDIO_PLAYER_PCM_CACHE_RESERVE_BYTES (256 * 1024)
+
+
+/**
+ * @class AudioPlayer
+ * @brief 専用タスクで動作する再生パイプライン
+ *
+ * 受信キュー（AudioPacketQueue）の唯一の消費者です。
+ * Reset()/SetMuted()/SetDecodeSampleRate() は任意のタスクから呼び出せます。
+ * デコードタスクは仕事がない間は周期的に起きず、Enqueue()/Notify()/Reset()/EnableOutput()で起こされます。
+ *
+ * 受信パケットの到着時刻から、一定速度で届いた場合に比べてどれだけ遅れたか（ジッタ）を
+ * 発話ごとに計測し、次の発話では再生開始前にその分を溜めてから再生します。
+ */
+class AudioPlayer {
+public:
+    explicit AudioPlayer(AudioPacketQueue& queue);
+    ~AudioPlayer();
+
+    /**
+     * @brief デコーダを初期化して再生タスクを開始
+     * @param codec 出力先のオーディオコーデック
+     * @param sample_rate 初期デコードサンプリングレート
+     * @param frame_duration 初期フレーム長（ミリ秒）
+     */
+    void Start(AudioCodec* codec, int sample_rate, int frame_duration);
+
+    /**
+     * @brief デコードするストリームのサンプリングレートとフレーム長を設定
+     * @note 使用済みの組み合わせはデコーダとリサンプラーを保持しており、
+     *       切り替え時は状態のリセットのみでヒープ確保を行いません
+     */
+    void SetDecodeSampleRate(int sample_rate, int frame_duration);
+
+    /** @brief デコーダ状態とPCMリング、ジッタバッファをリセット */
+    void Reset();
+
+    /** @brief コーデックの出力を切り替える（有効にした時はデコードタスクを起こす） */
+    void EnableOutput(bool enable);
+
+    /** @brief デコードタスクを起こす（受信キューへパケットを積んだ後に呼ぶ） */
+    void Notify();
+
+    /**
+     * @brief p3形式の音声アセットを再生待ちに追加（呼び出し側はブロックしない）
+     * @param sound フラッシュにマップされたアセット（再生が終わるまで有効なこと）
+     * @param voice 重ねるボイス（通知音は再生中に話声をダッキングする）
+     * @return 再生待ちが満杯の場合false
+     *
+     * アセットは追加した順で再生し、受信ストリームの再生中はその上に重ねます。
+     * フレームはフラッシュ上から直接デコードし、受信キューを経由しません。
+     */
+    bool PlayAsset(std::string_view sound, AudioVoice voice = kAudioVoiceNotification);
+
+    /**
+     * @brief 受信キューの基本の上限（パケット数）を設定
+     *
+     * 再生より速く届いて満杯になった場合は、AUDIO_PLAYER_QUEUE_MAX_MSまで一時的に広げ、
+     * 再生が終わると基本の上限へ戻します。
+     */
+    void SetQueueLimit(size_t packets);
+
+    /**
+     * @brief 受信パケットを受信キューへ追加し、到着間隔を計測してデコードタスクを起こす
+     * @return 満杯で破棄した場合false
+     * @note 受信キューの生産者として呼び出す（複数のタスクから呼ぶ場合は呼び出し側で直列化する）
+     */
+    bool Enqueue(const AudioStreamView& view);
+
+    /** @brief ボイスのゲインを設定（パーセント、任意のタスクから呼び出し可） */
+    void SetVoiceGain(AudioVoice voice, int percent) { mixer_.SetGain(voice, percent); }
+
+    /** @brief 通知音の再生中の話声のゲインと移行時間を設定 */
+    void SetDucking(int percent, int ramp_ms);
+
+    /** @brief 出力リミッター（有効/無効の切り替えと統計の取得は任意のタスクから可能） */
+    AudioLimiter& limiter() { return limiter_; }
+
+    /** @brief ミュート中は受信パケットをデコードせずに破棄（アセットは再生する） */
+    void SetMuted(bool muted) { muted_ = muted; }
+
+    /** @brief 受信キューが空になった時のコールバック（デコードタスクから呼ばれる） */
+    void OnQueueDrained(std::function<void()> callback) { on_queue_drained_ = callback; }
+
+    /**
+     * @brief パケットをPCMリングへ書き込んだ時のコールバック（サーバーAEC用）
+     *
+     * play_usはリングに先に入っている量から見積もった再生開始時刻（esp_timer_get_time）です。
+     */
+    void OnPacketDecoded(std::function<void(uint32_t timestamp, int64_t play_us)> callback) { on_packet_decoded_ = callback; }
+
+    /** @brief 発話を再生中（またはバッファリング中、デコード済みの話声が残っている）かどうか */
+    bool IsPlaying() const {
+        return state_ != kStateIdle || pending_assets_ > 0 ||
+            (voice_rings_[kAudioVoiceSpeech] != nullptr && xStreamBufferBytesAvailable(voice_rings_[kAudioVoiceSpeech]) > 0);
+    }
+
+    /** @brief 最後にコーデックへ音声を書き込んだ時刻（esp_timer_get_time、マイクロ秒） */
+    int64_t last_output_time_us() const { return last_output_time_us_; }
+
+    /** @brief コーデックへ書き込んだ受信音声のサンプル数（無音の埋め合わせは含まない、折り返しあり） */
+    uint32_t played_samples() const { return played_samples_; }
+
+    int sample_rate() const { return decode_sample_rate_; }
+    int duration_ms() const { return decode_frame_duration_; }
+    int jitter_target() const { return jitter_target_; }
+    /** @brief 計測した到着ジッタ（ミリ秒、直近の発話ほど重い平均） */
+    int measured_jitter_ms() const { return measured_jitter_ms_; }
+    uint32_t queue_grow_count() const { return queue_grow_count_; }
+    uint32_t underrun_count() const { return underrun_count_; }
+    uint32_t late_packet_count() const { return late_packet_count_; }
+    size_t max_queue_depth() const { return max_queue_depth_; }
+
+private:
+    /** @brief デコードタスクの状態 */
+    enum State {
+        kStateIdle,        /**< 発話なし */
+        kStateBuffering,   /**< ジッタバッファ蓄積中 */
+        kStatePlaying,     /**< 連続デコード中 */
+    };
+
+    AudioPacketQueue& queue_;                       /**< 受信キュー（消費者はデコードタスク） */
+    AudioCodec* codec_ = nullptr;                   /**< 出力先コーデック */
+
+    /** @brief (サンプリングレート, フレーム長) ごとのデコーダと出力リサンプラー */
+    struct DecoderSlot {
+        int sample_rate = 0;
+        int frame_duration = 0;
+        int frame_samples = 0;                      /**< 1フレームのデコード後のサンプル数 */
+        OpusDecoder* decoder = nullptr;
+        PolyphaseResampler resampler;
+        uint32_t last_used = 0;                     /**< LRU判定用 */
+    };
+
+    PriorityMutex decoder_mutex_{"audio_decoder"};  /**< デコーダ・リサンプラー保護用 */
+    esp_pm_lock_handle_t pm_lock_ = nullptr;        /**< DFS有効時、デコードとリサンプルの間だけ保持する */
+    DecoderSlot decoders_[AUDIO_PLAYER_DECODER_CACHE_SIZE];
+    DecoderSlot* active_decoder_ = nullptr;         /**< 現在のストリーム用（常にデコーダを持つ） */
+    uint32_t decoder_use_count_ = 0;
+    int decode_sample_rate_ = 0;
+    int decode_frame_duration_ = 0;
+
+    /** @brief ボイスごとのデコード済みPCMリング（書き込みはデコードタスク、読み出しはライタータスク） */
+    StreamBufferHandle_t voice_rings_[kAudioVoiceCount] = {};
+    StaticStreamBuffer_t voice_ring_structs_[kAudioVoiceCount];
+    uint8_t* ring_storage_ = nullptr;               /**< 全ボイス分をまとめて確保 */
+    size_t write_chunk_bytes_ = 0;
+    size_t last_render_bytes_ = 0;                  /**< 直前に話声のリングへ書いたバイト数（デコードタスクのみ） */
+    AudioMixer mixer_;
+    AudioLimiter limiter_;                          /**< ミックス後、コーデックへ書き込む直前に適用 */
+
+    TaskHandle_t decode_task_handle_ = nullptr;
+    TaskHandle_t write_task_handle_ = nullptr;
+
+    std::atomic<State> state_{kStateIdle};
+    std::atomic<bool> muted_{false};
+    std::atomic<bool> reset_requested_{false};
+    std::atomic<bool> flush_requested_{false};
+    std::atomic<int64_t> last_output_time_us_{0};
+    std::atomic<uint32_t> played_samples_{0};
+
+    // ジッタバッファ（デコードタスクのみが更新）
+    std::atomic<int> jitter_target_{AUDIO_PLAYER_JITTER_INITIAL_PACKETS};
+    int64_t buffering_start_us_ = 0;       /**< バッファリング開始時刻 */
+    std::atomic<int64_t> starved_since_us_{0};  /**< 再生中にキューが空になった時刻 */
+    int stable_packets_ = 0;               /**< アンダーランなしで連続再生したパケット数 */
+    uint32_t last_timestamp_ = 0;          /**< 直前に再生したパケットのタイムスタンプ */
+    std::atomic<uint32_t> underrun_count_{0};
+    std::atomic<uint32_t> late_packet_count_{0};
+    std::atomic<size_t> max_queue_depth_{0};  /**< 受信キュー長の最大値 */
+
+    // 到着ジッタの計測（受信キューの生産者のみが更新）
+    int64_t arrival_start_us_ = 0;         /**< 現在の受信バーストの最初の到着時刻 */
+    int64_t last_arrival_us_ = 0;
+    uint32_t arrival_count_ = 0;           /**< 現在のバーストで受信したパケット数 */
+    int64_t arrival_max_late_us_ = 0;      /**< 一定速度で届いた場合の予定時刻からの最大の遅れ */
+    std::atomic<int> measured_jitter_ms_{0};
+    std::atomic<size_t> queue_base_limit_{0};   /**< 受信キューの基本の上限（0なら未設定） */
+    std::atomic<uint32_t> queue_grow_count_{0};
+
+    AudioStreamPacket packet_;             /**< 取り出したパケット */
+    std::vector<int16_t> render_;          /**< リングへ書き込む出力レートのPCM（デコードとリサンプルの唯一の出力先） */
+
+    // 音声アセット（再生待ちは任意のタスクから追加、デコードはデコードタスクのみ）
+    struct QueuedAsset {
+        std::string_view sound;
+        AudioVoice voice = kAudioVoiceNotification;
+    };
+    std::mutex asset_mutex_;
+    QueuedAsset assets_[AUDIO_PLAYER_ASSET_QUEUE_SIZE];
+    size_t asset_head_ = 0;
+    std::atomic<size_t> pending_assets_{0};    /**< 再生待ち + 再生中のアセット数 */
+    OpusDecoder* asset_decoder_ = nullptr;     /**< アセット専用（最初の再生時に作成） */
+    int asset_sample_rate_ = 0;                /**< asset_decoder_のサンプリングレート */
+    PolyphaseResampler asset_resampler_;
+    std::vector<int16_t> asset_pcm_;           /**< アセットの出力レートのPCM */
+
+#if CONFIG_USE_SOUND_PCM_CACHE
+    /** @brief アセットごとのデコード済みPCM（出力レート、PSRAM）。デコードタスクのみが操作する */
+    struct PcmCacheEntry {
+        const char* key = nullptr;          /**< アセットの先頭アドレス */
+        int16_t* pcm = nullptr;
+        size_t samples = 0;
+        size_t bytes = 0;                   /**< 確保しているバイト数 */
+        uint32_t last_used = 0;             /**< LRU判定用 */
+    };
+    PcmCacheEntry pcm_cache_[AUDIO_PLAYER_PCM_CACHE_ENTRIES];
+    size_t pcm_cache_bytes_ = 0;
+    uint32_t pcm_cache_use_count_ = 0;
+
+    PcmCacheEntry* FindCachedPcm(std::string_view sound);
+    /**
+     * @brief キャッシュ用の領域を確保（容量やPSRAMが足りなければ古いエントリを破棄）
+     * @return 確保できなければnullptr
+     */
+    PcmCacheEntry* ReservePcmCache(size_t samples);
+    void EvictPcmCache(PcmCacheEntry& entry);
+#endif
+
+    /** @brief 再生中のアセット（デコードタスクのみが操作する） */
+    struct ActiveAsset {
+        std::string_view sound;                /**< 空なら再生中のアセットなし */
+        AudioVoice voice = kAudioVoiceNotification;
+        size_t offset = 0;                     /**< 次のp3フレームの位置（キャッシュ再生時はサンプル位置） */
+        int sample_rate = 0;
+        size_t max_frame_bytes = 0;            /**< 1フレームの出力の最大バイト数 */
+#if CONFIG_USE_SOUND_PCM_CACHE
+        const int16_t* cached = nullptr;       /**< キャッシュから再生する場合のPCM */
+        size_t cached_samples = 0;
+        PcmCacheEntry* entry = nullptr;        /**< デコード結果を保存するキャッシュ */
+        size_t filled = 0;
+        size_t capacity = 0;
+        bool complete = true;
+#endif
+    };
+    ActiveAsset asset_;
+
+    std::function<void()> on_queue_drained_;
+    std::function<void(uint32_t timestamp, int64_t play_us)> on_packet_decoded_;
+
+    void DecodeLoop();
+    void WriteLoop();
+    bool WaitForJitterBuffer();
+    /** @brief キューが空の間に眠る時間 */
+    TickType_t StarvationWaitTicks() const;
+    /** @brief ジッタバッファの蓄積を待つ間に眠る時間 */
+    TickType_t JitterWaitTicks() const;
+    /** @brief 書きかけのアセットがある間に眠る時間 */
+    TickType_t AssetWaitTicks() const;
+    /** @brief 到着時刻を記録し、受信が途切れていれば前のバーストの遅れをジッタへ反映 */
+    void MeasureArrival();
+    /** @brief 計測したジッタを吸収するのに必要なパケット数 */
+    int MeasuredJitterPackets() const;
+    void DecodePacket();
+    /**
+     * @brief opusフレームをデコードしてrender_へ出力レートのPCMを書き込む
+     *
+     * リサンプルが必要な場合はリサンプラーの履歴バッファへ直接デコードするため、
+     * ペイロードからrender_までの中間バッファはありません。
+     * @param payload 空なら欠落フレームとしてPLCで補間する
+     * @return 出力したサンプル数（デコード失敗時は0）
+     */
+    static size_t RenderFrame(OpusDecoder* decoder, PolyphaseResampler* resampler, const uint8_t* payload,
+        size_t payload_size, int max_samples, std::vector<int16_t>& output);
+    /** @brief 再生待ちの先頭のアセットの再生を開始（なければfalse） */
+    bool BeginNextAsset();
+    /**
+     * @brief 再生中のアセットをボイスのリングに入るだけデコードして書き込む（ブロックしない）
+     * @return 1フレーム以上書き込んだ場合true
+     */
+    bool StepAsset();
+    /** @brief 再生し終えたアセットをキャッシュへ登録し、再生待ちから外す */
+    void FinishAsset();
+    /** @brief 話声のリングに次のパケットのPCMが待たずに入るか（先行デコードを続けるかの判定） */
+    bool HasRoomForFrame() const;
+    /** @brief 話声のPCMをリングへ書き込む（満杯の間はライタータスクの消費を待つ） */
+    void WritePcm(const int16_t* pcm, size_t samples);
+    /** @brief 話声以外のボイスのリングにデータがあるか */
+    bool HasOverlay() const;
+    void HandleStarvation();
+};
+
+#endif // AUDIO_PLAYER_H
@@ -1,56 +1,114 @@
 #include "afe_audio_processor.h"
+#include "afe_profile.h"
+#include "task_factory.h"
+#include "trace_recorder.h"
+#include "audio_tap.h"
+#if CONFIG_USE_WAKE_WORD_DETECT
+#include "wake_word_config.h"
+#endif
 #include <esp_log.h>
 
+#include <algorithm>
+
 #define PROCESSOR_RUNNING 0x01
+#define WAKE_WORD_RUNNING 0x02
+#define WAKE_WORD_GATED 0x04
 
 static const char* TAG = "AfeAudioProcessor";
 
 AfeAudioProcessor::AfeAudioProcessor()
     : afe_data_(nullptr) {
     event_group_ = xEventGroupCreate();
+
+    auto ret = esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "audio_processor", &pm_lock_);
+    if (ret == ESP_ERR_NOT_SUPPORTED) {
+        pm_lock_ = nullptr;
+    } else {
+        ESP_ERROR_CHECK(ret);
+    }
 }
 
 void AfeAudioProcessor::Initialize(AudioCodec* codec) {
     codec_ = codec;
-    int ref_num = codec_->input_reference() ? 1 : 0;
 
-    std::string input_format;
-    for (int i = 0; i < codec_->input_channels() - ref_num; i++) {
-        input_format.push_back('M');
-    }
-    for (int i = 0; i < ref_num; i++) {
-        input_format.push_back('R');
-    }
+    std::string input_format = codec_->input_format();
 
+#if CONFIG_USE_WAKE_WORD_DETECT
+    // ウェイクワード検出と同じモデルリストを使い、パーティションの再読み込みを避ける
+    srmodel_list_t *models = WakeWordConfig::GetInstance().models();
+#else
     srmodel_list_t *models = esp_srmodel_init("model");
-    char* ns_model_name = esp_srmodel_filter(models, ESP_NSNET_PREFIX, NULL);
+#endif
+    auto profile = AfeProfile::GetInstance().Resolve();
 
-    afe_config_t* afe_config = afe_config_init(input_format.c_str(), NULL, AFE_TYPE_VC, AFE_MODE_HIGH_PERF);
+#if CONFIG_USE_SHARED_AUDIO_FRONTEND
+    // 1つのSR型AFEでAEC/NSを一度だけ行い、WakeNetとVC出力の両方に分岐する
+    afe_config_t* afe_config = afe_config_init(input_format.c_str(), models, AFE_TYPE_SR, AfeProfile::AfeMode(profile));
+    // 設定で無効にされている場合はWakeNetを作らない
+    bool wakenet = WakeWordConfig::GetInstance().enabled();
+    afe_config->wakenet_init = wakenet;
+    if (wakenet) {
+        WakeWordConfig::GetInstance().ApplyModels(afe_config);
+    }
+    afe_config->aec_init = codec_->input_reference();
+#else
+    afe_config_t* afe_config = afe_config_init(input_format.c_str(), NULL, AFE_TYPE_VC, AfeProfile::AfeMode(profile));
 #ifdef CONFIG_USE_DEVICE_AEC
     afe_config->aec_init = true;
-    afe_config->aec_mode = AEC_MODE_VOIP_HIGH_PERF;
 #else
     afe_config->aec_init = false;
+#endif
 #endif
     afe_config->ns_init = true;
-    afe_config->ns_model_name = ns_model_name;
-    afe_config->afe_ns_mode = AFE_NS_MODE_NET;
+#ifdef CONFIG_USE_DEVICE_AEC
+    AfeProfile::Apply(afe_config, profile, models, true);
+#else
+    AfeProfile::Apply(afe_config, profile, models, false);
+#endif
 #ifdef CONFIG_USE_DEVICE_AEC
     afe_config->vad_init = false;
 #else
     afe_config->vad_init = true;
     afe_config->vad_mode = VAD_MODE_0;
     afe_config->vad_min_noise_ms = 100;
+#if CONFIG_LOCAL_ENDPOINT_NN_VAD
+    // VADNetがあれば使う（見つからなければWebRTC VADのまま）
+    char* vad_model = esp_srmodel_filter(models, ESP_VADN_PREFIX, NULL);
+    if (vad_model != nullptr) {
+        afe_config->vad_model_name = vad_model;
+        ESP_LOGI(TAG, "Using VAD model %s", vad_model);
+    } else {
+        ESP_LOGW(TAG, "No VADNet model found, using WebRTC VAD");
+    }
+#endif
 #endif
-    afe_config->afe_perferred_core = 1;
+    // AFE内部のタスクのコアは配置表の "afe"（コア指定なしにはできないため0に寄せる）
+    afe_config->afe_perferred_core = std::max(GetTaskCore("afe", CONFIG_AFE_TASK_CORE), 0);
     afe_config->afe_perferred_priority = 1;
+#if CONFIG_USE_AFE_AGC
+    // 遠場の小さな声をASRに十分な音量まで持ち上げる。実行時はenable/disable_agcで切り替える
+    afe_config->agc_init = true;
+    afe_config->agc_mode = AFE_AGC_MODE_WEBRTC;
+    afe_config->agc_target_level_dbfs = CONFIG_AFE_AGC_TARGET_LEVEL_DBFS;
+    afe_config->agc_compression_gain_db = CONFIG_AFE_AGC_COMPRESSION_GAIN_DB;
+    agc_available_ = true;
+    agc_enabled_ = true;
+#else
     afe_config->agc_init = false;
+#endif
     afe_config->memory_alloc_mode = AFE_MEMORY_ALLOC_MORE_PSRAM;
 
     afe_iface_ = esp_afe_handle_from_config(afe_config);
     afe_data_ = afe_iface_->create_from_config(afe_config);
+#if CONFIG_USE_SHARED_AUDIO_FRONTEND
+    // StartDetection()まではWakeNetを止めておく
+    if (wakenet) {
+        WakeWordConfig::GetInstance().ApplyThresholds(afe_iface_, afe_data_);
+        afe_iface_->disable_wakenet(afe_data_);
+    }
+#endif
     
-    xTaskCreate([](void* arg) {
+    CreateTask([](void* arg) {
         auto this_ = (AfeAudioProcessor*)arg;
         this_->AudioProcessorTask();
         vTaskDelete(NULL);
@@ -62,6 +120,12 @@ AfeAudioProcessor::~AfeAudioProcessor() {
         afe_iface_->destroy(afe_data_);
     }
     vEventGroupDelete(event_group_);
+    if (pm_lock_ != nullptr) {
+        if (pm_lock_held_) {
+            esp_pm_lock_release(pm_lock_);
+        }
+        esp_pm_lock_delete(pm_lock_);
+    }
 }
 
 size_t AfeAudioProcessor::GetFeedSize() {
@@ -79,21 +143,112 @@ void AfeAudioProcessor::Feed(const std::vector<int16_t>& data) {
 }
 
 void AfeAudioProcessor::Start() {
+#if CONFIG_USE_VAD_GATED_UPLINK
+    gate_reset_ = true;
+#endif
     xEventGroupSetBits(event_group_, PROCESSOR_RUNNING);
+    UpdatePmLock();
 }
 
 void AfeAudioProcessor::Stop() {
     xEventGroupClearBits(event_group_, PROCESSOR_RUNNING);
-    if (afe_data_ != nullptr) {
-        afe_iface_->reset_buffer(afe_data_);
+    UpdatePmLock();
+    ResetBufferIfIdle();
+}
+
+void AfeAudioProcessor::UpdatePmLock() {
+    if (pm_lock_ == nullptr) {
+        return;
     }
+    std::lock_guard<std::mutex> lock(pm_mutex_);
+    auto bits = xEventGroupGetBits(event_group_);
+    bool need = (bits & PROCESSOR_RUNNING) || ((bits & WAKE_WORD_RUNNING) && !(bits & WAKE_WORD_GATED));
+    if (need == pm_lock_held_) {
+        return;
+    }
+    if (need) {
+        esp_pm_lock_acquire(pm_lock_);
+    } else {
+        esp_pm_lock_release(pm_lock_);
+    }
+    pm_lock_held_ = need;
 }
 
 bool AfeAudioProcessor::IsRunning() {
     return xEventGroupGetBits(event_group_) & PROCESSOR_RUNNING;
 }
 
-void AfeAudioProcessor::OnOutput(std::function<void(std::vector<int16_t>&& data)> callback) {
+void AfeAudioProcessor::ResetBufferIfIdle() {
+    // 共有フロントエンドでは、もう一方の利用者が残っている間はバッファを保持する
+    if (afe_data_ != nullptr && (xEventGroupGetBits(event_group_) & (PROCESSOR_RUNNING | WAKE_WORD_RUNNING)) == 0) {
+        afe_iface_->reset_buffer(afe_data_);
+    }
+}
+
+#if CONFIG_USE_SHARED_AUDIO_FRONTEND
+void AfeAudioProcessor::OnFrontEndFetch(std::function<void(const afe_fetch_result_t* res)> callback) {
+    front_end_fetch_callback_ = callback;
+}
+
+void AfeAudioProcessor::EnableWakeWord(bool enable) {
+    if (afe_data_ == nullptr) {
+        return;
+    }
+    if (enable) {
+        afe_iface_->enable_wakenet(afe_data_);
+        xEventGroupSetBits(event_group_, WAKE_WORD_RUNNING);
+        UpdatePmLock();
+    } else {
+        xEventGroupClearBits(event_group_, WAKE_WORD_RUNNING);
+        UpdatePmLock();
+        afe_iface_->disable_wakenet(afe_data_);
+        ResetBufferIfIdle();
+    }
+}
+
+void AfeAudioProcessor::SetWakeWordGated(bool gated) {
+    if (gated) {
+        xEventGroupSetBits(event_group_, WAKE_WORD_GATED);
+    } else {
+        xEventGroupClearBits(event_group_, WAKE_WORD_GATED);
+    }
+    UpdatePmLock();
+}
+
+void AfeAudioProcessor::FeedChunk(const int16_t* data) {
+    if (afe_data_ == nullptr) {
+        return;
+    }
+    afe_iface_->feed(afe_data_, data);
+}
+
+bool AfeAudioProcessor::IsWakeWordEnabled() {
+    return xEventGroupGetBits(event_group_) & WAKE_WORD_RUNNING;
+}
+
+void AfeAudioProcessor::SetWakeWordThreshold(int index, int percent) {
+    if (afe_data_ == nullptr) {
+        return;
+    }
+    WakeWordConfig::ApplyThreshold(afe_iface_, afe_data_, index, percent);
+}
+#endif
+
+bool AfeAudioProcessor::SetAgcEnabled(bool enabled) {
+    if (!agc_available_ || afe_data_ == nullptr) {
+        return false;
+    }
+    if (enabled) {
+        afe_iface_->enable_agc(afe_data_);
+    } else {
+        afe_iface_->disable_agc(afe_data_);
+    }
+    agc_enabled_ = enabled;
+    ESP_LOGI(TAG, "AGC %s", enabled ? "enabled" : "disabled");
+    return true;
+}
+
+void AfeAudioProcessor::OnOutput(std::function<void(const int16_t* data, size_t samples)> callback) {
     output_callback_ = callback;
 }
 
@@ -108,10 +263,15 @@ void AfeAudioProcessor::AudioProcessorTask() {
         feed_size, fetch_size);
 
     while (true) {
-        xEventGroupWaitBits(event_group_, PROCESSOR_RUNNING, pdFALSE, pdTRUE, portMAX_DELAY);
+        xEventGroupWaitBits(event_group_, PROCESSOR_RUNNING | WAKE_WORD_RUNNING, pdFALSE, pdFALSE, portMAX_DELAY);
 
-        auto res = afe_iface_->fetch_with_delay(afe_data_, portMAX_DELAY);
-        if ((xEventGroupGetBits(event_group_) & PROCESSOR_RUNNING) == 0) {
+        afe_fetch_result_t* res;
+        {
+            TRACE_SPAN("afe_fetch");
+            res = afe_iface_->fetch_with_delay(afe_data_, portMAX_DELAY);
+        }
+        auto bits = xEventGroupGetBits(event_group_);
+        if ((bits & (PROCESSOR_RUNNING | WAKE_WORD_RUNNING)) == 0) {
             continue;
         }
         if (res == nullptr || res->ret_value == ESP_FAIL) {
@@ -121,6 +281,15 @@ void AfeAudioProcessor::AudioProcessorTask() {
             continue;
         }
 
+#if CONFIG_USE_SHARED_AUDIO_FRONTEND
+        if ((bits & WAKE_WORD_RUNNING) && front_end_fetch_callback_) {
+            front_end_fetch_callback_(res);
+        }
+#endif
+        if ((bits & PROCESSOR_RUNNING) == 0) {
+            continue;
+        }
+
         // VAD state change
         if (vad_state_change_callback_) {
             if (res->vad_state == VAD_SPEECH && !is_speaking_) {
@@ -132,8 +301,117 @@ void AfeAudioProcessor::AudioProcessorTask() {
             }
         }
 
+#if CONFIG_USE_LOCAL_ENDPOINTING
+        DetectEndpoint(res);
+#endif
+
+#if CONFIG_USE_VAD_GATED_UPLINK
+        if (!GateOutput(res)) {
+            continue;
+        }
+#endif
+
+        AUDIO_TAP(kAudioTapAfeOutput, res->data, res->data_size / sizeof(int16_t), 16000, 1);
         if (output_callback_) {
-            output_callback_(std::vector<int16_t>(res->data, res->data + res->data_size / sizeof(int16_t)));
+            // AFEの出力バッファを次のfetchまで借りて渡す（コピーは受け取り側が必要な分だけ行う）
+            output_callback_(res->data, res->data_size / sizeof(int16_t));
         }
     }
-} 
\ No newline at end of file
+}
+
+#if CONFIG_USE_LOCAL_ENDPOINTING
+void AfeAudioProcessor::SetEndpointing(bool enabled) {
+    if (enabled) {
+        endpoint_reset_ = true;
+    }
+    endpoint_enabled_ = enabled;
+}
+
+void AfeAudioProcessor::OnEndOfUtterance(std::function<void()> callback) {
+    end_of_utterance_callback_ = callback;
+}
+
+void AfeAudioProcessor::DetectEndpoint(const afe_fetch_result_t* res) {
+    if (!endpoint_enabled_) {
+        return;
+    }
+    if (endpoint_reset_.exchange(false)) {
+        endpoint_speech_ms_ = 0;
+        endpoint_silence_ms_ = 0;
+    }
+
+    int chunk_ms = res->data_size / sizeof(int16_t) * 1000 / 16000;
+    if (res->vad_state == VAD_SPEECH) {
+        endpoint_speech_ms_ += chunk_ms;
+        endpoint_silence_ms_ = 0;
+        return;
+    }
+    // 話し始める前の無音では終了しない（聞き取りの終了はサーバーに任せる）
+    if (endpoint_speech_ms_ == 0) {
+        return;
+    }
+    endpoint_silence_ms_ += chunk_ms;
+    if (endpoint_speech_ms_ < CONFIG_LOCAL_ENDPOINT_MIN_SPEECH_MS || endpoint_silence_ms_ < CONFIG_LOCAL_ENDPOINT_SILENCE_MS) {
+        return;
+    }
+
+    endpoint_enabled_ = false;
+    ESP_LOGI(TAG, "End of utterance: %d ms speech, %d ms trailing silence", endpoint_speech_ms_, endpoint_silence_ms_);
+    if (end_of_utterance_callback_) {
+        end_of_utterance_callback_();
+    }
+}
+#endif
+
+#if CONFIG_USE_VAD_GATED_UPLINK
+bool AfeAudioProcessor::GateOutput(const afe_fetch_result_t* res) {
+    size_t samples = res->data_size / sizeof(int16_t);
+    int chunk_ms = samples * 1000 / 16000;
+    if (gate_preroll_.empty() && chunk_ms > 0) {
+        gate_preroll_.resize((CONFIG_VAD_GATE_PREROLL_MS + chunk_ms - 1) / chunk_ms);
+    }
+    if (gate_reset_.exchange(false)) {
+        // 開始直後は開いた状態から始め、話し始めなければ保持時間後に閉じる
+        gate_open_ = true;
+        gate_silence_ms_ = 0;
+        gate_preroll_count_ = 0;
+    }
+
+    if (res->vad_state == VAD_SPEECH) {
+        gate_silence_ms_ = 0;
+        if (!gate_open_) {
+            gate_open_ = true;
+            ESP_LOGI(TAG, "VAD gate opened, flushing %u pre-roll chunks", gate_preroll_count_);
+            for (size_t i = 0; i < gate_preroll_count_ && output_callback_; ++i) {
+                auto& chunk = gate_preroll_[(gate_preroll_head_ + i) % gate_preroll_.size()];
+                output_callback_(chunk.data(), chunk.size());
+            }
+            gate_preroll_count_ = 0;
+        }
+        return true;
+    }
+
+    if (gate_open_) {
+        gate_silence_ms_ += chunk_ms;
+        if (gate_silence_ms_ < CONFIG_VAD_GATE_HANGOVER_MS) {
+            return true;
+        }
+        gate_open_ = false;
+        gate_preroll_head_ = 0;
+        ESP_LOGI(TAG, "VAD gate closed after %d ms of silence", gate_silence_ms_);
+    }
+
+    // 閉じている間は直近のチャンクだけを容量を再利用して保持する
+    if (!gate_preroll_.empty()) {
+        size_t capacity = gate_preroll_.size();
+        size_t tail = (gate_preroll_head_ + gate_preroll_count_) % capacity;
+        gate_preroll_[tail].assign(res->data, res->data + samples);
+        if (gate_preroll_count_ < capacity) {
+            gate_preroll_count_++;
+        } else {
+            gate_preroll_head_ = (gate_preroll_head_ + 1) % capacity;
+        }
+    }
+    return false;
+}
+#endif 
\ No newline at end of file
@@ -13,10 +13,13 @@
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 #include <freertos/event_groups.h>
+#include <esp_pm.h>
 
+#include <atomic>
 #include <string>
 #include <vector>
 #include <functional>
+#include <mutex>
 
 #include "audio_processor.h"
 #include "audio_codec.h"
@@ -50,32 +53,118 @@ public:
     bool IsRunning() override;
     
     /** 処理済み音声データのコールバック設定 */
-    void OnOutput(std::function<void(std::vector<int16_t>&& data)> callback) override;
+    void OnOutput(std::function<void(const int16_t* data, size_t samples)> callback) override;
     
     /** VAD状態変化コールバック設定 */
     void OnVadStateChange(std::function<void(bool speaking)> callback) override;
+
+    /** AFEのAGCを有効/無効化（CONFIG_USE_AFE_AGCで作成した場合のみ） */
+    bool SetAgcEnabled(bool enabled) override;
+    bool agc_enabled() const override { return agc_enabled_; }
     
     /** 1回のフィードで必要なサンプル数を取得 */
     size_t GetFeedSize() override;
 
+#if CONFIG_USE_LOCAL_ENDPOINTING
+    /** 発話終了の検出を有効/無効化 */
+    void SetEndpointing(bool enabled) override;
+
+    /** 発話終了のコールバック設定 */
+    void OnEndOfUtterance(std::function<void()> callback) override;
+#endif
+
+#if CONFIG_USE_SHARED_AUDIO_FRONTEND
+    /**
+     * @brief 共有フロントエンドの取得結果を受け取るコールバックを設定
+     *
+     * EnableWakeWord(true)の間、AEC/NS処理済みの全チャンクとWakeNetの判定結果が
+     * 音声処理タスクから渡されます（ウェイクワード検出側が使用）。
+     */
+    void OnFrontEndFetch(std::function<void(const afe_fetch_result_t* res)> callback);
+
+    /** @brief WakeNetの有効/無効を切り替え（VC出力のStart()/Stop()とは独立） */
+    void EnableWakeWord(bool enable);
+
+    /**
+     * @brief WakeNetへの入力が止まっている間は周波数ロックを手放す
+     *
+     * ウェイクワード検出のエネルギーゲートが閉じている間に使います（WakeNetの状態は維持）。
+     */
+    void SetWakeWordGated(bool gated);
+
+    /** @brief GetFeedSize()サンプルの1チャンクを供給（vectorを作らない版） */
+    void FeedChunk(const int16_t* data);
+
+    /** WakeNetが有効かどうか */
+    bool IsWakeWordEnabled();
+
+    /** @brief WakeNetモデルの検出しきい値を変更（index は0始まり、percent 0で既定値） */
+    void SetWakeWordThreshold(int index, int percent);
+#endif
+
 private:
     // FreeRTOSイベントグループ
     EventGroupHandle_t event_group_ = nullptr;              /**< タスク間通信用イベントグループ */
+
+    // DFS有効時、処理中（VC出力またはWakeNet）だけCPUを最大周波数に保つ
+    esp_pm_lock_handle_t pm_lock_ = nullptr;                /**< CPU周波数ロック */
+    bool pm_lock_held_ = false;                             /**< ロックを保持しているか */
+    std::mutex pm_mutex_;                                   /**< pm_lock_held_の排他制御 */
+
+    /** @brief 実行中フラグに合わせて周波数ロックを取得・解放 */
+    void UpdatePmLock();
     
     // ESP-SR AFEインターフェース
     esp_afe_sr_iface_t* afe_iface_ = nullptr;               /**< AFEインターフェース */
     esp_afe_sr_data_t* afe_data_ = nullptr;                 /**< AFEデータハンドル */
     
     // コールバック関数
-    std::function<void(std::vector<int16_t>&& data)> output_callback_;          /**< 処理済み音声データコールバック */
+    std::function<void(const int16_t* data, size_t samples)> output_callback_;          /**< 処理済み音声データコールバック */
     std::function<void(bool speaking)> vad_state_change_callback_;              /**< VAD状態変化コールバック */
+#if CONFIG_USE_SHARED_AUDIO_FRONTEND
+    std::function<void(const afe_fetch_result_t* res)> front_end_fetch_callback_;  /**< ウェイクワード検出への分岐 */
+#endif
     
     // オーディオコーデックと状態
     AudioCodec* codec_ = nullptr;                           /**< オーディオコーデックインスタンス */
     bool is_speaking_ = false;                              /**< 現在の音声活動状態 */
 
+#if CONFIG_USE_VAD_GATED_UPLINK
+    // VADゲート（AudioProcessorTask専用）
+    bool gate_open_ = true;                                 /**< 出力を送っているかどうか */
+    std::atomic<bool> gate_reset_{false};                   /**< Start()時のリセット要求 */
+    int gate_silence_ms_ = 0;                               /**< ゲートが開いてからの連続無音時間 */
+    std::vector<std::vector<int16_t>> gate_preroll_;        /**< ゲート閉鎖中の直近チャンク（リング） */
+    size_t gate_preroll_head_ = 0;                          /**< 最も古いチャンクの位置 */
+    size_t gate_preroll_count_ = 0;                         /**< 保持しているチャンク数 */
+
+    /**
+     * @brief VAD結果に従って出力するかを判定
+     * @return trueの場合、このチャンクを出力する（プリロールは内部で先に出力済み）
+     */
+    bool GateOutput(const afe_fetch_result_t* res);
+#endif
+
+#if CONFIG_USE_LOCAL_ENDPOINTING
+    // 発話終了の検出（endpoint_enabled_以外はAudioProcessorTask専用）
+    std::atomic<bool> endpoint_enabled_{false};             /**< 検出中（1回検出すると自動で無効になる） */
+    std::atomic<bool> endpoint_reset_{false};               /**< SetEndpointing(true)時のリセット要求 */
+    int endpoint_speech_ms_ = 0;                            /**< 累計の発話時間 */
+    int endpoint_silence_ms_ = 0;                           /**< 最後の発話からの連続無音時間 */
+    std::function<void()> end_of_utterance_callback_;       /**< 発話終了コールバック */
+
+    /** @brief VAD結果から発話終了を判定し、条件を満たせばコールバックを呼ぶ */
+    void DetectEndpoint(const afe_fetch_result_t* res);
+#endif
+
+    /** 入力が不要になった場合のみAFEの内部バッファを破棄 */
+    void ResetBufferIfIdle();
+
     /** AFE音声処理タスク */
     void AudioProcessorTask();
+
+    bool agc_available_ = false;                            /**< AFEをAGC付きで作成したか */
+    std::atomic<bool> agc_enabled_{false};
 };
 
 #endif 
\ No newline at end of file
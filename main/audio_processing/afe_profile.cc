@@ -0,0 +1,213 @@
+#include "afe_profile.h"
+#include "settings.h"
+#include "board.h"
+#if CONFIG_USE_POWER_GOVERNOR
+#include "power_governor.h"
+#endif
+#if CONFIG_USE_THERMAL_MONITOR
+#include "thermal_monitor.h"
+#endif
+
+#include <freertos/task.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#include <algorithm>
+#include <cstdio>
+
+#define TAG "AfeProfile"
+
+#if CONFIG_AFE_PROFILE_LOW_COST
+#define AFE_PROFILE_DEFAULT kAfeProfileLowCost
+#elif CONFIG_AFE_PROFILE_BALANCED
+#define AFE_PROFILE_DEFAULT kAfeProfileBalanced
+#elif CONFIG_AFE_PROFILE_AUTO
+#define AFE_PROFILE_DEFAULT kAfeProfileAuto
+#else
+#define AFE_PROFILE_DEFAULT kAfeProfileHighPerf
+#endif
+
+AfeProfileMode AfeProfile::mode() {
+    Settings settings("audio");
+    int mode = settings.GetInt("afe_profile", AFE_PROFILE_DEFAULT);
+    if (mode < kAfeProfileLowCost || mode > kAfeProfileAuto) {
+        return AFE_PROFILE_DEFAULT;
+    }
+    return (AfeProfileMode)mode;
+}
+
+void AfeProfile::SetMode(AfeProfileMode mode) {
+    Settings settings("audio", true);
+    settings.SetInt("afe_profile", mode);
+    std::lock_guard<std::mutex> lock(mutex_);
+    busy_windows_ = 0;
+    headroom_windows_ = 0;
+    ESP_LOGI(TAG, "Profile set to %s (applied on next restart)", Name(mode));
+}
+
+AfeProfileMode AfeProfile::Resolve() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (resolved_) {
+        return active_;
+    }
+    auto configured = mode();
+    if (configured == kAfeProfileAuto) {
+        // 前回のセッションで決めた候補から始め、電池が少ないか高温なら低負荷にする
+        Settings settings("audio");
+        int next = settings.GetInt("afe_auto", kAfeProfileHighPerf);
+        active_ = (AfeProfileMode)std::clamp(next, (int)kAfeProfileLowCost, (int)kAfeProfileHighPerf);
+        if (BatteryLow() || Overheated()) {
+            active_ = kAfeProfileLowCost;
+        }
+    } else {
+        active_ = configured;
+    }
+    resolved_ = true;
+    ESP_LOGI(TAG, "Using %s profile (configured %s)", Name(active_), Name(configured));
+    return active_;
+}
+
+void AfeProfile::Sample(bool active) {
+    int idle = MeasureIdlePercent();
+    std::lock_guard<std::mutex> lock(mutex_);
+    idle_percent_ = idle;
+    if (!resolved_ || !active || idle < 0) {
+        return;
+    }
+
+    if (idle < AFE_PROFILE_BUSY_IDLE_PERCENT) {
+        headroom_windows_ = 0;
+        busy_windows_++;
+    } else if (idle > AFE_PROFILE_HEADROOM_IDLE_PERCENT) {
+        busy_windows_ = 0;
+        headroom_windows_++;
+    } else {
+        busy_windows_ = 0;
+        headroom_windows_ = 0;
+    }
+
+    int next = active_;
+    if (Overheated()) {
+        // 高温の間に作り直すAFEは低負荷にする（冷えたら余裕を見て1段ずつ戻す）
+        next = kAfeProfileLowCost;
+    } else if (busy_windows_ >= AFE_PROFILE_SWITCH_WINDOWS) {
+        next = std::max<int>(kAfeProfileLowCost, active_ - 1);
+    } else if (headroom_windows_ >= AFE_PROFILE_SWITCH_WINDOWS && !BatteryLow()) {
+        next = std::min<int>(kAfeProfileHighPerf, active_ + 1);
+    } else {
+        return;
+    }
+    busy_windows_ = 0;
+    headroom_windows_ = 0;
+    if (mode() != kAfeProfileAuto) {
+        return;
+    }
+
+    Settings settings("audio", true);
+    if (settings.GetInt("afe_auto", kAfeProfileHighPerf) != next) {
+        settings.SetInt("afe_auto", next);
+        ESP_LOGI(TAG, "Next profile %s -> %s (idle %d%%)", Name(active_), Name((AfeProfileMode)next), idle);
+    }
+}
+
+void AfeProfile::Apply(afe_config_t* afe_config, AfeProfileMode profile, srmodel_list_t* models, bool voip) {
+    if (profile == kAfeProfileLowCost) {
+        afe_config->aec_mode = voip ? AEC_MODE_VOIP_LOW_COST : AEC_MODE_SR_LOW_COST;
+    } else {
+        afe_config->aec_mode = voip ? AEC_MODE_VOIP_HIGH_PERF : AEC_MODE_SR_HIGH_PERF;
+    }
+    if (!afe_config->ns_init) {
+        return;
+    }
+    // NSNetは高性能プロファイルのみ。モデルがパーティションにない場合もWebRTCのNSを使う
+    char* ns_model_name = nullptr;
+    if (profile == kAfeProfileHighPerf) {
+        ns_model_name = esp_srmodel_filter(models, ESP_NSNET_PREFIX, NULL);
+    }
+    afe_config->ns_model_name = ns_model_name;
+    afe_config->afe_ns_mode = ns_model_name != nullptr ? AFE_NS_MODE_NET : AFE_NS_MODE_WEBRTC;
+}
+
+const char* AfeProfile::Name(AfeProfileMode mode) {
+    switch (mode) {
+    case kAfeProfileLowCost:
+        return "low_cost";
+    case kAfeProfileBalanced:
+        return "balanced";
+    case kAfeProfileHighPerf:
+        return "high_perf";
+    default:
+        return "auto";
+    }
+}
+
+bool AfeProfile::Parse(const std::string& name, AfeProfileMode& mode) {
+    for (int i = kAfeProfileLowCost; i <= kAfeProfileAuto; ++i) {
+        if (name == Name((AfeProfileMode)i)) {
+            mode = (AfeProfileMode)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+std::string AfeProfile::ToJson() {
+    auto configured = mode();
+    Settings settings("audio");
+    int next = settings.GetInt("afe_auto", kAfeProfileHighPerf);
+    std::lock_guard<std::mutex> lock(mutex_);
+    char json[192];
+    snprintf(json, sizeof(json),
+        "{\"mode\":\"%s\",\"active\":\"%s\",\"auto_next\":\"%s\",\"idle_percent\":%d,\"battery_low\":%s,"
+        "\"overheated\":%s}",
+        Name(configured), resolved_ ? Name(active_) : "none", Name((AfeProfileMode)next), idle_percent_,
+        BatteryLow() ? "true" : "false", Overheated() ? "true" : "false");
+    return json;
+}
+
+bool AfeProfile::BatteryLow() {
+#if CONFIG_USE_POWER_GOVERNOR
+    // 画面や通信と同じ判定（ヒステリシス付き）にそろえる
+    return PowerGovernor::GetInstance().tier() == kPowerTierSaver;
+#else
+    int level = 0;
+    bool charging = false;
+    bool discharging = false;
+    if (!Board::GetInstance().GetBatteryLevel(level, charging, discharging)) {
+        return false;
+    }
+    return discharging && level <= CONFIG_AFE_PROFILE_LOW_BATTERY_LEVEL;
+#endif
+}
+
+bool AfeProfile::Overheated() {
+#if CONFIG_USE_THERMAL_MONITOR
+    return ThermalMonitor::GetInstance().limits().afe_low_cost;
+#else
+    return false;
+#endif
+}
+
+int AfeProfile::MeasureIdlePercent() {
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS && CONFIG_FREERTOS_USE_TRACE_FACILITY
+    // 実行時間カウンタはesp_timer（マイクロ秒）基準。オーバーフローは符号なし減算で吸収する
+    configRUN_TIME_COUNTER_TYPE idle_time = 0;
+    for (BaseType_t core = 0; core < portNUM_PROCESSORS; ++core) {
+        TaskStatus_t status;
+        vTaskGetInfo(xTaskGetIdleTaskHandleForCore(core), &status, pdFALSE, eRunning);
+        idle_time += status.ulRunTimeCounter;
+    }
+    int64_t now = esp_timer_get_time();
+    int percent = -1;
+    if (last_sample_us_ != 0 && now > last_sample_us_) {
+        configRUN_TIME_COUNTER_TYPE idle_delta = idle_time - last_idle_time_;
+        int64_t elapsed = (now - last_sample_us_) * portNUM_PROCESSORS;
+        percent = std::min<int64_t>(100, (int64_t)idle_delta * 100 / elapsed);
+    }
+    last_idle_time_ = idle_time;
+    last_sample_us_ = now;
+    return percent;
+#else
+    return -1;
+#endif
+}
@@ -0,0 +1,109 @@
+/**
+ * @file afe_profile.h
+ * @brief AFEの演算量プロファイル（低負荷 / 標準 / 高性能）の選択
+ *
+ * AfeAudioProcessorとWakeWordDetectが作成するAFEのモード、AECモード、
+ * ノイズ抑制方式をプロファイルとしてまとめます。プロファイルはNVSの"audio"ネームスペースに
+ * 保存し、自動モードでは電池残量、チップ温度と前回までのCPU余裕から選びます。
+ * AFEのモードは作成時にしか変えられないため、切り替えは次回のAFE作成（再起動）時に反映されます。
+ */
+#ifndef AFE_PROFILE_H
+#define AFE_PROFILE_H
+
+#include <esp_afe_config.h>
+#include <model_path.h>
+#include <freertos/FreeRTOS.h>
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+/** @brief CPUが逼迫しているとみなすアイドル率（%） */
+#define AFE_PROFILE_BUSY_IDLE_PERCENT 15
+
+/** @brief 1段上のプロファイルに戻せるとみなすアイドル率（%） */
+#define AFE_PROFILE_HEADROOM_IDLE_PERCENT 50
+
+/** @brief 自動モードでプロファイルを切り替えるまでに必要な連続区間（秒） */
+#define AFE_PROFILE_SWITCH_WINDOWS 30
+
+enum AfeProfileMode {
+    kAfeProfileLowCost,     // AFE_MODE_LOW_COST、低負荷AEC、WebRTC NS
+    kAfeProfileBalanced,    // AFE_MODE_HIGH_PERF、高性能AEC、WebRTC NS
+    kAfeProfileHighPerf,    // AFE_MODE_HIGH_PERF、高性能AEC、NSNet
+    kAfeProfileAuto,        // 電池残量とCPU余裕から上の3つを選ぶ
+};
+
+/**
+ * @class AfeProfile
+ * @brief AFEプロファイル設定のシングルトン
+ *
+ * Resolve()は最初の呼び出しで実際に使うプロファイルを決め、以降は同じ値を返します。
+ * 共有AFEを使わない構成でもAfeAudioProcessorとWakeWordDetectは同じプロファイルになります。
+ * Sample()はクロックタイマーから1秒ごとに呼び出してください。
+ */
+class AfeProfile {
+public:
+    static AfeProfile& GetInstance() {
+        static AfeProfile instance;
+        return instance;
+    }
+
+    AfeProfile(const AfeProfile&) = delete;
+    AfeProfile& operator=(const AfeProfile&) = delete;
+
+    /** @brief 設定されたモード（未設定ならKconfigの既定値） */
+    AfeProfileMode mode();
+
+    /** @brief モードを保存（次回のAFE作成時に反映） */
+    void SetMode(AfeProfileMode mode);
+
+    /** @brief 今回のAFEに使うプロファイル（kAfeProfileAutoは返さない） */
+    AfeProfileMode Resolve();
+
+    /**
+     * @brief CPUアイドル率を計測し、自動モードなら次回のプロファイルを更新
+     * @param active 聞き取り中（AFEが動いている）かどうか。待機中の余裕は判断に使わない
+     */
+    void Sample(bool active);
+
+    /** @brief プロファイルをAFE設定に書き込む（AFEモード以外） */
+    static void Apply(afe_config_t* afe_config, AfeProfileMode profile, srmodel_list_t* models, bool voip);
+
+    static afe_mode_t AfeMode(AfeProfileMode profile) {
+        return profile == kAfeProfileLowCost ? AFE_MODE_LOW_COST : AFE_MODE_HIGH_PERF;
+    }
+
+    static const char* Name(AfeProfileMode mode);
+
+    /** @brief 名前からモードを取得。不明な名前ならfalse */
+    static bool Parse(const std::string& name, AfeProfileMode& mode);
+
+    /** @brief 設定、今回のプロファイル、自動モードの次回候補と直近のアイドル率をJSONで取得 */
+    std::string ToJson();
+
+private:
+    AfeProfile() = default;
+
+    /** @brief 電池が少なく放電中かどうか */
+    static bool BatteryLow();
+
+    /** @brief 温度が高く低負荷にすべきかどうか */
+    static bool Overheated();
+
+    /** @brief 前回呼び出しからの全コア平均アイドル率（%）。計測できない場合-1 */
+    int MeasureIdlePercent();
+
+    std::mutex mutex_;
+    bool resolved_ = false;
+    AfeProfileMode active_ = kAfeProfileHighPerf;   /**< 今回のAFEのプロファイル */
+    int busy_windows_ = 0;                          /**< 連続して逼迫していた区間数 */
+    int headroom_windows_ = 0;                      /**< 連続して余裕があった区間数 */
+    int idle_percent_ = -1;                         /**< 直近のアイドル率 */
+
+    // CPUアイドル率の計測用
+    configRUN_TIME_COUNTER_TYPE last_idle_time_ = 0;
+    int64_t last_sample_us_ = 0;
+};
+
+#endif // AFE_PROFILE_H
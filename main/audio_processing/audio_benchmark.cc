@@ -0,0 +1,617 @@
+/**
+ * @file audio_benchmark.cc
+ * @brief 音声パイプラインのオンデバイスベンチマークの実装
+ */
+#include "audio_benchmark.h"
+#include "audio_dsp.h"
+#include "polyphase_resampler.h"
+#include "audio_limiter.h"
+#include "opus_memory.h"
+#include "task_factory.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <functional>
+#include <vector>
+#include <esp_app_desc.h>
+#include <esp_cpu.h>
+#include <esp_idf_version.h>
+#include <esp_log.h>
+#include <esp_partition.h>
+#include <esp_pm.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/event_groups.h>
+#include <freertos/task.h>
+#include <mbedtls/aes.h>
+#include <opus_encoder.h>
+#include <opus_decoder.h>
+#include <opus_resampler.h>
+
+#if CONFIG_USE_AUDIO_PROCESSOR
+#include <esp_afe_sr_models.h>
+#include <model_path.h>
+#include "afe_profile.h"
+#endif
+
+#define TAG "AudioBenchmark"
+
+namespace audio_benchmark {
+
+namespace {
+
+struct Result {
+    uint32_t cycles_median;
+    uint32_t cycles_min;
+    uint32_t cycles_max;
+    uint32_t us_median;
+};
+
+/**
+ * @brief setup()を計測外で呼んでからbody()を1回ずつ計測
+ *
+ * 中央値を代表値にし、割り込みなどによる外れ値の影響を抑えます。
+ */
+template <typename Setup, typename Body>
+Result Measure(Setup&& setup, Body&& body) {
+    std::vector<uint32_t> cycles;
+    std::vector<uint32_t> us;
+    cycles.reserve(AUDIO_BENCHMARK_ITERATIONS);
+    us.reserve(AUDIO_BENCHMARK_ITERATIONS);
+    for (int i = 0; i < AUDIO_BENCHMARK_WARMUP + AUDIO_BENCHMARK_ITERATIONS; ++i) {
+        setup(i);
+        int64_t start_us = esp_timer_get_time();
+        uint32_t start = esp_cpu_get_cycle_count();
+        body(i);
+        uint32_t elapsed = esp_cpu_get_cycle_count() - start;
+        int64_t elapsed_us = esp_timer_get_time() - start_us;
+        if (i >= AUDIO_BENCHMARK_WARMUP) {
+            cycles.push_back(elapsed);
+            us.push_back((uint32_t)elapsed_us);
+        }
+    }
+    Result result = {};
+    result.cycles_min = *std::min_element(cycles.begin(), cycles.end());
+    result.cycles_max = *std::max_element(cycles.begin(), cycles.end());
+    std::nth_element(cycles.begin(), cycles.begin() + cycles.size() / 2, cycles.end());
+    std::nth_element(us.begin(), us.begin() + us.size() / 2, us.end());
+    result.cycles_median = cycles[cycles.size() / 2];
+    result.us_median = us[us.size() / 2];
+    return result;
+}
+
+template <typename Body>
+Result Measure(Body&& body) {
+    return Measure([](int) {}, body);
+}
+
+/**
+ * @brief 1ケースを1行のJSONで出力
+ * @param params ケース固有のパラメータ（JSONオブジェクトの中身）
+ */
+void Report(const char* name, const char* params, int frame_ms, const Result& result) {
+    printf("BENCH {\"case\":\"%s\",\"params\":{%s},\"frame_ms\":%d,\"iterations\":%d,"
+        "\"cycles\":%lu,\"cycles_min\":%lu,\"cycles_max\":%lu,\"us\":%lu}\n",
+        name, params, frame_ms, AUDIO_BENCHMARK_ITERATIONS,
+        result.cycles_median, result.cycles_min, result.cycles_max, result.us_median);
+}
+
+/** @brief 音声に近い再現可能な入力（2音の正弦波 + 固定シードの雑音） */
+std::vector<int16_t> GenerateSignal(int sample_rate, size_t samples, int channels = 1) {
+    std::vector<int16_t> signal(samples * channels);
+    uint32_t seed = 12345;
+    for (size_t i = 0; i < samples; ++i) {
+        double t = (double)i / sample_rate;
+        double value = 6000.0 * sin(2.0 * M_PI * 220.0 * t) + 3000.0 * sin(2.0 * M_PI * 1830.0 * t);
+        for (int ch = 0; ch < channels; ++ch) {
+            seed = seed * 1103515245 + 12345;
+            int noise = (int)((seed >> 16) & 0x7FF) - 1024;
+            signal[i * channels + ch] = (int16_t)(ch == 0 ? value + noise : value * 0.3 + noise);
+        }
+    }
+    return signal;
+}
+
+// 60msフレームを1秒分用意し、反復ごとに異なるフレームを使う
+constexpr int kFrameMs = 60;
+constexpr int kSignalFrames = 16;
+
+void BenchmarkOpusEncode() {
+    const size_t frame = 16000 * kFrameMs / 1000;
+    auto signal = GenerateSignal(16000, frame * kSignalFrames);
+    for (int complexity = 0; complexity <= 10; ++complexity) {
+        OpusEncoderWrapper encoder(16000, 1, kFrameMs);
+        encoder.SetComplexity(complexity);
+        std::vector<int16_t> pcm;
+        auto result = Measure([&](int i) {
+            auto begin = signal.begin() + (i % kSignalFrames) * frame;
+            pcm.assign(begin, begin + frame);
+        }, [&](int) {
+            encoder.Encode(std::move(pcm), [](std::vector<uint8_t>&& opus) {});
+        });
+        char params[32];
+        snprintf(params, sizeof(params), "\"complexity\":%d", complexity);
+        Report("opus_encode", params, kFrameMs, result);
+    }
+}
+
+void BenchmarkOpusDecode() {
+    for (int sample_rate : {16000, 24000}) {
+        // 計測対象外でパケットを用意する（サーバーと同程度の複雑度）
+        const size_t frame = sample_rate * kFrameMs / 1000;
+        auto signal = GenerateSignal(sample_rate, frame * kSignalFrames);
+        std::vector<std::vector<uint8_t>> packets;
+        {
+            OpusEncoderWrapper encoder(sample_rate, 1, kFrameMs);
+            encoder.SetComplexity(5);
+            for (int i = 0; i < kSignalFrames; ++i) {
+                std::vector<int16_t> pcm(signal.begin() + i * frame, signal.begin() + (i + 1) * frame);
+                encoder.Encode(std::move(pcm), [&packets](std::vector<uint8_t>&& opus) {
+                    packets.push_back(std::move(opus));
+                });
+            }
+        }
+        if (packets.empty()) {
+            ESP_LOGE(TAG, "No packets encoded at %d Hz", sample_rate);
+            continue;
+        }
+
+        OpusDecoderWrapper decoder(sample_rate, 1, kFrameMs);
+        std::vector<uint8_t> opus;
+        std::vector<int16_t> pcm;
+        auto result = Measure([&](int i) {
+            opus = packets[i % packets.size()];
+        }, [&](int) {
+            decoder.Decode(std::move(opus), pcm);
+        });
+        char params[32];
+        snprintf(params, sizeof(params), "\"sample_rate\":%d", sample_rate);
+        Report("opus_decode", params, kFrameMs, result);
+    }
+}
+
+/** @brief RunOnStack()から測定タスクへ渡す引数 */
+struct StackRun {
+    const std::function<void()>* body;
+    EventGroupHandle_t done;
+};
+
+/**
+ * @brief スタックの配置先を指定したタスクでbody()を実行して終了を待つ
+ *
+ * libopusの作業領域は呼び出したタスクのスタックに取られるため、作業領域の配置を変えて比較できます。
+ * @return タスクを作成できなかった場合false
+ */
+bool RunOnStack(bool psram, const std::function<void()>& body) {
+    StackRun run = {&body, xEventGroupCreate()};
+    auto entry = [](void* arg) {
+        auto run = (StackRun*)arg;
+        (*run->body)();
+        xEventGroupSetBits(run->done, 1);
+        // WithCapsで作成したタスクは自身を削除できないため、呼び出し元が削除する
+        vTaskSuspend(NULL);
+    };
+    TaskHandle_t task = nullptr;
+    BaseType_t core = portNUM_PROCESSORS > 1 ? AUDIO_BENCHMARK_CORE : 0;
+    BaseType_t ret;
+    if (psram) {
+        ret = xTaskCreatePinnedToCoreWithCaps(entry, "opus_bench", 4096 * 8, &run, configMAX_PRIORITIES - 2, &task,
+            core, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    } else {
+        ret = xTaskCreatePinnedToCore(entry, "opus_bench", 4096 * 8, &run, configMAX_PRIORITIES - 2, &task, core);
+    }
+    if (ret == pdPASS) {
+        xEventGroupWaitBits(run.done, 1, pdTRUE, pdTRUE, portMAX_DELAY);
+        DeleteTask(task);
+    }
+    vEventGroupDelete(run.done);
+    return ret == pdPASS;
+}
+
+/**
+ * @brief Opusの状態（内部SRAM/PSRAM）と作業領域（スタック）の配置の組み合わせを測定
+ *
+ * エンコードは複雑度ごと、デコードはレートごとに、すべての組み合わせを1行ずつ出力します。
+ * PSRAMのないボードでは内部SRAMの組み合わせだけを測定します。
+ */
+void BenchmarkOpusPlacement() {
+    bool has_psram = heap_caps_get_total_size(MALLOC_CAP_SPIRAM) > 0;
+    printf("BENCH {\"case\":\"opus_state_size\",\"encoder_bytes\":%d,\"decoder_bytes\":%d,\"psram\":%d}\n",
+        opus_encoder_get_size(1), opus_decoder_get_size(1), has_psram);
+
+    for (int sample_rate : {16000, 24000}) {
+        const size_t frame = sample_rate * kFrameMs / 1000;
+        auto signal = GenerateSignal(sample_rate, frame * kSignalFrames);
+        std::vector<uint8_t> packet(1500);
+
+        // デコード用のパケット（サーバーと同程度の複雑度）
+        std::vector<std::vector<uint8_t>> packets;
+        {
+            int error = 0;
+            auto encoder = opus_memory::CreateEncoder(sample_rate, 1, OPUS_APPLICATION_VOIP, kOpusMemoryDefault, &error);
+            if (encoder == nullptr) {
+                ESP_LOGE(TAG, "Failed to create encoder at %d Hz: %d", sample_rate, error);
+                continue;
+            }
+            opus_encoder_ctl(encoder, OPUS_SET_COMPLEXITY(5));
+            for (int i = 0; i < kSignalFrames; ++i) {
+                int bytes = opus_encode(encoder, signal.data() + i * frame, frame, packet.data(), packet.size());
+                if (bytes > 0) {
+                    packets.emplace_back(packet.begin(), packet.begin() + bytes);
+                }
+            }
+            opus_encoder_destroy(encoder);
+        }
+
+        for (auto state : {kOpusMemoryInternal, kOpusMemoryPsram}) {
+            for (bool psram_stack : {false, true}) {
+                if (!has_psram && (state == kOpusMemoryPsram || psram_stack)) {
+                    continue;
+                }
+                const char* state_name = opus_memory::GetPlacementName(state);
+                const char* scratch_name = psram_stack ? "psram" : "internal";
+
+                for (int complexity : {0, 3, 5, 8, 10}) {
+                    Result result = {};
+                    bool measured = false;
+                    RunOnStack(psram_stack, [&]() {
+                        int error = 0;
+                        auto encoder = opus_memory::CreateEncoder(sample_rate, 1, OPUS_APPLICATION_VOIP, state, &error);
+                        if (encoder == nullptr) {
+                            return;
+                        }
+                        opus_encoder_ctl(encoder, OPUS_SET_COMPLEXITY(complexity));
+                        opus_encoder_ctl(encoder, OPUS_SET_DTX(1));
+                        result = Measure([&](int i) {
+                            opus_encode(encoder, signal.data() + (i % kSignalFrames) * frame, frame,
+                                packet.data(), packet.size());
+                        });
+                        opus_encoder_destroy(encoder);
+                        measured = true;
+                    });
+                    if (measured) {
+                        char params[96];
+                        snprintf(params, sizeof(params),
+                            "\"sample_rate\":%d,\"complexity\":%d,\"state\":\"%s\",\"scratch\":\"%s\"",
+                            sample_rate, complexity, state_name, scratch_name);
+                        Report("opus_encode_placement", params, kFrameMs, result);
+                    }
+                }
+
+                if (packets.empty()) {
+                    continue;
+                }
+                Result result = {};
+                bool measured = false;
+                RunOnStack(psram_stack, [&]() {
+                    int error = 0;
+                    auto decoder = opus_memory::CreateDecoder(sample_rate, 1, state, &error);
+                    if (decoder == nullptr) {
+                        return;
+                    }
+                    std::vector<int16_t> pcm(frame);
+                    result = Measure([&](int i) {
+                        auto& opus = packets[i % packets.size()];
+                        opus_decode(decoder, opus.data(), opus.size(), pcm.data(), frame, 0);
+                    });
+                    opus_decoder_destroy(decoder);
+                    measured = true;
+                });
+                if (measured) {
+                    char params[80];
+                    snprintf(params, sizeof(params), "\"sample_rate\":%d,\"state\":\"%s\",\"scratch\":\"%s\"",
+                        sample_rate, state_name, scratch_name);
+                    Report("opus_decode_placement", params, kFrameMs, result);
+                }
+            }
+        }
+    }
+}
+
+void BenchmarkResamplers() {
+    struct RatePair {
+        int input;
+        int output;
+        bool opus;      // SILKリサンプラーが対応する組か
+    };
+    const RatePair pairs[] = {
+        {24000, 16000, true},
+        {16000, 24000, true},
+        {48000, 16000, true},
+        {16000, 48000, true},
+        {48000, 24000, false},
+    };
+    for (auto& pair : pairs) {
+        const size_t input_block = pair.input * kFrameMs / 1000;
+        auto signal = GenerateSignal(pair.input, input_block * kSignalFrames);
+        std::vector<int16_t> output(pair.output * kFrameMs / 1000 * 2);
+        char params[48];
+        snprintf(params, sizeof(params), "\"input\":%d,\"output\":%d", pair.input, pair.output);
+
+        if (pair.opus) {
+            OpusResampler resampler;
+            resampler.Configure(pair.input, pair.output);
+            auto result = Measure([&](int i) {
+                resampler.Process(signal.data() + (i % kSignalFrames) * input_block, input_block, output.data());
+            });
+            Report("opus_resample", params, kFrameMs, result);
+        }
+
+        PolyphaseResampler resampler;
+        resampler.Configure(pair.input, pair.output);
+        auto result = Measure([&](int i) {
+            resampler.Process(signal.data() + (i % kSignalFrames) * input_block, input_block, output.data());
+        });
+        Report("polyphase_resample", params, kFrameMs, result);
+    }
+}
+
+/** @brief ReadAudio()の2チャンネル入力の変換（分離のみ / 24kHzの分離 + 3:2間引き） */
+void BenchmarkReadAudio() {
+    {
+        const size_t frames = 16000 * kFrameMs / 1000;
+        auto stereo = GenerateSignal(16000, frames, 2);
+        std::vector<int16_t, audio_dsp::AlignedAllocator<int16_t>> input(stereo.begin(), stereo.end());
+        std::vector<int16_t, audio_dsp::AlignedAllocator<int16_t>> left(frames), right(frames);
+        auto result = Measure([&](int) {
+            audio_dsp::Deinterleave(input.data(), left.data(), right.data(), frames);
+        });
+        Report("read_audio_deinterleave", "\"input\":16000,\"channels\":2", kFrameMs, result);
+    }
+    {
+        const size_t frames = 24000 * kFrameMs / 1000;
+        auto stereo = GenerateSignal(24000, frames, 2);
+        audio_dsp::StereoDecimator3to2 decimator;
+        std::vector<int16_t> output((frames / 3 * 2 + 2) * 2);
+        auto result = Measure([&](int) {
+            decimator.Process(stereo.data(), frames, output.data());
+        });
+        Report("read_audio_decimate", "\"input\":24000,\"channels\":2", kFrameMs, result);
+    }
+}
+
+#if CONFIG_AUDIO_REALTIME_PROFILE
+constexpr int kRealtimeProfile = 1;
+#else
+constexpr int kRealtimeProfile = 0;
+#endif
+
+/** @brief キャッシュ圧迫タスクの状態 */
+struct CachePressure {
+    const uint8_t* data;
+    size_t size;
+    volatile bool stop;
+    volatile uint32_t sink;     // 読み出しを最適化で消されないように
+    EventGroupHandle_t done;
+};
+
+/** @brief フラッシュ上のデータをキャッシュラインごとに読み続け、キャッシュを追い出す */
+void CachePressureTask(void* arg) {
+    auto pressure = (CachePressure*)arg;
+    uint32_t sum = 0;
+    while (!pressure->stop) {
+        for (size_t offset = 0; offset < pressure->size && !pressure->stop; offset += 32) {
+            sum += pressure->data[offset];
+        }
+    }
+    pressure->sink = sum;
+    xEventGroupSetBits(pressure->done, 1);
+    vTaskDelete(NULL);
+}
+
+/**
+ * @brief もう一方のコアでフラッシュキャッシュを圧迫しながら、ReadAudio()の変換を計測
+ *
+ * OTAの書き込みやフラッシュ上のアセット読み出しでキャッシュが混んでいる状態を再現します。
+ * 圧迫なし/ありの cycles_max の差がジッタで、CONFIG_AUDIO_REALTIME_PROFILE の有無で
+ * 比べます（scripts/bench_compare.py --metric cycles_max）。
+ */
+void BenchmarkCachePressure() {
+    if (portNUM_PROCESSORS < 2) {
+        return;
+    }
+    // 数百KBあるモデルパーティションを使う（キャッシュより十分大きい）
+    auto partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, "model");
+    const void* mapped = nullptr;
+    esp_partition_mmap_handle_t handle;
+    if (partition == nullptr || esp_partition_mmap(partition, 0, partition->size, ESP_PARTITION_MMAP_DATA, &mapped, &handle) != ESP_OK) {
+        ESP_LOGW(TAG, "No model partition to map, skipping cache pressure benchmark");
+        return;
+    }
+
+    const size_t frames = 24000 * kFrameMs / 1000;
+    auto stereo = GenerateSignal(24000, frames, 2);
+    audio_dsp::StereoDecimator3to2 decimator;
+    std::vector<int16_t> decimated((frames / 3 * 2 + 2) * 2);
+    std::vector<int16_t, audio_dsp::AlignedAllocator<int16_t>> input(stereo.begin(), stereo.end());
+    std::vector<int16_t, audio_dsp::AlignedAllocator<int16_t>> left(frames), right(frames);
+    PolyphaseResampler resampler;
+    resampler.Configure(24000, 16000);
+    std::vector<int16_t> resampled(frames);
+
+    for (int with_pressure = 0; with_pressure <= 1; ++with_pressure) {
+        CachePressure pressure = {(const uint8_t*)mapped, partition->size, false, 0, xEventGroupCreate()};
+        if (with_pressure) {
+            xTaskCreatePinnedToCore(CachePressureTask, "cache_pressure", 2048, &pressure, configMAX_PRIORITIES - 2, nullptr,
+                AUDIO_BENCHMARK_CORE == 0 ? 1 : 0);
+        }
+        // 2チャンネル入力の経路（3:2間引き）と、分離 + リサンプルの経路を1フレーム分
+        auto result = Measure([&](int) {
+            decimator.Process(input.data(), frames, decimated.data());
+            audio_dsp::Deinterleave(input.data(), left.data(), right.data(), frames);
+            resampler.Process(left.data(), frames, resampled.data());
+        });
+        if (with_pressure) {
+            pressure.stop = true;
+            xEventGroupWaitBits(pressure.done, 1, pdTRUE, pdTRUE, portMAX_DELAY);
+        }
+        vEventGroupDelete(pressure.done);
+
+        char params[32];
+        snprintf(params, sizeof(params), "\"pressure\":%d", with_pressure);
+        Report("cache_pressure_read_audio", params, kFrameMs, result);
+    }
+    esp_partition_munmap(handle);
+}
+
+#if CONFIG_USE_AUDIO_PROCESSOR
+/**
+ * @brief AFE（AEC + NS + VAD、agcならAGCも）のfeed/fetchを同じタスクで交互に呼んで計測
+ *
+ * プロファイルごとのコア負荷として、1フレーム分のfeed + fetchの時間がフレーム長に占める割合も出力します。
+ */
+void BenchmarkAfe(AfeProfileMode profile, bool agc) {
+    srmodel_list_t* models = esp_srmodel_init("model");
+
+    afe_config_t* afe_config = afe_config_init("MR", NULL, AFE_TYPE_VC, AfeProfile::AfeMode(profile));
+    afe_config->aec_init = true;
+    afe_config->ns_init = true;
+    AfeProfile::Apply(afe_config, profile, models, true);
+    bool nsnet = afe_config->afe_ns_mode == AFE_NS_MODE_NET;
+    afe_config->vad_init = true;
+    afe_config->vad_mode = VAD_MODE_0;
+    afe_config->agc_init = agc;
+    if (agc) {
+        afe_config->agc_mode = AFE_AGC_MODE_WEBRTC;
+        afe_config->agc_target_level_dbfs = 3;
+        afe_config->agc_compression_gain_db = 9;
+    }
+    afe_config->memory_alloc_mode = AFE_MEMORY_ALLOC_MORE_PSRAM;
+    auto afe_iface = esp_afe_handle_from_config(afe_config);
+    auto afe_data = afe_iface->create_from_config(afe_config);
+    afe_config_free(afe_config);
+
+    const int chunk = afe_iface->get_feed_chunksize(afe_data);
+    const int frame_ms = chunk * 1000 / 16000;
+    const int chunks = 16000 * kFrameMs / 1000 * kSignalFrames / chunk;
+    auto input = GenerateSignal(16000, chunk * chunks, 2);
+
+    char params[80];
+    snprintf(params, sizeof(params), "\"profile\":\"%s\",\"aec\":1,\"nsnet\":%d,\"agc\":%d",
+        AfeProfile::Name(profile), nsnet, agc);
+    // feed 1回ごとにfetchして内部バッファをあふれさせない。fetchはfeed 1回分がそろってから呼ぶため待たない
+    auto feed_result = Measure([&](int i) {
+        if (i > 0) {
+            afe_iface->fetch_with_delay(afe_data, portMAX_DELAY);
+        }
+    }, [&](int i) {
+        afe_iface->feed(afe_data, input.data() + (i % chunks) * chunk * 2);
+    });
+    afe_iface->fetch_with_delay(afe_data, portMAX_DELAY);
+    Report("afe_feed", params, frame_ms, feed_result);
+
+    auto fetch_result = Measure([&](int i) {
+        afe_iface->feed(afe_data, input.data() + (i % chunks) * chunk * 2);
+    }, [&](int) {
+        afe_iface->fetch_with_delay(afe_data, portMAX_DELAY);
+    });
+    Report("afe_fetch", params, frame_ms, fetch_result);
+
+    uint32_t frame_us = feed_result.us_median + fetch_result.us_median;
+    printf("BENCH {\"case\":\"afe_load\",\"params\":{%s},\"frame_ms\":%d,\"iterations\":%d,"
+        "\"cycles\":%lu,\"us\":%lu,\"core_percent\":%.1f}\n",
+        params, frame_ms, AUDIO_BENCHMARK_ITERATIONS, feed_result.cycles_median + fetch_result.cycles_median,
+        frame_us, frame_us * 100.0f / (frame_ms * 1000));
+
+    afe_iface->destroy(afe_data);
+    esp_srmodel_deinit(models);
+}
+#endif
+
+/** @brief 出力リミッター（ライタータスクの20msチャンク、半分のサンプルがしきい値を超える信号） */
+void BenchmarkLimiter() {
+    const int rate = 24000;
+    const size_t samples = rate * 20 / 1000;
+    auto signal = GenerateSignal(rate, samples * kSignalFrames, 1);
+    for (auto& sample : signal) {
+        sample = sample * 2 > INT16_MAX ? INT16_MAX : sample * 2 < INT16_MIN ? INT16_MIN : sample * 2;
+    }
+    std::vector<int16_t> chunk(samples);
+    AudioLimiter limiter;
+    limiter.Configure(rate, -1.0f, 2, 100);
+    auto result = Measure([&](int i) {
+        auto src = signal.data() + (i % kSignalFrames) * samples;
+        std::copy(src, src + samples, chunk.begin());
+    }, [&](int) {
+        limiter.Process(chunk.data(), samples);
+    });
+    Report("output_limiter", "\"rate\":24000,\"lookahead_ms\":2", 20, result);
+}
+
+/** @brief MQTT+UDPの音声パケット1つ分のAES-128-CTR暗号化 */
+void BenchmarkAesCtr() {
+    const uint8_t key[16] = {0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6, 0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c};
+    mbedtls_aes_context aes;
+    mbedtls_aes_init(&aes);
+    mbedtls_aes_setkey_enc(&aes, key, 128);
+    for (size_t bytes : {64, 160, 512}) {
+        std::vector<uint8_t> input(bytes, 0x5a);
+        std::vector<uint8_t> output(bytes);
+        uint8_t nonce[16] = {};
+        auto result = Measure([&](int i) {
+            size_t nc_off = 0;
+            uint8_t counter[16];
+            uint8_t stream_block[16] = {};
+            std::copy(nonce, nonce + sizeof(nonce), counter);
+            counter[15] = (uint8_t)i;
+            mbedtls_aes_crypt_ctr(&aes, bytes, &nc_off, counter, stream_block, input.data(), output.data());
+        });
+        char params[32];
+        snprintf(params, sizeof(params), "\"bytes\":%u", bytes);
+        Report("aes_ctr", params, kFrameMs, result);
+    }
+    mbedtls_aes_free(&aes);
+}
+
+void BenchmarkTask(void* arg) {
+    auto done = (EventGroupHandle_t)arg;
+    auto app_desc = esp_app_get_description();
+    printf("BENCH {\"case\":\"meta\",\"version\":\"%s\",\"idf\":\"%s\",\"cpu_mhz\":%d,\"core\":%d,\"simd\":%d,\"realtime_profile\":%d}\n",
+        app_desc->version, esp_get_idf_version(), CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ, xPortGetCoreID(), audio_dsp::HasSimd(),
+        kRealtimeProfile);
+
+    BenchmarkOpusEncode();
+    BenchmarkOpusDecode();
+    BenchmarkOpusPlacement();
+    BenchmarkResamplers();
+    BenchmarkReadAudio();
+    BenchmarkCachePressure();
+#if CONFIG_USE_AUDIO_PROCESSOR
+    BenchmarkAfe(kAfeProfileLowCost, false);
+    BenchmarkAfe(kAfeProfileBalanced, false);
+    BenchmarkAfe(kAfeProfileHighPerf, false);
+    BenchmarkAfe(kAfeProfileHighPerf, true);
+#endif
+    BenchmarkLimiter();
+    BenchmarkAesCtr();
+
+    printf("BENCH {\"case\":\"done\"}\n");
+    xEventGroupSetBits(done, 1);
+    vTaskDelete(NULL);
+}
+
+} // namespace
+
+void Run() {
+    ESP_LOGI(TAG, "Running audio pipeline benchmark");
+    // DFSでクロックが変わるとサイクルと時間の関係が崩れるため、最大周波数に固定する
+    esp_pm_lock_handle_t pm_lock = nullptr;
+    if (esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "benchmark", &pm_lock) == ESP_OK) {
+        esp_pm_lock_acquire(pm_lock);
+    }
+
+    auto done = xEventGroupCreate();
+    xTaskCreatePinnedToCore(BenchmarkTask, "audio_bench", 4096 * 8, done, configMAX_PRIORITIES - 2, nullptr,
+        portNUM_PROCESSORS > 1 ? AUDIO_BENCHMARK_CORE : 0);
+    xEventGroupWaitBits(done, 1, pdTRUE, pdTRUE, portMAX_DELAY);
+    vEventGroupDelete(done);
+
+    if (pm_lock != nullptr) {
+        esp_pm_lock_release(pm_lock);
+        esp_pm_lock_delete(pm_lock);
+    }
+    ESP_LOGI(TAG, "Benchmark finished");
+}
+
+} // namespace audio_benchmark
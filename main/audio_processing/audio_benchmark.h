@@ -0,0 +1,33 @@
+/**
+ * @file audio_benchmark.h
+ * @brief 音声パイプラインのオンデバイスベンチマーク
+ *
+ * エンコード・デコード・リサンプル・チャンネル分離・AFE・AES-CTRを固定の入力と
+ * 反復回数で測定し、1ケース1行のJSON（"BENCH "接頭辞付き）としてログに出力します。
+ * Opusは状態と作業領域の配置（内部SRAM/PSRAM）・複雑度・レートの組み合わせも測定します。
+ * scripts/bench_compare.py で基準値と比較し、リリース前の性能低下を検出します。
+ */
+#ifndef AUDIO_BENCHMARK_H
+#define AUDIO_BENCHMARK_H
+
+/** @brief 1ケースあたりの測定回数（ウォームアップを除く） */
+#define AUDIO_BENCHMARK_ITERATIONS 50
+
+/** @brief 測定前に捨てる回数（キャッシュ・フィルタ状態を定常にする） */
+#define AUDIO_BENCHMARK_WARMUP 5
+
+/** @brief 測定タスクを固定するコア（AFEと同じコアで他の処理を避ける） */
+#define AUDIO_BENCHMARK_CORE 1
+
+namespace audio_benchmark {
+
+/**
+ * @brief すべてのケースを測定して結果をログに出力（完了まで戻らない）
+ *
+ * 測定は専用タスクで行い、サイクル数はそのコアのサイクルカウンタで数えます。
+ */
+void Run();
+
+} // namespace audio_benchmark
+
+#endif // AUDIO_BENCHMARK_H
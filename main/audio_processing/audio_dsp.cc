@@ -0,0 +1,394 @@
+/**
+ * @file audio_dsp.cc
+ * @brief 16ビットPCM用の基本DSPカーネルの実装
+ *
+ * PIEカーネルは8サンプル（128ビット）単位で処理し、端数はスカラーで処理します。
+ * ee.vld/ee.vst は下位4ビットのアドレスを無視するため、全ポインタが
+ * 16バイト境界に揃っている場合のみPIE経路を使用します。
+ */
+#include "audio_dsp.h"
+#include "resampler_filters.h"
+
+#include <cmath>
+#include <cstring>
+#include <vector>
+#include <esp_cpu.h>
+#include <esp_log.h>
+
+#define TAG "AudioDsp"
+
+#if CONFIG_IDF_TARGET_ESP32S3
+#define AUDIO_DSP_USE_PIE 1
+#else
+#define AUDIO_DSP_USE_PIE 0
+#endif
+
+namespace audio_dsp {
+
+static inline int16_t Saturate(int32_t value) {
+    if (value > INT16_MAX) {
+        return INT16_MAX;
+    }
+    if (value < INT16_MIN) {
+        return INT16_MIN;
+    }
+    return (int16_t)value;
+}
+
+static inline bool IsAligned(const void* p) {
+    return ((uintptr_t)p & (kAlignment - 1)) == 0;
+}
+
+// ---------------------------------------------------------------------------
+// スカラー実装
+// ---------------------------------------------------------------------------
+
+static void DeinterleaveScalar(const int16_t* input, int16_t* left, int16_t* right, size_t frames) {
+    for (size_t i = 0, j = 0; i < frames; ++i, j += 2) {
+        left[i] = input[j];
+        right[i] = input[j + 1];
+    }
+}
+
+static void InterleaveScalar(const int16_t* left, const int16_t* right, int16_t* output, size_t frames) {
+    for (size_t i = 0, j = 0; i < frames; ++i, j += 2) {
+        output[j] = left[i];
+        output[j + 1] = right[i];
+    }
+}
+
+static void ApplyGainScalar(const int16_t* input, int16_t* output, size_t samples, int32_t gain_q15) {
+    for (size_t i = 0; i < samples; ++i) {
+        output[i] = Saturate(((int32_t)input[i] * gain_q15) >> 15);
+    }
+}
+
+static void MixScalar(const int16_t* a, const int16_t* b, int16_t* output, size_t samples) {
+    for (size_t i = 0; i < samples; ++i) {
+        output[i] = Saturate((int32_t)a[i] + b[i]);
+    }
+}
+
+static void ByteSwap16Scalar(const uint16_t* input, uint16_t* output, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        output[i] = __builtin_bswap16(input[i]);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// PIE実装（ESP32-S3）
+// ---------------------------------------------------------------------------
+
+#if AUDIO_DSP_USE_PIE
+
+// 8フレーム（16サンプル）単位: ee.vunzip.16 で偶数/奇数要素に分離する
+static void DeinterleavePie(const int16_t* input, int16_t* left, int16_t* right, size_t blocks) {
+    asm volatile(
+        "loopnez %[count], 1f\n"
+        "ee.vld.128.ip q0, %[in], 16\n"
+        "ee.vld.128.ip q1, %[in], 16\n"
+        "ee.vunzip.16 q0, q1\n"
+        "ee.vst.128.ip q0, %[l], 16\n"
+        "ee.vst.128.ip q1, %[r], 16\n"
+        "1:\n"
+        : [in] "+r"(input), [l] "+r"(left), [r] "+r"(right)
+        : [count] "r"(blocks)
+        : "memory");
+}
+
+static void InterleavePie(const int16_t* left, const int16_t* right, int16_t* output, size_t blocks) {
+    asm volatile(
+        "loopnez %[count], 1f\n"
+        "ee.vld.128.ip q0, %[l], 16\n"
+        "ee.vld.128.ip q1, %[r], 16\n"
+        "ee.vzip.16 q0, q1\n"
+        "ee.vst.128.ip q0, %[out], 16\n"
+        "ee.vst.128.ip q1, %[out], 16\n"
+        "1:\n"
+        : [l] "+r"(left), [r] "+r"(right), [out] "+r"(output)
+        : [count] "r"(blocks)
+        : "memory");
+}
+
+// ゲインがQ15で1.0未満の場合のみ使用する（乗算結果が16ビットを超えない）
+static void ApplyGainPie(const int16_t* input, int16_t* output, size_t blocks, int16_t gain_q15) {
+    asm volatile(
+        "wsr.sar %[shift]\n"
+        "ee.vldbc.16 q3, %[gain]\n"
+        "loopnez %[count], 1f\n"
+        "ee.vld.128.ip q0, %[in], 16\n"
+        "ee.vmul.s16 q1, q0, q3\n"
+        "ee.vst.128.ip q1, %[out], 16\n"
+        "1:\n"
+        : [in] "+r"(input), [out] "+r"(output)
+        : [count] "r"(blocks), [gain] "r"(&gain_q15), [shift] "r"(15)
+        : "memory");
+}
+
+static void MixPie(const int16_t* a, const int16_t* b, int16_t* output, size_t blocks) {
+    asm volatile(
+        "loopnez %[count], 1f\n"
+        "ee.vld.128.ip q0, %[a], 16\n"
+        "ee.vld.128.ip q1, %[b], 16\n"
+        "ee.vadds.s16 q2, q0, q1\n"
+        "ee.vst.128.ip q2, %[out], 16\n"
+        "1:\n"
+        : [a] "+r"(a), [b] "+r"(b), [out] "+r"(output)
+        : [count] "r"(blocks)
+        : "memory");
+}
+
+// 16画素単位: バイト単位で偶数/奇数に分離し、上位/下位を入れ替えて再結合する
+static void ByteSwap16Pie(const uint16_t* input, uint16_t* output, size_t blocks) {
+    asm volatile(
+        "loopnez %[count], 1f\n"
+        "ee.vld.128.ip q0, %[in], 16\n"
+        "ee.vld.128.ip q1, %[in], 16\n"
+        "ee.vunzip.8 q0, q1\n"
+        "ee.vzip.8 q1, q0\n"
+        "ee.vst.128.ip q1, %[out], 16\n"
+        "ee.vst.128.ip q0, %[out], 16\n"
+        "1:\n"
+        : [in] "+r"(input), [out] "+r"(output)
+        : [count] "r"(blocks)
+        : "memory");
+}
+
+#endif // AUDIO_DSP_USE_PIE
+
+// ---------------------------------------------------------------------------
+// 公開API
+// ---------------------------------------------------------------------------
+
+bool HasSimd() {
+    return AUDIO_DSP_USE_PIE;
+}
+
+void Deinterleave(const int16_t* input, int16_t* left, int16_t* right, size_t frames) {
+    size_t done = 0;
+#if AUDIO_DSP_USE_PIE
+    if (IsAligned(input) && IsAligned(left) && IsAligned(right)) {
+        size_t blocks = frames / 8;
+        DeinterleavePie(input, left, right, blocks);
+        done = blocks * 8;
+    }
+#endif
+    DeinterleaveScalar(input + done * 2, left + done, right + done, frames - done);
+}
+
+void Interleave(const int16_t* left, const int16_t* right, int16_t* output, size_t frames) {
+    size_t done = 0;
+#if AUDIO_DSP_USE_PIE
+    if (IsAligned(left) && IsAligned(right) && IsAligned(output)) {
+        size_t blocks = frames / 8;
+        InterleavePie(left, right, output, blocks);
+        done = blocks * 8;
+    }
+#endif
+    InterleaveScalar(left + done, right + done, output + done * 2, frames - done);
+}
+
+void ApplyGain(const int16_t* input, int16_t* output, size_t samples, float gain) {
+    int32_t gain_q15 = (int32_t)lroundf(gain * 32768.0f);
+    if (gain_q15 < 0) {
+        gain_q15 = 0;
+    }
+    size_t done = 0;
+#if AUDIO_DSP_USE_PIE
+    if (gain_q15 <= INT16_MAX && IsAligned(input) && IsAligned(output)) {
+        size_t blocks = samples / 8;
+        ApplyGainPie(input, output, blocks, (int16_t)gain_q15);
+        done = blocks * 8;
+    }
+#endif
+    ApplyGainScalar(input + done, output + done, samples - done, gain_q15);
+}
+
+void Mix(const int16_t* a, const int16_t* b, int16_t* output, size_t samples) {
+    size_t done = 0;
+#if AUDIO_DSP_USE_PIE
+    if (IsAligned(a) && IsAligned(b) && IsAligned(output)) {
+        size_t blocks = samples / 8;
+        MixPie(a, b, output, blocks);
+        done = blocks * 8;
+    }
+#endif
+    MixScalar(a + done, b + done, output + done, samples - done);
+}
+
+void ByteSwap16(const uint16_t* input, uint16_t* output, size_t count) {
+    size_t done = 0;
+#if AUDIO_DSP_USE_PIE
+    if (IsAligned(input) && IsAligned(output)) {
+        size_t blocks = count / 16;
+        ByteSwap16Pie(input, output, blocks);
+        done = blocks * 16;
+    }
+#endif
+    ByteSwap16Scalar(input + done, output + done, count - done);
+}
+
+// 32ビット幅の変換はPIEの16ビットレーンに合わないため、4サンプル単位に展開したスカラーで処理する
+void ExpandToInt32(const int16_t* input, int32_t* output, size_t samples, int32_t gain_q16) {
+    size_t i = 0;
+    for (; i + 4 <= samples; i += 4) {
+        output[i] = input[i] * gain_q16;
+        output[i + 1] = input[i + 1] * gain_q16;
+        output[i + 2] = input[i + 2] * gain_q16;
+        output[i + 3] = input[i + 3] * gain_q16;
+    }
+    for (; i < samples; ++i) {
+        output[i] = input[i] * gain_q16;
+    }
+}
+
+void NarrowToInt16(const int32_t* input, int16_t* output, size_t samples, int shift) {
+    size_t i = 0;
+    for (; i + 4 <= samples; i += 4) {
+        output[i] = Saturate(input[i] >> shift);
+        output[i + 1] = Saturate(input[i + 1] >> shift);
+        output[i + 2] = Saturate(input[i + 2] >> shift);
+        output[i + 3] = Saturate(input[i + 3] >> shift);
+    }
+    for (; i < samples; ++i) {
+        output[i] = Saturate(input[i] >> shift);
+    }
+}
+
+void Measure(const int16_t* input, size_t samples, int16_t* peak, float* rms) {
+    int32_t max_abs = 0;
+    int64_t sum_squares = 0;
+    for (size_t i = 0; i < samples; ++i) {
+        int32_t v = input[i];
+        int32_t a = v < 0 ? -v : v;
+        if (a > max_abs) {
+            max_abs = a;
+        }
+        sum_squares += v * v;
+    }
+    if (peak != nullptr) {
+        *peak = Saturate(max_abs);
+    }
+    if (rms != nullptr) {
+        *rms = samples > 0 ? sqrtf((float)sum_squares / samples) : 0.0f;
+    }
+}
+
+// ---------------------------------------------------------------------------
+// StereoDecimator3to2
+// ---------------------------------------------------------------------------
+
+static_assert(StereoDecimator3to2::kTapsPerPhase == resampler_filters::k24kTo16kTaps &&
+              resampler_filters::k24kTo16kUp == 2 && resampler_filters::k24kTo16kDown == 3,
+              "StereoDecimator3to2 requires the 24k->16k (L=2, M=3) filter table");
+
+StereoDecimator3to2::StereoDecimator3to2() {
+    Reset();
+}
+
+void StereoDecimator3to2::Reset() {
+    left_.assign(kTapsPerPhase - 1, 0);
+    right_.assign(kTapsPerPhase - 1, 0);
+    pending_ = 0;
+}
+
+static inline int16_t Dot(const int16_t* x, const int16_t* c, int taps) {
+    int32_t acc = 1 << 14;
+    for (int i = 0; i < taps; ++i) {
+        acc += (int32_t)x[i] * c[i];
+    }
+    return Saturate(acc >> 15);
+}
+
+size_t StereoDecimator3to2::Process(const int16_t* input, size_t frames, int16_t* output) {
+    const size_t history = kTapsPerPhase - 1;
+    size_t base = left_.size();
+    // 容量は初回に確保され、以降同じフレーム数であれば再確保は発生しない
+    left_.resize(base + frames);
+    right_.resize(base + frames);
+    DeinterleaveScalar(input, left_.data() + base, right_.data() + base, frames);
+
+    // 出力2フレームごとに入力3フレームを消費する
+    // 出力2qは入力3q（フェーズ0）、出力2q+1は入力3q+1（フェーズ1）を中心とする
+    size_t groups = (left_.size() - history) / 3;
+    const int16_t* l = left_.data();
+    const int16_t* r = right_.data();
+    const int16_t* phase0 = resampler_filters::k24kTo16k;
+    const int16_t* phase1 = resampler_filters::k24kTo16k + kTapsPerPhase;
+    for (size_t q = 0; q < groups; ++q) {
+        size_t c = 3 * q;
+        output[0] = Dot(l + c, phase0, kTapsPerPhase);
+        output[1] = Dot(r + c, phase0, kTapsPerPhase);
+        output[2] = Dot(l + c + 1, phase1, kTapsPerPhase);
+        output[3] = Dot(r + c + 1, phase1, kTapsPerPhase);
+        output += 4;
+    }
+
+    // 次回用に履歴と未処理フレームを先頭へ移す
+    size_t consumed = groups * 3;
+    size_t remain = left_.size() - consumed;
+    memmove(left_.data(), left_.data() + consumed, remain * sizeof(int16_t));
+    memmove(right_.data(), right_.data() + consumed, remain * sizeof(int16_t));
+    left_.resize(remain);
+    right_.resize(remain);
+    pending_ = remain - history;
+    return groups * 2;
+}
+
+// ---------------------------------------------------------------------------
+// ベンチマーク
+// ---------------------------------------------------------------------------
+
+template <typename F>
+static uint32_t MeasureCycles(F&& func, int iterations) {
+    uint32_t start = esp_cpu_get_cycle_count();
+    for (int i = 0; i < iterations; ++i) {
+        func();
+    }
+    return (esp_cpu_get_cycle_count() - start) / iterations;
+}
+
+void RunBenchmark() {
+    // 24kHz・60msの2チャンネル入力に相当するサイズで測定する
+    const size_t frames = 1440;
+    const int iterations = 50;
+    std::vector<int16_t, AlignedAllocator<int16_t>> stereo(frames * 2), left(frames), right(frames), out(frames * 2);
+    for (size_t i = 0; i < stereo.size(); ++i) {
+        stereo[i] = (int16_t)((i * 7919) & 0xFFFF);
+    }
+
+    struct Result {
+        const char* name;
+        uint32_t scalar;
+        uint32_t simd;
+    } results[] = {
+        {"deinterleave",
+            MeasureCycles([&]() { DeinterleaveScalar(stereo.data(), left.data(), right.data(), frames); }, iterations),
+            MeasureCycles([&]() { Deinterleave(stereo.data(), left.data(), right.data(), frames); }, iterations)},
+        {"interleave",
+            MeasureCycles([&]() { InterleaveScalar(left.data(), right.data(), out.data(), frames); }, iterations),
+            MeasureCycles([&]() { Interleave(left.data(), right.data(), out.data(), frames); }, iterations)},
+        {"gain",
+            MeasureCycles([&]() { ApplyGainScalar(left.data(), out.data(), frames, 16384); }, iterations),
+            MeasureCycles([&]() { ApplyGain(left.data(), out.data(), frames, 0.5f); }, iterations)},
+        {"mix",
+            MeasureCycles([&]() { MixScalar(left.data(), right.data(), out.data(), frames); }, iterations),
+            MeasureCycles([&]() { Mix(left.data(), right.data(), out.data(), frames); }, iterations)},
+        {"byteswap",
+            MeasureCycles([&]() { ByteSwap16Scalar((uint16_t*)stereo.data(), (uint16_t*)out.data(), frames * 2); }, iterations),
+            MeasureCycles([&]() { ByteSwap16((uint16_t*)stereo.data(), (uint16_t*)out.data(), frames * 2); }, iterations)},
+    };
+
+    // 結果の一致も確認する
+    Deinterleave(stereo.data(), left.data(), right.data(), frames);
+    Interleave(left.data(), right.data(), out.data(), frames);
+    bool roundtrip_ok = memcmp(stereo.data(), out.data(), stereo.size() * sizeof(int16_t)) == 0;
+
+    ESP_LOGI(TAG, "Benchmark (%u frames, simd=%d, roundtrip=%s)", frames, HasSimd(), roundtrip_ok ? "ok" : "MISMATCH");
+    for (auto& r : results) {
+        ESP_LOGI(TAG, "  %-12s scalar %6lu cycles, dispatch %6lu cycles (x%.2f)", r.name, r.scalar, r.simd,
+            r.simd > 0 ? (float)r.scalar / r.simd : 0.0f);
+    }
+}
+
+} // namespace audio_dsp
@@ -0,0 +1,139 @@
+/**
+ * @file audio_dsp.h
+ * @brief 16ビットPCM用の基本DSPカーネル
+ *
+ * チャンネル分離/結合、ゲイン、ミックス、レベル測定などの小さなカーネル群です。
+ * ESP32-S3ではPIE（128ビットベクトル命令）を使用し、それ以外のターゲットや
+ * 16バイト境界に揃っていないバッファではスカラー実装にフォールバックします。
+ */
+#ifndef AUDIO_DSP_H
+#define AUDIO_DSP_H
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <vector>
+#include <esp_heap_caps.h>
+
+namespace audio_dsp {
+
+/** @brief PIEの128ビットロード/ストアに必要なアライメント（バイト） */
+constexpr size_t kAlignment = 16;
+
+/** @brief PIEカーネルが利用可能かどうか */
+bool HasSimd();
+
+/**
+ * @brief インターリーブされた2チャンネルを分離
+ * @param input L0 R0 L1 R1 ... 形式の入力（frames * 2 サンプル）
+ * @param left 出力（frames サンプル）
+ * @param right 出力（frames サンプル）
+ */
+void Deinterleave(const int16_t* input, int16_t* left, int16_t* right, size_t frames);
+
+/** @brief 2チャンネルをインターリーブ（Deinterleaveの逆） */
+void Interleave(const int16_t* left, const int16_t* right, int16_t* output, size_t frames);
+
+/**
+ * @brief 飽和付きゲインを適用（in-place可）
+ * @param gain 倍率（1.0で素通し）
+ */
+void ApplyGain(const int16_t* input, int16_t* output, size_t samples, float gain);
+
+/** @brief 飽和付き加算ミックス: output = sat(a + b)（in-place可） */
+void Mix(const int16_t* a, const int16_t* b, int16_t* output, size_t samples);
+
+/**
+ * @brief 16ビットPCMを32ビットスロットへ拡張しながらゲインを適用（I2S出力用）
+ * @param gain_q16 倍率（65536で等倍、0～65536）。積は32ビットに収まるため飽和処理は不要
+ */
+void ExpandToInt32(const int16_t* input, int32_t* output, size_t samples, int32_t gain_q16);
+
+/**
+ * @brief 32ビットスロットのPCMを右シフトして16ビットへ飽和変換（I2Sマイク入力用）
+ * @param shift 右シフト量（INMP441などの24ビットマイクでは12）
+ */
+void NarrowToInt16(const int32_t* input, int16_t* output, size_t samples, int shift);
+
+/** @brief 16ビット値のバイト順を入れ替え（RGB565のエンディアン変換など） */
+void ByteSwap16(const uint16_t* input, uint16_t* output, size_t count);
+
+/**
+ * @brief ピークとRMSを測定
+ * @param peak 絶対値の最大値
+ * @param rms 二乗平均平方根（フルスケール32768）
+ */
+void Measure(const int16_t* input, size_t samples, int16_t* peak, float* rms);
+
+/** @brief スカラー実装とPIE実装の処理時間を比較してログ出力 */
+void RunBenchmark();
+
+/**
+ * @class AlignedAllocator
+ * @brief PIEカーネル向けに16バイト境界へ揃えるstd::vector用アロケータ
+ */
+template <typename T>
+struct AlignedAllocator {
+    using value_type = T;
+    AlignedAllocator() = default;
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U>&) {}
+
+    T* allocate(size_t n) {
+        void* p = heap_caps_aligned_alloc(kAlignment, n * sizeof(T), MALLOC_CAP_8BIT);
+        if (p == nullptr) {
+            throw std::bad_alloc();
+        }
+        return (T*)p;
+    }
+    void deallocate(T* p, size_t) { heap_caps_free(p); }
+
+    template <typename U>
+    bool operator==(const AlignedAllocator<U>&) const { return true; }
+    template <typename U>
+    bool operator!=(const AlignedAllocator<U>&) const { return false; }
+};
+
+/** @brief 16バイト境界に揃えたPCMバッファ */
+using AlignedPcmBuffer = std::vector<int16_t, AlignedAllocator<int16_t>>;
+
+/**
+ * @class StereoDecimator3to2
+ * @brief チャンネル分離と3:2ダウンサンプリング（24kHz→16kHz）を一度に行うカーネル
+ *
+ * インターリーブされた2チャンネル入力（マイク + リファレンス）を受け取り、
+ * 2倍補間・3分の1間引きのポリフェーズFIR（PolyphaseResamplerと共通のQ15係数）で
+ * 16kHzのインターリーブ出力を直接生成します。チャンネル分離・個別リサンプル・再インターリーブの3パスを1パスにまとめ、
+ * フレーム間のフィルタ状態を保持します。
+ */
+class StereoDecimator3to2 {
+public:
+    /** @brief 1フェーズあたりのタップ数（48kHz換算で2倍のフィルタ長） */
+    static constexpr int kTapsPerPhase = 32;
+
+    StereoDecimator3to2();
+
+    /** @brief 入力フレーム数から出力フレーム数を計算 */
+    size_t GetOutputFrames(size_t input_frames) const { return (pending_ + input_frames) / 3 * 2; }
+
+    /**
+     * @brief インターリーブ入力を変換
+     * @param input L0 R0 L1 R1 ... 形式の24kHz入力（frames * 2 サンプル）
+     * @param frames 入力フレーム数
+     * @param output 出力先（GetOutputFrames(frames) * 2 サンプル）
+     * @return 出力したフレーム数
+     */
+    size_t Process(const int16_t* input, size_t frames, int16_t* output);
+
+    /** @brief フィルタ状態をクリア */
+    void Reset();
+
+private:
+    std::vector<int16_t> left_;         /**< 履歴 + 新規入力（チャンネル0） */
+    std::vector<int16_t> right_;        /**< 履歴 + 新規入力（チャンネル1） */
+    size_t pending_ = 0;                /**< 前回処理しきれなかった入力フレーム数 */
+};
+
+} // namespace audio_dsp
+
+#endif // AUDIO_DSP_H
@@ -0,0 +1,99 @@
+/**
+ * @file audio_limiter.cc
+ * @brief 再生用の先読みリミッターの実装
+ */
+#include "audio_limiter.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <esp_cpu.h>
+
+#define UNITY_GAIN 32768
+
+void AudioLimiter::Configure(int sample_rate, float threshold_dbfs, int lookahead_ms, int release_ms) {
+    sample_rate_ = sample_rate;
+    threshold_ = std::clamp((int32_t)lroundf(32767.0f * powf(10.0f, threshold_dbfs / 20.0f)), (int32_t)1, (int32_t)INT16_MAX);
+    // -20dB（Q15で約3277）から等倍まで release_ms で戻る
+    int32_t release_samples = std::max(1, sample_rate * release_ms / 1000);
+    release_step_ = std::max<int32_t>(1, (UNITY_GAIN - UNITY_GAIN / 10) / release_samples);
+    delay_.assign(std::max(1, sample_rate * lookahead_ms / 1000), 0);
+    Reset();
+}
+
+void AudioLimiter::Reset() {
+    std::fill(delay_.begin(), delay_.end(), 0);
+    delay_pos_ = 0;
+    gain_ = UNITY_GAIN;
+    target_ = UNITY_GAIN;
+    attack_step_ = 0;
+    hold_ = 0;
+}
+
+void AudioLimiter::Process(int16_t* data, size_t samples) {
+    if (!enabled_ || delay_.empty()) {
+        return;
+    }
+    uint32_t start = esp_cpu_get_cycle_count();
+    const size_t lookahead = delay_.size();
+    int32_t min_gain = UNITY_GAIN;
+    uint32_t limited = 0;
+
+    for (size_t i = 0; i < samples; ++i) {
+        int32_t input = data[i];
+        int32_t level = std::abs(input);
+        if (level > threshold_) {
+            // このサンプルが遅延線から出るまでに必要なゲインへ直線で下げる
+            int32_t required = (threshold_ << 15) / level;
+            if (required < target_) {
+                target_ = required;
+            }
+            attack_step_ = std::max(attack_step_, (int32_t)((gain_ - target_ + lookahead - 1) / lookahead));
+            hold_ = lookahead;
+        }
+
+        if (gain_ > target_) {
+            gain_ = std::max(target_, gain_ - attack_step_);
+        } else if (hold_ == 0) {
+            // ピークが出力し終わったら等倍へ戻す
+            target_ = UNITY_GAIN;
+            attack_step_ = 0;
+            gain_ = std::min(UNITY_GAIN, gain_ + release_step_);
+        }
+        if (hold_ > 0) {
+            hold_--;
+        }
+
+        int32_t delayed = delay_[delay_pos_];
+        delay_[delay_pos_] = (int16_t)input;
+        if (++delay_pos_ == lookahead) {
+            delay_pos_ = 0;
+        }
+
+        int32_t output = (delayed * gain_) >> 15;
+        data[i] = (int16_t)std::clamp(output, -threshold_, threshold_);
+        if (gain_ < UNITY_GAIN) {
+            limited++;
+            min_gain = std::min(min_gain, gain_);
+        }
+    }
+
+    cycles_ += esp_cpu_get_cycle_count() - start;
+    processed_samples_ += samples;
+    limited_samples_ += limited;
+    if (min_gain < min_gain_) {
+        min_gain_ = min_gain;
+    }
+}
+
+uint32_t AudioLimiter::cycles_per_second() const {
+    uint64_t samples = processed_samples_;
+    if (samples == 0) {
+        return 0;
+    }
+    return (uint32_t)(cycles_ * sample_rate_ / samples);
+}
+
+int32_t AudioLimiter::TakeMinGain() {
+    return min_gain_.exchange(UNITY_GAIN);
+}
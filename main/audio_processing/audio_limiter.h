@@ -0,0 +1,69 @@
+/**
+ * @file audio_limiter.h
+ * @brief 再生用の先読みリミッター（固定小数点）
+ *
+ * 出力を先読み時間だけ遅らせ、しきい値を超えるピークが出力される前にゲインを下げ終えます。
+ * 音量の大きいTTSや重ねた通知音でもクリップせず、ライタータスクでチャンクごとに動作します。
+ */
+#ifndef AUDIO_LIMITER_H
+#define AUDIO_LIMITER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * @class AudioLimiter
+ * @brief 先読み付きピークリミッター
+ *
+ * Configure()/Process() は同じタスクから呼び出します。SetEnabled() と統計の取得は任意のタスクから可能です。
+ */
+class AudioLimiter {
+public:
+    /**
+     * @brief リミッターを設定
+     * @param sample_rate 出力サンプリングレート
+     * @param threshold_dbfs 出力の上限（dBFS、負の値）
+     * @param lookahead_ms 先読み時間（出力の遅延になる）
+     * @param release_ms ゲインが-20dBから等倍へ戻るまでの時間
+     */
+    void Configure(int sample_rate, float threshold_dbfs, int lookahead_ms, int release_ms);
+
+    /** @brief 無効にすると遅延線を通さずにそのまま出力する */
+    void SetEnabled(bool enabled) { enabled_ = enabled; }
+    bool enabled() const { return enabled_; }
+
+    /** @brief samplesサンプルをin-placeで処理 */
+    void Process(int16_t* data, size_t samples);
+
+    /** @brief 遅延線とゲインをクリア */
+    void Reset();
+
+    /** @brief 出力1秒あたりの処理サイクル数（CPU負荷の目安） */
+    uint32_t cycles_per_second() const;
+    /** @brief これまでにゲインを下げたサンプル数 */
+    uint32_t limited_samples() const { return limited_samples_; }
+    /** @brief 直近のゲインの最小値（Q15、取得時にリセット） */
+    int32_t TakeMinGain();
+
+private:
+    std::atomic<bool> enabled_{true};
+    int sample_rate_ = 0;
+    int32_t threshold_ = INT16_MAX;          /**< 出力の上限（振幅） */
+    int32_t release_step_ = 1;               /**< 1サンプルあたりのゲインの戻り量（Q15） */
+
+    std::vector<int16_t> delay_;             /**< 先読み分の遅延線 */
+    size_t delay_pos_ = 0;
+    int32_t gain_ = 32768;                   /**< 現在のゲイン（Q15） */
+    int32_t target_ = 32768;                 /**< 先読み区間で必要な最小ゲイン（Q15） */
+    int32_t attack_step_ = 0;                /**< target_へ下げる1サンプルあたりの量 */
+    size_t hold_ = 0;                        /**< target_のピークが出力されるまでのサンプル数 */
+
+    std::atomic<uint64_t> cycles_{0};
+    std::atomic<uint64_t> processed_samples_{0};
+    std::atomic<uint32_t> limited_samples_{0};
+    std::atomic<int32_t> min_gain_{32768};
+};
+
+#endif // AUDIO_LIMITER_H
@@ -0,0 +1,289 @@
+/**
+ * @file audio_loopback_probe.cc
+ * @brief スピーカーからマイクまでの遅延とAECの計測の実装
+ */
+#include "audio_loopback_probe.h"
+
+#include <esp_heap_caps.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+#define TAG "AudioLoopbackProbe"
+
+/** @brief 音声処理の出力のサンプリングレート */
+#define AUDIO_LOOPBACK_PROCESSED_RATE 16000
+/** @brief 掃引の両端のフェード（クリックで相関が崩れないようにする） */
+#define AUDIO_LOOPBACK_FADE_MS 10
+/** @brief 出力の書き込み単位 */
+#define AUDIO_LOOPBACK_CHUNK_MS 20
+
+static int16_t* AllocatePsram(size_t samples) {
+    return (int16_t*)heap_caps_malloc(samples * sizeof(int16_t), MALLOC_CAP_SPIRAM);
+}
+
+AudioLoopbackProbe::~AudioLoopbackProbe() {
+    Release();
+}
+
+void AudioLoopbackProbe::Release() {
+    heap_caps_free(mic_);
+    heap_caps_free(ref_);
+    heap_caps_free(processed_);
+    heap_caps_free(template_);
+    mic_ = ref_ = processed_ = template_ = nullptr;
+}
+
+bool AudioLoopbackProbe::Start(AudioCodec* codec) {
+    if (busy_.exchange(true)) {
+        return false;
+    }
+    input_rate_ = codec->input_sample_rate();
+    input_channels_ = codec->input_channels();
+    // マイクは1チャンネル目だけを使い、リファレンスはコーデックの並びから位置を得る
+    reference_channel_ = codec->input_reference_channel();
+    reference_ = reference_channel_ > 0;
+
+    capacity_frames_ = (size_t)input_rate_ * AUDIO_LOOPBACK_CAPTURE_MS / 1000;
+    processed_capacity_ = AUDIO_LOOPBACK_PROCESSED_RATE * AUDIO_LOOPBACK_CAPTURE_MS / 1000;
+    template_samples_ = (size_t)input_rate_ * AUDIO_LOOPBACK_TEMPLATE_MS / 1000;
+    mic_ = AllocatePsram(capacity_frames_);
+    ref_ = reference_ ? AllocatePsram(capacity_frames_) : nullptr;
+    processed_ = AllocatePsram(processed_capacity_);
+    template_ = AllocatePsram(template_samples_);
+    if (mic_ == nullptr || (reference_ && ref_ == nullptr) || processed_ == nullptr || template_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate capture buffers");
+        Release();
+        busy_.store(false);
+        return false;
+    }
+    GenerateSweep(template_, 0, template_samples_, input_rate_);
+
+    captured_frames_.store(0);
+    processed_samples_.store(0);
+    capture_start_us_.store(INT64_MAX);
+    sweep_write_us_ = 0;
+    capturing_.store(true);
+    return true;
+}
+
+void AudioLoopbackProbe::GenerateSweep(int16_t* output, size_t offset, size_t samples, int sample_rate) {
+    // 線形掃引: 位相 = 2π(f0·t + k·t²/2), k = (f1 - f0) / T
+    const double duration = AUDIO_LOOPBACK_SWEEP_MS / 1000.0;
+    const double k = (AUDIO_LOOPBACK_SWEEP_END_HZ - AUDIO_LOOPBACK_SWEEP_START_HZ) / duration;
+    const double fade = AUDIO_LOOPBACK_FADE_MS / 1000.0;
+    const double amplitude = 16384.0;
+    for (size_t i = 0; i < samples; i++) {
+        double t = (double)(offset + i) / sample_rate;
+        if (t >= duration) {
+            output[i] = 0;
+            continue;
+        }
+        double gain = 1.0;
+        if (t < fade) {
+            gain = 0.5 - 0.5 * cos(M_PI * t / fade);
+        } else if (duration - t < fade) {
+            gain = 0.5 - 0.5 * cos(M_PI * (duration - t) / fade);
+        }
+        double phase = 2.0 * M_PI * (AUDIO_LOOPBACK_SWEEP_START_HZ * t + 0.5 * k * t * t);
+        output[i] = (int16_t)lrint(amplitude * gain * sin(phase));
+    }
+}
+
+void AudioLoopbackProbe::Play(AudioCodec* codec) {
+    int rate = codec->output_sample_rate();
+    size_t chunk = (size_t)rate * AUDIO_LOOPBACK_CHUNK_MS / 1000;
+    std::vector<int16_t> buffer(chunk, 0);
+
+    for (int ms = 0; ms < AUDIO_LOOPBACK_LEAD_MS; ms += AUDIO_LOOPBACK_CHUNK_MS) {
+        codec->OutputData(buffer.data(), chunk);
+    }
+    size_t sweep_samples = (size_t)rate * AUDIO_LOOPBACK_SWEEP_MS / 1000;
+    sweep_write_us_ = esp_timer_get_time();
+    for (size_t offset = 0; offset < sweep_samples; offset += chunk) {
+        GenerateSweep(buffer.data(), offset, chunk, rate);
+        codec->OutputData(buffer.data(), chunk);
+    }
+    std::fill(buffer.begin(), buffer.end(), 0);
+    for (int ms = 0; ms < AUDIO_LOOPBACK_TAIL_MS; ms += AUDIO_LOOPBACK_CHUNK_MS) {
+        codec->OutputData(buffer.data(), chunk);
+    }
+}
+
+void AudioLoopbackProbe::OnCapture(const int16_t* data, size_t samples) {
+    writers_.fetch_add(1);
+    if (!capturing_.load()) {
+        writers_.fetch_sub(1);
+        return;
+    }
+    int64_t now = esp_timer_get_time();
+    size_t frames = samples / input_channels_;
+    size_t position = captured_frames_.load(std::memory_order_relaxed);
+    size_t count = std::min(frames, capacity_frames_ - position);
+    for (size_t i = 0; i < count; i++) {
+        mic_[position + i] = data[i * input_channels_];
+        if (ref_ != nullptr) {
+            ref_[position + i] = data[i * input_channels_ + reference_channel_];
+        }
+    }
+    // 読み取りの戻りが遅れた回ほど推定が後ろにずれるため、最小値を先頭の収録時刻とする
+    int64_t start_us = now - (int64_t)(position + frames) * 1000000 / input_rate_;
+    if (start_us < capture_start_us_.load(std::memory_order_relaxed)) {
+        capture_start_us_.store(start_us, std::memory_order_relaxed);
+    }
+    captured_frames_.store(position + count, std::memory_order_release);
+    writers_.fetch_sub(1);
+}
+
+void AudioLoopbackProbe::OnProcessed(const int16_t* data, size_t samples) {
+    writers_.fetch_add(1);
+    if (!capturing_.load()) {
+        writers_.fetch_sub(1);
+        return;
+    }
+    size_t position = processed_samples_.load(std::memory_order_relaxed);
+    size_t count = std::min(samples, processed_capacity_ - position);
+    std::copy(data, data + count, processed_ + position);
+    processed_samples_.store(position + count, std::memory_order_release);
+    writers_.fetch_sub(1);
+}
+
+size_t AudioLoopbackProbe::FindTemplate(const int16_t* channel, size_t start, size_t end, float& correlation) const {
+    double template_energy = 0;
+    for (size_t i = 0; i < template_samples_; i++) {
+        template_energy += (double)template_[i] * template_[i];
+    }
+    // 窓の電力は1サンプルずつずらしながら更新する
+    double window_energy = 0;
+    for (size_t i = 0; i < template_samples_; i++) {
+        window_energy += (double)channel[start + i] * channel[start + i];
+    }
+    size_t best = start;
+    double best_score = 0;
+    for (size_t lag = start; lag < end; lag++) {
+        int64_t dot = 0;
+        const int16_t* window = channel + lag;
+        for (size_t i = 0; i < template_samples_; i++) {
+            dot += (int32_t)window[i] * template_[i];
+        }
+        if (dot > 0 && window_energy > 0) {
+            double score = dot / sqrt(window_energy * template_energy);
+            if (score > best_score) {
+                best_score = score;
+                best = lag;
+            }
+        }
+        double leaving = channel[lag];
+        double entering = channel[lag + template_samples_];
+        window_energy += entering * entering - leaving * leaving;
+    }
+    correlation = best_score;
+    return best;
+}
+
+/** @brief 区間の平均電力 */
+static double MeanPower(const int16_t* data, size_t begin, size_t end) {
+    if (end <= begin) {
+        return 0;
+    }
+    double sum = 0;
+    for (size_t i = begin; i < end; i++) {
+        sum += (double)data[i] * data[i];
+    }
+    return sum / (end - begin);
+}
+
+AudioLoopbackResult AudioLoopbackProbe::Finish() {
+    capturing_.store(false);
+    while (writers_.load() > 0) {
+        vTaskDelay(1);
+    }
+    auto result = Analyze();
+    Release();
+    busy_.store(false);
+    return result;
+}
+
+AudioLoopbackResult AudioLoopbackProbe::Analyze() const {
+    AudioLoopbackResult result;
+    size_t frames = captured_frames_.load(std::memory_order_acquire);
+    int64_t capture_start_us = capture_start_us_.load();
+    if (frames < template_samples_ || sweep_write_us_ == 0 || capture_start_us == INT64_MAX) {
+        ESP_LOGW(TAG, "Not enough input captured (%u frames)", (unsigned)frames);
+        return result;
+    }
+
+    // 掃引を書き込んだ時刻からAUDIO_LOOPBACK_MAX_DELAY_MSの範囲だけを探す
+    int64_t offset = (sweep_write_us_ - capture_start_us) * input_rate_ / 1000000;
+    size_t start = (size_t)std::max<int64_t>(offset, 0);
+    size_t end = std::min(start + (size_t)input_rate_ * AUDIO_LOOPBACK_MAX_DELAY_MS / 1000, frames - template_samples_);
+    if (start >= end) {
+        ESP_LOGW(TAG, "Capture ended before the sweep was played");
+        return result;
+    }
+    auto to_latency_ms = [&](size_t index) {
+        return (capture_start_us + (int64_t)index * 1000000 / input_rate_ - sweep_write_us_) / 1000.0f;
+    };
+
+    size_t mic_index = FindTemplate(mic_, start, end, result.correlation);
+    result.detected = result.correlation >= AUDIO_LOOPBACK_MIN_CORRELATION;
+    result.round_trip_ms = to_latency_ms(mic_index);
+
+    if (ref_ != nullptr) {
+        size_t ref_index = FindTemplate(ref_, start, end, result.reference_correlation);
+        result.has_reference = result.reference_correlation >= AUDIO_LOOPBACK_MIN_CORRELATION;
+        result.reference_latency_ms = to_latency_ms(ref_index);
+        result.reference_offset_ms = ((int64_t)mic_index - (int64_t)ref_index) * 1000.0f / input_rate_;
+    }
+
+    // ERLE: 掃引の後半（AECの収束後）の区間を、収録の開始からの時刻で音声処理の出力に対応付ける
+    // 音声処理の内部の遅延（数十ミリ秒）は区間の長さに比べて小さいため補正しない
+    size_t processed = processed_samples_.load(std::memory_order_acquire);
+    size_t sweep_frames = (size_t)input_rate_ * AUDIO_LOOPBACK_SWEEP_MS / 1000;
+    size_t mic_begin = mic_index + sweep_frames / 2;
+    size_t mic_end = std::min(mic_index + sweep_frames, frames);
+    size_t out_begin = (uint64_t)mic_begin * AUDIO_LOOPBACK_PROCESSED_RATE / input_rate_;
+    size_t out_end = (uint64_t)mic_end * AUDIO_LOOPBACK_PROCESSED_RATE / input_rate_;
+    if (result.detected && out_end <= processed && out_begin < out_end) {
+        double mic_power = MeanPower(mic_, mic_begin, mic_end);
+        double out_power = std::max(MeanPower(processed_, out_begin, out_end), 1.0);
+        result.has_erle = true;
+        result.erle_db = 10.0f * log10f(mic_power / out_power);
+    }
+
+    ESP_LOGI(TAG, "Round trip %.1f ms (corr %.2f), reference %.1f ms (corr %.2f), offset %.1f ms, ERLE %.1f dB",
+        result.round_trip_ms, result.correlation, result.reference_latency_ms, result.reference_correlation,
+        result.reference_offset_ms, result.erle_db);
+    return result;
+}
+
+std::string AudioLoopbackProbe::ToJson(const AudioLoopbackResult& result, AudioCodec* codec) {
+    char json[512];
+    int length = snprintf(json, sizeof(json),
+        "{\"success\":%s,\"correlation\":%.2f,\"round_trip_ms\":%.1f",
+        result.detected ? "true" : "false", result.correlation, result.round_trip_ms);
+    if (result.has_reference) {
+        length += snprintf(json + length, sizeof(json) - length,
+            ",\"reference\":{\"correlation\":%.2f,\"latency_ms\":%.1f,\"offset_ms\":%.1f}",
+            result.reference_correlation, result.reference_latency_ms, result.reference_offset_ms);
+    }
+    if (result.has_erle) {
+        length += snprintf(json + length, sizeof(json) - length, ",\"erle_db\":%.1f", result.erle_db);
+    }
+    if (!result.detected) {
+        length += snprintf(json + length, sizeof(json) - length,
+            ",\"message\":\"Sweep not detected at the microphone, raise the volume or check the speaker\"");
+    }
+    snprintf(json + length, sizeof(json) - length,
+        ",\"input_sample_rate\":%d,\"output_sample_rate\":%d,\"output_volume\":%d,"
+        "\"dma_desc_num\":%d,\"dma_frame_num\":%d}",
+        codec->input_sample_rate(), codec->output_sample_rate(), codec->output_volume(),
+        AUDIO_CODEC_DMA_DESC_NUM, AUDIO_CODEC_DMA_FRAME_NUM);
+    return json;
+}
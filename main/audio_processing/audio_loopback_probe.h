@@ -0,0 +1,116 @@
+/**
+ * @file audio_loopback_probe.h
+ * @brief スピーカーからマイクまでの遅延とAECの整列・収束を測る診断モード
+ *
+ * OutputDataで掃引音（チャープ）を直接再生し、ReadAudioが読み取った生の入力（マイクと
+ * リファレンスのスロット）に対して先頭部分との相互相関を取り、次の値を求めます。
+ * - 往復遅延: OutputDataの呼び出しからマイクの入力として読み取られるまで（DMAバッファを含む）
+ * - リファレンスのずれ: 同じ入力フレーム内でのリファレンスとマイクの差（AECが吸収すべき遅延）
+ * - ERLE: 掃引の後半（AECの収束後）でのマイクと音声処理の出力の電力比
+ * ボードごとのDMAバッファ数（CONFIG_AUDIO_CODEC_DMA_DESC_NUMなど）の調整に使います。
+ */
+#ifndef AUDIO_LOOPBACK_PROBE_H
+#define AUDIO_LOOPBACK_PROBE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "audio_codec.h"
+
+#define AUDIO_LOOPBACK_CAPTURE_MS 2500      // 記録する入力の最大時間
+#define AUDIO_LOOPBACK_LEAD_MS 300          // 掃引の前の無音（出力DMAと入力の読み取りを定常にする）
+#define AUDIO_LOOPBACK_SWEEP_MS 1000        // 掃引の長さ（後半をERLEの計測に使う）
+#define AUDIO_LOOPBACK_TAIL_MS 700          // 掃引の後の無音（遅れて届く分を記録する）
+#define AUDIO_LOOPBACK_TEMPLATE_MS 200      // 相互相関に使う掃引の先頭部分
+#define AUDIO_LOOPBACK_MAX_DELAY_MS 500     // 探索する遅延の上限
+#define AUDIO_LOOPBACK_SWEEP_START_HZ 500
+#define AUDIO_LOOPBACK_SWEEP_END_HZ 4000
+#define AUDIO_LOOPBACK_MIN_CORRELATION 0.3f // これ未満は検出できなかったとみなす
+
+/**
+ * @struct AudioLoopbackResult
+ * @brief 計測結果（遅延はミリ秒）
+ */
+struct AudioLoopbackResult {
+    bool detected = false;              // マイクで掃引を検出できた
+    float correlation = 0;              // マイクの正規化相互相関のピーク（0～1）
+    float round_trip_ms = 0;            // OutputDataの呼び出しからマイクの入力まで
+    bool has_reference = false;         // リファレンスのスロットで掃引を検出できた
+    float reference_correlation = 0;
+    float reference_latency_ms = 0;     // OutputDataの呼び出しからリファレンスの入力まで
+    float reference_offset_ms = 0;      // マイク - リファレンス（正ならマイクが遅れる）
+    bool has_erle = false;              // 音声処理の出力を受け取れた
+    float erle_db = 0;
+};
+
+/**
+ * @class AudioLoopbackProbe
+ * @brief 掃引音の再生と入力の記録・解析
+ *
+ * OnCapture()はaudio_loopタスク、OnProcessed()は音声処理の出力タスク、それ以外は
+ * 計測を行うタスクから呼びます。記録中の書き込み位置はアトミックに公開し、ロックを取りません。
+ */
+class AudioLoopbackProbe {
+public:
+    AudioLoopbackProbe() = default;
+    ~AudioLoopbackProbe();
+    AudioLoopbackProbe(const AudioLoopbackProbe&) = delete;
+    AudioLoopbackProbe& operator=(const AudioLoopbackProbe&) = delete;
+
+    /**
+     * @brief バッファをPSRAMに確保して記録を開始
+     * @return 確保に失敗したか、別の計測の途中の場合false
+     */
+    bool Start(AudioCodec* codec);
+
+    /** @brief 記録を止めて結果を解析し、バッファを解放 */
+    AudioLoopbackResult Finish();
+
+    /** @brief 無音・掃引・無音を出力（出力DMAのペースでブロックする） */
+    void Play(AudioCodec* codec);
+
+    bool capturing() const { return capturing_.load(std::memory_order_relaxed); }
+
+    /** @brief コーデックから読み取った生の入力（インターリーブ、入力のサンプリングレート） */
+    void OnCapture(const int16_t* data, size_t samples);
+
+    /** @brief 音声処理の出力（16kHzモノラル） */
+    void OnProcessed(const int16_t* data, size_t samples);
+
+    /** @brief 結果をJSON文字列に変換 */
+    static std::string ToJson(const AudioLoopbackResult& result, AudioCodec* codec);
+
+private:
+    std::atomic<bool> busy_{false};     /**< Start()からFinish()までtrue */
+    std::atomic<bool> capturing_{false};
+    std::atomic<int> writers_{0};       /**< OnCapture/OnProcessedの実行中の数（解放前に0を待つ） */
+    int input_rate_ = 0;
+    int input_channels_ = 1;
+    bool reference_ = false;
+    int reference_channel_ = -1;        /**< 入力のうちリファレンスのチャンネル位置 */
+
+    int16_t* mic_ = nullptr;            /**< マイクのチャンネル（PSRAM） */
+    int16_t* ref_ = nullptr;            /**< リファレンスのチャンネル（PSRAM） */
+    size_t capacity_frames_ = 0;
+    std::atomic<size_t> captured_frames_{0};
+    std::atomic<int64_t> capture_start_us_{INT64_MAX};  /**< 先頭フレームの収録時刻の推定（最小値） */
+
+    int16_t* processed_ = nullptr;      /**< 音声処理の出力（PSRAM） */
+    size_t processed_capacity_ = 0;
+    std::atomic<size_t> processed_samples_{0};
+
+    int16_t* template_ = nullptr;       /**< 入力のサンプリングレートで生成した掃引の先頭部分 */
+    size_t template_samples_ = 0;
+    int64_t sweep_write_us_ = 0;        /**< 掃引の先頭をOutputDataへ渡した時刻 */
+
+    void Release();
+    AudioLoopbackResult Analyze() const;
+    /** @brief startからendの範囲で掃引の先頭を探す（最大の正規化相互相関の位置） */
+    size_t FindTemplate(const int16_t* channel, size_t start, size_t end, float& correlation) const;
+    /** @brief 掃引のoffsetサンプル目からsamples分を生成 */
+    static void GenerateSweep(int16_t* output, size_t offset, size_t samples, int sample_rate);
+};
+
+#endif // AUDIO_LOOPBACK_PROBE_H
@@ -0,0 +1,78 @@
+/**
+ * @file audio_mixer.cc
+ * @brief 再生ボイスの固定小数点ミキサーの実装
+ */
+#include "audio_mixer.h"
+#include "audio_dsp.h"
+
+#include <algorithm>
+
+static inline int16_t Saturate(int32_t value) {
+    return (int16_t)std::min<int32_t>(INT16_MAX, std::max<int32_t>(INT16_MIN, value));
+}
+
+static int32_t PercentToQ15(int percent) {
+    return std::clamp(percent, 0, 100) * AUDIO_MIXER_UNITY_GAIN / 100;
+}
+
+AudioMixer::AudioMixer() {
+    for (auto& gain : gains_) {
+        gain = AUDIO_MIXER_UNITY_GAIN;
+    }
+}
+
+void AudioMixer::SetGain(AudioVoice voice, int percent) {
+    gains_[voice] = PercentToQ15(percent);
+}
+
+void AudioMixer::SetDucking(int percent, int ramp_ms, int sample_rate) {
+    int32_t target = PercentToQ15(percent);
+    int32_t ramp_samples = std::max(1, sample_rate * ramp_ms / 1000);
+    duck_target_ = target;
+    duck_step_ = std::max<int32_t>(1, (AUDIO_MIXER_UNITY_GAIN - target) / ramp_samples);
+}
+
+void AudioMixer::Mix(int16_t* out, size_t samples, const int16_t* const voices[kAudioVoiceCount],
+                     const size_t counts[kAudioVoiceCount]) {
+    bool ducking = voices[kAudioVoiceNotification] != nullptr && counts[kAudioVoiceNotification] > 0;
+    int32_t target = ducking ? duck_target_.load() : AUDIO_MIXER_UNITY_GAIN;
+    int32_t duck = current_duck_gain_;
+    int32_t speech_gain = gains_[kAudioVoiceSpeech];
+
+    // 話声: ゲインが一定ならPIEカーネル、移行中だけサンプルごとに変化させる
+    if (duck == target) {
+        int32_t gain = (int32_t)(((int64_t)speech_gain * duck) >> 15);
+        if (gain != AUDIO_MIXER_UNITY_GAIN) {
+            audio_dsp::ApplyGain(out, out, samples, gain / (float)AUDIO_MIXER_UNITY_GAIN);
+        }
+    } else {
+        int32_t step = duck_step_;
+        for (size_t i = 0; i < samples; ++i) {
+            if (duck < target) {
+                duck = std::min(target, duck + step);
+            } else if (duck > target) {
+                duck = std::max(target, duck - step);
+            }
+            int32_t gain = (int32_t)(((int64_t)speech_gain * duck) >> 15);
+            out[i] = Saturate(((int32_t)out[i] * gain) >> 15);
+        }
+        current_duck_gain_ = duck;
+    }
+
+    // 他のボイスを加算する
+    for (int voice = kAudioVoiceSpeech + 1; voice < kAudioVoiceCount; ++voice) {
+        const int16_t* pcm = voices[voice];
+        size_t count = std::min(counts[voice], samples);
+        if (pcm == nullptr || count == 0) {
+            continue;
+        }
+        int32_t gain = gains_[voice];
+        if (gain == AUDIO_MIXER_UNITY_GAIN) {
+            audio_dsp::Mix(out, pcm, out, count);
+        } else {
+            for (size_t i = 0; i < count; ++i) {
+                out[i] = Saturate((int32_t)out[i] + (((int32_t)pcm[i] * gain) >> 15));
+            }
+        }
+    }
+}
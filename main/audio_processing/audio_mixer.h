@@ -0,0 +1,71 @@
+/**
+ * @file audio_mixer.h
+ * @brief 再生ボイス（話声・通知音・効果音）の固定小数点ミキサー
+ *
+ * ライタータスクがコーデックへ書き込む直前に、話声のチャンクへ他のボイスを重ねます。
+ * ゲインはQ15で保持し、通知音の再生中は話声を滑らかに下げます（ダッキング）。
+ */
+#ifndef AUDIO_MIXER_H
+#define AUDIO_MIXER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+/** @brief Q15の等倍ゲイン */
+#define AUDIO_MIXER_UNITY_GAIN 32768
+
+/**
+ * @enum AudioVoice
+ * @brief ミキサーの入力ボイス
+ */
+enum AudioVoice {
+    kAudioVoiceSpeech,          /**< サーバーTTS（受信ストリーム） */
+    kAudioVoiceNotification,    /**< 通知音・案内音声（再生中は話声をダッキング） */
+    kAudioVoiceEarcon,          /**< 短い効果音（ダッキングしない） */
+    kAudioVoiceCount
+};
+
+/**
+ * @class AudioMixer
+ * @brief 話声のバッファへ他のボイスを加算する
+ *
+ * SetGain()/SetDucking() は任意のタスクから呼び出せます。Mix() はライタータスクのみが呼びます。
+ * 重ねるボイスがなくゲインも等倍のときは何もしません。
+ */
+class AudioMixer {
+public:
+    AudioMixer();
+
+    /** @brief ボイスのゲインを設定（パーセント、0〜100） */
+    void SetGain(AudioVoice voice, int percent);
+
+    /**
+     * @brief ダッキングを設定
+     * @param percent 通知音の再生中の話声のゲイン（パーセント）
+     * @param ramp_ms 等倍とpercentの間を移行する時間
+     * @param sample_rate 出力サンプリングレート
+     */
+    void SetDucking(int percent, int ramp_ms, int sample_rate);
+
+    /**
+     * @brief 話声へ他のボイスを重ねる
+     * @param out 話声（なければ無音）で満たした出力バッファ。結果で上書きする
+     * @param samples outのサンプル数
+     * @param voices ボイスごとのPCM（kAudioVoiceSpeechの要素は使わない、データがなければnullptr）
+     * @param counts ボイスごとのサンプル数（samples以下、足りない分は無音とみなす）
+     */
+    void Mix(int16_t* out, size_t samples, const int16_t* const voices[kAudioVoiceCount],
+             const size_t counts[kAudioVoiceCount]);
+
+    /** @brief 現在のダッキングゲイン（Q15） */
+    int32_t duck_gain() const { return current_duck_gain_; }
+
+private:
+    std::atomic<int32_t> gains_[kAudioVoiceCount];  /**< ボイスごとのゲイン（Q15） */
+    std::atomic<int32_t> duck_target_{AUDIO_MIXER_UNITY_GAIN};  /**< ダッキング中の話声ゲイン（Q15） */
+    std::atomic<int32_t> duck_step_{AUDIO_MIXER_UNITY_GAIN};    /**< 1サンプルあたりの変化量（Q15） */
+    std::atomic<int32_t> current_duck_gain_{AUDIO_MIXER_UNITY_GAIN};
+};
+
+#endif // AUDIO_MIXER_H
@@ -0,0 +1,381 @@
+/**
+ * @file audio_pipeline.cc
+ * @brief 音声変換パイプラインの実装
+ */
+#include "audio_pipeline.h"
+#include "polyphase_resampler.h"
+#include "metrics.h"
+#if CONFIG_USE_AUDIO_TAP
+#include "audio_tap.h"
+#endif
+#include "audio_codec.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <mutex>
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#define TAG "AudioPipeline"
+
+namespace {
+
+/** @brief メトリクスの読み出し用に生存中のパイプラインを保持する */
+std::mutex s_registry_mutex;
+std::vector<AudioPipeline*> s_pipelines;
+
+/** @brief 全チャンネルのリサンプル（直後のゲインを同じパスで適用） */
+class ResampleStage : public AudioStage {
+public:
+    ResampleStage(const char* name, const AudioFormat& input, const AudioFormat& output, int gain_percent)
+        : AudioStage(name, input, output), gain_percent_(gain_percent),
+          resamplers_(input.channels), channel_in_(input.channels), channel_out_(input.channels) {}
+
+    bool Configure() {
+        for (auto& resampler : resamplers_) {
+            if (!resampler.Configure(input_format().sample_rate, output_format().sample_rate)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    size_t GetMaxOutputSamples(size_t samples) const override {
+        size_t channels = resamplers_.size();
+        return resamplers_[0].GetOutputSamples(samples / channels) * channels;
+    }
+
+    size_t AUDIO_HOT_ATTR Process(const int16_t* input, size_t samples, int16_t* output) override {
+        size_t channels = resamplers_.size();
+        size_t frames = samples / channels;
+        size_t produced;
+        if (channels == 1) {
+            produced = resamplers_[0].Process(input, frames, output);
+        } else {
+            for (size_t c = 0; c < channels; ++c) {
+                channel_in_[c].resize(frames);
+                channel_out_[c].resize(resamplers_[c].GetOutputSamples(frames));
+            }
+            if (channels == 2) {
+                audio_dsp::Deinterleave(input, channel_in_[0].data(), channel_in_[1].data(), frames);
+            } else {
+                for (size_t i = 0; i < frames; ++i) {
+                    for (size_t c = 0; c < channels; ++c) {
+                        channel_in_[c][i] = input[i * channels + c];
+                    }
+                }
+            }
+            size_t out_frames = 0;
+            for (size_t c = 0; c < channels; ++c) {
+                out_frames = resamplers_[c].Process(channel_in_[c].data(), frames, channel_out_[c].data());
+            }
+            if (channels == 2) {
+                audio_dsp::Interleave(channel_out_[0].data(), channel_out_[1].data(), output, out_frames);
+            } else {
+                for (size_t i = 0; i < out_frames; ++i) {
+                    for (size_t c = 0; c < channels; ++c) {
+                        output[i * channels + c] = channel_out_[c][i];
+                    }
+                }
+            }
+            produced = out_frames * channels;
+        }
+        if (gain_percent_ != 100) {
+            audio_dsp::ApplyGain(output, output, produced, gain_percent_ / 100.0f);
+        }
+        return produced;
+    }
+
+    void Reset() override {
+        for (auto& resampler : resamplers_) {
+            resampler.Reset();
+        }
+    }
+
+private:
+    int gain_percent_;
+    std::vector<PolyphaseResampler> resamplers_;
+    std::vector<audio_dsp::AlignedPcmBuffer> channel_in_;   /**< チャンネル分離後の入力 */
+    std::vector<audio_dsp::AlignedPcmBuffer> channel_out_;  /**< チャンネルごとの出力 */
+};
+
+/** @brief 2チャンネル24kHz→16kHzのチャンネル分離・リサンプル・再インターリーブを1パスで行う段 */
+class StereoDecimateStage : public AudioStage {
+public:
+    StereoDecimateStage(const char* name, const AudioFormat& input, const AudioFormat& output, int gain_percent)
+        : AudioStage(name, input, output), gain_percent_(gain_percent) {}
+
+    size_t GetMaxOutputSamples(size_t samples) const override {
+        return decimator_.GetOutputFrames(samples / 2) * 2;
+    }
+
+    size_t AUDIO_HOT_ATTR Process(const int16_t* input, size_t samples, int16_t* output) override {
+        size_t produced = decimator_.Process(input, samples / 2, output) * 2;
+        if (gain_percent_ != 100) {
+            audio_dsp::ApplyGain(output, output, produced, gain_percent_ / 100.0f);
+        }
+        return produced;
+    }
+
+    void Reset() override { decimator_.Reset(); }
+
+private:
+    int gain_percent_;
+    audio_dsp::StereoDecimator3to2 decimator_;
+};
+
+/** @brief 飽和付きゲイン */
+class GainStage : public AudioStage {
+public:
+    GainStage(const AudioFormat& format, int gain_percent)
+        : AudioStage("gain", format, format), gain_percent_(gain_percent) {}
+
+    bool in_place() const override { return true; }
+
+    size_t Process(const int16_t* input, size_t samples, int16_t* output) override {
+        audio_dsp::ApplyGain(input, output, samples, gain_percent_ / 100.0f);
+        return samples;
+    }
+
+private:
+    int gain_percent_;
+};
+
+#if CONFIG_USE_AUDIO_TAP
+/** @brief AudioTapへの記録（チャンネルを指定した場合は取り出してから記録） */
+class TapStage : public AudioStage {
+public:
+    TapStage(const AudioFormat& format, AudioTapPoint point, int channel)
+        : AudioStage(kNames[point], format, format), point_(point), channel_(channel) {}
+
+    bool observer() const override { return true; }
+
+    void Observe(const int16_t* input, size_t samples) override {
+        auto& tap = AudioTap::GetInstance();
+        int channels = input_format().channels;
+        if (channel_ < 0 || channels == 1) {
+            tap.Write(point_, input, samples, input_format().sample_rate, channels);
+            return;
+        }
+        if (!tap.IsRecording(point_)) {
+            return;
+        }
+        size_t frames = samples / channels;
+        scratch_.resize(frames);
+        for (size_t i = 0; i < frames; ++i) {
+            scratch_[i] = input[i * channels + channel_];
+        }
+        tap.Write(point_, scratch_.data(), frames, input_format().sample_rate, 1);
+    }
+
+private:
+    static constexpr const char* kNames[kAudioTapPointCount] = {
+        "tap_mic_raw", "tap_reference", "tap_resampled", "tap_afe_output", "tap_decoded", "tap_speaker",
+    };
+    AudioTapPoint point_;
+    int channel_;
+    std::vector<int16_t> scratch_;
+};
+#endif
+
+/** @brief 連続するゲインの段をまとめた倍率（パーセント） */
+int CollectGain(const std::vector<AudioStageSpec>& spec, size_t& index) {
+    int gain = 100;
+    while (index + 1 < spec.size() && spec[index + 1].type == kAudioStageGain) {
+        gain = gain * spec[++index].value / 100;
+    }
+    return gain;
+}
+
+} // namespace
+
+#if CONFIG_USE_METRICS
+/** @brief 段ごとの計測値をパイプライン名と段名のラベル付きで書き出す */
+static void SampleStages(MetricSink& sink, std::atomic<uint32_t> AudioStage::*field) {
+    std::lock_guard<std::mutex> lock(s_registry_mutex);
+    char labels[64];
+    for (auto pipeline : s_pipelines) {
+        for (auto& stage : pipeline->stages()) {
+            snprintf(labels, sizeof(labels), "pipeline=\"%s\",stage=\"%s\"", pipeline->name(), stage->name());
+            sink.Sample("", labels, ((*stage).*field).load(std::memory_order_relaxed));
+        }
+    }
+}
+
+static MetricCallback metric_stage_calls("xiaozhi_audio_stage_calls_total",
+    "Blocks processed by each audio pipeline stage", kMetricCounter, [](MetricSink& sink) {
+        SampleStages(sink, &AudioStage::calls);
+    });
+static MetricCallback metric_stage_time("xiaozhi_audio_stage_time_us_total",
+    "Time spent in each audio pipeline stage", kMetricCounter, [](MetricSink& sink) {
+        SampleStages(sink, &AudioStage::total_us);
+    });
+static MetricCallback metric_stage_max("xiaozhi_audio_stage_max_us",
+    "Longest single block in each audio pipeline stage", kMetricGauge, [](MetricSink& sink) {
+        SampleStages(sink, &AudioStage::max_us);
+    });
+#endif
+
+AudioPipeline::AudioPipeline(const char* name) : name_(name) {
+    std::lock_guard<std::mutex> lock(s_registry_mutex);
+    s_pipelines.push_back(this);
+}
+
+AudioPipeline::~AudioPipeline() {
+    std::lock_guard<std::mutex> lock(s_registry_mutex);
+    s_pipelines.erase(std::remove(s_pipelines.begin(), s_pipelines.end(), this), s_pipelines.end());
+}
+
+bool AudioPipeline::Build(const AudioFormat& input, const std::vector<AudioStageSpec>& spec, size_t max_input_samples) {
+    std::vector<std::unique_ptr<AudioStage>> stages;
+    AudioFormat format = input;
+    size_t max_samples = max_input_samples;
+    size_t buffer_samples = 0;
+    bool converts = false;
+
+    for (size_t i = 0; i < spec.size(); ++i) {
+        const auto& item = spec[i];
+        std::unique_ptr<AudioStage> stage;
+        switch (item.type) {
+        case kAudioStageResample: {
+            if (item.value == format.sample_rate) {
+                break;
+            }
+            AudioFormat output = {item.value, format.channels};
+            // 直後のゲインはリサンプルの出力に同じパスで適用する
+            int gain = CollectGain(spec, i);
+            if (format.channels == 2 && format.sample_rate == 24000 && output.sample_rate == 16000) {
+                stage.reset(new StereoDecimateStage(gain != 100 ? "deinterleave+resample+gain" : "deinterleave+resample",
+                    format, output, gain));
+            } else {
+                auto resample = new ResampleStage(gain != 100 ? "resample+gain" : "resample", format, output, gain);
+                stage.reset(resample);
+                if (!resample->Configure()) {
+                    ESP_LOGE(TAG, "%s: cannot resample %d -> %d Hz", name_, format.sample_rate, output.sample_rate);
+                    return false;
+                }
+            }
+            break;
+        }
+        case kAudioStageGain: {
+            int gain = item.value * CollectGain(spec, i) / 100;
+            if (gain != 100) {
+                stage.reset(new GainStage(format, gain));
+            }
+            break;
+        }
+        case kAudioStageTap:
+#if CONFIG_USE_AUDIO_TAP
+            if (item.value < kAudioTapPointCount && item.channel < format.channels) {
+                stage.reset(new TapStage(format, (AudioTapPoint)item.value, item.channel));
+            }
+#endif
+            break;
+        }
+        if (stage == nullptr) {
+            continue;
+        }
+        if (!stage->observer()) {
+            converts = true;
+            max_samples = stage->GetMaxOutputSamples(max_samples);
+            buffer_samples = std::max(buffer_samples, max_samples);
+        }
+        format = stage->output_format();
+        stages.push_back(std::move(stage));
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(s_registry_mutex);
+        stages_ = std::move(stages);
+    }
+    output_ = format;
+    converts_ = converts;
+    for (auto& buffer : buffers_) {
+        buffer.reserve(buffer_samples);
+    }
+    LogStages();
+    return true;
+}
+
+size_t AUDIO_HOT_ATTR AudioPipeline::RunStage(AudioStage& stage, const int16_t* input, size_t samples, int16_t* output) {
+    int64_t start = esp_timer_get_time();
+    size_t produced = samples;
+    if (stage.observer()) {
+        stage.Observe(input, samples);
+    } else {
+        produced = stage.Process(input, samples, output);
+    }
+    uint32_t elapsed = esp_timer_get_time() - start;
+    stage.calls.fetch_add(1, std::memory_order_relaxed);
+    stage.total_us.fetch_add(elapsed, std::memory_order_relaxed);
+    if (elapsed > stage.max_us.load(std::memory_order_relaxed)) {
+        stage.max_us.store(elapsed, std::memory_order_relaxed);
+    }
+    return produced;
+}
+
+void AUDIO_HOT_ATTR AudioPipeline::Process(const int16_t* input, size_t samples, std::vector<int16_t>& output) {
+    if (!converts_) {
+        for (auto& stage : stages_) {
+            RunStage(*stage, input, samples, nullptr);
+        }
+        if (output.data() != input) {
+            output.assign(input, input + samples);
+        }
+        return;
+    }
+
+    // 最後に変換する段はoutputへ直接書き込む
+    size_t last = 0;
+    for (size_t i = 0; i < stages_.size(); ++i) {
+        if (!stages_[i]->observer()) {
+            last = i;
+        }
+    }
+
+    const int16_t* current = input;
+    size_t count = samples;
+    int next = 0;
+    for (size_t i = 0; i < stages_.size(); ++i) {
+        auto& stage = *stages_[i];
+        if (stage.observer()) {
+            RunStage(stage, current, count, nullptr);
+            continue;
+        }
+        int16_t* target;
+        size_t max_output = stage.GetMaxOutputSamples(count);
+        if (i == last) {
+            output.resize(max_output);
+            target = output.data();
+        } else if (stage.in_place() && current != input) {
+            target = const_cast<int16_t*>(current);
+        } else {
+            auto& buffer = buffers_[next];
+            next ^= 1;
+            buffer.resize(max_output);
+            target = buffer.data();
+        }
+        count = RunStage(stage, current, count, target);
+        if (i == last) {
+            output.resize(count);
+        }
+        current = target;
+    }
+}
+
+void AudioPipeline::Reset() {
+    for (auto& stage : stages_) {
+        stage->Reset();
+    }
+}
+
+void AudioPipeline::LogStages() const {
+    for (auto& stage : stages_) {
+        uint32_t calls = stage->calls.load(std::memory_order_relaxed);
+        ESP_LOGI(TAG, "%s: %s %d Hz x%d -> %d Hz x%d, %lu calls, avg %lu us, max %lu us", name_, stage->name(),
+            stage->input_format().sample_rate, stage->input_format().channels,
+            stage->output_format().sample_rate, stage->output_format().channels,
+            calls, calls > 0 ? stage->total_us.load(std::memory_order_relaxed) / calls : 0,
+            stage->max_us.load(std::memory_order_relaxed));
+    }
+}
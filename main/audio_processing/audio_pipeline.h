@@ -0,0 +1,145 @@
+/**
+ * @file audio_pipeline.h
+ * @brief 段の並びで宣言する音声変換パイプライン
+ *
+ * コーデックから読んだ入力をAFE/WakeNetへ渡す形へ変換する処理を、段（リサンプル・ゲイン・タップ）の
+ * 並びとして宣言します。Build()は隣り合う段を1パスのカーネルへ融合し（2チャンネル24kHz→16kHzの
+ * 分離とリサンプル、リサンプルとゲイン）、段の間のバッファを最大ブロック長で確保します。
+ * 定常動作中のProcess()はヒープ確保を行いません。
+ *
+ * 各段の処理時間を記録し、CONFIG_USE_METRICS が有効ならパイプライン名と段名のラベル付きで公開します。
+ * Process()は同じタスクから呼び出してください（計測値の読み出しだけは他のタスクから行えます）。
+ */
+#ifndef AUDIO_PIPELINE_H
+#define AUDIO_PIPELINE_H
+
+#include "audio_dsp.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/** @brief パイプラインを流れる音声の形式（複数チャンネルはインターリーブ） */
+struct AudioFormat {
+    int sample_rate = 16000;
+    int channels = 1;
+};
+
+/** @brief 段の種類 */
+enum AudioStageType : uint8_t {
+    kAudioStageResample,        /**< 全チャンネルをvalueのサンプリングレートへ変換 */
+    kAudioStageGain,            /**< valueパーセントのゲイン（飽和付き） */
+    kAudioStageTap,             /**< AudioTapへ記録（value: AudioTapPoint）。データは変えない */
+};
+
+/** @brief 段の宣言 */
+struct AudioStageSpec {
+    AudioStageType type;
+    int value;
+    int channel = -1;           /**< タップで記録するチャンネル（-1はすべて） */
+};
+
+/**
+ * @class AudioStage
+ * @brief パイプラインの1段
+ *
+ * 変換する段は入力と異なるバッファへ出力します（in-placeを許す段は同じバッファを渡されることがあります）。
+ * 観測だけの段（observer()がtrue）はObserve()だけが呼ばれ、バッファを消費しません。
+ */
+class AudioStage {
+public:
+    AudioStage(const char* name, const AudioFormat& input, const AudioFormat& output)
+        : name_(name), input_(input), output_(output) {}
+    virtual ~AudioStage() = default;
+
+    const char* name() const { return name_; }
+    const AudioFormat& input_format() const { return input_; }
+    const AudioFormat& output_format() const { return output_; }
+
+    /** @brief データを変えない段かどうか */
+    virtual bool observer() const { return false; }
+    /** @brief 出力先に入力と同じバッファを渡してよいか */
+    virtual bool in_place() const { return false; }
+
+    /** @brief 入力サンプル数（全チャンネル）に対する出力サンプル数の上限 */
+    virtual size_t GetMaxOutputSamples(size_t input_samples) const { return input_samples; }
+
+    /**
+     * @brief 変換
+     * @return 出力したサンプル数（全チャンネル）
+     */
+    virtual size_t Process(const int16_t* input, size_t samples, int16_t* output) { return 0; }
+
+    /** @brief 観測（observer()がtrueの段） */
+    virtual void Observe(const int16_t* input, size_t samples) {}
+
+    /** @brief フィルタ状態をクリア */
+    virtual void Reset() {}
+
+    // 計測（書き込みはProcess()を呼ぶタスク、読み出しは任意のタスク）
+    std::atomic<uint32_t> calls{0};
+    std::atomic<uint32_t> total_us{0};
+    std::atomic<uint32_t> max_us{0};
+
+private:
+    const char* name_;
+    AudioFormat input_;
+    AudioFormat output_;
+};
+
+/**
+ * @class AudioPipeline
+ * @brief 宣言した段を順に実行する変換パイプライン
+ */
+class AudioPipeline {
+public:
+    /** @param name メトリクスのラベルに使う名前（文字列リテラル） */
+    explicit AudioPipeline(const char* name);
+    ~AudioPipeline();
+
+    AudioPipeline(const AudioPipeline&) = delete;
+    AudioPipeline& operator=(const AudioPipeline&) = delete;
+
+    /**
+     * @brief 段を組み立てて段の間のバッファを確保
+     * @param input 入力の形式
+     * @param spec 段の並び
+     * @param max_input_samples 1回のProcess()に渡す入力サンプル数の上限（全チャンネル）
+     * @return 対応していない変換がある場合false
+     */
+    bool Build(const AudioFormat& input, const std::vector<AudioStageSpec>& spec, size_t max_input_samples);
+
+    /**
+     * @brief 入力を変換してoutputへ書き込む
+     *
+     * データを変換する段がない場合、outputが入力と同じバッファなら観測だけを行います。
+     */
+    void Process(const int16_t* input, size_t samples, std::vector<int16_t>& output);
+
+    /** @brief すべての段のフィルタ状態をクリア */
+    void Reset();
+
+    /** @brief データを変換する段があるかどうか */
+    bool converts() const { return converts_; }
+
+    const AudioFormat& output_format() const { return output_; }
+    const char* name() const { return name_; }
+    const std::vector<std::unique_ptr<AudioStage>>& stages() const { return stages_; }
+
+    /** @brief 段の並び（融合後）と処理時間をログへ出力 */
+    void LogStages() const;
+
+private:
+    const char* name_;
+    AudioFormat output_;
+    bool converts_ = false;
+    std::vector<std::unique_ptr<AudioStage>> stages_;
+    audio_dsp::AlignedPcmBuffer buffers_[2];    /**< 段の間で交互に使う作業バッファ */
+
+    /** @brief 段を実行して処理時間を記録 */
+    size_t RunStage(AudioStage& stage, const int16_t* input, size_t samples, int16_t* output);
+};
+
+#endif // AUDIO_PIPELINE_H
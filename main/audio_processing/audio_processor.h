@@ -40,14 +40,36 @@ public:
     /** 処理中かどうかを確認 */
     virtual bool IsRunning() = 0;
     
-    /** 処理済み音声データのコールバック設定 */
-    virtual void OnOutput(std::function<void(std::vector<int16_t>&& data)> callback) = 0;
+    /**
+     * 処理済み音声データのコールバック設定
+     *
+     * dataはプロセッサ内部のバッファを借りたもので、コールバックの呼び出し中のみ有効です。
+     * 後で使う場合は呼び出し側でコピーしてください（フェッチごとのvector確保を避けるため）。
+     */
+    virtual void OnOutput(std::function<void(const int16_t* data, size_t samples)> callback) = 0;
     
     /** VAD（音声活動検出）状態変化コールバック設定 */
     virtual void OnVadStateChange(std::function<void(bool speaking)> callback) = 0;
     
     /** 1回のフィードで必要なサンプル数を取得 */
     virtual size_t GetFeedSize() = 0;
+
+    /** 入力AGCを有効/無効化（対応していない場合はfalse） */
+    virtual bool SetAgcEnabled(bool enabled) { return false; }
+
+    /** 入力AGCが有効かどうか */
+    virtual bool agc_enabled() const { return false; }
+
+    /**
+     * 発話終了の検出を有効/無効化（対応していない場合は何もしない）
+     *
+     * 有効な間、発話の後に無音が続くと OnEndOfUtterance() のコールバックを1回だけ呼びます。
+     * 有効化するたびに状態は初期化されます。
+     */
+    virtual void SetEndpointing(bool enabled) {}
+
+    /** 発話終了のコールバック設定（音声処理タスクから呼ばれる） */
+    virtual void OnEndOfUtterance(std::function<void()> callback) {}
 };
 
 #endif
@@ -0,0 +1,206 @@
+/**
+ * @file audio_tap.cc
+ * @brief 音声パイプラインのPCMのUDP送信の実装
+ */
+#include "audio_tap.h"
+
+#include <esp_heap_caps.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <lwip/sockets.h>
+#include <cJSON.h>
+
+#include <algorithm>
+#include <cstring>
+
+#define TAG "AudioTap"
+
+namespace {
+
+const char* const kPointNames[kAudioTapPointCount] = {
+    "mic_raw", "reference", "resampled", "afe_output", "decoded", "speaker",
+};
+
+/** @brief リングの位置posからsizeバイトを書き込む（末尾で折り返す） */
+void CopyIn(uint8_t* ring, size_t ring_size, uint32_t pos, const void* data, size_t size) {
+    size_t offset = pos & (ring_size - 1);
+    size_t first = std::min(size, ring_size - offset);
+    memcpy(ring + offset, data, first);
+    memcpy(ring, (const uint8_t*)data + first, size - first);
+}
+
+void CopyOut(const uint8_t* ring, size_t ring_size, uint32_t pos, void* data, size_t size) {
+    size_t offset = pos & (ring_size - 1);
+    size_t first = std::min(size, ring_size - offset);
+    memcpy(data, ring + offset, first);
+    memcpy((uint8_t*)data + first, ring, size - first);
+}
+
+} // namespace
+
+void AudioTap::Start() {
+    if (task_ != nullptr) {
+        return;
+    }
+    size_t size = 1;
+    while (size < CONFIG_AUDIO_TAP_RING_KB * 1024) {
+        size <<= 1;
+    }
+    for (auto& ring : rings_) {
+        ring.buffer = (uint8_t*)heap_caps_malloc(size, MALLOC_CAP_SPIRAM);
+        if (ring.buffer == nullptr) {
+            ESP_LOGE(TAG, "Failed to allocate %u bytes", size);
+            return;
+        }
+        ring.size = size;
+    }
+
+    xTaskCreate([](void* arg) {
+        ((AudioTap*)arg)->SendTask();
+    }, "audio_tap", 4096, this, 2, &task_);
+
+    if (strlen(CONFIG_AUDIO_TAP_HOST) > 0) {
+        Configure(CONFIG_AUDIO_TAP_HOST, CONFIG_AUDIO_TAP_PORT, CONFIG_AUDIO_TAP_POINTS);
+    }
+}
+
+bool AudioTap::Configure(const std::string& host, int port, uint32_t points) {
+    if (task_ == nullptr) {
+        return false;
+    }
+    uint32_t address = 0;
+    if (!host.empty() && inet_pton(AF_INET, host.c_str(), &address) != 1) {
+        ESP_LOGW(TAG, "Invalid host: %s", host.c_str());
+        return false;
+    }
+
+    // 先に記録を止めてから送信先を変える
+    points_ = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        host_ = address;
+        port_ = port;
+    }
+    if (address != 0) {
+        points_ = points & ((1u << kAudioTapPointCount) - 1);
+    }
+    ESP_LOGI(TAG, "Streaming points 0x%02lx to %s:%d", points_.load(), host.c_str(), port);
+    return true;
+}
+
+void AudioTap::Push(AudioTapPoint point, const int16_t* data, size_t samples, int sample_rate, int channels) {
+    auto& ring = rings_[point];
+    if (ring.buffer == nullptr) {
+        return;
+    }
+    int64_t timestamp = esp_timer_get_time();
+    size_t max_samples = AUDIO_TAP_MAX_PAYLOAD / sizeof(int16_t) / channels * channels;
+    while (samples > 0) {
+        size_t chunk = std::min(samples, max_samples);
+        AudioTapHeader header = {
+            .magic = AUDIO_TAP_MAGIC,
+            .point = point,
+            .channels = (uint8_t)channels,
+            .sequence = ring.sequence++,
+            .timestamp_us = (uint64_t)timestamp,
+            .sample_rate = (uint32_t)sample_rate,
+            .samples = (uint16_t)chunk,
+            .reserved = 0,
+        };
+        size_t bytes = chunk * sizeof(int16_t);
+        uint32_t head = ring.head.load(std::memory_order_relaxed);
+        uint32_t tail = ring.tail.load(std::memory_order_acquire);
+        if (ring.size - (head - tail) < sizeof(header) + bytes) {
+            // 送信が追いつかない分は捨てる（ホストでは連番の欠けとして見える）
+            ring.dropped.fetch_add(1, std::memory_order_relaxed);
+        } else {
+            CopyIn(ring.buffer, ring.size, head, &header, sizeof(header));
+            CopyIn(ring.buffer, ring.size, head + sizeof(header), data, bytes);
+            ring.head.store(head + sizeof(header) + bytes, std::memory_order_release);
+        }
+        data += chunk;
+        samples -= chunk;
+        timestamp += (int64_t)chunk / channels * 1000000 / sample_rate;
+    }
+}
+
+bool AudioTap::SendOne(Ring& ring, uint8_t* datagram) {
+    uint32_t tail = ring.tail.load(std::memory_order_relaxed);
+    uint32_t head = ring.head.load(std::memory_order_acquire);
+    if (head - tail < sizeof(AudioTapHeader)) {
+        return false;
+    }
+    // 書き込み側はレコード全体を書いてからheadを進めるため、ヘッダーがあれば本体もそろっている
+    AudioTapHeader header;
+    CopyOut(ring.buffer, ring.size, tail, &header, sizeof(header));
+    size_t length = sizeof(header) + header.samples * sizeof(int16_t);
+    CopyOut(ring.buffer, ring.size, tail, datagram, length);
+    ring.tail.store(tail + length, std::memory_order_release);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (host_ == 0) {
+        return true;
+    }
+    struct sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port_);
+    address.sin_addr.s_addr = host_;
+    if (sendto(socket_, datagram, length, 0, (struct sockaddr*)&address, sizeof(address)) < 0) {
+        // 接続前やバッファ不足の間は捨てる
+        ring.dropped.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        ring.sent.fetch_add(1, std::memory_order_relaxed);
+    }
+    return true;
+}
+
+void AudioTap::SendTask() {
+    socket_ = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (socket_ < 0) {
+        ESP_LOGE(TAG, "Failed to create socket");
+        vTaskDelete(NULL);
+        return;
+    }
+    auto datagram = (uint8_t*)heap_caps_malloc(sizeof(AudioTapHeader) + AUDIO_TAP_MAX_PAYLOAD, MALLOC_CAP_INTERNAL);
+
+    while (true) {
+        bool sent = false;
+        for (auto& ring : rings_) {
+            sent = SendOne(ring, datagram) || sent;
+        }
+        if (!sent) {
+            vTaskDelay(pdMS_TO_TICKS(AUDIO_TAP_SEND_INTERVAL_MS));
+        }
+    }
+}
+
+std::string AudioTap::GetStatusJson() {
+    cJSON* root = cJSON_CreateObject();
+    char host[16] = "";
+    int port;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (host_ != 0) {
+            inet_ntop(AF_INET, &host_, host, sizeof(host));
+        }
+        port = port_;
+    }
+    cJSON_AddStringToObject(root, "host", host);
+    cJSON_AddNumberToObject(root, "port", port);
+    cJSON_AddNumberToObject(root, "points", points_.load());
+    cJSON* points = cJSON_CreateObject();
+    for (int i = 0; i < kAudioTapPointCount; i++) {
+        cJSON* item = cJSON_CreateObject();
+        cJSON_AddBoolToObject(item, "enabled", (points_.load() & (1u << i)) != 0);
+        cJSON_AddNumberToObject(item, "sent", rings_[i].sent.load());
+        cJSON_AddNumberToObject(item, "dropped", rings_[i].dropped.load());
+        cJSON_AddItemToObject(points, kPointNames[i], item);
+    }
+    cJSON_AddItemToObject(root, "stats", points);
+
+    char* json = cJSON_PrintUnformatted(root);
+    std::string result(json);
+    cJSON_free(json);
+    cJSON_Delete(root);
+    return result;
+}
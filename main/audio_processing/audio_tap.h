@@ -0,0 +1,131 @@
+/**
+ * @file audio_tap.h
+ * @brief 音声パイプラインの各段のPCMをUDPでホストへ送る診断機能
+ *
+ * ReadAudioの生の入力・リファレンス・リサンプル後、AFEの出力、デコードしたTTS、スピーカーへの出力を
+ * AUDIO_TAP() で記録し、段ごとのリングから送信タスクがUDPで送ります。各データグラムには
+ * 段・連番・記録時刻（esp_timer）・サンプリングレート・チャンネル数が付くため、ホスト側
+ * （scripts/audio_tap_receiver.py）で段ごとのWAVに戻し、欠落と段の間の遅延を確認できます。
+ *
+ * 無効時（CONFIG_USE_AUDIO_TAP=n）は AUDIO_TAP() が空になり、コストはありません。
+ * 有効時も書き込みはロックを取らず、リングがあふれた分は捨てて連番の欠けとして現れます。
+ */
+#ifndef AUDIO_TAP_H
+#define AUDIO_TAP_H
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+/** @brief 記録する段（ビット位置はCONFIG_AUDIO_TAP_POINTSとMCPツールのマスクに対応） */
+enum AudioTapPoint : uint8_t {
+    kAudioTapMicRaw,            /**< コーデックから読んだままの入力（複数チャンネルはインターリーブ） */
+    kAudioTapReference,         /**< リサンプル前のリファレンスチャンネル */
+    kAudioTapResampled,         /**< 16kHzへリサンプルした入力（AFE/WakeNetへ渡す形） */
+    kAudioTapAfeOutput,         /**< AFEの出力（上りエンコードへ渡す音声） */
+    kAudioTapDecoded,           /**< デコード・リサンプル後のTTS */
+    kAudioTapSpeaker,           /**< ミキサーとリミッター後のスピーカー出力 */
+    kAudioTapPointCount,
+};
+
+#if CONFIG_USE_AUDIO_TAP
+/** @brief PCMを記録（pointの記録が無効なら何もしない） */
+#define AUDIO_TAP(point, data, samples, sample_rate, channels) \
+    AudioTap::GetInstance().Write(point, data, samples, sample_rate, channels)
+#else
+#define AUDIO_TAP(point, data, samples, sample_rate, channels) do {} while (0)
+#endif
+
+#define AUDIO_TAP_MAGIC 0x4154          // 先頭2バイトは "TA"
+#define AUDIO_TAP_MAX_PAYLOAD 1024      // 1データグラムのPCMの最大バイト数
+#define AUDIO_TAP_SEND_INTERVAL_MS 10   // リングが空のときに送信タスクが待つ時間
+
+/** @brief データグラムの先頭（リトルエンディアン） */
+struct __attribute__((packed)) AudioTapHeader {
+    uint16_t magic;
+    uint8_t point;              /**< AudioTapPoint */
+    uint8_t channels;
+    uint32_t sequence;          /**< 段ごとの連番（あふれで捨てた分も進む） */
+    uint64_t timestamp_us;      /**< 先頭サンプルを記録した時刻（esp_timer_get_time） */
+    uint32_t sample_rate;
+    uint16_t samples;           /**< 全チャンネルを合わせたサンプル数 */
+    uint16_t reserved;
+};
+
+/**
+ * @class AudioTap
+ * @brief 段ごとのSPSCリングとUDP送信タスクを持つシングルトン
+ *
+ * 各段への書き込みは決まった1つのタスク（audio_loop、AFE、再生）から行われるため、
+ * 段ごとのリングは書き込み側1つ・読み出し側1つのロックなしリングです。
+ */
+class AudioTap {
+public:
+    static AudioTap& GetInstance() {
+        static AudioTap instance;
+        return instance;
+    }
+
+    AudioTap(const AudioTap&) = delete;
+    AudioTap& operator=(const AudioTap&) = delete;
+
+    /** @brief リングを確保して送信タスクを開始（CONFIG_AUDIO_TAP_HOSTが空ならConfigure()まで送らない） */
+    void Start();
+
+    /**
+     * @brief 送信先と記録する段を変更
+     * @param host 送信先のIPv4アドレス（空なら記録を止める）
+     * @param points 記録する段のビットマスク
+     * @return アドレスが不正なときfalse
+     */
+    bool Configure(const std::string& host, int port, uint32_t points);
+
+    /** @brief 設定と段ごとの送信数・破棄数をJSON形式で取得 */
+    std::string GetStatusJson();
+
+    /** @brief 段を記録中かどうか（記録用にデータを作る前の確認） */
+    bool IsRecording(AudioTapPoint point) const {
+        return (points_.load(std::memory_order_relaxed) & (1u << point)) != 0;
+    }
+
+    /** @brief PCMを記録 */
+    void Write(AudioTapPoint point, const int16_t* data, size_t samples, int sample_rate, int channels) {
+        if (!IsRecording(point)) {
+            return;
+        }
+        Push(point, data, samples, sample_rate, channels);
+    }
+
+private:
+    AudioTap() = default;
+
+    /** @brief 1段分のリング（headは書き込み側、tailは読み出し側だけが進める） */
+    struct Ring {
+        uint8_t* buffer = nullptr;
+        size_t size = 0;                        /**< 2のべき乗 */
+        std::atomic<uint32_t> head{0};
+        std::atomic<uint32_t> tail{0};
+        uint32_t sequence = 0;                  /**< 書き込み側だけが使う */
+        std::atomic<uint32_t> sent{0};
+        std::atomic<uint32_t> dropped{0};
+    };
+
+    Ring rings_[kAudioTapPointCount];
+    std::atomic<uint32_t> points_{0};
+    std::mutex mutex_;                          /**< 送信先の変更と送信の間 */
+    uint32_t host_ = 0;                         /**< 送信先（ネットワークバイトオーダー、0なら未設定） */
+    int port_ = 0;
+    int socket_ = -1;
+    TaskHandle_t task_ = nullptr;
+
+    void Push(AudioTapPoint point, const int16_t* data, size_t samples, int sample_rate, int channels);
+    void SendTask();
+    bool SendOne(Ring& ring, uint8_t* datagram);
+};
+
+#endif // AUDIO_TAP_H
@@ -12,7 +12,7 @@ void DummyAudioProcessor::Feed(const std::vector<int16_t>& data) {
         return;
     }
     // 直接将输入数据传递给输出回调
-    output_callback_(std::vector<int16_t>(data));
+    output_callback_(data.data(), data.size());
 }
 
 void DummyAudioProcessor::Start() {
@@ -27,7 +27,7 @@ bool DummyAudioProcessor::IsRunning() {
     return is_running_;
 }
 
-void DummyAudioProcessor::OnOutput(std::function<void(std::vector<int16_t>&& data)> callback) {
+void DummyAudioProcessor::OnOutput(std::function<void(const int16_t* data, size_t samples)> callback) {
     output_callback_ = callback;
 }
 
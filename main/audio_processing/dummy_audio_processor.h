@@ -44,7 +44,7 @@ public:
     bool IsRunning() override;
     
     /** 出力コールバックを設定 */
-    void OnOutput(std::function<void(std::vector<int16_t>&& data)> callback) override;
+    void OnOutput(std::function<void(const int16_t* data, size_t samples)> callback) override;
     
     /** VADコールバックを設定（ダミー） */
     void OnVadStateChange(std::function<void(bool speaking)> callback) override;
@@ -54,7 +54,7 @@ public:
 
 private:
     AudioCodec* codec_ = nullptr;                                               /**< オーディオコーデックインスタンス */
-    std::function<void(std::vector<int16_t>&& data)> output_callback_;          /**< 出力データコールバック */
+    std::function<void(const int16_t* data, size_t samples)> output_callback_;          /**< 出力データコールバック */
     std::function<void(bool speaking)> vad_state_change_callback_;              /**< VAD状態変化コールバック（未使用） */
     bool is_running_ = false;                                                   /**< 動作状態フラグ */
 };
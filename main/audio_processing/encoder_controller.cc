@@ -0,0 +1,97 @@
+#include "encoder_controller.h"
+
+#include <freertos/task.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#include <algorithm>
+
+#define TAG "EncoderController"
+
+void EncoderController::Initialize(int base_complexity) {
+    base_complexity_ = base_complexity;
+    Reset();
+}
+
+void EncoderController::Reset() {
+    complexity_ = target_complexity();
+    dtx_ = false;
+    healthy_windows_ = 0;
+    dropped_packets_.store(0, std::memory_order_relaxed);
+    send_failures_.store(0, std::memory_order_relaxed);
+}
+
+bool EncoderController::SetComplexityLimit(int limit) {
+    complexity_limit_ = limit;
+    int complexity = std::min(complexity_, target_complexity());
+    if (complexity == complexity_) {
+        return false;
+    }
+    ESP_LOGI(TAG, "complexity %d -> %d (limit %d)", complexity_, complexity, limit);
+    complexity_ = complexity;
+    return true;
+}
+
+bool EncoderController::Update(size_t queue_depth, size_t queue_capacity, bool network_weak, int rtt_ms) {
+    uint32_t dropped = dropped_packets_.exchange(0, std::memory_order_relaxed);
+    uint32_t failures = send_failures_.exchange(0, std::memory_order_relaxed);
+    bool congested = dropped > 0 || failures > 0 || queue_depth * 2 > queue_capacity;
+    int idle = MeasureIdlePercent();
+    bool cpu_busy = idle >= 0 && idle < ENCODER_CONTROLLER_BUSY_IDLE_PERCENT;
+    // 電波が強くても経路の先が遅い場合は同じく帯域を空ける
+    network_weak = network_weak || rtt_ms > ENCODER_CONTROLLER_SLOW_RTT_MS;
+
+    int complexity = complexity_;
+    bool dtx = dtx_;
+    if (congested || network_weak || cpu_busy) {
+        healthy_windows_ = 0;
+        // 回線が詰まっている間は無音区間の送信を止めて帯域を空ける
+        if (congested || network_weak) {
+            dtx = true;
+        }
+        // エンコードが間に合わない場合は演算量を下げる
+        if (cpu_busy) {
+            complexity = std::max(0, complexity - 2);
+        }
+    } else if (++healthy_windows_ >= ENCODER_CONTROLLER_RECOVER_WINDOWS) {
+        healthy_windows_ = 0;
+        if (complexity < target_complexity()) {
+            complexity++;
+        } else {
+            dtx = false;
+        }
+    }
+
+    if (complexity == complexity_ && dtx == dtx_) {
+        return false;
+    }
+    ESP_LOGI(TAG, "complexity %d -> %d, dtx %d -> %d (queue %u/%u, dropped %lu, failures %lu, weak %d, rtt %d ms, idle %d%%)",
+        complexity_, complexity, dtx_, dtx, queue_depth, queue_capacity, dropped, failures, network_weak, rtt_ms, idle);
+    complexity_ = complexity;
+    dtx_ = dtx;
+    return true;
+}
+
+int EncoderController::MeasureIdlePercent() {
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS && CONFIG_FREERTOS_USE_TRACE_FACILITY
+    // 実行時間カウンタはesp_timer（マイクロ秒）基準。オーバーフローは符号なし減算で吸収する
+    configRUN_TIME_COUNTER_TYPE idle_time = 0;
+    for (BaseType_t core = 0; core < portNUM_PROCESSORS; ++core) {
+        TaskStatus_t status;
+        vTaskGetInfo(xTaskGetIdleTaskHandleForCore(core), &status, pdFALSE, eRunning);
+        idle_time += status.ulRunTimeCounter;
+    }
+    int64_t now = esp_timer_get_time();
+    int percent = -1;
+    if (last_sample_us_ != 0 && now > last_sample_us_) {
+        configRUN_TIME_COUNTER_TYPE idle_delta = idle_time - last_idle_time_;
+        int64_t elapsed = (now - last_sample_us_) * portNUM_PROCESSORS;
+        percent = std::min<int64_t>(100, (int64_t)idle_delta * 100 / elapsed);
+    }
+    last_idle_time_ = idle_time;
+    last_sample_us_ = now;
+    return percent;
+#else
+    return -1;
+#endif
+}
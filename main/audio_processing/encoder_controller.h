@@ -0,0 +1,90 @@
+/**
+ * @file encoder_controller.h
+ * @brief 回線品質とCPU負荷に応じたOpusエンコーダ設定の調整
+ *
+ * 送信キューの深さ、パケット破棄、SendAudio()の失敗、電波強度、往復遅延、CPUアイドル率を
+ * 1秒ごとに評価し、エンコーダの演算量（complexity）とDTXを段階的に切り替えます。
+ * 悪化時は即座に下げ、良好な状態が続いた場合のみ少しずつ元に戻します。
+ */
+#ifndef ENCODER_CONTROLLER_H
+#define ENCODER_CONTROLLER_H
+
+#include <freertos/FreeRTOS.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+/** @brief CPUが逼迫しているとみなすアイドル率（%） */
+#define ENCODER_CONTROLLER_BUSY_IDLE_PERCENT 15
+
+/** @brief 回線が遅いとみなすサーバーとの往復遅延（ミリ秒） */
+#define ENCODER_CONTROLLER_SLOW_RTT_MS 600
+
+/** @brief 設定を1段戻すまでに必要な連続良好区間（秒） */
+#define ENCODER_CONTROLLER_RECOVER_WINDOWS 5
+
+/**
+ * @class EncoderController
+ * @brief エンコーダ設定のコントローラ
+ *
+ * OnPacketDropped()/OnSendFailed()は任意のタスクから呼び出せます。
+ * Update()は単一のタスク（クロックタイマー）から呼び出してください。
+ */
+class EncoderController {
+public:
+    EncoderController() = default;
+
+    /** @brief 基準となる演算量を設定し、状態を初期化 */
+    void Initialize(int base_complexity);
+
+    /** @brief 初期設定へ戻す（会話開始時など） */
+    void Reset();
+
+    /**
+     * @brief 演算量の上限を設定（電池の段階など、回線品質とは別の制約）
+     * @return 現在の演算量が変わった場合true
+     */
+    bool SetComplexityLimit(int limit);
+
+    /** @brief 送信キューが満杯でパケットを破棄した */
+    void OnPacketDropped() { dropped_packets_.fetch_add(1, std::memory_order_relaxed); }
+
+    /** @brief 音声の送信に失敗した */
+    void OnSendFailed() { send_failures_.fetch_add(1, std::memory_order_relaxed); }
+
+    /**
+     * @brief 直近1区間の状態を評価
+     * @param queue_depth 送信キューに残っているパケット数
+     * @param queue_capacity 送信キューの容量
+     * @param network_weak 電波強度が弱いかどうか
+     * @param rtt_ms サーバーとの往復遅延（ミリ秒）。未計測なら-1
+     * @return 設定が変わった場合true
+     */
+    bool Update(size_t queue_depth, size_t queue_capacity, bool network_weak, int rtt_ms = -1);
+
+    int complexity() const { return complexity_; }
+    bool dtx() const { return dtx_; }
+
+private:
+    int base_complexity_ = 0;           /**< 基準の演算量 */
+    int complexity_limit_ = 10;         /**< 演算量の上限 */
+    int complexity_ = 0;                /**< 現在の演算量 */
+    bool dtx_ = false;                  /**< 現在のDTX設定 */
+    int healthy_windows_ = 0;           /**< 連続良好区間数 */
+    std::atomic<uint32_t> dropped_packets_{0};
+    std::atomic<uint32_t> send_failures_{0};
+
+    // CPUアイドル率の計測用
+    configRUN_TIME_COUNTER_TYPE last_idle_time_ = 0;
+    int64_t last_sample_us_ = 0;
+
+    /** @brief 前回呼び出しからの全コア平均アイドル率（%）。計測できない場合-1 */
+    int MeasureIdlePercent();
+
+    /** @brief 上限を考慮した基準の演算量 */
+    int target_complexity() const { return std::min(base_complexity_, complexity_limit_); }
+};
+
+#endif // ENCODER_CONTROLLER_H
@@ -0,0 +1,129 @@
+#include "local_command_detect.h"
+#include "wake_word_config.h"
+
+#include <esp_log.h>
+#include <esp_mn_models.h>
+#include <esp_mn_speech_commands.h>
+#include <model_path.h>
+
+#include <algorithm>
+#include <cstring>
+
+#define TAG "LocalCommandDetect"
+
+/**
+ * 端末上で実行するコマンドの一覧（インデックス+1がMultiNetのコマンドIDになる）
+ * ツールが登録されていない構成（バックライトなしなど）では実行に失敗し、サーバーに任せる
+ */
+static const LocalCommand kLocalCommands[] = {
+    {"turn up the volume",      "tiao da yin liang",    "self.audio_speaker.set_volume",    "{\"volume\":90}"},
+    {"turn down the volume",    "tiao xiao yin liang",  "self.audio_speaker.set_volume",    "{\"volume\":40}"},
+    {"maximum volume",          "zui da yin liang",     "self.audio_speaker.set_volume",    "{\"volume\":100}"},
+    {"mute the speaker",        "jing yin",             "self.audio_speaker.set_volume",    "{\"volume\":0}"},
+    {"brighter screen",         "tiao liang ping mu",   "self.screen.set_brightness",       "{\"brightness\":100}"},
+    {"darker screen",           "tiao an ping mu",      "self.screen.set_brightness",       "{\"brightness\":30}"},
+    {"dark mode",               "ye jian mo shi",       "self.screen.set_theme",            "{\"theme\":\"dark\"}"},
+    {"light mode",              "ri jian mo shi",       "self.screen.set_theme",            "{\"theme\":\"light\"}"},
+};
+
+LocalCommandDetect::LocalCommandDetect() {
+}
+
+LocalCommandDetect::~LocalCommandDetect() {
+    if (model_data_ != nullptr) {
+        multinet_->destroy(model_data_);
+    }
+}
+
+bool LocalCommandDetect::Initialize() {
+    auto models = WakeWordConfig::GetInstance().models();
+    bool english = true;
+    char* name = esp_srmodel_filter(models, ESP_MN_PREFIX, ESP_MN_ENGLISH);
+    if (name == nullptr) {
+        name = esp_srmodel_filter(models, ESP_MN_PREFIX, ESP_MN_CHINESE);
+        english = false;
+    }
+    if (name == nullptr) {
+        ESP_LOGW(TAG, "No MultiNet model in the model partition, local commands disabled");
+        return false;
+    }
+
+    multinet_ = esp_mn_handle_from_name(name);
+    model_data_ = multinet_->create(name, CONFIG_LOCAL_COMMAND_WINDOW_MS);
+    if (model_data_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to create MultiNet %s", name);
+        return false;
+    }
+
+    esp_mn_commands_alloc(multinet_, model_data_);
+    esp_mn_commands_clear();
+    for (size_t i = 0; i < sizeof(kLocalCommands) / sizeof(kLocalCommands[0]); ++i) {
+        auto& command = kLocalCommands[i];
+        esp_mn_commands_add(i + 1, english ? command.phrase_en : command.phrase_zh);
+    }
+    auto errors = esp_mn_commands_update();
+    if (errors != nullptr) {
+        for (int i = 0; i < errors->num; ++i) {
+            ESP_LOGW(TAG, "Rejected phrase: %s", errors->phrases[i]->string);
+        }
+    }
+
+    chunk_samples_ = multinet_->get_samp_chunksize(model_data_);
+    chunk_.reserve(chunk_samples_);
+    ESP_LOGI(TAG, "MultiNet %s loaded, %u commands", name, (unsigned)(sizeof(kLocalCommands) / sizeof(kLocalCommands[0])));
+    return true;
+}
+
+void LocalCommandDetect::OnCommandDetected(std::function<void(const LocalCommand& command)> callback) {
+    command_detected_callback_ = callback;
+}
+
+void LocalCommandDetect::Start() {
+    if (model_data_ == nullptr) {
+        return;
+    }
+    // モデルの状態は音声処理タスクで初期化する（Feed()と競合させない）
+    reset_ = true;
+    running_ = true;
+}
+
+void LocalCommandDetect::Stop() {
+    running_ = false;
+}
+
+void LocalCommandDetect::Feed(const int16_t* data, size_t samples) {
+    if (!running_) {
+        return;
+    }
+    if (reset_.exchange(false)) {
+        multinet_->clean(model_data_);
+        chunk_.clear();
+    }
+
+    while (samples > 0 && running_) {
+        size_t count = std::min(samples, chunk_samples_ - chunk_.size());
+        chunk_.insert(chunk_.end(), data, data + count);
+        data += count;
+        samples -= count;
+        if (chunk_.size() < chunk_samples_) {
+            break;
+        }
+
+        auto state = multinet_->detect(model_data_, chunk_.data());
+        chunk_.clear();
+        if (state == ESP_MN_STATE_DETECTED) {
+            running_ = false;
+            auto results = multinet_->get_results(model_data_);
+            int id = results->command_id[0] - 1;
+            if (id < 0 || id >= (int)(sizeof(kLocalCommands) / sizeof(kLocalCommands[0]))) {
+                return;
+            }
+            ESP_LOGI(TAG, "Detected command %d (%s), prob %.2f", id, kLocalCommands[id].tool, results->prob[0]);
+            if (command_detected_callback_) {
+                command_detected_callback_(kLocalCommands[id]);
+            }
+        } else if (state == ESP_MN_STATE_TIMEOUT) {
+            running_ = false;
+        }
+    }
+}
@@ -0,0 +1,73 @@
+/**
+ * @file local_command_detect.h
+ * @brief 端末上のコマンド認識（MultiNet）
+ *
+ * ウェイクワード検出の直後から一定時間、AFE処理済みの音声をESP-SRのMultiNetにも渡し、
+ * 音量や画面の明るさのような頻繁な操作を端末上で認識します。認識したコマンドは
+ * McpServerのツールに対応付けてその場で実行するため、サーバーのASR・LLMの往復を省けます。
+ */
+#ifndef LOCAL_COMMAND_DETECT_H
+#define LOCAL_COMMAND_DETECT_H
+
+#include <esp_mn_iface.h>
+
+#include <atomic>
+#include <functional>
+#include <vector>
+
+/**
+ * @struct LocalCommand
+ * @brief 認識するフレーズと実行するMCPツールの対応
+ */
+struct LocalCommand {
+    const char* phrase_en;      /**< 英語モデル用のフレーズ */
+    const char* phrase_zh;      /**< 中国語モデル用のフレーズ（拼音） */
+    const char* tool;           /**< 実行するMCPツール名 */
+    const char* arguments;      /**< ツールの引数（JSON） */
+};
+
+/**
+ * @class LocalCommandDetect
+ * @brief MultiNetによるコマンド認識
+ *
+ * Feed()はAFEの出力コールバック（音声処理タスク）から呼ばれます。
+ * 認識は Start() から CONFIG_LOCAL_COMMAND_WINDOW_MS の間だけ行い、
+ * 認識またはタイムアウトで自動的に止まります。
+ */
+class LocalCommandDetect {
+public:
+    LocalCommandDetect();
+    ~LocalCommandDetect();
+
+    /**
+     * @brief モデルパーティションからMultiNetを読み込み、コマンドを登録
+     * @return MultiNetモデルが見つからない場合false（以降の呼び出しは何もしない）
+     */
+    bool Initialize();
+
+    /** @brief 認識を開始（ウェイクワード検出後の聞き取り開始時に呼ぶ） */
+    void Start();
+
+    /** @brief 認識を止める */
+    void Stop();
+
+    /** @brief 認識中かどうか */
+    bool IsRunning() const { return running_; }
+
+    /** @brief AFE処理済みの音声（16kHzモノラル）を渡す */
+    void Feed(const int16_t* data, size_t samples);
+
+    /** @brief コマンド認識時のコールバックを設定（音声処理タスクから呼ばれる） */
+    void OnCommandDetected(std::function<void(const LocalCommand& command)> callback);
+
+private:
+    esp_mn_iface_t* multinet_ = nullptr;
+    model_iface_data_t* model_data_ = nullptr;
+    size_t chunk_samples_ = 0;
+    std::vector<int16_t> chunk_;                /**< 1回の検出に渡す端数の蓄積（音声処理タスク専用） */
+    std::atomic<bool> running_{false};
+    std::atomic<bool> reset_{false};            /**< 次のFeed()でモデルの状態を初期化する */
+    std::function<void(const LocalCommand& command)> command_detected_callback_;
+};
+
+#endif // LOCAL_COMMAND_DETECT_H
@@ -0,0 +1,218 @@
+/**
+ * @file model_loader.cc
+ * @brief 音声モデルのパーティションの読み込みの実装
+ */
+#include "model_loader.h"
+
+#include <esp_heap_caps.h>
+#include <esp_log.h>
+#include <esp_partition.h>
+#include <esp_timer.h>
+#include <rom/miniz.h>
+
+#include <cstdlib>
+#include <cstring>
+
+#define TAG "ModelLoader"
+
+/** @brief srmodels.bin内の名前の長さ */
+#define MODEL_NAME_SIZE 32
+
+static uint32_t ReadLe32(const uint8_t* data) {
+    return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+/**
+ * @brief srmodels.binの構造を確認し、listがあればモデルの一覧を組み立てる
+ *
+ * 一覧の名前とデータはimageを直接指すので、imageは一覧より長く保持する。
+ */
+static bool ParseModelImage(const uint8_t* image, size_t size, srmodel_list_t* list) {
+    if (size < 4) {
+        return false;
+    }
+    uint32_t model_num = ReadLe32(image);
+    if (model_num == 0 || model_num > 64) {
+        ESP_LOGE(TAG, "Invalid model count %lu", model_num);
+        return false;
+    }
+    if (list != nullptr) {
+        list->num = model_num;
+        list->model_name = (char**)calloc(model_num, sizeof(char*));
+        list->model_data = (model_data_t**)calloc(model_num, sizeof(model_data_t*));
+        if (list->model_name == nullptr || list->model_data == nullptr) {
+            return false;
+        }
+    }
+
+    size_t offset = 4;
+    for (uint32_t i = 0; i < model_num; i++) {
+        if (offset + MODEL_NAME_SIZE + 4 > size) {
+            ESP_LOGE(TAG, "Model table is truncated");
+            return false;
+        }
+        const char* name = (const char*)image + offset;
+        uint32_t file_num = ReadLe32(image + offset + MODEL_NAME_SIZE);
+        offset += MODEL_NAME_SIZE + 4;
+        if (strnlen(name, MODEL_NAME_SIZE) == MODEL_NAME_SIZE || file_num == 0 ||
+            offset + file_num * (MODEL_NAME_SIZE + 8) > size) {
+            ESP_LOGE(TAG, "Invalid entry for model %lu", i);
+            return false;
+        }
+
+        model_data_t* data = nullptr;
+        if (list != nullptr) {
+            data = (model_data_t*)calloc(1, sizeof(model_data_t));
+            if (data == nullptr) {
+                return false;
+            }
+            list->model_name[i] = (char*)name;
+            list->model_data[i] = data;
+            data->num = file_num;
+            data->files = (char**)calloc(file_num, sizeof(char*));
+            data->data = (char**)calloc(file_num, sizeof(char*));
+            data->sizes = (int*)calloc(file_num, sizeof(int));
+            if (data->files == nullptr || data->data == nullptr || data->sizes == nullptr) {
+                return false;
+            }
+        }
+        for (uint32_t j = 0; j < file_num; j++) {
+            const uint8_t* entry = image + offset;
+            uint32_t start = ReadLe32(entry + MODEL_NAME_SIZE);
+            uint32_t length = ReadLe32(entry + MODEL_NAME_SIZE + 4);
+            offset += MODEL_NAME_SIZE + 8;
+            if (start > size || length > size - start) {
+                ESP_LOGE(TAG, "File %lu of %.32s is out of the image", j, name);
+                return false;
+            }
+            if (data != nullptr) {
+                data->files[j] = (char*)entry;
+                data->data[j] = (char*)image + start;
+                data->sizes[j] = length;
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief コンテナを展開する
+ * @return PSRAMに確保した展開後のsrmodels.bin（コンテナでないか失敗ならnullptr）
+ */
+static uint8_t* InflateModelPack(const esp_partition_t* partition, size_t* raw_size) {
+    uint8_t header[16];
+    if (esp_partition_read(partition, 0, header, sizeof(header)) != ESP_OK ||
+        memcmp(header, MODEL_PACK_MAGIC, 4) != 0) {
+        return nullptr;
+    }
+    uint32_t size = ReadLe32(header + 8);
+    uint32_t compressed_size = ReadLe32(header + 12);
+    if ((header[4] | (header[5] << 8)) != 1 || compressed_size > partition->size - sizeof(header)) {
+        ESP_LOGE(TAG, "Unsupported model pack in %s", partition->label);
+        return nullptr;
+    }
+
+    const void* mapped = nullptr;
+    esp_partition_mmap_handle_t mmap_handle;
+    if (esp_partition_mmap(partition, 0, sizeof(header) + compressed_size, ESP_PARTITION_MMAP_DATA,
+            &mapped, &mmap_handle) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to map %s", partition->label);
+        return nullptr;
+    }
+    // 各ファイルのデータはmmapした場合と同じく先頭からのオフセットで参照されるため、
+    // 演算ライブラリが前提とする16バイト境界に置く
+    auto image = (uint8_t*)heap_caps_aligned_alloc(16, size, MALLOC_CAP_SPIRAM);
+    auto inflator = (tinfl_decompressor*)heap_caps_malloc(sizeof(tinfl_decompressor), MALLOC_CAP_SPIRAM);
+    bool ok = false;
+    if (image != nullptr && inflator != nullptr) {
+        int64_t start = esp_timer_get_time();
+        tinfl_init(inflator);
+        size_t in_bytes = compressed_size;
+        size_t out_bytes = size;
+        auto status = tinfl_decompress(inflator, (const uint8_t*)mapped + sizeof(header), &in_bytes, image, image,
+            &out_bytes, TINFL_FLAG_PARSE_ZLIB_HEADER | TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF);
+        ok = status == TINFL_STATUS_DONE && out_bytes == size;
+        if (ok) {
+            ESP_LOGI(TAG, "Inflated %s: %lu -> %lu bytes in %lld ms", partition->label, compressed_size, size,
+                (esp_timer_get_time() - start) / 1000);
+        } else {
+            ESP_LOGE(TAG, "Failed to inflate %s: %d", partition->label, status);
+        }
+    } else {
+        ESP_LOGE(TAG, "Failed to allocate %lu bytes for models", size);
+    }
+    heap_caps_free(inflator);
+    esp_partition_munmap(mmap_handle);
+    if (!ok) {
+        heap_caps_free(image);
+        return nullptr;
+    }
+    *raw_size = size;
+    return image;
+}
+
+static const esp_partition_t* FindModelPartition(const char* partition_label) {
+    auto partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_SPIFFS, partition_label);
+    if (partition == nullptr) {
+        ESP_LOGE(TAG, "No model partition %s", partition_label);
+    }
+    return partition;
+}
+
+static bool IsModelPack(const esp_partition_t* partition) {
+    char magic[4];
+    return esp_partition_read(partition, 0, magic, sizeof(magic)) == ESP_OK &&
+        memcmp(magic, MODEL_PACK_MAGIC, 4) == 0;
+}
+
+srmodel_list_t* LoadSpeechModels(const char* partition_label) {
+    auto partition = FindModelPartition(partition_label);
+    if (partition == nullptr) {
+        return nullptr;
+    }
+    if (!IsModelPack(partition)) {
+        return esp_srmodel_init(partition_label);
+    }
+
+    size_t size = 0;
+    uint8_t* image = InflateModelPack(partition, &size);
+    if (image == nullptr) {
+        return nullptr;
+    }
+    // 途中で失敗した場合の一覧の断片は、起動時に一度きりなので解放しない
+    auto list = (srmodel_list_t*)calloc(1, sizeof(srmodel_list_t));
+    if (list == nullptr || !ParseModelImage(image, size, list)) {
+        ESP_LOGE(TAG, "Invalid model image in %s", partition_label);
+        heap_caps_free(image);
+        return nullptr;
+    }
+    list->partition_label = (char*)partition->label;
+    for (int i = 0; i < list->num; i++) {
+        ESP_LOGI(TAG, "Model %d: %s", i, list->model_name[i]);
+    }
+    return list;
+}
+
+bool VerifySpeechModels(const char* partition_label) {
+    auto partition = FindModelPartition(partition_label);
+    if (partition == nullptr) {
+        return false;
+    }
+    if (IsModelPack(partition)) {
+        size_t size = 0;
+        uint8_t* image = InflateModelPack(partition, &size);
+        bool ok = image != nullptr && ParseModelImage(image, size, nullptr);
+        heap_caps_free(image);
+        return ok;
+    }
+
+    const void* mapped = nullptr;
+    esp_partition_mmap_handle_t mmap_handle;
+    if (esp_partition_mmap(partition, 0, partition->size, ESP_PARTITION_MMAP_DATA, &mapped, &mmap_handle) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to map %s", partition_label);
+        return false;
+    }
+    bool ok = ParseModelImage((const uint8_t*)mapped, partition->size, nullptr);
+    esp_partition_munmap(mmap_handle);
+    return ok;
+}
@@ -0,0 +1,44 @@
+/**
+ * @file model_loader.h
+ * @brief 音声モデルのパーティションの読み込み（圧縮コンテナ対応）
+ *
+ * モデルのパーティションには、esp-srのビルドが作るsrmodels.bin（非圧縮）か、
+ * scripts/gen_model_pack.py でそれをzlib圧縮したコンテナのどちらかを書き込みます。
+ * コンテナは起動時にPSRAMへ一度だけ展開し、srmodels.binをmmapした場合と同じ
+ * srmodel_list_tを組み立てます。圧縮で空いたパーティションの容量を、より大きな
+ * モデルや複数の組み合わせに使えます。
+ *
+ * コンテナの形式（リトルエンディアン）:
+ *   ヘッダ（16バイト）: "XZMC" | uint16 version(=1) | uint16 予約 | uint32 展開後サイズ | uint32 圧縮サイズ
+ *   本体: srmodels.binのzlibストリーム
+ *
+ * srmodels.binの形式（esp-srのpack_model.py）:
+ *   uint32 model_num、モデルごとに name[32] | uint32 file_num、
+ *   ファイルごとに file_name[32] | uint32 start（先頭から） | uint32 size、その後にデータ
+ */
+#ifndef MODEL_LOADER_H
+#define MODEL_LOADER_H
+
+#include <model_path.h>
+
+/** @brief コンテナの先頭の識別子 */
+#define MODEL_PACK_MAGIC "XZMC"
+
+/**
+ * @brief パーティションからモデルを読み込む
+ *
+ * コンテナならPSRAMへ展開し、そうでなければesp_srmodel_init()に任せます。
+ * 展開したモデルは解放しません（起動中ずっと使う前提）。
+ * @return 読み込めなければnullptr
+ */
+srmodel_list_t* LoadSpeechModels(const char* partition_label);
+
+/**
+ * @brief パーティションの内容がモデルとして読み込める形式か確認
+ *
+ * OTAで書き込んだパーティションを切り替える前の確認に使います。コンテナは展開して
+ * 中身まで確認し、読み込み中のモデルの状態には触れません。
+ */
+bool VerifySpeechModels(const char* partition_label);
+
+#endif // MODEL_LOADER_H
@@ -0,0 +1,61 @@
+#include "opus_frame_encoder.h"
+#include "opus_memory.h"
+#include "trace_recorder.h"
+
+#include <esp_log.h>
+
+#define TAG "OpusFrameEncoder"
+
+OpusFrameEncoder::OpusFrameEncoder(int sample_rate, int channels, int duration_ms)
+    : frame_samples_(sample_rate / 1000 * channels * duration_ms), channels_(channels) {
+    int error = 0;
+    encoder_ = opus_memory::CreateEncoder(sample_rate, channels, OPUS_APPLICATION_VOIP, &error);
+    if (encoder_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to create audio encoder, error code: %d", error);
+        return;
+    }
+    SetDtx(true);
+    SetComplexity(5);
+}
+
+OpusFrameEncoder::~OpusFrameEncoder() {
+    if (encoder_ != nullptr) {
+        opus_encoder_destroy(encoder_);
+    }
+}
+
+void OpusFrameEncoder::SetComplexity(int complexity) {
+    if (encoder_ != nullptr) {
+        opus_encoder_ctl(encoder_, OPUS_SET_COMPLEXITY(complexity));
+    }
+}
+
+void OpusFrameEncoder::SetDtx(bool enable) {
+    if (encoder_ != nullptr) {
+        opus_encoder_ctl(encoder_, OPUS_SET_DTX(enable ? 1 : 0));
+    }
+}
+
+void OpusFrameEncoder::SetBitrate(int bitrate) {
+    if (encoder_ != nullptr) {
+        opus_encoder_ctl(encoder_, OPUS_SET_BITRATE(bitrate > 0 ? bitrate : OPUS_AUTO));
+    }
+}
+
+void OpusFrameEncoder::ResetState() {
+    if (encoder_ != nullptr) {
+        opus_encoder_ctl(encoder_, OPUS_RESET_STATE);
+    }
+}
+
+int OpusFrameEncoder::Encode(const int16_t* pcm, uint8_t* packet, size_t capacity) {
+    if (encoder_ == nullptr) {
+        return OPUS_INVALID_STATE;
+    }
+    TRACE_SPAN("opus_encode");
+    int ret = opus_encode(encoder_, pcm, frame_samples_ / channels_, packet, capacity);
+    if (ret < 0) {
+        ESP_LOGE(TAG, "Failed to encode audio, error code: %d", ret);
+    }
+    return ret;
+}
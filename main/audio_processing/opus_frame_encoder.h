@@ -0,0 +1,56 @@
+/**
+ * @file opus_frame_encoder.h
+ * @brief 呼び出し側のバッファを直接読み書きする上り用Opusエンコーダ
+ *
+ * OpusEncoderWrapperのEncode()は入力vectorの所有権を取り、出力パケットもvectorで返すため、
+ * フレームごとに確保とコピーが発生します。このクラスは1フレーム分のPCMを借りて
+ * 呼び出し側のパケットバッファへ直接エンコードします。
+ */
+#ifndef OPUS_FRAME_ENCODER_H
+#define OPUS_FRAME_ENCODER_H
+
+#include <opus.h>
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @class OpusFrameEncoder
+ * @brief libopusエンコーダの薄いラッパー
+ *
+ * 既定値はOpusEncoderWrapperと同じ（VOIP、DTX有効、complexity 5）です。
+ * スレッドセーフではないため、操作は単一のタスク（エンコードグループ）から行ってください。
+ */
+class OpusFrameEncoder {
+public:
+    OpusFrameEncoder(int sample_rate, int channels, int duration_ms);
+    ~OpusFrameEncoder();
+
+    OpusFrameEncoder(const OpusFrameEncoder&) = delete;
+    OpusFrameEncoder& operator=(const OpusFrameEncoder&) = delete;
+
+    void SetComplexity(int complexity);
+    void SetDtx(bool enable);
+    /** @brief ビットレート（bps、0はOpusの自動設定） */
+    void SetBitrate(int bitrate);
+    void ResetState();
+
+    /** @brief 1フレームのサンプル数（全チャンネル分） */
+    size_t frame_samples() const { return frame_samples_; }
+
+    /**
+     * @brief 1フレームをエンコード
+     * @param pcm frame_samples()個のサンプル
+     * @param packet 出力先
+     * @param capacity 出力先の容量（バイト）
+     * @return パケット長。失敗時は負のOpusエラーコード
+     */
+    int Encode(const int16_t* pcm, uint8_t* packet, size_t capacity);
+
+private:
+    OpusEncoder* encoder_ = nullptr;
+    size_t frame_samples_ = 0;
+    int channels_ = 1;
+};
+
+#endif // OPUS_FRAME_ENCODER_H
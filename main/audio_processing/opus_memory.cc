@@ -0,0 +1,123 @@
+/**
+ * @file opus_memory.cc
+ * @brief Opusの状態の配置先を指定した確保の実装
+ */
+#include "opus_memory.h"
+
+#include <cstdlib>
+#include <esp_heap_caps.h>
+#include <esp_log.h>
+
+#define TAG "OpusMemory"
+
+namespace opus_memory {
+
+namespace {
+
+/** @brief 配置先から確保し、できなければ既定のヒープへ戻す */
+void* Allocate(size_t size, OpusMemoryPlacement placement, const char* what) {
+    void* memory = nullptr;
+    switch (placement) {
+    case kOpusMemoryInternal:
+        memory = heap_caps_malloc(size, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+        break;
+    case kOpusMemoryPsram:
+        memory = heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        break;
+    default:
+        return malloc(size);
+    }
+    if (memory == nullptr) {
+        ESP_LOGW(TAG, "%s state (%u bytes) unavailable in %s, using default heap", what, size,
+            GetPlacementName(placement));
+        memory = malloc(size);
+    }
+    return memory;
+}
+
+} // namespace
+
+OpusMemoryPlacement GetEncoderPlacement() {
+#if CONFIG_OPUS_ENCODER_STATE_INTERNAL
+    return kOpusMemoryInternal;
+#elif CONFIG_OPUS_ENCODER_STATE_PSRAM
+    return kOpusMemoryPsram;
+#else
+    return kOpusMemoryDefault;
+#endif
+}
+
+OpusMemoryPlacement GetDecoderPlacement() {
+#if CONFIG_OPUS_DECODER_STATE_INTERNAL
+    return kOpusMemoryInternal;
+#elif CONFIG_OPUS_DECODER_STATE_PSRAM
+    return kOpusMemoryPsram;
+#else
+    return kOpusMemoryDefault;
+#endif
+}
+
+const char* GetPlacementName(OpusMemoryPlacement placement) {
+    switch (placement) {
+    case kOpusMemoryInternal:
+        return "internal";
+    case kOpusMemoryPsram:
+        return "psram";
+    default:
+        return "default";
+    }
+}
+
+OpusEncoder* CreateEncoder(int sample_rate, int channels, int application, OpusMemoryPlacement placement, int* error) {
+    int size = opus_encoder_get_size(channels);
+    if (size <= 0) {
+        if (error != nullptr) {
+            *error = OPUS_BAD_ARG;
+        }
+        return nullptr;
+    }
+    auto encoder = (OpusEncoder*)Allocate(size, placement, "Encoder");
+    if (encoder == nullptr) {
+        if (error != nullptr) {
+            *error = OPUS_ALLOC_FAIL;
+        }
+        return nullptr;
+    }
+    int ret = opus_encoder_init(encoder, sample_rate, channels, application);
+    if (error != nullptr) {
+        *error = ret;
+    }
+    if (ret != OPUS_OK) {
+        free(encoder);
+        return nullptr;
+    }
+    return encoder;
+}
+
+OpusDecoder* CreateDecoder(int sample_rate, int channels, OpusMemoryPlacement placement, int* error) {
+    int size = opus_decoder_get_size(channels);
+    if (size <= 0) {
+        if (error != nullptr) {
+            *error = OPUS_BAD_ARG;
+        }
+        return nullptr;
+    }
+    auto decoder = (OpusDecoder*)Allocate(size, placement, "Decoder");
+    if (decoder == nullptr) {
+        if (error != nullptr) {
+            *error = OPUS_ALLOC_FAIL;
+        }
+        return nullptr;
+    }
+    int ret = opus_decoder_init(decoder, sample_rate, channels);
+    if (error != nullptr) {
+        *error = ret;
+    }
+    if (ret != OPUS_OK) {
+        free(decoder);
+        return nullptr;
+    }
+    return decoder;
+}
+
+} // namespace opus_memory
@@ -0,0 +1,57 @@
+/**
+ * @file opus_memory.h
+ * @brief Opusエンコーダ/デコーダの状態を置くメモリの選択
+ *
+ * opus_encoder_create()/opus_decoder_create()は既定のヒープ（malloc）から状態を確保するため、
+ * CONFIG_SPIRAM_MALLOC_ALWAYSINTERNALより大きい状態はPSRAMに置かれます。ここでは
+ * opus_*_get_size()で大きさを求めて配置先を指定して確保し、opus_*_init()で初期化します。
+ * 破棄は従来どおりopus_encoder_destroy()/opus_decoder_destroy()で行えます（freeは確保元を問わない）。
+ *
+ * libopusの作業領域（疑似スタック）は呼び出したタスクのスタックに取られるため、
+ * 作業領域の配置はエンコード・デコードを行うタスクのスタック配置（task_factory）で決まります。
+ */
+#ifndef OPUS_MEMORY_H
+#define OPUS_MEMORY_H
+
+#include <opus.h>
+
+/** @brief 状態の配置先 */
+enum OpusMemoryPlacement {
+    kOpusMemoryDefault,         /**< 既定のヒープ（大きさに応じて内部SRAMかPSRAM） */
+    kOpusMemoryInternal,        /**< 内部SRAM（足りなければ既定のヒープ） */
+    kOpusMemoryPsram,           /**< PSRAM（なければ既定のヒープ） */
+};
+
+namespace opus_memory {
+
+/** @brief Kconfigで選んだエンコーダの状態の配置先 */
+OpusMemoryPlacement GetEncoderPlacement();
+
+/** @brief Kconfigで選んだデコーダの状態の配置先 */
+OpusMemoryPlacement GetDecoderPlacement();
+
+/** @brief 配置先の名前（ログ・ベンチマーク用） */
+const char* GetPlacementName(OpusMemoryPlacement placement);
+
+/**
+ * @brief 配置先を指定してエンコーダを作成
+ * @param error 失敗時のOpusエラーコード（nullptr可）
+ */
+OpusEncoder* CreateEncoder(int sample_rate, int channels, int application, OpusMemoryPlacement placement, int* error);
+
+/** @brief Kconfigの配置先でエンコーダを作成 */
+inline OpusEncoder* CreateEncoder(int sample_rate, int channels, int application, int* error) {
+    return CreateEncoder(sample_rate, channels, application, GetEncoderPlacement(), error);
+}
+
+/** @brief 配置先を指定してデコーダを作成 */
+OpusDecoder* CreateDecoder(int sample_rate, int channels, OpusMemoryPlacement placement, int* error);
+
+/** @brief Kconfigの配置先でデコーダを作成 */
+inline OpusDecoder* CreateDecoder(int sample_rate, int channels, int* error) {
+    return CreateDecoder(sample_rate, channels, GetDecoderPlacement(), error);
+}
+
+} // namespace opus_memory
+
+#endif // OPUS_MEMORY_H
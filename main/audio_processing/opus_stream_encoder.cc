@@ -0,0 +1,126 @@
+#include "opus_stream_encoder.h"
+
+#include <esp_heap_caps.h>
+#include <esp_log.h>
+
+#include <algorithm>
+#include <cstring>
+
+#define TAG "OpusStreamEncoder"
+
+static_assert((OPUS_STREAM_RING_SAMPLES & (OPUS_STREAM_RING_SAMPLES - 1)) == 0,
+    "OPUS_STREAM_RING_SAMPLES must be a power of two");
+
+OpusStreamEncoder::~OpusStreamEncoder() {
+    heap_caps_free(ring_);
+}
+
+bool OpusStreamEncoder::Initialize(int duration_ms) {
+    if (ring_ == nullptr) {
+        size_t bytes = OPUS_STREAM_RING_SAMPLES * sizeof(int16_t);
+        ring_ = (int16_t*)heap_caps_malloc(bytes, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        if (ring_ == nullptr) {
+            ring_ = (int16_t*)heap_caps_malloc(bytes, MALLOC_CAP_8BIT);
+        }
+        if (ring_ == nullptr) {
+            ESP_LOGE(TAG, "Failed to allocate %u bytes for the PCM ring", bytes);
+            return false;
+        }
+    }
+    SetFrameDuration(duration_ms);
+    return true;
+}
+
+bool OpusStreamEncoder::Accumulate(const int16_t*& data, size_t& samples, size_t frame_samples, PcmFrameRef& frame) {
+    if (ring_ == nullptr || frame_samples == 0 || frame_samples > OPUS_STREAM_RING_SAMPLES) {
+        samples = 0;
+        return false;
+    }
+    if (fill_ > 0 && frame_samples != frame_samples_) {
+        fill_ = 0;
+    }
+    if (fill_ == 0) {
+        // 新しいフレームの位置を決める。末尾をまたぐ場合は先頭へ回り込む
+        uint32_t start = frame_start_;
+        uint32_t offset = start % OPUS_STREAM_RING_SAMPLES;
+        if (offset + frame_samples > OPUS_STREAM_RING_SAMPLES) {
+            start += OPUS_STREAM_RING_SAMPLES - offset;
+        }
+        uint32_t read = read_position_.load(std::memory_order_acquire);
+        if (start + frame_samples - read > OPUS_STREAM_RING_SAMPLES) {
+            // エンコードが追いついていない。古いフレームは消費者が読んでいるので新しい音声を捨てる
+            overrun_count_.fetch_add(1, std::memory_order_relaxed);
+            samples = 0;
+            return false;
+        }
+        frame_start_ = start;
+        frame_samples_ = frame_samples;
+    }
+
+    size_t count = std::min(samples, frame_samples_ - fill_);
+    memcpy(ring_ + (frame_start_ + fill_) % OPUS_STREAM_RING_SAMPLES, data, count * sizeof(int16_t));
+    fill_ += count;
+    data += count;
+    samples -= count;
+    if (fill_ < frame_samples_) {
+        return false;
+    }
+
+    frame.position = frame_start_;
+    frame.samples = frame_samples_;
+    frame_start_ += frame_samples_;
+    fill_ = 0;
+    return true;
+}
+
+void OpusStreamEncoder::SetFrameDuration(int duration_ms) {
+    encoder_ = std::make_unique<OpusFrameEncoder>(16000, 1, duration_ms);
+    encoder_->SetComplexity(complexity_);
+    encoder_->SetDtx(dtx_);
+    encoder_->SetBitrate(bitrate_);
+}
+
+void OpusStreamEncoder::SetComplexity(int complexity) {
+    complexity_ = complexity;
+    if (encoder_ != nullptr) {
+        encoder_->SetComplexity(complexity);
+    }
+}
+
+void OpusStreamEncoder::SetDtx(bool enable) {
+    dtx_ = enable;
+    if (encoder_ != nullptr) {
+        encoder_->SetDtx(enable);
+    }
+}
+
+void OpusStreamEncoder::SetBitrate(int bitrate) {
+    bitrate_ = bitrate;
+    if (encoder_ != nullptr) {
+        encoder_->SetBitrate(bitrate);
+    }
+}
+
+void OpusStreamEncoder::ResetState() {
+    if (encoder_ != nullptr) {
+        encoder_->ResetState();
+    }
+}
+
+int OpusStreamEncoder::Encode(const PcmFrameRef& frame, OpusPacketBuffer& packet) {
+    int size = -1;
+    if (encoder_ != nullptr && frame.samples == encoder_->frame_samples()) {
+        packet.resize(OPUS_PACKET_MAX_SIZE);
+        if (packet.size() == OPUS_PACKET_MAX_SIZE) {
+            // リング上のフレームをその場で読み、プールのバッファへ直接書き込む
+            size = encoder_->Encode(ring_ + frame.position % OPUS_STREAM_RING_SAMPLES, packet.data(), packet.size());
+        }
+        packet.resize(std::max(size, 0));
+    }
+    Skip(frame);
+    return size;
+}
+
+void OpusStreamEncoder::Skip(const PcmFrameRef& frame) {
+    read_position_.store(frame.position + frame.samples, std::memory_order_release);
+}
@@ -0,0 +1,108 @@
+/**
+ * @file opus_stream_encoder.h
+ * @brief 任意長のPCMチャンクをOpusフレームへまとめる上り用ストリームエンコーダ
+ *
+ * AFEの出力チャンク（16kHzで512サンプル = 32ms）は60msなどのOpusフレーム長と一致しません。
+ * このクラスはチャンクを固定サイズのリングへ追記し、1フレームそろうごとに
+ * その位置（PcmFrameRef）を返します。エンコードはリング上のフレームをその場で読み、
+ * パケットプールのバッファへ直接書き込むため、チャンクごとのvectorの確保やムーブが発生しません。
+ */
+#ifndef OPUS_STREAM_ENCODER_H
+#define OPUS_STREAM_ENCODER_H
+
+#include "opus_frame_encoder.h"
+#include "opus_packet_pool.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+/**
+ * @brief リングの容量（サンプル数、16kHzで512ms）
+ *
+ * 絶対位置の剰余がラップアラウンドをまたいでも連続するよう2のべき乗にします。
+ */
+#define OPUS_STREAM_RING_SAMPLES 8192
+
+/** @brief リング上の1フレームの位置 */
+struct PcmFrameRef {
+    uint32_t position;  /**< 先頭の絶対位置（サンプル） */
+    uint32_t samples;   /**< サンプル数 */
+};
+
+/**
+ * @class OpusStreamEncoder
+ * @brief 単一生産者・単一消費者のPCMリングとOpusエンコーダ
+ *
+ * Accumulate()とDiscardPartial()は生産者（音声処理の出力コールバック）だけが、
+ * それ以外は消費者（エンコードグループ）だけが呼び出します。
+ * フレームは投入順にEncode()またはSkip()で解放してください。
+ * フレームはリング末尾をまたがないよう配置するため、いつでも連続した領域として読めます。
+ */
+class OpusStreamEncoder {
+public:
+    OpusStreamEncoder() = default;
+    ~OpusStreamEncoder();
+
+    OpusStreamEncoder(const OpusStreamEncoder&) = delete;
+    OpusStreamEncoder& operator=(const OpusStreamEncoder&) = delete;
+
+    /** @brief リングを確保し、16kHzモノラルのエンコーダを作成 */
+    bool Initialize(int duration_ms);
+
+    // --- 生産者 ---
+
+    /**
+     * @brief PCMをリングへ追記
+     * @param data 追記するサンプル（追記した分だけ進める）
+     * @param samples 残りのサンプル数（追記した分だけ減らす）
+     * @param frame_samples 現在のフレーム長。途中のフレームと異なる場合はそれを捨てる
+     * @param frame フレームがそろった場合の位置
+     * @return フレームがそろった場合true。呼び出し側はsamplesが0になるまで繰り返す
+     * @note リングに空きがない場合は残りのサンプルを捨ててfalseを返す
+     */
+    bool Accumulate(const int16_t*& data, size_t& samples, size_t frame_samples, PcmFrameRef& frame);
+
+    /** @brief ため途中のフレームを捨てる（ストリームの切り替え時） */
+    void DiscardPartial() { fill_ = 0; }
+
+    /** @brief リングに空きがなく捨てたチャンク数 */
+    uint32_t overrun_count() const { return overrun_count_.load(std::memory_order_relaxed); }
+
+    // --- 消費者 ---
+
+    /** @brief フレーム長を変更（エンコーダを作り直す） */
+    void SetFrameDuration(int duration_ms);
+    void SetComplexity(int complexity);
+    void SetDtx(bool enable);
+    /** @brief ビットレート（bps、0はOpusの自動設定） */
+    void SetBitrate(int bitrate);
+    void ResetState();
+
+    /**
+     * @brief フレームをエンコードしてpacketへ書き込み、リングから解放
+     * @return パケット長。フレーム長が現在のエンコーダと異なる場合や失敗時は0以下
+     */
+    int Encode(const PcmFrameRef& frame, OpusPacketBuffer& packet);
+
+    /** @brief エンコードせずにリングから解放 */
+    void Skip(const PcmFrameRef& frame);
+
+private:
+    std::unique_ptr<OpusFrameEncoder> encoder_;
+    int complexity_ = 5;
+    bool dtx_ = true;
+    int bitrate_ = 0;
+
+    int16_t* ring_ = nullptr;
+    // 生産者側
+    uint32_t frame_start_ = 0;      /**< ため途中のフレームの先頭位置 */
+    size_t fill_ = 0;               /**< ため途中のフレームのサンプル数 */
+    size_t frame_samples_ = 0;      /**< ため途中のフレームの長さ */
+    std::atomic<uint32_t> overrun_count_{0};
+    // 消費者側（解放済みの位置）
+    std::atomic<uint32_t> read_position_{0};
+};
+
+#endif // OPUS_STREAM_ENCODER_H
@@ -0,0 +1,323 @@
+/**
+ * @file polyphase_resampler.cc
+ * @brief 固定小数点ポリフェーズリサンプラーの実装
+ */
+#include "polyphase_resampler.h"
+#include "resampler_filters.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+#include <esp_cpu.h>
+#include <esp_log.h>
+#include <opus_resampler.h>
+
+#define TAG "PolyphaseResampler"
+
+/** @brief 実行時設計時の1フェーズあたりのタップ数 */
+#define RESAMPLER_DESIGN_TAPS_PER_PHASE 24
+
+namespace {
+
+struct FilterTable {
+    int input_sample_rate;
+    int output_sample_rate;
+    int up;
+    int down;
+    int taps;
+    const int16_t* coeffs;
+};
+
+const FilterTable kFilterTables[] = {
+    {24000, 16000, resampler_filters::k24kTo16kUp, resampler_filters::k24kTo16kDown,
+        resampler_filters::k24kTo16kTaps, resampler_filters::k24kTo16k},
+    {16000, 24000, resampler_filters::k16kTo24kUp, resampler_filters::k16kTo24kDown,
+        resampler_filters::k16kTo24kTaps, resampler_filters::k16kTo24k},
+    {48000, 24000, resampler_filters::k48kTo24kUp, resampler_filters::k48kTo24kDown,
+        resampler_filters::k48kTo24kTaps, resampler_filters::k48kTo24k},
+};
+
+inline int16_t Saturate(int32_t value) {
+    if (value > INT16_MAX) {
+        return INT16_MAX;
+    }
+    if (value < INT16_MIN) {
+        return INT16_MIN;
+    }
+    return (int16_t)value;
+}
+
+} // namespace
+
+bool PolyphaseResampler::Configure(int input_sample_rate, int output_sample_rate) {
+    if (input_sample_rate <= 0 || output_sample_rate <= 0) {
+        ESP_LOGE(TAG, "Invalid sample rates %d -> %d", input_sample_rate, output_sample_rate);
+        return false;
+    }
+    input_sample_rate_ = input_sample_rate;
+    output_sample_rate_ = output_sample_rate;
+
+    precomputed_ = false;
+    for (auto& table : kFilterTables) {
+        if (table.input_sample_rate == input_sample_rate && table.output_sample_rate == output_sample_rate) {
+            up_ = table.up;
+            down_ = table.down;
+            taps_ = table.taps;
+            coeffs_ = table.coeffs;
+            designed_.clear();
+            precomputed_ = true;
+            break;
+        }
+    }
+
+    if (precomputed_) {
+        switch (taps_) {
+        case 24:
+            process_ = &ProcessFixed<24>;
+            break;
+        case 32:
+            process_ = &ProcessFixed<32>;
+            break;
+        case 48:
+            process_ = &ProcessFixed<48>;
+            break;
+        default:
+            process_ = &ProcessGeneric;
+            break;
+        }
+    } else {
+        int g = std::gcd(input_sample_rate, output_sample_rate);
+        up_ = output_sample_rate / g;
+        down_ = input_sample_rate / g;
+        Design(RESAMPLER_DESIGN_TAPS_PER_PHASE);
+        process_ = &ProcessGeneric;
+        ESP_LOGI(TAG, "Designed filter for %d -> %d (L=%d, M=%d)", input_sample_rate, output_sample_rate, up_, down_);
+    }
+
+    Reset();
+    return true;
+}
+
+void PolyphaseResampler::Design(int taps_per_phase) {
+    // 生成スクリプトと同じBlackman窓付きsinc。カットオフは低い方のナイキストの85%
+    taps_ = taps_per_phase;
+    const int taps = taps_per_phase * up_;
+    const float up_rate = (float)input_sample_rate_ * up_;
+    const float cutoff = 0.85f * std::min(input_sample_rate_, output_sample_rate_) / 2.0f / up_rate;
+    const float center = (taps - 1) / 2.0f;
+    designed_.assign(taps, 0);
+    for (int n = 0; n < taps; ++n) {
+        float x = n - center;
+        float sinc = x == 0.0f ? 2.0f * cutoff : sinf(2.0f * (float)M_PI * cutoff * x) / ((float)M_PI * x);
+        float w = 0.42f - 0.5f * cosf(2.0f * (float)M_PI * n / (taps - 1)) + 0.08f * cosf(4.0f * (float)M_PI * n / (taps - 1));
+        int p = n % up_;
+        int j = n / up_;
+        designed_[p * taps_per_phase + taps_per_phase - 1 - j] = Saturate((int32_t)lroundf(up_ * sinc * w * 32768.0f));
+    }
+    coeffs_ = designed_.data();
+}
+
+void PolyphaseResampler::Reset() {
+    buffer_.assign(taps_ - 1, 0);
+    index_ = taps_ - 1;
+    phase_ = 0;
+}
+
+size_t PolyphaseResampler::GetOutputSamples(size_t input_samples) const {
+    size_t available = buffer_.size() + input_samples;
+    if (available <= index_) {
+        return 0;
+    }
+    // 出力k回目の入力位置は index_ + floor((phase_ + k*M) / L) で、available未満の間出力できる
+    size_t span = (available - index_) * up_ - phase_;
+    return (span + down_ - 1) / down_;
+}
+
+size_t PolyphaseResampler::Process(const int16_t* input, size_t samples, int16_t* output) {
+    if (process_ == nullptr) {
+        return 0;
+    }
+    memcpy(BeginInput(samples), input, samples * sizeof(int16_t));
+    return EndInput(samples, output);
+}
+
+int16_t* PolyphaseResampler::BeginInput(size_t max_samples) {
+    input_base_ = buffer_.size();
+    buffer_.resize(input_base_ + max_samples);
+    return buffer_.data() + input_base_;
+}
+
+size_t PolyphaseResampler::EndInput(size_t samples, int16_t* output) {
+    buffer_.resize(input_base_ + samples);
+    if (process_ == nullptr || samples == 0) {
+        return 0;
+    }
+
+    size_t produced = process_(*this, output);
+
+    // 次の出力に必要な履歴だけを残す
+    size_t size = buffer_.size();
+    size_t drop = std::min(index_ - (taps_ - 1), size);
+    memmove(buffer_.data(), buffer_.data() + drop, (size - drop) * sizeof(int16_t));
+    buffer_.resize(size - drop);
+    index_ -= drop;
+    return produced;
+}
+
+template <int K>
+size_t PolyphaseResampler::ProcessFixed(PolyphaseResampler& self, int16_t* output) {
+    const int16_t* buffer = self.buffer_.data();
+    const size_t size = self.buffer_.size();
+    const int up = self.up_;
+    const int down = self.down_;
+    size_t index = self.index_;
+    int phase = self.phase_;
+    size_t produced = 0;
+    while (index < size) {
+        const int16_t* x = buffer + index - (K - 1);
+        const int16_t* c = self.coeffs_ + phase * K;
+        int32_t acc = 1 << 14;
+        for (int i = 0; i < K; ++i) {
+            acc += (int32_t)x[i] * c[i];
+        }
+        output[produced++] = Saturate(acc >> 15);
+        phase += down;
+        index += phase / up;
+        phase %= up;
+    }
+    self.index_ = index;
+    self.phase_ = phase;
+    return produced;
+}
+
+size_t PolyphaseResampler::ProcessGeneric(PolyphaseResampler& self, int16_t* output) {
+    const int16_t* buffer = self.buffer_.data();
+    const size_t size = self.buffer_.size();
+    const int taps = self.taps_;
+    size_t produced = 0;
+    while (self.index_ < size) {
+        const int16_t* x = buffer + self.index_ - (taps - 1);
+        const int16_t* c = self.coeffs_ + self.phase_ * taps;
+        int32_t acc = 1 << 14;
+        for (int i = 0; i < taps; ++i) {
+            acc += (int32_t)x[i] * c[i];
+        }
+        output[produced++] = Saturate(acc >> 15);
+        self.phase_ += self.down_;
+        self.index_ += self.phase_ / self.up_;
+        self.phase_ %= self.up_;
+    }
+    return produced;
+}
+
+// ---------------------------------------------------------------------------
+// ベンチマーク
+// ---------------------------------------------------------------------------
+
+namespace {
+
+/**
+ * @brief 正弦波への最小二乗フィットで信号対雑音比を求める（位相・遅延に依存しない）
+ */
+float MeasureSnr(const int16_t* samples, size_t count, float frequency, int sample_rate) {
+    double ss = 0, sc = 0, cc = 0, ys = 0, yc = 0, yy = 0;
+    for (size_t i = 0; i < count; ++i) {
+        double t = 2.0 * M_PI * frequency * i / sample_rate;
+        double s = sin(t);
+        double c = cos(t);
+        double y = samples[i];
+        ss += s * s;
+        sc += s * c;
+        cc += c * c;
+        ys += y * s;
+        yc += y * c;
+        yy += y * y;
+    }
+    double det = ss * cc - sc * sc;
+    double a = (ys * cc - yc * sc) / det;
+    double b = (yc * ss - ys * sc) / det;
+    double signal = a * ys + b * yc;
+    double noise = yy - signal;
+    if (noise <= 0) {
+        return 120.0f;
+    }
+    return (float)(10.0 * log10(signal / noise));
+}
+
+struct BenchmarkResult {
+    uint32_t cycles;    /**< 1ブロックあたりの平均サイクル */
+    float snr_low;      /**< 1kHzでのSNR（dB） */
+    float snr_high;     /**< 帯域上端付近でのSNR（dB） */
+};
+
+template <typename Resampler, typename ProcessFn>
+BenchmarkResult RunCase(Resampler& resampler, ProcessFn process, int input_rate, int output_rate) {
+    const int block_ms = 60;
+    const int blocks = 20;
+    const int warmup_blocks = 2;
+    const size_t input_block = input_rate * block_ms / 1000;
+    const size_t output_block = output_rate * block_ms / 1000;
+    const float high_frequency = 0.4f * std::min(input_rate, output_rate);
+    std::vector<int16_t> input(input_block);
+    std::vector<int16_t> output(output_block * 2);
+    std::vector<int16_t> captured;
+    captured.reserve(output_block * blocks);
+
+    BenchmarkResult result = {};
+    for (float frequency : {1000.0f, high_frequency}) {
+        captured.clear();
+        uint32_t cycles = 0;
+        for (int blk = 0; blk < blocks; ++blk) {
+            for (size_t i = 0; i < input_block; ++i) {
+                double t = 2.0 * M_PI * frequency * (blk * input_block + i) / input_rate;
+                input[i] = (int16_t)(16000.0 * sin(t));
+            }
+            uint32_t start = esp_cpu_get_cycle_count();
+            size_t produced = process(resampler, input.data(), input_block, output.data());
+            cycles += esp_cpu_get_cycle_count() - start;
+            if (blk >= warmup_blocks) {
+                captured.insert(captured.end(), output.begin(), output.begin() + produced);
+            }
+        }
+        float snr = MeasureSnr(captured.data(), captured.size(), frequency, output_rate);
+        if (frequency == 1000.0f) {
+            result.snr_low = snr;
+            result.cycles = cycles / blocks;
+        } else {
+            result.snr_high = snr;
+        }
+    }
+    return result;
+}
+
+} // namespace
+
+void PolyphaseResampler::RunBenchmark() {
+    for (auto& table : kFilterTables) {
+        int in = table.input_sample_rate;
+        int out = table.output_sample_rate;
+
+        PolyphaseResampler polyphase;
+        polyphase.Configure(in, out);
+        auto ours = RunCase(polyphase, [](PolyphaseResampler& r, const int16_t* x, size_t n, int16_t* y) {
+            return r.Process(x, n, y);
+        }, in, out);
+        ESP_LOGI(TAG, "%5d -> %5d polyphase: %7lu cycles/60ms, SNR %.1f dB @1k, %.1f dB @%dHz",
+            in, out, ours.cycles, ours.snr_low, ours.snr_high, (int)(0.4f * std::min(in, out)));
+
+        // SILKリサンプラーは48kHz→24kHzに対応しないため比較対象から外す
+        if (out > 16000 && in > out) {
+            continue;
+        }
+        OpusResampler opus;
+        opus.Configure(in, out);
+        auto theirs = RunCase(opus, [](OpusResampler& r, const int16_t* x, size_t n, int16_t* y) {
+            size_t produced = r.GetOutputSamples(n);
+            r.Process(x, n, y);
+            return produced;
+        }, in, out);
+        ESP_LOGI(TAG, "%5d -> %5d opus:      %7lu cycles/60ms, SNR %.1f dB @1k, %.1f dB @%dHz",
+            in, out, theirs.cycles, theirs.snr_low, theirs.snr_high, (int)(0.4f * std::min(in, out)));
+    }
+}
@@ -0,0 +1,101 @@
+/**
+ * @file polyphase_resampler.h
+ * @brief 固定小数点ポリフェーズリサンプラー
+ *
+ * L倍補間・M分の1間引きを1段のポリフェーズFIR（Q15係数）で行うモノラルリサンプラーです。
+ * 実際に使用するレートの組（24kHz↔16kHz、48kHz→24kHz）は
+ * scripts/gen_resampler_filters.py で生成した係数テーブルとタップ数固定の
+ * 内積ループを使用し、それ以外の組はConfigure()時に係数を設計します。
+ * フレーム間のフィルタ状態を保持し、出力は呼び出し側のバッファへ書き込みます。
+ */
+#ifndef POLYPHASE_RESAMPLER_H
+#define POLYPHASE_RESAMPLER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * @class PolyphaseResampler
+ * @brief 16ビットモノラルPCM用のストリーミングリサンプラー
+ *
+ * Process()は同じタスクから呼び出してください。入力ブロック長が一定であれば
+ * 初回以降はヒープ確保を行いません。
+ */
+class PolyphaseResampler {
+public:
+    PolyphaseResampler() = default;
+
+    /**
+     * @brief 変換レートを設定してフィルタ状態をリセット
+     * @return レートが不正な場合false
+     */
+    bool Configure(int input_sample_rate, int output_sample_rate);
+
+    /** @brief 次のProcess()で出力されるサンプル数を計算 */
+    size_t GetOutputSamples(size_t input_samples) const;
+
+    /**
+     * @brief 入力を変換
+     * @param input 入力サンプル
+     * @param samples 入力サンプル数
+     * @param output 出力先（GetOutputSamples(samples) サンプル以上）
+     * @return 出力したサンプル数
+     */
+    size_t Process(const int16_t* input, size_t samples, int16_t* output);
+
+    /**
+     * @brief 入力をフィルタの履歴バッファへ直接書き込むための領域を確保
+     *
+     * デコーダの出力先として使うと、Process()の入力コピーを省けます。
+     * 書き込んだ後は必ずEndInput()を呼び出してください。
+     * @param max_samples 書き込む可能性のある最大サンプル数
+     * @return 書き込み先（次のBeginInput()またはProcess()まで有効）
+     */
+    int16_t* BeginInput(size_t max_samples);
+
+    /**
+     * @brief BeginInput()の領域に書き込んだ入力を変換
+     * @param samples 実際に書き込んだサンプル数（0なら入力を取り消す）
+     * @param output 出力先（BeginInput()の前にGetOutputSamples(max_samples)で求めたサンプル数以上）
+     * @return 出力したサンプル数
+     */
+    size_t EndInput(size_t samples, int16_t* output);
+
+    /** @brief フィルタ状態をクリア */
+    void Reset();
+
+    /** @brief 事前計算済みテーブルを使用しているかどうか */
+    bool precomputed() const { return precomputed_; }
+    int input_sample_rate() const { return input_sample_rate_; }
+    int output_sample_rate() const { return output_sample_rate_; }
+
+    /** @brief 既存のOpusResamplerと品質（SNR）・処理サイクルを比較してログ出力 */
+    static void RunBenchmark();
+
+private:
+    using ProcessFunc = size_t (*)(PolyphaseResampler& self, int16_t* output);
+
+    int input_sample_rate_ = 0;
+    int output_sample_rate_ = 0;
+    int up_ = 1;                        /**< 補間率L */
+    int down_ = 1;                      /**< 間引き率M */
+    int taps_ = 1;                      /**< 1フェーズあたりのタップ数 */
+    const int16_t* coeffs_ = nullptr;   /**< フェーズ別係数（up_ * taps_） */
+    std::vector<int16_t> designed_;     /**< 実行時に設計した係数 */
+    bool precomputed_ = false;
+    ProcessFunc process_ = nullptr;
+
+    std::vector<int16_t> buffer_;       /**< 履歴 + 未処理入力 */
+    size_t index_ = 0;                  /**< 次の出力の基準となるbuffer_上の入力位置 */
+    size_t input_base_ = 0;             /**< BeginInput()で確保した領域の先頭 */
+    int phase_ = 0;                     /**< 次の出力のフェーズ（0..up_-1） */
+
+    void Design(int taps_per_phase);
+
+    template <int K>
+    static size_t ProcessFixed(PolyphaseResampler& self, int16_t* output);
+    static size_t ProcessGeneric(PolyphaseResampler& self, int16_t* output);
+};
+
+#endif // POLYPHASE_RESAMPLER_H
@@ -0,0 +1,50 @@
+// Auto-generated by scripts/gen_resampler_filters.py
+#pragma once
+
+#include <cstdint>
+
+namespace resampler_filters {
+    // 24000 Hz -> 16000 Hz (L=2, M=3, cutoff 6800 Hz)
+    constexpr int k24kTo16kUp = 2;
+    constexpr int k24kTo16kDown = 3;
+    constexpr int k24kTo16kTaps = 32;
+    constexpr int16_t k24kTo16k[2 * 32] = {
+             1,      1,    -19,      8,     77,    -84,   -168,    327,
+           194,   -853,     98,   1743,  -1287,  -3244,   6453,  17943,
+         13399,    148,  -3294,    844,   1242,   -754,   -371,    447,
+            40,   -191,     32,     54,    -19,     -7,      2,      0,
+             0,      2,     -7,    -19,     54,     32,   -191,     40,
+           447,   -371,   -754,   1242,    844,  -3294,    148,  13399,
+         17943,   6453,  -3244,  -1287,   1743,     98,   -853,    194,
+           327,   -168,    -84,     77,      8,    -19,      1,      1,
+    };
+
+    // 16000 Hz -> 24000 Hz (L=3, M=2, cutoff 7000 Hz)
+    constexpr int k16kTo24kUp = 3;
+    constexpr int k16kTo24kDown = 2;
+    constexpr int k16kTo24kTaps = 24;
+    constexpr int16_t k16kTo24k[3 * 24] = {
+            -2,      6,      4,    -62,    212,   -493,    897,  -1338,
+          1617,  -1350,   -562,  27657,   9223,  -4886,   2903,  -1578,
+           704,   -202,    -23,     79,    -61,     28,     -6,      0,
+             0,     -6,     36,   -105,    222,   -356,    418,   -247,
+          -405,   1931,  -5416,  20313,  20313,  -5416,   1931,   -405,
+          -247,    418,   -356,    222,   -105,     36,     -6,      0,
+             0,     -6,     28,    -61,     79,    -23,   -202,    704,
+         -1578,   2903,  -4886,   9223,  27657,   -562,  -1350,   1617,
+         -1338,    897,   -493,    212,    -62,      4,      6,     -2,
+    };
+
+    // 48000 Hz -> 24000 Hz (L=1, M=2, cutoff 11000 Hz)
+    constexpr int k48kTo24kUp = 1;
+    constexpr int k48kTo24kDown = 2;
+    constexpr int k48kTo24kTaps = 48;
+    constexpr int16_t k48kTo24k[1 * 48] = {
+             0,      1,     -1,     -7,      3,     26,      3,    -62,
+           -30,    117,    100,   -183,   -243,    236,    495,   -228,
+          -894,     77,   1512,    389,  -2578,  -1762,   5687,  13729,
+         13729,   5687,  -1762,  -2578,    389,   1512,     77,   -894,
+          -228,    495,    236,   -243,   -183,    100,    117,    -30,
+           -62,      3,     26,      3,     -7,     -1,      1,      0,
+    };
+} // namespace resampler_filters
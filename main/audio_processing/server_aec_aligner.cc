@@ -0,0 +1,66 @@
+#include "server_aec_aligner.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#define TAG "ServerAecAligner"
+
+static_assert((SERVER_AEC_ALIGNER_CAPACITY & (SERVER_AEC_ALIGNER_CAPACITY - 1)) == 0,
+    "SERVER_AEC_ALIGNER_CAPACITY must be a power of two");
+
+void ServerAecAligner::OnPlayback(uint32_t timestamp, int64_t play_us) {
+    uint32_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail - head_.load(std::memory_order_acquire) >= SERVER_AEC_ALIGNER_CAPACITY) {
+        // 収録側が動いていない間は古いものが残る。ForCapture()で期限切れとして捨てられる
+        overflows_.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    auto& entry = entries_[tail % SERVER_AEC_ALIGNER_CAPACITY];
+    entry.timestamp = timestamp;
+    entry.decoded_us = esp_timer_get_time();
+    entry.play_us = play_us;
+    tail_.store(tail + 1, std::memory_order_release);
+}
+
+uint32_t ServerAecAligner::ForCapture(int64_t capture_us) {
+    uint32_t head = head_.load(std::memory_order_relaxed);
+    uint32_t tail = tail_.load(std::memory_order_acquire);
+    if (reset_requested_.exchange(false, std::memory_order_acquire)) {
+        head = tail;
+        has_current_ = false;
+    }
+
+    // 収録開始までに再生が始まったパケットを進め、最後のものを現在のパケットとする
+    while (head != tail && entries_[head % SERVER_AEC_ALIGNER_CAPACITY].play_us <= capture_us) {
+        current_ = entries_[head % SERVER_AEC_ALIGNER_CAPACITY];
+        has_current_ = true;
+        head++;
+    }
+    head_.store(head, std::memory_order_release);
+
+    if (!has_current_ || capture_us - current_.play_us > SERVER_AEC_ALIGNER_MAX_AGE_MS * 1000) {
+        untagged_.fetch_add(1, std::memory_order_relaxed);
+        return 0;
+    }
+
+    uint32_t delay = capture_us - current_.decoded_us;
+    tagged_.fetch_add(1, std::memory_order_relaxed);
+    delay_sum_us_.fetch_add(delay, std::memory_order_relaxed);
+    if (delay > delay_max_us_.load(std::memory_order_relaxed)) {
+        delay_max_us_.store(delay, std::memory_order_relaxed);
+    }
+    return current_.timestamp;
+}
+
+void ServerAecAligner::PrintStats() {
+    uint32_t tagged = tagged_.exchange(0, std::memory_order_relaxed);
+    uint32_t untagged = untagged_.exchange(0, std::memory_order_relaxed);
+    uint32_t overflows = overflows_.exchange(0, std::memory_order_relaxed);
+    uint64_t delay_sum = delay_sum_us_.exchange(0, std::memory_order_relaxed);
+    uint32_t delay_max = delay_max_us_.exchange(0, std::memory_order_relaxed);
+    if (tagged == 0) {
+        return;
+    }
+    ESP_LOGI(TAG, "Echo path delay avg %llu ms, max %lu ms (%lu frames tagged, %lu untagged, %lu overflows)",
+        delay_sum / tagged / 1000, delay_max / 1000, tagged, untagged, overflows);
+}
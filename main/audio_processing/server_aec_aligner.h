@@ -0,0 +1,79 @@
+/**
+ * @file server_aec_aligner.h
+ * @brief サーバー側AEC用に、上りフレームへ再生中の下りパケットのタイムスタンプを対応付ける
+ *
+ * 下りパケットは、デコードしてPCMリングへ書き込んだ時点ではまだスピーカーから出ていません。
+ * デコードタスクはリングに残っている量から再生開始時刻を見積もって記録し、
+ * エンコードグループは上りフレームの収録開始時刻に再生されていたパケットを選びます。
+ * 固定長のSPSCリングで受け渡すため、どちらの側もロックを取りません。
+ */
+#ifndef SERVER_AEC_ALIGNER_H
+#define SERVER_AEC_ALIGNER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+/** @brief 対応付け待ちにできる下りパケット数（2の累乗） */
+#define SERVER_AEC_ALIGNER_CAPACITY 16
+
+/** @brief 再生開始からこの時間を過ぎたパケットは、収録中のフレームに対応付けない（ミリ秒） */
+#define SERVER_AEC_ALIGNER_MAX_AGE_MS 200
+
+/**
+ * @class ServerAecAligner
+ * @brief 再生側と収録側のタイムスタンプの整列
+ *
+ * OnPlayback()はデコードタスクのみ、ForCapture()はエンコードグループのみが呼び出します。
+ * Reset()は任意のタスクから呼び出せ、実際の破棄は次のForCapture()で行われます。
+ */
+class ServerAecAligner {
+public:
+    ServerAecAligner() = default;
+    ServerAecAligner(const ServerAecAligner&) = delete;
+    ServerAecAligner& operator=(const ServerAecAligner&) = delete;
+
+    /**
+     * @brief 下りパケットをPCMリングへ書き込んだ（生産者専用）
+     * @param timestamp パケットのタイムスタンプ
+     * @param play_us 見積もった再生開始時刻（esp_timer_get_time）
+     */
+    void OnPlayback(uint32_t timestamp, int64_t play_us);
+
+    /**
+     * @brief 収録開始時刻に再生されていたパケットのタイムスタンプ（消費者専用）
+     * @return 対応するパケットがなければ0
+     */
+    uint32_t ForCapture(int64_t capture_us);
+
+    /** @brief 記録を破棄（新しい会話の開始時） */
+    void Reset() { reset_requested_.store(true, std::memory_order_release); }
+
+    /** @brief デコードから上りフレームへの対応付けまでの遅延と統計をログ出力してリセット */
+    void PrintStats();
+
+private:
+    struct Entry {
+        uint32_t timestamp;
+        int64_t decoded_us;     /**< PCMリングへ書き込んだ時刻 */
+        int64_t play_us;        /**< 再生開始の見積もり時刻 */
+    };
+
+    Entry entries_[SERVER_AEC_ALIGNER_CAPACITY];
+    alignas(4) std::atomic<uint32_t> head_{0};     /**< 消費者側インデックス（単調増加） */
+    alignas(4) std::atomic<uint32_t> tail_{0};     /**< 生産者側インデックス（単調増加） */
+    std::atomic<bool> reset_requested_{false};
+
+    // 消費者側の状態
+    Entry current_ = {};                /**< 直近に再生が始まったパケット */
+    bool has_current_ = false;
+
+    // 統計（消費者が更新し、PrintStats()で読み出す）
+    std::atomic<uint32_t> tagged_{0};           /**< タイムスタンプを付けたフレーム数 */
+    std::atomic<uint32_t> untagged_{0};         /**< 対応するパケットがなかったフレーム数 */
+    std::atomic<uint32_t> overflows_{0};        /**< リングが満杯で記録できなかったパケット数 */
+    std::atomic<uint64_t> delay_sum_us_{0};
+    std::atomic<uint32_t> delay_max_us_{0};
+};
+
+#endif // SERVER_AEC_ALIGNER_H
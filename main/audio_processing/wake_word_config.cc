@@ -0,0 +1,155 @@
+#include "wake_word_config.h"
+#include "settings.h"
+#include "model_loader.h"
+#if CONFIG_MODEL_OTA
+#include "ota.h"
+#endif
+
+#include <esp_log.h>
+#include <cJSON.h>
+#include <cstring>
+#include <sstream>
+
+#define TAG "WakeWordConfig"
+
+srmodel_list_t* WakeWordConfig::models() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (models_ == nullptr) {
+#if CONFIG_MODEL_OTA
+        // OTAで切り替えたパーティションが読めなければ、もう一方（出荷時のmodel）に戻す
+        Settings settings("model");
+        std::string label = settings.GetString("partition", OTA_MODEL_PARTITION_A);
+        models_ = LoadSpeechModels(label.c_str());
+        if (models_ == nullptr && label != OTA_MODEL_PARTITION_A) {
+            ESP_LOGW(TAG, "Failed to load models from %s, falling back to %s", label.c_str(), OTA_MODEL_PARTITION_A);
+            models_ = LoadSpeechModels(OTA_MODEL_PARTITION_A);
+        }
+#else
+        models_ = LoadSpeechModels("model");
+#endif
+    }
+    return models_;
+}
+
+bool WakeWordConfig::enabled() {
+    Settings settings("wake_word");
+    return settings.GetInt("enabled", 1) != 0;
+}
+
+void WakeWordConfig::SetEnabled(bool enabled) {
+    Settings settings("wake_word", true);
+    settings.SetInt("enabled", enabled ? 1 : 0);
+}
+
+std::vector<char*> WakeWordConfig::SelectedModelNames() {
+    auto list = models();
+    std::vector<char*> names;
+    if (list == nullptr) {
+        return names;
+    }
+
+    Settings settings("wake_word");
+    std::stringstream ss(settings.GetString("models"));
+    std::string name;
+    while (std::getline(ss, name, ';') && names.size() < WAKE_WORD_MAX_MODELS) {
+        bool found = false;
+        for (int i = 0; i < list->num && !found; i++) {
+            if (name == list->model_name[i] && strstr(list->model_name[i], ESP_WN_PREFIX) != NULL) {
+                names.push_back(list->model_name[i]);
+                found = true;
+            }
+        }
+        if (!found && !name.empty()) {
+            ESP_LOGW(TAG, "Wake word model not found: %s", name.c_str());
+        }
+    }
+
+    if (names.empty()) {
+        char* name = esp_srmodel_filter(list, ESP_WN_PREFIX, NULL);
+        if (name != nullptr) {
+            names.push_back(name);
+        }
+    }
+    return names;
+}
+
+std::vector<std::string> WakeWordConfig::SelectedModels() {
+    auto names = SelectedModelNames();
+    return std::vector<std::string>(names.begin(), names.end());
+}
+
+void WakeWordConfig::SetModels(const std::string& models) {
+    Settings settings("wake_word", true);
+    settings.SetString("models", models);
+}
+
+int WakeWordConfig::threshold(int index) {
+    Settings settings("wake_word");
+    return settings.GetInt("threshold" + std::to_string(index), 0);
+}
+
+void WakeWordConfig::SetThreshold(int index, int percent) {
+    Settings settings("wake_word", true);
+    settings.SetInt("threshold" + std::to_string(index), percent);
+}
+
+void WakeWordConfig::ApplyModels(afe_config_t* afe_config) {
+    auto names = SelectedModelNames();
+    afe_config->wakenet_model_name = names.size() > 0 ? names[0] : NULL;
+    afe_config->wakenet_model_name_2 = names.size() > 1 ? names[1] : NULL;
+    for (size_t i = 0; i < names.size(); i++) {
+        ESP_LOGI(TAG, "WakeNet model %u: %s, threshold %d", i + 1, names[i], threshold(i));
+    }
+}
+
+void WakeWordConfig::ApplyThresholds(esp_afe_sr_iface_t* afe_iface, esp_afe_sr_data_t* afe_data) {
+    auto count = SelectedModelNames().size();
+    for (size_t i = 0; i < count; i++) {
+        int percent = threshold(i);
+        if (percent != 0) {
+            ApplyThreshold(afe_iface, afe_data, i, percent);
+        }
+    }
+}
+
+void WakeWordConfig::ApplyThreshold(esp_afe_sr_iface_t* afe_iface, esp_afe_sr_data_t* afe_data, int index, int percent) {
+    // AFEのモデル番号は1始まり
+    if (percent == 0) {
+        afe_iface->reset_wakenet_threshold(afe_data, index + 1);
+    } else {
+        afe_iface->set_wakenet_threshold(afe_data, index + 1, percent / 100.0f);
+    }
+}
+
+std::string WakeWordConfig::ToJson() {
+    cJSON* root = cJSON_CreateObject();
+    cJSON_AddBoolToObject(root, "enabled", enabled());
+
+    auto selected = SelectedModels();
+    cJSON* models = cJSON_CreateArray();
+    for (size_t i = 0; i < selected.size(); i++) {
+        cJSON* model = cJSON_CreateObject();
+        cJSON_AddStringToObject(model, "name", selected[i].c_str());
+        char* words = esp_srmodel_get_wake_words(models_, (char*)selected[i].c_str());
+        cJSON_AddStringToObject(model, "wake_words", words != nullptr ? words : "");
+        cJSON_AddNumberToObject(model, "threshold", threshold(i));
+        cJSON_AddItemToArray(models, model);
+    }
+    cJSON_AddItemToObject(root, "models", models);
+
+    cJSON* available = cJSON_CreateArray();
+    if (models_ != nullptr) {
+        for (int i = 0; i < models_->num; i++) {
+            if (strstr(models_->model_name[i], ESP_WN_PREFIX) != NULL) {
+                cJSON_AddItemToArray(available, cJSON_CreateString(models_->model_name[i]));
+            }
+        }
+    }
+    cJSON_AddItemToObject(root, "available", available);
+
+    char* json_str = cJSON_PrintUnformatted(root);
+    std::string result(json_str);
+    cJSON_free(json_str);
+    cJSON_Delete(root);
+    return result;
+}
@@ -0,0 +1,93 @@
+/**
+ * @file wake_word_config.h
+ * @brief WakeNetモデルの選択と検出しきい値の設定
+ *
+ * NVSの"wake_word"ネームスペースに、有効/無効、使用するモデル名、
+ * モデルごとのしきい値を保存します。AFEは最大2つのWakeNetモデルを同時に
+ * 動かせるため、感度の異なる2つのウェイクフレーズを使い分けられます。
+ */
+#ifndef WAKE_WORD_CONFIG_H
+#define WAKE_WORD_CONFIG_H
+
+#include <esp_afe_sr_iface.h>
+#include <esp_afe_config.h>
+#include <model_path.h>
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+/** @brief 同時に読み込めるWakeNetモデル数（AFEの制限） */
+#define WAKE_WORD_MAX_MODELS 2
+
+/** @brief しきい値の設定範囲（パーセント、0はモデルの既定値） */
+#define WAKE_WORD_THRESHOLD_MIN 40
+#define WAKE_WORD_THRESHOLD_MAX 99
+
+/**
+ * @class WakeWordConfig
+ * @brief ウェイクワード設定のシングルトン
+ *
+ * モデルリストは最初の呼び出しで一度だけ取得し、WakeWordDetectと
+ * AfeAudioProcessorで共有します。モデルパーティションはESP-SRがフラッシュから
+ * メモリマップするため、リストを共有すればマップとモデル情報の確保も一度で済みます。
+ */
+class WakeWordConfig {
+public:
+    static WakeWordConfig& GetInstance() {
+        static WakeWordConfig instance;
+        return instance;
+    }
+
+    WakeWordConfig(const WakeWordConfig&) = delete;
+    WakeWordConfig& operator=(const WakeWordConfig&) = delete;
+
+    /** @brief "model"パーティションのモデルリストを取得（初回のみ読み込み） */
+    srmodel_list_t* models();
+
+    /** @brief ウェイクワード検出が有効かどうか（変更は再起動後にモデル読み込みへ反映） */
+    bool enabled();
+    void SetEnabled(bool enabled);
+
+    /**
+     * @brief 使用するWakeNetモデル名を取得
+     *
+     * 設定されたモデルのうちパーティションに存在するものを最大 WAKE_WORD_MAX_MODELS 個返します。
+     * 未設定または1つも見つからない場合は、最初に見つかったWakeNetモデルを使います。
+     */
+    std::vector<std::string> SelectedModels();
+
+    /** @brief 使用するモデルを";"区切りで保存（再起動後に反映） */
+    void SetModels(const std::string& models);
+
+    /**
+     * @brief しきい値を取得
+     * @param index モデル番号（0始まり）
+     * @return パーセント値、0はモデルの既定値
+     */
+    int threshold(int index);
+    void SetThreshold(int index, int percent);
+
+    /** @brief 選択したモデルをAFE設定に書き込む */
+    void ApplyModels(afe_config_t* afe_config);
+
+    /** @brief 保存されたしきい値をAFEへ反映 */
+    void ApplyThresholds(esp_afe_sr_iface_t* afe_iface, esp_afe_sr_data_t* afe_data);
+
+    /** @brief 1つのモデルのしきい値をAFEへ反映（0なら既定値に戻す） */
+    static void ApplyThreshold(esp_afe_sr_iface_t* afe_iface, esp_afe_sr_data_t* afe_data, int index, int percent);
+
+    /** @brief 現在の設定と利用可能なモデルをJSONで取得 */
+    std::string ToJson();
+
+private:
+    WakeWordConfig() = default;
+
+    std::mutex mutex_;                                      /**< models_の初期化を保護 */
+    srmodel_list_t* models_ = nullptr;                      /**< 共有モデルリスト */
+
+    /** @brief SelectedModels()の結果をリスト内の名前ポインタで取得 */
+    std::vector<char*> SelectedModelNames();
+};
+
+#endif // WAKE_WORD_CONFIG_H
@@ -1,21 +1,46 @@
 #include "wake_word_detect.h"
 #include "application.h"
+#include "latency_trace.h"
+#include "wake_word_config.h"
+#include "afe_profile.h"
+#include "task_factory.h"
+#include "opus_memory.h"
 
 #include <esp_log.h>
+#include <esp_timer.h>
 #include <model_path.h>
+#include <opus.h>
 #include <arpa/inet.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 #include <sstream>
 
 #define DETECTION_RUNNING_EVENT 1
 
+/** @brief 保持するプリロール音声の長さ（ミリ秒） */
+#define WAKE_WORD_PREROLL_MS 2000
+
+/** @brief 検出タスクとエンコードタスク間のPCMリング長（ミリ秒、フレーム長の整数倍に切り上げ） */
+#define WAKE_WORD_PCM_BUFFER_MS 240
+
+/** @brief Opusパケットの最大サイズ（RFC 6716） */
+#define WAKE_WORD_MAX_OPUS_PACKET 1275
+
 static const char* TAG = "WakeWordDetect";
 
 WakeWordDetect::WakeWordDetect()
     : afe_data_(nullptr),
-      wake_word_pcm_(),
       wake_word_opus_() {
 
     event_group_ = xEventGroupCreate();
+
+    auto ret = esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "wake_word", &pm_lock_);
+    if (ret == ESP_ERR_NOT_SUPPORTED) {
+        pm_lock_ = nullptr;
+    } else {
+        ESP_ERROR_CHECK(ret);
+    }
 }
 
 WakeWordDetect::~WakeWordDetect() {
@@ -23,66 +48,162 @@ WakeWordDetect::~WakeWordDetect() {
         afe_iface_->destroy(afe_data_);
     }
 
-    if (wake_word_encode_task_stack_ != nullptr) {
-        heap_caps_free(wake_word_encode_task_stack_);
-    }
+    DeleteTask(wake_word_encode_task_);
+    heap_caps_free(preroll_pcm_);
 
     vEventGroupDelete(event_group_);
+    if (pm_lock_ != nullptr) {
+        if (pm_lock_held_) {
+            esp_pm_lock_release(pm_lock_);
+        }
+        esp_pm_lock_delete(pm_lock_);
+    }
 }
 
-void WakeWordDetect::Initialize(AudioCodec* codec) {
-    codec_ = codec;
-    int ref_num = codec_->input_reference() ? 1 : 0;
+void WakeWordDetect::UpdatePmLock() {
+    if (pm_lock_ == nullptr) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(pm_mutex_);
+    bool hold = IsDetectionRunning();
+#if CONFIG_USE_WAKE_WORD_ENERGY_GATE
+    hold = hold && gate_open_;
+#endif
+    if (hold == pm_lock_held_) {
+        return;
+    }
+    if (hold) {
+        esp_pm_lock_acquire(pm_lock_);
+    } else {
+        esp_pm_lock_release(pm_lock_);
+    }
+    pm_lock_held_ = hold;
+}
 
-    srmodel_list_t *models = esp_srmodel_init("model");
+void WakeWordDetect::LoadWakeWords(srmodel_list_t* models) {
     for (int i = 0; i < models->num; i++) {
         ESP_LOGI(TAG, "Model %d: %s", i, models->model_name[i]);
-        if (strstr(models->model_name[i], ESP_WN_PREFIX) != NULL) {
-            wakenet_model_ = models->model_name[i];
-            auto words = esp_srmodel_get_wake_words(models, wakenet_model_);
-            // split by ";" to get all wake words
-            std::stringstream ss(words);
-            std::string word;
-            while (std::getline(ss, word, ';')) {
-                wake_words_.push_back(word);
-            }
+    }
+    // AFEはモデルごとに1始まりのwakenet_model_indexを返すため、単語リストもモデル単位で持つ
+    auto selected = WakeWordConfig::GetInstance().SelectedModels();
+    for (size_t i = 0; i < selected.size(); i++) {
+        auto words = esp_srmodel_get_wake_words(models, (char*)selected[i].c_str());
+        if (words == nullptr) {
+            continue;
+        }
+        // split by ";" to get all wake words
+        std::stringstream ss(words);
+        std::string word;
+        while (std::getline(ss, word, ';')) {
+            wake_words_[i].push_back(word);
         }
     }
+}
 
-    std::string input_format;
-    for (int i = 0; i < codec_->input_channels() - ref_num; i++) {
-        input_format.push_back('M');
-    }
-    for (int i = 0; i < ref_num; i++) {
-        input_format.push_back('R');
+void WakeWordDetect::Initialize(AudioCodec* codec) {
+    codec_ = codec;
+
+    auto& config = WakeWordConfig::GetInstance();
+    if (!config.enabled()) {
+        // モデルもAFEも読み込まず、起動時のRAMを節約する
+        ESP_LOGI(TAG, "Wake word detection disabled by settings");
+        return;
     }
-    afe_config_t* afe_config = afe_config_init(input_format.c_str(), models, AFE_TYPE_SR, AFE_MODE_HIGH_PERF);
+    srmodel_list_t *models = config.models();
+    LoadWakeWords(models);
+
+    std::string input_format = codec_->input_format();
+    auto profile = AfeProfile::GetInstance().Resolve();
+    afe_config_t* afe_config = afe_config_init(input_format.c_str(), models, AFE_TYPE_SR, AfeProfile::AfeMode(profile));
     afe_config->aec_init = codec_->input_reference();
-    afe_config->aec_mode = AEC_MODE_SR_HIGH_PERF;
-    afe_config->afe_perferred_core = 1;
+    AfeProfile::Apply(afe_config, profile, models, false);
+    // AFE内部のタスクのコアは配置表の "afe"（コア指定なしにはできないため0に寄せる）
+    afe_config->afe_perferred_core = std::max(GetTaskCore("afe", CONFIG_AFE_TASK_CORE), 0);
     afe_config->afe_perferred_priority = 1;
     afe_config->memory_alloc_mode = AFE_MEMORY_ALLOC_MORE_PSRAM;
+    config.ApplyModels(afe_config);
     
     afe_iface_ = esp_afe_handle_from_config(afe_config);
     afe_data_ = afe_iface_->create_from_config(afe_config);
+    config.ApplyThresholds(afe_iface_, afe_data_);
+    enabled_ = true;
+
+    StartPrerollEncoder();
 
-    xTaskCreate([](void* arg) {
+    CreateTask([](void* arg) {
         auto this_ = (WakeWordDetect*)arg;
         this_->AudioDetectionTask();
         vTaskDelete(NULL);
     }, "audio_detection", 4096, this, 3, nullptr);
 }
 
+#if CONFIG_USE_SHARED_AUDIO_FRONTEND
+void WakeWordDetect::Initialize(AudioCodec* codec, AfeAudioProcessor* front_end) {
+    codec_ = codec;
+    auto& config = WakeWordConfig::GetInstance();
+    if (!config.enabled()) {
+        ESP_LOGI(TAG, "Wake word detection disabled by settings");
+        return;
+    }
+    // モデル選択としきい値はfront_end側のAFE作成時に反映済み
+    front_end_ = front_end;
+    LoadWakeWords(config.models());
+    enabled_ = true;
+    StartPrerollEncoder();
+    // 検出は共有フロントエンドの音声処理タスク上で行う
+    front_end_->OnFrontEndFetch([this](const afe_fetch_result_t* res) {
+        HandleFetchResult(res);
+    });
+    ESP_LOGI(TAG, "Wake word detection attached to the shared audio front-end");
+}
+#endif
+
+void WakeWordDetect::StartPrerollEncoder() {
+    // 常駐プリロールエンコーダ。検出待ちの間も直近の音声をエンコードし続ける
+    preroll_opus_.resize(WAKE_WORD_PREROLL_MS / OPUS_FRAME_DURATION_MS);
+    for (auto& packet : preroll_opus_) {
+        packet.reserve(WAKE_WORD_MAX_OPUS_PACKET);
+    }
+    // フレームがリングの末尾をまたがないよう、長さはフレーム長の整数倍にする
+    const size_t frame_samples = 16000 * OPUS_FRAME_DURATION_MS / 1000;
+    size_t frames = (WAKE_WORD_PCM_BUFFER_MS + OPUS_FRAME_DURATION_MS - 1) / OPUS_FRAME_DURATION_MS;
+    preroll_pcm_samples_ = frames * frame_samples;
+    preroll_pcm_ = (int16_t*)heap_caps_malloc(preroll_pcm_samples_ * sizeof(int16_t), MALLOC_CAP_SPIRAM);
+    assert(preroll_pcm_ != nullptr);
+    CreateTask([](void* arg) {
+        auto this_ = (WakeWordDetect*)arg;
+        this_->PrerollEncodeTask();
+        vTaskDelete(NULL);
+    }, "encode_detect_packets", 4096 * 8, this, 2, &wake_word_encode_task_);
+}
+
 void WakeWordDetect::OnWakeWordDetected(std::function<void(const std::string& wake_word)> callback) {
     wake_word_detected_callback_ = callback;
 }
 
 void WakeWordDetect::StartDetection() {
+    if (!enabled_) {
+        return;
+    }
+    // 前回のプリロールは古いため破棄し、エンコーダ状態も初期化する
+    preroll_reset_ = true;
     xEventGroupSetBits(event_group_, DETECTION_RUNNING_EVENT);
+    UpdatePmLock();
+#if CONFIG_USE_SHARED_AUDIO_FRONTEND
+    if (front_end_ != nullptr) {
+        front_end_->EnableWakeWord(true);
+    }
+#endif
 }
 
 void WakeWordDetect::StopDetection() {
     xEventGroupClearBits(event_group_, DETECTION_RUNNING_EVENT);
+    UpdatePmLock();
+#if CONFIG_USE_SHARED_AUDIO_FRONTEND
+    if (front_end_ != nullptr) {
+        front_end_->EnableWakeWord(false);
+    }
+#endif
     if (afe_data_ != nullptr) {
         afe_iface_->reset_buffer(afe_data_);
     }
@@ -92,19 +213,167 @@ bool WakeWordDetect::IsDetectionRunning() {
     return xEventGroupGetBits(event_group_) & DETECTION_RUNNING_EVENT;
 }
 
+bool WakeWordDetect::SetEnabled(bool enabled) {
+    WakeWordConfig::GetInstance().SetEnabled(enabled);
+    bool loaded = afe_data_ != nullptr;
+#if CONFIG_USE_SHARED_AUDIO_FRONTEND
+    loaded = loaded || front_end_ != nullptr;
+#endif
+    if (!loaded) {
+        // 起動時に無効だった場合はモデルが未読み込みのため、再起動で反映する
+        return !enabled;
+    }
+    enabled_ = enabled;
+    if (!enabled) {
+        StopDetection();
+    }
+    return true;
+}
+
+void WakeWordDetect::SetThreshold(int index, int percent) {
+    WakeWordConfig::GetInstance().SetThreshold(index, percent);
+    if (afe_data_ != nullptr) {
+        WakeWordConfig::ApplyThreshold(afe_iface_, afe_data_, index, percent);
+    }
+#if CONFIG_USE_SHARED_AUDIO_FRONTEND
+    if (front_end_ != nullptr) {
+        front_end_->SetWakeWordThreshold(index, percent);
+    }
+#endif
+}
+
 void WakeWordDetect::Feed(const std::vector<int16_t>& data) {
-    if (afe_data_ == nullptr) {
+#if CONFIG_USE_WAKE_WORD_ENERGY_GATE
+    bool was_open = gate_open_;
+    if (GateInput(data)) {
+        return;
+    }
+    if (!was_open && !gate_lookback_.empty()) {
+        // ゲートが開いた：直前のまとまりから渡し、ウェイクワードの頭を欠かさない
+        FeedChunks(gate_lookback_.data(), gate_lookback_.size());
+        gate_lookback_.clear();
+    }
+#endif
+    FeedChunks(data.data(), data.size());
+}
+
+void WakeWordDetect::FeedChunks(const int16_t* data, size_t samples) {
+    size_t chunk = 0;
+#if CONFIG_USE_SHARED_AUDIO_FRONTEND
+    if (front_end_ != nullptr) {
+        chunk = front_end_->GetFeedSize();
+    }
+#endif
+    if (chunk == 0 && afe_data_ != nullptr) {
+        chunk = afe_iface_->get_feed_chunksize(afe_data_) * codec_->input_channels();
+    }
+    if (chunk == 0) {
         return;
     }
-    afe_iface_->feed(afe_data_, data.data());
+    for (size_t offset = 0; offset < samples; offset += chunk) {
+        const int16_t* p = data + offset;
+        if (offset + chunk > samples) {
+            // リサンプル後の端数は無音で埋めて1チャンクにする
+            feed_scratch_.assign(p, data + samples);
+            feed_scratch_.resize(chunk, 0);
+            p = feed_scratch_.data();
+        }
+#if CONFIG_USE_SHARED_AUDIO_FRONTEND
+        if (front_end_ != nullptr) {
+            front_end_->FeedChunk(p);
+            continue;
+        }
+#endif
+        afe_iface_->feed(afe_data_, p);
+    }
 }
 
 size_t WakeWordDetect::GetFeedSize() {
-    if (afe_data_ == nullptr) {
-        return 0;
+    size_t chunk = 0;
+#if CONFIG_USE_SHARED_AUDIO_FRONTEND
+    if (front_end_ != nullptr) {
+        chunk = front_end_->GetFeedSize();
+    }
+#endif
+    if (chunk == 0 && afe_data_ != nullptr) {
+        chunk = afe_iface_->get_feed_chunksize(afe_data_) * codec_->input_channels();
+    }
+#if CONFIG_USE_WAKE_WORD_ENERGY_GATE
+    if (chunk > 0 && !gate_open_) {
+        // 閉鎖中は大きなまとまりで読み、audio_loopの起床回数を減らす
+        size_t chunk_ms = chunk / codec_->input_channels() * 1000 / 16000;
+        size_t chunks = std::max<size_t>(1, CONFIG_WAKE_WORD_GATE_BATCH_MS / std::max<size_t>(1, chunk_ms));
+        return chunk * chunks;
+    }
+#endif
+    return chunk;
+}
+
+#if CONFIG_USE_WAKE_WORD_ENERGY_GATE
+void WakeWordDetect::SetEnergyGate(bool enabled) {
+    gate_enabled_ = enabled;
+    if (!enabled && !gate_open_) {
+        gate_open_ = true;
+#if CONFIG_USE_SHARED_AUDIO_FRONTEND
+        if (front_end_ != nullptr) {
+            front_end_->SetWakeWordGated(false);
+        }
+#endif
+        UpdatePmLock();
+    }
+}
+
+void WakeWordDetect::OnSpeechOnset(std::function<void()> callback) {
+    speech_onset_callback_ = callback;
+}
+
+bool WakeWordDetect::GateInput(const std::vector<int16_t>& data) {
+    if (!gate_enabled_) {
+        return false;
+    }
+
+    // マイク（先頭チャンネル）の平均二乗振幅
+    int channels = codec_->input_channels();
+    int64_t sum = 0;
+    size_t count = 0;
+    for (size_t i = 0; i < data.size(); i += channels) {
+        sum += (int32_t)data[i] * data[i];
+        count++;
+    }
+    static const double threshold = [] {
+        double amplitude = 32768.0 * pow(10.0, CONFIG_WAKE_WORD_GATE_THRESHOLD_DB / 20.0);
+        return amplitude * amplitude;
+    }();
+    bool loud = count > 0 && (double)sum / count > threshold;
+
+    int64_t now = esp_timer_get_time();
+    if (loud) {
+        gate_hold_until_us_ = now + CONFIG_WAKE_WORD_GATE_HOLD_MS * 1000LL;
+    }
+    bool open = loud || now < gate_hold_until_us_;
+    if (open != gate_open_) {
+        gate_open_ = open;
+        ESP_LOGD(TAG, "Energy gate %s", open ? "opened" : "closed");
+#if CONFIG_USE_SHARED_AUDIO_FRONTEND
+        if (front_end_ != nullptr) {
+            front_end_->SetWakeWordGated(!open);
+        }
+#endif
+        UpdatePmLock();
+        if (open && speech_onset_callback_ != nullptr) {
+            speech_onset_callback_();
+        }
     }
-    return afe_iface_->get_feed_chunksize(afe_data_) * codec_->input_channels();
+    if (!open) {
+        gate_lookback_.assign(data.begin(), data.end());
+        return true;
+    }
+    return false;
+}
+#else
+void WakeWordDetect::SetEnergyGate(bool enabled) {
 }
+#endif
 
 void WakeWordDetect::AudioDetectionTask() {
     auto fetch_size = afe_iface_->get_fetch_chunksize(afe_data_);
@@ -119,61 +388,106 @@ void WakeWordDetect::AudioDetectionTask() {
         if (res == nullptr || res->ret_value == ESP_FAIL) {
             continue;;
         }
+        HandleFetchResult(res);
+    }
+}
 
-        // Store the wake word data for voice recognition, like who is speaking
-        StoreWakeWordData((uint16_t*)res->data, res->data_size / sizeof(uint16_t));
+void WakeWordDetect::HandleFetchResult(const afe_fetch_result_t* res) {
+    // Store the wake word data for voice recognition, like who is speaking
+    StoreWakeWordData((uint16_t*)res->data, res->data_size / sizeof(uint16_t));
 
-        if (res->wakeup_state == WAKENET_DETECTED) {
-            StopDetection();
-            last_detected_wake_word_ = wake_words_[res->wake_word_index - 1];
+    if (res->wakeup_state == WAKENET_DETECTED) {
+        StopDetection();
+        // wakenet_model_index / wake_word_index はどちらも1始まり
+        int model = res->wakenet_model_index > 0 ? res->wakenet_model_index - 1 : 0;
+        auto& words = wake_words_[model % WAKE_WORD_MAX_MODELS];
+        int index = res->wake_word_index - 1;
+        last_detected_wake_word_ = index >= 0 && index < (int)words.size() ? words[index] : "";
 
-            if (wake_word_detected_callback_) {
-                wake_word_detected_callback_(last_detected_wake_word_);
-            }
+        if (wake_word_detected_callback_) {
+            wake_word_detected_callback_(last_detected_wake_word_);
         }
     }
 }
 
 void WakeWordDetect::StoreWakeWordData(uint16_t* data, size_t samples) {
-    // store audio data to wake_word_pcm_
-    wake_word_pcm_.emplace_back(std::vector<int16_t>(data, data + samples));
-    // keep about 2 seconds of data, detect duration is 30ms (sample_rate == 16000, chunksize == 512)
-    while (wake_word_pcm_.size() > 2000 / 30) {
-        wake_word_pcm_.pop_front();
+    // PSRAM上のリングへ直接コピーする（検出タスクを止めず、フレームごとの確保もしない）
+    size_t write = preroll_pcm_write_.load(std::memory_order_relaxed);
+    size_t offset = write % preroll_pcm_samples_;
+    size_t first = std::min(samples, preroll_pcm_samples_ - offset);
+    memcpy(preroll_pcm_ + offset, data, first * sizeof(int16_t));
+    memcpy(preroll_pcm_, data + first, (samples - first) * sizeof(int16_t));
+    preroll_pcm_write_.store(write + samples, std::memory_order_release);
+    xTaskNotifyGive(wake_word_encode_task_);
+}
+
+void WakeWordDetect::PrerollEncodeTask() {
+    // ラッパーのEncode()は入力vectorの所有権を取るためフレームごとに確保が発生する。
+    // リング上のPCMを直接渡せるようlibopusを直接使う
+    int error = 0;
+    OpusEncoder* encoder = opus_memory::CreateEncoder(16000, 1, OPUS_APPLICATION_VOIP, &error);
+    assert(encoder != nullptr);
+    opus_encoder_ctl(encoder, OPUS_SET_COMPLEXITY(0)); // 0 is the fastest
+    opus_encoder_ctl(encoder, OPUS_SET_DTX(1));
+
+    const size_t frame_samples = 16000 * OPUS_FRAME_DURATION_MS / 1000;
+    uint8_t packet[WAKE_WORD_MAX_OPUS_PACKET];
+    size_t read = 0;
+    while (true) {
+        size_t write = preroll_pcm_write_.load(std::memory_order_acquire);
+        if (preroll_reset_.exchange(false)) {
+            opus_encoder_ctl(encoder, OPUS_RESET_STATE);
+            // 古いPCMを捨て、次のフレーム境界から読み始める
+            read = (write + frame_samples - 1) / frame_samples * frame_samples;
+            std::lock_guard<std::mutex> lock(wake_word_mutex_);
+            preroll_head_ = 0;
+            preroll_count_ = 0;
+        }
+        if (write < read + frame_samples) {
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(100));
+            continue;
+        }
+        if (write - read > preroll_pcm_samples_ - frame_samples) {
+            // 書き込み側に追い越されそうな場合は最新のフレーム境界まで読み飛ばす
+            read = (write - frame_samples) / frame_samples * frame_samples;
+        }
+
+        const int16_t* pcm = preroll_pcm_ + read % preroll_pcm_samples_;
+        int size = opus_encode(encoder, pcm, frame_samples, packet, sizeof(packet));
+        read += frame_samples;
+        if (size <= 0) {
+            ESP_LOGE(TAG, "Failed to encode pre-roll frame: %d", size);
+            continue;
+        }
+
+        std::lock_guard<std::mutex> lock(wake_word_mutex_);
+        size_t capacity = preroll_opus_.size();
+        size_t tail = (preroll_head_ + preroll_count_) % capacity;
+        // スロットの容量を再利用するためコピーする
+        preroll_opus_[tail].assign(packet, packet + size);
+        if (preroll_count_ < capacity) {
+            preroll_count_++;
+        } else {
+            preroll_head_ = (preroll_head_ + 1) % capacity;
+        }
     }
 }
 
 void WakeWordDetect::EncodeWakeWordData() {
+    // 常駐エンコーダが保持しているリングをそのまま送信キューへ移す
+    std::lock_guard<std::mutex> lock(wake_word_mutex_);
     wake_word_opus_.clear();
-    if (wake_word_encode_task_stack_ == nullptr) {
-        wake_word_encode_task_stack_ = (StackType_t*)heap_caps_malloc(4096 * 8, MALLOC_CAP_SPIRAM);
+    size_t capacity = preroll_opus_.size();
+    for (size_t i = 0; i < preroll_count_; ++i) {
+        wake_word_opus_.push_back(preroll_opus_[(preroll_head_ + i) % capacity]);
     }
-    wake_word_encode_task_ = xTaskCreateStatic([](void* arg) {
-        auto this_ = (WakeWordDetect*)arg;
-        {
-            auto start_time = esp_timer_get_time();
-            auto encoder = std::make_unique<OpusEncoderWrapper>(16000, 1, OPUS_FRAME_DURATION_MS);
-            encoder->SetComplexity(0); // 0 is the fastest
-
-            for (auto& pcm: this_->wake_word_pcm_) {
-                encoder->Encode(std::move(pcm), [this_](std::vector<uint8_t>&& opus) {
-                    std::lock_guard<std::mutex> lock(this_->wake_word_mutex_);
-                    this_->wake_word_opus_.emplace_back(std::move(opus));
-                    this_->wake_word_cv_.notify_all();
-                });
-            }
-            this_->wake_word_pcm_.clear();
-
-            auto end_time = esp_timer_get_time();
-            ESP_LOGI(TAG, "Encode wake word opus %u packets in %lld ms",
-                this_->wake_word_opus_.size(), (end_time - start_time) / 1000);
-
-            std::lock_guard<std::mutex> lock(this_->wake_word_mutex_);
-            this_->wake_word_opus_.push_back(std::vector<uint8_t>());
-            this_->wake_word_cv_.notify_all();
-        }
-        vTaskDelete(NULL);
-    }, "encode_detect_packets", 4096 * 8, this, 2, wake_word_encode_task_stack_, &wake_word_encode_task_buffer_);
+    ESP_LOGI(TAG, "Wake word pre-roll ready: %u packets", wake_word_opus_.size());
+    preroll_head_ = 0;
+    preroll_count_ = 0;
+    // 終端マーカー
+    wake_word_opus_.push_back(std::vector<uint8_t>());
+    wake_word_cv_.notify_all();
+    LatencyTrace::GetInstance().Mark(kLatencyWakeWordEncoded);
 }
 
 bool WakeWordDetect::GetWakeWordOpus(std::vector<uint8_t>& opus) {
@@ -3,7 +3,8 @@
  * @brief ウェイクワード検出システム
  * 
  * ESP-SRライブラリを使用して、リアルタイムでウェイクワードを検出します。
- * 検出されたウェイクワード音声はOpusエンコードされ、サーバーに送信されます。
+ * 検出待ちの間も直近約2秒の音声を常駐エンコーダでOpusエンコードし続けるため、
+ * 検出時点でプリロール音声を即座にサーバーへ送信できます。
  * AFE（Audio Front-End）処理、音声活動検出、エコーキャンセレーションなどを組み合わせます。
  */
 #ifndef WAKE_WORD_DETECT_H
@@ -12,10 +13,12 @@
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 #include <freertos/event_groups.h>
+#include <esp_pm.h>
 
 #include <esp_afe_sr_models.h>
 #include <esp_nsn_models.h>
 
+#include <atomic>
 #include <list>
 #include <string>
 #include <vector>
@@ -24,6 +27,10 @@
 #include <condition_variable>
 
 #include "audio_codec.h"
+#include "wake_word_config.h"
+#if CONFIG_USE_SHARED_AUDIO_FRONTEND
+#include "afe_audio_processor.h"
+#endif
 
 /**
  * @class WakeWordDetect
@@ -40,6 +47,16 @@ public:
 
     /** ウェイクワード検出システムをオーディオコーデックで初期化 */
     void Initialize(AudioCodec* codec);
+
+#if CONFIG_USE_SHARED_AUDIO_FRONTEND
+    /**
+     * @brief 共有フロントエンドに接続して初期化
+     *
+     * 独自のAFEと検出タスクは作成せず、front_endのAEC/NS処理済み音声と
+     * WakeNetの結果を使います。Feed()はfront_endへ転送されます。
+     */
+    void Initialize(AudioCodec* codec, AfeAudioProcessor* front_end);
+#endif
     
     /** 音声データをウェイクワード検出システムに供給 */
     void Feed(const std::vector<int16_t>& data);
@@ -55,11 +72,45 @@ public:
     
     /** ウェイクワード検出が動作中かどうかを確認 */
     bool IsDetectionRunning();
+
+    /**
+     * @brief ウェイクワード検出の有効/無効を切り替えて保存
+     *
+     * 無効化は即座に反映されます。有効化は次にアイドル状態になった時点から検出を再開します。
+     * @return 即座に反映できた場合true、起動時に無効だったため再起動が必要な場合false
+     */
+    bool SetEnabled(bool enabled);
+
+    /**
+     * @brief モデルごとの検出しきい値を変更して保存
+     * @param index モデル番号（0始まり）
+     * @param percent しきい値（WAKE_WORD_THRESHOLD_MIN〜MAX、0はモデルの既定値）
+     */
+    void SetThreshold(int index, int percent);
     
-    /** 1回のフィードで必要なサンプル数を取得 */
+    /** 1回のフィードで必要なサンプル数を取得（ゲートが閉じている間はまとめ読みの長さ） */
     size_t GetFeedSize();
+
+    /**
+     * @brief 省電力のエネルギーゲートを使うかどうか（待機中のみ有効にする）
+     *
+     * 有効な間は入力をWAKE_WORD_GATE_BATCH_MSごとにまとめて読み、音量が
+     * WAKE_WORD_GATE_THRESHOLD_DBを超えるまでWakeNetへ渡しません。直前のまとまりは
+     * 保持しておき、ゲートが開いたときに先に渡すため、ウェイクワードの頭は欠けません。
+     */
+    void SetEnergyGate(bool enabled);
+
+#if CONFIG_USE_WAKE_WORD_ENERGY_GATE
+    /**
+     * @brief 待機中にゲートが開いた（声が始まった）ときのコールバックを設定
+     *
+     * ウェイクワードの確認より前に呼ばれます。audio_loopタスクから呼ばれるため、
+     * コールバックでは処理をスケジュールするだけにしてください。
+     */
+    void OnSpeechOnset(std::function<void()> callback);
+#endif
     
-    /** ウェイクワード音声データをOpusエンコード */
+    /** エンコード済みのプリロール音声を送信用キューへ確定（即座に戻る） */
     void EncodeWakeWordData();
     
     /** エンコード済みウェイクワードOpusデータを取得 */
@@ -72,31 +123,74 @@ private:
     // ESP-SR AFEインターフェース
     esp_afe_sr_iface_t* afe_iface_ = nullptr;               /**< AFEインターフェース */
     esp_afe_sr_data_t* afe_data_ = nullptr;                 /**< AFEデータハンドル */
-    char* wakenet_model_ = NULL;                            /**< ウェイクネットモデル */
-    std::vector<std::string> wake_words_;                   /**< 検出可能なウェイクワードリスト */
+    std::vector<std::string> wake_words_[WAKE_WORD_MAX_MODELS];  /**< モデルごとの検出可能なウェイクワードリスト */
+    std::atomic<bool> enabled_{false};                      /**< 初期化済みかつ設定で有効 */
     
     // FreeRTOSイベントとコールバック
     EventGroupHandle_t event_group_;                                            /**< タスク間通信用イベントグループ */
+    esp_pm_lock_handle_t pm_lock_ = nullptr;                /**< 検出中（AFE・プリロールエンコード）のCPU周波数ロック */
+    bool pm_lock_held_ = false;                             /**< ロックを保持しているか */
+    std::mutex pm_mutex_;                                   /**< pm_lock_held_の排他制御 */
     std::function<void(const std::string& wake_word)> wake_word_detected_callback_;  /**< ウェイクワード検出コールバック */
     AudioCodec* codec_ = nullptr;                           /**< オーディオコーデックインスタンス */
     std::string last_detected_wake_word_;                   /**< 最後に検出したウェイクワード */
+#if CONFIG_USE_SHARED_AUDIO_FRONTEND
+    AfeAudioProcessor* front_end_ = nullptr;                /**< 共有フロントエンド（nullptrなら独自AFE） */
+#endif
+
+    // 常駐プリロールエンコードタスク関連
+    TaskHandle_t wake_word_encode_task_ = nullptr;          /**< プリロールエンコードタスクハンドル（スタックはPSRAM） */
+    int16_t* preroll_pcm_ = nullptr;                        /**< 検出タスク→エンコードタスクのPCMリング（PSRAM） */
+    size_t preroll_pcm_samples_ = 0;                        /**< リング長（フレーム長の整数倍） */
+    std::atomic<size_t> preroll_pcm_write_{0};              /**< 書き込み済みの総サンプル数（検出タスクのみ更新） */
+    std::atomic<bool> preroll_reset_{false};                /**< エンコーダ状態とリングのリセット要求 */
+
+    // プリロールリング（wake_word_mutex_で保護）
+    std::vector<std::vector<uint8_t>> preroll_opus_;        /**< エンコード済みパケットのリング（容量を再利用） */
+    size_t preroll_head_ = 0;                               /**< 最も古いパケットの位置 */
+    size_t preroll_count_ = 0;                              /**< 保持しているパケット数 */
 
-    // Opusエンコードタスク関連
-    TaskHandle_t wake_word_encode_task_ = nullptr;          /**< ウェイクワードエンコードタスクハンドル */
-    StaticTask_t wake_word_encode_task_buffer_;             /**< タスクバッファ */
-    StackType_t* wake_word_encode_task_stack_ = nullptr;    /**< タスクスタック */
-    
     // ウェイクワードデータキュー
-    std::list<std::vector<int16_t>> wake_word_pcm_;         /**< ウェイクワードPCMデータキュー */
-    std::list<std::vector<uint8_t>> wake_word_opus_;        /**< ウェイクワードOpusデータキュー */
+    std::list<std::vector<uint8_t>> wake_word_opus_;        /**< 送信待ちウェイクワードOpusデータキュー */
     std::mutex wake_word_mutex_;                            /**< ウェイクワードデータの排他制御 */
     std::condition_variable wake_word_cv_;                  /**< ウェイクワードデータの通知 */
 
-    /** ウェイクワード音声データを保存 */
+    /** ウェイクワード音声データをプリロールエンコーダへ渡す */
     void StoreWakeWordData(uint16_t* data, size_t size);
+
+    /** DFS有効時、検出中（ゲートが開いている間）だけCPUを最大周波数に保つ */
+    void UpdatePmLock();
+
+    /** サンプルをAFEのチャンクごとに渡す（端数は無音で埋める） */
+    void FeedChunks(const int16_t* data, size_t samples);
+    std::vector<int16_t> feed_scratch_;                     /**< 端数チャンク用の作業バッファ（audio_loopタスク専用） */
+
+#if CONFIG_USE_WAKE_WORD_ENERGY_GATE
+    // エネルギーゲート（gate_open_以外はaudio_loopタスク専用）
+    std::atomic<bool> gate_enabled_{false};                 /**< 待機中でゲートを使う */
+    std::atomic<bool> gate_open_{true};                     /**< WakeNetへ入力を渡している */
+    int64_t gate_hold_until_us_ = 0;                        /**< 無音になってもゲートを開けておく期限 */
+    std::vector<int16_t> gate_lookback_;                    /**< ゲート閉鎖中の直前のまとまり */
+    std::function<void()> speech_onset_callback_;           /**< ゲートが開いたときのコールバック */
+
+    /** @brief まとまりの音量でゲートを開閉し、閉じている間はtrueを返す（入力は保持のみ） */
+    bool GateInput(const std::vector<int16_t>& data);
+#endif
     
+    /** モデル一覧からWakeNetモデルとウェイクワードを取得 */
+    void LoadWakeWords(srmodel_list_t* models);
+
+    /** 常駐プリロールエンコーダを起動 */
+    void StartPrerollEncoder();
+
+    /** AFEの取得結果を処理（プリロール保存と検出判定） */
+    void HandleFetchResult(const afe_fetch_result_t* res);
+
     /** 音声検出タスク */
     void AudioDetectionTask();
+
+    /** プリロールエンコードタスク */
+    void PrerollEncodeTask();
 };
 
 #endif
@@ -0,0 +1,170 @@
+/**
+ * @file audio_stall_watchdog.cc
+ * @brief audio_loopの停滞検出の実装
+ */
+#include "audio_stall_watchdog.h"
+#include "lvgl_port_config.h"
+#if CONFIG_USE_FLIGHT_RECORDER
+#include "flight_recorder.h"
+#endif
+
+#include <cJSON.h>
+#include <esp_log.h>
+
+#include <cstring>
+
+#define TAG "AudioStall"
+
+/** @brief 停滞の警告ログを出す最小間隔（マイクロ秒） */
+#define AUDIO_STALL_LOG_INTERVAL_US 5000000
+
+const char* AudioStallWatchdog::StageName(AudioLoopStage stage) {
+    switch (stage) {
+    case kAudioLoopStageRead:
+        return "read";
+    case kAudioLoopStageConvert:
+        return "convert";
+    case kAudioLoopStageFeed:
+        return "feed";
+    case kAudioLoopStageOutput:
+        return "output";
+    default:
+        return "unknown";
+    }
+}
+
+const char* AudioStallWatchdog::CauseName(StallCause cause) {
+    switch (cause) {
+    case kStallCauseCpu:
+        return "cpu";
+    case kStallCauseLock:
+        return "lock";
+    case kStallCauseInputWait:
+        return "input_wait";
+    case kStallCauseWaiting:
+        return "waiting";
+    default:
+        return "unknown";
+    }
+}
+
+void AudioStallWatchdog::OnLockWait(const char* lock, const char* holder, uint32_t wait_us) {
+    if (!active_ || xTaskGetCurrentTaskHandle() != task_) {
+        return;
+    }
+    lock_wait_us_ += wait_us;
+    // 最も長く待たされたロックを残す
+    if (lock_name_ == nullptr || wait_us * 2 > lock_wait_us_) {
+        lock_name_ = lock;
+        strlcpy(lock_holder_, holder, sizeof(lock_holder_));
+    }
+}
+
+void AudioStallWatchdog::RecordStall(uint32_t elapsed_us) {
+    // 最も時間のかかったステージを原因とする
+    AudioLoopStage worst = kAudioLoopStageRead;
+    for (int i = 1; i < kAudioLoopStageCount; i++) {
+        if (stages_[i].wall_us > stages_[worst].wall_us) {
+            worst = (AudioLoopStage)i;
+        }
+    }
+    auto& time = stages_[worst];
+    uint32_t idle_us = time.wall_us > time.cpu_us ? time.wall_us - time.cpu_us : 0;
+    StallCause cause;
+    if (time.cpu_us * 10 >= time.wall_us * 7) {
+        cause = kStallCauseCpu;
+    } else if (lock_wait_us_ * 2 >= idle_us) {
+        cause = kStallCauseLock;
+    } else if (worst == kAudioLoopStageRead) {
+        cause = kStallCauseInputWait;
+    } else {
+        cause = kStallCauseWaiting;
+    }
+
+    StallEvent event = {
+        .time_us = iteration_start_us_,
+        .elapsed_us = elapsed_us,
+        .deadline_us = (uint32_t)((uint64_t)frame_us_ * CONFIG_AUDIO_STALL_DEADLINE_PERCENT / 100),
+        .stage = worst,
+        .cause = cause,
+        .stage_time = time,
+        .lock_wait_us = lock_wait_us_,
+        .lock = lock_name_,
+        .holder = {},
+        .during_render = LvglRenderMonitor::GetInstance().RenderedSince(iteration_start_us_),
+    };
+    if (event.during_render) {
+        LvglRenderMonitor::GetInstance().OnAudioStallDuringRender();
+    }
+    if (lock_name_ != nullptr) {
+        strlcpy(event.holder, lock_holder_, sizeof(event.holder));
+    }
+
+    taskENTER_CRITICAL(&lock_);
+    events_[next_] = event;
+    next_ = (next_ + 1) % AUDIO_STALL_EVENT_CAPACITY;
+    if (count_ < AUDIO_STALL_EVENT_CAPACITY) {
+        count_++;
+    }
+    stall_count_++;
+    taskEXIT_CRITICAL(&lock_);
+#if CONFIG_USE_FLIGHT_RECORDER
+    FlightRecorder::GetInstance().Record(kFlightEventStall, worst, cause, elapsed_us);
+#endif
+
+    if (event.time_us - last_log_us_ >= AUDIO_STALL_LOG_INTERVAL_US) {
+        last_log_us_ = event.time_us;
+        ESP_LOGW(TAG, "audio_loop took %lu us (deadline %lu us): %s %lu us, cpu %lu us, cause %s%s%s",
+            (unsigned long)elapsed_us, (unsigned long)event.deadline_us, StageName(worst),
+            (unsigned long)time.wall_us, (unsigned long)time.cpu_us, CauseName(cause),
+            cause == kStallCauseLock ? ", held by " : "", cause == kStallCauseLock ? event.holder : "");
+    }
+}
+
+void AudioStallWatchdog::AddToJson(cJSON* root) {
+    StallEvent events[AUDIO_STALL_EVENT_CAPACITY];
+    uint32_t histogram[AUDIO_STALL_HISTOGRAM_BUCKETS];
+    size_t count;
+    uint32_t stall_count;
+    taskENTER_CRITICAL(&lock_);
+    size_t start = (next_ + AUDIO_STALL_EVENT_CAPACITY - count_) % AUDIO_STALL_EVENT_CAPACITY;
+    count = count_;
+    for (size_t i = 0; i < count; i++) {
+        events[i] = events_[(start + i) % AUDIO_STALL_EVENT_CAPACITY];
+    }
+    stall_count = stall_count_;
+    memcpy(histogram, histogram_, sizeof(histogram));
+    taskEXIT_CRITICAL(&lock_);
+
+    cJSON* audio_loop = cJSON_CreateObject();
+    cJSON_AddNumberToObject(audio_loop, "deadline_percent", CONFIG_AUDIO_STALL_DEADLINE_PERCENT);
+    cJSON_AddNumberToObject(audio_loop, "stalls", stall_count);
+    // 1回の処理時間のフレーム時間に対する割合。区間は50%刻みで、最後は300%以上
+    cJSON* buckets = cJSON_CreateArray();
+    for (auto value : histogram) {
+        cJSON_AddItemToArray(buckets, cJSON_CreateNumber(value));
+    }
+    cJSON_AddItemToObject(audio_loop, "histogram", buckets);
+
+    cJSON* event_array = cJSON_CreateArray();
+    for (size_t i = 0; i < count; i++) {
+        auto& event = events[i];
+        cJSON* item = cJSON_CreateObject();
+        cJSON_AddNumberToObject(item, "uptime_ms", event.time_us / 1000);
+        cJSON_AddNumberToObject(item, "elapsed_us", event.elapsed_us);
+        cJSON_AddNumberToObject(item, "deadline_us", event.deadline_us);
+        cJSON_AddStringToObject(item, "stage", StageName(event.stage));
+        cJSON_AddNumberToObject(item, "stage_us", event.stage_time.wall_us);
+        cJSON_AddNumberToObject(item, "stage_cpu_us", event.stage_time.cpu_us);
+        cJSON_AddStringToObject(item, "cause", CauseName(event.cause));
+        if (event.lock != nullptr) {
+            cJSON_AddStringToObject(item, "lock", event.lock);
+            cJSON_AddStringToObject(item, "holder", event.holder);
+            cJSON_AddNumberToObject(item, "lock_wait_us", event.lock_wait_us);
+        }
+        cJSON_AddBoolToObject(item, "during_lvgl_render", event.during_render);
+        cJSON_AddItemToArray(event_array, item);
+    }
+    cJSON_AddItemToObject(audio_loop, "events", event_array);
+    cJSON_AddItemToObject(root, "audio_loop", audio_loop);
+}
@@ -0,0 +1,175 @@
+/**
+ * @file audio_stall_watchdog.h
+ * @brief audio_loopの停滞検出と原因の特定
+ *
+ * audio_loopの1回の処理（入力の読み取り、変換、AFE/WakeNetへの供給、出力ポリシー）の各ステージに
+ * 時刻と実行時間カウンタを記録し、1回の処理がフレーム時間の CONFIG_AUDIO_STALL_DEADLINE_PERCENT %を
+ * 超えたら停滞として、最も時間のかかったステージとその原因（CPU処理、ロック待ち、入力待ち、
+ * 他タスクによる待たされ）を記録します。ロック待ちは PriorityMutex から通知され、保持していたタスクも残ります。
+ * LVGLの描画と重なった停滞には印を付け、LVGLタスクの配置の確認に使います（lvgl_port_config.h）。
+ * 停滞イベントと処理時間のヒストグラムは self.get_perf_stats の "audio_loop" に含まれます。
+ */
+#ifndef AUDIO_STALL_WATCHDOG_H
+#define AUDIO_STALL_WATCHDOG_H
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_timer.h>
+
+#include <cstdint>
+
+struct cJSON;
+
+/** @brief 保持する停滞イベント数 */
+#define AUDIO_STALL_EVENT_CAPACITY 16
+
+/** @brief 処理時間ヒストグラムの区間数（フレーム時間に対する割合で区切る） */
+#define AUDIO_STALL_HISTOGRAM_BUCKETS 7
+
+/** @brief audio_loopのステージ */
+enum AudioLoopStage : uint8_t {
+    kAudioLoopStageRead,        /**< codec->InputData（I2S DMAの完了待ちを含む） */
+    kAudioLoopStageConvert,     /**< 声道分離・リサンプル */
+    kAudioLoopStageFeed,        /**< AFE / WakeNetへの供給 */
+    kAudioLoopStageOutput,      /**< OnAudioOutput */
+    kAudioLoopStageCount,
+};
+
+/**
+ * @class AudioStallWatchdog
+ * @brief audio_loopの停滞を記録するシングルトン
+ *
+ * BeginIteration()/EnterStage()/EndIteration()はaudio_loopからのみ呼びます。
+ * 定常時のコストはステージごとに時刻と実行時間カウンタの読み出し1回ずつです。
+ */
+class AudioStallWatchdog {
+public:
+    static AudioStallWatchdog& GetInstance() {
+        static AudioStallWatchdog instance;
+        return instance;
+    }
+
+    AudioStallWatchdog(const AudioStallWatchdog&) = delete;
+    AudioStallWatchdog& operator=(const AudioStallWatchdog&) = delete;
+
+    /**
+     * @brief 1回の処理を開始し、最初のステージ（入力の読み取り）に入る
+     * @param frame_us 今回読み取る音声の長さ（マイクロ秒）
+     */
+    void BeginIteration(uint32_t frame_us) {
+        if (task_ == nullptr) {
+            task_ = xTaskGetCurrentTaskHandle();
+        }
+        frame_us_ = frame_us;
+        active_ = true;
+        lock_wait_us_ = 0;
+        lock_name_ = nullptr;
+        for (auto& stage : stages_) {
+            stage = {};
+        }
+        stage_ = kAudioLoopStageRead;
+        iteration_start_us_ = stage_start_us_ = esp_timer_get_time();
+        stage_start_cpu_ = ulTaskGetRunTimeCounter(task_);
+    }
+
+    /** @brief 次のステージに入る（処理中でなければ何もしない） */
+    void EnterStage(AudioLoopStage stage) {
+        if (!active_) {
+            return;
+        }
+        CloseStage();
+        stage_ = stage;
+    }
+
+    /** @brief 1回の処理を終え、期限を超えていれば停滞として記録 */
+    void EndIteration() {
+        if (!active_) {
+            return;
+        }
+        CloseStage();
+        active_ = false;
+        uint32_t elapsed_us = stage_start_us_ - iteration_start_us_;
+        uint32_t bucket = elapsed_us * 2 / (frame_us_ > 0 ? frame_us_ : 1);    // 50%刻み
+        histogram_[bucket < AUDIO_STALL_HISTOGRAM_BUCKETS ? bucket : AUDIO_STALL_HISTOGRAM_BUCKETS - 1]++;
+        if ((uint64_t)elapsed_us * 100 > (uint64_t)frame_us_ * CONFIG_AUDIO_STALL_DEADLINE_PERCENT) {
+            RecordStall(elapsed_us);
+        }
+    }
+
+    /**
+     * @brief ロック待ちを通知（PriorityMutexから任意のタスクで呼ばれる）
+     *
+     * audio_loopの処理中の待ちだけを記録します。
+     */
+    void OnLockWait(const char* lock, const char* holder, uint32_t wait_us);
+
+    /** @brief ヒストグラムと停滞イベントをJSONに追加（PerfMonitor用） */
+    void AddToJson(cJSON* root);
+
+private:
+    AudioStallWatchdog() = default;
+
+    enum StallCause : uint8_t {
+        kStallCauseCpu,             /**< ステージ自体の処理が重い */
+        kStallCauseLock,            /**< ロック待ち */
+        kStallCauseInputWait,       /**< I2Sの入力待ち（DMAの詰まり、マイクのクロック停止など） */
+        kStallCauseWaiting,         /**< 他タスクに待たされた（高優先度タスクによるCPU不足、キュー待ち） */
+    };
+
+    struct StageTime {
+        uint32_t wall_us;
+        uint32_t cpu_us;
+    };
+
+    struct StallEvent {
+        int64_t time_us;
+        uint32_t elapsed_us;
+        uint32_t deadline_us;
+        AudioLoopStage stage;
+        StallCause cause;
+        StageTime stage_time;
+        uint32_t lock_wait_us;
+        const char* lock;                           /**< ロック名（文字列リテラル） */
+        char holder[configMAX_TASK_NAME_LEN];
+        bool during_render;                         /**< 処理中にLVGLが描画していた */
+    };
+
+    void CloseStage() {
+        int64_t now = esp_timer_get_time();
+        auto cpu = ulTaskGetRunTimeCounter(task_);
+        stages_[stage_].wall_us += now - stage_start_us_;
+        stages_[stage_].cpu_us += cpu - stage_start_cpu_;
+        stage_start_us_ = now;
+        stage_start_cpu_ = cpu;
+    }
+
+    void RecordStall(uint32_t elapsed_us);
+
+    static const char* StageName(AudioLoopStage stage);
+    static const char* CauseName(StallCause cause);
+
+    // audio_loop専用
+    TaskHandle_t task_ = nullptr;
+    volatile bool active_ = false;
+    uint32_t frame_us_ = 0;
+    AudioLoopStage stage_ = kAudioLoopStageRead;
+    int64_t iteration_start_us_ = 0;
+    int64_t stage_start_us_ = 0;
+    configRUN_TIME_COUNTER_TYPE stage_start_cpu_ = 0;
+    StageTime stages_[kAudioLoopStageCount] = {};
+    uint32_t histogram_[AUDIO_STALL_HISTOGRAM_BUCKETS] = {};
+
+    // OnLockWait()はaudio_loop自身が待ちから戻った直後に呼ばれる
+    uint32_t lock_wait_us_ = 0;
+    const char* lock_name_ = nullptr;
+    char lock_holder_[configMAX_TASK_NAME_LEN] = {};
+
+    portMUX_TYPE lock_ = portMUX_INITIALIZER_UNLOCKED;    /**< 停滞イベントの保護 */
+    StallEvent events_[AUDIO_STALL_EVENT_CAPACITY] = {};
+    size_t next_ = 0;
+    size_t count_ = 0;
+    uint32_t stall_count_ = 0;
+    int64_t last_log_us_ = 0;
+};
+
+#endif // AUDIO_STALL_WATCHDOG_H
@@ -8,6 +8,7 @@
  */
 
 #include "background_task.h"
+#include "task_factory.h"
 
 #include <esp_log.h>
 #include <esp_task_wdt.h>
@@ -17,16 +18,19 @@
 /**
  * @brief BackgroundTaskコンストラクタ
  * @param stack_size タスクスタックサイズ（バイト）
+ * @param name タスク名
+ * @param priority タスク優先度
+ * @param core_id 実行コア（-1: コア指定なし）
  * 
  * FreeRTOSバックグラウンドタスクを作成し、
  * ワーカーループを開始します。
  */
-BackgroundTask::BackgroundTask(uint32_t stack_size) {
+BackgroundTask::BackgroundTask(uint32_t stack_size, const char* name, UBaseType_t priority, int core_id) {
     // FreeRTOSタスクを作成し、バックグラウンドループを開始
-    xTaskCreate([](void* arg) {
+    CreateTask([](void* arg) {
         BackgroundTask* task = (BackgroundTask*)arg;
         task->BackgroundTaskLoop();
-    }, "background_task", stack_size, this, 2, &background_task_handle_);
+    }, name, stack_size, this, priority, &background_task_handle_, core_id);
 }
 
 /**
@@ -36,7 +40,7 @@ BackgroundTask::BackgroundTask(uint32_t stack_size) {
  */
 BackgroundTask::~BackgroundTask() {
     if (background_task_handle_ != nullptr) {
-        vTaskDelete(background_task_handle_);
+        DeleteTask(background_task_handle_);
     }
 }
 
@@ -58,7 +62,10 @@ void BackgroundTask::Schedule(std::function<void()> callback) {
         }
     }
     
-    active_tasks_++;
+    size_t depth = ++active_tasks_;
+    if (depth > max_queue_depth_) {
+        max_queue_depth_ = depth;
+    }
     // コールバックをラップして、完了時にカウンタをデクリメント
     main_tasks_.emplace_back([this, cb = std::move(callback)]() {
         cb();
@@ -94,7 +101,7 @@ void BackgroundTask::WaitForCompletion() {
  * 順次実行します。
  */
 void BackgroundTask::BackgroundTaskLoop() {
-    ESP_LOGI(TAG, "background_task started");
+    ESP_LOGI(TAG, "%s started", pcTaskGetName(NULL));
     while (true) {
         std::unique_lock<std::mutex> lock(mutex_);
         // タスクキューにタスクが追加されるまで待機
@@ -110,3 +117,185 @@ void BackgroundTask::BackgroundTaskLoop() {
         }
     }
 }
+
+/**
+ * @brief BackgroundTaskPoolコンストラクタ
+ *
+ * ワーカーiをコア (i % portNUM_PROCESSORS) に固定して起動します。
+ */
+BackgroundTaskPool::BackgroundTaskPool(size_t worker_count, uint32_t stack_size, const char* name, UBaseType_t priority) {
+    if (worker_count == 0) {
+        worker_count = 1;
+    }
+    // スティール時にworkers_全体を走査するため、タスク起動前にすべて用意する
+    for (size_t i = 0; i < worker_count; ++i) {
+        auto worker = std::make_unique<Worker>();
+        worker->pool = this;
+        worker->index = i;
+        workers_.push_back(std::move(worker));
+    }
+    for (auto& worker : workers_) {
+        char task_name[configMAX_TASK_NAME_LEN];
+        snprintf(task_name, sizeof(task_name), "%s_%u", name, worker->index);
+        CreateTask([](void* arg) {
+            auto worker = (Worker*)arg;
+            worker->pool->WorkerLoop(worker->index);
+        }, task_name, stack_size, worker.get(), priority, &worker->handle, worker->index % portNUM_PROCESSORS);
+    }
+}
+
+BackgroundTaskPool::~BackgroundTaskPool() {
+    for (auto& worker : workers_) {
+        if (worker->handle != nullptr) {
+            DeleteTask(worker->handle);
+        }
+    }
+}
+
+void BackgroundTaskPool::Schedule(TaskFunction callback, BackgroundTaskGroup* group) {
+    size_t depth = ++pending_;
+    if (depth > max_pending_) {
+        max_pending_ = depth;
+    }
+    if (group != nullptr) {
+        size_t group_depth = ++group->pending_;
+        if (group_depth > group->max_pending_) {
+            group->max_pending_ = group_depth;
+        }
+        if (group->serial_) {
+            // serialグループはストランドに積み、実行ジョブは同時に1つだけ投入する
+            std::lock_guard<std::mutex> lock(group->mutex_);
+            group->strand_.push_back(std::move(callback));
+            if (group->strand_scheduled_) {
+                return;
+            }
+            group->strand_scheduled_ = true;
+        }
+    }
+    Push(Job{std::move(callback), group});
+}
+
+void BackgroundTaskPool::Push(Job&& job) {
+    int current = CurrentWorker();
+    size_t index = current >= 0 ? current : next_worker_++ % workers_.size();
+    {
+        std::lock_guard<std::mutex> lock(workers_[index]->mutex);
+        workers_[index]->jobs.push_back(std::move(job));
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        queued_++;
+    }
+    work_available_.notify_one();
+}
+
+bool BackgroundTaskPool::Pop(size_t index, Job& job) {
+    // 自分のデックは先頭から（投入順）
+    {
+        auto& worker = *workers_[index];
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        if (!worker.jobs.empty()) {
+            job = std::move(worker.jobs.front());
+            worker.jobs.pop_front();
+            queued_--;
+            return true;
+        }
+    }
+    // 他のワーカーのデックは末尾から盗む（持ち主と先頭を取り合わないため）
+    for (size_t i = 1; i < workers_.size(); ++i) {
+        auto& victim = *workers_[(index + i) % workers_.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.jobs.empty()) {
+            job = std::move(victim.jobs.back());
+            victim.jobs.pop_back();
+            queued_--;
+            steal_count_++;
+            return true;
+        }
+    }
+    return false;
+}
+
+int BackgroundTaskPool::CurrentWorker() const {
+    TaskHandle_t current = xTaskGetCurrentTaskHandle();
+    for (auto& worker : workers_) {
+        if (worker->handle == current) {
+            return worker->index;
+        }
+    }
+    return -1;
+}
+
+void BackgroundTaskPool::Run(Job& job) {
+    auto group = job.group;
+    if (group == nullptr || !group->serial_) {
+        job.callback();
+        job.callback.Reset();
+        Complete(group);
+        return;
+    }
+
+    // ストランドから1件だけ実行し、残りがあれば実行ジョブを積み直す
+    TaskFunction callback;
+    {
+        std::lock_guard<std::mutex> lock(group->mutex_);
+        callback = std::move(group->strand_.front());
+        group->strand_.pop_front();
+    }
+    callback();
+    callback.Reset();
+    bool more;
+    {
+        std::lock_guard<std::mutex> lock(group->mutex_);
+        more = !group->strand_.empty();
+        group->strand_scheduled_ = more;
+    }
+    Complete(group);
+    if (more) {
+        Push(Job{TaskFunction(), group});
+    }
+}
+
+void BackgroundTaskPool::Complete(BackgroundTaskGroup* group) {
+    if (group != nullptr && --group->pending_ == 0) {
+        std::lock_guard<std::mutex> lock(group->mutex_);
+        group->condition_variable_.notify_all();
+    }
+    if (--pending_ == 0) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        all_done_.notify_all();
+    }
+}
+
+/**
+ * @brief 指定グループの完了を待機
+ *
+ * 他のグループのタスクが残っていても待たずに戻ります。
+ * そのグループのタスク内から呼び出すとデッドロックします。
+ */
+void BackgroundTaskPool::WaitForCompletion(BackgroundTaskGroup& group) {
+    std::unique_lock<std::mutex> lock(group.mutex_);
+    group.condition_variable_.wait(lock, [&group]() {
+        return group.pending_ == 0;
+    });
+}
+
+void BackgroundTaskPool::WaitForCompletion() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    all_done_.wait(lock, [this]() {
+        return pending_ == 0;
+    });
+}
+
+void BackgroundTaskPool::WorkerLoop(size_t index) {
+    ESP_LOGI(TAG, "%s started on core %d", pcTaskGetName(NULL), xPortGetCoreID());
+    Job job;
+    while (true) {
+        if (Pop(index, job)) {
+            Run(job);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(mutex_);
+        work_available_.wait(lock, [this]() { return queued_ > 0; });
+    }
+}
@@ -15,6 +15,11 @@
 #include <list>
 #include <condition_variable>
 #include <atomic>
+#include <deque>
+#include <memory>
+#include <vector>
+
+#include "main_task_scheduler.h"
 
 /**
  * @class BackgroundTask
@@ -29,8 +34,12 @@ public:
     /**
      * @brief バックグラウンドタスクコンストラクタ
      * @param stack_size タスクスタックサイズ（デフォルト: 8KB）
+     * @param name タスク名
+     * @param priority タスク優先度
+     * @param core_id 実行コア（-1: コア指定なし）
      */
-    BackgroundTask(uint32_t stack_size = 4096 * 2);
+    BackgroundTask(uint32_t stack_size = 4096 * 2, const char* name = "background_task",
+        UBaseType_t priority = 2, int core_id = -1);
     ~BackgroundTask();
 
     /**
@@ -42,15 +51,137 @@ public:
     /** すべてのタスクの完了を待機 */
     void WaitForCompletion();
 
+    /** 未完了のタスク数（実行中を含む） */
+    size_t queue_depth() const { return active_tasks_; }
+
+    /** 未完了タスク数の最大値 */
+    size_t max_queue_depth() const { return max_queue_depth_; }
+
 private:
     std::mutex mutex_;                                  /**< タスクキュー保護用ミューテックス */
     std::list<std::function<void()>> main_tasks_;      /**< 実行待ちタスクのキュー */
     std::condition_variable condition_variable_;        /**< タスク完了通知用条件変数 */
     TaskHandle_t background_task_handle_ = nullptr;     /**< バックグラウンドタスクハンドル */
     std::atomic<size_t> active_tasks_{0};               /**< アクティブタスク数（アトミック） */
+    std::atomic<size_t> max_queue_depth_{0};            /**< アクティブタスク数の最大値 */
 
     /** バックグラウンドタスクのメインループ */
     void BackgroundTaskLoop();
 };
 
+/**
+ * @class BackgroundTaskGroup
+ * @brief BackgroundTaskPoolに投入するタスクのグループ
+ *
+ * グループ単位で完了を待機できます。serialを指定したグループのタスクは
+ * 投入順に1件ずつ実行され（ストランド）、どのワーカーで実行されても
+ * 同時に2件が走ることはありません。Opusエンコーダのように状態を持つ処理に使います。
+ */
+class BackgroundTaskGroup {
+public:
+    explicit BackgroundTaskGroup(const char* name, bool serial = false) : name_(name), serial_(serial) {}
+
+    BackgroundTaskGroup(const BackgroundTaskGroup&) = delete;
+    BackgroundTaskGroup& operator=(const BackgroundTaskGroup&) = delete;
+
+    const char* name() const { return name_; }
+
+    /** 未完了のタスク数（実行中を含む） */
+    size_t queue_depth() const { return pending_; }
+
+    /** 未完了タスク数の最大値 */
+    size_t max_queue_depth() const { return max_pending_; }
+
+private:
+    friend class BackgroundTaskPool;
+
+    const char* name_;
+    const bool serial_;
+    std::mutex mutex_;                                  /**< 以下のメンバの保護 */
+    std::condition_variable condition_variable_;        /**< 完了通知用条件変数 */
+    std::deque<TaskFunction> strand_;                   /**< serialグループの実行待ちタスク */
+    bool strand_scheduled_ = false;                     /**< ストランド実行ジョブがワーカーに投入済み */
+    std::atomic<size_t> pending_{0};                    /**< 未完了タスク数 */
+    std::atomic<size_t> max_pending_{0};                /**< 未完了タスク数の最大値 */
+};
+
+/**
+ * @class BackgroundTaskPool
+ * @brief コアに固定した複数ワーカーとワークスティーリングを持つタスクプール
+ *
+ * ワーカーiはコア (i % portNUM_PROCESSORS) に固定され、それぞれ専用のデックを持ちます。
+ * ワーカーは自分のデックの先頭から取り出し、空であれば他のワーカーのデックの末尾から
+ * 盗みます。ワーカー内から投入したタスクは自分のデックに積まれます。
+ */
+class BackgroundTaskPool {
+public:
+    /**
+     * @brief タスクプールコンストラクタ
+     * @param worker_count ワーカー数
+     * @param stack_size 各ワーカーのスタックサイズ
+     * @param name タスク名の接頭辞（"<name>_<i>"）
+     * @param priority タスク優先度
+     */
+    BackgroundTaskPool(size_t worker_count, uint32_t stack_size, const char* name, UBaseType_t priority);
+    ~BackgroundTaskPool();
+
+    BackgroundTaskPool(const BackgroundTaskPool&) = delete;
+    BackgroundTaskPool& operator=(const BackgroundTaskPool&) = delete;
+
+    /**
+     * @brief タスクを投入
+     * @param callback 実行するタスク
+     * @param group 所属グループ（nullptrならグループなし）
+     */
+    void Schedule(TaskFunction callback, BackgroundTaskGroup* group = nullptr);
+
+    /** @brief 指定グループのタスクがすべて完了するまで待機 */
+    void WaitForCompletion(BackgroundTaskGroup& group);
+
+    /** @brief プール全体のタスクがすべて完了するまで待機 */
+    void WaitForCompletion();
+
+    size_t worker_count() const { return workers_.size(); }
+
+    /** 未完了のタスク数（全グループ、実行中を含む） */
+    size_t queue_depth() const { return pending_; }
+
+    /** 未完了タスク数の最大値 */
+    size_t max_queue_depth() const { return max_pending_; }
+
+    /** 他のワーカーから盗んで実行したタスク数 */
+    size_t steal_count() const { return steal_count_; }
+
+private:
+    struct Job {
+        TaskFunction callback;                  // serialグループのストランド実行ジョブでは空
+        BackgroundTaskGroup* group = nullptr;
+    };
+
+    struct Worker {
+        BackgroundTaskPool* pool = nullptr;
+        size_t index = 0;
+        std::mutex mutex;                       // jobsの保護
+        std::deque<Job> jobs;
+        TaskHandle_t handle = nullptr;
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::mutex mutex_;                                  /**< 待機中ワーカーと完了待ちの保護 */
+    std::condition_variable work_available_;            /**< ジョブ投入通知 */
+    std::condition_variable all_done_;                  /**< 全タスク完了通知 */
+    std::atomic<size_t> queued_{0};                     /**< デックに積まれているジョブ数 */
+    std::atomic<size_t> pending_{0};                    /**< 未完了タスク数 */
+    std::atomic<size_t> max_pending_{0};                /**< 未完了タスク数の最大値 */
+    std::atomic<size_t> next_worker_{0};                /**< ワーカー外からの投入先（ラウンドロビン） */
+    std::atomic<size_t> steal_count_{0};
+
+    void Push(Job&& job);
+    bool Pop(size_t index, Job& job);
+    int CurrentWorker() const;
+    void Run(Job& job);
+    void Complete(BackgroundTaskGroup* group);
+    void WorkerLoop(size_t index);
+};
+
 #endif
@@ -9,6 +9,13 @@
 Axp2101::Axp2101(i2c_master_bus_handle_t i2c_bus, uint8_t addr) : I2cDevice(i2c_bus, addr) {
 }
 
+Axp2101::~Axp2101() {
+    if (telemetry_timer_ != nullptr) {
+        esp_timer_stop(telemetry_timer_);
+        esp_timer_delete(telemetry_timer_);
+    }
+}
+
 int Axp2101::GetBatteryCurrentDirection() {
     return (ReadReg(0x01) & 0b01100000) >> 5;
 }
@@ -30,6 +37,60 @@ int Axp2101::GetBatteryLevel() {
     return ReadReg(0xA4);
 }
 
+void Axp2101::GetBatteryStatus(int& level, bool& charging, bool& discharging) {
+    const uint8_t regs[2] = {0x01, 0xA4};
+    uint8_t values[2];
+    ReadRegList(regs, values, 2);
+    int direction = (values[0] & 0b01100000) >> 5;
+    charging = direction == 1;
+    discharging = direction == 2;
+    level = values[1];
+}
+
+void Axp2101::StartTelemetry(uint32_t interval_ms) {
+    if (telemetry_timer_ != nullptr) {
+        return;
+    }
+    RefreshTelemetry();
+    esp_timer_create_args_t timer_args = {
+        .callback = [](void* arg) {
+            ((Axp2101*)arg)->RefreshTelemetry();
+        },
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "pmic_telemetry",
+        .skip_unhandled_events = true,
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&timer_args, &telemetry_timer_));
+    ESP_ERROR_CHECK(esp_timer_start_periodic(telemetry_timer_, interval_ms * 1000));
+    ESP_LOGI(TAG, "Telemetry refresh every %lums", interval_ms);
+}
+
+void Axp2101::RefreshTelemetry() {
+    int level;
+    bool charging;
+    bool discharging;
+    GetBatteryStatus(level, charging, discharging);
+    std::lock_guard<std::mutex> lock(telemetry_mutex_);
+    cached_level_ = level;
+    cached_charging_ = charging;
+    cached_discharging_ = discharging;
+    telemetry_valid_ = true;
+}
+
+void Axp2101::GetCachedBatteryStatus(int& level, bool& charging, bool& discharging) {
+    {
+        std::lock_guard<std::mutex> lock(telemetry_mutex_);
+        if (telemetry_valid_) {
+            level = cached_level_;
+            charging = cached_charging_;
+            discharging = cached_discharging_;
+            return;
+        }
+    }
+    GetBatteryStatus(level, charging, discharging);
+}
+
 float Axp2101::GetTemperature() {
     return ReadReg(0xA5);
 }
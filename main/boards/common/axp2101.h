@@ -10,6 +10,10 @@
 
 #include "i2c_device.h"
 
+#include <esp_timer.h>
+
+#include <mutex>
+
 /**
  * @class Axp2101
  * @brief AXP2101電源管理IC制御クラス
@@ -25,6 +29,7 @@ public:
      * @param addr AXP2101のI2Cアドレス
      */
     Axp2101(i2c_master_bus_handle_t i2c_bus, uint8_t addr);
+    ~Axp2101();
     
     /**
      * @brief 充電状態の確認
@@ -49,6 +54,32 @@ public:
      * @return int バッテリー残量（パーセント：0-100）
      */
     int GetBatteryLevel();
+
+    /**
+     * @brief 充放電状態とバッテリー残量を一括で取得
+     * @param level バッテリー残量（パーセント：0-100）
+     * @param charging 充電中ならtrue
+     * @param discharging 放電中ならtrue
+     * 
+     * 状態と残量のレジスタを1回のバス使用権で読み取ります。定期的な読み取りはこちらを使用してください。
+     */
+    void GetBatteryStatus(int& level, bool& charging, bool& discharging);
+
+    /**
+     * @brief 充放電状態と残量のバックグラウンド読み取りを開始
+     * @param interval_ms 読み取り間隔（ミリ秒）
+     * 
+     * 最初の1回はこの関数の中で読み取り、以降はesp_timerタスクで定期的に読み取ります。
+     */
+    void StartTelemetry(uint32_t interval_ms);
+
+    /**
+     * @brief 直近に読み取った充放電状態と残量の取得
+     * 
+     * I2Cを使わずにすぐ戻るため、UIやプロトコルのタスクから呼び出せます。
+     * StartTelemetry()の前はGetBatteryStatus()と同じく直接読み取ります。
+     */
+    void GetCachedBatteryStatus(int& level, bool& charging, bool& discharging);
     
     /**
      * @brief チップ温度の取得
@@ -64,6 +95,16 @@ public:
     void PowerOff();
 
 private:
+    std::mutex telemetry_mutex_;
+    esp_timer_handle_t telemetry_timer_ = nullptr;
+    bool telemetry_valid_ = false;      /**< キャッシュに読み取り結果がある */
+    int cached_level_ = 0;
+    bool cached_charging_ = false;
+    bool cached_discharging_ = false;
+
+    /** @brief レジスタを読み取ってキャッシュを更新 */
+    void RefreshTelemetry();
+
     /**
      * @brief バッテリー電流方向の取得
      * @return int 電流方向（正：充電、負：放電）
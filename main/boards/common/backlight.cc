@@ -8,10 +8,14 @@
 
 #include "backlight.h"
 #include "settings.h"
+#include "mcp_tool_cache.h"
 
 #include <esp_log.h>
 #include <driver/ledc.h>
 
+#include <algorithm>
+#include <cstdlib>
+
 #define TAG "Backlight"
 
 /**
@@ -61,36 +65,56 @@ void Backlight::SetBrightness(uint8_t brightness, bool permanent) {
         brightness = 100;
     }
 
-    if (brightness_ == brightness) {
-        return;
-    }
-
     if (permanent) {
         Settings settings("display", true);
         settings.SetInt("brightness", brightness);
     }
+    requested_brightness_ = brightness;
+    brightness = std::min(brightness, ceiling_);
 
-    target_brightness_ = brightness;
-    step_ = (target_brightness_ > brightness_) ? 1 : -1;
+    if (brightness_ == brightness) {
+        return;
+    }
 
-    if (transition_timer_ != nullptr) {
-        // 启动定时器，每 5ms 更新一次
-        esp_timer_start_periodic(transition_timer_, 5 * 1000);
+    target_brightness_ = brightness;
+    int duration_ms = abs(target_brightness_ - brightness_) * BACKLIGHT_TRANSITION_MS_PER_STEP;
+
+    esp_timer_stop(transition_timer_);
+    if (StartHardwareFade(target_brightness_, duration_ms)) {
+        brightness_ = target_brightness_;
+        McpToolCache::Invalidate();
+    } else if (transition_timer_ != nullptr) {
+        esp_timer_start_periodic(transition_timer_, step_interval_ms_ * 1000);
     }
     ESP_LOGI(TAG, "Set brightness to %d", brightness);
 }
 
+void Backlight::SetCeiling(uint8_t ceiling) {
+    ceiling_ = std::min<uint8_t>(ceiling, 100);
+    // 消灯中（明度0）はそのまま。点灯中なら要求された明度を新しい上限で設定し直す
+    if (brightness_ > 0 || target_brightness_ > 0) {
+        SetBrightness(requested_brightness_);
+    }
+}
+
 void Backlight::OnTransitionTimer() {
     if (brightness_ == target_brightness_) {
         esp_timer_stop(transition_timer_);
         return;
     }
 
-    brightness_ += step_;
+    // 目標を越えないようにstep_ずつ近づける
+    if (target_brightness_ > brightness_) {
+        brightness_ = std::min<int>(brightness_ + step_, target_brightness_);
+    } else {
+        brightness_ = std::max<int>(brightness_ - step_, target_brightness_);
+    }
     SetBrightnessImpl(brightness_);
 
     if (brightness_ == target_brightness_) {
         esp_timer_stop(transition_timer_);
+        // 状態のツールが返す明るさは変化を終えた値にする
+        McpToolCache::Invalidate();
     }
 }
 
@@ -119,6 +143,13 @@ PwmBacklight::PwmBacklight(gpio_num_t pin, bool output_invert) : Backlight() {
         }
     };
     ESP_ERROR_CHECK(ledc_channel_config(&backlight_channel));
+
+    // 他のLEDCの利用者（GpioLedなど）が先にインストールしている場合も使える
+    auto ret = ledc_fade_func_install(0);
+    fade_installed_ = (ret == ESP_OK || ret == ESP_ERR_INVALID_STATE);
+    if (!fade_installed_) {
+        ESP_LOGW(TAG, "LEDC fade unavailable (%s), using timer steps", esp_err_to_name(ret));
+    }
 }
 
 PwmBacklight::~PwmBacklight() {
@@ -132,3 +163,16 @@ void PwmBacklight::SetBrightnessImpl(uint8_t brightness) {
     ledc_update_duty(LEDC_LOW_SPEED_MODE, LEDC_CHANNEL_0);
 }
 
+bool PwmBacklight::StartHardwareFade(uint8_t brightness, int duration_ms) {
+    if (!fade_installed_) {
+        return false;
+    }
+    // 前のフェードが途中なら、その時点のデューティから新しい目標へ向かう
+    ledc_fade_stop(LEDC_LOW_SPEED_MODE, LEDC_CHANNEL_0);
+    uint32_t duty_cycle = (1023 * brightness) / 100;
+    if (ledc_set_fade_with_time(LEDC_LOW_SPEED_MODE, LEDC_CHANNEL_0, duty_cycle, duration_ms) != ESP_OK) {
+        return false;
+    }
+    return ledc_fade_start(LEDC_LOW_SPEED_MODE, LEDC_CHANNEL_0, LEDC_FADE_NO_WAIT) == ESP_OK;
+}
+
@@ -13,12 +13,19 @@
 #include <driver/gpio.h>
 #include <esp_timer.h>
 
+/** @brief 明度1あたりの変化時間（ms）。フェードの長さは変化量に比例する */
+#define BACKLIGHT_TRANSITION_MS_PER_STEP 5
+
 /**
  * @class Backlight
  * @brief バックライト制御の抽象基底クラス
  * 
  * ディスプレイのバックライト明度を制御する機能を提供します。
  * 段階的な明度変更（フェードイン/アウト）とタイマー制御を含みます。
+ *
+ * ハードウェアでフェードできる派生クラスはStartHardwareFade()を実装し、タイマーを使いません。
+ * I2C経由のPMICのように1回の設定が重い派生クラスは、step_とstep_interval_ms_を大きくして
+ * 書き込み回数を減らします。
  */
 class Backlight {
 public:
@@ -61,6 +68,15 @@ public:
      */
     inline uint8_t brightness() const { return brightness_; }
 
+    /**
+     * @brief 明度の上限を設定
+     * @param ceiling 上限（0-100）
+     *
+     * 電池の節約などで一時的に明るさを抑えます。保存される明度は要求された値のままで、
+     * 上限を上げると要求された明度へ戻ります。
+     */
+    void SetCeiling(uint8_t ceiling);
+
 protected:
     /**
      * @brief トランジションタイマーコールバック
@@ -70,6 +86,14 @@ protected:
      */
     void OnTransitionTimer();
     
+    /**
+     * @brief ハードウェアによるフェードを開始
+     * @param brightness 目標の明度（0-100）
+     * @param duration_ms フェードにかける時間（ms）
+     * @return 開始した場合true（falseならタイマーで段階的に変更する）
+     */
+    virtual bool StartHardwareFade(uint8_t brightness, int duration_ms) { return false; }
+
     /**
      * @brief 実際の明度設定実装（純粋仮想関数）
      * @param brightness 設定する明度（0-100）
@@ -86,9 +110,18 @@ protected:
     
     /** @brief 目標明度値（0-100） */
     uint8_t target_brightness_ = 0;
+
+    /** @brief 上限で抑える前の要求された明度（0-100） */
+    uint8_t requested_brightness_ = 0;
+
+    /** @brief 明度の上限（0-100） */
+    uint8_t ceiling_ = 100;
     
     /** @brief 明度変更時のステップサイズ */
     uint8_t step_ = 1;
+
+    /** @brief 段階的変更の間隔（ms）。step_と合わせて全体の長さを保つように設定する */
+    int step_interval_ms_ = BACKLIGHT_TRANSITION_MS_PER_STEP;
 };
 
 /**
@@ -124,4 +157,14 @@ public:
      * PWM デューティサイクルを調整して明度を制御します。
      */
     void SetBrightnessImpl(uint8_t brightness) override;
+
+    /**
+     * @brief LEDCのハードウェアフェードで明度を変更
+     * 
+     * デューティの変化はLEDCが行うため、フェード中のCPUとタイマーの負荷はありません。
+     */
+    bool StartHardwareFade(uint8_t brightness, int duration_ms) override;
+
+private:
+    bool fade_installed_ = false;   /**< ledc_fade_func_installに成功したか */
 };
@@ -16,6 +16,10 @@
 #include <esp_ota_ops.h>
 #include <esp_chip_info.h>
 #include <esp_random.h>
+#include <soc/soc_caps.h>
+#if SOC_TEMP_SENSOR_SUPPORTED
+#include <driver/temperature_sensor.h>
+#endif
 
 #define TAG "Board"
 
@@ -96,11 +100,36 @@ bool Board::GetBatteryLevel(int &level, bool& charging, bool& discharging) {
  * @param esp32temp チップ温度（摂氏）の出力先
  * @return bool 取得成功時true、失敗時false
  * 
- * 基底クラスでは温度センサー機能をサポートしないため常にfalseを返します。
- * 温度センサー搭載ボードでは派生クラスでオーバーライドして実装します。
+ * 基底クラスではチップ内蔵の温度センサーを初回の呼び出しで有効にして読みます。
+ * 内蔵センサーのないチップでは常にfalseを返します。
+ * 別の温度センサー搭載ボードでは派生クラスでオーバーライドして実装します。
  */
 bool Board::GetTemperature(float& esp32temp){
+#if SOC_TEMP_SENSOR_SUPPORTED
+    static temperature_sensor_handle_t sensor = nullptr;
+    static bool unavailable = false;
+    if (sensor == nullptr) {
+        if (unavailable) {
+            return false;
+        }
+        // 筐体内の発熱を見るため、高温側の精度がよい範囲を選ぶ
+        temperature_sensor_config_t config = TEMPERATURE_SENSOR_CONFIG_DEFAULT(20, 100);
+        if (temperature_sensor_install(&config, &sensor) != ESP_OK) {
+            sensor = nullptr;
+        } else if (temperature_sensor_enable(sensor) != ESP_OK) {
+            temperature_sensor_uninstall(sensor);
+            sensor = nullptr;
+        }
+        if (sensor == nullptr) {
+            ESP_LOGW(TAG, "Chip temperature sensor is not available");
+            unavailable = true;
+            return false;
+        }
+    }
+    return temperature_sensor_get_celsius(sensor, &esp32temp) == ESP_OK;
+#else
     return false;  // 温度センサー非対応
+#endif
 }
 
 /**
@@ -22,6 +22,17 @@
 void* create_board();
 class AudioCodec;
 class Display;
+
+/**
+ * @enum NetworkPowerProfile
+ * @brief 通信の省電力方針（Application::SetDeviceState()がデバイス状態から選ぶ）
+ */
+enum NetworkPowerProfile {
+    kNetworkPowerSave,          // 待機中：最大限スリープし、ビーコンに合わせて起床
+    kNetworkPowerLowLatency,    // 接続・聞き取り中：応答遅延を最小にする
+    kNetworkPowerThroughput,    // 発話・アップグレード中：受信スループットを優先
+};
+
 /**
  * @class Board
  * @brief ハードウェアボードの基底抽象クラス
@@ -66,10 +77,32 @@ public:
     virtual Mqtt* CreateMqtt() = 0;
     virtual Udp* CreateUdp() = 0;
     virtual void StartNetwork() = 0;
+    /**
+     * @brief 待ち受けに不要な初期化（カメラ、IoTデバイス登録など）
+     *
+     * 起動時間を短くするため、Application::Start()が待ち受け状態に入った後に
+     * メインタスクから1度だけ呼び出します。
+     */
+    virtual void InitializeDeferred() {}
     virtual const char* GetNetworkStateIcon() = 0;
+    /** @brief 電波強度が弱いかどうか（エンコーダ設定の調整に使用） */
+    virtual bool IsNetworkWeak() { return false; }
+    /** @brief 電波強度（dBm）を取得（メトリクス用）。取得できない場合false */
+    virtual bool GetSignalStrength(int& rssi) { return false; }
     virtual bool GetBatteryLevel(int &level, bool& charging, bool& discharging);
     virtual std::string GetJson();
     virtual void SetPowerSaveMode(bool enabled) = 0;
+    /**
+     * @brief デバイス状態に応じた省電力方針を設定
+     *
+     * 既定ではkNetworkPowerSaveのときだけSetPowerSaveMode(true)にします。
+     * ボードごとに調整する場合はこの関数（WiFiボードではGetWifiPowerSaveType()）を上書きします。
+     */
+    virtual void SetNetworkPowerProfile(NetworkPowerProfile profile) {
+        SetPowerSaveMode(profile == kNetworkPowerSave);
+    }
+    /** @brief 電池の段階が変わったときに、同じ省電力方針を設定し直す（既定は何もしない） */
+    virtual void RefreshNetworkPowerProfile() {}
     virtual std::string GetBoardJson() = 0;
     virtual std::string GetDeviceStatusJson() = 0;
 };
@@ -0,0 +1,131 @@
+#include "cached_tls_transport.h"
+#include "net_cache.h"
+#include "qos_udp.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_crt_bundle.h>
+#include <lwip/sockets.h>
+
+#include <cstring>
+
+#define TAG "CachedTls"
+
+CachedTlsTransport::CachedTlsTransport(int dscp) : dscp_(dscp) {
+}
+
+CachedTlsTransport::~CachedTlsTransport() {
+    Disconnect();
+}
+
+bool CachedTlsTransport::Connect(const char* host, int port) {
+    auto& dns = DnsCache::GetInstance();
+    std::string address;
+    if (!dns.Resolve(host, address)) {
+        return false;
+    }
+    if (ConnectTo(host, address, port)) {
+        return true;
+    }
+
+    // キャッシュしたアドレスが古い可能性があるため、再解決して1回だけ再試行する
+    dns.Invalidate(host);
+    TlsSessionCache::GetInstance().Remove(host, port);
+    std::string fresh;
+    if (!dns.Resolve(host, fresh)) {
+        return false;
+    }
+    return ConnectTo(host, fresh, port);
+}
+
+bool CachedTlsTransport::ConnectTo(const char* host, const std::string& address, int port) {
+    Disconnect();
+
+    esp_tls_cfg_t cfg = {};
+    cfg.crt_bundle_attach = esp_crt_bundle_attach;
+    // IPアドレスで接続するため、証明書の検証とSNIには元のホスト名を使う
+    cfg.common_name = host;
+    cfg.timeout_ms = 10000;
+#ifdef CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+    auto session = TlsSessionCache::GetInstance().Get(host, port);
+    cfg.client_session = session.get();
+#endif
+
+    tls_ = esp_tls_init();
+    if (tls_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate tls handle");
+        return false;
+    }
+
+    int64_t start = esp_timer_get_time();
+    if (esp_tls_conn_new_sync(address.c_str(), address.size(), port, &cfg, tls_) != 1) {
+        ESP_LOGE(TAG, "Failed to connect to %s (%s):%d", host, address.c_str(), port);
+        esp_tls_conn_destroy(tls_);
+        tls_ = nullptr;
+        return false;
+    }
+    ESP_LOGI(TAG, "Connected to %s:%d in %lldms%s", host, port, (esp_timer_get_time() - start) / 1000,
+#ifdef CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+        session ? " (resumed)" : "");
+#else
+        "");
+#endif
+
+    TlsSessionCache::GetInstance().Save(host, port, tls_);
+    int fd;
+    if (esp_tls_get_conn_sockfd(tls_, &fd) == ESP_OK) {
+        SetSocketDscp(fd, dscp_);
+#if CONFIG_NETWORK_PROFILE_REALTIME_VOICE
+        // 60msごとの小さなフレームを続けて書くと、Nagleと相手の遅延ACKが重なって
+        // 2つ目以降がACKを待つ間（最大で数百ms）止まるため、書き込みごとにすぐ送る
+        int nodelay = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+#endif
+    }
+    connected_ = true;
+    return true;
+}
+
+void CachedTlsTransport::Disconnect() {
+    if (tls_ != nullptr) {
+        esp_tls_conn_destroy(tls_);
+        tls_ = nullptr;
+    }
+    connected_ = false;
+}
+
+int CachedTlsTransport::Send(const char* data, size_t length) {
+    if (tls_ == nullptr) {
+        return -1;
+    }
+    size_t total_sent = 0;
+    while (total_sent < length) {
+        int ret = esp_tls_conn_write(tls_, data + total_sent, length - total_sent);
+        if (ret == ESP_TLS_ERR_SSL_WANT_READ || ret == ESP_TLS_ERR_SSL_WANT_WRITE) {
+            continue;
+        }
+        if (ret <= 0) {
+            ESP_LOGE(TAG, "Send failed: %d", ret);
+            connected_ = false;
+            return ret;
+        }
+        total_sent += ret;
+    }
+    return total_sent;
+}
+
+int CachedTlsTransport::Receive(char* buffer, size_t bufferSize) {
+    if (tls_ == nullptr) {
+        return -1;
+    }
+    while (true) {
+        int ret = esp_tls_conn_read(tls_, buffer, bufferSize);
+        if (ret == ESP_TLS_ERR_SSL_WANT_READ || ret == ESP_TLS_ERR_SSL_WANT_WRITE) {
+            continue;
+        }
+        if (ret <= 0) {
+            connected_ = false;
+        }
+        return ret;
+    }
+}
@@ -0,0 +1,39 @@
+/**
+ * @file cached_tls_transport.h
+ * @brief DNSキャッシュとTLSセッション再開を使うTLSトランスポート
+ *
+ * WebSocket（wss）用のTransport実装です。2回目以降の接続ではDNS問い合わせを省略し、
+ * 保存済みのセッションチケットで短縮ハンドシェイクを行います。
+ */
+#ifndef _CACHED_TLS_TRANSPORT_H_
+#define _CACHED_TLS_TRANSPORT_H_
+
+#include <transport.h>
+#include <esp_tls.h>
+
+#include <string>
+
+/**
+ * @class CachedTlsTransport
+ * @brief DnsCache / TlsSessionCache を共有するesp-tlsベースのトランスポート
+ */
+class CachedTlsTransport : public Transport {
+public:
+    /** @param dscp 接続のソケットに付けるDSCP（0: 付けない） */
+    explicit CachedTlsTransport(int dscp = 0);
+    ~CachedTlsTransport();
+
+    bool Connect(const char* host, int port) override;
+    void Disconnect() override;
+    int Send(const char* data, size_t length) override;
+    int Receive(char* buffer, size_t bufferSize) override;
+
+private:
+    esp_tls_t* tls_ = nullptr;      /**< esp-tls接続ハンドル */
+    int dscp_;                      /**< 接続ごとに設定するDSCP */
+
+    /** @brief 解決済みアドレスへ接続（hostは証明書検証とSNIに使用） */
+    bool ConnectTo(const char* host, const std::string& address, int port);
+};
+
+#endif // _CACHED_TLS_TRANSPORT_H_
@@ -10,6 +10,18 @@
 
 #include <string>
 
+/**
+ * @enum ExplainDetail
+ * @brief 画像解析に送る画像の詳細度
+ */
+enum ExplainDetail {
+    kExplainDetailNormal,   /**< 撮影解像度のまま標準の画質で送る */
+    kExplainDetailLow,      /**< 縦横1/2・低画質で送り、アップロード時間を短くする */
+};
+
+/** @brief ライブビューで設定できる最大フレームレート */
+#define CAMERA_VIEWFINDER_MAX_FPS 30
+
 /**
  * @class Camera
  * @brief カメラ制御とAI画像解析の抽象基底クラス
@@ -61,12 +73,23 @@ public:
     /**
      * @brief AI による画像説明生成
      * @param question 画像に対する質問文（例: "この画像に何が写っていますか？"）
+     * @param detail 送る画像の詳細度
      * @return std::string AI生成の画像説明文
      * 
      * 最後にキャプチャした画像をAIサーバーに送信し、
      * 指定された質問に対する回答を画像説明として取得します。
      */
-    virtual std::string Explain(const std::string& question) = 0;
+    virtual std::string Explain(const std::string& question, ExplainDetail detail = kExplainDetailNormal) = 0;
+
+    /**
+     * @brief ライブビュー（ビューファインダー）を開始
+     * @param fps 目標フレームレート（実行中に呼ぶと変更のみ）
+     * @return 対応していない場合false
+     */
+    virtual bool StartViewfinder(int fps) { return false; }
+
+    /** @brief ライブビューを停止して通常の画面に戻す */
+    virtual void StopViewfinder() {}
 };
 
 #endif // CAMERA_H
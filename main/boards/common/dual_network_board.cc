@@ -13,9 +13,22 @@
 #include "assets/lang_config.h"
 #include "settings.h"
 #include <esp_log.h>
+#include <esp_timer.h>
+#include <wifi_station.h>
+#include <ssid_manager.h>
 
 static const char *TAG = "DualNetworkBoard";
 
+#if CONFIG_DUAL_NETWORK_RACE
+/** @brief 並行起動のイベントビット */
+#define RACE_WIFI_DONE_EVENT (1 << 0)
+#define RACE_ML307_DONE_EVENT (1 << 1)
+#define RACE_WON_EVENT (1 << 2)
+
+/** @brief 並行起動でWiFiの接続を待つ時間（ミリ秒） */
+#define RACE_WIFI_TIMEOUT_MS (60 * 1000)
+#endif
+
 /**
  * @brief DualNetworkBoardクラスのコンストラクタ
  * @param ml307_tx_pin ML307モデム用UART送信ピン
@@ -129,6 +142,18 @@ std::string DualNetworkBoard::GetBoardType() {
  */
 void DualNetworkBoard::StartNetwork() {
     auto display = Board::GetInstance().GetDisplay();
+
+#if CONFIG_DUAL_NETWORK_RACE
+    // WiFiの接続先がない場合は設定モードに入る必要があるため、従来どおり選択中のネットワークだけを起動する
+    if (!SsidManager::GetInstance().GetSsidList().empty()) {
+        display->SetStatus(Lang::Strings::CONNECTING);
+        if (StartNetworkRace()) {
+            return;
+        }
+        ESP_LOGW(TAG, "Neither network reached the server, falling back to %s",
+            network_type_ == NetworkType::WIFI ? "WiFi" : "ML307");
+    }
+#endif
     
     // ネットワークタイプに応じた状態メッセージを表示
     if (network_type_ == NetworkType::WIFI) {
@@ -146,6 +171,9 @@ void DualNetworkBoard::StartNetwork() {
  * @return Http* 現在のネットワークタイプ用HTTPクライアント
  */
 Http* DualNetworkBoard::CreateHttp() {
+#if CONFIG_DUAL_NETWORK_RACE
+    FailoverIfNeeded();
+#endif
     return current_board_->CreateHttp();
 }
 
@@ -154,6 +182,9 @@ Http* DualNetworkBoard::CreateHttp() {
  * @return WebSocket* 現在のネットワークタイプ用WebSocketクライアント
  */
 WebSocket* DualNetworkBoard::CreateWebSocket() {
+#if CONFIG_DUAL_NETWORK_RACE
+    FailoverIfNeeded();
+#endif
     return current_board_->CreateWebSocket();
 }
 
@@ -162,6 +193,9 @@ WebSocket* DualNetworkBoard::CreateWebSocket() {
  * @return Mqtt* 現在のネットワークタイプ用MQTTクライアント
  */
 Mqtt* DualNetworkBoard::CreateMqtt() {
+#if CONFIG_DUAL_NETWORK_RACE
+    FailoverIfNeeded();
+#endif
     return current_board_->CreateMqtt();
 }
 
@@ -170,6 +204,9 @@ Mqtt* DualNetworkBoard::CreateMqtt() {
  * @return Udp* 現在のネットワークタイプ用UDPクライアント
  */
 Udp* DualNetworkBoard::CreateUdp() {
+#if CONFIG_DUAL_NETWORK_RACE
+    FailoverIfNeeded();
+#endif
     return current_board_->CreateUdp();
 }
 
@@ -181,12 +218,24 @@ const char* DualNetworkBoard::GetNetworkStateIcon() {
     return current_board_->GetNetworkStateIcon();
 }
 
+bool DualNetworkBoard::IsNetworkWeak() {
+    return current_board_->IsNetworkWeak();
+}
+
 /**
  * @brief 省電力モードの設定
  * @param enabled 省電力モードの有効/無効
  */
 void DualNetworkBoard::SetPowerSaveMode(bool enabled) {
     current_board_->SetPowerSaveMode(enabled);
+#if CONFIG_DUAL_NETWORK_RACE
+    // 待機中はバックアップのML307の無線部を止め、会話中だけ登録を保つ
+    std::lock_guard<std::mutex> lock(board_mutex_);
+    if (backup_board_ != nullptr && backup_type_ == NetworkType::ML307 &&
+        (xEventGroupGetBits(race_event_group_) & RACE_ML307_DONE_EVENT)) {
+        static_cast<Ml307Board*>(backup_board_.get())->SetRadioEnabled(!enabled);
+    }
+#endif
 }
 
 /**
@@ -204,3 +253,110 @@ std::string DualNetworkBoard::GetBoardJson() {
 std::string DualNetworkBoard::GetDeviceStatusJson() {
     return current_board_->GetDeviceStatusJson();
 }
+
+#if CONFIG_DUAL_NETWORK_RACE
+bool DualNetworkBoard::StartNetworkRace() {
+    // 選択中のネットワークは作成済み。もう一方をバックアップとして作る
+    backup_type_ = network_type_ == NetworkType::WIFI ? NetworkType::ML307 : NetworkType::WIFI;
+    if (backup_type_ == NetworkType::ML307) {
+        backup_board_ = std::make_unique<Ml307Board>(ml307_tx_pin_, ml307_rx_pin_, ml307_rx_buffer_size_);
+    } else {
+        backup_board_ = std::make_unique<WifiBoard>();
+    }
+
+    race_event_group_ = xEventGroupCreate();
+    race_winner_ = -1;
+    struct RaceArgs {
+        DualNetworkBoard* board;
+        Board* network;
+        NetworkType type;
+    };
+    for (auto& entry : { std::make_pair(current_board_.get(), network_type_), std::make_pair(backup_board_.get(), backup_type_) }) {
+        auto args = new RaceArgs{this, entry.first, entry.second};
+        xTaskCreate([](void* arg) {
+            auto args = (RaceArgs*)arg;
+            args->board->RaceNetwork(args->network, args->type);
+            delete args;
+            vTaskDelete(NULL);
+        }, entry.second == NetworkType::WIFI ? "race_wifi" : "race_ml307", 4096 * 2, args, 3, nullptr);
+    }
+
+    // どちらかがサーバーへ到達するか、両方が失敗するまで待つ
+    EventBits_t done = RACE_WIFI_DONE_EVENT | RACE_ML307_DONE_EVENT;
+    EventBits_t bits = 0;
+    while (!(bits & RACE_WON_EVENT) && (bits & done) != done) {
+        bits = xEventGroupWaitBits(race_event_group_, done | RACE_WON_EVENT, pdFALSE, pdFALSE, portMAX_DELAY);
+    }
+    if (race_winner_ < 0) {
+        std::lock_guard<std::mutex> lock(board_mutex_);
+        backup_board_.reset();
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(board_mutex_);
+    if ((NetworkType)race_winner_.load() != network_type_) {
+        current_board_.swap(backup_board_);
+        std::swap(network_type_, backup_type_);
+    }
+    ESP_LOGI(TAG, "Using %s, %s kept as backup", network_type_ == NetworkType::WIFI ? "WiFi" : "ML307",
+        backup_type_ == NetworkType::WIFI ? "WiFi" : "ML307");
+    return true;
+}
+
+void DualNetworkBoard::RaceNetwork(Board* board, NetworkType type) {
+    int64_t start_time = esp_timer_get_time();
+    bool ready;
+    if (type == NetworkType::WIFI) {
+        // WifiBoard::StartNetwork()は失敗時に設定モードに入るため、ステーションだけを起動する
+        auto& wifi_station = WifiStation::GetInstance();
+        wifi_station.Start();
+        ready = wifi_station.WaitForConnected(RACE_WIFI_TIMEOUT_MS);
+        if (!ready) {
+            wifi_station.Stop();
+        }
+    } else {
+        ready = static_cast<Ml307Board*>(board)->StartNetworkQuietly();
+    }
+
+    // ネットワークの起動だけでなく、実際にサーバーへ到達できたかで判定する
+    if (ready) {
+        auto http = std::unique_ptr<Http>(board->CreateHttp());
+        std::string url = Settings("wifi", false).GetString("ota_url");
+        ready = http->Open("GET", url.empty() ? CONFIG_OTA_URL : url);
+        http->Close();
+    }
+    ESP_LOGI(TAG, "%s %s in %lld ms", type == NetworkType::WIFI ? "WiFi" : "ML307",
+        ready ? "reached the server" : "failed", (esp_timer_get_time() - start_time) / 1000);
+
+    int expected = -1;
+    if (ready && race_winner_.compare_exchange_strong(expected, (int)type)) {
+        xEventGroupSetBits(race_event_group_, RACE_WON_EVENT);
+    }
+    xEventGroupSetBits(race_event_group_, type == NetworkType::WIFI ? RACE_WIFI_DONE_EVENT : RACE_ML307_DONE_EVENT);
+}
+
+bool DualNetworkBoard::IsBoardReady(Board* board, NetworkType type) {
+    if (type == NetworkType::WIFI) {
+        return WifiStation::GetInstance().IsConnected();
+    }
+    return static_cast<Ml307Board*>(board)->IsNetworkReady();
+}
+
+void DualNetworkBoard::FailoverIfNeeded() {
+    std::lock_guard<std::mutex> lock(board_mutex_);
+    if (backup_board_ == nullptr || IsBoardReady(current_board_.get(), network_type_)) {
+        return;
+    }
+    if (backup_type_ == NetworkType::ML307) {
+        // 待機中に止めていた場合は無線部を戻す（再登録を待つため即座には使えない）
+        static_cast<Ml307Board*>(backup_board_.get())->SetRadioEnabled(true);
+    }
+    if (!IsBoardReady(backup_board_.get(), backup_type_)) {
+        return;
+    }
+    ESP_LOGW(TAG, "%s is down, failing over to %s", network_type_ == NetworkType::WIFI ? "WiFi" : "ML307",
+        backup_type_ == NetworkType::WIFI ? "WiFi" : "ML307");
+    current_board_.swap(backup_board_);
+    std::swap(network_type_, backup_type_);
+}
+#endif
@@ -12,7 +12,11 @@
 #include "board.h"
 #include "wifi_board.h"
 #include "ml307_board.h"
+#include <freertos/FreeRTOS.h>
+#include <freertos/event_groups.h>
+#include <atomic>
 #include <memory>
+#include <mutex>
 
 /**
  * @enum NetworkType
@@ -30,6 +34,11 @@ enum class NetworkType {
  * WiFiとML307 4Gモジュールの両方を搭載したボードで、
  * 実行時にネットワーク接続方式を切り替えることができます。
  * 設定は永続化され、再起動後も保持されます。
+ *
+ * CONFIG_DUAL_NETWORK_RACE が有効でWiFiの接続先が登録済みの場合、起動時に両方の
+ * ネットワークを並行して立ち上げ、先にサーバーへ到達した方を使います。もう一方は
+ * バックアップとして保持し、使用中のネットワークが切れたら次の接続から切り替えます。
+ * ML307は待機中（省電力モード）には無線部を止めます。
  */
 class DualNetworkBoard : public Board {
 private:
@@ -74,6 +83,38 @@ private:
      * インスタンスを作成し、current_board_に設定します。
      */
     void InitializeCurrentBoard();
+
+#if CONFIG_DUAL_NETWORK_RACE
+    /** @brief 並行起動で後れた側のボード（バックアップ） */
+    std::unique_ptr<Board> backup_board_;
+
+    /** @brief バックアップのネットワークタイプ */
+    NetworkType backup_type_ = NetworkType::WIFI;
+
+    /** @brief current_board_とbackup_board_の入れ替えの保護 */
+    std::mutex board_mutex_;
+
+    /** @brief 並行起動の完了通知 */
+    EventGroupHandle_t race_event_group_ = nullptr;
+
+    /** @brief 先にサーバーへ到達したネットワーク（-1: 未決定） */
+    std::atomic<int> race_winner_{-1};
+
+    /**
+     * @brief WiFiとML307を並行して起動し、先にサーバーへ到達した方を使う
+     * @return どちらかが到達した場合true
+     */
+    bool StartNetworkRace();
+
+    /** @brief 1つのネットワークを起動してサーバーへの到達を確認（並行起動タスク） */
+    void RaceNetwork(Board* board, NetworkType type);
+
+    /** @brief ネットワークが使える状態かどうか */
+    bool IsBoardReady(Board* board, NetworkType type);
+
+    /** @brief 使用中のネットワークが切れていて、バックアップが使える場合に切り替える */
+    void FailoverIfNeeded();
+#endif
  
 public:
     /**
@@ -156,6 +197,12 @@ public:
      * @return const char* 現在のネットワーク接続状態を表すアイコン文字
      */
     virtual const char* GetNetworkStateIcon() override;
+
+    /**
+     * @brief 電波強度が弱いかどうか
+     * @return bool 現在のネットワークの判定の場合true
+     */
+    virtual bool IsNetworkWeak() override;
     
     /**
      * @brief 省電力モード設定
@@ -12,14 +12,93 @@
 #include "display.h"
 #include "board.h"
 #include "system_info.h"
+#include "audio_dsp.h"
 
+#include <cJSON.h>
 #include <esp_log.h>
 #include <esp_heap_caps.h>
+#include <esp_timer.h>
 #include <img_converters.h>
+#include <cstdlib>
 #include <cstring>
+#include <algorithm>
+#include <vector>
 
 #define TAG "Esp32Camera"
 
+/**
+ * @brief センサーごとの待機と露出安定判定のレジスタ
+ *
+ * 出力ピンを止めるとPCLK/VSYNCが止まり、ドライバのDMAはフレームを書かなくなります。
+ * センサー内部の自動露出・ホワイトバランスの状態は保持されるため、復帰後すぐに使えるフレームが出ます。
+ */
+struct SensorPowerRegs {
+    uint16_t pid;
+    int page_reg;               /**< レジスタページの選択（なければ-1） */
+    int output_enable_reg;      /**< 出力ピンの有効化 */
+    int output_enable_value;    /**< 有効時の値（待機時は0） */
+    int exposure_high_reg;
+    int exposure_high_mask;
+    int exposure_low_reg;
+    int awb_r_gain_reg;
+    int awb_g_gain_reg;
+    int awb_b_gain_reg;
+};
+
+static const SensorPowerRegs kSensorPowerRegs[] = {
+    // GC0308（CoreS3）: ページ0の0x25が出力ピン、0x03/0x04が露出時間、0x5A〜0x5CがAWBのゲイン
+    { GC0308_PID, 0xFE, 0x25, 0x0F, 0x03, 0x0F, 0x04, 0x5A, 0x5B, 0x5C },
+};
+
+/**
+ * @brief RGB565（ビッグエンディアン）のフレームの知覚ハッシュ（dHash）
+ *
+ * 9x8のセルの平均輝度を求め、横に隣り合うセルの明暗を1ビットずつ並べます。
+ * 照明の小さな変化やノイズではほとんどのビットが変わらず、構図が変わると多くのビットが変わります。
+ * 各セルは4x4点だけを読むため、QVGAでも1ms未満で終わります。
+ */
+static uint64_t ComputeSceneHash(const uint8_t* rgb565, int width, int height) {
+    const int kCols = 9;
+    const int kRows = 8;
+    const int kSamples = 4;
+    int luma[kRows][kCols];
+    for (int row = 0; row < kRows; row++) {
+        for (int col = 0; col < kCols; col++) {
+            int sum = 0;
+            for (int sy = 0; sy < kSamples; sy++) {
+                int y = (row * kSamples + sy) * height / (kRows * kSamples);
+                for (int sx = 0; sx < kSamples; sx++) {
+                    int x = (col * kSamples + sx) * width / (kCols * kSamples);
+                    const uint8_t* p = rgb565 + (y * width + x) * 2;
+                    uint16_t v = (p[0] << 8) | p[1];
+                    // R5/G6/B5のままBT.601の重みで輝度を近似する
+                    sum += ((v >> 11) << 1) * 77 + ((v >> 5) & 0x3F) * 150 + ((v & 0x1F) << 1) * 29;
+                }
+            }
+            luma[row][col] = sum;
+        }
+    }
+    uint64_t hash = 0;
+    for (int row = 0; row < kRows; row++) {
+        for (int col = 0; col < kCols - 1; col++) {
+            hash = (hash << 1) | (luma[row][col] > luma[row][col + 1] ? 1 : 0);
+        }
+    }
+    return hash;
+}
+
+static const SensorPowerRegs* FindSensorPowerRegs(sensor_t* s) {
+    if (s == nullptr || s->set_reg == nullptr || s->get_reg == nullptr) {
+        return nullptr;
+    }
+    for (auto& regs : kSensorPowerRegs) {
+        if (regs.pid == s->id.PID) {
+            return &regs;
+        }
+    }
+    return nullptr;
+}
+
 /**
  * @brief Esp32Cameraクラスのコンストラクタ
  * @param config カメラの設定構造体（ピン、解像度、フォーマット等）
@@ -29,6 +108,9 @@
  * LVGL用のRGB565フォーマットプレビュー画像バッファをPSRAMに作成します。
  */
 Esp32Camera::Esp32Camera(const camera_config_t& config) {
+    config_ = config;
+    pixel_format_ = config.pixel_format;
+
     // カメラモジュールの初期化
     esp_err_t err = esp_camera_init(&config);
     if (err != ESP_OK) {
@@ -43,6 +125,17 @@ Esp32Camera::Esp32Camera(const camera_config_t& config) {
         s->set_hmirror(s, 0);  // 0=ミラーなし、1=ミラーあり
     }
 
+#if CONFIG_CAMERA_NATIVE_JPEG
+    // 画像解析用にJPEG出力を使えるか確認（GC0308などRGB/YUV専用のセンサーはソフトウェアでエンコード）
+    camera_sensor_info_t* info = esp_camera_sensor_get_info(&s->id);
+    native_jpeg_ = info != nullptr && info->support_jpeg && config.pixel_format != PIXFORMAT_JPEG;
+    ESP_LOGI(TAG, "Sensor %s, native JPEG %s", info != nullptr ? info->name : "unknown",
+        native_jpeg_ ? "supported" : "not supported");
+#endif
+
+    // 撮影するまではセンサーの出力を止めておく
+    SetPowerState(kCameraPowerStandby);
+
     // LVGL用プレビュー画像の初期化
     memset(&preview_image_, 0, sizeof(preview_image_));
     preview_image_.header.magic = LV_IMAGE_HEADER_MAGIC;                           // LVGLマジックナンバー
@@ -58,16 +151,12 @@ Esp32Camera::Esp32Camera(const camera_config_t& config) {
         preview_image_.header.h = 240;
     }
     
-    // 画像メモリの計算と確保
+    // 画像メモリの計算（確保は撮影中だけ作業領域から行う）
     preview_image_.header.stride = preview_image_.header.w * 2;  // 1ピクセル=2バイト（RGB565）
     preview_image_.data_size = preview_image_.header.w * preview_image_.header.h * 2;
-    
-    // PSRAMにプレビュー用メモリを確保（高速アクセス用）
-    preview_image_.data = (uint8_t*)heap_caps_malloc(preview_image_.data_size, MALLOC_CAP_SPIRAM);
-    if (preview_image_.data == nullptr) {
-        ESP_LOGE(TAG, "Failed to allocate memory for preview image");
-        return;
-    }
+
+    // 作業領域はプレビュー画像と、低詳細の解析用に縦横1/2へ縮小した画像の合計
+    capture_arena_size_ = preview_image_.data_size + preview_image_.data_size / 4;
 }
 
 /**
@@ -77,17 +166,16 @@ Esp32Camera::Esp32Camera(const camera_config_t& config) {
  * カメラドライバの上から順番にクリーンアップします。
  */
 Esp32Camera::~Esp32Camera() {
+    StopViewfinder();
+
     // カメラフレームバッファの解放
     if (fb_) {
         esp_camera_fb_return(fb_);  // ESP32カメラライブラリに返却
         fb_ = nullptr;
     }
     
-    // プレビュー画像用メモリの解放
-    if (preview_image_.data) {
-        heap_caps_free((void*)preview_image_.data);  // PSRAMメモリを解放
-        preview_image_.data = nullptr;
-    }
+    // 撮影中の作業領域の解放
+    ReleaseCaptureBuffers();
     
     // カメラドライバの終了処理
     esp_camera_deinit();
@@ -115,45 +203,369 @@ void Esp32Camera::SetExplainUrl(const std::string& url, const std::string& token
  * RGB565フォーマットのバイトオーダーをLVGL用に変換して表示します。
  */
 bool Esp32Camera::Capture() {
+    // 撮影はライブビューのフレームを横取りしないよう、先に停止してから行う
+    StopViewfinder();
+
     // 前回のエンコーダースレッドの終了を待機
     if (encoder_thread_.joinable()) {
         encoder_thread_.join();
     }
+    // 解析されなかった前回の撮影の作業領域が残っていれば解放
+    ReleaseCaptureBuffers();
 
-    // 安定したフレームを取得するために複数回キャプチャ
-    int frames_to_get = 2;
-    for (int i = 0; i < frames_to_get; i++) {
-        // 前回のフレームバッファを解放
-        if (fb_ != nullptr) {
-            esp_camera_fb_return(fb_);
-        }
-        
-        // 新しいフレームを取得
-        fb_ = esp_camera_fb_get();
-        if (fb_ == nullptr) {
-            ESP_LOGE(TAG, "Camera capture failed");
-            return false;
-        }
+    EnsurePreviewMode();
+
+    int64_t start_time = esp_timer_get_time();
+
+    // 前回のフレームバッファを解放
+    if (fb_ != nullptr) {
+        esp_camera_fb_return(fb_);
+        fb_ = nullptr;
+    }
+
+    // 待機から復帰し、露出とホワイトバランスが安定したフレームを使う。取得後はすぐ待機に戻す
+    SetPowerState(kCameraPowerActive);
+    fb_ = GetSettledFrame(start_time);
+    SetPowerState(kCameraPowerStandby);
+    if (fb_ == nullptr) {
+        ESP_LOGE(TAG, "Camera capture failed");
+        return false;
+    }
+
+    int64_t captured_time = esp_timer_get_time();
+
+    scene_hash_valid_ = fb_->format == PIXFORMAT_RGB565;
+    if (scene_hash_valid_) {
+        scene_hash_ = ComputeSceneHash(fb_->buf, fb_->width, fb_->height);
     }
 
     // ディスプレイにプレビュー画像を表示
     auto display = Board::GetInstance().GetDisplay();
-    if (display != nullptr) {
+    bool direct = false;
+#if CONFIG_CAMERA_PREVIEW_DIRECT
+    direct = display != nullptr && display->DrawPreviewFrame(fb_->buf, fb_->width, fb_->height);
+#endif
+    if (direct) {
+        // パネルと同じサイズなら変換・縮小なしで直接転送できた
+        ESP_LOGI(TAG, "Preview %dx%d direct: capture %lld ms, display %lld ms", fb_->width, fb_->height,
+            (captured_time - start_time) / 1000, (esp_timer_get_time() - captured_time) / 1000);
+    } else if (display != nullptr) {
+        // プレビュー画像は撮影中だけ作業領域に置き、解析が終われば解放する
+        preview_image_.data = (uint8_t*)AllocateCaptureBuffer(preview_image_.data_size);
+        if (preview_image_.data == nullptr) {
+            return true;
+        }
         auto src = (uint16_t*)fb_->buf;            // カメラフレームデータ（RGB565）
         auto dst = (uint16_t*)preview_image_.data; // プレビュー画像バッファ
         size_t pixel_count = fb_->len / 2;         // 16ビットピクセル数
         
-        // バイトオーダー変換（カメラ→LVGLフォーマット）
-        for (size_t i = 0; i < pixel_count; i++) {
-            // 16ビット内のバイト順序を入れ替え（エンディアン変換）
-            dst[i] = __builtin_bswap16(src[i]);
-        }
+        // バイトオーダー変換（カメラ→LVGLフォーマット、ESP32-S3ではPIEで16画素ずつ処理）
+        audio_dsp::ByteSwap16(src, dst, pixel_count);
         
         // LVGLディスプレイにプレビュー画像を設定
         display->SetPreviewImage(&preview_image_);
+        ESP_LOGI(TAG, "Preview %dx%d via LVGL: capture %lld ms, convert %lld ms", fb_->width, fb_->height,
+            (captured_time - start_time) / 1000, (esp_timer_get_time() - captured_time) / 1000);
+    }
+    return true;
+}
+
+void* Esp32Camera::AllocateCaptureBuffer(size_t bytes) {
+    if (capture_arena_ == nullptr) {
+        capture_arena_ = (uint8_t*)heap_caps_malloc(capture_arena_size_, MALLOC_CAP_SPIRAM);
+        if (capture_arena_ == nullptr) {
+            ESP_LOGE(TAG, "Failed to allocate %u bytes for capture buffers", capture_arena_size_);
+            return nullptr;
+        }
+        capture_arena_used_ = 0;
+    }
+    // PSRAMのキャッシュラインに揃え、並行して使うバッファが同じラインを共有しないようにする
+    bytes = (bytes + 63) & ~63;
+    if (capture_arena_used_ + bytes > capture_arena_size_) {
+        ESP_LOGE(TAG, "Capture buffers exhausted: %u + %u > %u", capture_arena_used_, bytes, capture_arena_size_);
+        return nullptr;
+    }
+    void* buffer = capture_arena_ + capture_arena_used_;
+    capture_arena_used_ += bytes;
+    return buffer;
+}
+
+void Esp32Camera::ReleaseCaptureBuffers() {
+    if (capture_arena_ == nullptr) {
+        return;
+    }
+    // LVGLが参照している間は解放できないため、先にプレビュー画像を外す
+    if (preview_image_.data != nullptr) {
+        auto display = Board::GetInstance().GetDisplay();
+        if (display != nullptr) {
+            display->SetPreviewImage(nullptr);
+        }
+        preview_image_.data = nullptr;
+    }
+    heap_caps_free(capture_arena_);
+    capture_arena_ = nullptr;
+    capture_arena_used_ = 0;
+    ESP_LOGI(TAG, "Released %u KB of capture buffers", capture_arena_size_ / 1024);
+}
+
+void Esp32Camera::SetPowerState(CameraPowerState state) {
+#if CONFIG_CAMERA_STANDBY
+    if (state == power_state_) {
+        return;
+    }
+    sensor_t* s = esp_camera_sensor_get();
+    auto regs = FindSensorPowerRegs(s);
+    if (regs == nullptr) {
+        return;
+    }
+    if (state == kCameraPowerStandby) {
+        standby_settle_valid_ = ReadSettleState(standby_settle_);
+    }
+    if (regs->page_reg >= 0) {
+        s->set_reg(s, regs->page_reg, 0xFF, 0x00);
+    }
+    int value = state == kCameraPowerActive ? regs->output_enable_value : 0x00;
+    if (s->set_reg(s, regs->output_enable_reg, 0xFF, value) != 0) {
+        ESP_LOGW(TAG, "Failed to switch camera to %s", state == kCameraPowerActive ? "active" : "standby");
+        return;
+    }
+    power_state_ = state;
+    ESP_LOGD(TAG, "Camera %s", state == kCameraPowerActive ? "active" : "standby");
+#endif
+}
+
+bool Esp32Camera::ReadSettleState(CameraSettleState& state) {
+    sensor_t* s = esp_camera_sensor_get();
+    auto regs = FindSensorPowerRegs(s);
+    if (regs == nullptr) {
+        return false;
+    }
+    if (regs->page_reg >= 0) {
+        s->set_reg(s, regs->page_reg, 0xFF, 0x00);
+    }
+    int exposure_high = s->get_reg(s, regs->exposure_high_reg, regs->exposure_high_mask);
+    int exposure_low = s->get_reg(s, regs->exposure_low_reg, 0xFF);
+    state.r_gain = s->get_reg(s, regs->awb_r_gain_reg, 0xFF);
+    state.g_gain = s->get_reg(s, regs->awb_g_gain_reg, 0xFF);
+    state.b_gain = s->get_reg(s, regs->awb_b_gain_reg, 0xFF);
+    if (exposure_high < 0 || exposure_low < 0 || state.r_gain < 0 || state.g_gain < 0 || state.b_gain < 0) {
+        return false;
+    }
+    state.exposure = (exposure_high << 8) | exposure_low;
+    return true;
+}
+
+camera_fb_t* Esp32Camera::GetSettledFrame(int64_t since_us) {
+    int64_t start_time = esp_timer_get_time();
+    CameraSettleState previous = standby_settle_;
+    bool has_previous = standby_settle_valid_;
+    int fresh_frames = 0;
+    camera_fb_t* fb = nullptr;
+    for (int i = 0; i < CAMERA_SETTLE_MAX_FRAMES; i++) {
+        if (fb != nullptr) {
+            esp_camera_fb_return(fb);
+        }
+        fb = esp_camera_fb_get();
+        if (fb == nullptr) {
+            return nullptr;
+        }
+        // CAMERA_GRAB_LATESTでは待機前に書かれたフレームが残っていることがある
+        int64_t taken_us = (int64_t)fb->timestamp.tv_sec * 1000000 + fb->timestamp.tv_usec;
+        if (taken_us < since_us) {
+            continue;
+        }
+        fresh_frames++;
+
+        CameraSettleState current;
+        if (!ReadSettleState(current)) {
+            // レジスタを読めないセンサーは従来どおり2フレーム目を使う
+            if (fresh_frames >= 2) {
+                return fb;
+            }
+            continue;
+        }
+        // 前のフレーム（復帰直後は待機に入った時点）から露出とゲインが動いていなければ安定している
+        if (has_previous && abs(current.exposure - previous.exposure) <= CAMERA_SETTLE_EXPOSURE_TOLERANCE &&
+            abs(current.r_gain - previous.r_gain) <= CAMERA_SETTLE_GAIN_TOLERANCE &&
+            abs(current.g_gain - previous.g_gain) <= CAMERA_SETTLE_GAIN_TOLERANCE &&
+            abs(current.b_gain - previous.b_gain) <= CAMERA_SETTLE_GAIN_TOLERANCE) {
+            ESP_LOGI(TAG, "Exposure settled after %d frames in %lld ms", i + 1, (esp_timer_get_time() - start_time) / 1000);
+            return fb;
+        }
+        previous = current;
+        has_previous = true;
+    }
+    ESP_LOGW(TAG, "Exposure not settled after %d frames, using the last one", CAMERA_SETTLE_MAX_FRAMES);
+    return fb;
+}
+
+bool Esp32Camera::Reinitialize(const camera_config_t& config) {
+    sensor_t* s = esp_camera_sensor_get();
+    int hmirror = s != nullptr ? s->status.hmirror : 0;
+    int vflip = s != nullptr ? s->status.vflip : 0;
+
+    esp_camera_deinit();
+    esp_err_t err = esp_camera_init(&config);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Camera reinit failed with error 0x%x", err);
+        return false;
+    }
+    s = esp_camera_sensor_get();
+    s->set_hmirror(s, hmirror);
+    s->set_vflip(s, vflip);
+    pixel_format_ = config.pixel_format;
+    // 再初期化したセンサーは出力中で、露出も初めから合わせ直す
+    power_state_ = kCameraPowerActive;
+    standby_settle_valid_ = false;
+    return true;
+}
+
+void Esp32Camera::EnsurePreviewMode() {
+    if (pixel_format_ != config_.pixel_format) {
+        Reinitialize(config_);
+    }
+}
+
+camera_fb_t* Esp32Camera::CaptureJpeg(ExplainDetail detail) {
+    // 再初期化でドライバのフレームバッファは解放される。プレビュー画像は別バッファにコピー済み
+    if (fb_ != nullptr) {
+        esp_camera_fb_return(fb_);
+        fb_ = nullptr;
+    }
+
+    camera_config_t config = config_;
+    config.pixel_format = PIXFORMAT_JPEG;
+    config.jpeg_quality = detail == kExplainDetailLow ? CAMERA_NATIVE_JPEG_LOW_QUALITY : CAMERA_NATIVE_JPEG_QUALITY;
+    if (detail == kExplainDetailLow) {
+        if (config.frame_size == FRAMESIZE_VGA) {
+            config.frame_size = FRAMESIZE_QVGA;
+        } else if (config.frame_size == FRAMESIZE_QVGA) {
+            config.frame_size = FRAMESIZE_QQVGA;
+        }
+    }
+    if (!Reinitialize(config)) {
+        Reinitialize(config_);
+        return nullptr;
+    }
+
+    // 再初期化直後は露出が安定していないため、Capture()と同様に安定するまで待つ
+    int64_t start_time = esp_timer_get_time();
+    camera_fb_t* fb = GetSettledFrame(start_time);
+    SetPowerState(kCameraPowerStandby);
+    if (fb == nullptr) {
+        ESP_LOGE(TAG, "JPEG capture failed");
+        return nullptr;
+    }
+    ESP_LOGI(TAG, "Sensor JPEG %dx%d: %u bytes in %lld ms", fb->width, fb->height, fb->len,
+        (esp_timer_get_time() - start_time) / 1000);
+    return fb;
+}
+
+bool Esp32Camera::StartViewfinder(int fps) {
+    fps = std::clamp(fps, 1, CAMERA_VIEWFINDER_MAX_FPS);
+    viewfinder_fps_ = fps;
+    if (viewfinder_task_ != nullptr) {
+        return true;
+    }
+
+    auto display = Board::GetInstance().GetDisplay();
+    if (display == nullptr || !display->SupportsPreviewFrame(preview_image_.header.w, preview_image_.header.h)) {
+        ESP_LOGW(TAG, "Viewfinder needs a %dx%d display with direct drawing", preview_image_.header.w, preview_image_.header.h);
+        return false;
+    }
+
+    // 撮影済みのフレームを持ったままだとドライバが使えるバッファが減るため返却する
+    if (encoder_thread_.joinable()) {
+        encoder_thread_.join();
     }
+    if (fb_ != nullptr) {
+        esp_camera_fb_return(fb_);
+        fb_ = nullptr;
+    }
+    EnsurePreviewMode();
+    SetPowerState(kCameraPowerActive);
+
+    viewfinder_running_ = true;
+    TaskHandle_t handle = nullptr;
+    if (xTaskCreate([](void* arg) {
+        auto camera = (Esp32Camera*)arg;
+        camera->ViewfinderLoop();
+        camera->viewfinder_task_ = nullptr;
+        vTaskDelete(NULL);
+    }, "viewfinder", 4096, this, CAMERA_VIEWFINDER_TASK_PRIORITY, &handle) != pdPASS) {
+        viewfinder_running_ = false;
+        SetPowerState(kCameraPowerStandby);
+        ESP_LOGE(TAG, "Failed to create viewfinder task");
+        return false;
+    }
+    viewfinder_task_ = handle;
+    ESP_LOGI(TAG, "Viewfinder started at %d fps", fps);
     return true;
 }
+
+void Esp32Camera::StopViewfinder() {
+    if (viewfinder_task_ == nullptr) {
+        return;
+    }
+    viewfinder_running_ = false;
+    while (viewfinder_task_ != nullptr) {
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+    SetPowerState(kCameraPowerStandby);
+    auto display = Board::GetInstance().GetDisplay();
+    if (display != nullptr) {
+        display->EndPreviewFrames();
+    }
+    ESP_LOGI(TAG, "Viewfinder stopped");
+}
+
+void Esp32Camera::ViewfinderLoop() {
+    auto display = Board::GetInstance().GetDisplay();
+    TickType_t last_wake = xTaskGetTickCount();
+    uint32_t frames = 0;
+    uint32_t dropped = 0;
+    int64_t capture_us = 0;
+    int64_t draw_us = 0;
+    int64_t stats_start = esp_timer_get_time();
+
+    while (viewfinder_running_) {
+        int64_t start = esp_timer_get_time();
+        camera_fb_t* fb = esp_camera_fb_get();
+        int64_t captured = esp_timer_get_time();
+        if (fb != nullptr) {
+            // LVGLが描画中なら待たずに捨てる。待つとバッファを握ったまま次のフレームも遅れる
+            bool drawn = display->DrawPreviewFrame(fb->buf, fb->width, fb->height, 0);
+            // 描画は内部RAMへのコピーを終えてから戻るため、すぐ返してセンサーに次を書かせる
+            esp_camera_fb_return(fb);
+            if (drawn) {
+                frames++;
+                capture_us += captured - start;
+                draw_us += esp_timer_get_time() - captured;
+            } else {
+                dropped++;
+            }
+        } else {
+            dropped++;
+        }
+
+        int64_t elapsed = esp_timer_get_time() - stats_start;
+        if (elapsed >= CAMERA_VIEWFINDER_STATS_INTERVAL_MS * 1000) {
+            int fps10 = frames * 10000000LL / elapsed;
+            ESP_LOGI(TAG, "Viewfinder: %d.%d fps (target %d), dropped %lu, capture %lld us, draw %lld us",
+                fps10 / 10, fps10 % 10, viewfinder_fps_.load(), dropped,
+                frames > 0 ? capture_us / frames : 0, frames > 0 ? draw_us / frames : 0);
+            frames = 0;
+            dropped = 0;
+            capture_us = 0;
+            draw_us = 0;
+            stats_start = esp_timer_get_time();
+        }
+
+        // 目標周期で起きる。遅れている場合は待たずに次のフレームへ進む
+        xTaskDelayUntil(&last_wake, std::max<TickType_t>(1, pdMS_TO_TICKS(1000 / viewfinder_fps_)));
+    }
+}
+
 /**
  * @brief 水平ミラー（左右反転）の設定
  * @param enabled trueでミラー有効、falseで無効
@@ -208,6 +620,30 @@ bool Esp32Camera::SetVFlip(bool enabled) {
     return true;
 }
 
+/**
+ * @brief RGB565（ビッグエンディアン）画像を2x2平均で縦横1/2に縮小
+ */
+static void DownscaleRgb565Half(const uint8_t* src, int width, int height, uint8_t* dst) {
+    auto pixel = [src, width](int x, int y) -> uint16_t {
+        const uint8_t* p = src + (y * width + x) * 2;
+        return (p[0] << 8) | p[1];
+    };
+    for (int y = 0; y < height / 2; y++) {
+        for (int x = 0; x < width / 2; x++) {
+            uint16_t p[4] = { pixel(x * 2, y * 2), pixel(x * 2 + 1, y * 2), pixel(x * 2, y * 2 + 1), pixel(x * 2 + 1, y * 2 + 1) };
+            int r = 0, g = 0, b = 0;
+            for (auto v : p) {
+                r += v >> 11;
+                g += (v >> 5) & 0x3F;
+                b += v & 0x1F;
+            }
+            uint16_t out = ((r / 4) << 11) | ((g / 4) << 5) | (b / 4);
+            *dst++ = out >> 8;
+            *dst++ = out & 0xFF;
+        }
+    }
+}
+
 /**
  * @brief 将摄像头捕获的图像发送到远程服务器进行AI分析和解释
  * 
@@ -231,31 +667,136 @@ bool Esp32Camera::SetVFlip(bool enabled) {
  * @note 函数会等待之前的编码线程完成后再开始新的处理
  * @warning 如果摄像头缓冲区为空或网络连接失败，将返回错误信息
  */
-std::string Esp32Camera::Explain(const std::string& question) {
+std::string Esp32Camera::Explain(const std::string& question, ExplainDetail detail) {
+#if CONFIG_CAMERA_EXPLAIN_CACHE_SECONDS > 0
+    // 同じ場面への同じ質問はアップロードせずに前回の回答を返す
+    std::string cached;
+    if (FindCachedAnswer(question, detail, cached)) {
+        ReleaseCaptureBuffers();
+        return cached;
+    }
+#endif
+    std::string result = ExplainCapture(question, detail);
+#if CONFIG_CAMERA_EXPLAIN_CACHE_SECONDS > 0
+    StoreAnswer(question, detail, result);
+#endif
+    // 撮影から解析までの作業領域（プレビュー画像・縮小画像）を返し、他の用途に回す
+    ReleaseCaptureBuffers();
+    return result;
+}
+
+bool Esp32Camera::FindCachedAnswer(const std::string& question, ExplainDetail detail, std::string& answer) {
+    if (!scene_hash_valid_) {
+        return false;
+    }
+    int64_t now = esp_timer_get_time();
+    explain_cache_.remove_if([now](const ExplainCacheEntry& entry) {
+        return now - entry.time_us > CONFIG_CAMERA_EXPLAIN_CACHE_SECONDS * 1000000LL;
+    });
+    for (auto& entry : explain_cache_) {
+        int distance = __builtin_popcountll(entry.scene_hash ^ scene_hash_);
+        // 通常の詳細度で得た回答は低詳細の質問にも使える
+        if (distance <= CAMERA_SCENE_HASH_THRESHOLD && entry.detail <= detail && entry.question == question) {
+            ESP_LOGI(TAG, "Reusing answer from %lld s ago (scene distance %d): %s", (now - entry.time_us) / 1000000,
+                distance, question.c_str());
+            answer = entry.answer;
+            return true;
+        }
+    }
+    return false;
+}
+
+void Esp32Camera::StoreAnswer(const std::string& question, ExplainDetail detail, const std::string& answer) {
+    if (!scene_hash_valid_) {
+        return;
+    }
+    // サーバーが成功を返した回答だけを保存する
+    cJSON* json = cJSON_Parse(answer.c_str());
+    bool success = json != nullptr && cJSON_IsTrue(cJSON_GetObjectItem(json, "success"));
+    cJSON_Delete(json);
+    if (!success) {
+        return;
+    }
+    explain_cache_.push_front({scene_hash_, esp_timer_get_time(), detail, question, answer});
+    if (explain_cache_.size() > CAMERA_EXPLAIN_CACHE_ENTRIES) {
+        explain_cache_.pop_back();
+    }
+}
+
+std::string Esp32Camera::ExplainCapture(const std::string& question, ExplainDetail detail) {
     if (explain_url_.empty()) {
         return "{\"success\": false, \"message\": \"Image explain URL or token is not set\"}";
     }
+    if (fb_ == nullptr && !native_jpeg_) {
+        return "{\"success\": false, \"message\": \"No photo has been captured\"}";
+    }
+    int64_t start_time = esp_timer_get_time();
+
+    // 传感器可直接输出 JPEG 时，不做软件编码，直接发送该帧
+    camera_fb_t* jpeg_fb = nullptr;
+    if (native_jpeg_) {
+        jpeg_fb = CaptureJpeg(detail);
+        if (jpeg_fb == nullptr) {
+            return "{\"success\": false, \"message\": \"Failed to capture JPEG\"}";
+        }
+    }
+
+    // 创建局部的 JPEG 队列，满时编码线程阻塞等待发送（背压）
+    QueueHandle_t jpeg_queue = nullptr;
+    if (jpeg_fb == nullptr) {
+        jpeg_queue = xQueueCreate(CAMERA_JPEG_QUEUE_LENGTH, sizeof(JpegChunk));
+        if (jpeg_queue == nullptr) {
+            ESP_LOGE(TAG, "Failed to create JPEG queue");
+            return "{\"success\": false, \"message\": \"Failed to create JPEG queue\"}";
+        }
+    }
 
-    // 创建局部的 JPEG 队列, 40 entries is about to store 512 * 40 = 20480 bytes of JPEG data
-    QueueHandle_t jpeg_queue = xQueueCreate(40, sizeof(JpegChunk));
-    if (jpeg_queue == nullptr) {
-        ESP_LOGE(TAG, "Failed to create JPEG queue");
-        return "{\"success\": false, \"message\": \"Failed to create JPEG queue\"}";
+    // 低详细度：先缩小为 1/2 再编码，JPEG 体积约为原来的 1/4
+    int width = jpeg_fb != nullptr ? jpeg_fb->width : fb_->width;
+    int height = jpeg_fb != nullptr ? jpeg_fb->height : fb_->height;
+    int quality = CAMERA_EXPLAIN_JPEG_QUALITY;
+    uint8_t* scaled = nullptr;
+    if (jpeg_fb == nullptr && detail == kExplainDetailLow) {
+        quality = CAMERA_EXPLAIN_LOW_JPEG_QUALITY;
+        if (fb_->format == PIXFORMAT_RGB565) {
+            scaled = (uint8_t*)AllocateCaptureBuffer((width / 2) * (height / 2) * 2);
+        }
+        if (scaled != nullptr) {
+            DownscaleRgb565Half(fb_->buf, width, height, scaled);
+            width /= 2;
+            height /= 2;
+        }
     }
 
     // We spawn a thread to encode the image to JPEG
-    encoder_thread_ = std::thread([this, jpeg_queue]() {
-        frame2jpg_cb(fb_, 80, [](void* arg, size_t index, const void* data, size_t len) -> unsigned int {
-            auto jpeg_queue = (QueueHandle_t)arg;
-            JpegChunk chunk = {
-                .data = (uint8_t*)heap_caps_malloc(len, MALLOC_CAP_SPIRAM),
-                .len = len
+    if (jpeg_fb == nullptr) {
+        encoder_thread_ = std::thread([this, jpeg_queue, scaled, width, height, quality]() {
+            int64_t encode_start = esp_timer_get_time();
+            auto on_chunk = [](void* arg, size_t index, const void* data, size_t len) -> unsigned int {
+                if (len == 0) {
+                    return 0;
+                }
+                auto jpeg_queue = (QueueHandle_t)arg;
+                JpegChunk chunk = {
+                    .data = (uint8_t*)heap_caps_malloc(len, MALLOC_CAP_SPIRAM),
+                    .len = len
+                };
+                memcpy(chunk.data, data, len);
+                xQueueSend(jpeg_queue, &chunk, portMAX_DELAY);
+                return len;
             };
-            memcpy(chunk.data, data, len);
-            xQueueSend(jpeg_queue, &chunk, portMAX_DELAY);
-            return len;
-        }, jpeg_queue);
-    });
+            if (scaled != nullptr) {
+                fmt2jpg_cb(scaled, width * height * 2, width, height, PIXFORMAT_RGB565, quality, on_chunk, jpeg_queue);
+            } else {
+                frame2jpg_cb(fb_, quality, on_chunk, jpeg_queue);
+            }
+            ESP_LOGI(TAG, "JPEG encode %dx%d quality %d: %lld ms", width, height, quality,
+                (esp_timer_get_time() - encode_start) / 1000);
+            // 结束标记
+            JpegChunk end = { .data = nullptr, .len = 0 };
+            xQueueSend(jpeg_queue, &end, portMAX_DELAY);
+        });
+    }
 
     auto http = Board::GetInstance().CreateHttp();
     // 构造multipart/form-data请求体
@@ -289,6 +830,10 @@ std::string Esp32Camera::Explain(const std::string& question) {
     http->SetHeader("Transfer-Encoding", "chunked");
     if (!http->Open("POST", explain_url_)) {
         ESP_LOGE(TAG, "Failed to connect to explain URL");
+        if (jpeg_fb != nullptr) {
+            esp_camera_fb_return(jpeg_fb);
+            return "{\"success\": false, \"message\": \"Failed to connect to explain URL\"}";
+        }
         // Clear the queue
         encoder_thread_.join();
         JpegChunk chunk;
@@ -310,24 +855,51 @@ std::string Esp32Camera::Explain(const std::string& question) {
     http->Write(file_header.c_str(), file_header.size());
     
     // 第三块：JPEG数据
+    // 编码器每次只输出几百字节，逐个写入会产生大量小的 chunk 和 TLS 记录。
+    // 队列中已有数据时不等待地取出，合并到 CAMERA_UPLOAD_BATCH_BYTES 再写入
     size_t total_sent = 0;
-    while (true) {
+    std::vector<char> batch;
+    bool done = false;
+    if (jpeg_fb != nullptr) {
+        // センサーのJPEGはすでに1つのバッファにあるため、同じ大きさに区切って送る
+        while (total_sent < jpeg_fb->len) {
+            size_t size = std::min<size_t>(CAMERA_UPLOAD_BATCH_BYTES, jpeg_fb->len - total_sent);
+            http->Write((const char*)jpeg_fb->buf + total_sent, size);
+            total_sent += size;
+        }
+        esp_camera_fb_return(jpeg_fb);
+        done = true;
+    } else {
+        batch.reserve(CAMERA_UPLOAD_BATCH_BYTES);
+    }
+    while (!done) {
         JpegChunk chunk;
-        if (xQueueReceive(jpeg_queue, &chunk, portMAX_DELAY) != pdPASS) {
-            ESP_LOGE(TAG, "Failed to receive JPEG chunk");
-            break;
+        TickType_t wait = batch.empty() ? portMAX_DELAY : 0;
+        if (xQueueReceive(jpeg_queue, &chunk, wait) != pdPASS) {
+            // 编码器暂时跟不上，先把已有的数据发出去
+            http->Write(batch.data(), batch.size());
+            total_sent += batch.size();
+            batch.clear();
+            continue;
         }
         if (chunk.data == nullptr) {
-            break; // The last chunk
+            done = true; // The last chunk
+        } else {
+            batch.insert(batch.end(), chunk.data, chunk.data + chunk.len);
+            heap_caps_free(chunk.data);
+        }
+        if (!batch.empty() && (done || batch.size() >= CAMERA_UPLOAD_BATCH_BYTES)) {
+            http->Write(batch.data(), batch.size());
+            total_sent += batch.size();
+            batch.clear();
         }
-        http->Write((const char*)chunk.data, chunk.len);
-        total_sent += chunk.len;
-        heap_caps_free(chunk.data);
     }
-    // Wait for the encoder thread to finish
-    encoder_thread_.join();
-    // 清理队列
-    vQueueDelete(jpeg_queue);
+    if (jpeg_queue != nullptr) {
+        // Wait for the encoder thread to finish
+        encoder_thread_.join();
+        // 清理队列
+        vQueueDelete(jpeg_queue);
+    }
 
     // 第四块：multipart尾部
     http->Write(multipart_footer.c_str(), multipart_footer.size());
@@ -343,6 +915,8 @@ std::string Esp32Camera::Explain(const std::string& question) {
     std::string result = http->ReadAll();
     http->Close();
 
-    ESP_LOGI(TAG, "Explain image size=%dx%d, compressed size=%d, question=%s\n%s", fb_->width, fb_->height, total_sent, question.c_str(), result.c_str());
+    ESP_LOGI(TAG, "Explain image size=%dx%d, %s JPEG, compressed size=%u, %lld ms, question=%s\n%s", width, height,
+        jpeg_queue != nullptr ? "software" : "sensor", total_sent, (esp_timer_get_time() - start_time) / 1000,
+        question.c_str(), result.c_str());
     return result;
 }
@@ -12,12 +12,81 @@
 #include <lvgl.h>
 #include <thread>
 #include <memory>
+#include <atomic>
+#include <list>
+#include <string>
 
 #include <freertos/FreeRTOS.h>
 #include <freertos/queue.h>
+#include <freertos/task.h>
 
 #include "camera.h"
 
+/** @brief 画像解析用JPEGの画質（通常 / 低詳細） */
+#define CAMERA_EXPLAIN_JPEG_QUALITY 80
+#define CAMERA_EXPLAIN_LOW_JPEG_QUALITY 50
+
+/** @brief センサーJPEGの画質（esp32-cameraの0〜63、小さいほど高画質） */
+#define CAMERA_NATIVE_JPEG_QUALITY 12
+#define CAMERA_NATIVE_JPEG_LOW_QUALITY 20
+
+/** @brief エンコーダーと送信の間に置くJPEG断片の数（満杯になるとエンコーダーが待つ） */
+#define CAMERA_JPEG_QUEUE_LENGTH 40
+
+/** @brief 1回のHTTP書き込み（チャンク / TLSレコード）にまとめる最大バイト数 */
+#define CAMERA_UPLOAD_BATCH_BYTES 4096
+
+/** @brief ライブビュータスクの優先度（音声タスクより低く、フレームの遅れより音切れを避ける） */
+#define CAMERA_VIEWFINDER_TASK_PRIORITY 2
+
+/** @brief 達成フレームレートと各段の時間をログに出す間隔 */
+#define CAMERA_VIEWFINDER_STATS_INTERVAL_MS 5000
+
+/** @brief 露出が安定するまでに捨てるフレームの上限（超えたらその時点のフレームを使う） */
+#define CAMERA_SETTLE_MAX_FRAMES 8
+
+/** @brief 露出・ホワイトバランスの安定とみなす前フレームからの変化量（レジスタ値の差） */
+#define CAMERA_SETTLE_EXPOSURE_TOLERANCE 8
+#define CAMERA_SETTLE_GAIN_TOLERANCE 2
+
+/** @brief 同じ場面とみなす知覚ハッシュ（64ビット）の異なるビット数の上限 */
+#define CAMERA_SCENE_HASH_THRESHOLD 6
+
+/** @brief 保持する画像解析の回答の数 */
+#define CAMERA_EXPLAIN_CACHE_ENTRIES 4
+
+/**
+ * @struct ExplainCacheEntry
+ * @brief 画像解析の回答のキャッシュ（場面のハッシュと質問が同じなら再利用する）
+ */
+struct ExplainCacheEntry {
+    uint64_t scene_hash;
+    int64_t time_us;
+    ExplainDetail detail;
+    std::string question;
+    std::string answer;
+};
+
+/**
+ * @enum CameraPowerState
+ * @brief センサーの電源状態
+ */
+enum CameraPowerState {
+    kCameraPowerActive,     /**< フレームを出力中 */
+    kCameraPowerStandby,    /**< 出力を止めて待機（露出・ホワイトバランスの状態は保持） */
+};
+
+/**
+ * @struct CameraSettleState
+ * @brief 露出・ホワイトバランスの安定判定に使うセンサーのレジスタ値
+ */
+struct CameraSettleState {
+    int exposure;
+    int r_gain;
+    int g_gain;
+    int b_gain;
+};
+
 /**
  * @struct JpegChunk
  * @brief JPEG データの断片を表す構造体
@@ -39,8 +108,40 @@ private:
     /** @brief 現在のカメラフレームバッファ */
     camera_fb_t* fb_ = nullptr;
     
-    /** @brief LVGLディスプレイ用画像記述子 */
+    /** @brief LVGLディスプレイ用画像記述子（dataは撮影中だけ作業領域を指す） */
     lv_img_dsc_t preview_image_;
+
+    /**
+     * @brief 撮影中だけ確保するPSRAMの作業領域
+     *
+     * プレビュー画像と画像解析用の縮小画像で1つの領域を共有し、
+     * Capture()で確保してExplain()の終わりに解放します。
+     */
+    uint8_t* capture_arena_ = nullptr;
+    size_t capture_arena_size_ = 0;
+    size_t capture_arena_used_ = 0;
+
+    /** @brief 作業領域からバッファを割り当てる（必要なら作業領域を確保） */
+    void* AllocateCaptureBuffer(size_t bytes);
+
+    /** @brief プレビュー画像を外して作業領域を解放 */
+    void ReleaseCaptureBuffers();
+
+    /** @brief Explain()の本体（作業領域の解放は呼び出し側で行う） */
+    std::string ExplainCapture(const std::string& question, ExplainDetail detail);
+
+    /** @brief 最後に撮影したフレームの知覚ハッシュ（dHash） */
+    uint64_t scene_hash_ = 0;
+    bool scene_hash_valid_ = false;
+
+    /** @brief 画像解析の回答（先頭ほど新しい） */
+    std::list<ExplainCacheEntry> explain_cache_;
+
+    /** @brief 同じ場面・同じ質問への回答が有効期間内にあれば取り出す */
+    bool FindCachedAnswer(const std::string& question, ExplainDetail detail, std::string& answer);
+
+    /** @brief 成功した回答を現在の場面のハッシュと一緒に保存 */
+    void StoreAnswer(const std::string& question, ExplainDetail detail, const std::string& answer);
     
     /** @brief AI画像解析APIのURL */
     std::string explain_url_;
@@ -51,6 +152,57 @@ private:
     /** @brief JPEG エンコード処理用スレッド */
     std::thread encoder_thread_;
 
+    /** @brief 初期化時の設定（プレビュー用のRGB565） */
+    camera_config_t config_;
+
+    /** @brief 現在ドライバに設定しているピクセル形式 */
+    pixformat_t pixel_format_ = PIXFORMAT_RGB565;
+
+    /** @brief センサーがJPEGを直接出力できる（画像解析ではソフトウェアエンコードを省く） */
+    bool native_jpeg_ = false;
+
+    /** @brief センサーの電源状態 */
+    CameraPowerState power_state_ = kCameraPowerActive;
+
+    /** @brief 待機に入った時点のレジスタ値（復帰後の最初のフレームと比べる） */
+    CameraSettleState standby_settle_ = {};
+    bool standby_settle_valid_ = false;
+
+    /**
+     * @brief センサーを待機させる / 復帰させる
+     *
+     * 待機中はセンサーの出力を止め、ドライバのDMAがPSRAMへフレームを書き続けないようにします。
+     * 待機に対応しないセンサーでは何もしません。
+     */
+    void SetPowerState(CameraPowerState state);
+
+    /** @brief 露出・ホワイトバランスのレジスタ値を読む（対応しないセンサーはfalse） */
+    bool ReadSettleState(CameraSettleState& state);
+
+    /**
+     * @brief 露出とホワイトバランスが安定したフレームを取得
+     * @param since_us この時刻より前に撮られたフレーム（待機前の古いもの）は捨てる
+     * @return 取得したフレーム（呼び出し側がesp_camera_fb_returnする）。失敗時nullptr
+     */
+    camera_fb_t* GetSettledFrame(int64_t since_us);
+
+    /** @brief 設定を変えてドライバを再初期化（ミラー・フリップの状態は引き継ぐ） */
+    bool Reinitialize(const camera_config_t& config);
+
+    /** @brief JPEGモードに切り替えていればプレビュー用のRGB565に戻す */
+    void EnsurePreviewMode();
+
+    /** @brief センサーのJPEG出力で1フレームを取得（呼び出し側がesp_camera_fb_returnする） */
+    camera_fb_t* CaptureJpeg(ExplainDetail detail);
+
+    /** @brief ライブビュータスク（停止時にタスク自身がnullptrに戻す） */
+    std::atomic<TaskHandle_t> viewfinder_task_{nullptr};
+    std::atomic<bool> viewfinder_running_{false};
+    std::atomic<int> viewfinder_fps_{0};
+
+    /** @brief フレームを取得してパネルへ直接描画し、すぐにドライバへ返す */
+    void ViewfinderLoop();
+
 public:
     /**
      * @brief ESP32カメラのコンストラクタ
@@ -108,13 +260,26 @@ public:
     /**
      * @brief AI による画像説明生成
      * @param question 画像に対する質問文
+     * @param detail kExplainDetailLowなら縦横1/2に縮小し、低画質でエンコードする
      * @return std::string AI生成の画像説明文
      * 
      * 最後にキャプチャした画像をJPEG形式でAIサーバーに送信し、
      * 指定された質問に対する回答を画像説明として取得します。
+     * エンコードは別スレッドで行い、接続確立やTLS送信と並行して進みます。
      * ネットワーク接続とAI API の設定が必要です。
      */
-    virtual std::string Explain(const std::string& question) override;
+    virtual std::string Explain(const std::string& question, ExplainDetail detail = kExplainDetailNormal) override;
+
+    /**
+     * @brief ライブビューを開始
+     *
+     * フレームがパネルと同じサイズで、ディスプレイが直接描画に対応している場合のみ動作します。
+     * LVGLが描画中のフレームは待たずに捨て、フレームバッファはコピー後すぐに返却します。
+     * フレームバッファを2つ（fb_count=2、CAMERA_GRAB_LATEST）にしておくと、
+     * 描画中もセンサーが次のフレームを書き込めます。
+     */
+    virtual bool StartViewfinder(int fps) override;
+    virtual void StopViewfinder() override;
 };
 
 #endif // ESP32_CAMERA_H
\ No newline at end of file
@@ -0,0 +1,123 @@
+#include "i2c_bus_scheduler.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#define TAG "I2cBusScheduler"
+
+static const char* const kPriorityNames[kI2cPriorityCount] = {
+    "codec", "touch", "telemetry"
+};
+
+static std::mutex registry_mutex;
+static i2c_master_bus_handle_t registry_buses[I2C_BUS_SCHEDULER_MAX_BUSES] = {};
+static I2cBusScheduler* registry_schedulers[I2C_BUS_SCHEDULER_MAX_BUSES] = {};
+
+I2cBusScheduler* I2cBusScheduler::For(i2c_master_bus_handle_t bus) {
+    if (bus == nullptr) {
+        return nullptr;
+    }
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    for (int i = 0; i < I2C_BUS_SCHEDULER_MAX_BUSES; ++i) {
+        if (registry_buses[i] == bus) {
+            return registry_schedulers[i];
+        }
+        if (registry_buses[i] == nullptr) {
+            auto scheduler = new I2cBusScheduler();
+            scheduler->index_ = i;
+            scheduler->window_start_us_ = esp_timer_get_time();
+            registry_buses[i] = bus;
+            registry_schedulers[i] = scheduler;
+            return scheduler;
+        }
+    }
+    ESP_LOGW(TAG, "Too many I2C buses, transactions on %p are not scheduled", bus);
+    return nullptr;
+}
+
+void I2cBusScheduler::PrintAllStats() {
+    I2cBusScheduler* schedulers[I2C_BUS_SCHEDULER_MAX_BUSES];
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        for (int i = 0; i < I2C_BUS_SCHEDULER_MAX_BUSES; ++i) {
+            schedulers[i] = registry_schedulers[i];
+        }
+    }
+    for (auto scheduler : schedulers) {
+        if (scheduler != nullptr) {
+            scheduler->PrintStats();
+        }
+    }
+}
+
+bool I2cBusScheduler::HigherWaiting(I2cPriority priority) const {
+    for (int i = 0; i < priority; ++i) {
+        if (waiting_[i] > 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void I2cBusScheduler::Acquire(I2cPriority priority) {
+    int64_t start = esp_timer_get_time();
+    std::unique_lock<std::mutex> lock(mutex_);
+    waiting_[priority]++;
+    cv_.wait(lock, [this, priority]() {
+        return !busy_ && !HigherWaiting(priority);
+    });
+    waiting_[priority]--;
+    busy_ = true;
+    owner_ = priority;
+    grant_us_ = esp_timer_get_time();
+
+    auto& stats = stats_[priority];
+    uint32_t wait_us = grant_us_ - start;
+    stats.count++;
+    stats.total_wait_us += wait_us;
+    if (wait_us > stats.max_wait_us) {
+        stats.max_wait_us = wait_us;
+    }
+}
+
+void I2cBusScheduler::Release() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stats_[owner_].busy_us += esp_timer_get_time() - grant_us_;
+        busy_ = false;
+    }
+    // 待っているクラスが混在するため全員を起こし、条件を満たす1件だけが使用権を得る
+    cv_.notify_all();
+}
+
+void I2cBusScheduler::PrintStats() {
+    Stats snapshot[kI2cPriorityCount];
+    int64_t elapsed_us;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        int64_t now = esp_timer_get_time();
+        elapsed_us = now - window_start_us_;
+        window_start_us_ = now;
+        for (int i = 0; i < kI2cPriorityCount; ++i) {
+            snapshot[i] = stats_[i];
+            stats_[i] = Stats();
+        }
+    }
+    uint64_t busy_us = 0;
+    for (auto& stats : snapshot) {
+        busy_us += stats.busy_us;
+    }
+    if (busy_us == 0 || elapsed_us <= 0) {
+        return;
+    }
+    ESP_LOGI(TAG, "Bus %d: utilization %llu.%llu%%", index_,
+        busy_us * 100 / elapsed_us, busy_us * 1000 / elapsed_us % 10);
+    for (int i = 0; i < kI2cPriorityCount; ++i) {
+        auto& stats = snapshot[i];
+        if (stats.count == 0) {
+            continue;
+        }
+        ESP_LOGI(TAG, "Bus %d %s: %lu transactions, busy %lluus, avg wait %lluus, max wait %luus", index_,
+            kPriorityNames[i], stats.count, stats.busy_us, stats.total_wait_us / stats.count, stats.max_wait_us);
+    }
+}
@@ -0,0 +1,109 @@
+/**
+ * @file i2c_bus_scheduler.h
+ * @brief 共有I2Cバスの優先度付きトランザクション調停
+ *
+ * 1本のi2c_master_bus_handle_tにPMIC、IOエキスパンダ、タッチ、コーデックが
+ * つながっている場合、ドライバのバスロックは先着順のため、コーデックの音量変更が
+ * 電池残量の読み取りの後ろで待たされることがあります。このクラスはトランザクション単位で
+ * バスの使用権を優先度クラスの高い順に渡し、待ち時間とバス使用率を記録します。
+ */
+#ifndef I2C_BUS_SCHEDULER_H
+#define I2C_BUS_SCHEDULER_H
+
+#include <driver/i2c_master.h>
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+/** @brief 管理できるI2Cバスの数 */
+#define I2C_BUS_SCHEDULER_MAX_BUSES 2
+
+/**
+ * @enum I2cPriority
+ * @brief バス使用権の優先度クラス（値が小さいほど先に使用権を得る）
+ */
+enum I2cPriority {
+    kI2cPriorityCodec,          // コーデック制御（音量、入出力の開始/停止）
+    kI2cPriorityTouch,          // タッチ座標の読み取り
+    kI2cPriorityTelemetry,      // PMICの電池残量などの定期読み取り（I2cDeviceの既定）
+    kI2cPriorityCount
+};
+
+/**
+ * @class I2cBusScheduler
+ * @brief バスごとの使用権の調停器
+ *
+ * 実行中のトランザクションは中断しません。使用権が空いた時点で待っている中で
+ * 最も優先度の高いクラスに渡し、同じクラス内の順序はOSの待ち行列に従います。
+ * 使用権は再入できないため、Guardの中で同じバスのGuardを取らないでください。
+ */
+class I2cBusScheduler {
+public:
+    /** @brief 優先度クラスごとの統計 */
+    struct Stats {
+        uint32_t count = 0;             /**< 使用権を得た回数 */
+        uint64_t total_wait_us = 0;     /**< 合計待ち時間 */
+        uint32_t max_wait_us = 0;       /**< 最大待ち時間 */
+        uint64_t busy_us = 0;           /**< 使用権を保持していた合計時間 */
+    };
+
+    /**
+     * @class Guard
+     * @brief スコープの間バスの使用権を保持する
+     */
+    class Guard {
+    public:
+        Guard(I2cBusScheduler* scheduler, I2cPriority priority) : scheduler_(scheduler) {
+            if (scheduler_ != nullptr) {
+                scheduler_->Acquire(priority);
+            }
+        }
+        ~Guard() {
+            if (scheduler_ != nullptr) {
+                scheduler_->Release();
+            }
+        }
+        Guard(const Guard&) = delete;
+        Guard& operator=(const Guard&) = delete;
+
+    private:
+        I2cBusScheduler* scheduler_;
+    };
+
+    /**
+     * @brief バスに対応する調停器を取得（初回呼び出しで作成）
+     * @return 管理できるバス数を超えた場合nullptr（調停なしで動作する）
+     */
+    static I2cBusScheduler* For(i2c_master_bus_handle_t bus);
+
+    /** @brief 全バスの統計をログに出力してリセット */
+    static void PrintAllStats();
+
+    I2cBusScheduler(const I2cBusScheduler&) = delete;
+    I2cBusScheduler& operator=(const I2cBusScheduler&) = delete;
+
+    void Acquire(I2cPriority priority);
+    void Release();
+
+    /** @brief 統計をログに出力してリセット */
+    void PrintStats();
+
+private:
+    I2cBusScheduler() = default;
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool busy_ = false;
+    I2cPriority owner_ = kI2cPriorityTelemetry;     /**< 使用権を保持しているクラス */
+    int64_t grant_us_ = 0;                          /**< 使用権を渡した時刻 */
+    int waiting_[kI2cPriorityCount] = {};           /**< クラスごとの待ち数 */
+    Stats stats_[kI2cPriorityCount];
+    int64_t window_start_us_ = 0;                   /**< 統計の集計開始時刻 */
+    int index_ = 0;
+
+    /** @brief 自分より優先度の高いクラスが待っているか */
+    bool HigherWaiting(I2cPriority priority) const;
+};
+
+#endif // I2C_BUS_SCHEDULER_H
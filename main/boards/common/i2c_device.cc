@@ -38,6 +38,7 @@ I2cDevice::I2cDevice(i2c_master_bus_handle_t i2c_bus, uint8_t addr) {
     // デバイスをI2Cマスターバスに追加
     ESP_ERROR_CHECK(i2c_master_bus_add_device(i2c_bus, &i2c_device_cfg, &i2c_device_));
     assert(i2c_device_ != NULL);  // 初期化失敗時はアサーションエラー
+    bus_scheduler_ = I2cBusScheduler::For(i2c_bus);
 }
 
 /**
@@ -51,6 +52,7 @@ I2cDevice::I2cDevice(i2c_master_bus_handle_t i2c_bus, uint8_t addr) {
  */
 void I2cDevice::WriteReg(uint8_t reg, uint8_t value) {
     uint8_t buffer[2] = {reg, value};  // レジスタアドレス + データ値
+    I2cBusScheduler::Guard guard(bus_scheduler_, i2c_priority_);
     ESP_ERROR_CHECK(i2c_master_transmit(i2c_device_, buffer, 2, 100));  // 100msタイムアウト
 }
 
@@ -65,6 +67,7 @@ void I2cDevice::WriteReg(uint8_t reg, uint8_t value) {
  */
 uint8_t I2cDevice::ReadReg(uint8_t reg) {
     uint8_t buffer[1];
+    I2cBusScheduler::Guard guard(bus_scheduler_, i2c_priority_);
     // レジスタアドレス送信 → データ受信（100msタイムアウト）
     ESP_ERROR_CHECK(i2c_master_transmit_receive(i2c_device_, &reg, 1, buffer, 1, 100));
     return buffer[0];
@@ -82,6 +85,23 @@ uint8_t I2cDevice::ReadReg(uint8_t reg) {
  * 通信エラーが発生した場合はESP_ERROR_CHECKによりアプリケーションが停止します。
  */
 void I2cDevice::ReadRegs(uint8_t reg, uint8_t* buffer, size_t length) {
+    I2cBusScheduler::Guard guard(bus_scheduler_, i2c_priority_);
     // レジスタアドレス送信 → 複数バイトデータ受信（100msタイムアウト）
     ESP_ERROR_CHECK(i2c_master_transmit_receive(i2c_device_, &reg, 1, buffer, length, 100));
-}
\ No newline at end of file
+}
+
+/**
+ * @brief 連続していない複数レジスタを一括で読み取り
+ * @param regs 読み取るレジスタアドレスの配列
+ * @param values 読み取ったデータを格納する配列
+ * @param count レジスタ数
+ * 
+ * 電池の状態と残量のように離れたアドレスのレジスタを、1回のバス使用権の中で読み取ります。
+ * 通信エラーが発生した場合はESP_ERROR_CHECKによりアプリケーションが停止します。
+ */
+void I2cDevice::ReadRegList(const uint8_t* regs, uint8_t* values, size_t count) {
+    I2cBusScheduler::Guard guard(bus_scheduler_, i2c_priority_);
+    for (size_t i = 0; i < count; ++i) {
+        ESP_ERROR_CHECK(i2c_master_transmit_receive(i2c_device_, &regs[i], 1, &values[i], 1, 100));
+    }
+}
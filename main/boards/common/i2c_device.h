@@ -8,6 +8,8 @@
 #ifndef I2C_DEVICE_H
 #define I2C_DEVICE_H
 
+#include "i2c_bus_scheduler.h"
+
 #include <driver/i2c_master.h>
 
 /**
@@ -33,6 +35,15 @@ protected:
     /** @brief I2C デバイスハンドル（ESP-IDF マスターデバイス） */
     i2c_master_dev_handle_t i2c_device_;
 
+    /** @brief 共有バスの調停器（バス数の上限を超えた場合nullptr） */
+    I2cBusScheduler* bus_scheduler_ = nullptr;
+
+    /** @brief このデバイスのトランザクションの優先度クラス */
+    I2cPriority i2c_priority_ = kI2cPriorityTelemetry;
+
+    /** @brief トランザクションの優先度クラスを変更 */
+    void SetI2cPriority(I2cPriority priority) { i2c_priority_ = priority; }
+
     /**
      * @brief レジスタへの書き込み
      * @param reg 書き込み先レジスタアドレス
@@ -63,6 +74,17 @@ protected:
      * センサーデータの一括取得やFIFOバッファの読み込みに使用されます。
      */
     void ReadRegs(uint8_t reg, uint8_t* buffer, size_t length);
+
+    /**
+     * @brief 連続していない複数レジスタの一括読み込み
+     * @param regs 読み込むレジスタアドレスの配列
+     * @param values 読み込んだ値の格納先（regsと同じ要素数）
+     * @param count レジスタ数
+     * 
+     * 1回のバス使用権の中で順に読み込むため、途中に他のデバイスの
+     * トランザクションが割り込まず、使用権の受け渡しも1回で済みます。
+     */
+    void ReadRegList(const uint8_t* regs, uint8_t* values, size_t count);
 };
 
 #endif // I2C_DEVICE_H
@@ -0,0 +1,132 @@
+/**
+ * @file init_graph.cc
+ * @brief ボード初期化手順の並行実行の実装
+ */
+#include "init_graph.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+
+#define TAG "InitGraph"
+
+namespace {
+
+/** @brief Run()の間だけ両方のタスクで共有する状態 */
+struct RunState {
+    InitGraph* graph;
+    std::mutex mutex;
+    std::condition_variable changed;    /**< 手順の完了、または補助タスクの終了 */
+    int remaining;
+    bool helper_running = true;
+};
+
+} // namespace
+
+InitGraph& InitGraph::Add(const char* name, std::function<void()> step, std::initializer_list<const char*> depends) {
+    Step entry;
+    entry.name = name;
+    entry.function = std::move(step);
+    for (auto depend : depends) {
+        int index = -1;
+        for (int i = 0; i < (int)steps_.size(); i++) {
+            if (strcmp(steps_[i].name, depend) == 0) {
+                index = i;
+                break;
+            }
+        }
+        if (index < 0) {
+            ESP_LOGE(TAG, "%s depends on unknown step %s", name, depend);
+            continue;
+        }
+        entry.depends.push_back(index);
+    }
+    steps_.push_back(std::move(entry));
+    return *this;
+}
+
+void InitGraph::Worker(void* arg) {
+    auto state = (RunState*)arg;
+    std::unique_lock<std::mutex> lock(state->mutex);
+    while (state->remaining > 0) {
+        Step* next = nullptr;
+        for (auto& step : steps_) {
+            if (step.started) {
+                continue;
+            }
+            bool ready = true;
+            for (int depend : step.depends) {
+                ready = ready && steps_[depend].done;
+            }
+            if (ready) {
+                next = &step;
+                break;
+            }
+        }
+        if (next == nullptr) {
+            bool pending = false;
+            for (auto& step : steps_) {
+                pending = pending || !step.started;
+            }
+            if (!pending) {
+                // 残りは相手のタスクが実行中
+                break;
+            }
+            state->changed.wait(lock);
+            continue;
+        }
+
+        next->started = true;
+        next->core = xPortGetCoreID();
+        lock.unlock();
+        next->start_us = esp_timer_get_time();
+        next->function();
+        next->duration_us = esp_timer_get_time() - next->start_us;
+        lock.lock();
+        next->done = true;
+        state->remaining--;
+        state->changed.notify_all();
+    }
+}
+
+void InitGraph::Run() {
+    RunState state;
+    state.graph = this;
+    state.remaining = steps_.size();
+    int64_t start = esp_timer_get_time();
+
+    // 呼び出し元と反対のコアで補助タスクを動かす
+    int helper_core = xPortGetCoreID() == 0 ? 1 : 0;
+    if (xTaskCreatePinnedToCore([](void* arg) {
+            auto state = (RunState*)arg;
+            state->graph->Worker(state);
+            {
+                // 通知もロック中に行う（Run()はこの直後にstateを破棄できる）
+                std::lock_guard<std::mutex> lock(state->mutex);
+                state->helper_running = false;
+                state->changed.notify_all();
+            }
+            vTaskDelete(NULL);
+        }, "board_init", INIT_GRAPH_TASK_STACK_SIZE, &state, uxTaskPriorityGet(NULL), nullptr, helper_core) != pdPASS) {
+        ESP_LOGW(TAG, "Failed to create the helper task, initializing sequentially");
+        state.helper_running = false;
+    }
+
+    Worker(&state);
+    {
+        std::unique_lock<std::mutex> lock(state.mutex);
+        state.changed.wait(lock, [&state]() { return !state.helper_running; });
+    }
+
+    int64_t total = esp_timer_get_time() - start;
+    for (auto& step : steps_) {
+        ESP_LOGI(TAG, "%-12s core %d  +%4lld ms  %4lld ms", step.name, step.core, (step.start_us - start) / 1000,
+            step.duration_us / 1000);
+    }
+    ESP_LOGI(TAG, "Board initialized in %lld ms", total / 1000);
+}
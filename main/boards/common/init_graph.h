@@ -0,0 +1,58 @@
+/**
+ * @file init_graph.h
+ * @brief 依存関係を宣言したボード初期化手順の並行実行
+ *
+ * ボードのコンストラクタの初期化手順（I2C、PMIC、SPI、ディスプレイなど）を名前と依存先で
+ * 登録すると、依存先が終わった手順から順に、呼び出し元のタスクともう一方のコアの
+ * 補助タスクの2つで実行します。I2Cの待ち（IOエキスパンダのリセット待ちなど）の間に
+ * SPIやディスプレイの初期化を進められます。手順ごとの所要時間をログに出します。
+ */
+#ifndef INIT_GRAPH_H
+#define INIT_GRAPH_H
+
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <vector>
+
+/** @brief 補助タスクのスタックサイズ（LVGLやパネルドライバの初期化を実行できる大きさ） */
+#define INIT_GRAPH_TASK_STACK_SIZE 8192
+
+/**
+ * @class InitGraph
+ * @brief 初期化手順の依存グラフ
+ *
+ * 手順は依存先より後に追加します（存在しない名前への依存は登録時にエラー）。
+ * 同じI2Cバスを使う手順を並行させても、トランザクションはドライバのバスロックで直列化されます。
+ */
+class InitGraph {
+public:
+    /**
+     * @brief 手順を追加
+     * @param name ログに出す名前
+     * @param depends 先に終わっている必要がある手順の名前
+     */
+    InitGraph& Add(const char* name, std::function<void()> step, std::initializer_list<const char*> depends = {});
+
+    /** @brief すべての手順を実行し、終わるまで戻らない */
+    void Run();
+
+private:
+    struct Step {
+        const char* name;
+        std::function<void()> function;
+        std::vector<int> depends;
+        bool started = false;
+        bool done = false;
+        int core = -1;
+        int64_t start_us = 0;
+        int64_t duration_us = 0;
+    };
+
+    std::vector<Step> steps_;
+
+    /** @brief 実行できる手順がなくなるまで取り出して実行する（両方のタスクで動く） */
+    void Worker(void* state);
+};
+
+#endif // INIT_GRAPH_H
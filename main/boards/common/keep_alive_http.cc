@@ -0,0 +1,383 @@
+#include "keep_alive_http.h"
+#include "cached_tls_transport.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <tcp_transport.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+
+#define TAG "KeepAliveHttp"
+
+std::mutex KeepAliveHttp::pool_mutex_;
+std::vector<KeepAliveHttp::IdleConnection> KeepAliveHttp::pool_;
+
+static std::string ToLower(std::string text) {
+    std::transform(text.begin(), text.end(), text.begin(), [](unsigned char c) { return std::tolower(c); });
+    return text;
+}
+
+KeepAliveHttp::KeepAliveHttp() {
+}
+
+KeepAliveHttp::~KeepAliveHttp() {
+    Close();
+}
+
+Transport* KeepAliveHttp::TakeConnection(const std::string& key) {
+    std::lock_guard<std::mutex> lock(pool_mutex_);
+    int64_t now = esp_timer_get_time();
+    Transport* found = nullptr;
+    for (auto it = pool_.begin(); it != pool_.end();) {
+        bool expired = now - it->released_us > HTTP_POOL_IDLE_TIMEOUT_MS * 1000LL;
+        if (!expired && found == nullptr && it->key == key) {
+            found = it->transport;
+            it = pool_.erase(it);
+        } else if (expired) {
+            delete it->transport;
+            it = pool_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    return found;
+}
+
+void KeepAliveHttp::ReturnConnection(const std::string& key, Transport* transport) {
+    std::lock_guard<std::mutex> lock(pool_mutex_);
+    if (pool_.size() >= HTTP_POOL_MAX_IDLE) {
+        // 最も古い接続を閉じる
+        delete pool_.front().transport;
+        pool_.erase(pool_.begin());
+    }
+    pool_.push_back({key, transport, esp_timer_get_time()});
+}
+
+void KeepAliveHttp::CloseIdleConnections() {
+    std::lock_guard<std::mutex> lock(pool_mutex_);
+    for (auto& connection : pool_) {
+        delete connection.transport;
+    }
+    pool_.clear();
+}
+
+void KeepAliveHttp::SetTimeout(int timeout_ms) {
+    // 接続のタイムアウトはトランスポート側の設定（10秒）を使う
+}
+
+void KeepAliveHttp::SetHeader(const std::string& key, const std::string& value) {
+    auto lower = ToLower(key);
+    if (lower == "transfer-encoding") {
+        chunked_request_ = ToLower(value) == "chunked";
+    }
+    for (auto& header : headers_) {
+        if (ToLower(header.first) == lower) {
+            header.second = value;
+            return;
+        }
+    }
+    headers_.emplace_back(key, value);
+}
+
+void KeepAliveHttp::SetContent(std::string&& content) {
+    content_ = std::move(content);
+}
+
+void KeepAliveHttp::ResetResponse() {
+    headers_received_ = false;
+    status_code_ = -1;
+    response_headers_.clear();
+    keep_alive_ = true;
+    chunked_response_ = false;
+    body_until_close_ = false;
+    body_complete_ = false;
+    content_length_ = 0;
+    body_remaining_ = 0;
+    rx_buffer_.clear();
+}
+
+bool KeepAliveHttp::Open(const std::string& method, const std::string& url) {
+    Close();
+
+    // scheme://host[:port]/path
+    auto scheme_end = url.find("://");
+    if (scheme_end == std::string::npos) {
+        ESP_LOGE(TAG, "Invalid URL: %s", url.c_str());
+        return false;
+    }
+    std::string scheme = url.substr(0, scheme_end);
+    bool tls = scheme == "https";
+    auto host_start = scheme_end + 3;
+    auto path_start = url.find('/', host_start);
+    std::string authority = url.substr(host_start, path_start == std::string::npos ? std::string::npos : path_start - host_start);
+    std::string path = path_start == std::string::npos ? "/" : url.substr(path_start);
+    std::string host = authority;
+    int port = tls ? 443 : 80;
+    auto colon = authority.find(':');
+    if (colon != std::string::npos) {
+        host = authority.substr(0, colon);
+        port = atoi(authority.c_str() + colon + 1);
+    }
+    key_ = scheme + "://" + host + ":" + std::to_string(port);
+
+    std::string request = method + " " + path + " HTTP/1.1\r\n";
+    request += "Host: " + authority + "\r\n";
+    for (auto& header : headers_) {
+        request += header.first + ": " + header.second + "\r\n";
+    }
+    request += "Connection: keep-alive\r\n";
+    if (!chunked_request_ && (!content_.empty() || method == "POST" || method == "PUT")) {
+        request += "Content-Length: " + std::to_string(content_.size()) + "\r\n";
+    }
+    request += "\r\n";
+
+    // 再利用した接続はサーバー側で閉じられている可能性がある。本文を送り直せる場合は新しい接続で1回だけ再試行する
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        ResetResponse();
+        transport_ = TakeConnection(key_);
+        bool reused = transport_ != nullptr;
+        if (!reused) {
+            if (tls) {
+                transport_ = new CachedTlsTransport();
+            } else {
+                transport_ = new TcpTransport();
+            }
+            if (!transport_->Connect(host.c_str(), port)) {
+                ESP_LOGE(TAG, "Failed to connect to %s:%d", host.c_str(), port);
+                delete transport_;
+                transport_ = nullptr;
+                return false;
+            }
+        }
+
+        bool sent = transport_->Send(request.data(), request.size()) == (int)request.size();
+        if (sent && !content_.empty()) {
+            sent = transport_->Send(content_.data(), content_.size()) == (int)content_.size();
+        }
+        // 分割送信する場合はWrite()の後にレスポンスを読む
+        if (sent && (chunked_request_ || ReadResponseHeaders())) {
+            if (reused) {
+                ESP_LOGD(TAG, "Reused connection to %s", key_.c_str());
+            }
+            return true;
+        }
+
+        delete transport_;
+        transport_ = nullptr;
+        if (!reused || chunked_request_) {
+            break;
+        }
+        ESP_LOGW(TAG, "Pooled connection to %s was closed, reconnecting", key_.c_str());
+    }
+    ESP_LOGE(TAG, "Failed to send request to %s", url.c_str());
+    return false;
+}
+
+void KeepAliveHttp::Close() {
+    if (transport_ == nullptr) {
+        return;
+    }
+    // レスポンスを最後まで読み、サーバーが接続を保つ場合だけ再利用する
+    if (headers_received_ && body_complete_ && keep_alive_ && rx_buffer_.empty()) {
+        ReturnConnection(key_, transport_);
+    } else {
+        delete transport_;
+    }
+    transport_ = nullptr;
+}
+
+bool KeepAliveHttp::ReceiveMore() {
+    char buffer[512];
+    int ret = transport_->Receive(buffer, sizeof(buffer));
+    if (ret <= 0) {
+        return false;
+    }
+    rx_buffer_.append(buffer, ret);
+    return true;
+}
+
+bool KeepAliveHttp::ReadLine(std::string& line) {
+    size_t end;
+    while ((end = rx_buffer_.find("\r\n")) == std::string::npos) {
+        if (!ReceiveMore()) {
+            return false;
+        }
+    }
+    line = rx_buffer_.substr(0, end);
+    rx_buffer_.erase(0, end + 2);
+    return true;
+}
+
+bool KeepAliveHttp::ReadResponseHeaders() {
+    if (headers_received_) {
+        return true;
+    }
+    if (transport_ == nullptr) {
+        return false;
+    }
+
+    std::string line;
+    // 100 Continueなどの中間レスポンスは読み飛ばす
+    do {
+        if (!ReadLine(line)) {
+            return false;
+        }
+        auto space = line.find(' ');
+        if (line.compare(0, 5, "HTTP/") != 0 || space == std::string::npos) {
+            ESP_LOGE(TAG, "Invalid status line: %s", line.c_str());
+            return false;
+        }
+        status_code_ = atoi(line.c_str() + space + 1);
+        keep_alive_ = line.compare(0, 8, "HTTP/1.0") != 0;
+        response_headers_.clear();
+        while (ReadLine(line) && !line.empty()) {
+            auto colon = line.find(':');
+            if (colon == std::string::npos) {
+                continue;
+            }
+            auto value_start = line.find_first_not_of(' ', colon + 1);
+            response_headers_.emplace_back(ToLower(line.substr(0, colon)),
+                value_start == std::string::npos ? "" : line.substr(value_start));
+        }
+        if (!line.empty()) {
+            return false;
+        }
+    } while (status_code_ >= 100 && status_code_ < 200);
+    headers_received_ = true;
+
+    auto connection = ToLower(GetResponseHeader("connection"));
+    if (connection == "close") {
+        keep_alive_ = false;
+    } else if (connection == "keep-alive") {
+        keep_alive_ = true;
+    }
+
+    auto transfer_encoding = ToLower(GetResponseHeader("transfer-encoding"));
+    auto content_length = GetResponseHeader("content-length");
+    if (status_code_ == 204 || status_code_ == 304) {
+        body_complete_ = true;
+    } else if (transfer_encoding.find("chunked") != std::string::npos) {
+        chunked_response_ = true;
+    } else if (!content_length.empty()) {
+        content_length_ = strtoul(content_length.c_str(), nullptr, 10);
+        body_remaining_ = content_length_;
+        body_complete_ = body_remaining_ == 0;
+    } else {
+        // 長さの指定がない場合は切断まで読む
+        body_until_close_ = true;
+        keep_alive_ = false;
+    }
+    return true;
+}
+
+int KeepAliveHttp::GetStatusCode() {
+    if (!ReadResponseHeaders()) {
+        return -1;
+    }
+    return status_code_;
+}
+
+std::string KeepAliveHttp::GetResponseHeader(const std::string& key) const {
+    auto lower = ToLower(key);
+    for (auto& header : response_headers_) {
+        if (header.first == lower) {
+            return header.second;
+        }
+    }
+    return "";
+}
+
+size_t KeepAliveHttp::GetBodyLength() {
+    if (!ReadResponseHeaders()) {
+        return 0;
+    }
+    return content_length_;
+}
+
+int KeepAliveHttp::Read(char* buffer, size_t buffer_size) {
+    if (!ReadResponseHeaders()) {
+        return -1;
+    }
+    if (body_complete_ || buffer_size == 0) {
+        return 0;
+    }
+
+    if (chunked_response_ && body_remaining_ == 0) {
+        // 次のチャンクのサイズ行を読む（前のチャンクの末尾のCRLFは読み飛ばす）
+        std::string line;
+        do {
+            if (!ReadLine(line)) {
+                return -1;
+            }
+        } while (line.empty());
+        body_remaining_ = strtoul(line.c_str(), nullptr, 16);
+        if (body_remaining_ == 0) {
+            // トレーラーを読み飛ばす
+            while (ReadLine(line) && !line.empty()) {
+            }
+            body_complete_ = true;
+            return 0;
+        }
+    }
+
+    size_t limit = body_until_close_ ? buffer_size : std::min(buffer_size, body_remaining_);
+    int size;
+    if (!rx_buffer_.empty()) {
+        size = std::min(limit, rx_buffer_.size());
+        memcpy(buffer, rx_buffer_.data(), size);
+        rx_buffer_.erase(0, size);
+    } else {
+        // 本文は受信バッファを経由せずに直接読み込む
+        size = transport_->Receive(buffer, limit);
+        if (size <= 0) {
+            if (body_until_close_) {
+                body_complete_ = true;
+                return 0;
+            }
+            return -1;
+        }
+    }
+
+    if (!body_until_close_) {
+        body_remaining_ -= size;
+        if (!chunked_response_ && body_remaining_ == 0) {
+            body_complete_ = true;
+        }
+    }
+    return size;
+}
+
+int KeepAliveHttp::Write(const char* buffer, size_t buffer_size) {
+    if (transport_ == nullptr) {
+        return -1;
+    }
+    if (!chunked_request_) {
+        return transport_->Send(buffer, buffer_size);
+    }
+    // 長さ0で終端チャンクを送る
+    char size_line[16];
+    int size_line_length = snprintf(size_line, sizeof(size_line), "%x\r\n", (unsigned)buffer_size);
+    if (transport_->Send(size_line, size_line_length) != size_line_length) {
+        return -1;
+    }
+    if (buffer_size > 0 && transport_->Send(buffer, buffer_size) != (int)buffer_size) {
+        return -1;
+    }
+    if (transport_->Send("\r\n", 2) != 2) {
+        return -1;
+    }
+    return buffer_size;
+}
+
+std::string KeepAliveHttp::ReadAll() {
+    std::string body;
+    char buffer[512];
+    int ret;
+    while ((ret = Read(buffer, sizeof(buffer))) > 0) {
+        body.append(buffer, ret);
+    }
+    return body;
+}
@@ -0,0 +1,101 @@
+/**
+ * @file keep_alive_http.h
+ * @brief 接続を使い回すHTTP/1.1クライアント
+ *
+ * バージョン確認、アクティベーションのポーリング、画像の説明依頼のように同じホストへ
+ * 繰り返し送るリクエストで、TCP接続とTLSハンドシェイクを省略します。
+ * レスポンスを最後まで読んだ接続はClose()でプールに戻し、次のOpen()で再利用します。
+ */
+#ifndef _KEEP_ALIVE_HTTP_H_
+#define _KEEP_ALIVE_HTTP_H_
+
+#include <http.h>
+#include <transport.h>
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+/** @brief プールに保持するアイドル接続の最大数（TLS接続1本あたり数十KBを使う） */
+#define HTTP_POOL_MAX_IDLE 2
+
+/** @brief アイドル接続を再利用する期限（ミリ秒）。サーバー側のkeep-alive期限より短くする */
+#define HTTP_POOL_IDLE_TIMEOUT_MS 15000
+
+/**
+ * @class KeepAliveHttp
+ * @brief 接続プールを共有するHttp実装（https はCachedTlsTransport、http はTcpTransport）
+ */
+class KeepAliveHttp : public Http {
+public:
+    KeepAliveHttp();
+    ~KeepAliveHttp();
+
+    void SetTimeout(int timeout_ms) override;
+    void SetHeader(const std::string& key, const std::string& value) override;
+    void SetContent(std::string&& content) override;
+    bool Open(const std::string& method, const std::string& url) override;
+    void Close() override;
+    int Read(char* buffer, size_t buffer_size) override;
+    int Write(const char* buffer, size_t buffer_size) override;
+    int GetStatusCode() override;
+    std::string GetResponseHeader(const std::string& key) const override;
+    size_t GetBodyLength() override;
+    std::string ReadAll() override;
+
+    /** @brief アイドル接続をすべて閉じる（ネットワーク切り替え時など） */
+    static void CloseIdleConnections();
+
+private:
+    struct IdleConnection {
+        std::string key;            /**< scheme://host:port */
+        Transport* transport;
+        int64_t released_us;
+    };
+    static std::mutex pool_mutex_;
+    static std::vector<IdleConnection> pool_;
+
+    /** @brief 期限内のアイドル接続を取り出す（なければnullptr） */
+    static Transport* TakeConnection(const std::string& key);
+
+    /** @brief 接続をプールに戻す */
+    static void ReturnConnection(const std::string& key, Transport* transport);
+
+    Transport* transport_ = nullptr;
+    std::string key_;
+    std::vector<std::pair<std::string, std::string>> headers_;
+    std::string content_;
+    bool chunked_request_ = false;
+
+    // レスポンスの状態
+    bool headers_received_ = false;
+    int status_code_ = -1;
+    std::vector<std::pair<std::string, std::string>> response_headers_;  /**< キーは小文字 */
+    bool keep_alive_ = true;
+    bool chunked_response_ = false;
+    bool body_until_close_ = false;
+    bool body_complete_ = false;
+    size_t content_length_ = 0;
+    size_t body_remaining_ = 0;     /**< 固定長の残り、またはチャンク内の残り */
+    std::string rx_buffer_;         /**< 受信済みで未処理のデータ */
+
+    /** @brief 接続してリクエスト行・ヘッダ・本文を送る */
+    bool SendRequest(const std::string& method, const std::string& scheme, const std::string& host, int port,
+        const std::string& request);
+
+    /** @brief ステータス行とヘッダを受信して解析 */
+    bool ReadResponseHeaders();
+
+    /** @brief rx_buffer_に追加で受信（切断時false） */
+    bool ReceiveMore();
+
+    /** @brief CRLFで終わる1行を取り出す */
+    bool ReadLine(std::string& line);
+
+    /** @brief レスポンスの状態を初期化 */
+    void ResetResponse();
+};
+
+#endif // _KEEP_ALIVE_HTTP_H_
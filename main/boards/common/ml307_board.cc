@@ -10,11 +10,13 @@
 
 #include "application.h"
 #include "display.h"
+#include "boot_profile.h"
 #include "font_awesome_symbols.h"
 #include "assets/lang_config.h"
 
 #include <esp_log.h>
 #include <esp_timer.h>
+#include <algorithm>
 #include <ml307_http.h>
 #include <ml307_ssl_transport.h>
 #include <web_socket.h>
@@ -34,8 +36,19 @@ static const char *TAG = "Ml307Board";
  * 指定されたピンでシリアル通信を確立し、AT コマンドによる
  * モデム制御の準備を行います。
  */
-Ml307Board::Ml307Board(gpio_num_t tx_pin, gpio_num_t rx_pin, size_t rx_buffer_size) : modem_(tx_pin, rx_pin, rx_buffer_size) {
-    // モデムオブジェクトの初期化は基底クラスの初期化リストで実行済み
+Ml307Board::Ml307Board(gpio_num_t tx_pin, gpio_num_t rx_pin, size_t rx_buffer_size)
+    : modem_(tx_pin, rx_pin, std::max<size_t>(rx_buffer_size, CONFIG_ML307_UART_RX_BUFFER_SIZE)) {
+    // OTAや下り音声の突発的な受信で溢れないよう、受信バッファは設定の最小値以上にする
+}
+
+void Ml307Board::SetBaudRate() {
+    int64_t start_time = esp_timer_get_time();
+    if (!modem_.SetBaudRate(CONFIG_ML307_UART_BAUD_RATE)) {
+        ESP_LOGW(TAG, "ML307 rejected %d baud, falling back to 921600", CONFIG_ML307_UART_BAUD_RATE);
+        modem_.SetBaudRate(921600);
+        return;
+    }
+    ESP_LOGI(TAG, "ML307 UART at %d baud (%lld ms)", CONFIG_ML307_UART_BAUD_RATE, (esp_timer_get_time() - start_time) / 1000);
 }
 
 /**
@@ -59,7 +72,7 @@ void Ml307Board::StartNetwork() {
     
     // モデム通信設定
     modem_.SetDebug(false);    // デバッグ出力を無効化（本番環境用）
-    modem_.SetBaudRate(921600); // 高速通信用ボーレート設定
+    SetBaudRate();             // 高速通信用ボーレート設定
 
     auto& application = Application::GetInstance();
     
@@ -105,6 +118,8 @@ void Ml307Board::WaitForNetworkReady() {
         return;
     }
 
+    BootProfile::GetInstance().Mark(kBootNetworkConnected);
+
     // モデム情報の取得とログ出力
     std::string module_name = modem_.GetModuleName();  // モジュール名（例: "ML307A-DSLN"）
     std::string imei = modem_.GetImei();               // 国際移動体装置識別番号
@@ -119,6 +134,29 @@ void Ml307Board::WaitForNetworkReady() {
     modem_.ResetConnections();
 }
 
+bool Ml307Board::StartNetworkQuietly() {
+    modem_.SetDebug(false);
+    SetBaudRate();
+    int result = modem_.WaitForNetworkReady();
+    if (result < 0) {
+        ESP_LOGW(TAG, "ML307 network not ready: %d", result);
+        return false;
+    }
+    ESP_LOGI(TAG, "ML307 Module: %s", modem_.GetModuleName().c_str());
+    modem_.ResetConnections();
+    return true;
+}
+
+bool Ml307Board::SetRadioEnabled(bool enabled) {
+    // CFUN=4は無線部のみ停止（SIMとATは使える）ため、復帰時に再初期化が不要
+    if (!modem_.Command(enabled ? "AT+CFUN=1" : "AT+CFUN=4")) {
+        ESP_LOGE(TAG, "Failed to %s radio", enabled ? "enable" : "disable");
+        return false;
+    }
+    ESP_LOGI(TAG, "Radio %s", enabled ? "enabled" : "disabled");
+    return true;
+}
+
 /**
  * @brief HTTPクライアントの作成
  * @return Http* ML307用HTTPクライアントインスタンス
@@ -197,6 +235,15 @@ const char* Ml307Board::GetNetworkStateIcon() {
     return FONT_AWESOME_SIGNAL_OFF;
 }
 
+bool Ml307Board::IsNetworkWeak() {
+    if (!modem_.network_ready()) {
+        return false;
+    }
+    // GetNetworkStateIcon()のSIGNAL_1（-113 dBm 以下）に相当
+    int csq = modem_.GetCsq();
+    return csq >= 0 && csq <= 14;
+}
+
 /**
  * @brief ボード固有情報のJSON生成
  * @return std::string ボード情報を含むJSON文字列
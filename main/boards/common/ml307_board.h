@@ -38,6 +38,13 @@ protected:
      */
     void WaitForNetworkReady();
 
+    /**
+     * @brief AT UARTのボーレートをCONFIG_ML307_UART_BAUD_RATEに切り替える
+     *
+     * モデムが受け付けない場合は921600で動作します。
+     */
+    void SetBaudRate();
+
 public:
     /**
      * @brief ML307ボードのコンストラクタ
@@ -93,6 +100,12 @@ public:
      * @return const char* 現在の4G/LTE接続状態を表すアイコン文字
      */
     virtual const char* GetNetworkStateIcon() override;
+
+    /**
+     * @brief 電波強度が弱いかどうか
+     * @return bool CSQが15未満の場合true
+     */
+    virtual bool IsNetworkWeak() override;
     
     /**
      * @brief 省電力モード設定
@@ -102,6 +115,24 @@ public:
      */
     virtual void SetPowerSaveMode(bool enabled) override;
     
+    /**
+     * @brief 表示やアラートを出さずにモデムを起動し、ネットワーク登録を待つ
+     * @return 登録できた場合true
+     *
+     * DualNetworkBoardがWiFiと並行して起動する場合に使います。
+     */
+    bool StartNetworkQuietly();
+
+    /** @brief ネットワークに登録済みでデータ通信できるかどうか */
+    bool IsNetworkReady() { return modem_.network_ready(); }
+
+    /**
+     * @brief 無線部の有効/無効（AT+CFUN）
+     *
+     * 無効にすると登録が解除され消費電力が下がります。再び有効にすると再登録を待つ必要があります。
+     */
+    bool SetRadioEnabled(bool enabled);
+
     /**
      * @brief オーディオコーデック取得（未実装）
      * @return AudioCodec* nullptr（派生クラスで実装される）
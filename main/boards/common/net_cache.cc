@@ -0,0 +1,80 @@
+#include "net_cache.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <lwip/netdb.h>
+#include <lwip/inet.h>
+
+#define TAG "NetCache"
+
+bool DnsCache::Resolve(const std::string& host, std::string& address) {
+    // 数値アドレスはそのまま使う
+    struct in_addr numeric;
+    if (inet_aton(host.c_str(), &numeric)) {
+        address = host;
+        return true;
+    }
+
+    int64_t now = esp_timer_get_time();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = entries_.find(host);
+        if (it != entries_.end() && it->second.expires_us > now) {
+            address = it->second.address;
+            return true;
+        }
+    }
+
+    struct addrinfo hints = {};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* result = nullptr;
+    int err = getaddrinfo(host.c_str(), nullptr, &hints, &result);
+    if (err != 0 || result == nullptr) {
+        ESP_LOGE(TAG, "Failed to resolve %s: %d", host.c_str(), err);
+        return false;
+    }
+    char buffer[INET_ADDRSTRLEN];
+    auto addr = &((struct sockaddr_in*)result->ai_addr)->sin_addr;
+    inet_ntoa_r(*addr, buffer, sizeof(buffer));
+    freeaddrinfo(result);
+
+    address = buffer;
+    ESP_LOGI(TAG, "Resolved %s -> %s", host.c_str(), buffer);
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_[host] = {address, now + (int64_t)DNS_CACHE_TTL_SECONDS * 1000000};
+    return true;
+}
+
+void DnsCache::Invalidate(const std::string& host) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_.erase(host);
+}
+
+void DnsCache::Clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_.clear();
+}
+
+TlsSessionCache::Session TlsSessionCache::Get(const std::string& host, int port) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = sessions_.find(host + ":" + std::to_string(port));
+    return it != sessions_.end() ? it->second : nullptr;
+}
+
+void TlsSessionCache::Save(const std::string& host, int port, esp_tls_t* tls) {
+#ifdef CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+    esp_tls_client_session_t* session = esp_tls_get_client_session(tls);
+    if (session == nullptr) {
+        return;
+    }
+    Session shared(session, esp_tls_free_client_session);
+    std::lock_guard<std::mutex> lock(mutex_);
+    sessions_[host + ":" + std::to_string(port)] = std::move(shared);
+#endif
+}
+
+void TlsSessionCache::Remove(const std::string& host, int port) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    sessions_.erase(host + ":" + std::to_string(port));
+}
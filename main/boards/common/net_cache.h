@@ -0,0 +1,98 @@
+/**
+ * @file net_cache.h
+ * @brief DNS解決結果とTLSセッションチケットのプロセス共通キャッシュ
+ *
+ * 音声チャンネルを開くたびに発生するDNS問い合わせとTLSフルハンドシェイクを
+ * 省略するため、ホストごとの解決結果とセッションチケットを保持します。
+ */
+#ifndef _NET_CACHE_H_
+#define _NET_CACHE_H_
+
+#include <esp_tls.h>
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+/** @brief DNSキャッシュの有効期間（秒）。getaddrinfo()はTTLを返さないため固定値を使用 */
+#define DNS_CACHE_TTL_SECONDS 300
+
+/**
+ * @class DnsCache
+ * @brief ホスト名→IPv4アドレスのTTL付きキャッシュ（シングルトン）
+ */
+class DnsCache {
+public:
+    static DnsCache& GetInstance() {
+        static DnsCache instance;
+        return instance;
+    }
+
+    DnsCache(const DnsCache&) = delete;
+    DnsCache& operator=(const DnsCache&) = delete;
+
+    /**
+     * @brief ホスト名を解決（キャッシュが有効ならネットワークに問い合わせない）
+     * @param host ホスト名またはIPアドレス文字列
+     * @param address 解決したIPv4アドレス文字列
+     * @return 成功時true
+     */
+    bool Resolve(const std::string& host, std::string& address);
+
+    /** @brief 接続に失敗したアドレスを破棄し、次回は再解決させる */
+    void Invalidate(const std::string& host);
+
+    /** @brief すべてのエントリを破棄（ネットワーク切り替え時など） */
+    void Clear();
+
+private:
+    DnsCache() = default;
+
+    struct Entry {
+        std::string address;
+        int64_t expires_us;
+    };
+
+    std::mutex mutex_;
+    std::map<std::string, Entry> entries_;
+};
+
+/**
+ * @class TlsSessionCache
+ * @brief ホスト:ポートごとのTLSセッションチケットキャッシュ（シングルトン）
+ *
+ * セッションはshared_ptrで保持するため、ハンドシェイク中に別のタスクが
+ * 新しいチケットで置き換えても参照中のセッションは解放されません。
+ * CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS が無効な場合は常に空を返します。
+ */
+class TlsSessionCache {
+public:
+    using Session = std::shared_ptr<esp_tls_client_session_t>;
+
+    static TlsSessionCache& GetInstance() {
+        static TlsSessionCache instance;
+        return instance;
+    }
+
+    TlsSessionCache(const TlsSessionCache&) = delete;
+    TlsSessionCache& operator=(const TlsSessionCache&) = delete;
+
+    /** @brief 保存済みセッションを取得（無ければnullptr） */
+    Session Get(const std::string& host, int port);
+
+    /** @brief 確立した接続からセッションを取り出して保存 */
+    void Save(const std::string& host, int port, esp_tls_t* tls);
+
+    /** @brief セッションを破棄（再開に失敗した場合など） */
+    void Remove(const std::string& host, int port);
+
+private:
+    TlsSessionCache() = default;
+
+    std::mutex mutex_;
+    std::map<std::string, Session> sessions_;
+};
+
+#endif // _NET_CACHE_H_
@@ -1,5 +1,6 @@
 #include "power_save_timer.h"
 #include "application.h"
+#include "power_profile.h"
 
 #include <esp_log.h>
 
@@ -28,12 +29,12 @@ PowerSaveTimer::~PowerSaveTimer() {
 
 void PowerSaveTimer::SetEnabled(bool enabled) {
     if (enabled && !enabled_) {
-        ticks_ = 0;
+        idle_since_us_ = esp_timer_get_time();
         enabled_ = enabled;
-        ESP_ERROR_CHECK(esp_timer_start_periodic(power_save_timer_, 1000000));
+        ArmNextDeadline(0);
         ESP_LOGI(TAG, "Power save timer enabled");
     } else if (!enabled && enabled_) {
-        ESP_ERROR_CHECK(esp_timer_stop(power_save_timer_));
+        esp_timer_stop(power_save_timer_);
         enabled_ = enabled;
         WakeUp();
         ESP_LOGI(TAG, "Power save timer disabled");
@@ -52,21 +53,52 @@ void PowerSaveTimer::OnShutdownRequest(std::function<void()> callback) {
     on_shutdown_request_ = callback;
 }
 
+void PowerSaveTimer::ArmNextDeadline(int64_t idle_us) {
+    int64_t deadline_us = -1;
+    if (seconds_to_sleep_ != -1 && !in_sleep_mode_) {
+        deadline_us = seconds_to_sleep_ * 1000000LL;
+    }
+    if (seconds_to_shutdown_ != -1 && on_shutdown_request_ && seconds_to_shutdown_ * 1000000LL > idle_us &&
+        (deadline_us < 0 || seconds_to_shutdown_ * 1000000LL < deadline_us)) {
+        deadline_us = seconds_to_shutdown_ * 1000000LL;
+    }
+
+    esp_timer_stop(power_save_timer_);
+    if (!enabled_ || deadline_us < 0) {
+        return;     // WakeUp()まで期限はない
+    }
+    int64_t delay_us = deadline_us - idle_us;
+    esp_timer_start_once(power_save_timer_, delay_us > 0 ? delay_us : 0);
+}
+
 void PowerSaveTimer::PowerSaveCheck() {
     auto& app = Application::GetInstance();
+    int64_t now = esp_timer_get_time();
     if (!in_sleep_mode_ && !app.CanEnterSleepMode()) {
-        ticks_ = 0;
+        // 会話中は状態の変化を待つ間だけ短い間隔で確認し、待ち受けに戻った時刻から数え直す
+        idle_since_us_ = 0;
+        esp_timer_stop(power_save_timer_);
+        esp_timer_start_once(power_save_timer_, POWER_SAVE_BUSY_RECHECK_MS * 1000);
         return;
     }
+    if (idle_since_us_ == 0) {
+        idle_since_us_ = now;
+    }
 
-    ticks_++;
-    if (seconds_to_sleep_ != -1 && ticks_ >= seconds_to_sleep_) {
+    int64_t idle_us = now - idle_since_us_;
+    if (seconds_to_sleep_ != -1 && idle_us >= seconds_to_sleep_ * 1000000LL) {
         if (!in_sleep_mode_) {
             in_sleep_mode_ = true;
             if (on_enter_sleep_mode_) {
                 on_enter_sleep_mode_();
             }
+            // スリープ中は時計のタイマーも間隔を延ばし、起床を減らす
+            app.SetClockInterval(CLOCK_SLEEP_INTERVAL_SECONDS);
 
+#if CONFIG_USE_DFS_PROFILES
+            // 周波数範囲は状態ごとのプロファイルに任せ、ライトスリープだけを許可する
+            PowerProfile::GetInstance().SetSleepMode(true);
+#else
             if (cpu_max_freq_ != -1) {
                 esp_pm_config_t pm_config = {
                     .max_freq_mhz = cpu_max_freq_,
@@ -75,18 +107,24 @@ void PowerSaveTimer::PowerSaveCheck() {
                 };
                 esp_pm_configure(&pm_config);
             }
+#endif
         }
     }
-    if (seconds_to_shutdown_ != -1 && ticks_ >= seconds_to_shutdown_ && on_shutdown_request_) {
+    if (seconds_to_shutdown_ != -1 && idle_us >= seconds_to_shutdown_ * 1000000LL && on_shutdown_request_) {
         on_shutdown_request_();
     }
+    ArmNextDeadline(idle_us);
 }
 
 void PowerSaveTimer::WakeUp() {
-    ticks_ = 0;
+    idle_since_us_ = esp_timer_get_time();
     if (in_sleep_mode_) {
         in_sleep_mode_ = false;
+        Application::GetInstance().SetClockInterval(1);
 
+#if CONFIG_USE_DFS_PROFILES
+        PowerProfile::GetInstance().SetSleepMode(false);
+#else
         if (cpu_max_freq_ != -1) {
             esp_pm_config_t pm_config = {
                 .max_freq_mhz = cpu_max_freq_,
@@ -95,9 +133,11 @@ void PowerSaveTimer::WakeUp() {
             };
             esp_pm_configure(&pm_config);
         }
+#endif
 
         if (on_exit_sleep_mode_) {
             on_exit_sleep_mode_();
         }
     }
+    ArmNextDeadline(0);
 }
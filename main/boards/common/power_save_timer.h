@@ -12,6 +12,9 @@
 #include <esp_timer.h>
 #include <esp_pm.h>
 
+/** @brief 期限に達したときに会話中だった場合、再確認するまでの時間（CPUは動作中なので負担にならない） */
+#define POWER_SAVE_BUSY_RECHECK_MS 1000
+
 /**
  * @class PowerSaveTimer
  * @brief 省電力モード制御タイマークラス
@@ -19,6 +22,10 @@
  * デバイスの省電力管理を行うクラスです。
  * 一定時間非アクティブ状態が続いた場合の自動スリープ、CPU周波数の調整、
  * 自動シャットダウンなどの機能を提供します。
+ *
+ * 毎秒の確認ではなく、次の期限（スリープまたはシャットダウン）に一度だけ発火する
+ * タイマーを使い、WakeUp()で期限を張り直します。待ち受け中はCPUを起こさないため、
+ * 期限までの間ずっとライトスリープに入れます。
  */
 class PowerSaveTimer {
 public:
@@ -79,20 +86,23 @@ public:
     /**
      * @brief ウェイクアップ処理
      * 
-     * デバイスをアクティブ状態に戻し、省電力タイマーをリセットします。
+     * デバイスをアクティブ状態に戻し、スリープまでの期限を今から数え直します。
      * ユーザー操作やイベント発生時に呼び出されます。
      */
     void WakeUp();
 
 private:
     /**
-     * @brief 省電力チェック処理
+     * @brief 期限での省電力チェック処理
      * 
-     * 定期的に呼び出される内部関数で、省電力モードへの移行や
-     * シャットダウンタイミングを判定します。
+     * タイマーの期限で呼び出され、省電力モードへの移行や
+     * シャットダウンタイミングを判定して、次の期限を設定します。
      */
     void PowerSaveCheck();
 
+    /** @brief 非アクティブ期間の長さから次の期限を求めてタイマーを設定（期限がなければ止める） */
+    void ArmNextDeadline(int64_t idle_us);
+
     /** @brief 省電力管理用タイマーハンドル */
     esp_timer_handle_t power_save_timer_ = nullptr;
     
@@ -102,8 +112,8 @@ private:
     /** @brief 現在スリープモード中かのフラグ */
     bool in_sleep_mode_ = false;
     
-    /** @brief 内部タイマーカウンタ */
-    int ticks_ = 0;
+    /** @brief 非アクティブになった時刻（esp_timer_get_time、0なら会話中） */
+    int64_t idle_since_us_ = 0;
     
     /** @brief CPU最大周波数（MHz） */
     int cpu_max_freq_;
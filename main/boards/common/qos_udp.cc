@@ -0,0 +1,114 @@
+#include "qos_udp.h"
+#include "net_cache.h"
+
+#include <esp_log.h>
+#include <lwip/sockets.h>
+
+#include <cerrno>
+#include <cstring>
+
+#define TAG "QosUdp"
+
+/** @brief 受信バッファの大きさ（1データグラムの最大） */
+#define QOS_UDP_RECEIVE_BUFFER 1500
+
+bool SetSocketDscp(int fd, int dscp) {
+    if (dscp <= 0) {
+        return true;
+    }
+    int tos = dscp << 2;
+    if (setsockopt(fd, IPPROTO_IP, IP_TOS, &tos, sizeof(tos)) != 0) {
+        ESP_LOGW(TAG, "Failed to set DSCP %d on socket %d: errno %d", dscp, fd, errno);
+        return false;
+    }
+    return true;
+}
+
+QosUdp::QosUdp(int dscp) : dscp_(dscp) {
+}
+
+QosUdp::~QosUdp() {
+    Disconnect();
+}
+
+bool QosUdp::Connect(const std::string& host, int port) {
+    Disconnect();
+
+    std::string address;
+    if (!DnsCache::GetInstance().Resolve(host, address)) {
+        return false;
+    }
+    struct sockaddr_in server = {};
+    server.sin_family = AF_INET;
+    server.sin_port = htons(port);
+    if (inet_pton(AF_INET, address.c_str(), &server.sin_addr) != 1) {
+        ESP_LOGE(TAG, "Invalid address: %s", address.c_str());
+        return false;
+    }
+
+    fd_ = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (fd_ < 0) {
+        ESP_LOGE(TAG, "Failed to create socket: errno %d", errno);
+        return false;
+    }
+    // 設定できなくても通常の優先度で送る
+    SetSocketDscp(fd_, dscp_);
+    if (connect(fd_, (struct sockaddr*)&server, sizeof(server)) != 0) {
+        ESP_LOGE(TAG, "Failed to connect to %s:%d: errno %d", address.c_str(), port, errno);
+        close(fd_);
+        fd_ = -1;
+        return false;
+    }
+    receiving_ = true;
+    if (xTaskCreate([](void* arg) {
+        ((QosUdp*)arg)->ReceiveTask();
+    }, "udp_receive", 4096, this, 5, nullptr) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create the receive task");
+        receiving_ = false;
+        Disconnect();
+        return false;
+    }
+    ESP_LOGI(TAG, "Connected to %s:%d with DSCP %d", address.c_str(), port, dscp_);
+    return true;
+}
+
+void QosUdp::Disconnect() {
+    if (fd_ >= 0) {
+        // 受信中のrecv()を戻らせてから、受信タスクの終了を待つ
+        shutdown(fd_, SHUT_RDWR);
+        close(fd_);
+        fd_ = -1;
+    }
+    while (receiving_) {
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+}
+
+int QosUdp::Send(const std::string& data) {
+    if (fd_ < 0) {
+        return -1;
+    }
+    int ret = send(fd_, data.data(), data.size(), 0);
+    if (ret <= 0) {
+        ESP_LOGE(TAG, "Send failed: errno %d", errno);
+    }
+    return ret;
+}
+
+void QosUdp::ReceiveTask() {
+    std::string data;
+    int fd = fd_;
+    while (true) {
+        data.resize(QOS_UDP_RECEIVE_BUFFER);
+        int ret = recv(fd, data.data(), data.size(), 0);
+        if (ret <= 0) {
+            break;
+        }
+        data.resize(ret);
+        if (message_callback_) {
+            message_callback_(data);
+        }
+    }
+    receiving_ = false;
+    vTaskDelete(nullptr);
+}
@@ -0,0 +1,50 @@
+/**
+ * @file qos_udp.h
+ * @brief 音声用のDSCPを付けて送るUDPクライアント
+ *
+ * 混雑したAPでは、ベストエフォートの音声パケットが大きな転送の後ろに並んで揺らぎが増えます。
+ * 音声チャネルのソケットにだけDSCP（既定はEF）を設定し、WMM対応のAPとスイッチで
+ * 音声の優先度（AC_VO）として扱わせます。制御用のMQTTやHTTPの接続は変更しません。
+ */
+#ifndef _QOS_UDP_H_
+#define _QOS_UDP_H_
+
+#include <udp.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <atomic>
+#include <string>
+
+/**
+ * @brief ソケットにDSCPを設定（IP_TOSの上位6ビット）
+ * @param dscp 0〜63（0は何もしない）
+ * @return 設定できなかった場合false
+ */
+bool SetSocketDscp(int fd, int dscp);
+
+/**
+ * @class QosUdp
+ * @brief 送信前にDSCPを設定するlwIPソケットのUDPクライアント
+ *
+ * EspUdpと同じく接続済みソケットを使い、受信タスクからOnMessage()のコールバックを呼びます。
+ * 宛先の解決はDnsCacheを使います。
+ */
+class QosUdp : public Udp {
+public:
+    explicit QosUdp(int dscp);
+    ~QosUdp();
+
+    bool Connect(const std::string& host, int port) override;
+    void Disconnect() override;
+    int Send(const std::string& data) override;
+
+private:
+    int dscp_;
+    int fd_ = -1;
+    std::atomic<bool> receiving_{false};   /**< 受信タスクが動いている間true */
+
+    void ReceiveTask();
+};
+
+#endif // _QOS_UDP_H_
@@ -13,17 +13,25 @@
 #include "system_info.h"
 #include "font_awesome_symbols.h"
 #include "settings.h"
+#include "cached_tls_transport.h"
+#include "keep_alive_http.h"
+#include "qos_udp.h"
+#include "mcp_tool_cache.h"
+#include "boot_profile.h"
 #include "assets/lang_config.h"
+#if CONFIG_USE_POWER_GOVERNOR
+#include "power_governor.h"
+#endif
 
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
-#include <esp_http.h>
 #include <esp_mqtt.h>
 #include <esp_udp.h>
 #include <tcp_transport.h>
-#include <tls_transport.h>
 #include <web_socket.h>
 #include <esp_log.h>
+#include <esp_netif.h>
+#include <esp_wifi.h>
 
 #include <wifi_station.h>
 #include <wifi_configuration_ap.h>
@@ -31,6 +39,46 @@
 
 static const char *TAG = "WifiBoard";
 
+#if CONFIG_WIFI_STATIC_IP
+/**
+ * @brief DHCPクライアントを止めて固定IPを設定
+ *
+ * 接続前に設定しておくと、アソシエーション直後にIP_EVENT_STA_GOT_IPが発行され、
+ * DHCPの往復を待たずにWaitForConnected()が戻ります。
+ */
+static void ApplyStaticIp() {
+    esp_netif_t* netif = esp_netif_get_handle_from_ifkey("WIFI_STA_DEF");
+    if (netif == nullptr) {
+        ESP_LOGE(TAG, "WiFi station netif not found");
+        return;
+    }
+
+    esp_netif_ip_info_t ip_info = {};
+    if (esp_netif_str_to_ip4(CONFIG_WIFI_STATIC_IP_ADDRESS, &ip_info.ip) != ESP_OK ||
+        esp_netif_str_to_ip4(CONFIG_WIFI_STATIC_IP_NETMASK, &ip_info.netmask) != ESP_OK ||
+        esp_netif_str_to_ip4(CONFIG_WIFI_STATIC_IP_GATEWAY, &ip_info.gw) != ESP_OK) {
+        ESP_LOGE(TAG, "Invalid static IP configuration, using DHCP");
+        return;
+    }
+
+    esp_err_t ret = esp_netif_dhcpc_stop(netif);
+    if (ret != ESP_OK && ret != ESP_ERR_ESP_NETIF_DHCP_ALREADY_STOPPED) {
+        ESP_LOGE(TAG, "Failed to stop DHCP client: %s", esp_err_to_name(ret));
+        return;
+    }
+    ESP_ERROR_CHECK(esp_netif_set_ip_info(netif, &ip_info));
+
+    // DNSが未設定ならゲートウェイを使う
+    esp_netif_dns_info_t dns = {};
+    dns.ip.type = ESP_IPADDR_TYPE_V4;
+    if (esp_netif_str_to_ip4(CONFIG_WIFI_STATIC_IP_DNS, &dns.ip.u_addr.ip4) != ESP_OK) {
+        dns.ip.u_addr.ip4 = ip_info.gw;
+    }
+    esp_netif_set_dns_info(netif, ESP_NETIF_DNS_MAIN, &dns);
+    ESP_LOGI(TAG, "Using static IP %s", CONFIG_WIFI_STATIC_IP_ADDRESS);
+}
+#endif
+
 /**
  * @brief WifiBoardクラスのコンストラクタ
  * 
@@ -129,12 +177,19 @@ void WifiBoard::StartNetwork() {
         display->ShowNotification(notification.c_str(), 30000);
     });
     wifi_station.OnConnected([this](const std::string& ssid) {
+        BootProfile::GetInstance().Mark(kBootNetworkConnected);
         auto display = Board::GetInstance().GetDisplay();
         std::string notification = Lang::Strings::CONNECTED_TO;
         notification += ssid;
         display->ShowNotification(notification.c_str(), 30000);
+        display->PostStatusBarUpdate(true);
+        McpToolCache::Invalidate();
     });
     wifi_station.Start();
+#if CONFIG_WIFI_STATIC_IP
+    // Start()でnetifが作られ、スキャンと接続はイベントタスクで進むため、ここで間に合う
+    ApplyStaticIp();
+#endif
 
     // Try to connect to WiFi, if failed, launch the WiFi configuration AP
     if (!wifi_station.WaitForConnected(60 * 1000)) {
@@ -146,14 +201,22 @@ void WifiBoard::StartNetwork() {
 }
 
 Http* WifiBoard::CreateHttp() {
-    return new EspHttp();
+    // 同じホストへの繰り返しのリクエスト（バージョン確認、アクティベーション、画像の説明）で接続を使い回す
+    return new KeepAliveHttp();
 }
 
 WebSocket* WifiBoard::CreateWebSocket() {
     Settings settings("websocket", false);
     std::string url = settings.GetString("url");
     if (url.find("wss://") == 0) {
-        return new WebSocket(new TlsTransport());
+#if CONFIG_USE_AUDIO_DSCP && !CONFIG_WEBSOCKET_UDP_AUDIO
+        // 音声も同じ接続で送るため、接続全体を音声の優先度にする
+        int dscp = CONFIG_AUDIO_DSCP;
+#else
+        int dscp = 0;
+#endif
+        // DNS結果とTLSセッションを接続間で共有し、2回目以降のハンドシェイクを短縮する
+        return new WebSocket(new CachedTlsTransport(dscp));
     } else {
         return new WebSocket(new TcpTransport());
     }
@@ -165,7 +228,12 @@ Mqtt* WifiBoard::CreateMqtt() {
 }
 
 Udp* WifiBoard::CreateUdp() {
+#if CONFIG_USE_AUDIO_DSCP
+    // UDPは音声チャネルにだけ使う
+    return new QosUdp(CONFIG_AUDIO_DSCP);
+#else
     return new EspUdp();
+#endif
 }
 
 const char* WifiBoard::GetNetworkStateIcon() {
@@ -186,6 +254,21 @@ const char* WifiBoard::GetNetworkStateIcon() {
     }
 }
 
+bool WifiBoard::IsNetworkWeak() {
+    auto& wifi_station = WifiStation::GetInstance();
+    // GetNetworkStateIcon()のWEAK表示と同じしきい値
+    return !wifi_config_mode_ && wifi_station.IsConnected() && wifi_station.GetRssi() < -70;
+}
+
+bool WifiBoard::GetSignalStrength(int& rssi) {
+    auto& wifi_station = WifiStation::GetInstance();
+    if (wifi_config_mode_ || !wifi_station.IsConnected()) {
+        return false;
+    }
+    rssi = wifi_station.GetRssi();
+    return true;
+}
+
 std::string WifiBoard::GetBoardJson() {
     // Set the board type for OTA
     auto& wifi_station = WifiStation::GetInstance();
@@ -202,8 +285,60 @@ std::string WifiBoard::GetBoardJson() {
 }
 
 void WifiBoard::SetPowerSaveMode(bool enabled) {
-    auto& wifi_station = WifiStation::GetInstance();
-    wifi_station.SetPowerSaveMode(enabled);
+    if (enabled) {
+        power_profile_ = kNetworkPowerSave;
+    } else if (power_profile_ == kNetworkPowerSave) {
+        power_profile_ = kNetworkPowerLowLatency;
+    }
+    ApplyWifiPowerSave();
+}
+
+void WifiBoard::ApplyWifiPowerSave() {
+    if (wifi_config_mode_) {
+        return;
+    }
+    auto type = GetWifiPowerSaveType(power_profile_);
+    esp_err_t ret = esp_wifi_set_ps(type);
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to set power save type %d: %s", type, esp_err_to_name(ret));
+    }
+}
+
+void WifiBoard::RefreshNetworkPowerProfile() {
+    ApplyWifiPowerSave();
+}
+
+void WifiBoard::SetNetworkPowerProfile(NetworkPowerProfile profile) {
+    power_profile_ = profile;
+    SetPowerSaveMode(profile == kNetworkPowerSave);
+}
+
+wifi_ps_type_t WifiBoard::GetWifiPowerSaveType(NetworkPowerProfile profile) {
+#if CONFIG_USE_POWER_GOVERNOR
+    // 電池で動いている間は待機中の起床を減らし、残量が少なければ聞き取り中もDTIMごとの起床にとどめる。
+    // 応答の受信（スループット優先）はスリープしない
+    auto tier = PowerGovernor::GetInstance().tier();
+    if (profile == kNetworkPowerSave && tier != kPowerTierFull) {
+        return WIFI_PS_MAX_MODEM;
+    }
+    if (profile == kNetworkPowerLowLatency && tier == kPowerTierSaver) {
+        return WIFI_PS_MIN_MODEM;
+    }
+#endif
+    switch (profile) {
+        case kNetworkPowerSave:
+#if CONFIG_WIFI_IDLE_PS_MAX_MODEM
+            // APとのアソシエーション時に決まるリッスン間隔ごとに起床
+            return WIFI_PS_MAX_MODEM;
+#else
+            // DTIMビーコンごとに起床
+            return WIFI_PS_MIN_MODEM;
+#endif
+        case kNetworkPowerLowLatency:
+        case kNetworkPowerThroughput:
+        default:
+            return WIFI_PS_NONE;
+    }
 }
 
 void WifiBoard::ResetWifiConfiguration() {
@@ -10,6 +10,8 @@
 
 #include "board.h"
 
+#include <esp_wifi_types.h>
+
 /**
  * @class WifiBoard
  * @brief WiFi機能付きボードの基底クラス
@@ -22,6 +24,20 @@ class WifiBoard : public Board {
 protected:
     /** @brief WiFi設定モードフラグ（true: 設定モード, false: 通常モード） */
     bool wifi_config_mode_ = false;
+
+    /** @brief 現在の省電力方針（SetPowerSaveMode()を直接呼んだ場合も追従する） */
+    NetworkPowerProfile power_profile_ = kNetworkPowerLowLatency;
+
+    /**
+     * @brief 省電力方針に対応するWiFiのスリープ種別
+     *
+     * 既定では待機中はCONFIG_WIFI_IDLE_POWER_SAVEの設定、それ以外はスリープなしです。
+     * 電池容量やアンテナ特性に合わせてボードごとに上書きできます。
+     */
+    virtual wifi_ps_type_t GetWifiPowerSaveType(NetworkPowerProfile profile);
+
+    /** @brief 現在の省電力方針のスリープ種別をWiFiへ設定 */
+    void ApplyWifiPowerSave();
     
     /**
      * @brief WiFi設定モードに入る
@@ -89,6 +105,18 @@ public:
      * @return const char* 現在のWiFi接続状態を表すアイコン文字
      */
     virtual const char* GetNetworkStateIcon() override;
+
+    /**
+     * @brief 電波強度が弱いかどうか
+     * @return bool RSSIが-70dBm未満の場合true
+     */
+    virtual bool IsNetworkWeak() override;
+
+    /**
+     * @brief 接続中のAPのRSSIを取得
+     * @return bool 未接続または設定モードの場合false
+     */
+    virtual bool GetSignalStrength(int& rssi) override;
     
     /**
      * @brief 省電力モード設定
@@ -97,6 +125,20 @@ public:
      * WiFiの省電力機能（モデムスリープ等）を制御します。
      */
     virtual void SetPowerSaveMode(bool enabled) override;
+
+    /**
+     * @brief 省電力方針の設定
+     *
+     * SetPowerSaveMode()を経由するため、ボード側の上書き（省電力タイマーの起床など）も呼ばれます。
+     */
+    virtual void SetNetworkPowerProfile(NetworkPowerProfile profile) override;
+
+    /**
+     * @brief 現在の省電力方針を設定し直す
+     *
+     * ボード側のSetPowerSaveMode()の上書き（省電力タイマーの起床など）は呼びません。
+     */
+    virtual void RefreshNetworkPowerProfile() override;
     
     /**
      * @brief WiFi設定リセット
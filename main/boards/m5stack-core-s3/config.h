@@ -75,6 +75,9 @@
 /** @brief 音量ダウンボタンGPIO（CoreS3では未使用） */
 #define VOLUME_DOWN_BUTTON_GPIO GPIO_NUM_NC
 
+/** @brief タッチパネル（FT6336）の割り込みピン（AW9523と共有のINT線） */
+#define TOUCH_INT_GPIO          GPIO_NUM_21
+
 // ================================================================
 // ディスプレイ関連設定
 // ================================================================
@@ -112,6 +115,13 @@
 /** @brief バックライト出力反転フラグ */
 #define DISPLAY_BACKLIGHT_OUTPUT_INVERT true
 
+// ================================================================
+// 電源管理関連設定
+// ================================================================
+
+/** @brief AXP2101の充放電状態と残量を読み直す間隔（ミリ秒） */
+#define PMIC_TELEMETRY_INTERVAL_MS 5000
+
 // ================================================================
 // カメラ関連設定
 // ================================================================
@@ -7,12 +7,19 @@
 
 static const char TAG[] = "CoreS3AudioCodec";
 
+// ES7210のTDMフレームの時隙（MIC1〜MIC4）。CoreS3ではMIC2にAW88298の出力を戻している
+#define CORES3_TDM_SLOT_NUM         4
+#define CORES3_TDM_SLOT_MIC         0   // MIC1: 1つ目のマイク
+#define CORES3_TDM_SLOT_REFERENCE   1   // MIC2: AECのリファレンス
+#define CORES3_TDM_SLOT_MIC2        2   // MIC3: 2つ目のマイク
+
 CoreS3AudioCodec::CoreS3AudioCodec(void* i2c_master_handle, int input_sample_rate, int output_sample_rate,
     gpio_num_t mclk, gpio_num_t bclk, gpio_num_t ws, gpio_num_t dout, gpio_num_t din,
-    uint8_t aw88298_addr, uint8_t es7210_addr, bool input_reference) {
+    uint8_t aw88298_addr, uint8_t es7210_addr, bool input_reference, int input_mics) {
     duplex_ = true; // 是否双工
     input_reference_ = input_reference; // 是否使用参考输入，实现回声消除
-    input_channels_ = input_reference_ ? 2 : 1; // 输入通道数
+    input_mics_ = input_mics > 1 ? 2 : 1;
+    input_channels_ = input_mics_ + (input_reference_ ? 1 : 0); // 输入通道数
     input_sample_rate_ = input_sample_rate;
     output_sample_rate_ = output_sample_rate;
 
@@ -73,7 +80,8 @@ CoreS3AudioCodec::CoreS3AudioCodec(void* i2c_master_handle, int input_sample_rat
     input_dev_ = esp_codec_dev_new(&dev_cfg);
     assert(input_dev_ != NULL);
 
-    ESP_LOGI(TAG, "CoreS3AudioCodec initialized");
+    bus_scheduler_ = I2cBusScheduler::For((i2c_master_bus_handle_t)i2c_master_handle);
+    ESP_LOGI(TAG, "CoreS3AudioCodec initialized, input format %s", input_format().c_str());
 }
 
 CoreS3AudioCodec::~CoreS3AudioCodec() {
@@ -90,6 +98,29 @@ CoreS3AudioCodec::~CoreS3AudioCodec() {
     audio_codec_delete_data_if(data_if_);
 }
 
+uint32_t CoreS3AudioCodec::InputSlotMask() const {
+    uint32_t mask = 1 << CORES3_TDM_SLOT_MIC;
+    if (input_reference_) {
+        mask |= 1 << CORES3_TDM_SLOT_REFERENCE;
+    }
+    if (input_mics_ > 1) {
+        mask |= 1 << CORES3_TDM_SLOT_MIC2;
+    }
+    return mask;
+}
+
+std::string CoreS3AudioCodec::input_format() const {
+    // DMAには有効な時隙だけが時隙の番号順に並ぶため、並べ替えずにその順で渡す（2マイクは"MRM"）
+    std::string format;
+    uint32_t mask = InputSlotMask();
+    for (int slot = 0; slot < CORES3_TDM_SLOT_NUM; ++slot) {
+        if (mask & (1 << slot)) {
+            format.push_back(slot == CORES3_TDM_SLOT_REFERENCE ? 'R' : 'M');
+        }
+    }
+    return format;
+}
+
 void CoreS3AudioCodec::CreateDuplexChannels(gpio_num_t mclk, gpio_num_t bclk, gpio_num_t ws, gpio_num_t dout, gpio_num_t din) {
     assert(input_sample_rate_ == output_sample_rate_);
 
@@ -151,7 +182,8 @@ void CoreS3AudioCodec::CreateDuplexChannels(gpio_num_t mclk, gpio_num_t bclk, gp
             .data_bit_width = I2S_DATA_BIT_WIDTH_16BIT,
             .slot_bit_width = I2S_SLOT_BIT_WIDTH_AUTO,
             .slot_mode = I2S_SLOT_MODE_STEREO,
-            .slot_mask = i2s_tdm_slot_mask_t(I2S_TDM_SLOT0 | I2S_TDM_SLOT1 | I2S_TDM_SLOT2 | I2S_TDM_SLOT3),
+            // 使う時隙だけを受信する（使わない時隙はDMAへ転送されない）
+            .slot_mask = i2s_tdm_slot_mask_t(InputSlotMask()),
             .ws_width = I2S_TDM_AUTO_WS_WIDTH,
             .ws_pol = false,
             .bit_shift = true,
@@ -159,7 +191,8 @@ void CoreS3AudioCodec::CreateDuplexChannels(gpio_num_t mclk, gpio_num_t bclk, gp
             .big_endian = false,
             .bit_order_lsb = false,
             .skip_mask = false,
-            .total_slot = I2S_TDM_AUTO_SLOT_NUM
+            // マスクから数えると時隙が減ってフレームの長さが変わるため、ES7210のフレームに合わせて固定する
+            .total_slot = CORES3_TDM_SLOT_NUM
         },
         .gpio_cfg = {
             .mclk = mclk,
@@ -181,6 +214,7 @@ void CoreS3AudioCodec::CreateDuplexChannels(gpio_num_t mclk, gpio_num_t bclk, gp
 }
 
 void CoreS3AudioCodec::SetOutputVolume(int volume) {
+    I2cBusScheduler::Guard guard(bus_scheduler_, kI2cPriorityCodec);
     ESP_ERROR_CHECK(esp_codec_dev_set_out_vol(output_dev_, volume));
     AudioCodec::SetOutputVolume(volume);
 }
@@ -189,19 +223,22 @@ void CoreS3AudioCodec::EnableInput(bool enable) {
     if (enable == input_enabled_) {
         return;
     }
+    I2cBusScheduler::Guard guard(bus_scheduler_, kI2cPriorityCodec);
     if (enable) {
+        // 1マイクは従来どおり2時隙、2マイクはMIC3まで届くようES7210の4時隙のフレームから選ぶ
         esp_codec_dev_sample_info_t fs = {
             .bits_per_sample = 16,
-            .channel = 2,
-            .channel_mask = ESP_CODEC_DEV_MAKE_CHANNEL_MASK(0),
+            .channel = (uint8_t)(input_mics_ > 1 ? CORES3_TDM_SLOT_NUM : 2),
+            .channel_mask = (uint16_t)InputSlotMask(),
             .sample_rate = (uint32_t)output_sample_rate_,
             .mclk_multiple = 0,
         };
-        if (input_reference_) {
-            fs.channel_mask |= ESP_CODEC_DEV_MAKE_CHANNEL_MASK(1);
-        }
         ESP_ERROR_CHECK(esp_codec_dev_open(input_dev_, &fs));
-        ESP_ERROR_CHECK(esp_codec_dev_set_in_channel_gain(input_dev_, ESP_CODEC_DEV_MAKE_CHANNEL_MASK(0), 40.0));
+        uint32_t mic_mask = ESP_CODEC_DEV_MAKE_CHANNEL_MASK(CORES3_TDM_SLOT_MIC);
+        if (input_mics_ > 1) {
+            mic_mask |= ESP_CODEC_DEV_MAKE_CHANNEL_MASK(CORES3_TDM_SLOT_MIC2);
+        }
+        ESP_ERROR_CHECK(esp_codec_dev_set_in_channel_gain(input_dev_, mic_mask, 40.0));
     } else {
         ESP_ERROR_CHECK(esp_codec_dev_close(input_dev_));
     }
@@ -212,6 +249,7 @@ void CoreS3AudioCodec::EnableOutput(bool enable) {
     if (enable == output_enabled_) {
         return;
     }
+    I2cBusScheduler::Guard guard(bus_scheduler_, kI2cPriorityCodec);
     if (enable) {
         // Play 16bit 1 channel
         esp_codec_dev_sample_info_t fs = {
@@ -229,16 +267,33 @@ void CoreS3AudioCodec::EnableOutput(bool enable) {
     AudioCodec::EnableOutput(enable);
 }
 
-int CoreS3AudioCodec::Read(int16_t* dest, int samples) {
+void CoreS3AudioCodec::SetOutputMuted(bool muted) {
+    if (!output_enabled_ || muted == output_muted_) {
+        return;
+    }
+    // AW88298のデジタル消音だけを切り替える（I2Sのクロックとアンプは動かしたまま）
+    I2cBusScheduler::Guard guard(bus_scheduler_, kI2cPriorityCodec);
+    ESP_ERROR_CHECK_WITHOUT_ABORT(esp_codec_dev_set_out_mute(output_dev_, muted));
+    AudioCodec::SetOutputMuted(muted);
+}
+
+int AUDIO_HOT_ATTR CoreS3AudioCodec::Read(int16_t* dest, int samples) {
     if (input_enabled_) {
         ESP_ERROR_CHECK_WITHOUT_ABORT(esp_codec_dev_read(input_dev_, (void*)dest, samples * sizeof(int16_t)));
     }
     return samples;
 }
 
-int CoreS3AudioCodec::Write(const int16_t* data, int samples) {
+int AUDIO_HOT_ATTR CoreS3AudioCodec::Write(const int16_t* data, int samples) {
     if (output_enabled_) {
+#if CONFIG_AUDIO_CODEC_DIRECT_I2S_WRITE
+        // esp_codec_dev_openでモノラルに設定済み。音量はAW88298側なのでデータはそのままDMAへ書く
+        size_t bytes_written = 0;
+        ESP_ERROR_CHECK_WITHOUT_ABORT(i2s_channel_write(tx_handle_, data, samples * sizeof(int16_t), &bytes_written, portMAX_DELAY));
+        return bytes_written / sizeof(int16_t);
+#else
         ESP_ERROR_CHECK_WITHOUT_ABORT(esp_codec_dev_write(output_dev_, (void*)data, samples * sizeof(int16_t)));
+#endif
     }
     return samples;
 }
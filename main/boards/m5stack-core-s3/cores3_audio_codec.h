@@ -9,6 +9,7 @@
 #define _BOX_AUDIO_CODEC_H
 
 #include "audio_codec.h"
+#include "i2c_bus_scheduler.h"
 
 #include <esp_codec_dev.h>
 #include <esp_codec_dev_defaults.h>
@@ -46,6 +47,15 @@ private:
     /** @brief 入力デバイスハンドル（ES7210マイクアレイ） */
     esp_codec_dev_handle_t input_dev_ = nullptr;
 
+    /** @brief PMIC・タッチと共有するI2Cバスの調停器（制御はコーデック優先度で行う） */
+    I2cBusScheduler* bus_scheduler_ = nullptr;
+
+    /** @brief 入力に使うマイクの数（1: MIC1のみ、2: MIC1とMIC3） */
+    int input_mics_ = 1;
+
+    /** @brief 受信するTDM時隙のマスク（マイクとリファレンスの分だけ） */
+    uint32_t InputSlotMask() const;
+
     /**
      * @brief デュプレックスチャンネルの作成
      * @param mclk マスタークロックGPIOピン
@@ -88,13 +98,15 @@ public:
      * @param aw88298_addr AW88298アンプのI2Cアドレス
      * @param es7210_addr ES7210マイクアレイのI2Cアドレス
      * @param input_reference 入力リファレンス使用フラグ
+     * @param input_mics 入力に使うマイクの数（1または2）
      * 
      * デュアルコーデック構成のオーディオシステムを初期化します。
      * AW88298とES7210の両方を設定し、デュプレックス通信を確立します。
+     * ES7210のTDMフレームからはマイクとリファレンスの時隙だけを受信します。
      */
     CoreS3AudioCodec(void* i2c_master_handle, int input_sample_rate, int output_sample_rate,
         gpio_num_t mclk, gpio_num_t bclk, gpio_num_t ws, gpio_num_t dout, gpio_num_t din,
-        uint8_t aw88298_addr, uint8_t es7210_addr, bool input_reference);
+        uint8_t aw88298_addr, uint8_t es7210_addr, bool input_reference, int input_mics = 1);
     
     /**
      * @brief デストラクタ
@@ -126,6 +138,20 @@ public:
      * AW88298アンプからの音声出力を制御します。
      */
     virtual void EnableOutput(bool enable) override;
+
+    /**
+     * @brief 出力の消音/解除
+     * @param muted true: 消音, false: 解除
+     * 
+     * AW88298を開いたまま消音を切り替えます（esp_codec_dev_openより速い）。
+     */
+    virtual void SetOutputMuted(bool muted) override;
+
+    /**
+     * @brief 入力チャンネルの並び
+     * @return 受信する時隙の順の並び（"M"、"MR"、2マイクは"MRM"）
+     */
+    virtual std::string input_format() const override;
 };
 
 #endif // _BOX_AUDIO_CODEC_H
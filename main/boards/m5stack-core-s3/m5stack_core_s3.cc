@@ -10,22 +10,36 @@
 #include "wifi_board.h"
 #include "cores3_audio_codec.h"
 #include "display/lcd_display.h"
+#include "display/touch_gestures.h"
 #include "application.h"
 #include "config.h"
 #include "power_save_timer.h"
 #include "i2c_device.h"
 #include "iot/thing_manager.h"
 #include "axp2101.h"
+#include "init_graph.h"
+#include "settings.h"
+#if CONFIG_USE_ULP_SOUND_WAKE
+#include "sound_wake_standby.h"
+#endif
+#include "assets/lang_config.h"
+#if CONFIG_CORES3_INPUT_LAYOUT_AUTO && (CONFIG_USE_AUDIO_PROCESSOR || CONFIG_USE_WAKE_WORD_DETECT)
+#include "afe_profile.h"
+#endif
 
 #include <esp_log.h>
 #include <driver/i2c_master.h>
+#include <driver/gpio.h>
 #include <wifi_station.h>
 #include <esp_lcd_panel_io.h>
 #include <esp_lcd_panel_ops.h>
 #include <esp_lcd_ili9341.h>
-#include <esp_timer.h>
+#include <esp_lcd_touch_ft5x06.h>
+#include <esp_lvgl_port.h>
 #include "esp32_camera.h"
 
+#include <algorithm>
+
 #define TAG "M5StackCoreS3Board"
 
 // LVGL フォント宣言
@@ -82,6 +96,16 @@ public:
         brightness = ((brightness + 641) >> 5);
         WriteReg(0x99, brightness);        // LDO4 電圧レジスタに書き込み
     }
+
+    /**
+     * @brief バックライトの電源を切る
+     * 
+     * ディープスリープ中もPMICの出力は残るため、待機に入る前に呼びます。
+     * 次の起動でコンストラクタが電源設定を書き直すと元に戻ります。
+     */
+    void DisableBacklightPower() {
+        WriteReg(0x90, ReadReg(0x90) & ~0x80);
+    }
 };
 
 /**
@@ -97,7 +121,12 @@ public:
      * @brief カスタムバックライトのコンストラクタ
      * @param pmic PMIC制御オブジェクトへのポインタ
      */
-    CustomBacklight(Pmic *pmic) : pmic_(pmic) {}
+    CustomBacklight(Pmic *pmic) : pmic_(pmic) {
+        // 1段ごとにI2C書き込みになるため、LDOの電圧段階に合わせて粗く変える
+        // （0→100で5回の書き込み、フェードの長さはPWMと同じ）
+        step_ = 20;
+        step_interval_ms_ = step_ * BACKLIGHT_TRANSITION_MS_PER_STEP;
+    }
 
     /**
      * @brief 実際の明度設定実装
@@ -107,8 +136,7 @@ public:
      * LCDバックライトの明度を制御します。
      */
     void SetBrightnessImpl(uint8_t brightness) override {
-        pmic_->SetBrightness(target_brightness_);  // PMICに明度設定を送信
-        brightness_ = target_brightness_;           // 内部状態を更新
+        pmic_->SetBrightness(brightness);  // PMICに明度設定を送信
     }
 
 private:
@@ -127,6 +155,11 @@ public:
         WriteReg(0x11, 0b00010000);  // GCR P0 port is Push-Pull mode.
         WriteReg(0x12, 0b11111111);  // LEDMODE_P0
         WriteReg(0x13, 0b11111111);  // LEDMODE_P1
+        // 入力変化の割り込みを無効にし、共有のINT線（TOUCH_INT_GPIO）をタッチ専用にする
+        WriteReg(0x06, 0b11111111);  // INT_P0
+        WriteReg(0x07, 0b11111111);  // INT_P1
+        ReadReg(0x00);               // 入力ポートを読んで保留中の割り込みを解除
+        ReadReg(0x01);
     }
 
     void ResetAw88298() {
@@ -146,50 +179,24 @@ public:
     }
 };
 
-class Ft6336 : public I2cDevice {
-public:
-    struct TouchPoint_t {
-        int num = 0;
-        int x = -1;
-        int y = -1;
-    };
-    
-    Ft6336(i2c_master_bus_handle_t i2c_bus, uint8_t addr) : I2cDevice(i2c_bus, addr) {
-        uint8_t chip_id = ReadReg(0xA3);
-        ESP_LOGI(TAG, "Get chip ID: 0x%02X", chip_id);
-        read_buffer_ = new uint8_t[6];
-    }
-
-    ~Ft6336() {
-        delete[] read_buffer_;
-    }
-
-    void UpdateTouchPoint() {
-        ReadRegs(0x02, read_buffer_, 6);
-        tp_.num = read_buffer_[0] & 0x0F;
-        tp_.x = ((read_buffer_[1] & 0x0F) << 8) | read_buffer_[2];
-        tp_.y = ((read_buffer_[3] & 0x0F) << 8) | read_buffer_[4];
-    }
-
-    inline const TouchPoint_t& GetTouchPoint() {
-        return tp_;
-    }
-
-private:
-    uint8_t* read_buffer_ = nullptr;
-    TouchPoint_t tp_;
-};
-
-
 class M5StackCoreS3Board : public WifiBoard {
 private:
     i2c_master_bus_handle_t i2c_bus_;
     Pmic* pmic_;
     Aw9523* aw9523_;
-    Ft6336* ft6336_;
     LcdDisplay* display_;
-    Esp32Camera* camera_;
-    esp_timer_handle_t touchpad_timer_;
+    Esp32Camera* camera_ = nullptr;
+    TouchGestures* touch_gestures_ = nullptr;
+
+    // esp_lvgl_portのタッチ読み取りコールバック（タッチ優先度でバスを使うために包む）
+    static inline lv_indev_read_cb_t touch_read_cb_ = nullptr;
+    static inline I2cBusScheduler* touch_bus_scheduler_ = nullptr;
+
+    static void TouchReadCallback(lv_indev_t* indev, lv_indev_data_t* data) {
+        I2cBusScheduler::Guard guard(touch_bus_scheduler_, kI2cPriorityTouch);
+        touch_read_cb_(indev, data);
+    }
+
     PowerSaveTimer* power_save_timer_;
 
     void InitializePowerSaveTimer() {
@@ -200,14 +207,28 @@ private:
             display->SetChatMessage("system", "");
             display->SetEmotion("sleepy");
             GetBacklight()->SetBrightness(10);
+            display->SetPowerState(kDisplayPowerDimmed);
+            Application::GetInstance().SetStandbyAllowed(false);
         });
         power_save_timer_->OnExitSleepMode([this]() {
+            Application::GetInstance().SetStandbyAllowed(true);
             auto display = GetDisplay();
+            display->SetPowerState(kDisplayPowerOn);
             display->SetChatMessage("system", "");
             display->SetEmotion("neutral");
             GetBacklight()->RestoreBrightness();
         });
         power_save_timer_->OnShutdownRequest([this]() {
+#if CONFIG_USE_ULP_SOUND_WAKE
+            // 電源を切らずにディープスリープで待機し、音で起きる
+            GetDisplay()->SetPowerState(kDisplayPowerOff);
+            pmic_->DisableBacklightPower();
+            if (SoundWakeStandby::Enter()) {
+                return;
+            }
+            ESP_LOGW(TAG, "Sound wake standby unavailable, powering off");
+#endif
+            Settings::Flush();
             pmic_->PowerOff();
         });
         power_save_timer_->SetEnabled(true);
@@ -230,6 +251,7 @@ private:
         ESP_ERROR_CHECK(i2c_new_master_bus(&i2c_bus_cfg, &i2c_bus_));
     }
 
+#if CONFIG_BOARD_I2C_SCAN
     void I2cDetect() {
         uint8_t address;
         printf("     0  1  2  3  4  5  6  7  8  9  a  b  c  d  e  f\r\n");
@@ -250,10 +272,13 @@ private:
             printf("\r\n");
         }
     }
+#endif
 
     void InitializeAxp2101() {
         ESP_LOGI(TAG, "Init AXP2101");
         pmic_ = new Pmic(i2c_bus_, 0x34);
+        // 電池残量はステータスバーやMCPから頻繁に参照されるため、読み取りはバックグラウンドで行う
+        pmic_->StartTelemetry(PMIC_TELEMETRY_INTERVAL_MS);
     }
 
     void InitializeAw9523() {
@@ -262,54 +287,96 @@ private:
         vTaskDelay(pdMS_TO_TICKS(50));
     }
 
-    void PollTouchpad() {
-        static bool was_touched = false;
-        static int64_t touch_start_time = 0;
-        const int64_t TOUCH_THRESHOLD_MS = 500;  // 触摸时长阈值，超过500ms视为长按
-        
-        ft6336_->UpdateTouchPoint();
-        auto& touch_point = ft6336_->GetTouchPoint();
-        
-        // 检测触摸开始
-        if (touch_point.num > 0 && !was_touched) {
-            was_touched = true;
-            touch_start_time = esp_timer_get_time() / 1000; // 转换为毫秒
-        } 
-        // 检测触摸释放
-        else if (touch_point.num == 0 && was_touched) {
-            was_touched = false;
-            int64_t touch_duration = (esp_timer_get_time() / 1000) - touch_start_time;
-            
-            // 只有短触才触发
-            if (touch_duration < TOUCH_THRESHOLD_MS) {
-                auto& app = Application::GetInstance();
-                if (app.GetDeviceState() == kDeviceStateStarting && 
+    /**
+     * @brief タッチジェスチャーの処理
+     *
+     * LVGLタスクから呼ばれるため、状態遷移はメインタスクへ渡す。
+     * タップは従来どおり会話の開始/終了、上下スワイプは音量の調整。
+     */
+    void OnTouchGesture(TouchGesture gesture, int32_t x, int32_t y) {
+        ESP_LOGI(TAG, "Touch gesture %s at (%ld, %ld)", TouchGestures::Name(gesture), (long)x, (long)y);
+        power_save_timer_->WakeUp();
+        auto& app = Application::GetInstance();
+        switch (gesture) {
+        case kTouchGestureTap:
+            app.Schedule([this, &app]() {
+                if (app.GetDeviceState() == kDeviceStateStarting &&
                     !WifiStation::GetInstance().IsConnected()) {
                     ResetWifiConfiguration();
                 }
                 app.ToggleChatState();
-            }
+            }, kSchedulePriorityAudio);
+            break;
+        case kTouchGestureSwipeUp:
+        case kTouchGestureSwipeDown: {
+            int delta = gesture == kTouchGestureSwipeUp ? 10 : -10;
+            app.Schedule([this, delta]() {
+                auto codec = GetAudioCodec();
+                auto volume = std::clamp(codec->output_volume() + delta, 0, 100);
+                codec->SetOutputVolume(volume);
+                GetDisplay()->ShowNotification(Lang::Strings::VOLUME + std::to_string(volume));
+            }, kSchedulePriorityUi);
+            break;
+        }
+        default:
+            break;
         }
     }
 
-    void InitializeFt6336TouchPad() {
+    void InitializeTouch() {
         ESP_LOGI(TAG, "Init FT6336");
-        ft6336_ = new Ft6336(i2c_bus_, 0x38);
-        
-        // 创建定时器，20ms 间隔
-        esp_timer_create_args_t timer_args = {
-            .callback = [](void* arg) {
-                M5StackCoreS3Board* board = (M5StackCoreS3Board*)arg;
-                board->PollTouchpad();
+        esp_lcd_touch_handle_t tp;
+        // INTはesp_lvgl_portのイベントモードに渡さず、TouchGesturesで読み取りの要否の判定に使う
+        esp_lcd_touch_config_t tp_cfg = {
+            .x_max = DISPLAY_WIDTH,
+            .y_max = DISPLAY_HEIGHT,
+            .rst_gpio_num = GPIO_NUM_NC,
+            .int_gpio_num = GPIO_NUM_NC,
+            .levels = {
+                .reset = 0,
+                .interrupt = 0,
+            },
+            .flags = {
+                .swap_xy = DISPLAY_SWAP_XY,
+                .mirror_x = DISPLAY_MIRROR_X,
+                .mirror_y = DISPLAY_MIRROR_Y,
             },
-            .arg = this,
-            .dispatch_method = ESP_TIMER_TASK,
-            .name = "touchpad_timer",
-            .skip_unhandled_events = true,
         };
-        
-        ESP_ERROR_CHECK(esp_timer_create(&timer_args, &touchpad_timer_));
-        ESP_ERROR_CHECK(esp_timer_start_periodic(touchpad_timer_, 20 * 1000));
+        esp_lcd_panel_io_handle_t tp_io_handle = NULL;
+        esp_lcd_panel_io_i2c_config_t tp_io_config = ESP_LCD_TOUCH_IO_I2C_FT5x06_CONFIG();
+        tp_io_config.scl_speed_hz = 400000;
+        ESP_ERROR_CHECK(esp_lcd_new_panel_io_i2c(i2c_bus_, &tp_io_config, &tp_io_handle));
+        ESP_ERROR_CHECK(esp_lcd_touch_new_i2c_ft5x06(tp_io_handle, &tp_cfg, &tp));
+
+        // G_MODE: タッチ中はINTをLowに保つ
+        uint8_t mode = 0x00;
+        esp_lcd_panel_io_tx_param(tp_io_handle, 0xA4, &mode, 1);
+
+        gpio_config_t io_config = {
+            .pin_bit_mask = 1ULL << TOUCH_INT_GPIO,
+            .mode = GPIO_MODE_INPUT,
+            .pull_up_en = GPIO_PULLUP_ENABLE,
+            .pull_down_en = GPIO_PULLDOWN_DISABLE,
+            .intr_type = GPIO_INTR_DISABLE,
+        };
+        ESP_ERROR_CHECK(gpio_config(&io_config));
+
+        const lvgl_port_touch_cfg_t touch_cfg = {
+            .disp = lv_display_get_default(),
+            .handle = tp,
+        };
+        lv_indev_t* indev = lvgl_port_add_touch(&touch_cfg);
+        lvgl_port_lock(0);
+        touch_read_cb_ = lv_indev_get_read_cb(indev);
+        touch_bus_scheduler_ = I2cBusScheduler::For(i2c_bus_);
+        lv_indev_set_read_cb(indev, TouchReadCallback);
+        lvgl_port_unlock();
+
+        // 離している間はI2C（AXP2101・AW9523・コーデックと共有）を読まない
+        touch_gestures_ = new TouchGestures([this](TouchGesture gesture, int32_t x, int32_t y) {
+            OnTouchGesture(gesture, x, y);
+        });
+        touch_gestures_->Attach(indev, TOUCH_INT_GPIO);
     }
 
     void InitializeSpi() {
@@ -392,9 +459,10 @@ private:
         config.pixel_format = PIXFORMAT_RGB565;
         config.frame_size = FRAMESIZE_QVGA;
         config.jpeg_quality = 12;
-        config.fb_count = 1;
+        // ライブビュー中もセンサーが次のフレームを書けるようにダブルバッファにする
+        config.fb_count = 2;
         config.fb_location = CAMERA_FB_IN_PSRAM;
-        config.grab_mode = CAMERA_GRAB_WHEN_EMPTY;
+        config.grab_mode = CAMERA_GRAB_LATEST;
         camera_ = new Esp32Camera(config);
     }
 
@@ -408,17 +476,42 @@ private:
 
 public:
     M5StackCoreS3Board() {
-        InitializePowerSaveTimer();
-        InitializeI2c();
-        InitializeAxp2101();
-        InitializeAw9523();
-        I2cDetect();
-        InitializeSpi();
-        InitializeIli9342Display();
+        // PMICとIOエキスパンダの設定（I2C）とSPIバスの準備は互いに依存しないため、並行して進める。
+        // パネルはPMICの電源レールとAW9523によるリセットの後、タッチはLVGLのディスプレイの後
+        InitGraph graph;
+        graph.Add("power_save", [this]() { InitializePowerSaveTimer(); })
+            .Add("i2c", [this]() { InitializeI2c(); })
+            .Add("axp2101", [this]() { InitializeAxp2101(); }, {"i2c"})
+            .Add("aw9523", [this]() { InitializeAw9523(); }, {"i2c"})
+#if CONFIG_BOARD_I2C_SCAN
+            .Add("i2c_scan", [this]() { I2cDetect(); }, {"axp2101", "aw9523"})
+#endif
+            .Add("spi", [this]() { InitializeSpi(); })
+            .Add("display", [this]() { InitializeIli9342Display(); }, {"spi", "axp2101", "aw9523"})
+            .Add("touch", [this]() { InitializeTouch(); }, {"display"})
+            .Add("backlight", [this]() { GetBacklight()->RestoreBrightness(); }, {"display"});
+        graph.Run();
+    }
+
+    virtual void InitializeDeferred() override {
         InitializeCamera();
         InitializeIot();
-        InitializeFt6336TouchPad();
-        GetBacklight()->RestoreBrightness();
+    }
+
+    /**
+     * @brief 入力に使うマイクの数
+     *
+     * 自動ではAFEのプロファイルが高性能のときだけ2マイクにします。AFEは作成時の入力形式に
+     * 固定されるため、コーデックを作る前にプロファイルを確定させて同じ値を使わせます。
+     */
+    static int InputMicCount() {
+#if CONFIG_CORES3_INPUT_LAYOUT_MMR
+        return 2;
+#elif CONFIG_CORES3_INPUT_LAYOUT_AUTO && (CONFIG_USE_AUDIO_PROCESSOR || CONFIG_USE_WAKE_WORD_DETECT)
+        return AfeProfile::GetInstance().Resolve() == kAfeProfileHighPerf ? 2 : 1;
+#else
+        return 1;
+#endif
     }
 
     virtual AudioCodec* GetAudioCodec() override {
@@ -432,7 +525,8 @@ public:
             AUDIO_I2S_GPIO_DIN,
             AUDIO_CODEC_AW88298_ADDR,
             AUDIO_CODEC_ES7210_ADDR,
-            AUDIO_INPUT_REFERENCE);
+            AUDIO_INPUT_REFERENCE,
+            InputMicCount());
         return &audio_codec;
     }
 
@@ -446,14 +540,11 @@ public:
 
     virtual bool GetBatteryLevel(int &level, bool& charging, bool& discharging) override {
         static bool last_discharging = false;
-        charging = pmic_->IsCharging();
-        discharging = pmic_->IsDischarging();
+        pmic_->GetCachedBatteryStatus(level, charging, discharging);
         if (discharging != last_discharging) {
             power_save_timer_->SetEnabled(discharging);
             last_discharging = discharging;
         }
-
-        level = pmic_->GetBatteryLevel();
         return true;
     }
 
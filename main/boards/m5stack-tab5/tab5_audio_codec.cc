@@ -229,14 +229,14 @@ void Tab5AudioCodec::EnableOutput(bool enable) {
     AudioCodec::EnableOutput(enable);
 }
 
-int Tab5AudioCodec::Read(int16_t* dest, int samples) {
+int AUDIO_HOT_ATTR Tab5AudioCodec::Read(int16_t* dest, int samples) {
     if (input_enabled_) {
         ESP_ERROR_CHECK_WITHOUT_ABORT(esp_codec_dev_read(input_dev_, (void*)dest, samples * sizeof(int16_t)));
     }
     return samples;
 }
 
-int Tab5AudioCodec::Write(const int16_t* data, int samples) {
+int AUDIO_HOT_ATTR Tab5AudioCodec::Write(const int16_t* data, int samples) {
     if (output_enabled_) {
         ESP_ERROR_CHECK_WITHOUT_ABORT(esp_codec_dev_write(output_dev_, (void*)data, samples * sizeof(int16_t)));
     }
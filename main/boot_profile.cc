@@ -0,0 +1,111 @@
+/**
+ * @file boot_profile.cc
+ * @brief 起動段階の記録の実装
+ */
+#include "boot_profile.h"
+#include "settings.h"
+
+#include <cJSON.h>
+#include <esp_app_desc.h>
+#include <esp_log.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+
+#include <cstring>
+#include <memory>
+
+#define TAG "BootProfile"
+
+/** @brief 保存形式のバージョン（Boot/Historyのレイアウトを変えたら上げる） */
+#define BOOT_PROFILE_VERSION 1
+
+const char* BootProfile::MilestoneName(BootMilestone milestone) {
+    switch (milestone) {
+    case kBootAppMain: return "app_main";
+    case kBootBoardConstructed: return "board_constructed";
+    case kBootFirstFrame: return "first_frame";
+    case kBootCodecStarted: return "codec_started";
+    case kBootNetworkConnected: return "network_connected";
+    case kBootOtaChecked: return "ota_checked";
+    case kBootProtocolStarted: return "protocol_started";
+    case kBootFirstIdle: return "first_idle";
+    default: return "unknown";
+    }
+}
+
+void BootProfile::Record(BootMilestone milestone) {
+    // esp_timerは起動直後から数えるため、そのまま起動からの経過時間になる
+    milestones_ms_[milestone] = esp_timer_get_time() / 1000;
+    if (milestone != kBootFirstIdle) {
+        return;
+    }
+
+    for (int i = 0; i < kBootMilestoneCount; i++) {
+        ESP_LOGI(TAG, "%-18s %5lu ms", MilestoneName((BootMilestone)i), milestones_ms_[i]);
+    }
+    Save();
+}
+
+void BootProfile::Save() {
+    auto history = std::make_unique<History>();
+    Settings settings("boot_profile", true);
+    if (!settings.GetStruct("history", *history, BOOT_PROFILE_VERSION) || history->next >= BOOT_PROFILE_HISTORY) {
+        memset(history.get(), 0, sizeof(History));
+    }
+
+    auto& boot = history->boots[history->next];
+    memset(&boot, 0, sizeof(boot));
+    strncpy(boot.version, esp_app_get_description()->version, sizeof(boot.version) - 1);
+    boot.reset_reason = esp_reset_reason();
+    memcpy(boot.milestones_ms, milestones_ms_, sizeof(milestones_ms_));
+    history->next = (history->next + 1) % BOOT_PROFILE_HISTORY;
+    if (history->count < BOOT_PROFILE_HISTORY) {
+        history->count++;
+    }
+    settings.SetStruct("history", *history, BOOT_PROFILE_VERSION);
+}
+
+std::string BootProfile::ToJson() {
+    auto history = std::make_unique<History>();
+    {
+        Settings settings("boot_profile");
+        if (!settings.GetStruct("history", *history, BOOT_PROFILE_VERSION) || history->next >= BOOT_PROFILE_HISTORY) {
+            memset(history.get(), 0, sizeof(History));
+        }
+    }
+
+    auto add_milestones = [](cJSON* object, const uint32_t* milestones) {
+        cJSON* items = cJSON_CreateObject();
+        for (int i = 0; i < kBootMilestoneCount; i++) {
+            if (milestones[i] != 0) {
+                cJSON_AddNumberToObject(items, MilestoneName((BootMilestone)i), milestones[i]);
+            }
+        }
+        cJSON_AddItemToObject(object, "milestones_ms", items);
+    };
+
+    cJSON* root = cJSON_CreateObject();
+    cJSON* current = cJSON_CreateObject();
+    cJSON_AddStringToObject(current, "version", esp_app_get_description()->version);
+    add_milestones(current, milestones_ms_);
+    cJSON_AddItemToObject(root, "current", current);
+
+    // 古い順に並べる
+    cJSON* boots = cJSON_CreateArray();
+    uint32_t start = (history->next + BOOT_PROFILE_HISTORY - history->count) % BOOT_PROFILE_HISTORY;
+    for (uint32_t i = 0; i < history->count; i++) {
+        auto& boot = history->boots[(start + i) % BOOT_PROFILE_HISTORY];
+        cJSON* item = cJSON_CreateObject();
+        cJSON_AddStringToObject(item, "version", std::string(boot.version, strnlen(boot.version, sizeof(boot.version))).c_str());
+        cJSON_AddNumberToObject(item, "reset_reason", boot.reset_reason);
+        add_milestones(item, boot.milestones_ms);
+        cJSON_AddItemToArray(boots, item);
+    }
+    cJSON_AddItemToObject(root, "history", boots);
+
+    char* json = cJSON_PrintUnformatted(root);
+    std::string result(json);
+    cJSON_free(json);
+    cJSON_Delete(root);
+    return result;
+}
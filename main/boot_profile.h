@@ -0,0 +1,90 @@
+/**
+ * @file boot_profile.h
+ * @brief 起動の各段階までの時間の記録
+ *
+ * app_mainの開始から最初の待ち受けまでの主要な段階に、起動からの経過時間を記録します。
+ * 最初の待ち受けに入った時点で、ファームウェアのバージョンとともにNVSへ保存し、
+ * 直近 BOOT_PROFILE_HISTORY 回の起動を残します。リリースごとの起動時間の比較に使います。
+ */
+#ifndef BOOT_PROFILE_H
+#define BOOT_PROFILE_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+/** @brief 保存する起動の回数 */
+#define BOOT_PROFILE_HISTORY 8
+
+/** @brief 起動の段階 */
+enum BootMilestone : uint8_t {
+    kBootAppMain,               /**< app_mainの開始 */
+    kBootBoardConstructed,      /**< ボードの初期化完了 */
+    kBootFirstFrame,            /**< ディスプレイへの最初の描画 */
+    kBootCodecStarted,          /**< 音声コーデックの開始 */
+    kBootNetworkConnected,      /**< ネットワーク接続 */
+    kBootOtaChecked,            /**< バージョン確認の完了 */
+    kBootProtocolStarted,       /**< 通信プロトコルの開始 */
+    kBootFirstIdle,             /**< 最初の待ち受け */
+    kBootMilestoneCount,
+};
+
+/**
+ * @class BootProfile
+ * @brief 起動段階の記録と履歴を持つシングルトン
+ *
+ * Mark()は任意のタスクから呼べ、各段階の最初の1回だけを記録します。
+ */
+class BootProfile {
+public:
+    static BootProfile& GetInstance() {
+        static BootProfile instance;
+        return instance;
+    }
+
+    BootProfile(const BootProfile&) = delete;
+    BootProfile& operator=(const BootProfile&) = delete;
+
+    /** @brief 段階を記録（kBootFirstIdleで今回の起動をログに出してNVSへ保存する） */
+    void Mark(BootMilestone milestone) {
+        uint32_t bit = 1u << milestone;
+        if (marked_.load(std::memory_order_relaxed) & bit) {
+            return;
+        }
+        if (marked_.fetch_or(bit, std::memory_order_relaxed) & bit) {
+            return;
+        }
+        Record(milestone);
+    }
+
+    /** @brief 今回と過去の起動をJSON形式で取得（MCPツール用） */
+    std::string ToJson();
+
+    static const char* MilestoneName(BootMilestone milestone);
+
+private:
+    BootProfile() = default;
+
+    /** @brief NVSに保存する1回分の起動 */
+    struct Boot {
+        char version[32];
+        uint8_t reset_reason;                       /**< esp_reset_reason_t */
+        uint8_t reserved[3];
+        uint32_t milestones_ms[kBootMilestoneCount];    /**< 起動からの経過時間（未到達なら0） */
+    };
+
+    /** @brief NVSに保存する履歴 */
+    struct History {
+        uint32_t count;
+        uint32_t next;                              /**< 次に書き込む位置 */
+        Boot boots[BOOT_PROFILE_HISTORY];
+    };
+
+    std::atomic<uint32_t> marked_{0};
+    uint32_t milestones_ms_[kBootMilestoneCount] = {};
+
+    void Record(BootMilestone milestone);
+    void Save();
+};
+
+#endif // BOOT_PROFILE_H
@@ -0,0 +1,75 @@
+/**
+ * @file control_message_buffer.cc
+ * @brief 制御メッセージの本文バッファの実装
+ */
+#include "control_message_buffer.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <esp_heap_caps.h>
+#include <esp_log.h>
+
+#define TAG "ControlMessageBuffer"
+
+/** @brief cJSON_PrintPreallocated()は必要な長さを最大5バイト多く見積もるため、その分を余分に確保する */
+#define CONTROL_MESSAGE_PRINT_HEADROOM 5
+
+ControlMessageBuffer::ControlMessageBuffer(size_t limit) : limit_(limit) {
+}
+
+ControlMessageBuffer::~ControlMessageBuffer() {
+    free(buffer_);
+}
+
+bool ControlMessageBuffer::Reallocate(size_t capacity) {
+    free(buffer_);
+    size_t size = capacity + CONTROL_MESSAGE_PRINT_HEADROOM;
+    buffer_ = (char*)heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (buffer_ == nullptr) {
+        buffer_ = (char*)malloc(size);
+    }
+    if (buffer_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate %u bytes", capacity);
+        capacity_ = 0;
+        return false;
+    }
+    if (capacity_.load(std::memory_order_relaxed) > 0) {
+        ESP_LOGI(TAG, "Grown to %u bytes", capacity);
+    }
+    capacity_ = capacity;
+    return true;
+}
+
+const char* ControlMessageBuffer::Write(const cJSON* item, size_t& length) {
+    size_t written = written_.load(std::memory_order_relaxed);
+    if (written != 0 && released_.load(std::memory_order_acquire) == written) {
+        // すべて処理済み。消費者は次のメッセージまでバッファに触れないので先頭へ戻す
+        released_.store(0, std::memory_order_relaxed);
+        written_.store(0, std::memory_order_relaxed);
+        written = 0;
+    }
+    if (buffer_ == nullptr && !Reallocate(std::min<size_t>(CONTROL_MESSAGE_BUFFER_INITIAL_BYTES, limit_))) {
+        return nullptr;
+    }
+
+    while (true) {
+        size_t capacity = capacity_.load(std::memory_order_relaxed);
+        // 末尾の余白も含めて渡し、capacityに収まるメッセージが見積もりの誤差で失敗しないようにする
+        size_t room = capacity + CONTROL_MESSAGE_PRINT_HEADROOM - written;
+        // 入りきらない場合はfalseが返る（途中まで書かれた分は次の書き込みで上書きされる）
+        if (room > CONTROL_MESSAGE_PRINT_HEADROOM + 1 && cJSON_PrintPreallocated(const_cast<cJSON*>(item), buffer_ + written, room, false)) {
+            length = strlen(buffer_ + written);
+            written_.store(written + length + 1, std::memory_order_release);
+            return buffer_ + written;
+        }
+        // 処理待ちがある間は作り直せない
+        if (written != 0 || capacity >= limit_ || !Reallocate(std::min(capacity * 2, limit_))) {
+            return nullptr;
+        }
+    }
+}
+
+void ControlMessageBuffer::Release(size_t length) {
+    released_.fetch_add(length + 1, std::memory_order_release);
+}
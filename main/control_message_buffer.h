@@ -0,0 +1,68 @@
+/**
+ * @file control_message_buffer.h
+ * @brief 制御キューへ渡すメッセージ本文を置く再利用バッファ
+ *
+ * 受信タスクから制御キューへ渡すMCPの tools/call などの大きなメッセージを、1件ごとに
+ * ヒープへ確保した文字列ではなく、PSRAMに置いた1つのバッファへ書き出します。
+ * 処理側はバッファ上の本文をそのまま解析するため（in-place）、数KBの一時的な確保が
+ * 内部SRAMで繰り返されません。
+ *
+ * バッファは先頭から順に積み、すべて処理されて空になった時点で先頭へ戻ります。
+ * 空のときに入りきらないメッセージが来たら上限（CONFIG_CONTROL_MESSAGE_BUFFER_KB）まで倍々に広げ、
+ * 上限を超えるメッセージや、処理待ちがあって入らないメッセージは呼び出し側がヒープへ回します。
+ *
+ * 書き込み（Write）は1つの受信タスクから、解放（Release）は直列の制御キューから呼びます。
+ */
+#ifndef CONTROL_MESSAGE_BUFFER_H
+#define CONTROL_MESSAGE_BUFFER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include <cJSON.h>
+
+/** @brief 最初に確保するバイト数 */
+#define CONTROL_MESSAGE_BUFFER_INITIAL_BYTES 4096
+
+/**
+ * @class ControlMessageBuffer
+ * @brief 単一生産者/単一消費者のメッセージ本文バッファ
+ */
+class ControlMessageBuffer {
+public:
+    /** @param limit 広げられる最大のバイト数 */
+    explicit ControlMessageBuffer(size_t limit);
+    ~ControlMessageBuffer();
+
+    ControlMessageBuffer(const ControlMessageBuffer&) = delete;
+    ControlMessageBuffer& operator=(const ControlMessageBuffer&) = delete;
+
+    /**
+     * @brief itemをJSON文字列として書き出す（生産者専用）
+     * @param length 書き出した長さ（終端を含まない）
+     * @return 書き出した本文の先頭。入りきらない場合はnullptr
+     */
+    const char* Write(const cJSON* item, size_t& length);
+
+    /** @brief Write()で得た本文の処理を終えたことを知らせる（消費者専用） */
+    void Release(size_t length);
+
+    size_t capacity() const { return capacity_.load(std::memory_order_relaxed); }
+    /** @brief 処理待ちのバイト数 */
+    size_t pending() const {
+        return written_.load(std::memory_order_relaxed) - released_.load(std::memory_order_relaxed);
+    }
+
+private:
+    const size_t limit_;
+    char* buffer_ = nullptr;
+    std::atomic<size_t> capacity_{0};
+    std::atomic<size_t> written_{0};    /**< 生産者が書いた位置 */
+    std::atomic<size_t> released_{0};   /**< 消費者が解放したバイト数の累計（written_と同じ基準） */
+
+    /** @brief 空のバッファをcapacityへ作り直す */
+    bool Reallocate(size_t capacity);
+};
+
+#endif // CONTROL_MESSAGE_BUFFER_H
@@ -0,0 +1,50 @@
+/**
+ * @file debug_http_server.cc
+ * @brief 診断用HTTPサーバーの実装
+ */
+#include "debug_http_server.h"
+
+#include <esp_log.h>
+
+#define TAG "DebugHttpServer"
+
+/** @brief 登録できるハンドラーの最大数 */
+#define DEBUG_HTTP_MAX_HANDLERS 8
+
+bool DebugHttpServer::Start() {
+    if (server_ != nullptr) {
+        return true;
+    }
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.server_port = CONFIG_DEBUG_HTTP_PORT;
+    config.ctrl_port = CONFIG_DEBUG_HTTP_PORT + 1;
+    // ハンドラーは応答を数KBずつ組み立てて送る
+    config.stack_size = 4096 + 2048;
+    config.max_open_sockets = 2;
+    config.max_uri_handlers = DEBUG_HTTP_MAX_HANDLERS;
+    if (httpd_start(&server_, &config) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start on port %d", CONFIG_DEBUG_HTTP_PORT);
+        server_ = nullptr;
+        return false;
+    }
+    ESP_LOGI(TAG, "Listening on port %d", CONFIG_DEBUG_HTTP_PORT);
+    return true;
+}
+
+bool DebugHttpServer::RegisterHandler(const char* uri, esp_err_t (*handler)(httpd_req_t* req), void* context) {
+    if (!Start()) {
+        return false;
+    }
+    httpd_uri_t entry = {
+        .uri = uri,
+        .method = HTTP_GET,
+        .handler = handler,
+        .user_ctx = context,
+    };
+    if (httpd_register_uri_handler(server_, &entry) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to register %s", uri);
+        return false;
+    }
+    ESP_LOGI(TAG, "Serving http://<device>:%d%s", CONFIG_DEBUG_HTTP_PORT, uri);
+    return true;
+}
@@ -0,0 +1,44 @@
+/**
+ * @file debug_http_server.h
+ * @brief 診断用の小さなHTTPサーバー
+ *
+ * トレース（/trace.json）やメトリクス（/metrics）のように、ログやMCPツールでは大きすぎる
+ * 診断データを同じLAN内のPCから取得するためのサーバーです。認証はないため開発・検証用の
+ * ネットワークでのみ有効にします（CONFIG_USE_DEBUG_HTTP_SERVER）。
+ */
+#ifndef DEBUG_HTTP_SERVER_H
+#define DEBUG_HTTP_SERVER_H
+
+#include <esp_http_server.h>
+
+/**
+ * @class DebugHttpServer
+ * @brief 各診断機能がハンドラーを登録するHTTPサーバーのシングルトン
+ */
+class DebugHttpServer {
+public:
+    static DebugHttpServer& GetInstance() {
+        static DebugHttpServer instance;
+        return instance;
+    }
+
+    DebugHttpServer(const DebugHttpServer&) = delete;
+    DebugHttpServer& operator=(const DebugHttpServer&) = delete;
+
+    /**
+     * @brief GETハンドラーを登録（最初の登録でサーバーを起動する）
+     * @param uri パス（文字列リテラル）
+     * @param context ハンドラーで req->user_ctx として受け取る値
+     * @return 起動または登録に失敗した場合false
+     */
+    bool RegisterHandler(const char* uri, esp_err_t (*handler)(httpd_req_t* req), void* context);
+
+private:
+    DebugHttpServer() = default;
+
+    httpd_handle_t server_ = nullptr;
+
+    bool Start();
+};
+
+#endif // DEBUG_HTTP_SERVER_H
@@ -0,0 +1,275 @@
+/**
+ * @file deferred_log.cc
+ * @brief ログリングと書き出しタスクの実装
+ */
+#include "deferred_log.h"
+#include "system_info.h"
+
+#include <esp_attr.h>
+#include <esp_heap_caps.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+
+#include <algorithm>
+#include <cstring>
+
+#define TAG "DeferredLog"
+
+/** @brief レコードヘッダーの書き込み完了ビット（下位16ビットは本文の長さ） */
+#define DEFERRED_LOG_COMMITTED 0x80000000u
+/** @brief リング末尾の詰め物のビット（下位16ビットは詰め物のバイト数、出力しない） */
+#define DEFERRED_LOG_PADDING 0x40000000u
+#define DEFERRED_LOG_HEADER_SIZE 4
+/** @brief 構造体の配置を変えたら値を変える */
+#define DEFERRED_LOG_TAIL_MAGIC 0x444c5431  // "DLT1"
+
+namespace {
+
+/** @brief 再起動をまたいで残る直近のログ（電源投入時は不定なのでmagicで判定する） */
+struct DeferredLogTail {
+    uint32_t magic;
+    uint32_t position;                          /**< これまでに書いた総バイト数 */
+    char text[CONFIG_DEFERRED_LOG_TAIL_BYTES];
+};
+
+__NOINIT_ATTR DeferredLogTail s_tail;
+
+/** @brief 本文の長さからレコードの大きさ（vsnprintf()が書く終端の1バイトを含む） */
+size_t RecordSize(size_t length) {
+    return DEFERRED_LOG_HEADER_SIZE + ((length + 1 + 3) & ~(size_t)3);
+}
+
+/** @brief リングの位置posからsizeバイトを読み出す（末尾で折り返す） */
+void CopyOut(const uint8_t* ring, size_t ring_size, uint32_t pos, void* data, size_t size) {
+    size_t offset = pos & (ring_size - 1);
+    size_t first = std::min(size, ring_size - offset);
+    memcpy(data, ring + offset, first);
+    memcpy((uint8_t*)data + first, ring, size - first);
+}
+
+void Clear(uint8_t* ring, size_t ring_size, uint32_t pos, size_t size) {
+    size_t offset = pos & (ring_size - 1);
+    size_t first = std::min(size, ring_size - offset);
+    memset(ring + offset, 0, first);
+    memset(ring, 0, size - first);
+}
+
+/** @brief 末尾ログへ1行を写す（同時に書かれると行が混ざり得るが、診断用なので許容する） */
+void SaveTail(const char* line, size_t length) {
+    if (s_tail.magic != DEFERRED_LOG_TAIL_MAGIC) {
+        return;
+    }
+    uint32_t position = __atomic_fetch_add(&s_tail.position, (uint32_t)length, __ATOMIC_RELAXED);
+    for (size_t i = 0; i < length; i++) {
+        s_tail.text[(position + i) % sizeof(s_tail.text)] = line[i];
+    }
+}
+
+} // namespace
+
+void DeferredLog::Start() {
+    if (task_ != nullptr) {
+        return;
+    }
+    PrintPreviousTail();
+
+    size_t size = 1;
+    while (size < CONFIG_DEFERRED_LOG_RING_KB * 1024) {
+        size <<= 1;
+    }
+    // 書き出す前の行はゼロのヘッダーで未完了と判定するため、ゼロで確保する
+    buffer_ = (uint8_t*)heap_caps_calloc(1, size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (buffer_ == nullptr) {
+        buffer_ = (uint8_t*)heap_caps_calloc(1, size, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    }
+    if (buffer_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate %u bytes, logging stays synchronous", size);
+        return;
+    }
+    size_ = size;
+
+    if (xTaskCreate([](void* arg) {
+        ((DeferredLog*)arg)->DrainTask();
+    }, "log_drain", 3072, this, 1, &task_) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create the drain task, logging stays synchronous");
+        heap_caps_free(buffer_);
+        buffer_ = nullptr;
+        size_ = 0;
+        task_ = nullptr;
+        return;
+    }
+
+    original_ = esp_log_set_vprintf(HookVprintf);
+    // 再起動（OTAやリブート）の直前に残りを出力する
+    esp_register_shutdown_handler([]() {
+        DeferredLog::GetInstance().Flush();
+    });
+    ESP_LOGI(TAG, "Deferred logging: %u bytes ring, %u bytes tail", size_, sizeof(s_tail.text));
+}
+
+int DeferredLog::HookVprintf(const char* format, va_list args) {
+    auto& self = GetInstance();
+    if (xPortInIsrContext() || xTaskGetSchedulerState() != taskSCHEDULER_RUNNING) {
+        // 書き出しタスクが動けない状況では、従来どおりその場で出力する
+        return self.original_(format, args);
+    }
+
+    // 呼び出し元のスタックに行バッファを置かず、長さを求めてからリングに予約した領域へ直接整形する
+    va_list measure;
+    va_copy(measure, args);
+    int length = vsnprintf(nullptr, 0, format, measure);
+    va_end(measure);
+    if (length <= 0) {
+        return length;
+    }
+    size_t stored = std::min((size_t)length, (size_t)CONFIG_DEFERRED_LOG_LINE_MAX - 1);
+    uint32_t head;
+    char* line = self.Reserve(stored, head);
+    if (line == nullptr) {
+        return length;
+    }
+    vsnprintf(line, stored + 1, format, args);
+    if (stored < (size_t)length) {
+        // 切り詰めた行も改行で終える
+        line[stored - 1] = '\n';
+        self.truncated_.fetch_add(1, std::memory_order_relaxed);
+    }
+    SaveTail(line, stored);
+    self.Commit(head, stored);
+    return length;
+}
+
+char* DeferredLog::Reserve(size_t length, uint32_t& head) {
+    size_t record = RecordSize(length);
+    size_t padding;
+    head = head_.load(std::memory_order_relaxed);
+    do {
+        // 本文は折り返さずに書くため、リングの末尾に入らなければ末尾を詰め物にして先頭から置く
+        size_t offset = head & (size_ - 1);
+        padding = size_ - offset < record ? size_ - offset : 0;
+        uint32_t tail = tail_.load(std::memory_order_acquire);
+        if (size_ - (head - tail) < padding + record) {
+            // 書き出しが追いつかない分は捨て、次の書き出しで捨てた行数を出力する
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+    } while (!head_.compare_exchange_weak(head, head + padding + record, std::memory_order_acq_rel,
+        std::memory_order_relaxed));
+
+    if (padding > 0) {
+        auto header = (uint32_t*)(buffer_ + (head & (size_ - 1)));
+        __atomic_store_n(header, (uint32_t)padding | DEFERRED_LOG_PADDING | DEFERRED_LOG_COMMITTED, __ATOMIC_RELEASE);
+        head += padding;
+    }
+    return (char*)buffer_ + (head & (size_ - 1)) + DEFERRED_LOG_HEADER_SIZE;
+}
+
+void DeferredLog::Commit(uint32_t head, size_t length) {
+    // 本文を書いてからヘッダーを公開する（ヘッダーは4バイト境界にあり折り返さない）
+    auto header = (uint32_t*)(buffer_ + (head & (size_ - 1)));
+    __atomic_store_n(header, (uint32_t)length | DEFERRED_LOG_COMMITTED, __ATOMIC_RELEASE);
+}
+
+bool DeferredLog::DrainOne() {
+    uint32_t tail = tail_.load(std::memory_order_relaxed);
+    if (head_.load(std::memory_order_acquire) == tail) {
+        return false;
+    }
+    auto header = (uint32_t*)(buffer_ + (tail & (size_ - 1)));
+    uint32_t value = __atomic_load_n(header, __ATOMIC_ACQUIRE);
+    if ((value & DEFERRED_LOG_COMMITTED) == 0) {
+        // 予約したタスクがまだ本文を書いている
+        return false;
+    }
+    if (value & DEFERRED_LOG_PADDING) {
+        // 末尾の詰め物は出力せずに明け渡す
+        size_t padding = value & 0xffff;
+        Clear(buffer_, size_, tail, padding);
+        tail_.store(tail + padding, std::memory_order_release);
+        return true;
+    }
+    size_t length = value & 0xffff;
+    size_t record = RecordSize(length);
+    CopyOut(buffer_, size_, tail + DEFERRED_LOG_HEADER_SIZE, line_, length);
+    // 次にこの領域へ書くレコードのヘッダーを未完了に見せるため、ゼロに戻してから明け渡す
+    Clear(buffer_, size_, tail, record);
+    tail_.store(tail + record, std::memory_order_release);
+
+    Write("%.*s", (int)length, line_);
+    return true;
+}
+
+void DeferredLog::ReportDropped() {
+    uint32_t dropped = dropped_.load(std::memory_order_relaxed);
+    if (dropped != reported_dropped_) {
+        Write("W (%lu) %s: %lu log lines dropped (%lu total, %lu truncated)\n", esp_log_timestamp(), TAG,
+            dropped - reported_dropped_, dropped, truncated_.load(std::memory_order_relaxed));
+        reported_dropped_ = dropped;
+    }
+}
+
+void DeferredLog::DrainTask() {
+    while (true) {
+        {
+            std::lock_guard<std::mutex> lock(drain_mutex_);
+            while (DrainOne()) {
+            }
+            ReportDropped();
+        }
+        vTaskDelay(pdMS_TO_TICKS(DEFERRED_LOG_DRAIN_INTERVAL_MS));
+    }
+}
+
+void DeferredLog::Flush() {
+    if (buffer_ == nullptr) {
+        return;
+    }
+    // 書き出しタスクが書き出し中なら、終わるまで少し待つ
+    int64_t deadline = esp_timer_get_time() + DEFERRED_LOG_FLUSH_TIMEOUT_MS * 1000;
+    while (!drain_mutex_.try_lock()) {
+        if (esp_timer_get_time() > deadline) {
+            return;
+        }
+        vTaskDelay(1);
+    }
+    while (DrainOne()) {
+    }
+    ReportDropped();
+    drain_mutex_.unlock();
+}
+
+void DeferredLog::Write(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    original_(format, args);
+    va_end(args);
+}
+
+void DeferredLog::PrintPreviousTail() {
+    auto reason = esp_reset_reason();
+    // .noinitの内容が残るのはソフトウェア要因のリセット
+    if (SystemInfo::IsCrashReset() && s_tail.magic == DEFERRED_LOG_TAIL_MAGIC && s_tail.position > 0) {
+        size_t size = sizeof(s_tail.text);
+        size_t length = std::min((size_t)s_tail.position, size);
+        size_t start = s_tail.position > size ? s_tail.position % size : 0;
+        size_t skip = 0;
+        if (s_tail.position > size) {
+            // 折り返した先頭は行の途中なので、最初の改行まで飛ばす
+            while (skip < length && s_tail.text[(start + skip) % size] != '\n') {
+                skip++;
+            }
+            skip++;
+        }
+        Write("W (%lu) %s: ---- last log before reset (reason %d) ----\n", esp_log_timestamp(), TAG, reason);
+        if (skip < length) {
+            size_t begin = (start + skip) % size;
+            size_t count = length - skip;
+            size_t first = std::min(count, size - begin);
+            Write("%.*s", (int)first, s_tail.text + begin);
+            Write("%.*s", (int)(count - first), s_tail.text);
+        }
+        Write("W (%lu) %s: ---- end of last log ----\n", esp_log_timestamp(), TAG);
+    }
+    s_tail.position = 0;
+    s_tail.magic = DEFERRED_LOG_TAIL_MAGIC;
+}
@@ -0,0 +1,94 @@
+/**
+ * @file deferred_log.h
+ * @brief ESP_LOGの出力をリングに溜めて低優先度のタスクからUARTへ書き出すバックエンド
+ *
+ * esp_log_set_vprintf() で出力先を差し替え、ログを呼んだタスクではリングに予約した領域へ
+ * 1行を直接整形するだけにします（呼び出し元のスタックに行バッファを置かない）。
+ * UARTやUSBシリアルへの書き込みは低優先度の log_drain タスクが行うため、
+ * コンソールが遅くても、TTSの文（<<）や認識結果（>>）、ヒープの定期ログなどで
+ * 音声やネットワークのタスクが止まりません。
+ *
+ * リングへの書き込みはロックを取らず（複数の書き込み側が位置を原子的に予約する）、
+ * 満杯なら捨てて数を数え、次に書き出すときに捨てた行数を出力します。
+ * 直近のログは再起動をまたいで残る領域（.noinit）にも写し、パニックやウォッチドッグで
+ * リングの中身が出力されずに失われても、次の起動時に出力します。
+ */
+#ifndef DEFERRED_LOG_H
+#define DEFERRED_LOG_H
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_log.h>
+
+#include <atomic>
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+
+#define DEFERRED_LOG_DRAIN_INTERVAL_MS 20   // リングが空のときに書き出しタスクが待つ時間
+#define DEFERRED_LOG_FLUSH_TIMEOUT_MS 200   // 再起動前に書き出しを待つ最大時間
+
+/**
+ * @class DeferredLog
+ * @brief 複数書き込み・単一読み出しのログリングと書き出しタスクを持つシングルトン
+ *
+ * リングの各レコードは4バイトのヘッダー（長さと書き込み完了のビット）と本文からなります。
+ * 書き込み側はheadをCASで進めて領域を予約し、本文を書いてからヘッダーを公開します。
+ * 読み出し側は完了したレコードだけをtailから順に取り出し、取り出した領域をゼロに戻します。
+ */
+class DeferredLog {
+public:
+    static DeferredLog& GetInstance() {
+        static DeferredLog instance;
+        return instance;
+    }
+
+    DeferredLog(const DeferredLog&) = delete;
+    DeferredLog& operator=(const DeferredLog&) = delete;
+
+    /**
+     * @brief 前回の起動の末尾ログを出力し、リングを確保して出力先を差し替える
+     *
+     * スケジューラの開始後、できるだけ早く1回呼ぶ。リングを確保できない場合は同期出力のまま。
+     */
+    void Start();
+
+    /** @brief リングに残っている行を呼び出し元のタスクで書き出す（再起動の前など） */
+    void Flush();
+
+    /** @brief リングが満杯で捨てた行数 */
+    uint32_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+private:
+    DeferredLog() = default;
+
+    uint8_t* buffer_ = nullptr;
+    size_t size_ = 0;                           /**< 2のべき乗 */
+    std::atomic<uint32_t> head_{0};             /**< 書き込み側が予約した位置 */
+    std::atomic<uint32_t> tail_{0};             /**< 読み出し側だけが進める */
+    std::atomic<uint32_t> dropped_{0};
+    std::atomic<uint32_t> truncated_{0};        /**< 1行の上限を超えて切り詰めた行数 */
+    uint32_t reported_dropped_ = 0;             /**< 読み出し側だけが使う */
+    vprintf_like_t original_ = vprintf;         /**< 差し替え前の出力先（UART） */
+    std::mutex drain_mutex_;                    /**< 書き出しタスクとFlush()の間（line_もこれで保護） */
+    char line_[CONFIG_DEFERRED_LOG_LINE_MAX];
+    TaskHandle_t task_ = nullptr;
+
+    static int HookVprintf(const char* format, va_list args);
+    /**
+     * @brief 本文lengthバイト（と終端）の領域を予約する
+     * @return 本文の書き込み先。リングが満杯ならnullptr（捨てた行として数える）
+     */
+    char* Reserve(size_t length, uint32_t& head);
+    /** @brief 予約したレコードを書き込み完了として公開する */
+    void Commit(uint32_t head, size_t length);
+    bool DrainOne();
+    void ReportDropped();
+    void DrainTask();
+    void Write(const char* format, ...);
+    void PrintPreviousTail();
+};
+
+#endif // DEFERRED_LOG_H
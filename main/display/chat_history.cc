@@ -0,0 +1,134 @@
+/**
+ * @file chat_history.cc
+ * @brief チャット履歴ストアの実装
+ */
+#include "chat_history.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <esp_heap_caps.h>
+#include <esp_log.h>
+
+#define TAG "ChatHistory"
+
+/** @brief 1件の本文の上限（Entry::lengthの範囲） */
+#define CHAT_HISTORY_MAX_TEXT_BYTES 65535
+
+static void* AllocatePsram(size_t size) {
+    void* ptr = heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    return ptr != nullptr ? ptr : malloc(size);
+}
+
+ChatHistory::ChatHistory(size_t capacity_bytes, size_t max_messages) {
+    data_ = (char*)AllocatePsram(capacity_bytes);
+    entries_ = (Entry*)AllocatePsram(max_messages * sizeof(Entry));
+    if (data_ == nullptr || entries_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate %u bytes for %u messages", capacity_bytes, max_messages);
+        return;
+    }
+    capacity_ = capacity_bytes;
+    max_messages_ = max_messages;
+}
+
+ChatHistory::~ChatHistory() {
+    free(data_);
+    free(entries_);
+}
+
+size_t ChatHistory::TruncateUtf8(const char* text, size_t length) {
+    // 切る位置が継続バイトなら、文字の先頭まで戻る
+    while (length > 0 && ((uint8_t)text[length] & 0xC0) == 0x80) {
+        length--;
+    }
+    return length;
+}
+
+void ChatHistory::MakeRoom(size_t extra, bool keep_last) {
+    size_t keep = keep_last ? 1 : 0;
+    size_t drop = 0;
+    size_t drop_bytes = 0;
+    while (count_ - drop > keep && used_ - drop_bytes + extra > capacity_) {
+        drop_bytes += EntryAt(drop).length + 1;
+        drop++;
+    }
+    if (drop == 0) {
+        return;
+    }
+    // 最も古いメッセージは常に先頭にあるため、残りを前へ詰めて位置をずらすだけでよい
+    memmove(data_, data_ + drop_bytes, used_ - drop_bytes);
+    used_ -= drop_bytes;
+    head_ = (head_ + drop) % max_messages_;
+    count_ -= drop;
+    for (size_t i = 0; i < count_; ++i) {
+        EntryAt(i).offset -= drop_bytes;
+    }
+}
+
+void ChatHistory::Add(ChatRole role, const char* text) {
+    if (capacity_ == 0) {
+        return;
+    }
+    if (count_ == max_messages_) {
+        // 件数の上限では最も古い1件を捨てる（バイト数が足りていても詰める）
+        size_t bytes = EntryAt(0).length + 1;
+        memmove(data_, data_ + bytes, used_ - bytes);
+        used_ -= bytes;
+        head_ = (head_ + 1) % max_messages_;
+        count_--;
+        for (size_t i = 0; i < count_; ++i) {
+            EntryAt(i).offset -= bytes;
+        }
+    }
+    size_t length = strlen(text);
+    length = TruncateUtf8(text, std::min<size_t>(length, std::min<size_t>(capacity_ - 1, CHAT_HISTORY_MAX_TEXT_BYTES)));
+    MakeRoom(length + 1, false);
+
+    memcpy(data_ + used_, text, length);
+    data_[used_ + length] = '\0';
+    EntryAt(count_) = Entry{(uint32_t)used_, (uint16_t)length, role};
+    count_++;
+    used_ += length + 1;
+    next_++;
+}
+
+void ChatHistory::ReplaceLast(const char* text) {
+    if (count_ == 0) {
+        return;
+    }
+    // 最新のメッセージは常に末尾にあるため、取り除いて追加し直す
+    Entry last = EntryAt(count_ - 1);
+    used_ -= last.length + 1;
+    count_--;
+    next_--;
+    Add(last.role, text);
+}
+
+void ChatHistory::AppendToLast(const char* text) {
+    if (count_ == 0) {
+        return;
+    }
+    size_t limit = std::min<size_t>(capacity_ - 1, CHAT_HISTORY_MAX_TEXT_BYTES) - EntryAt(count_ - 1).length;
+    size_t length = TruncateUtf8(text, std::min(strlen(text), limit));
+    if (length == 0) {
+        return;
+    }
+    MakeRoom(length, true);
+
+    // 終端を上書きして続ける
+    Entry& last = EntryAt(count_ - 1);
+    memcpy(data_ + used_ - 1, text, length);
+    used_ += length;
+    data_[used_ - 1] = '\0';
+    last.length += length;
+}
+
+bool ChatHistory::Get(uint32_t index, ChatRole& role, const char*& text) const {
+    if (count_ == 0 || index < first() || index >= next_) {
+        return false;
+    }
+    const Entry& entry = EntryAt(index - first());
+    role = entry.role;
+    text = data_ + entry.offset;
+    return true;
+}
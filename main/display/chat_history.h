@@ -0,0 +1,88 @@
+/**
+ * @file chat_history.h
+ * @brief チャットの表示履歴（役割とUTF-8の本文）をPSRAMに詰めて保持するストア
+ *
+ * LVGLの気泡は画面に見える範囲の分だけを作り、それより前の会話はここから読み直して
+ * 気泡へ割り当て直します（LcdDisplayのスクロールバック）。本文は終端付きで1つのバッファへ
+ * 詰めて置き、容量（バイト数・件数）を超えたら古いものから捨てます。
+ *
+ * 各メッセージには追加順の通し番号が付き、捨てられた後も番号は振り直しません。
+ * LVGLのロックを持つタスクからのみ呼ばれるため、内部で排他制御は行いません。
+ */
+#ifndef CHAT_HISTORY_H
+#define CHAT_HISTORY_H
+
+#include <cstddef>
+#include <cstdint>
+
+/** @brief メッセージの役割 */
+enum ChatRole : uint8_t {
+    kChatRoleUser,
+    kChatRoleAssistant,
+    kChatRoleSystem,
+};
+
+/**
+ * @class ChatHistory
+ * @brief 通し番号で引けるチャット履歴
+ */
+class ChatHistory {
+public:
+    /**
+     * @param capacity_bytes 本文に使うバイト数の上限
+     * @param max_messages 保持するメッセージ数の上限
+     */
+    ChatHistory(size_t capacity_bytes, size_t max_messages);
+    ~ChatHistory();
+
+    ChatHistory(const ChatHistory&) = delete;
+    ChatHistory& operator=(const ChatHistory&) = delete;
+
+    /** @brief メッセージを追加（本文が容量を超える場合は切り詰める） */
+    void Add(ChatRole role, const char* text);
+
+    /** @brief 最新のメッセージの本文を置き換える */
+    void ReplaceLast(const char* text);
+
+    /** @brief 最新のメッセージの末尾に追記する（TTSの文の逐次表示） */
+    void AppendToLast(const char* text);
+
+    /** @brief 保持している最も古いメッセージの番号 */
+    uint32_t first() const { return next_ - count_; }
+    /** @brief 次に追加されるメッセージの番号（最新の番号+1） */
+    uint32_t end() const { return next_; }
+    bool empty() const { return count_ == 0; }
+    /** @brief バッファを確保できたか */
+    bool valid() const { return capacity_ > 0; }
+
+    /**
+     * @brief 番号のメッセージを読む
+     * @param text 本文（次に履歴を変更するまで有効）
+     * @return 捨てられた、またはまだない番号ならfalse
+     */
+    bool Get(uint32_t index, ChatRole& role, const char*& text) const;
+
+private:
+    struct Entry {
+        uint32_t offset;        /**< data_内の位置 */
+        uint16_t length;        /**< 終端を含まないバイト数 */
+        ChatRole role;
+    };
+
+    char* data_ = nullptr;
+    size_t capacity_ = 0;
+    size_t used_ = 0;           /**< data_の使用バイト数（古いものから詰めて置く） */
+    Entry* entries_ = nullptr;  /**< 古い順の環状配列 */
+    size_t max_messages_ = 0;
+    size_t head_ = 0;           /**< 最も古いメッセージのentries_上の位置 */
+    size_t count_ = 0;
+    uint32_t next_ = 0;
+
+    Entry& EntryAt(size_t i) const { return entries_[(head_ + i) % max_messages_]; }
+    /** @brief 最新のメッセージを残してextraバイトの空きを作る（古いものを捨てて詰める） */
+    void MakeRoom(size_t extra, bool keep_last);
+    /** @brief UTF-8の文字の途中で切らない長さ */
+    static size_t TruncateUtf8(const char* text, size_t length);
+};
+
+#endif // CHAT_HISTORY_H
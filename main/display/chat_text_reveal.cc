@@ -0,0 +1,79 @@
+#include "chat_text_reveal.h"
+#include "display.h"
+
+#include <algorithm>
+
+/** @brief ASCII 1文字を1、それ以外を3として数える */
+#define REVEAL_UNITS_PER_CHAR 3
+
+size_t ChatTextReveal::CharLength(unsigned char lead) {
+    if (lead < 0x80) {
+        return 1;
+    } else if ((lead & 0xE0) == 0xC0) {
+        return 2;
+    } else if ((lead & 0xF0) == 0xE0) {
+        return 3;
+    } else if ((lead & 0xF8) == 0xF0) {
+        return 4;
+    }
+    return 1;
+}
+
+void ChatTextReveal::Start(Display* display, const std::string& text, uint32_t played_samples, int sample_rate) {
+    Finish();
+    if (text.empty()) {
+        return;
+    }
+    display_ = display;
+    text_ = text;
+    start_samples_ = played_samples;
+    sample_rate_ = sample_rate;
+
+    // 空の気泡は作られないため、最初の1文字で気泡を作る
+    shown_bytes_ = std::min(CharLength(text_[0]), text_.size());
+    display_->PostChatMessage("assistant", text_.substr(0, shown_bytes_).c_str());
+    if (shown_bytes_ == text_.size()) {
+        display_ = nullptr;
+    }
+}
+
+void ChatTextReveal::Update(uint32_t played_samples) {
+    if (display_ == nullptr || sample_rate_ <= 0) {
+        return;
+    }
+    // 差分で扱うため、カウンタの折り返しは問題にならない
+    uint64_t elapsed_ms = (uint64_t)(uint32_t)(played_samples - start_samples_) * 1000 / sample_rate_;
+    uint64_t budget = elapsed_ms * CONFIG_CHAT_TEXT_REVEAL_CHARS_PER_SECOND * REVEAL_UNITS_PER_CHAR / 1000;
+
+    // 先頭から予算分だけ進める（表示済みの部分も数え直すが、1文は高々数百バイト）
+    uint64_t units = 0;
+    size_t end = 0;
+    while (end < text_.size()) {
+        size_t length = CharLength(text_[end]);
+        uint64_t cost = length == 1 ? 1 : REVEAL_UNITS_PER_CHAR;
+        if (units + cost > budget) {
+            break;
+        }
+        units += cost;
+        end = std::min(end + length, text_.size());
+    }
+    if (end <= shown_bytes_) {
+        return;
+    }
+    display_->PostChatAppend(text_.substr(shown_bytes_, end - shown_bytes_).c_str());
+    shown_bytes_ = end;
+    if (shown_bytes_ == text_.size()) {
+        display_ = nullptr;
+    }
+}
+
+void ChatTextReveal::Finish() {
+    if (display_ == nullptr) {
+        return;
+    }
+    if (shown_bytes_ < text_.size()) {
+        display_->PostChatAppend(text_.substr(shown_bytes_).c_str());
+    }
+    display_ = nullptr;
+    text_.clear();
+}
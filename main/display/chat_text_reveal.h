@@ -0,0 +1,55 @@
+/**
+ * @file chat_text_reveal.h
+ * @brief TTS再生の進み具合に合わせたチャット文字列の逐次表示
+ *
+ * tts sentence_startで届いた文を一度に表示すると、長い文ではデコード開始と同時に
+ * 大きな再レイアウトが走ります。最初の1文字で気泡を作り、残りはコーデックへ
+ * 書き込んだサンプル数から求めた再生時間に合わせてラベルの末尾へ追記します。
+ */
+#ifndef CHAT_TEXT_REVEAL_H
+#define CHAT_TEXT_REVEAL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+class Display;
+
+/**
+ * @class ChatTextReveal
+ * @brief 1文分の逐次表示の状態
+ *
+ * 文ごとの再生時間はサーバーから届かないため、表示速度は
+ * CONFIG_CHAT_TEXT_REVEAL_CHARS_PER_SECOND（CJK文字換算）で見積もります。
+ * ASCII文字は読み上げが速いため1/3文字として数えます。
+ * メインタスクからのみ呼び出してください。
+ */
+class ChatTextReveal {
+public:
+    /**
+     * @brief 新しい文の表示を開始（前の文の残りは先に全て表示する）
+     * @param played_samples 現在までに再生したサンプル数
+     * @param sample_rate 出力サンプリングレート
+     */
+    void Start(Display* display, const std::string& text, uint32_t played_samples, int sample_rate);
+
+    /** @brief 再生位置までの文字を追記 */
+    void Update(uint32_t played_samples);
+
+    /** @brief 残りの文字をすべて表示して終了 */
+    void Finish();
+
+    bool active() const { return display_ != nullptr; }
+
+private:
+    Display* display_ = nullptr;
+    std::string text_;
+    size_t shown_bytes_ = 0;        /**< 表示済みのバイト数（UTF-8文字境界） */
+    uint32_t start_samples_ = 0;    /**< 文の開始時点の再生サンプル数 */
+    int sample_rate_ = 0;
+
+    /** @brief 次の1文字のバイト長 */
+    static size_t CharLength(unsigned char lead);
+};
+
+#endif // CHAT_TEXT_REVEAL_H
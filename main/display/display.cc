@@ -1,5 +1,6 @@
 #include <esp_log.h>
 #include <esp_err.h>
+#include <esp_lvgl_port.h>
 #include <string>
 #include <cstdlib>
 #include <cstring>
@@ -30,6 +31,17 @@ Display::Display() {
     };
     ESP_ERROR_CHECK(esp_timer_create(&notification_timer_args, &notification_timer_));
 
+    esp_timer_create_args_t coalesce_timer_args = {
+        .callback = [](void *arg) {
+            static_cast<Display*>(arg)->FlushPending();
+        },
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "display_coalesce",
+        .skip_unhandled_events = true,
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&coalesce_timer_args, &coalesce_timer_));
+
     // Create a power management lock
     auto ret = esp_pm_lock_create(ESP_PM_APB_FREQ_MAX, 0, "display_update", &pm_lock_);
     if (ret == ESP_ERR_NOT_SUPPORTED) {
@@ -44,6 +56,10 @@ Display::~Display() {
         esp_timer_stop(notification_timer_);
         esp_timer_delete(notification_timer_);
     }
+    if (coalesce_timer_ != nullptr) {
+        esp_timer_stop(coalesce_timer_);
+        esp_timer_delete(coalesce_timer_);
+    }
 
     if (network_label_ != nullptr) {
         lv_obj_del(network_label_);
@@ -108,6 +124,10 @@ void Display::UpdateStatusBar(bool update_all) {
         }
     }
 
+    if (!update_all) {
+        return;
+    }
+
     esp_pm_lock_acquire(pm_lock_);
     // 更新电池图标
     int battery_level;
@@ -138,7 +158,7 @@ void Display::UpdateStatusBar(bool update_all) {
                 if (lv_obj_has_flag(low_battery_popup_, LV_OBJ_FLAG_HIDDEN)) { // 如果低电量提示框隐藏，则显示
                     lv_obj_clear_flag(low_battery_popup_, LV_OBJ_FLAG_HIDDEN);
                     auto& app = Application::GetInstance();
-                    app.PlaySound(Lang::Sounds::P3_LOW_BATTERY);
+                    app.PlaySound(Lang::Sounds::P3_LOW_BATTERY, kAudioVoiceEarcon);
                 }
             } else {
                 // Hide the low battery popup when the battery is not empty
@@ -149,9 +169,8 @@ void Display::UpdateStatusBar(bool update_all) {
         }
     }
 
-    // 每 10 秒更新一次网络图标
-    static int seconds_counter = 0;
-    if (update_all || seconds_counter++ % 10 == 0) {
+    // 更新网络图标
+    {
         // 升级固件时，不读取 4G 网络状态，避免占用 UART 资源
         auto device_state = Application::GetInstance().GetDeviceState();
         static const std::vector<DeviceState> allowed_states = {
@@ -243,6 +262,161 @@ void Display::SetChatMessage(const char* role, const char* content) {
     lv_label_set_text(chat_message_label_, content);
 }
 
+void Display::AppendChatMessage(const char* content) {
+    DisplayLockGuard lock(this);
+    if (chat_message_label_ == nullptr) {
+        return;
+    }
+    lv_label_ins_text(chat_message_label_, LV_LABEL_POS_LAST, content);
+}
+
+void Display::ArmCoalesceTimer() {
+    if (!coalesce_armed_ && power_state_ == kDisplayPowerOn) {
+        coalesce_armed_ = true;
+        esp_timer_start_once(coalesce_timer_, DISPLAY_COALESCE_MS * 1000);
+    }
+}
+
+void Display::PostStatus(const char* status) {
+    std::lock_guard<std::mutex> lock(pending_mutex_);
+    pending_.status = status;
+    pending_.fields |= kPendingStatus;
+    pending_.notification_after_status = false;
+    ArmCoalesceTimer();
+}
+
+void Display::PostEmotion(const char* emotion) {
+    std::lock_guard<std::mutex> lock(pending_mutex_);
+    pending_.emotion = emotion;
+    pending_.fields |= kPendingEmotion;
+    ArmCoalesceTimer();
+}
+
+void Display::PostChatMessage(const char* role, const char* content) {
+    std::lock_guard<std::mutex> lock(pending_mutex_);
+    if (!KeepsChatHistory()) {
+        // 1つのラベルに上書きする表示では最後のメッセージだけ反映すればよい
+        pending_.chat.clear();
+    }
+    pending_.chat.emplace_back(role, content);
+    ArmCoalesceTimer();
+}
+
+void Display::PostChatAppend(const char* content) {
+    std::lock_guard<std::mutex> lock(pending_mutex_);
+    if (!pending_.chat.empty()) {
+        // 追記先のメッセージもまだ反映前なので、その本文に連結する
+        pending_.chat.back().second += content;
+    } else {
+        pending_.chat_append += content;
+    }
+    ArmCoalesceTimer();
+}
+
+void Display::PostNotification(const std::string& notification, int duration_ms) {
+    std::lock_guard<std::mutex> lock(pending_mutex_);
+    pending_.notification = notification;
+    pending_.notification_duration_ms = duration_ms;
+    pending_.fields |= kPendingNotification;
+    pending_.notification_after_status = true;
+    ArmCoalesceTimer();
+}
+
+void Display::PostStatusBarUpdate(bool update_all) {
+    std::lock_guard<std::mutex> lock(pending_mutex_);
+    pending_.fields |= kPendingStatusBar;
+    pending_.status_bar_all = pending_.status_bar_all || update_all;
+    ArmCoalesceTimer();
+}
+
+void Display::FlushPending() {
+    PendingState state;
+    {
+        std::lock_guard<std::mutex> lock(pending_mutex_);
+        std::swap(state, pending_);
+        coalesce_armed_ = false;
+    }
+
+    if (state.fields & (kPendingStatus | kPendingEmotion | kPendingNotification) ||
+        !state.chat_append.empty() || !state.chat.empty()) {
+        // 各Set*()もロックを取るが再帰ロックのため、ここで1回取れば待ちは1回で済む
+        DisplayLockGuard lock(this);
+        // SetStatus()は通知を隠すため、書き込まれた順に反映する
+        bool status = state.fields & kPendingStatus;
+        bool notification = state.fields & kPendingNotification;
+        if (notification && !state.notification_after_status) {
+            ShowNotification(state.notification.c_str(), state.notification_duration_ms);
+        }
+        if (status) {
+            SetStatus(state.status.c_str());
+        }
+        if (notification && state.notification_after_status) {
+            ShowNotification(state.notification.c_str(), state.notification_duration_ms);
+        }
+        if (state.fields & kPendingEmotion) {
+            SetEmotion(state.emotion.c_str());
+        }
+        if (!state.chat_append.empty()) {
+            AppendChatMessage(state.chat_append.c_str());
+        }
+        for (auto& [role, content] : state.chat) {
+            SetChatMessage(role.c_str(), content.c_str());
+        }
+    }
+
+    // バッテリーの読み出しなどを含むため、LVGLのロックの外で行う
+    if (state.fields & kPendingStatusBar) {
+        UpdateStatusBar(state.status_bar_all);
+    }
+}
+
+DisplayPowerState Display::power_state() {
+    std::lock_guard<std::mutex> lock(pending_mutex_);
+    return power_state_;
+}
+
+void Display::SetPowerState(DisplayPowerState state) {
+    bool was_on;
+    {
+        std::lock_guard<std::mutex> lock(pending_mutex_);
+        if (state == power_state_) {
+            return;
+        }
+        was_on = power_state_ == kDisplayPowerOn;
+        power_state_ = state;
+    }
+    if (display_ == nullptr) {
+        return;
+    }
+    bool on = state == kDisplayPowerOn;
+    if (was_on == on) {
+        // DimmedとOffの間の切り替えは描画に影響しない
+        return;
+    }
+
+    auto refr_timer = lv_display_get_refr_timer(display_);
+    if (!on) {
+        ESP_LOGI(TAG, "Suspending LVGL rendering");
+        DisplayLockGuard lock(this);
+        // 直前に設定された表示（スリープの表情など）を描いてから止める
+        lv_refr_now(display_);
+        lv_timer_pause(refr_timer);
+        lv_timer_pause(lv_anim_get_timer());
+        return;
+    }
+
+    ESP_LOGI(TAG, "Resuming LVGL rendering");
+    {
+        DisplayLockGuard lock(this);
+        lv_timer_resume(lv_anim_get_timer());
+        lv_timer_resume(refr_timer);
+        // 停止中の変更は無効領域として積まれているが、まとめて1回で描き直す
+        lv_obj_invalidate(lv_screen_active());
+        lv_obj_invalidate(lv_layer_top());
+    }
+    FlushPending();
+}
+
 void Display::SetTheme(const std::string& theme_name) {
     current_theme_name_ = theme_name;
     Settings settings("display", true);
@@ -14,7 +14,13 @@
 #include <esp_log.h>
 #include <esp_pm.h>
 
+#include <mutex>
 #include <string>
+#include <utility>
+#include <vector>
+
+/** @brief Post*()による書き込みをまとめて反映するまでの間隔（ミリ秒、約1フレーム） */
+#define DISPLAY_COALESCE_MS 33
 
 /**
  * @struct DisplayFonts
@@ -26,6 +32,13 @@ struct DisplayFonts {
     const lv_font_t* emoji_font = nullptr; // 絵文字用フォント
 };
 
+/** @brief 画面の電源状態 */
+enum DisplayPowerState {
+    kDisplayPowerOn,
+    kDisplayPowerDimmed,    /**< バックライトを下げた省電力表示 */
+    kDisplayPowerOff,
+};
+
 /**
  * @class Display
  * @brief ディスプレイ制御の基底クラス
@@ -51,12 +64,29 @@ public:
     
     /** チャットメッセージを表示 */
     virtual void SetChatMessage(const char* role, const char* content);
+
+    /** @brief 最新のチャットメッセージの末尾に追記（気泡は作り直さない） */
+    virtual void AppendChatMessage(const char* content);
     
     /** アイコンを設定 */
     virtual void SetIcon(const char* icon);
     
     /** プレビュー画像を設定 */
     virtual void SetPreviewImage(const lv_img_dsc_t* image);
+
+    /**
+     * @brief カメラのフレームをLVGLを介さずパネルへ直接描画
+     * @param data パネルと同じバイト順のRGB565画素
+     * @param lock_timeout_ms 表示のロックを待つ時間（0ならLVGLが描画中のフレームは捨てる）
+     * @return 直接描画に対応しない表示やサイズ、ロックを取れなかった場合はfalse
+     */
+    virtual bool DrawPreviewFrame(const uint8_t* data, int width, int height, int lock_timeout_ms = 30000) { return false; }
+
+    /** @brief DrawPreviewFrame()に対応したサイズかどうか */
+    virtual bool SupportsPreviewFrame(int width, int height) const { return false; }
+
+    /** @brief DrawPreviewFrame()を終えて通常の画面を描き直す */
+    virtual void EndPreviewFrames() {}
     
     /** テーマ（ライト/ダーク）を設定 */
     virtual void SetTheme(const std::string& theme_name);
@@ -64,9 +94,43 @@ public:
     /** 現在のテーマを取得 */
     virtual std::string GetTheme() { return current_theme_name_; }
     
-    /** ステータスバーを更新 */
+    /**
+     * @brief ステータスバーを更新
+     * @param update_all falseならミュート表示のみ、trueならバッテリー（PMICの読み出し）と
+     *        ネットワークアイコンも更新
+     */
     virtual void UpdateStatusBar(bool update_all = false);
 
+    /**
+     * @name 表示状態の非同期更新
+     *
+     * 表示したい状態を記録するだけで即座に戻り、DISPLAY_COALESCE_MS 後に1回のロックで
+     * まとめてLVGLへ反映します。同じ項目への複数回の書き込みは最後の値だけが残ります。
+     * チャット履歴を持つ表示（KeepsChatHistory()）ではメッセージを投稿順にすべて反映します。
+     * @{
+     */
+    void PostStatus(const char* status);
+    void PostEmotion(const char* emotion);
+    void PostChatMessage(const char* role, const char* content);
+    void PostChatAppend(const char* content);
+    void PostNotification(const std::string& notification, int duration_ms = 3000);
+    void PostStatusBarUpdate(bool update_all = false);
+    /** @} */
+
+    /** @brief 記録済みの表示状態を今すぐ反映 */
+    void FlushPending();
+
+    /**
+     * @brief 画面の電源状態を設定
+     *
+     * On以外ではLVGLの画面更新とアニメーションのタイマーを止め、パネルへの転送を行いません
+     * （タッチ入力の読み取りは続けるため、タッチで起床できます）。止める直前に1回描画するので、
+     * 直前に設定した表情などは表示されたまま残ります。Post*()の反映も保留し、Onに戻すときに
+     * 画面全体を1回描き直して保留分をまとめて反映します。
+     */
+    void SetPowerState(DisplayPowerState state);
+    DisplayPowerState power_state();
+
     inline int width() const { return width_; }
     inline int height() const { return height_; }
 
@@ -94,9 +158,42 @@ protected:
 
     esp_timer_handle_t notification_timer_ = nullptr;
 
+    /** @brief チャットメッセージを履歴として積み上げる表示ならtrue（まとめる際に間引かない） */
+    virtual bool KeepsChatHistory() const { return false; }
+
     friend class DisplayLockGuard;
     virtual bool Lock(int timeout_ms = 0) = 0;
     virtual void Unlock() = 0;
+
+private:
+    enum PendingField {
+        kPendingStatus = 1 << 0,
+        kPendingEmotion = 1 << 1,
+        kPendingNotification = 1 << 2,
+        kPendingStatusBar = 1 << 3,
+    };
+
+    /** @brief まだLVGLへ反映していない表示状態 */
+    struct PendingState {
+        uint32_t fields = 0;                    /**< PendingFieldのビット和 */
+        std::string status;
+        std::string emotion;
+        std::string notification;
+        int notification_duration_ms = 0;
+        bool notification_after_status = false; /**< ステータスより後に通知が書かれた */
+        bool status_bar_all = false;
+        std::string chat_append;                /**< chatより前に、表示中のメッセージへ追記する文字列 */
+        std::vector<std::pair<std::string, std::string>> chat;  /**< (role, content) */
+    };
+
+    std::mutex pending_mutex_;                  /**< pending_、coalesce_armed_、power_state_の保護 */
+    PendingState pending_;
+    bool coalesce_armed_ = false;
+    DisplayPowerState power_state_ = kDisplayPowerOn;
+    esp_timer_handle_t coalesce_timer_ = nullptr;
+
+    /** @brief 反映タイマーが止まっていれば開始（pending_mutex_保持中に呼ぶ。画面がOn以外なら保留） */
+    void ArmCoalesceTimer();
 };
 
 
@@ -0,0 +1,349 @@
+/**
+ * @file display_benchmark.cc
+ * @brief 表示のオンデバイスベンチマークの実装
+ */
+#include "display_benchmark.h"
+#include "display.h"
+#include "lvgl_port_config.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+#include <esp_app_desc.h>
+#include <esp_heap_caps.h>
+#include <esp_idf_version.h>
+#include <esp_log.h>
+#include <esp_pm.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#define TAG "DisplayBenchmark"
+
+namespace display_benchmark {
+
+namespace {
+
+/** @brief 1回のリフレッシュ（無効領域の描画と送信） */
+struct Frame {
+    uint32_t refresh_us;        /**< REFR_STARTからREFR_READYまで */
+    uint32_t flush_us;          /**< flush_cbの呼び出しの合計 */
+    uint32_t wait_us;           /**< 送信完了待ちの合計 */
+};
+
+// LVGLタスクが描画イベントで書き、ベンチマーク側は表示のロックを持って読み書きする
+std::vector<Frame> frames;
+bool recording = false;
+Frame current = {};
+bool flushed = false;
+int64_t refresh_start_us = 0;
+int64_t flush_start_us = 0;
+int64_t wait_start_us = 0;
+
+void OnDisplayEvent(lv_event_t* e) {
+    int64_t now = esp_timer_get_time();
+    switch (lv_event_get_code(e)) {
+    case LV_EVENT_REFR_START:
+        refresh_start_us = now;
+        current = {};
+        flushed = false;
+        break;
+    case LV_EVENT_FLUSH_START:
+        flush_start_us = now;
+        flushed = true;
+        break;
+    case LV_EVENT_FLUSH_FINISH:
+        current.flush_us += now - flush_start_us;
+        break;
+    case LV_EVENT_FLUSH_WAIT_START:
+        wait_start_us = now;
+        break;
+    case LV_EVENT_FLUSH_WAIT_FINISH:
+        current.wait_us += now - wait_start_us;
+        break;
+    case LV_EVENT_REFR_READY:
+        // 無効領域がなく何も送らなかったリフレッシュは数えない
+        if (recording && flushed && refresh_start_us != 0) {
+            current.refresh_us = now - refresh_start_us;
+            frames.push_back(current);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+uint32_t CountObjects(lv_obj_t* obj) {
+    uint32_t count = 1;
+    uint32_t children = lv_obj_get_child_count(obj);
+    for (uint32_t i = 0; i < children; ++i) {
+        count += CountObjects(lv_obj_get_child(obj, i));
+    }
+    return count;
+}
+
+uint32_t Percentile(std::vector<uint32_t> values, int percent) {
+    if (values.empty()) {
+        return 0;
+    }
+    size_t index = std::min(values.size() - 1, values.size() * percent / 100);
+    std::nth_element(values.begin(), values.begin() + index, values.end());
+    return values[index];
+}
+
+/**
+ * @brief body()で表示を操作し、描画が落ち着くまでのリフレッシュを1行のJSONで出力
+ * @param params シナリオ固有のパラメータ（JSONオブジェクトの中身）
+ */
+void RunScenario(Display* display, const char* name, const char* params, const std::function<void()>& body) {
+    {
+        DisplayLockGuard lock(display);
+        frames.clear();
+        recording = true;
+    }
+    size_t internal_before = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+    size_t psram_before = heap_caps_get_free_size(MALLOC_CAP_SPIRAM);
+    int64_t start_us = esp_timer_get_time();
+
+    body();
+    vTaskDelay(pdMS_TO_TICKS(DISPLAY_BENCHMARK_SETTLE_MS));
+
+    int64_t wall_us = esp_timer_get_time() - start_us;
+    std::vector<Frame> recorded;
+    uint32_t objects;
+    {
+        DisplayLockGuard lock(display);
+        recording = false;
+        recorded.swap(frames);
+        objects = CountObjects(lv_screen_active()) + CountObjects(lv_layer_top());
+    }
+    int internal_delta = (int)heap_caps_get_free_size(MALLOC_CAP_INTERNAL) - (int)internal_before;
+    int psram_delta = (int)heap_caps_get_free_size(MALLOC_CAP_SPIRAM) - (int)psram_before;
+
+    std::vector<uint32_t> refresh, render, flush, wait;
+    uint64_t busy_us = 0;
+    for (auto& frame : recorded) {
+        refresh.push_back(frame.refresh_us);
+        render.push_back(frame.refresh_us - std::min(frame.refresh_us, frame.flush_us + frame.wait_us));
+        flush.push_back(frame.flush_us);
+        wait.push_back(frame.wait_us);
+        busy_us += frame.refresh_us;
+    }
+    uint32_t refresh_max = refresh.empty() ? 0 : *std::max_element(refresh.begin(), refresh.end());
+    printf("BENCH {\"case\":\"ui_%s\",\"params\":{%s},\"frames\":%u,\"fps\":%.1f,\"lvgl_load\":%.1f,"
+        "\"refresh_us\":%lu,\"refresh_p95_us\":%lu,\"refresh_max_us\":%lu,\"render_us\":%lu,\"flush_us\":%lu,"
+        "\"flush_wait_us\":%lu,\"heap_internal_delta\":%d,\"heap_psram_delta\":%d,\"internal_largest_block\":%u,"
+        "\"objects\":%lu}\n",
+        name, params, recorded.size(), recorded.size() * 1000000.0 / wall_us, busy_us * 100.0 / wall_us,
+        Percentile(refresh, 50), Percentile(refresh, 95), refresh_max, Percentile(render, 50), Percentile(flush, 50),
+        Percentile(wait, 50), internal_delta, psram_delta, heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL),
+        objects);
+}
+
+// 改行のない長い文（折り返しとグリフの描画が多い）
+const char* const kCjkSentences[] = {
+    "今天的天气非常好，阳光明媚，微风轻拂，我们一起去公园散步吧。路边的樱花已经开了，粉色的花瓣随风飘落，真是一幅美丽的画面。",
+    "人工智能正在改变我们的生活方式，从语音助手到自动驾驶，从医疗诊断到教育辅导，它的应用越来越广泛，也带来了新的挑战和机遇。",
+    "请稍等一下，我正在为你查询明天北京的天气预报：多云转晴，最高气温二十三度，最低气温十二度，东南风三到四级，适合户外活动。",
+    "日本語の文章も表示できます。今日は良い天気ですね、一緒に散歩に行きませんか。駅前の新しいカフェのケーキがとても美味しいそうです。",
+};
+
+const char* const kEmotions[] = {
+    "neutral", "happy", "laughing", "funny", "sad", "angry", "crying", "loving", "embarrassed", "surprised",
+    "shocked", "thinking", "winking", "cool", "relaxed", "delicious", "kissy", "confident", "sleepy", "silly",
+    "confused",
+};
+
+constexpr int kSentenceCount = sizeof(kCjkSentences) / sizeof(kCjkSentences[0]);
+constexpr int kEmotionCount = sizeof(kEmotions) / sizeof(kEmotions[0]);
+
+void ScenarioChat(Display* display) {
+    const int messages = 20;
+    char params[32];
+    snprintf(params, sizeof(params), "\"messages\":%d", messages);
+    RunScenario(display, "chat_cjk", params, [display]() {
+        for (int i = 0; i < messages; ++i) {
+            display->SetChatMessage(i % 2 == 0 ? "user" : "assistant", kCjkSentences[i % kSentenceCount]);
+            vTaskDelay(pdMS_TO_TICKS(150));
+        }
+    });
+}
+
+void ScenarioStream(Display* display) {
+    // TTSの文を数文字ずつ追記する（AppendChatMessageの経路）
+    RunScenario(display, "chat_stream", "\"chars_per_append\":2", [display]() {
+        for (int i = 0; i < kSentenceCount; ++i) {
+            display->SetChatMessage("assistant", "");
+            const char* text = kCjkSentences[i];
+            size_t length = strlen(text);
+            size_t pos = 0;
+            while (pos < length) {
+                // UTF-8の2文字分ずつ切り出す
+                size_t end = pos;
+                for (int chars = 0; chars < 2 && end < length; ++chars) {
+                    do {
+                        ++end;
+                    } while (end < length && (text[end] & 0xC0) == 0x80);
+                }
+                std::string piece(text + pos, end - pos);
+                display->AppendChatMessage(piece.c_str());
+                pos = end;
+                vTaskDelay(pdMS_TO_TICKS(50));
+            }
+        }
+    });
+}
+
+void ScenarioSystemBurst(Display* display) {
+    const int messages = 100;
+    char params[48];
+    snprintf(params, sizeof(params), "\"messages\":%d,\"interval_ms\":10", messages);
+    RunScenario(display, "system_burst", params, [display]() {
+        char text[64];
+        for (int i = 0; i < messages; ++i) {
+            snprintf(text, sizeof(text), "正在连接服务器… (%d)", i);
+            display->SetChatMessage("system", text);
+            vTaskDelay(pdMS_TO_TICKS(10));
+        }
+    });
+}
+
+void ScenarioEmotion(Display* display) {
+    RunScenario(display, "emotion", "\"interval_ms\":100", [display]() {
+        for (int i = 0; i < kEmotionCount * 2; ++i) {
+            display->SetEmotion(kEmotions[i % kEmotionCount]);
+            vTaskDelay(pdMS_TO_TICKS(100));
+        }
+    });
+    display->SetEmotion("neutral");
+}
+
+void ScenarioTheme(Display* display) {
+    std::string original = display->GetTheme();
+    RunScenario(display, "theme", "\"switches\":10", [display]() {
+        for (int i = 0; i < 10; ++i) {
+            display->SetTheme(i % 2 == 0 ? "dark" : "light");
+            vTaskDelay(pdMS_TO_TICKS(300));
+        }
+    });
+    // SetTheme()は設定を保存するため、元のテーマに戻す
+    if (!original.empty()) {
+        display->SetTheme(original);
+    }
+}
+
+void ScenarioPreview(Display* display) {
+    int width = display->width();
+    int height = display->height() / 2;
+    if (width <= 0 || height <= 0) {
+        return;
+    }
+    size_t size = width * height * sizeof(uint16_t);
+    auto pixels = (uint16_t*)heap_caps_malloc(size, MALLOC_CAP_SPIRAM);
+    if (pixels == nullptr) {
+        pixels = (uint16_t*)heap_caps_malloc(size, MALLOC_CAP_8BIT);
+    }
+    if (pixels == nullptr) {
+        ESP_LOGW(TAG, "Skipping preview scenario: failed to allocate %u bytes", size);
+        return;
+    }
+    lv_img_dsc_t image;
+    memset(&image, 0, sizeof(image));
+    image.header.magic = LV_IMAGE_HEADER_MAGIC;
+    image.header.cf = LV_COLOR_FORMAT_RGB565;
+    image.header.w = width;
+    image.header.h = height;
+    image.header.stride = width * sizeof(uint16_t);
+    image.data_size = size;
+    image.data = (const uint8_t*)pixels;
+
+    char params[48];
+    snprintf(params, sizeof(params), "\"width\":%d,\"height\":%d", width, height);
+    RunScenario(display, "preview", params, [&]() {
+        for (int i = 0; i < 10; ++i) {
+            // 毎回異なる画像にして、画像キャッシュに当たらないようにする
+            for (int y = 0; y < height; ++y) {
+                for (int x = 0; x < width; ++x) {
+                    pixels[y * width + x] = (uint16_t)(((x + i * 8) & 0x1F) << 11 | ((y * 2) & 0x3F) << 5 | (i * 3 & 0x1F));
+                }
+            }
+            display->SetPreviewImage(&image);
+            vTaskDelay(pdMS_TO_TICKS(300));
+            display->SetPreviewImage(nullptr);
+            vTaskDelay(pdMS_TO_TICKS(200));
+        }
+    });
+    heap_caps_free(pixels);
+}
+
+void ReportMeta(Display* display) {
+    auto app_desc = esp_app_get_description();
+#if CONFIG_LCD_DRAW_BUFFER_FULL_FRAME
+    const char* buffer = "full_frame";
+    int buffer_lines = display->height();
+#elif CONFIG_LCD_DRAW_BUFFER_PSRAM
+    const char* buffer = "psram";
+    int buffer_lines = CONFIG_LCD_DRAW_BUFFER_LINES;
+#else
+    const char* buffer = "internal";
+    int buffer_lines = CONFIG_LCD_DRAW_BUFFER_LINES;
+#endif
+#if CONFIG_LCD_DRAW_BUFFER_DOUBLE
+    int double_buffer = 1;
+#else
+    int double_buffer = 0;
+#endif
+    int refresh_period_ms = CONFIG_LVGL_REFRESH_PERIOD_MS > 0 ? CONFIG_LVGL_REFRESH_PERIOD_MS : LV_DEF_REFR_PERIOD;
+    printf("BENCH {\"case\":\"meta\",\"version\":\"%s\",\"idf\":\"%s\",\"cpu_mhz\":%d,\"board\":\"%s\","
+        "\"width\":%d,\"height\":%d,\"draw_buffer\":\"%s\",\"buffer_lines\":%d,\"double_buffer\":%d,"
+        "\"refresh_period_ms\":%d,\"lvgl_core\":%d,\"lvgl_priority\":%d}\n",
+        app_desc->version, esp_get_idf_version(), CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ, BOARD_NAME,
+        display->width(), display->height(), buffer, buffer_lines, double_buffer, refresh_period_ms,
+        GetLvglTaskCore(), CONFIG_LVGL_TASK_PRIORITY);
+}
+
+} // namespace
+
+void Run(Display* display) {
+    ESP_LOGI(TAG, "Running display benchmark");
+    {
+        DisplayLockGuard lock(display);
+        lv_display_t* lv_display = lv_display_get_default();
+        if (lv_display == nullptr) {
+            ESP_LOGE(TAG, "No LVGL display");
+            return;
+        }
+        // 測定中にLVGLタスクで確保が起きないよう先に確保しておく
+        frames.reserve(1024);
+        lv_display_add_event_cb(lv_display, OnDisplayEvent, LV_EVENT_ALL, nullptr);
+    }
+
+    // DFSでクロックが変わると時間が比較できないため、最大周波数に固定する
+    esp_pm_lock_handle_t pm_lock = nullptr;
+    if (esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "benchmark", &pm_lock) == ESP_OK) {
+        esp_pm_lock_acquire(pm_lock);
+    }
+
+    ReportMeta(display);
+    RunScenario(display, "idle", "", []() {
+        vTaskDelay(pdMS_TO_TICKS(1000));
+    });
+    ScenarioChat(display);
+    ScenarioStream(display);
+    ScenarioSystemBurst(display);
+    ScenarioEmotion(display);
+    ScenarioTheme(display);
+    ScenarioPreview(display);
+    printf("BENCH {\"case\":\"done\"}\n");
+
+    if (pm_lock != nullptr) {
+        esp_pm_lock_release(pm_lock);
+        esp_pm_lock_delete(pm_lock);
+    }
+    ESP_LOGI(TAG, "Benchmark finished");
+}
+
+} // namespace display_benchmark
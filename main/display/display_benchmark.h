@@ -0,0 +1,32 @@
+/**
+ * @file display_benchmark.h
+ * @brief 表示（LVGL）のオンデバイスベンチマークと負荷試験
+ *
+ * 長いCJKの文、連続するシステムメッセージ、ストリーミングの追記、表情の切り替え、
+ * テーマの切り替え、プレビュー画像の表示をボードの表示へ順に流し込み、シナリオごとに
+ * 1回の描画（リフレッシュ）の時間、flush_cbとDMA完了待ちの時間、ヒープとLVGLオブジェクト数の変化を
+ * 1行のJSON（"BENCH "接頭辞付き）としてログに出力します。
+ * 描画バッファの設定は "meta" 行に出力するため、scripts/bench_compare.py で
+ * 設定やボードの異なる結果を同じシナリオ同士で比較できます。
+ */
+#ifndef DISPLAY_BENCHMARK_H
+#define DISPLAY_BENCHMARK_H
+
+class Display;
+
+/** @brief 描画が落ち着くまで待つ時間（各シナリオの後、次の測定の前） */
+#define DISPLAY_BENCHMARK_SETTLE_MS 500
+
+namespace display_benchmark {
+
+/**
+ * @brief すべてのシナリオを実行して結果をログに出力（完了まで戻らない）
+ *
+ * 通常のアプリケーションは起動せず、呼び出し元のタスクから表示を操作します。
+ * 測定はLVGLタスクの描画イベントで行うため、呼び出し元のタスクの優先度は結果に影響しません。
+ */
+void Run(Display* display);
+
+} // namespace display_benchmark
+
+#endif // DISPLAY_BENCHMARK_H
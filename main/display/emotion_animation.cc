@@ -0,0 +1,226 @@
+/**
+ * @file emotion_animation.cc
+ * @brief 表情のアニメーションの実装
+ */
+#include "emotion_animation.h"
+#include "task_factory.h"
+
+#include <esp_heap_caps.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <rom/miniz.h>
+
+#include <algorithm>
+#include <cstring>
+
+#define TAG "EmotionAnimation"
+
+static uint32_t ReadLe32(const uint8_t* data) {
+    return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+EmotionAnimator::EmotionAnimator(const uint8_t* pack, size_t pack_size, size_t budget_bytes,
+    std::function<void(const std::string& emotion)> on_ready)
+    : pack_(pack), pack_size_(pack_size), budget_bytes_(budget_bytes), on_ready_(on_ready) {
+    if (pack_size_ < 8 || memcmp(pack_, EMOTION_PACK_MAGIC, 4) != 0 || (pack_[4] | (pack_[5] << 8)) != 1) {
+        ESP_LOGW(TAG, "No valid emotion sprite pack embedded");
+        return;
+    }
+    size_t count = pack_[6] | (pack_[7] << 8);
+    if (8 + count * sizeof(EmotionSpriteEntry) > pack_size_) {
+        ESP_LOGE(TAG, "Emotion sprite pack is truncated");
+        return;
+    }
+    entries_ = (const EmotionSpriteEntry*)(pack_ + 8);
+    entry_count_ = count;
+    ESP_LOGI(TAG, "%u emotion sprites, cache budget %u KB", (unsigned)count, (unsigned)(budget_bytes_ / 1024));
+}
+
+EmotionAnimator::~EmotionAnimator() {
+    Stop();
+    if (decode_task_ != nullptr) {
+        DeleteTask(decode_task_);
+    }
+    if (decode_queue_ != nullptr) {
+        vQueueDelete(decode_queue_);
+    }
+    heap_caps_free(inflator_);
+    for (auto& sprite : cache_) {
+        heap_caps_free(sprite.pixels);
+    }
+}
+
+const EmotionSpriteEntry* EmotionAnimator::FindEntry(const char* emotion) const {
+    for (size_t i = 0; i < entry_count_; i++) {
+        if (strncmp(entries_[i].name, emotion, sizeof(entries_[i].name)) == 0) {
+            return &entries_[i];
+        }
+    }
+    return nullptr;
+}
+
+bool EmotionAnimator::Play(lv_obj_t* image, const char* emotion) {
+    Stop();
+    auto entry = FindEntry(emotion);
+    if (entry == nullptr) {
+        return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = std::find_if(cache_.begin(), cache_.end(), [entry](const Sprite& s) { return s.entry == entry; });
+        if (it != cache_.end()) {
+            // LRUの先頭へ移し、再生中は解放されないようにする
+            cache_.splice(cache_.begin(), cache_, it);
+            playing_ = &cache_.front();
+        }
+    }
+    if (playing_ == nullptr) {
+        if (decode_queue_ == nullptr) {
+            decode_queue_ = xQueueCreate(4, sizeof(uint16_t));
+            CreateTask([](void* arg) {
+                ((EmotionAnimator*)arg)->DecodeLoop();
+            }, "emotion_decode", 4096, this, EMOTION_DECODE_TASK_PRIORITY, &decode_task_);
+        }
+        uint16_t index = entry - entries_;
+        xQueueSend(decode_queue_, &index, 0);
+        return false;
+    }
+
+    image_ = image;
+    start_us_ = esp_timer_get_time();
+    frame_index_ = 0;
+    lv_image_set_src(image_, &playing_->frames[0]);
+    if (playing_->frames.size() > 1) {
+        timer_ = lv_timer_create([](lv_timer_t* timer) {
+            ((EmotionAnimator*)lv_timer_get_user_data(timer))->OnTimer();
+        }, std::max<uint16_t>(entry->frame_ms, 1), this);
+    }
+    return true;
+}
+
+void EmotionAnimator::Stop() {
+    if (timer_ != nullptr) {
+        lv_timer_delete(timer_);
+        timer_ = nullptr;
+    }
+    image_ = nullptr;
+    std::lock_guard<std::mutex> lock(mutex_);
+    playing_ = nullptr;
+}
+
+void EmotionAnimator::OnTimer() {
+    // 経過時間からフレームを決めるため、負荷でタイマーが遅れた分のフレームは飛ばして追いつく
+    auto entry = playing_->entry;
+    int index = (esp_timer_get_time() - start_us_) / 1000 / std::max<uint16_t>(entry->frame_ms, 1) % playing_->frames.size();
+    if (index != frame_index_) {
+        frame_index_ = index;
+        lv_image_set_src(image_, &playing_->frames[index]);
+    }
+}
+
+void EmotionAnimator::DecodeLoop() {
+    uint16_t index;
+    while (xQueueReceive(decode_queue_, &index, portMAX_DELAY) == pdTRUE) {
+        auto entry = &entries_[index];
+        bool cached;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            cached = std::any_of(cache_.begin(), cache_.end(), [entry](const Sprite& s) { return s.entry == entry; });
+        }
+        if (!cached && !Decode(entry)) {
+            continue;
+        }
+        on_ready_(std::string(entry->name, strnlen(entry->name, sizeof(entry->name))));
+    }
+}
+
+bool EmotionAnimator::Decode(const EmotionSpriteEntry* entry) {
+    size_t plane = entry->width * entry->height;
+    size_t frame_bytes = plane * (entry->format == 1 ? 3 : 2);
+    size_t bytes = frame_bytes * entry->frame_count;
+    if (entry->frame_count == 0 || bytes > budget_bytes_ ||
+        entry->frame_table + entry->frame_count * 8 > pack_size_) {
+        ESP_LOGE(TAG, "Sprite %.16s does not fit the cache (%u bytes)", entry->name, (unsigned)bytes);
+        return false;
+    }
+
+    // 予算を超える分を、再生中のものを除いて古い順に解放する
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto it = cache_.end(); used_bytes_ + bytes > budget_bytes_ && it != cache_.begin();) {
+            --it;
+            if (&*it == playing_) {
+                continue;
+            }
+            ESP_LOGI(TAG, "Evict %.16s (%u bytes)", it->entry->name, (unsigned)it->bytes);
+            used_bytes_ -= it->bytes;
+            heap_caps_free(it->pixels);
+            it = cache_.erase(it);
+        }
+        if (used_bytes_ + bytes > budget_bytes_) {
+            ESP_LOGW(TAG, "No room for %.16s while another sprite is playing", entry->name);
+            return false;
+        }
+    }
+
+    if (inflator_ == nullptr) {
+        inflator_ = heap_caps_malloc(sizeof(tinfl_decompressor), MALLOC_CAP_SPIRAM);
+    }
+    auto pixels = (uint8_t*)heap_caps_malloc(bytes, MALLOC_CAP_SPIRAM);
+    if (inflator_ == nullptr || pixels == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate %u bytes for %.16s", (unsigned)bytes, entry->name);
+        heap_caps_free(pixels);
+        return false;
+    }
+
+    int64_t start = esp_timer_get_time();
+    auto table = pack_ + entry->frame_table;
+    for (int i = 0; i < entry->frame_count; i++) {
+        uint32_t offset = ReadLe32(table + i * 8);
+        uint32_t size = ReadLe32(table + i * 8 + 4);
+        if (offset + size > pack_size_) {
+            ESP_LOGE(TAG, "Frame %d of %.16s is out of the pack", i, entry->name);
+            heap_caps_free(pixels);
+            return false;
+        }
+        // 出力先は1フレーム全体なので、辞書を循環させずにそのまま展開できる
+        auto inflator = (tinfl_decompressor*)inflator_;
+        tinfl_init(inflator);
+        uint8_t* out = pixels + i * frame_bytes;
+        size_t in_bytes = size;
+        size_t out_bytes = frame_bytes;
+        auto status = tinfl_decompress(inflator, pack_ + offset, &in_bytes, out, out, &out_bytes,
+            TINFL_FLAG_PARSE_ZLIB_HEADER | TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF);
+        if (status != TINFL_STATUS_DONE || out_bytes != frame_bytes) {
+            ESP_LOGE(TAG, "Failed to inflate frame %d of %.16s: %d", i, entry->name, status);
+            heap_caps_free(pixels);
+            return false;
+        }
+    }
+
+    Sprite sprite;
+    sprite.entry = entry;
+    sprite.pixels = pixels;
+    sprite.bytes = bytes;
+    sprite.frames.resize(entry->frame_count);
+    for (int i = 0; i < entry->frame_count; i++) {
+        auto& frame = sprite.frames[i];
+        memset(&frame, 0, sizeof(frame));
+        frame.header.magic = LV_IMAGE_HEADER_MAGIC;
+        frame.header.cf = entry->format == 1 ? LV_COLOR_FORMAT_RGB565A8 : LV_COLOR_FORMAT_RGB565;
+        frame.header.w = entry->width;
+        frame.header.h = entry->height;
+        frame.header.stride = entry->width * 2;
+        frame.data = pixels + i * frame_bytes;
+        frame.data_size = frame_bytes;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    cache_.push_front(std::move(sprite));
+    used_bytes_ += bytes;
+    ESP_LOGI(TAG, "Decoded %.16s: %d frames, %u bytes in %lld ms (cache %u/%u KB)", entry->name, entry->frame_count,
+        (unsigned)bytes, (esp_timer_get_time() - start) / 1000, (unsigned)(used_bytes_ / 1024),
+        (unsigned)(budget_bytes_ / 1024));
+    return true;
+}
@@ -0,0 +1,122 @@
+/**
+ * @file emotion_animation.h
+ * @brief 表情のアニメーション（スプライト）の再生とデコード済みフレームのキャッシュ
+ *
+ * スプライトはフレームごとにzlib圧縮したRGB565（またはRGB565A8）を1つのパックにまとめて
+ * フラッシュに埋め込みます（scripts/gen_emotion_sprites.py で生成）。初めて使う表情は
+ * 低優先度のタスクでPSRAMへ一度だけ展開し、以後は展開済みのフレームをLVGLのタイマーで
+ * 切り替えるだけなので、再生中にデコードの負荷はかかりません。
+ * キャッシュは CONFIG_EMOTION_CACHE_SIZE_KB を上限とし、超える場合は最も長く使われていない
+ * 表情から解放します。
+ *
+ * パックの形式（リトルエンディアン）:
+ *   ヘッダ      "XZEM", uint16 version(=1), uint16 sprite_count
+ *   スプライト  EmotionSpriteEntry × sprite_count
+ *   フレーム表  スプライトごとに {uint32 offset, uint32 size} × frame_count（offsetはパックの先頭から）
+ *   フレーム    zlib圧縮した画素（RGB565の面、RGB565A8ならその後にA8の面）
+ */
+#ifndef EMOTION_ANIMATION_H
+#define EMOTION_ANIMATION_H
+
+#include <lvgl.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/** @brief パックの先頭の識別子 */
+#define EMOTION_PACK_MAGIC "XZEM"
+
+/** @brief デコードタスクの優先度（音声やUIより低く、空き時間に展開する） */
+#define EMOTION_DECODE_TASK_PRIORITY 1
+
+/** @brief パック内のスプライトの記述 */
+struct EmotionSpriteEntry {
+    char name[16];              /**< 表情名（"happy" など、NUL終端） */
+    uint16_t width;
+    uint16_t height;
+    uint16_t frame_count;
+    uint16_t frame_ms;          /**< 1フレームの表示時間 */
+    uint8_t format;             /**< 0: RGB565、1: RGB565A8 */
+    uint8_t reserved[3];
+    uint32_t frame_table;       /**< フレーム表のオフセット（パックの先頭から） */
+} __attribute__((packed));
+
+/**
+ * @class EmotionAnimator
+ * @brief スプライトのパック、デコード済みフレームのLRUキャッシュ、再生
+ *
+ * Play()とStop()はLVGLのロックを持って呼びます。デコードは専用タスクで行い、
+ * 完了すると on_ready に表情名を渡します（呼び出し側がロックを取って再生し直す）。
+ */
+class EmotionAnimator {
+public:
+    /**
+     * @param pack 埋め込んだパック
+     * @param budget_bytes デコード済みフレームに使うPSRAMの上限
+     * @param on_ready デコードの完了通知（デコードタスクから呼ばれる）
+     */
+    EmotionAnimator(const uint8_t* pack, size_t pack_size, size_t budget_bytes,
+        std::function<void(const std::string& emotion)> on_ready);
+    ~EmotionAnimator();
+    EmotionAnimator(const EmotionAnimator&) = delete;
+    EmotionAnimator& operator=(const EmotionAnimator&) = delete;
+
+    /** @brief パックにスプライトがあるか */
+    bool Has(const char* emotion) const { return FindEntry(emotion) != nullptr; }
+
+    /**
+     * @brief 表情のアニメーションを再生
+     * @param image フレームを表示するlv_image
+     * @return 展開済みで再生を始めた場合true。未展開ならデコードを依頼してfalse
+     */
+    bool Play(lv_obj_t* image, const char* emotion);
+
+    /** @brief 再生を止める（表示中のフレームはそのまま） */
+    void Stop();
+
+private:
+    /** @brief デコード済みのスプライト */
+    struct Sprite {
+        const EmotionSpriteEntry* entry;
+        uint8_t* pixels = nullptr;              /**< 全フレーム（PSRAM） */
+        size_t bytes = 0;
+        std::vector<lv_image_dsc_t> frames;
+    };
+
+    const uint8_t* pack_;
+    size_t pack_size_;
+    const EmotionSpriteEntry* entries_ = nullptr;
+    size_t entry_count_ = 0;
+    size_t budget_bytes_;
+    std::function<void(const std::string& emotion)> on_ready_;
+
+    std::mutex mutex_;                          /**< cache_、used_bytes_、playing_の保護 */
+    std::list<Sprite> cache_;                   /**< 先頭ほど最近使われた */
+    size_t used_bytes_ = 0;
+    const Sprite* playing_ = nullptr;           /**< 再生中（解放しない） */
+
+    // 再生（LVGLのロック中のみ）
+    lv_timer_t* timer_ = nullptr;
+    lv_obj_t* image_ = nullptr;
+    int64_t start_us_ = 0;
+    int frame_index_ = -1;
+
+    QueueHandle_t decode_queue_ = nullptr;      /**< デコードを依頼するスプライトの番号 */
+    TaskHandle_t decode_task_ = nullptr;
+    void* inflator_ = nullptr;                  /**< tinfl_decompressor（PSRAM、デコードタスク専用） */
+
+    const EmotionSpriteEntry* FindEntry(const char* emotion) const;
+    bool Decode(const EmotionSpriteEntry* entry);
+    void DecodeLoop();
+    void OnTimer();
+};
+
+#endif // EMOTION_ANIMATION_H
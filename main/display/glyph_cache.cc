@@ -0,0 +1,95 @@
+#include "glyph_cache.h"
+#if CONFIG_USE_MEMORY_BUDGET
+#include "memory_budget.h"
+#endif
+
+#include <esp_heap_caps.h>
+#include <esp_lvgl_port.h>
+#include <cstring>
+
+GlyphCacheFont::GlyphCacheFont(const lv_font_t* base, size_t capacity_bytes)
+    : font_(*base), base_get_bitmap_(base->get_glyph_bitmap), capacity_bytes_(capacity_bytes) {
+    // dscやフォールバックは元のフォントのものをそのまま共有する
+    font_.get_glyph_bitmap = GetGlyphBitmap;
+    font_.user_data = this;
+#if CONFIG_USE_MEMORY_BUDGET
+    budget_id_ = MemoryBudget::GetInstance().Register("glyph", kMemoryPoolPsram, kMemoryPriorityLow,
+        [this]() { return used_bytes_; },
+        [this](size_t bytes) { return Shrink(bytes); });
+#endif
+}
+
+GlyphCacheFont::~GlyphCacheFont() {
+#if CONFIG_USE_MEMORY_BUDGET
+    MemoryBudget::GetInstance().Unregister(budget_id_);
+#endif
+    for (auto& entry : lru_) {
+        heap_caps_free(entry.bitmap);
+    }
+}
+
+const void* GlyphCacheFont::GetGlyphBitmap(lv_font_glyph_dsc_t* g_dsc, lv_draw_buf_t* draw_buf) {
+    auto self = static_cast<GlyphCacheFont*>(g_dsc->resolved_font->user_data);
+    return self->Lookup(g_dsc, draw_buf);
+}
+
+const void* GlyphCacheFont::Lookup(lv_font_glyph_dsc_t* g_dsc, lv_draw_buf_t* draw_buf) {
+    // 1〜8bppのグリフはA8へ展開される。画像グリフなどや描画バッファを使わない呼び出しはキャッシュしない
+    if (draw_buf == nullptr || g_dsc->format < LV_FONT_GLYPH_FORMAT_A1 || g_dsc->format > LV_FONT_GLYPH_FORMAT_A8) {
+        return base_get_bitmap_(g_dsc, draw_buf);
+    }
+    uint32_t stride = lv_draw_buf_width_to_stride(g_dsc->box_w, LV_COLOR_FORMAT_A8);
+    size_t size = (size_t)stride * g_dsc->box_h;
+    uint32_t glyph_id = g_dsc->gid.index;
+
+    auto it = index_.find(glyph_id);
+    if (it != index_.end() && it->second->size == size) {
+        lru_.splice(lru_.begin(), lru_, it->second);
+        memcpy(draw_buf->data, it->second->bitmap, size);
+        return draw_buf;
+    }
+
+    const void* result = base_get_bitmap_(g_dsc, draw_buf);
+    // 元の実装がdraw_bufへ展開した場合のみ保存できる
+    if (result != draw_buf || size == 0 || size > capacity_bytes_ / 8) {
+        return result;
+    }
+    if (it != index_.end()) {
+        used_bytes_ -= it->second->size;
+        heap_caps_free(it->second->bitmap);
+        lru_.erase(it->second);
+        index_.erase(it);
+    }
+    Evict(size);
+    auto bitmap = (uint8_t*)heap_caps_malloc(size, MALLOC_CAP_SPIRAM);
+    if (bitmap == nullptr) {
+        return result;
+    }
+    memcpy(bitmap, draw_buf->data, size);
+    lru_.push_front({glyph_id, bitmap, size});
+    index_[glyph_id] = lru_.begin();
+    used_bytes_ += size;
+    return result;
+}
+
+void GlyphCacheFont::Evict(size_t needed) {
+    while (!lru_.empty() && used_bytes_ + needed > capacity_bytes_) {
+        auto& oldest = lru_.back();
+        used_bytes_ -= oldest.size;
+        heap_caps_free(oldest.bitmap);
+        index_.erase(oldest.glyph_id);
+        lru_.pop_back();
+    }
+}
+
+size_t GlyphCacheFont::Shrink(size_t bytes) {
+    // 描画中なら待たない。グリフは展開し直せるので、次の水位チェックに任せる
+    if (!lvgl_port_lock(1)) {
+        return 0;
+    }
+    size_t before = used_bytes_;
+    Evict(used_bytes_ > bytes ? capacity_bytes_ - (used_bytes_ - bytes) : capacity_bytes_);
+    size_t freed = before - used_bytes_;
+    lvgl_port_unlock();
+    return freed;
+}
@@ -0,0 +1,64 @@
+/**
+ * @file glyph_cache.h
+ * @brief 展開済みグリフビットマップのLRUキャッシュ
+ *
+ * LVGLのlv_font_fmt_txtフォントは、描画のたびにグリフを1/2/4bppからA8へ展開
+ * （圧縮フォントでは伸張も）します。TTS再生中に長い中国語・日本語の文を再描画すると
+ * この展開が繰り返されるため、結果をPSRAMにキャッシュして再利用します。
+ */
+#ifndef GLYPH_CACHE_H
+#define GLYPH_CACHE_H
+
+#include <lvgl.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <unordered_map>
+
+/**
+ * @class GlyphCacheFont
+ * @brief 元のフォントを包み、get_glyph_bitmapだけをキャッシュ付きに差し替えたフォント
+ *
+ * グリフの検索（get_glyph_dsc）とフォールバックは元のフォントのまま使います。
+ * LVGLのロックを持つタスクからのみ呼ばれるため、内部で排他制御は行いません
+ * （メモリ予算からの回収だけはLVGLのロックを取ってから行います）。
+ */
+class GlyphCacheFont {
+public:
+    /**
+     * @param base 元のフォント（lv_font_fmt_txt形式）
+     * @param capacity_bytes キャッシュに使うPSRAMの上限
+     */
+    GlyphCacheFont(const lv_font_t* base, size_t capacity_bytes);
+    ~GlyphCacheFont();
+
+    GlyphCacheFont(const GlyphCacheFont&) = delete;
+    GlyphCacheFont& operator=(const GlyphCacheFont&) = delete;
+
+    /** @brief 描画に使うフォント */
+    const lv_font_t* font() const { return &font_; }
+
+private:
+    struct Entry {
+        uint32_t glyph_id;
+        uint8_t* bitmap;        /**< 展開済みA8ビットマップ（PSRAM） */
+        size_t size;
+    };
+
+    lv_font_t font_;                                            /**< 差し替え後のフォント */
+    const void* (*base_get_bitmap_)(lv_font_glyph_dsc_t*, lv_draw_buf_t*) = nullptr;
+    size_t capacity_bytes_;
+    size_t used_bytes_ = 0;
+    std::list<Entry> lru_;                                      /**< 先頭が最近使ったもの */
+    std::unordered_map<uint32_t, std::list<Entry>::iterator> index_;
+    int budget_id_ = -1;                                        /**< MemoryBudgetの登録ID */
+
+    static const void* GetGlyphBitmap(lv_font_glyph_dsc_t* g_dsc, lv_draw_buf_t* draw_buf);
+    const void* Lookup(lv_font_glyph_dsc_t* g_dsc, lv_draw_buf_t* draw_buf);
+    void Evict(size_t needed);
+    /** @brief メモリ予算からの回収要求。LVGLのロックが取れなければ何もしない */
+    size_t Shrink(size_t bytes);
+};
+
+#endif // GLYPH_CACHE_H
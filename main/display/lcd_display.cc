@@ -6,11 +6,18 @@
 #include <esp_log.h>
 #include <esp_err.h>
 #include <esp_lvgl_port.h>
+#include <esp_heap_caps.h>
+#if CONFIG_LCD_MIPI_DIRECT_FRAMEBUFFER
+#include <esp_lcd_mipi_dsi.h>
+#endif
 #include "assets/lang_config.h"
+#include <cmath>
 #include <cstring>
 #include "settings.h"
 
 #include "board.h"
+#include "trace_recorder.h"
+#include "lvgl_port_config.h"
 
 #define TAG "LcdDisplay"
 
@@ -66,11 +73,23 @@ const ThemeColors LIGHT_THEME = {
 
 LV_FONT_DECLARE(font_awesome_30_4);
 
+#if CONFIG_USE_EMOTION_ANIMATION
+// スプライトのパックは固定の名前で埋め込む（CMakeLists.txt）
+extern const uint8_t emotion_sprites_start[] asm("_binary_emotion_sprites_bin_start");
+extern const uint8_t emotion_sprites_end[] asm("_binary_emotion_sprites_bin_end");
+#endif
+
 LcdDisplay::LcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_handle_t panel, DisplayFonts fonts, int width, int height)
     : panel_io_(panel_io), panel_(panel), fonts_(fonts) {
     width_ = width;
     height_ = height;
 
+#if CONFIG_USE_GLYPH_CACHE
+    // チャット文の再描画でグリフの展開を繰り返さないよう、展開結果をPSRAMに残す
+    text_font_cache_ = std::make_unique<GlyphCacheFont>(fonts.text_font, CONFIG_GLYPH_CACHE_SIZE_KB * 1024);
+    fonts_.text_font = text_font_cache_->font();
+#endif
+
     // Load theme from settings
     Settings settings("display", false);
     current_theme_name_ = settings.GetString("theme", "light");
@@ -81,6 +100,33 @@ LcdDisplay::LcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_handle_
     } else if (current_theme_name_ == "light") {
         current_theme_ = LIGHT_THEME;
     }
+
+    // 色の設定はLVGLの初期化後（SetupUI）に行う
+    for (auto style : {&styles_.background, &styles_.content, &styles_.text, &styles_.system_text,
+            &styles_.user_bubble, &styles_.assistant_bubble, &styles_.system_bubble, &styles_.low_battery}) {
+        lv_style_init(style);
+    }
+}
+
+void LcdDisplay::UpdateThemeStyles() {
+    lv_style_set_bg_color(&styles_.background, current_theme_.background);
+    lv_style_set_text_color(&styles_.background, current_theme_.text);
+    lv_style_set_border_color(&styles_.background, current_theme_.border);
+
+    lv_style_set_bg_color(&styles_.content, current_theme_.chat_background);
+    lv_style_set_border_color(&styles_.content, current_theme_.border);
+
+    lv_style_set_text_color(&styles_.text, current_theme_.text);
+    lv_style_set_text_color(&styles_.system_text, current_theme_.system_text);
+
+    lv_style_set_bg_color(&styles_.user_bubble, current_theme_.user_bubble);
+    lv_style_set_border_color(&styles_.user_bubble, current_theme_.border);
+    lv_style_set_bg_color(&styles_.assistant_bubble, current_theme_.assistant_bubble);
+    lv_style_set_border_color(&styles_.assistant_bubble, current_theme_.border);
+    lv_style_set_bg_color(&styles_.system_bubble, current_theme_.system_bubble);
+    lv_style_set_border_color(&styles_.system_bubble, current_theme_.border);
+
+    lv_style_set_bg_color(&styles_.low_battery, current_theme_.low_battery);
 }
 
 SpiLcdDisplay::SpiLcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_handle_t panel,
@@ -102,19 +148,37 @@ SpiLcdDisplay::SpiLcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_h
     lv_init();
 
     ESP_LOGI(TAG, "Initialize LVGL port");
-    lvgl_port_cfg_t port_cfg = ESP_LVGL_PORT_INIT_CONFIG();
-    port_cfg.task_priority = 1;
-    port_cfg.timer_period_ms = 50;
+    lvgl_port_cfg_t port_cfg = GetLvglPortConfig();
     lvgl_port_init(&port_cfg);
 
-    ESP_LOGI(TAG, "Adding LCD screen");
+    // 描画バッファの配置とサイズはKconfigで選ぶ。PSRAMに置く場合はSPI DMAが直接読めないため、
+    // 内部RAMの転送バッファ（trans_size）経由で送る
+#if CONFIG_LCD_DRAW_BUFFER_FULL_FRAME
+    uint32_t buffer_lines = height_;
+#else
+    uint32_t buffer_lines = std::min<uint32_t>(CONFIG_LCD_DRAW_BUFFER_LINES, height_);
+#endif
+#if CONFIG_LCD_DRAW_BUFFER_PSRAM || CONFIG_LCD_DRAW_BUFFER_FULL_FRAME
+    bool buffer_spiram = true;
+    uint32_t trans_size = width_ * std::min<uint32_t>(CONFIG_LCD_TRANSFER_BUFFER_LINES, buffer_lines);
+#else
+    bool buffer_spiram = false;
+    uint32_t trans_size = 0;
+#endif
+#if CONFIG_LCD_DRAW_BUFFER_DOUBLE
+    bool double_buffer = true;
+#else
+    bool double_buffer = false;
+#endif
+    ESP_LOGI(TAG, "Adding LCD screen, draw buffer %lu lines x%d in %s", buffer_lines, double_buffer ? 2 : 1,
+        buffer_spiram ? "PSRAM" : "internal RAM");
     const lvgl_port_display_cfg_t display_cfg = {
         .io_handle = panel_io_,
         .panel_handle = panel_,
         .control_handle = nullptr,
-        .buffer_size = static_cast<uint32_t>(width_ * 20),
-        .double_buffer = false,
-        .trans_size = 0,
+        .buffer_size = static_cast<uint32_t>(width_) * buffer_lines,
+        .double_buffer = double_buffer,
+        .trans_size = trans_size,
         .hres = static_cast<uint32_t>(width_),
         .vres = static_cast<uint32_t>(height_),
         .monochrome = false,
@@ -125,8 +189,8 @@ SpiLcdDisplay::SpiLcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_h
         },
         .color_format = LV_COLOR_FORMAT_RGB565,
         .flags = {
-            .buff_dma = 1,
-            .buff_spiram = 0,
+            .buff_dma = !buffer_spiram,
+            .buff_spiram = buffer_spiram,
             .sw_rotate = 0,
             .swap_bytes = 1,
             .full_refresh = 0,
@@ -143,6 +207,9 @@ SpiLcdDisplay::SpiLcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_h
     if (offset_x != 0 || offset_y != 0) {
         lv_display_set_offset(display_, offset_x, offset_y);
     }
+    // SPIパネルはカメラセンサーと同じビッグエンディアンのRGB565を受け取るため、
+    // カメラのフレームはバイト入れ替えなしでそのまま送れる
+    direct_preview_supported_ = offset_x == 0 && offset_y == 0;
 
     SetupUI();
 }
@@ -164,9 +231,7 @@ RgbLcdDisplay::RgbLcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_h
     lv_init();
 
     ESP_LOGI(TAG, "Initialize LVGL port");
-    lvgl_port_cfg_t port_cfg = ESP_LVGL_PORT_INIT_CONFIG();
-    port_cfg.task_priority = 1;
-    port_cfg.timer_period_ms = 50;
+    lvgl_port_cfg_t port_cfg = GetLvglPortConfig();
     lvgl_port_init(&port_cfg);
 
     ESP_LOGI(TAG, "Adding LCD screen");
@@ -224,16 +289,25 @@ MipiLcdDisplay::MipiLcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel
     lv_init();
 
     ESP_LOGI(TAG, "Initialize LVGL port");
-    lvgl_port_cfg_t port_cfg = ESP_LVGL_PORT_INIT_CONFIG();
+    lvgl_port_cfg_t port_cfg = GetLvglPortConfig();
     lvgl_port_init(&port_cfg);
 
     ESP_LOGI(TAG, "Adding LCD screen");
+#if CONFIG_LCD_MIPI_DIRECT_FRAMEBUFFER
+    // パネルのDPIフレームバッファ（esp_lcd_dpi_panel_config_tのnum_fbs = 2）をそのまま描画バッファにする。
+    // 変化した領域だけを描画し、垂直同期でバッファを切り替えるためテアリングもない
+    uint32_t buffer_size = width_ * height_;
+    bool direct_mode = true;
+#else
+    uint32_t buffer_size = width_ * 50;
+    bool direct_mode = false;
+#endif
     const lvgl_port_display_cfg_t disp_cfg = {
             .io_handle = panel_io,
             .panel_handle = panel,
             .control_handle = nullptr,
-            .buffer_size = static_cast<uint32_t>(width_ * 50),
-            .double_buffer = false,
+            .buffer_size = buffer_size,
+            .double_buffer = direct_mode,
             .hres = static_cast<uint32_t>(width_),
             .vres = static_cast<uint32_t>(height_),
             .monochrome = false,
@@ -247,12 +321,14 @@ MipiLcdDisplay::MipiLcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel
             .buff_dma = true,
             .buff_spiram =false,
             .sw_rotate = false,
+            .full_refresh = false,
+            .direct_mode = direct_mode,
         },
     };
 
     const lvgl_port_display_dsi_cfg_t dpi_cfg = {
         .flags = {
-            .avoid_tearing = false,
+            .avoid_tearing = direct_mode,
         }
     };
     display_ = lvgl_port_add_disp_dsi(&disp_cfg, &dpi_cfg);
@@ -261,6 +337,24 @@ MipiLcdDisplay::MipiLcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel
         return;
     }
 
+#if CONFIG_LCD_MIPI_DIRECT_FRAMEBUFFER
+    if (esp_lcd_dpi_panel_get_frame_buffer(panel_, 2, &frame_buffers_[0], &frame_buffers_[1]) != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to get DPI frame buffers, PPA preview disabled");
+        frame_buffers_[0] = frame_buffers_[1] = nullptr;
+    }
+    ppa_client_config_t srm_config = {
+        .oper_type = PPA_OPERATION_SRM,
+        .max_pending_trans_num = 1,
+    };
+    ppa_client_config_t fill_config = {
+        .oper_type = PPA_OPERATION_FILL,
+        .max_pending_trans_num = 1,
+    };
+    if (ppa_register_client(&srm_config, &ppa_srm_) != ESP_OK || ppa_register_client(&fill_config, &ppa_fill_) != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to register PPA clients, PPA preview disabled");
+    }
+#endif
+
     if (offset_x != 0 || offset_y != 0) {
         lv_display_set_offset(display_, offset_x, offset_y);
     }
@@ -268,7 +362,107 @@ MipiLcdDisplay::MipiLcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel
     SetupUI();
 }
 
+#if CONFIG_LCD_MIPI_DIRECT_FRAMEBUFFER
+MipiLcdDisplay::~MipiLcdDisplay() {
+    if (ppa_srm_ != nullptr) {
+        ppa_unregister_client(ppa_srm_);
+    }
+    if (ppa_fill_ != nullptr) {
+        ppa_unregister_client(ppa_fill_);
+    }
+}
+
+bool MipiLcdDisplay::FitPreview(int width, int height, bool& rotate, float& scale) const {
+    // 縦長のパネルに横長のフレームなどは90度回転した方が大きく表示できる
+    float normal = std::min((float)width_ / width, (float)height_ / height);
+    float rotated = std::min((float)width_ / height, (float)height_ / width);
+    rotate = rotated > normal;
+    // PPAの倍率は1/16刻み
+    scale = std::floor((rotate ? rotated : normal) * 16) / 16;
+    return scale >= 1.0f / 16 && scale < 16;
+}
+
+bool MipiLcdDisplay::SupportsPreviewFrame(int width, int height) const {
+    bool rotate;
+    float scale;
+    return ppa_srm_ != nullptr && ppa_fill_ != nullptr && frame_buffers_[1] != nullptr &&
+        width > 0 && height > 0 && FitPreview(width, height, rotate, scale);
+}
+
+bool MipiLcdDisplay::DrawPreviewFrame(const uint8_t* data, int width, int height, int lock_timeout_ms) {
+    bool rotate;
+    float scale;
+    if (!SupportsPreviewFrame(width, height) || !FitPreview(width, height, rotate, scale)) {
+        return false;
+    }
+    if (!Lock(lock_timeout_ms)) {
+        return false;
+    }
+    if (!direct_preview_active_) {
+        // フレームバッファに書いたプレビューをLVGLが上書きしないよう、再描画を止める
+        lv_display_enable_invalidation(display_, false);
+        direct_preview_active_ = true;
+        preview_cleared_ = 0;
+    }
+
+    // 表示されていない方のフレームバッファへ書き込み、draw_bitmapで垂直同期時に切り替える
+    void* fb = frame_buffers_[preview_fb_index_];
+    uint32_t fb_size = width_ * height_ * 2;
+    if (!(preview_cleared_ & (1 << preview_fb_index_))) {
+        // LVGLの画面が残っているため、初回だけ全体を黒で塗りつぶして余白にする
+        ppa_fill_oper_config_t fill = {};
+        fill.out.buffer = fb;
+        fill.out.buffer_size = fb_size;
+        fill.out.pic_w = width_;
+        fill.out.pic_h = height_;
+        fill.out.fill_cm = PPA_FILL_COLOR_MODE_RGB565;
+        fill.fill_block_w = width_;
+        fill.fill_block_h = height_;
+        fill.fill_argb_color.val = 0xFF000000;
+        fill.mode = PPA_TRANS_MODE_BLOCKING;
+        if (ppa_do_fill(ppa_fill_, &fill) == ESP_OK) {
+            preview_cleared_ |= 1 << preview_fb_index_;
+        }
+    }
+
+    int out_w = (int)((rotate ? height : width) * scale);
+    int out_h = (int)((rotate ? width : height) * scale);
+    ppa_srm_oper_config_t srm = {};
+    srm.in.buffer = data;
+    srm.in.pic_w = width;
+    srm.in.pic_h = height;
+    srm.in.block_w = width;
+    srm.in.block_h = height;
+    srm.in.srm_cm = PPA_SRM_COLOR_MODE_RGB565;
+    srm.out.buffer = fb;
+    srm.out.buffer_size = fb_size;
+    srm.out.pic_w = width_;
+    srm.out.pic_h = height_;
+    srm.out.block_offset_x = (width_ - out_w) / 2;
+    srm.out.block_offset_y = (height_ - out_h) / 2;
+    srm.out.srm_cm = PPA_SRM_COLOR_MODE_RGB565;
+    srm.rotation_angle = rotate ? PPA_SRM_ROTATION_ANGLE_90 : PPA_SRM_ROTATION_ANGLE_0;
+    srm.scale_x = scale;
+    srm.scale_y = scale;
+    // カメラのRGB565はビッグエンディアン、DPIパネルはリトルエンディアン
+    srm.byte_swap = true;
+    srm.mode = PPA_TRANS_MODE_BLOCKING;
+    esp_err_t err = ppa_do_scale_rotate_mirror(ppa_srm_, &srm);
+    if (err == ESP_OK) {
+        esp_lcd_panel_draw_bitmap(panel_, 0, 0, width_, height_, fb);
+        preview_fb_index_ ^= 1;
+    } else {
+        ESP_LOGW(TAG, "PPA scale/rotate failed: %s", esp_err_to_name(err));
+    }
+    Unlock();
+    return err == ESP_OK;
+}
+#endif
+
 LcdDisplay::~LcdDisplay() {
+#if CONFIG_USE_EMOTION_ANIMATION
+    emotion_animator_.reset();
+#endif
     // 然后再清理 LVGL 对象
     if (content_ != nullptr) {
         lv_obj_del(content_);
@@ -285,6 +479,14 @@ LcdDisplay::~LcdDisplay() {
     if (display_ != nullptr) {
         lv_display_delete(display_);
     }
+    for (auto style : {&styles_.background, &styles_.content, &styles_.text, &styles_.system_text,
+            &styles_.user_bubble, &styles_.assistant_bubble, &styles_.system_bubble, &styles_.low_battery}) {
+        lv_style_reset(style);
+    }
+
+    for (auto strip : preview_strips_) {
+        heap_caps_free(strip);
+    }
 
     if (panel_ != nullptr) {
         esp_lcd_panel_del(panel_);
@@ -302,14 +504,44 @@ void LcdDisplay::Unlock() {
     lvgl_port_unlock();
 }
 
+#if CONFIG_USE_TRACE_SPANS
+// flush_cbの呼び出しと、DMA転送の完了待ちをそれぞれスパンとして記録する（LVGLタスク専用）
+static void AttachFlushTrace(lv_display_t* display) {
+    lv_display_add_event_cb(display, [](lv_event_t* e) {
+        static int64_t flush_start_us = 0;
+        static int64_t wait_start_us = 0;
+        switch (lv_event_get_code(e)) {
+        case LV_EVENT_FLUSH_START:
+            flush_start_us = esp_timer_get_time();
+            break;
+        case LV_EVENT_FLUSH_FINISH:
+            TraceRecorder::GetInstance().Record("lvgl_flush", flush_start_us, esp_timer_get_time());
+            break;
+        case LV_EVENT_FLUSH_WAIT_START:
+            wait_start_us = esp_timer_get_time();
+            break;
+        case LV_EVENT_FLUSH_WAIT_FINISH:
+            TraceRecorder::GetInstance().Record("lvgl_flush_wait", wait_start_us, esp_timer_get_time());
+            break;
+        default:
+            break;
+        }
+    }, LV_EVENT_ALL, nullptr);
+}
+#endif
+
 #if CONFIG_USE_WECHAT_MESSAGE_STYLE
 void LcdDisplay::SetupUI() {
     DisplayLockGuard lock(this);
+    LvglRenderMonitor::GetInstance().Attach(display_);
+#if CONFIG_USE_TRACE_SPANS
+    AttachFlushTrace(display_);
+#endif
 
+    UpdateThemeStyles();
     auto screen = lv_screen_active();
     lv_obj_set_style_text_font(screen, fonts_.text_font, 0);
-    lv_obj_set_style_text_color(screen, current_theme_.text, 0);
-    lv_obj_set_style_bg_color(screen, current_theme_.background, 0);
+    lv_obj_add_style(screen, &styles_.background, 0);
 
     /* Container */
     container_ = lv_obj_create(screen);
@@ -318,15 +550,13 @@ void LcdDisplay::SetupUI() {
     lv_obj_set_style_pad_all(container_, 0, 0);
     lv_obj_set_style_border_width(container_, 0, 0);
     lv_obj_set_style_pad_row(container_, 0, 0);
-    lv_obj_set_style_bg_color(container_, current_theme_.background, 0);
-    lv_obj_set_style_border_color(container_, current_theme_.border, 0);
+    lv_obj_add_style(container_, &styles_.background, 0);
 
     /* Status bar */
     status_bar_ = lv_obj_create(container_);
     lv_obj_set_size(status_bar_, LV_HOR_RES, LV_SIZE_CONTENT);
     lv_obj_set_style_radius(status_bar_, 0, 0);
-    lv_obj_set_style_bg_color(status_bar_, current_theme_.background, 0);
-    lv_obj_set_style_text_color(status_bar_, current_theme_.text, 0);
+    lv_obj_add_style(status_bar_, &styles_.background, 0);
     
     /* Content - Chat area */
     content_ = lv_obj_create(container_);
@@ -334,8 +564,7 @@ void LcdDisplay::SetupUI() {
     lv_obj_set_width(content_, LV_HOR_RES);
     lv_obj_set_flex_grow(content_, 1);
     lv_obj_set_style_pad_all(content_, 10, 0);
-    lv_obj_set_style_bg_color(content_, current_theme_.chat_background, 0); // Background for chat area
-    lv_obj_set_style_border_color(content_, current_theme_.border, 0); // Border color for chat area
+    lv_obj_add_style(content_, &styles_.content, 0);
 
     // Enable scrolling for chat content
     lv_obj_set_scrollbar_mode(content_, LV_SCROLLBAR_MODE_OFF);
@@ -348,6 +577,16 @@ void LcdDisplay::SetupUI() {
 
     // We'll create chat messages dynamically in SetChatMessage
     chat_message_label_ = nullptr;
+#if CONFIG_USE_CHAT_SCROLLBACK
+    chat_history_ = std::make_unique<ChatHistory>(CONFIG_CHAT_HISTORY_KB * 1024, CONFIG_CHAT_HISTORY_MAX_MESSAGES);
+    if (chat_history_->valid()) {
+        lv_obj_add_event_cb(content_, [](lv_event_t* e) {
+            static_cast<LcdDisplay*>(lv_event_get_user_data(e))->OnChatScrollEnd();
+        }, LV_EVENT_SCROLL_END, this);
+    } else {
+        chat_history_.reset();
+    }
+#endif
 
     /* Status bar */
     lv_obj_set_flex_flow(status_bar_, LV_FLEX_FLOW_ROW);
@@ -365,14 +604,17 @@ void LcdDisplay::SetupUI() {
     // 创建emotion_label_在状态栏最左侧
     emotion_label_ = lv_label_create(status_bar_);
     lv_obj_set_style_text_font(emotion_label_, &font_awesome_30_4, 0);
-    lv_obj_set_style_text_color(emotion_label_, current_theme_.text, 0);
+    lv_obj_add_style(emotion_label_, &styles_.text, 0);
     lv_label_set_text(emotion_label_, FONT_AWESOME_AI_CHIP);
     lv_obj_set_style_margin_right(emotion_label_, 5, 0); // 添加右边距，与后面的元素分隔
+#if CONFIG_USE_EMOTION_ANIMATION
+    SetupEmotionAnimation();
+#endif
 
     notification_label_ = lv_label_create(status_bar_);
     lv_obj_set_flex_grow(notification_label_, 1);
     lv_obj_set_style_text_align(notification_label_, LV_TEXT_ALIGN_CENTER, 0);
-    lv_obj_set_style_text_color(notification_label_, current_theme_.text, 0);
+    lv_obj_add_style(notification_label_, &styles_.text, 0);
     lv_label_set_text(notification_label_, "");
     lv_obj_add_flag(notification_label_, LV_OBJ_FLAG_HIDDEN);
 
@@ -380,31 +622,31 @@ void LcdDisplay::SetupUI() {
     lv_obj_set_flex_grow(status_label_, 1);
     lv_label_set_long_mode(status_label_, LV_LABEL_LONG_SCROLL_CIRCULAR);
     lv_obj_set_style_text_align(status_label_, LV_TEXT_ALIGN_CENTER, 0);
-    lv_obj_set_style_text_color(status_label_, current_theme_.text, 0);
+    lv_obj_add_style(status_label_, &styles_.text, 0);
     lv_label_set_text(status_label_, Lang::Strings::INITIALIZING);
     
     mute_label_ = lv_label_create(status_bar_);
     lv_label_set_text(mute_label_, "");
     lv_obj_set_style_text_font(mute_label_, fonts_.icon_font, 0);
-    lv_obj_set_style_text_color(mute_label_, current_theme_.text, 0);
+    lv_obj_add_style(mute_label_, &styles_.text, 0);
 
     network_label_ = lv_label_create(status_bar_);
     lv_label_set_text(network_label_, "");
     lv_obj_set_style_text_font(network_label_, fonts_.icon_font, 0);
-    lv_obj_set_style_text_color(network_label_, current_theme_.text, 0);
+    lv_obj_add_style(network_label_, &styles_.text, 0);
     lv_obj_set_style_margin_left(network_label_, 5, 0); // 添加左边距，与前面的元素分隔
 
     battery_label_ = lv_label_create(status_bar_);
     lv_label_set_text(battery_label_, "");
     lv_obj_set_style_text_font(battery_label_, fonts_.icon_font, 0);
-    lv_obj_set_style_text_color(battery_label_, current_theme_.text, 0);
+    lv_obj_add_style(battery_label_, &styles_.text, 0);
     lv_obj_set_style_margin_left(battery_label_, 5, 0); // 添加左边距，与前面的元素分隔
 
     low_battery_popup_ = lv_obj_create(screen);
     lv_obj_set_scrollbar_mode(low_battery_popup_, LV_SCROLLBAR_MODE_OFF);
     lv_obj_set_size(low_battery_popup_, LV_HOR_RES * 0.9, fonts_.text_font->line_height * 2);
     lv_obj_align(low_battery_popup_, LV_ALIGN_BOTTOM_MID, 0, 0);
-    lv_obj_set_style_bg_color(low_battery_popup_, current_theme_.low_battery, 0);
+    lv_obj_add_style(low_battery_popup_, &styles_.low_battery, 0);
     lv_obj_set_style_radius(low_battery_popup_, 10, 0);
     low_battery_label_ = lv_label_create(low_battery_popup_);
     lv_label_set_text(low_battery_label_, Lang::Strings::BATTERY_NEED_CHARGE);
@@ -417,58 +659,46 @@ void LcdDisplay::SetupUI() {
 #else
 #define  MAX_MESSAGES 20
 #endif
-void LcdDisplay::SetChatMessage(const char* role, const char* content) {
-    DisplayLockGuard lock(this);
-    if (content_ == nullptr) {
-        return;
-    }
-    
-    //避免出现空的消息框
-    if(strlen(content) == 0) return;
-    
-    // 检查消息数量是否超过限制
+lv_obj_t* LcdDisplay::AcquireChatRow() {
     uint32_t child_count = lv_obj_get_child_cnt(content_);
-    if (child_count >= MAX_MESSAGES) {
-        // 删除最早的消息（第一个子对象）
-        lv_obj_t* first_child = lv_obj_get_child(content_, 0);
-        lv_obj_t* last_child = lv_obj_get_child(content_, child_count - 1);
-        if (first_child != nullptr) {
-            lv_obj_del(first_child);
-        }
-        // Scroll to the last message immediately
-        if (last_child != nullptr) {
-            lv_obj_scroll_to_view_recursive(last_child, LV_ANIM_OFF);
-        }
-    }
-    
-    // 折叠系统消息（如果是系统消息，检查最后一个消息是否也是系统消息）
-    if (strcmp(role, "system") == 0 && child_count > 0) {
-        // 获取最后一个消息容器
-        lv_obj_t* last_container = lv_obj_get_child(content_, child_count - 1);
-        if (last_container != nullptr && lv_obj_get_child_cnt(last_container) > 0) {
-            // 获取容器内的气泡
-            lv_obj_t* last_bubble = lv_obj_get_child(last_container, 0);
-            if (last_bubble != nullptr) {
-                // 检查气泡类型是否为系统消息
-                void* bubble_type_ptr = lv_obj_get_user_data(last_bubble);
-                if (bubble_type_ptr != nullptr && strcmp((const char*)bubble_type_ptr, "system") == 0) {
-                    // 如果最后一个消息也是系统消息，则删除它
-                    lv_obj_del(last_container);
-                }
-            }
-        }
+    if (child_count < MAX_MESSAGES) {
+        // 全幅の透明な行コンテナ > 気泡 > ラベル の3段を作る。以後は作り直さず再利用する
+        lv_obj_t* row = lv_obj_create(content_);
+        lv_obj_set_width(row, LV_HOR_RES);
+        lv_obj_set_height(row, LV_SIZE_CONTENT);
+        lv_obj_set_style_bg_opa(row, LV_OPA_TRANSP, 0);
+        lv_obj_set_style_border_width(row, 0, 0);
+        lv_obj_set_style_pad_all(row, 0, 0);
+        lv_obj_set_scrollbar_mode(row, LV_SCROLLBAR_MODE_OFF);
+
+        lv_obj_t* bubble = lv_obj_create(row);
+        lv_obj_set_style_radius(bubble, 8, 0);
+        lv_obj_set_scrollbar_mode(bubble, LV_SCROLLBAR_MODE_OFF);
+        lv_obj_set_style_border_width(bubble, 1, 0);
+        lv_obj_set_style_pad_all(bubble, 8, 0);
+        lv_obj_set_size(bubble, LV_SIZE_CONTENT, LV_SIZE_CONTENT);
+        lv_obj_set_style_flex_grow(bubble, 0, 0);
+
+        lv_obj_t* text = lv_label_create(bubble);
+        lv_label_set_long_mode(text, LV_LABEL_LONG_WRAP);
+        lv_obj_set_style_text_font(text, fonts_.text_font, 0);
+        return row;
     }
-    
-    // Create a message bubble
-    lv_obj_t* msg_bubble = lv_obj_create(content_);
-    lv_obj_set_style_radius(msg_bubble, 8, 0);
-    lv_obj_set_scrollbar_mode(msg_bubble, LV_SCROLLBAR_MODE_OFF);
-    lv_obj_set_style_border_width(msg_bubble, 1, 0);
-    lv_obj_set_style_border_color(msg_bubble, current_theme_.border, 0);
-    lv_obj_set_style_pad_all(msg_bubble, 8, 0);
-
-    // Create the message text
-    lv_obj_t* msg_text = lv_label_create(msg_bubble);
+
+    // 上限に達したら最も古い行を末尾へ移して使い回す（生成/削除を行わない）
+    lv_obj_t* row = lv_obj_get_child(content_, 0);
+    lv_obj_move_to_index(row, -1);
+#if CONFIG_USE_CHAT_SCROLLBACK
+    chat_window_first_++;
+#endif
+    return row;
+}
+
+void LcdDisplay::BindChatRow(lv_obj_t* row, const char* role, const char* content) {
+    bool is_user = strcmp(role, "user") == 0;
+    bool is_system = strcmp(role, "system") == 0;
+    lv_obj_t* msg_bubble = lv_obj_get_child(row, 0);
+    lv_obj_t* msg_text = lv_obj_get_child(msg_bubble, 0);
     lv_label_set_text(msg_text, content);
     
     // 计算文本实际宽度
@@ -493,120 +723,222 @@ void LcdDisplay::SetChatMessage(const char* role, const char* content) {
     
     // 设置消息文本的宽度
     lv_obj_set_width(msg_text, bubble_width);  // 减去padding
-    lv_label_set_long_mode(msg_text, LV_LABEL_LONG_WRAP);
-    lv_obj_set_style_text_font(msg_text, fonts_.text_font, 0);
-
-    // 设置气泡宽度
-    lv_obj_set_width(msg_bubble, bubble_width);
-    lv_obj_set_height(msg_bubble, LV_SIZE_CONTENT);
 
     // Set alignment and style based on message role
-    if (strcmp(role, "user") == 0) {
-        // User messages are right-aligned with green background
-        lv_obj_set_style_bg_color(msg_bubble, current_theme_.user_bubble, 0);
-        // Set text color for contrast
-        lv_obj_set_style_text_color(msg_text, current_theme_.text, 0);
-        
-        // 设置自定义属性标记气泡类型
-        lv_obj_set_user_data(msg_bubble, (void*)"user");
-        
-        // Set appropriate width for content
-        lv_obj_set_width(msg_bubble, LV_SIZE_CONTENT);
-        lv_obj_set_height(msg_bubble, LV_SIZE_CONTENT);
-        
-        // Don't grow
-        lv_obj_set_style_flex_grow(msg_bubble, 0, 0);
-    } else if (strcmp(role, "assistant") == 0) {
-        // Assistant messages are left-aligned with white background
-        lv_obj_set_style_bg_color(msg_bubble, current_theme_.assistant_bubble, 0);
-        // Set text color for contrast
-        lv_obj_set_style_text_color(msg_text, current_theme_.text, 0);
-        
-        // 设置自定义属性标记气泡类型
-        lv_obj_set_user_data(msg_bubble, (void*)"assistant");
-        
-        // Set appropriate width for content
-        lv_obj_set_width(msg_bubble, LV_SIZE_CONTENT);
-        lv_obj_set_height(msg_bubble, LV_SIZE_CONTENT);
-        
-        // Don't grow
-        lv_obj_set_style_flex_grow(msg_bubble, 0, 0);
-    } else if (strcmp(role, "system") == 0) {
-        // System messages are center-aligned with light gray background
-        lv_obj_set_style_bg_color(msg_bubble, current_theme_.system_bubble, 0);
-        // Set text color for contrast
-        lv_obj_set_style_text_color(msg_text, current_theme_.system_text, 0);
-        
-        // 设置自定义属性标记气泡类型
-        lv_obj_set_user_data(msg_bubble, (void*)"system");
-        
-        // Set appropriate width for content
-        lv_obj_set_width(msg_bubble, LV_SIZE_CONTENT);
-        lv_obj_set_height(msg_bubble, LV_SIZE_CONTENT);
-        
-        // Don't grow
-        lv_obj_set_style_flex_grow(msg_bubble, 0, 0);
+    // 行を使い回すため、前の役割のスタイルを外してから共有スタイルを付ける
+    const char* previous_role = (const char*)lv_obj_get_user_data(msg_bubble);
+    const char* new_role = is_user ? "user" : is_system ? "system" : "assistant";
+    if (previous_role == nullptr || strcmp(previous_role, new_role) != 0) {
+        lv_obj_remove_style(msg_bubble, &styles_.user_bubble, 0);
+        lv_obj_remove_style(msg_bubble, &styles_.assistant_bubble, 0);
+        lv_obj_remove_style(msg_bubble, &styles_.system_bubble, 0);
+        lv_obj_remove_style(msg_text, &styles_.text, 0);
+        lv_obj_remove_style(msg_text, &styles_.system_text, 0);
+        if (is_user) {
+            lv_obj_add_style(msg_bubble, &styles_.user_bubble, 0);
+            lv_obj_add_style(msg_text, &styles_.text, 0);
+        } else if (is_system) {
+            lv_obj_add_style(msg_bubble, &styles_.system_bubble, 0);
+            lv_obj_add_style(msg_text, &styles_.system_text, 0);
+        } else {
+            lv_obj_add_style(msg_bubble, &styles_.assistant_bubble, 0);
+            lv_obj_add_style(msg_text, &styles_.text, 0);
+        }
+        lv_obj_set_user_data(msg_bubble, (void*)new_role);
     }
-    
-    // Create a full-width container for user messages to ensure right alignment
-    if (strcmp(role, "user") == 0) {
-        // Create a full-width container
-        lv_obj_t* container = lv_obj_create(content_);
-        lv_obj_set_width(container, LV_HOR_RES);
-        lv_obj_set_height(container, LV_SIZE_CONTENT);
-        
-        // Make container transparent and borderless
-        lv_obj_set_style_bg_opa(container, LV_OPA_TRANSP, 0);
-        lv_obj_set_style_border_width(container, 0, 0);
-        lv_obj_set_style_pad_all(container, 0, 0);
-        
-        // Move the message bubble into this container
-        lv_obj_set_parent(msg_bubble, container);
-        
-        // Right align the bubble in the container
+    if (is_user) {
+        // User messages are right-aligned with green background
         lv_obj_align(msg_bubble, LV_ALIGN_RIGHT_MID, -25, 0);
-        
-        // Auto-scroll to this container
-        lv_obj_scroll_to_view_recursive(container, LV_ANIM_ON);
-    } else if (strcmp(role, "system") == 0) {
-        // 为系统消息创建全宽容器以确保居中对齐
-        lv_obj_t* container = lv_obj_create(content_);
-        lv_obj_set_width(container, LV_HOR_RES);
-        lv_obj_set_height(container, LV_SIZE_CONTENT);
-        
-        // 使容器透明且无边框
-        lv_obj_set_style_bg_opa(container, LV_OPA_TRANSP, 0);
-        lv_obj_set_style_border_width(container, 0, 0);
-        lv_obj_set_style_pad_all(container, 0, 0);
-        
-        // 将消息气泡移入此容器
-        lv_obj_set_parent(msg_bubble, container);
-        
-        // 将气泡居中对齐在容器中
+    } else if (is_system) {
+        // System messages are center-aligned with light gray background
         lv_obj_align(msg_bubble, LV_ALIGN_CENTER, 0, 0);
-        
-        // 自动滚动底部
-        lv_obj_scroll_to_view_recursive(container, LV_ANIM_ON);
     } else {
-        // For assistant messages
-        // Left align assistant messages
+        // Assistant messages are left-aligned with white background
         lv_obj_align(msg_bubble, LV_ALIGN_LEFT_MID, 0, 0);
+    }
+}
+
+#if CONFIG_USE_CHAT_SCROLLBACK
+static const char* ChatRoleName(ChatRole role) {
+    return role == kChatRoleUser ? "user" : role == kChatRoleSystem ? "system" : "assistant";
+}
+
+bool LcdDisplay::ShowsLatestChatMessage() const {
+    return chat_window_first_ + lv_obj_get_child_cnt(content_) == chat_history_->end();
+}
+
+void LcdDisplay::ShowLatestChatMessages() {
+    uint32_t end = chat_history_->end();
+    uint32_t rows = lv_obj_get_child_cnt(content_);
+    // 容量の上限で捨てられた分、行が余る場合は削除する
+    while (rows > end - chat_history_->first()) {
+        lv_obj_del(lv_obj_get_child(content_, 0));
+        rows--;
+    }
+    chat_window_first_ = end - rows;
+    for (uint32_t i = 0; i < rows; ++i) {
+        ChatRole role;
+        const char* text;
+        chat_history_->Get(chat_window_first_ + i, role, text);
+        BindChatRow(lv_obj_get_child(content_, i), ChatRoleName(role), text);
+    }
+    chat_message_label_ = nullptr;
+    if (rows > 0) {
+        lv_obj_t* last_row = lv_obj_get_child(content_, rows - 1);
+        chat_message_label_ = lv_obj_get_child(lv_obj_get_child(last_row, 0), 0);
+        lv_obj_update_layout(content_);
+        lv_obj_scroll_to_view(last_row, LV_ANIM_OFF);
+    }
+}
 
-        // Auto-scroll to the message bubble
-        lv_obj_scroll_to_view_recursive(msg_bubble, LV_ANIM_ON);
+void LcdDisplay::OnChatScrollEnd() {
+    uint32_t rows = lv_obj_get_child_cnt(content_);
+    if (chat_paging_ || rows == 0) {
+        return;
+    }
+    // 端から画面の半分以内で止まったら、行の1/4ずつ割り当て直す
+    lv_coord_t margin = lv_obj_get_height(content_) / 2;
+    uint32_t step = std::max<uint32_t>(1, rows / 4);
+    uint32_t window_end = chat_window_first_ + rows;
+    bool older = lv_obj_get_scroll_top(content_) < margin && chat_window_first_ > chat_history_->first();
+    bool newer = !older && lv_obj_get_scroll_bottom(content_) < margin && window_end < chat_history_->end();
+    if (!older && !newer) {
+        return;
+    }
+
+    chat_paging_ = true;
+    // 移さない側の端の行を基準に、割り当て直しの前後で画面上の位置を揃える
+    lv_obj_t* anchor = lv_obj_get_child(content_, older ? 0 : rows - 1);
+    lv_coord_t anchor_y = lv_obj_get_y(anchor);
+    ChatRole role;
+    const char* text;
+    if (older) {
+        step = std::min(step, chat_window_first_ - chat_history_->first());
+        for (uint32_t i = 0; i < step; ++i) {
+            lv_obj_t* row = lv_obj_get_child(content_, rows - 1);
+            lv_obj_move_to_index(row, 0);
+            chat_history_->Get(chat_window_first_ - 1 - i, role, text);
+            BindChatRow(row, ChatRoleName(role), text);
+        }
+        chat_window_first_ -= step;
+        chat_message_label_ = nullptr;
+    } else {
+        step = std::min(step, chat_history_->end() - window_end);
+        for (uint32_t i = 0; i < step; ++i) {
+            lv_obj_t* row = lv_obj_get_child(content_, 0);
+            lv_obj_move_to_index(row, -1);
+            chat_history_->Get(window_end + i, role, text);
+            BindChatRow(row, ChatRoleName(role), text);
+        }
+        chat_window_first_ += step;
+        if (ShowsLatestChatMessage()) {
+            chat_message_label_ = lv_obj_get_child(lv_obj_get_child(lv_obj_get_child(content_, rows - 1), 0), 0);
+        }
+    }
+    lv_obj_update_layout(content_);
+    lv_obj_scroll_to_y(content_, lv_obj_get_scroll_y(content_) + lv_obj_get_y(anchor) - anchor_y, LV_ANIM_OFF);
+    chat_paging_ = false;
+}
+#endif
+
+void LcdDisplay::SetChatMessage(const char* role, const char* content) {
+    DisplayLockGuard lock(this);
+    if (content_ == nullptr) {
+        return;
     }
     
+    //避免出现空的消息框
+    if(strlen(content) == 0) return;
+
+    bool is_system = strcmp(role, "system") == 0;
+
+#if CONFIG_USE_CHAT_SCROLLBACK
+    if (chat_history_ != nullptr) {
+        // 折叠系统消息：最后一个消息也是系统消息时，直接复用它
+        ChatRole last_role;
+        const char* last_text;
+        bool collapse = is_system && chat_history_->Get(chat_history_->end() - 1, last_role, last_text) &&
+            last_role == kChatRoleSystem;
+        // 遡って見ている間に届いたら、最新の位置へ戻してから表示する
+        bool latest = ShowsLatestChatMessage();
+        if (collapse) {
+            chat_history_->ReplaceLast(content);
+        } else {
+            chat_history_->Add(strcmp(role, "user") == 0 ? kChatRoleUser : is_system ? kChatRoleSystem : kChatRoleAssistant,
+                content);
+        }
+        if (!latest) {
+            chat_paging_ = true;
+            if (!collapse) {
+                AcquireChatRow();
+            }
+            ShowLatestChatMessages();
+            chat_paging_ = false;
+            return;
+        }
+    }
+#endif
+
+    // 折叠系统消息：最后一个消息也是系统消息时，直接复用它
+    lv_obj_t* row = nullptr;
+    uint32_t child_count = lv_obj_get_child_cnt(content_);
+    if (is_system && child_count > 0) {
+        lv_obj_t* last_row = lv_obj_get_child(content_, child_count - 1);
+        lv_obj_t* last_bubble = lv_obj_get_child(last_row, 0);
+        void* bubble_type_ptr = last_bubble != nullptr ? lv_obj_get_user_data(last_bubble) : nullptr;
+        if (bubble_type_ptr != nullptr && strcmp((const char*)bubble_type_ptr, "system") == 0) {
+            row = last_row;
+        }
+    }
+    if (row == nullptr) {
+        row = AcquireChatRow();
+    }
+    BindChatRow(row, role, content);
+
+    // 行はcontent_の直下にあるため、再帰せずcontent_だけをスクロールする
+    lv_obj_scroll_to_view(row, LV_ANIM_ON);
+    
     // Store reference to the latest message label
-    chat_message_label_ = msg_text;
+    chat_message_label_ = lv_obj_get_child(lv_obj_get_child(row, 0), 0);
+}
+
+void LcdDisplay::AppendChatMessage(const char* content) {
+    DisplayLockGuard lock(this);
+#if CONFIG_USE_CHAT_SCROLLBACK
+    // 遡って見ている間は履歴だけに追記する（chat_message_label_はnullptr）
+    if (chat_history_ != nullptr) {
+        chat_history_->AppendToLast(content);
+    }
+#endif
+    if (chat_message_label_ == nullptr) {
+        return;
+    }
+    lv_label_ins_text(chat_message_label_, LV_LABEL_POS_LAST, content);
+
+    // 最大幅に達した後は折り返すだけなので、幅の計算は省く
+    lv_coord_t max_width = LV_HOR_RES * 85 / 100 - 16;
+    if (lv_obj_get_style_width(chat_message_label_, 0) < max_width) {
+        const char* text = lv_label_get_text(chat_message_label_);
+        lv_coord_t text_width = lv_txt_get_width(text, strlen(text), fonts_.text_font, 0);
+        lv_obj_set_width(chat_message_label_, LV_CLAMP(20, text_width, max_width));
+    }
+
+    // 行が伸びて下にはみ出した場合に備え、行全体を表示範囲に入れる
+    lv_obj_t* row = lv_obj_get_parent(lv_obj_get_parent(chat_message_label_));
+    lv_obj_scroll_to_view(row, LV_ANIM_OFF);
 }
 #else
 void LcdDisplay::SetupUI() {
     DisplayLockGuard lock(this);
+    LvglRenderMonitor::GetInstance().Attach(display_);
+#if CONFIG_USE_TRACE_SPANS
+    AttachFlushTrace(display_);
+#endif
 
+    UpdateThemeStyles();
     auto screen = lv_screen_active();
     lv_obj_set_style_text_font(screen, fonts_.text_font, 0);
-    lv_obj_set_style_text_color(screen, current_theme_.text, 0);
-    lv_obj_set_style_bg_color(screen, current_theme_.background, 0);
+    lv_obj_add_style(screen, &styles_.background, 0);
 
     /* Container */
     container_ = lv_obj_create(screen);
@@ -615,15 +947,13 @@ void LcdDisplay::SetupUI() {
     lv_obj_set_style_pad_all(container_, 0, 0);
     lv_obj_set_style_border_width(container_, 0, 0);
     lv_obj_set_style_pad_row(container_, 0, 0);
-    lv_obj_set_style_bg_color(container_, current_theme_.background, 0);
-    lv_obj_set_style_border_color(container_, current_theme_.border, 0);
+    lv_obj_add_style(container_, &styles_.background, 0);
 
     /* Status bar */
     status_bar_ = lv_obj_create(container_);
     lv_obj_set_size(status_bar_, LV_HOR_RES, fonts_.text_font->line_height);
     lv_obj_set_style_radius(status_bar_, 0, 0);
-    lv_obj_set_style_bg_color(status_bar_, current_theme_.background, 0);
-    lv_obj_set_style_text_color(status_bar_, current_theme_.text, 0);
+    lv_obj_add_style(status_bar_, &styles_.background, 0);
     
     /* Content */
     content_ = lv_obj_create(container_);
@@ -632,16 +962,18 @@ void LcdDisplay::SetupUI() {
     lv_obj_set_width(content_, LV_HOR_RES);
     lv_obj_set_flex_grow(content_, 1);
     lv_obj_set_style_pad_all(content_, 5, 0);
-    lv_obj_set_style_bg_color(content_, current_theme_.chat_background, 0);
-    lv_obj_set_style_border_color(content_, current_theme_.border, 0); // Border color for content
+    lv_obj_add_style(content_, &styles_.content, 0);
 
     lv_obj_set_flex_flow(content_, LV_FLEX_FLOW_COLUMN); // 垂直布局（从上到下）
     lv_obj_set_flex_align(content_, LV_FLEX_ALIGN_CENTER, LV_FLEX_ALIGN_CENTER, LV_FLEX_ALIGN_SPACE_EVENLY); // 子对象居中对齐，等距分布
 
     emotion_label_ = lv_label_create(content_);
     lv_obj_set_style_text_font(emotion_label_, &font_awesome_30_4, 0);
-    lv_obj_set_style_text_color(emotion_label_, current_theme_.text, 0);
+    lv_obj_add_style(emotion_label_, &styles_.text, 0);
     lv_label_set_text(emotion_label_, FONT_AWESOME_AI_CHIP);
+#if CONFIG_USE_EMOTION_ANIMATION
+    SetupEmotionAnimation();
+#endif
 
     preview_image_ = lv_image_create(content_);
     lv_obj_set_size(preview_image_, width_ * 0.5, height_ * 0.5);
@@ -653,7 +985,7 @@ void LcdDisplay::SetupUI() {
     lv_obj_set_width(chat_message_label_, LV_HOR_RES * 0.9); // 限制宽度为屏幕宽度的 90%
     lv_label_set_long_mode(chat_message_label_, LV_LABEL_LONG_WRAP); // 设置为自动换行模式
     lv_obj_set_style_text_align(chat_message_label_, LV_TEXT_ALIGN_CENTER, 0); // 设置文本居中对齐
-    lv_obj_set_style_text_color(chat_message_label_, current_theme_.text, 0);
+    lv_obj_add_style(chat_message_label_, &styles_.text, 0);
 
     /* Status bar */
     lv_obj_set_flex_flow(status_bar_, LV_FLEX_FLOW_ROW);
@@ -666,12 +998,12 @@ void LcdDisplay::SetupUI() {
     network_label_ = lv_label_create(status_bar_);
     lv_label_set_text(network_label_, "");
     lv_obj_set_style_text_font(network_label_, fonts_.icon_font, 0);
-    lv_obj_set_style_text_color(network_label_, current_theme_.text, 0);
+    lv_obj_add_style(network_label_, &styles_.text, 0);
 
     notification_label_ = lv_label_create(status_bar_);
     lv_obj_set_flex_grow(notification_label_, 1);
     lv_obj_set_style_text_align(notification_label_, LV_TEXT_ALIGN_CENTER, 0);
-    lv_obj_set_style_text_color(notification_label_, current_theme_.text, 0);
+    lv_obj_add_style(notification_label_, &styles_.text, 0);
     lv_label_set_text(notification_label_, "");
     lv_obj_add_flag(notification_label_, LV_OBJ_FLAG_HIDDEN);
 
@@ -679,23 +1011,23 @@ void LcdDisplay::SetupUI() {
     lv_obj_set_flex_grow(status_label_, 1);
     lv_label_set_long_mode(status_label_, LV_LABEL_LONG_SCROLL_CIRCULAR);
     lv_obj_set_style_text_align(status_label_, LV_TEXT_ALIGN_CENTER, 0);
-    lv_obj_set_style_text_color(status_label_, current_theme_.text, 0);
+    lv_obj_add_style(status_label_, &styles_.text, 0);
     lv_label_set_text(status_label_, Lang::Strings::INITIALIZING);
     mute_label_ = lv_label_create(status_bar_);
     lv_label_set_text(mute_label_, "");
     lv_obj_set_style_text_font(mute_label_, fonts_.icon_font, 0);
-    lv_obj_set_style_text_color(mute_label_, current_theme_.text, 0);
+    lv_obj_add_style(mute_label_, &styles_.text, 0);
 
     battery_label_ = lv_label_create(status_bar_);
     lv_label_set_text(battery_label_, "");
     lv_obj_set_style_text_font(battery_label_, fonts_.icon_font, 0);
-    lv_obj_set_style_text_color(battery_label_, current_theme_.text, 0);
+    lv_obj_add_style(battery_label_, &styles_.text, 0);
 
     low_battery_popup_ = lv_obj_create(screen);
     lv_obj_set_scrollbar_mode(low_battery_popup_, LV_SCROLLBAR_MODE_OFF);
     lv_obj_set_size(low_battery_popup_, LV_HOR_RES * 0.9, fonts_.text_font->line_height * 2);
     lv_obj_align(low_battery_popup_, LV_ALIGN_BOTTOM_MID, 0, 0);
-    lv_obj_set_style_bg_color(low_battery_popup_, current_theme_.low_battery, 0);
+    lv_obj_add_style(low_battery_popup_, &styles_.low_battery, 0);
     lv_obj_set_style_radius(low_battery_popup_, 10, 0);
     low_battery_label_ = lv_label_create(low_battery_popup_);
     lv_label_set_text(low_battery_label_, Lang::Strings::BATTERY_NEED_CHARGE);
@@ -705,6 +1037,30 @@ void LcdDisplay::SetupUI() {
 }
 #endif
 
+#if CONFIG_USE_EMOTION_ANIMATION
+void LcdDisplay::SetupEmotionAnimation() {
+    emotion_image_ = lv_image_create(lv_obj_get_parent(emotion_label_));
+    lv_obj_move_to_index(emotion_image_, lv_obj_get_index(emotion_label_) + 1);
+    lv_obj_add_flag(emotion_image_, LV_OBJ_FLAG_HIDDEN);
+
+    emotion_animator_ = std::make_unique<EmotionAnimator>(emotion_sprites_start,
+        emotion_sprites_end - emotion_sprites_start, CONFIG_EMOTION_CACHE_SIZE_KB * 1024,
+        [this](const std::string& emotion) {
+            DisplayLockGuard lock(this);
+            // 展開中に別の表情へ変わっていれば何もしない
+            if (emotion == animated_emotion_) {
+                SetEmotion(emotion.c_str());
+            }
+        });
+}
+
+void LcdDisplay::StopEmotionAnimation() {
+    emotion_animator_->Stop();
+    animated_emotion_.clear();
+    lv_obj_add_flag(emotion_image_, LV_OBJ_FLAG_HIDDEN);
+}
+#endif
+
 void LcdDisplay::SetEmotion(const char* emotion) {
     struct Emotion {
         const char* icon;
@@ -745,6 +1101,22 @@ void LcdDisplay::SetEmotion(const char* emotion) {
         return;
     }
 
+#if CONFIG_USE_EMOTION_ANIMATION
+    StopEmotionAnimation();
+    if (emotion_animator_->Has(emotion)) {
+        animated_emotion_ = emotion;
+        if (emotion_animator_->Play(emotion_image_, emotion)) {
+            lv_obj_add_flag(emotion_label_, LV_OBJ_FLAG_HIDDEN);
+            lv_obj_clear_flag(emotion_image_, LV_OBJ_FLAG_HIDDEN);
+            if (preview_image_ != nullptr) {
+                lv_obj_add_flag(preview_image_, LV_OBJ_FLAG_HIDDEN);
+            }
+            return;
+        }
+        // 展開が終わるまでは静的な絵文字を表示し、完了の通知で再生し直す
+    }
+#endif
+
     // 如果找到匹配的表情就显示对应图标，否则显示默认的neutral表情
     lv_obj_set_style_text_font(emotion_label_, fonts_.emoji_font, 0);
     if (it != emotions.end()) {
@@ -765,6 +1137,9 @@ void LcdDisplay::SetIcon(const char* icon) {
     if (emotion_label_ == nullptr) {
         return;
     }
+#if CONFIG_USE_EMOTION_ANIMATION
+    StopEmotionAnimation();
+#endif
     lv_obj_set_style_text_font(emotion_label_, &font_awesome_30_4, 0);
     lv_label_set_text(emotion_label_, icon);
     
@@ -787,11 +1162,20 @@ void LcdDisplay::SetPreviewImage(const lv_img_dsc_t* img_dsc) {
         // 设置图片源并显示预览图片
         lv_img_set_src(preview_image_, img_dsc);
         lv_obj_clear_flag(preview_image_, LV_OBJ_FLAG_HIDDEN);
+#if CONFIG_USE_EMOTION_ANIMATION
+        StopEmotionAnimation();
+#endif
         // 隐藏emotion_label_
         if (emotion_label_ != nullptr) {
             lv_obj_add_flag(emotion_label_, LV_OBJ_FLAG_HIDDEN);
         }
     } else {
+        // 画像のメモリは呼び出し側が解放するため、キャッシュと参照を先に捨てる
+        const void* src = lv_image_get_src(preview_image_);
+        if (src != nullptr) {
+            lv_image_cache_drop(src);
+            lv_image_set_src(preview_image_, nullptr);
+        }
         // 隐藏预览图片并显示emotion_label_
         lv_obj_add_flag(preview_image_, LV_OBJ_FLAG_HIDDEN);
         if (emotion_label_ != nullptr) {
@@ -800,6 +1184,65 @@ void LcdDisplay::SetPreviewImage(const lv_img_dsc_t* img_dsc) {
     }
 }
 
+bool LcdDisplay::SupportsPreviewFrame(int width, int height) const {
+    return direct_preview_supported_ && width == width_ && height == height_;
+}
+
+bool LcdDisplay::DrawPreviewFrame(const uint8_t* data, int width, int height, int lock_timeout_ms) {
+    if (!SupportsPreviewFrame(width, height)) {
+        return false;
+    }
+
+    // LVGLのロックを持つ間は描画も転送も行われないため、パネルを独占できる
+    if (!Lock(lock_timeout_ms)) {
+        return false;
+    }
+    size_t stride = width * 2;
+    size_t strip_size = stride * CAMERA_PREVIEW_STRIP_LINES;
+    if (preview_strips_[0] == nullptr) {
+        for (auto& strip : preview_strips_) {
+            strip = (uint8_t*)heap_caps_malloc(strip_size, MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL);
+        }
+        if (preview_strips_[0] == nullptr || preview_strips_[1] == nullptr) {
+            ESP_LOGE(TAG, "Failed to allocate preview strips");
+            for (auto& strip : preview_strips_) {
+                heap_caps_free(strip);
+                strip = nullptr;
+            }
+            Unlock();
+            return false;
+        }
+    }
+    if (!direct_preview_active_) {
+        // 直接描画した内容を上書きされないよう、LVGLの再描画を止める
+        lv_display_enable_invalidation(display_, false);
+        direct_preview_active_ = true;
+    }
+
+    // PSRAMのフレームを2つのストリップへ交互にコピーし、前のストリップのDMA中に次をコピーする。
+    // draw_bitmapはウィンドウ設定のコマンド送信時に転送中の色データの完了を待つため、
+    // 次に書き込むストリップ（2つ前に送ったもの）は必ず転送済みになっている
+    for (int y = 0; y < height; y += CAMERA_PREVIEW_STRIP_LINES) {
+        int lines = std::min(CAMERA_PREVIEW_STRIP_LINES, height - y);
+        uint8_t* strip = preview_strips_[preview_strip_index_];
+        preview_strip_index_ ^= 1;
+        memcpy(strip, data + y * stride, lines * stride);
+        esp_lcd_panel_draw_bitmap(panel_, 0, y, width, y + lines, strip);
+    }
+    Unlock();
+    return true;
+}
+
+void LcdDisplay::EndPreviewFrames() {
+    DisplayLockGuard lock(this);
+    if (!direct_preview_active_) {
+        return;
+    }
+    direct_preview_active_ = false;
+    lv_display_enable_invalidation(display_, true);
+    lv_obj_invalidate(lv_screen_active());
+}
+
 void LcdDisplay::SetTheme(const std::string& theme_name) {
     DisplayLockGuard lock(this);
     
@@ -813,181 +1256,10 @@ void LcdDisplay::SetTheme(const std::string& theme_name) {
         return;
     }
     
-    // Get the active screen
-    lv_obj_t* screen = lv_screen_active();
-    
-    // Update the screen colors
-    lv_obj_set_style_bg_color(screen, current_theme_.background, 0);
-    lv_obj_set_style_text_color(screen, current_theme_.text, 0);
-    
-    // Update container colors
-    if (container_ != nullptr) {
-        lv_obj_set_style_bg_color(container_, current_theme_.background, 0);
-        lv_obj_set_style_border_color(container_, current_theme_.border, 0);
-    }
-    
-    // Update status bar colors
-    if (status_bar_ != nullptr) {
-        lv_obj_set_style_bg_color(status_bar_, current_theme_.background, 0);
-        lv_obj_set_style_text_color(status_bar_, current_theme_.text, 0);
-        
-        // Update status bar elements
-        if (network_label_ != nullptr) {
-            lv_obj_set_style_text_color(network_label_, current_theme_.text, 0);
-        }
-        if (status_label_ != nullptr) {
-            lv_obj_set_style_text_color(status_label_, current_theme_.text, 0);
-        }
-        if (notification_label_ != nullptr) {
-            lv_obj_set_style_text_color(notification_label_, current_theme_.text, 0);
-        }
-        if (mute_label_ != nullptr) {
-            lv_obj_set_style_text_color(mute_label_, current_theme_.text, 0);
-        }
-        if (battery_label_ != nullptr) {
-            lv_obj_set_style_text_color(battery_label_, current_theme_.text, 0);
-        }
-        if (emotion_label_ != nullptr) {
-            lv_obj_set_style_text_color(emotion_label_, current_theme_.text, 0);
-        }
-    }
-    
-    // Update content area colors
-    if (content_ != nullptr) {
-        lv_obj_set_style_bg_color(content_, current_theme_.chat_background, 0);
-        lv_obj_set_style_border_color(content_, current_theme_.border, 0);
-        
-        // If we have the chat message style, update all message bubbles
-#if CONFIG_USE_WECHAT_MESSAGE_STYLE
-        // Iterate through all children of content (message containers or bubbles)
-        uint32_t child_count = lv_obj_get_child_cnt(content_);
-        for (uint32_t i = 0; i < child_count; i++) {
-            lv_obj_t* obj = lv_obj_get_child(content_, i);
-            if (obj == nullptr) continue;
-            
-            lv_obj_t* bubble = nullptr;
-            
-            // 检查这个对象是容器还是气泡
-            // 如果是容器（用户或系统消息），则获取其子对象作为气泡
-            // 如果是气泡（助手消息），则直接使用
-            if (lv_obj_get_child_cnt(obj) > 0) {
-                // 可能是容器，检查它是否为用户或系统消息容器
-                // 用户和系统消息容器是透明的
-                lv_opa_t bg_opa = lv_obj_get_style_bg_opa(obj, 0);
-                if (bg_opa == LV_OPA_TRANSP) {
-                    // 这是用户或系统消息的容器
-                    bubble = lv_obj_get_child(obj, 0);
-                } else {
-                    // 这可能是助手消息的气泡自身
-                    bubble = obj;
-                }
-            } else {
-                // 没有子元素，可能是其他UI元素，跳过
-                continue;
-            }
-            
-            if (bubble == nullptr) continue;
-            
-            // 使用保存的用户数据来识别气泡类型
-            void* bubble_type_ptr = lv_obj_get_user_data(bubble);
-            if (bubble_type_ptr != nullptr) {
-                const char* bubble_type = static_cast<const char*>(bubble_type_ptr);
-                
-                // 根据气泡类型应用正确的颜色
-                if (strcmp(bubble_type, "user") == 0) {
-                    lv_obj_set_style_bg_color(bubble, current_theme_.user_bubble, 0);
-                } else if (strcmp(bubble_type, "assistant") == 0) {
-                    lv_obj_set_style_bg_color(bubble, current_theme_.assistant_bubble, 0); 
-                } else if (strcmp(bubble_type, "system") == 0) {
-                    lv_obj_set_style_bg_color(bubble, current_theme_.system_bubble, 0);
-                }
-                
-                // Update border color
-                lv_obj_set_style_border_color(bubble, current_theme_.border, 0);
-                
-                // Update text color for the message
-                if (lv_obj_get_child_cnt(bubble) > 0) {
-                    lv_obj_t* text = lv_obj_get_child(bubble, 0);
-                    if (text != nullptr) {
-                        // 根据气泡类型设置文本颜色
-                        if (strcmp(bubble_type, "system") == 0) {
-                            lv_obj_set_style_text_color(text, current_theme_.system_text, 0);
-                        } else {
-                            lv_obj_set_style_text_color(text, current_theme_.text, 0);
-                        }
-                    }
-                }
-            } else {
-                // 如果没有标记，回退到之前的逻辑（颜色比较）
-                // ...保留原有的回退逻辑...
-                lv_color_t bg_color = lv_obj_get_style_bg_color(bubble, 0);
-            
-                // 改进bubble类型检测逻辑，不仅使用颜色比较
-                bool is_user_bubble = false;
-                bool is_assistant_bubble = false;
-                bool is_system_bubble = false;
-            
-                // 检查用户bubble
-                if (lv_color_eq(bg_color, DARK_USER_BUBBLE_COLOR) || 
-                    lv_color_eq(bg_color, LIGHT_USER_BUBBLE_COLOR) ||
-                    lv_color_eq(bg_color, current_theme_.user_bubble)) {
-                    is_user_bubble = true;
-                }
-                // 检查系统bubble
-                else if (lv_color_eq(bg_color, DARK_SYSTEM_BUBBLE_COLOR) || 
-                         lv_color_eq(bg_color, LIGHT_SYSTEM_BUBBLE_COLOR) ||
-                         lv_color_eq(bg_color, current_theme_.system_bubble)) {
-                    is_system_bubble = true;
-                }
-                // 剩余的都当作助手bubble处理
-                else {
-                    is_assistant_bubble = true;
-                }
-            
-                // 根据bubble类型应用正确的颜色
-                if (is_user_bubble) {
-                    lv_obj_set_style_bg_color(bubble, current_theme_.user_bubble, 0);
-                } else if (is_assistant_bubble) {
-                    lv_obj_set_style_bg_color(bubble, current_theme_.assistant_bubble, 0);
-                } else if (is_system_bubble) {
-                    lv_obj_set_style_bg_color(bubble, current_theme_.system_bubble, 0);
-                }
-                
-                // Update border color
-                lv_obj_set_style_border_color(bubble, current_theme_.border, 0);
-                
-                // Update text color for the message
-                if (lv_obj_get_child_cnt(bubble) > 0) {
-                    lv_obj_t* text = lv_obj_get_child(bubble, 0);
-                    if (text != nullptr) {
-                        // 回退到颜色检测逻辑
-                        if (lv_color_eq(bg_color, current_theme_.system_bubble) ||
-                            lv_color_eq(bg_color, DARK_SYSTEM_BUBBLE_COLOR) || 
-                            lv_color_eq(bg_color, LIGHT_SYSTEM_BUBBLE_COLOR)) {
-                            lv_obj_set_style_text_color(text, current_theme_.system_text, 0);
-                        } else {
-                            lv_obj_set_style_text_color(text, current_theme_.text, 0);
-                        }
-                    }
-                }
-            }
-        }
-#else
-        // Simple UI mode - just update the main chat message
-        if (chat_message_label_ != nullptr) {
-            lv_obj_set_style_text_color(chat_message_label_, current_theme_.text, 0);
-        }
-        
-        if (emotion_label_ != nullptr) {
-            lv_obj_set_style_text_color(emotion_label_, current_theme_.text, 0);
-        }
-#endif
-    }
-    
-    // Update low battery popup
-    if (low_battery_popup_ != nullptr) {
-        lv_obj_set_style_bg_color(low_battery_popup_, current_theme_.low_battery, 0);
-    }
+    // 各オブジェクトは共有スタイルを参照しているため、スタイルの色を書き換えて
+    // 1回通知すれば画面全体に反映される
+    UpdateThemeStyles();
+    lv_obj_report_style_change(nullptr);
 
     // No errors occurred. Save theme to settings
     Display::SetTheme(theme_name);
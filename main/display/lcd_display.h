@@ -10,12 +10,26 @@
 #define LCD_DISPLAY_H
 
 #include "display.h"
+#include "glyph_cache.h"
+#if CONFIG_USE_CHAT_SCROLLBACK
+#include "chat_history.h"
+#endif
+#if CONFIG_USE_EMOTION_ANIMATION
+#include "emotion_animation.h"
+#endif
 
 #include <esp_lcd_panel_io.h>
 #include <esp_lcd_panel_ops.h>
 #include <font_emoji.h>
+#if CONFIG_LCD_MIPI_DIRECT_FRAMEBUFFER
+#include <driver/ppa.h>
+#endif
 
 #include <atomic>
+#include <memory>
+
+/** @brief カメラプレビューを直接描画する際の1回の転送行数（内部RAMに2本確保） */
+#define CAMERA_PREVIEW_STRIP_LINES 20
 
 /**
  * @struct ThemeColors
@@ -35,6 +49,25 @@ struct ThemeColors {
     lv_color_t low_battery;     /**< バッテリー低下警告色 */
 };
 
+/**
+ * @struct ThemeStyles
+ * @brief テーマの役割ごとの共有スタイル
+ *
+ * 各オブジェクトはローカルスタイルで色を持たず、これらのスタイルを参照します。
+ * テーマの切り替えはスタイルの色を書き換えて1回通知するだけで済み、
+ * チャット履歴の長さに比例した処理やオブジェクトごとのローカルスタイルのメモリも不要になります。
+ */
+struct ThemeStyles {
+    lv_style_t background;      /**< 画面・コンテナ・ステータスバー（背景、文字、枠線） */
+    lv_style_t content;         /**< チャット領域（背景、枠線） */
+    lv_style_t text;            /**< 通常のテキスト */
+    lv_style_t system_text;     /**< システムメッセージのテキスト */
+    lv_style_t user_bubble;     /**< ユーザーの気泡（背景、枠線） */
+    lv_style_t assistant_bubble; /**< アシスタントの気泡（背景、枠線） */
+    lv_style_t system_bubble;   /**< システムの気泡（背景、枠線） */
+    lv_style_t low_battery;     /**< バッテリー低下の警告 */
+};
+
 
 /**
  * @class LcdDisplay
@@ -58,12 +91,69 @@ protected:
     lv_obj_t* side_bar_ = nullptr;                  /**< サイドバーオブジェクト */
     lv_obj_t* preview_image_ = nullptr;             /**< プレビュー画像オブジェクト */
 
+    // カメラプレビューの直接描画
+    bool direct_preview_supported_ = false;         /**< パネルがカメラと同じバイト順で、オフセットもない */
+    bool direct_preview_active_ = false;            /**< 直接描画中（LVGLの無効化領域登録を停止中） */
+    uint8_t* preview_strips_[2] = {nullptr, nullptr};  /**< 内部RAMのDMA転送用ストリップ */
+    int preview_strip_index_ = 0;                   /**< 次に書き込むストリップ */
+
     // フォントとテーマ
     DisplayFonts fonts_;                            /**< 使用するフォント群 */
+    std::unique_ptr<GlyphCacheFont> text_font_cache_;  /**< テキストフォントのグリフキャッシュ */
     ThemeColors current_theme_;                     /**< 現在のテーマ色 */
+    ThemeStyles styles_;                            /**< 現在のテーマ色を反映した共有スタイル */
+
+    /** @brief current_theme_の色を共有スタイルに反映 */
+    void UpdateThemeStyles();
+
+#if CONFIG_USE_EMOTION_ANIMATION
+    // 表情のアニメーション
+    lv_obj_t* emotion_image_ = nullptr;             /**< アニメーションのフレームを表示する画像 */
+    std::unique_ptr<EmotionAnimator> emotion_animator_;
+    std::string animated_emotion_;                  /**< 再生中、または展開を待っている表情 */
+
+    /** @brief emotion_label_の隣に画像を作り、スプライトのパックを読み込む（SetupUIから呼ぶ） */
+    void SetupEmotionAnimation();
+
+    /** @brief アニメーションを止めて画像を隠す（ロック中に呼ぶ） */
+    void StopEmotionAnimation();
+#endif
 
     /** UIレイアウトを設定 */
     void SetupUI();
+
+#if CONFIG_USE_WECHAT_MESSAGE_STYLE
+    /**
+     * @brief 次のメッセージに使う行コンテナを取得
+     *
+     * MAX_MESSAGES 件までは新規作成し、以降は最も古い行を末尾へ移して再利用します。
+     * 会話が長くなっても1メッセージあたりのコストは一定です。
+     */
+    lv_obj_t* AcquireChatRow();
+
+    /** @brief 行に役割と本文を設定する（幅・スタイル・寄せ方） */
+    void BindChatRow(lv_obj_t* row, const char* role, const char* content);
+
+#if CONFIG_USE_CHAT_SCROLLBACK
+    // スクロールバック: 行（気泡）は画面の数ページ分だけを使い回し、それより前は履歴から割り当て直す
+    std::unique_ptr<ChatHistory> chat_history_;     /**< 表示した全メッセージ（PSRAM） */
+    uint32_t chat_window_first_ = 0;                /**< content_の先頭の行に割り当てた履歴の番号 */
+    bool chat_paging_ = false;                      /**< 割り当て直しによるスクロールで再び呼ばれないようにする */
+
+    /** @brief 最新のメッセージが最後の行に表示されているか */
+    bool ShowsLatestChatMessage() const;
+
+    /** @brief 行を最新のメッセージへ割り当て直して最後までスクロールする */
+    void ShowLatestChatMessages();
+
+    /**
+     * @brief スクロールが止まった位置が端に近ければ、反対側の行を移して前後のメッセージを割り当てる
+     *
+     * 見ていた行の画面上の位置が変わらないようにスクロール量を補正します。
+     */
+    void OnChatScrollEnd();
+#endif
+#endif
     
     /** LVGLミューテックスをロック */
     virtual bool Lock(int timeout_ms = 0) override;
@@ -71,6 +161,11 @@ protected:
     /** LVGLミューテックスをアンロック */
     virtual void Unlock() override;
 
+#if CONFIG_USE_WECHAT_MESSAGE_STYLE
+    /** メッセージごとに気泡を積み上げるため、まとめる際も全メッセージを反映する */
+    virtual bool KeepsChatHistory() const override { return true; }
+#endif
+
 protected:
     /**
      * @brief LCDディスプレイ基底コンストラクタ（サブクラス用）
@@ -93,10 +188,20 @@ public:
     
     /** プレビュー画像を設定 */
     virtual void SetPreviewImage(const lv_img_dsc_t* img_dsc) override;
+
+    /** パネルと同じサイズのフレームを内部RAMのストリップ経由で直接転送 */
+    virtual bool DrawPreviewFrame(const uint8_t* data, int width, int height, int lock_timeout_ms = 30000) override;
+    virtual bool SupportsPreviewFrame(int width, int height) const override;
+
+    /** 直接描画を終えてLVGLの画面を描き直す */
+    virtual void EndPreviewFrames() override;
     
 #if CONFIG_USE_WECHAT_MESSAGE_STYLE
     /** チャットメッセージを表示（WeChatスタイル） */
     virtual void SetChatMessage(const char* role, const char* content) override; 
+
+    /** 最新の気泡へ追記し、最大幅までは気泡を文字列に合わせて広げる */
+    virtual void AppendChatMessage(const char* content) override;
 #endif  
 
     /** テーマ（ライト/ダーク）を切り替え */
@@ -122,6 +227,9 @@ public:
  * @brief MIPI DSIインターフェースLCDディスプレイ
  * 
  * MIPI DSIインターフェースで接続される高解像LCDディスプレイを制御します。
+ * CONFIG_LCD_MIPI_DIRECT_FRAMEBUFFER が有効なら、LVGLはパネルのDPIフレームバッファ（2枚）へ
+ * 変化した領域だけを直接描画し（direct mode）、垂直同期で切り替えます。カメラプレビューは
+ * PPAで回転・拡大縮小して表示されていない方のフレームバッファへ書き込みます。
  */
 class MipiLcdDisplay : public LcdDisplay {
 public:
@@ -129,6 +237,27 @@ public:
                    int width, int height, int offset_x, int offset_y,
                    bool mirror_x, bool mirror_y, bool swap_xy,
                    DisplayFonts fonts);
+
+#if CONFIG_LCD_MIPI_DIRECT_FRAMEBUFFER
+    ~MipiLcdDisplay();
+
+    /** PPAで画面に収まるよう回転・拡大縮小し、余白を塗りつぶして表示 */
+    virtual bool DrawPreviewFrame(const uint8_t* data, int width, int height, int lock_timeout_ms = 30000) override;
+    virtual bool SupportsPreviewFrame(int width, int height) const override;
+
+private:
+    ppa_client_handle_t ppa_srm_ = nullptr;         /**< 回転・拡大縮小 */
+    ppa_client_handle_t ppa_fill_ = nullptr;        /**< 余白の塗りつぶし */
+    void* frame_buffers_[2] = {nullptr, nullptr};   /**< パネルのDPIフレームバッファ */
+    int preview_fb_index_ = 0;                      /**< 次にプレビューを書き込むフレームバッファ */
+    uint8_t preview_cleared_ = 0;                   /**< 余白を塗りつぶし済みのフレームバッファ（ビット） */
+
+    /**
+     * @brief フレームを画面に収める回転と倍率を求める
+     * @return PPAの倍率の範囲（1/16～16）に収まらなければfalse
+     */
+    bool FitPreview(int width, int height, bool& rotate, float& scale) const;
+#endif
 };
 
 /**
@@ -0,0 +1,145 @@
+/**
+ * @file lvgl_port_config.cc
+ * @brief LVGLタスクの配置と描画時間の計測の実装
+ */
+#include "lvgl_port_config.h"
+#include "boot_profile.h"
+#include "task_factory.h"
+#if CONFIG_USE_METRICS
+#include "metrics.h"
+#endif
+
+#include <algorithm>
+#include <cJSON.h>
+#include <esp_heap_caps.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#define TAG "LvglPort"
+
+#if CONFIG_USE_METRICS
+static const uint32_t kLvglRenderBoundsUs[] = {1000, 2000, 5000, 10000, 20000, 50000, 100000, 200000};
+static MetricHistogram metric_lvgl_render("xiaozhi_lvgl_render_duration_us", "Time spent in one LVGL refresh that flushed",
+    kLvglRenderBoundsUs, sizeof(kLvglRenderBoundsUs) / sizeof(kLvglRenderBoundsUs[0]));
+#endif
+
+/** @brief Kconfigから決まるLVGLタスクのコア */
+static int GetDefaultLvglTaskCore() {
+#if CONFIG_FREERTOS_UNICORE
+    return -1;
+#elif CONFIG_LVGL_TASK_CORE >= -1
+    return CONFIG_LVGL_TASK_CORE;
+#elif CONFIG_AUDIO_CAPTURE_TASK_CORE >= 0
+    // audio_loopと反対側のコア
+    return 1 - CONFIG_AUDIO_CAPTURE_TASK_CORE;
+#elif CONFIG_USE_AUDIO_PROCESSOR
+    // AFEのタスクはコア1を優先する
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+int GetLvglTaskCore() {
+    // esp_lvgl_portが作成する "taskLVGL" も配置表の上書きに従う
+    return GetTaskCore("taskLVGL", GetDefaultLvglTaskCore());
+}
+
+lvgl_port_cfg_t GetLvglPortConfig() {
+    lvgl_port_cfg_t port_cfg = ESP_LVGL_PORT_INIT_CONFIG();
+    port_cfg.task_priority = CONFIG_LVGL_TASK_PRIORITY;
+    port_cfg.task_stack = CONFIG_LVGL_TASK_STACK_SIZE;
+    port_cfg.task_affinity = GetLvglTaskCore();
+    port_cfg.timer_period_ms = CONFIG_LVGL_TIMER_PERIOD_MS;
+#if CONFIG_LVGL_TASK_STACK_IN_PSRAM
+    port_cfg.task_stack_caps = MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT;
+    const char* stack_location = "PSRAM";
+#else
+    const char* stack_location = "internal";
+#endif
+    ESP_LOGI(TAG, "LVGL task: core %d, priority %d, stack %d (%s), tick %d ms", port_cfg.task_affinity,
+        port_cfg.task_priority, port_cfg.task_stack, stack_location, port_cfg.timer_period_ms);
+    return port_cfg;
+}
+
+/** @brief Kconfigで決まる描画周期（ミリ秒） */
+static int GetDefaultRefreshPeriod() {
+    return CONFIG_LVGL_REFRESH_PERIOD_MS > 0 ? CONFIG_LVGL_REFRESH_PERIOD_MS : LV_DEF_REFR_PERIOD;
+}
+
+void LvglRenderMonitor::Attach(lv_display_t* display) {
+    display_ = display;
+#if CONFIG_LVGL_REFRESH_PERIOD_MS > 0
+    lv_timer_set_period(lv_display_get_refr_timer(display), CONFIG_LVGL_REFRESH_PERIOD_MS);
+#endif
+    lv_display_add_event_cb(display, [](lv_event_t* e) {
+        LvglRenderMonitor::GetInstance().OnEvent(e);
+    }, LV_EVENT_ALL, nullptr);
+}
+
+void LvglRenderMonitor::SetRefreshPeriod(LvglRefreshLimit source, int period_ms) {
+    if (display_ == nullptr) {
+        return;
+    }
+    lvgl_port_lock(0);
+    refresh_limits_[source] = period_ms;
+    period_ms = GetDefaultRefreshPeriod();
+    for (int limit : refresh_limits_) {
+        period_ms = std::max(period_ms, limit);
+    }
+    lv_timer_set_period(lv_display_get_refr_timer(display_), period_ms);
+    lvgl_port_unlock();
+    ESP_LOGI(TAG, "Refresh period %d ms", period_ms);
+}
+
+void LvglRenderMonitor::OnEvent(lv_event_t* e) {
+    switch (lv_event_get_code(e)) {
+    case LV_EVENT_REFR_START:
+        flushed_ = false;
+        render_start_us_.store(esp_timer_get_time(), std::memory_order_relaxed);
+        break;
+    case LV_EVENT_FLUSH_START:
+        flushed_ = true;
+        break;
+    case LV_EVENT_REFR_READY: {
+        int64_t start = render_start_us_.load(std::memory_order_relaxed);
+        if (start == 0) {
+            break;
+        }
+        int64_t now = esp_timer_get_time();
+        render_start_us_.store(0, std::memory_order_relaxed);
+        // 無効領域がなく何も送らなかったリフレッシュは数えない
+        if (!flushed_) {
+            break;
+        }
+        render_end_us_.store(now, std::memory_order_relaxed);
+        BootProfile::GetInstance().Mark(kBootFirstFrame);
+        uint32_t elapsed = now - start;
+        render_count_.fetch_add(1, std::memory_order_relaxed);
+        render_total_us_.fetch_add(elapsed, std::memory_order_relaxed);
+        if (elapsed > render_max_us_.load(std::memory_order_relaxed)) {
+            render_max_us_.store(elapsed, std::memory_order_relaxed);
+        }
+#if CONFIG_USE_METRICS
+        metric_lvgl_render.Observe(elapsed);
+#endif
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+void LvglRenderMonitor::AddToJson(cJSON* root) {
+    uint32_t count = render_count_.load(std::memory_order_relaxed);
+    cJSON* lvgl = cJSON_CreateObject();
+    cJSON_AddNumberToObject(lvgl, "core", GetLvglTaskCore());
+    cJSON_AddNumberToObject(lvgl, "priority", CONFIG_LVGL_TASK_PRIORITY);
+    cJSON_AddNumberToObject(lvgl, "tick_ms", CONFIG_LVGL_TIMER_PERIOD_MS);
+    cJSON_AddNumberToObject(lvgl, "renders", count);
+    cJSON_AddNumberToObject(lvgl, "render_avg_us", count > 0 ? render_total_us_.load(std::memory_order_relaxed) / count : 0);
+    cJSON_AddNumberToObject(lvgl, "render_max_us", render_max_us_.load(std::memory_order_relaxed));
+    // 描画と同じコアでaudio_loopが待たされていれば増える（配置が適切なら0に近い）
+    cJSON_AddNumberToObject(lvgl, "audio_stalls_during_render", stalls_during_render_.load(std::memory_order_relaxed));
+    cJSON_AddItemToObject(root, "lvgl", lvgl);
+}
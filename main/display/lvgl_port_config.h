@@ -0,0 +1,94 @@
+/**
+ * @file lvgl_port_config.h
+ * @brief LVGLタスクの配置（コア・優先度・スタック・周期）と描画時間の計測
+ *
+ * LVGLの描画がaudio_loop（優先度8）やAFEのタスクと同じコアで競合しないよう、
+ * LVGLタスクの設定をKconfigで選べるようにします（ボードのconfig.jsonのsdkconfig_appendで上書き可能）。
+ * コアの既定値は音声パイプラインと反対側のコアです。
+ * 配置の妥当性は描画時間と、描画中に起きたaudio_loopの停滞の数で確認します
+ * （self.get_perf_stats の "lvgl" と "audio_loop"）。
+ */
+#ifndef LVGL_PORT_CONFIG_H
+#define LVGL_PORT_CONFIG_H
+
+#include <esp_lvgl_port.h>
+
+#include <atomic>
+#include <cstdint>
+
+struct cJSON;
+
+/** @brief Kconfigの設定を反映したlvgl_port_init()用の設定 */
+lvgl_port_cfg_t GetLvglPortConfig();
+
+/** @brief LVGLタスクを固定するコア（-1は固定しない） */
+int GetLvglTaskCore();
+
+/** @brief 描画周期を延ばすよう求める側（周期は全体で最も長いものを使う） */
+enum LvglRefreshLimit {
+    kLvglRefreshLimitPower,     // PowerGovernorの電力段階
+    kLvglRefreshLimitThermal,   // ThermalMonitorの温度段階
+    kLvglRefreshLimitCount,
+};
+
+/**
+ * @class LvglRenderMonitor
+ * @brief LVGLの1回の描画（リフレッシュ）にかかった時間を記録するシングルトン
+ *
+ * 書き込みはLVGLタスクのみ、読み出しは任意のタスクから行います。
+ */
+class LvglRenderMonitor {
+public:
+    static LvglRenderMonitor& GetInstance() {
+        static LvglRenderMonitor instance;
+        return instance;
+    }
+
+    LvglRenderMonitor(const LvglRenderMonitor&) = delete;
+    LvglRenderMonitor& operator=(const LvglRenderMonitor&) = delete;
+
+    /**
+     * @brief 描画の計測を開始し、描画周期を設定（LVGLのロックを持って呼ぶ）
+     * @param display lvgl_port_add_disp()で追加したディスプレイ
+     */
+    void Attach(lv_display_t* display);
+
+    /**
+     * @brief 描画周期を変更（LVGLのロックを取るため、LVGLタスク以外から呼ぶ）
+     * @param source 求める側。各側の求める周期のうち最も長いものを使う
+     * @param period_ms 描画周期（ミリ秒）。0ならKconfigの既定値。既定値より短くはしない
+     */
+    void SetRefreshPeriod(LvglRefreshLimit source, int period_ms);
+
+    /** @brief start_us以降にLVGLが描画していたか（描画中を含む） */
+    bool RenderedSince(int64_t start_us) const {
+        return render_start_us_.load(std::memory_order_relaxed) != 0 ||
+            render_end_us_.load(std::memory_order_relaxed) > start_us;
+    }
+
+    /** @brief audio_loopの停滞が描画と重なった（AudioStallWatchdogから呼ぶ） */
+    void OnAudioStallDuringRender() { stalls_during_render_.fetch_add(1, std::memory_order_relaxed); }
+
+    /** @brief タスクの配置と描画時間をJSONに追加（PerfMonitor用） */
+    void AddToJson(cJSON* root);
+
+private:
+    LvglRenderMonitor() = default;
+
+    void OnEvent(lv_event_t* e);
+
+    // LVGLタスク専用
+    bool flushed_ = false;                  /**< 今回のリフレッシュで送信があった */
+
+    lv_display_t* display_ = nullptr;       /**< Attach()したディスプレイ */
+    int refresh_limits_[kLvglRefreshLimitCount] = {};  /**< 各側の求める描画周期（LVGLのロックで保護） */
+
+    std::atomic<int64_t> render_start_us_{0};   /**< 描画中なら開始時刻、それ以外は0 */
+    std::atomic<int64_t> render_end_us_{0};
+    std::atomic<uint32_t> render_count_{0};
+    std::atomic<uint64_t> render_total_us_{0};
+    std::atomic<uint32_t> render_max_us_{0};
+    std::atomic<uint32_t> stalls_during_render_{0};
+};
+
+#endif // LVGL_PORT_CONFIG_H
@@ -0,0 +1,174 @@
+/**
+ * @file oled_diff_panel.cc
+ * @brief OLEDパネルの差分転送の実装
+ */
+#include "oled_diff_panel.h"
+#if CONFIG_USE_METRICS
+#include "metrics.h"
+#endif
+
+#include <esp_lcd_panel_interface.h>
+#include <esp_check.h>
+#include <esp_log.h>
+
+#include <cstdlib>
+#include <cstring>
+
+#define TAG "OledDiffPanel"
+
+#if CONFIG_USE_METRICS
+static MetricCounter metric_oled_sent("xiaozhi_oled_bytes_sent", "Pixel bytes sent to the OLED panel");
+static MetricCounter metric_oled_skipped("xiaozhi_oled_bytes_skipped", "Pixel bytes not sent because the panel already showed them");
+#endif
+
+/** @brief 差分転送するパネル（baseは先頭に置き、esp_lcd_panel_t*から戻せるようにする） */
+struct OledDiffPanel {
+    esp_lcd_panel_t base;
+    esp_lcd_panel_handle_t panel;   /**< 元のパネル */
+    int width;
+    int pages;
+    uint8_t* shadow;                /**< パネルのGDDRAMの写し（width × pages バイト） */
+    uint8_t* page_valid;            /**< ページごとに写しがパネルと一致しているか（pages バイト） */
+};
+
+/** @brief 全ページの写しを無効にし、次の描画は全て送る */
+static void InvalidateShadow(OledDiffPanel* diff) {
+    memset(diff->page_valid, 0, diff->pages);
+}
+
+static OledDiffPanel* GetDiffPanel(esp_lcd_panel_t* panel) {
+    return (OledDiffPanel*)panel;
+}
+
+static esp_err_t DiffPanelDel(esp_lcd_panel_t* panel) {
+    auto diff = GetDiffPanel(panel);
+    free(diff->shadow);
+    free(diff);
+    return ESP_OK;
+}
+
+static esp_err_t DiffPanelReset(esp_lcd_panel_t* panel) {
+    auto diff = GetDiffPanel(panel);
+    InvalidateShadow(diff);
+    return esp_lcd_panel_reset(diff->panel);
+}
+
+static esp_err_t DiffPanelInit(esp_lcd_panel_t* panel) {
+    auto diff = GetDiffPanel(panel);
+    InvalidateShadow(diff);
+    return esp_lcd_panel_init(diff->panel);
+}
+
+static esp_err_t DiffPanelDrawBitmap(esp_lcd_panel_t* panel, int x_start, int y_start, int x_end, int y_end,
+    const void* color_data) {
+    auto diff = GetDiffPanel(panel);
+    if (x_start < 0 || x_end > diff->width || y_start < 0 || y_end > diff->pages * 8 ||
+        x_start >= x_end || (y_start % 8) != 0 || (y_end % 8) != 0) {
+        // ページ境界に揃っていない描画は比較できないので、そのまま送って写しを捨てる
+        InvalidateShadow(diff);
+        return esp_lcd_panel_draw_bitmap(diff->panel, x_start, y_start, x_end, y_end, color_data);
+    }
+
+    int span = x_end - x_start;
+    auto data = (const uint8_t*)color_data;
+    for (int page = y_start / 8; page < y_end / 8; page++) {
+        const uint8_t* row = data + (page - y_start / 8) * span;
+        uint8_t* shadow = diff->shadow + page * diff->width + x_start;
+        int first = 0;
+        int last = span - 1;
+        if (diff->page_valid[page]) {
+            while (first < span && row[first] == shadow[first]) {
+                first++;
+            }
+            if (first == span) {
+#if CONFIG_USE_METRICS
+                metric_oled_skipped.Increment(span);
+#endif
+                continue;
+            }
+            while (row[last] == shadow[last]) {
+                last--;
+            }
+        }
+        // 1ページ分は連続しているので、変化した列の範囲をそのまま元のパネルへ渡せる
+        esp_err_t ret = esp_lcd_panel_draw_bitmap(diff->panel, x_start + first, page * 8, x_start + last + 1,
+            page * 8 + 8, row + first);
+        if (ret != ESP_OK) {
+            diff->page_valid[page] = 0;
+            return ret;
+        }
+        memcpy(shadow + first, row + first, last - first + 1);
+        // ページの幅全体を送ったら、以後はそのページを写しと比較できる
+        if (span == diff->width) {
+            diff->page_valid[page] = 1;
+        }
+#if CONFIG_USE_METRICS
+        metric_oled_sent.Increment(last - first + 1);
+        metric_oled_skipped.Increment(span - (last - first + 1));
+#endif
+    }
+    return ESP_OK;
+}
+
+static esp_err_t DiffPanelMirror(esp_lcd_panel_t* panel, bool mirror_x, bool mirror_y) {
+    auto diff = GetDiffPanel(panel);
+    // 表示中の画素の配置が変わるので、次は全て送り直す
+    InvalidateShadow(diff);
+    return esp_lcd_panel_mirror(diff->panel, mirror_x, mirror_y);
+}
+
+static esp_err_t DiffPanelSwapXy(esp_lcd_panel_t* panel, bool swap_axes) {
+    auto diff = GetDiffPanel(panel);
+    InvalidateShadow(diff);
+    return esp_lcd_panel_swap_xy(diff->panel, swap_axes);
+}
+
+static esp_err_t DiffPanelSetGap(esp_lcd_panel_t* panel, int x_gap, int y_gap) {
+    auto diff = GetDiffPanel(panel);
+    InvalidateShadow(diff);
+    return esp_lcd_panel_set_gap(diff->panel, x_gap, y_gap);
+}
+
+static esp_err_t DiffPanelInvertColor(esp_lcd_panel_t* panel, bool invert_color_data) {
+    return esp_lcd_panel_invert_color(GetDiffPanel(panel)->panel, invert_color_data);
+}
+
+static esp_err_t DiffPanelDispOnOff(esp_lcd_panel_t* panel, bool on_off) {
+    return esp_lcd_panel_disp_on_off(GetDiffPanel(panel)->panel, on_off);
+}
+
+static esp_err_t DiffPanelDispSleep(esp_lcd_panel_t* panel, bool sleep) {
+    return esp_lcd_panel_disp_sleep(GetDiffPanel(panel)->panel, sleep);
+}
+
+esp_err_t NewOledDiffPanel(esp_lcd_panel_handle_t panel, int width, int height, esp_lcd_panel_handle_t* ret_panel) {
+    ESP_RETURN_ON_FALSE(panel != nullptr && ret_panel != nullptr && width > 0 && height > 0 && height % 8 == 0,
+        ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+    auto diff = (OledDiffPanel*)calloc(1, sizeof(OledDiffPanel));
+    ESP_RETURN_ON_FALSE(diff != nullptr, ESP_ERR_NO_MEM, TAG, "no mem for diff panel");
+    // 写しとページごとの有効フラグを1つの領域に置く（calloc済みなので全ページ無効から始まる）
+    diff->shadow = (uint8_t*)calloc(width * height / 8 + height / 8, 1);
+    if (diff->shadow == nullptr) {
+        free(diff);
+        ESP_LOGE(TAG, "no mem for shadow framebuffer");
+        return ESP_ERR_NO_MEM;
+    }
+    diff->panel = panel;
+    diff->width = width;
+    diff->pages = height / 8;
+    diff->page_valid = diff->shadow + width * diff->pages;
+
+    diff->base.del = DiffPanelDel;
+    diff->base.reset = DiffPanelReset;
+    diff->base.init = DiffPanelInit;
+    diff->base.draw_bitmap = DiffPanelDrawBitmap;
+    diff->base.mirror = DiffPanelMirror;
+    diff->base.swap_xy = DiffPanelSwapXy;
+    diff->base.set_gap = DiffPanelSetGap;
+    diff->base.invert_color = DiffPanelInvertColor;
+    diff->base.disp_on_off = DiffPanelDispOnOff;
+    diff->base.disp_sleep = DiffPanelDispSleep;
+    *ret_panel = &diff->base;
+    ESP_LOGI(TAG, "Page diffing enabled for %dx%d OLED (%d bytes shadow)", width, height, width * height / 8);
+    return ESP_OK;
+}
@@ -0,0 +1,25 @@
+/**
+ * @file oled_diff_panel.h
+ * @brief OLEDパネルへの転送を変化したページと列だけに絞るラッパー
+ *
+ * SSD1306/SH1106のGDDRAMは8行を1バイトにまとめた「ページ」単位で、draw_bitmapには
+ * ページごとに(x_end - x_start)バイトを並べたデータが渡されます。このラッパーは
+ * パネルに送った内容の写し（シャドウ）を持ち、ページごとに前回と異なる列の範囲だけを
+ * 元のパネルへ送ります。ステータスバーと1行のチャットだけが変わる画面では、
+ * I2Cバス（音声コーデックと共有するボードがある）の転送がほとんどなくなります。
+ */
+#ifndef OLED_DIFF_PANEL_H
+#define OLED_DIFF_PANEL_H
+
+#include <esp_lcd_panel_ops.h>
+
+/**
+ * @brief 差分転送するパネルを作成
+ * @param panel 元のパネル（esp_lcd_new_panel_ssd1306()など）。所有権は移らない
+ * @param width パネルの幅
+ * @param height パネルの高さ（8の倍数）
+ * @param[out] ret_panel 作成したパネル。esp_lcd_panel_del()で解放する（元のパネルは削除しない）
+ */
+esp_err_t NewOledDiffPanel(esp_lcd_panel_handle_t panel, int width, int height, esp_lcd_panel_handle_t* ret_panel);
+
+#endif // OLED_DIFF_PANEL_H
@@ -1,4 +1,8 @@
 #include "oled_display.h"
+#include "lvgl_port_config.h"
+#if CONFIG_OLED_PAGE_DIFF
+#include "oled_diff_panel.h"
+#endif
 #include "font_awesome_symbols.h"
 #include "assets/lang_config.h"
 
@@ -20,15 +24,21 @@ OledDisplay::OledDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_handl
     height_ = height;
 
     ESP_LOGI(TAG, "Initialize LVGL");
-    lvgl_port_cfg_t port_cfg = ESP_LVGL_PORT_INIT_CONFIG();
-    port_cfg.task_priority = 1;
-    port_cfg.timer_period_ms = 50;
+    lvgl_port_cfg_t port_cfg = GetLvglPortConfig();
     lvgl_port_init(&port_cfg);
 
+    // LVGLには差分転送のパネルを渡し、変化したページと列だけをバスへ送る
+    esp_lcd_panel_handle_t lvgl_panel = panel_;
+#if CONFIG_OLED_PAGE_DIFF
+    if (NewOledDiffPanel(panel_, width_, height_, &diff_panel_) == ESP_OK) {
+        lvgl_panel = diff_panel_;
+    }
+#endif
+
     ESP_LOGI(TAG, "Adding LCD screen");
     const lvgl_port_display_cfg_t display_cfg = {
         .io_handle = panel_io_,
-        .panel_handle = panel_,
+        .panel_handle = lvgl_panel,
         .control_handle = nullptr,
         .buffer_size = static_cast<uint32_t>(width_ * height_),
         .double_buffer = false,
@@ -55,6 +65,10 @@ OledDisplay::OledDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_handl
         ESP_LOGE(TAG, "Failed to add display");
         return;
     }
+    {
+        DisplayLockGuard lock(this);
+        LvglRenderMonitor::GetInstance().Attach(display_);
+    }
 
     if (height_ == 64) {
         SetupUI_128x64();
@@ -77,6 +91,9 @@ OledDisplay::~OledDisplay() {
         lv_obj_del(container_);
     }
 
+    if (diff_panel_ != nullptr) {
+        esp_lcd_panel_del(diff_panel_);
+    }
     if (panel_ != nullptr) {
         esp_lcd_panel_del(panel_);
     }
@@ -27,6 +27,7 @@ private:
     // ESP-IDF LCDパネルインターフェース
     esp_lcd_panel_io_handle_t panel_io_ = nullptr;  /**< OLEDパネルIOハンドル（I2C） */
     esp_lcd_panel_handle_t panel_ = nullptr;        /**< OLEDパネルハンドル */
+    esp_lcd_panel_handle_t diff_panel_ = nullptr;   /**< 差分転送のパネル（CONFIG_OLED_PAGE_DIFF、LVGLが描画する） */
 
     // LVGL UI要素
     lv_obj_t* status_bar_ = nullptr;                /**< ステータスバーオブジェクト */
@@ -0,0 +1,109 @@
+#include "touch_gestures.h"
+
+#include <esp_log.h>
+#include <esp_lvgl_port.h>
+
+#include <cstdlib>
+
+#define TAG "TouchGestures"
+
+void TouchGestures::Attach(lv_indev_t* indev, gpio_num_t int_gpio) {
+    if (indev == nullptr) {
+        ESP_LOGE(TAG, "No touch input device");
+        return;
+    }
+    int_gpio_ = int_gpio;
+    // esp_lvgl_portはdriver_dataを使うため、user_dataに自身を保存する
+    lvgl_port_lock(0);
+    read_cb_ = lv_indev_get_read_cb(indev);
+    lv_indev_set_user_data(indev, this);
+    lv_indev_set_read_cb(indev, ReadCallback);
+    lvgl_port_unlock();
+    ESP_LOGI(TAG, "Gestures attached (INT gpio %d)", (int)int_gpio);
+}
+
+void TouchGestures::ReadCallback(lv_indev_t* indev, lv_indev_data_t* data) {
+    auto self = (TouchGestures*)lv_indev_get_user_data(indev);
+    // 離している間はINTがHighのまま。コントローラを読まずに前回の座標で「離した」を返す
+    if (!self->pressed_ && self->int_gpio_ != GPIO_NUM_NC && gpio_get_level(self->int_gpio_) == 1) {
+        data->point = self->last_point_;
+        data->state = LV_INDEV_STATE_RELEASED;
+        return;
+    }
+
+    self->read_cb_(indev, data);
+    bool pressed = data->state == LV_INDEV_STATE_PRESSED;
+    if (pressed) {
+        self->last_point_ = data->point;
+    }
+    self->Feed(pressed, data->point.x, data->point.y, lv_tick_get());
+}
+
+void TouchGestures::Feed(bool pressed, int32_t x, int32_t y, uint32_t now_ms) {
+    if (pressed && !pressed_) {
+        pressed_ = true;
+        long_pressed_ = false;
+        start_x_ = last_x_ = x;
+        start_y_ = last_y_ = y;
+        press_time_ = now_ms;
+        return;
+    }
+    if (!pressed) {
+        if (pressed_) {
+            pressed_ = false;
+            OnRelease(now_ms);
+        }
+        return;
+    }
+
+    last_x_ = x;
+    last_y_ = y;
+    if (!long_pressed_ && now_ms - press_time_ >= TOUCH_GESTURE_LONG_PRESS_MS &&
+        std::abs(x - start_x_) <= TOUCH_GESTURE_MOVE_TOLERANCE &&
+        std::abs(y - start_y_) <= TOUCH_GESTURE_MOVE_TOLERANCE) {
+        long_pressed_ = true;
+        callback_(kTouchGestureLongPress, x, y);
+    }
+}
+
+void TouchGestures::OnRelease(uint32_t now_ms) {
+    if (long_pressed_) {
+        return;
+    }
+    int32_t dx = last_x_ - start_x_;
+    int32_t dy = last_y_ - start_y_;
+    int32_t adx = std::abs(dx);
+    int32_t ady = std::abs(dy);
+    // 移動量の大きい方の軸で方向を決める
+    if (adx >= TOUCH_GESTURE_SWIPE_MIN || ady >= TOUCH_GESTURE_SWIPE_MIN) {
+        TouchGesture gesture;
+        if (adx >= ady) {
+            gesture = dx > 0 ? kTouchGestureSwipeRight : kTouchGestureSwipeLeft;
+        } else {
+            gesture = dy > 0 ? kTouchGestureSwipeDown : kTouchGestureSwipeUp;
+        }
+        callback_(gesture, start_x_, start_y_);
+        return;
+    }
+    if (now_ms - press_time_ < TOUCH_GESTURE_TAP_MAX_MS &&
+        adx <= TOUCH_GESTURE_MOVE_TOLERANCE && ady <= TOUCH_GESTURE_MOVE_TOLERANCE) {
+        callback_(kTouchGestureTap, last_x_, last_y_);
+    }
+}
+
+const char* TouchGestures::Name(TouchGesture gesture) {
+    switch (gesture) {
+    case kTouchGestureTap:
+        return "tap";
+    case kTouchGestureLongPress:
+        return "long_press";
+    case kTouchGestureSwipeLeft:
+        return "swipe_left";
+    case kTouchGestureSwipeRight:
+        return "swipe_right";
+    case kTouchGestureSwipeUp:
+        return "swipe_up";
+    default:
+        return "swipe_down";
+    }
+}
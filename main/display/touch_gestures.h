@@ -0,0 +1,86 @@
+/**
+ * @file touch_gestures.h
+ * @brief LVGLタッチ入力デバイスのジェスチャー認識（タップ / 長押し / スワイプ）
+ *
+ * esp_lvgl_portが登録したタッチのlv_indevの読み取りコールバックを包み、
+ * 座標列からジェスチャーを判定します。INTピンを指定した場合は、
+ * 離している間（INTがHigh）のI2C読み取りを省略します。
+ */
+#ifndef TOUCH_GESTURES_H
+#define TOUCH_GESTURES_H
+
+#include <lvgl.h>
+#include <driver/gpio.h>
+
+#include <cstdint>
+#include <functional>
+
+/** @brief タップとみなす最大の押下時間（ミリ秒） */
+#define TOUCH_GESTURE_TAP_MAX_MS        500
+
+/** @brief 長押しとみなす押下時間（ミリ秒） */
+#define TOUCH_GESTURE_LONG_PRESS_MS     800
+
+/** @brief タップ・長押しで許容する移動量（ピクセル） */
+#define TOUCH_GESTURE_MOVE_TOLERANCE    20
+
+/** @brief スワイプとみなす最小の移動量（ピクセル） */
+#define TOUCH_GESTURE_SWIPE_MIN         40
+
+enum TouchGesture {
+    kTouchGestureTap,
+    kTouchGestureLongPress,     // 押している間に1回だけ通知
+    kTouchGestureSwipeLeft,
+    kTouchGestureSwipeRight,
+    kTouchGestureSwipeUp,
+    kTouchGestureSwipeDown,
+};
+
+/**
+ * @class TouchGestures
+ * @brief 1本指のジェスチャー認識器
+ *
+ * コールバックはLVGLタスクから（LVGLのロックを保持した状態で）呼ばれます。
+ * 重い処理はApplication::Schedule()などで別タスクへ渡してください。
+ */
+class TouchGestures {
+public:
+    using Callback = std::function<void(TouchGesture gesture, int32_t x, int32_t y)>;
+
+    explicit TouchGestures(Callback callback) : callback_(callback) {}
+
+    /**
+     * @brief 入力デバイスの読み取りコールバックを包んでジェスチャー認識を開始
+     * @param indev lvgl_port_add_touch()が返した入力デバイス
+     * @param int_gpio タッチ中にLowになるINTピン。GPIO_NUM_NCなら毎回読み取る
+     *
+     * INTはタッチ中にLowを保つモード（FT5x06系のG_MODE=0）に設定しておいてください。
+     */
+    void Attach(lv_indev_t* indev, gpio_num_t int_gpio = GPIO_NUM_NC);
+
+    /** @brief 1回分の読み取り結果を入力 */
+    void Feed(bool pressed, int32_t x, int32_t y, uint32_t now_ms);
+
+    static const char* Name(TouchGesture gesture);
+
+private:
+    Callback callback_;
+    lv_indev_read_cb_t read_cb_ = nullptr;      /**< 包んだ元の読み取りコールバック */
+    gpio_num_t int_gpio_ = GPIO_NUM_NC;
+    lv_point_t last_point_ = {};                /**< 離している間に返す最後の座標 */
+
+    bool pressed_ = false;
+    bool long_pressed_ = false;                 /**< 今回の押下で長押しを通知済み */
+    int32_t start_x_ = 0;
+    int32_t start_y_ = 0;
+    int32_t last_x_ = 0;
+    int32_t last_y_ = 0;
+    uint32_t press_time_ = 0;
+
+    static void ReadCallback(lv_indev_t* indev, lv_indev_data_t* data);
+
+    /** @brief 押下開始からの移動量を判定して離した時のジェスチャーを通知 */
+    void OnRelease(uint32_t now_ms);
+};
+
+#endif // TOUCH_GESTURES_H
@@ -0,0 +1,220 @@
+/**
+ * @file flight_recorder.cc
+ * @brief フライトレコーダーの実装
+ */
+#include "flight_recorder.h"
+#include "system_info.h"
+
+#include <esp_attr.h>
+#include <esp_heap_caps.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <cJSON.h>
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+
+#define TAG "FlightRecorder"
+
+/** @brief 構造体の配置を変えたら値を変える */
+#define FLIGHT_RECORDER_MAGIC 0x46525231  // "FRR1"
+
+/** @brief JSONで返す今回の起動のレコード数 */
+#define FLIGHT_RECORDER_CURRENT_JSON 32
+
+namespace {
+
+/** @brief 再起動をまたいで残るリング（電源投入時は不定なのでmagicで判定する） */
+struct FlightRing {
+    uint32_t magic;
+    uint32_t position;                                  /**< これまでに書いた総レコード数 */
+    FlightRecord records[CONFIG_FLIGHT_RECORDER_RECORDS];
+};
+
+__NOINIT_ATTR FlightRing s_ring;
+
+/** @brief リングの内容を古い順にdestへ写し、件数を返す */
+size_t CopyRing(FlightRecord* dest, size_t max_count) {
+    uint32_t position = __atomic_load_n(&s_ring.position, __ATOMIC_RELAXED);
+    size_t count = std::min({(size_t)position, (size_t)CONFIG_FLIGHT_RECORDER_RECORDS, max_count});
+    for (size_t i = 0; i < count; i++) {
+        dest[i] = s_ring.records[(position - count + i) % CONFIG_FLIGHT_RECORDER_RECORDS];
+    }
+    return count;
+}
+
+void AddRecords(cJSON* array, const FlightRecord* records, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        const auto& record = records[i];
+        if (record.type == kFlightEventNone) {
+            continue;   // 予約しただけで書き終わっていないレコード
+        }
+        auto item = cJSON_CreateObject();
+        cJSON_AddNumberToObject(item, "t", record.time_ms);
+        switch (record.type) {
+        case kFlightEventBoot:
+            cJSON_AddStringToObject(item, "type", "boot");
+            cJSON_AddNumberToObject(item, "reset_reason", record.value);
+            break;
+        case kFlightEventState:
+            cJSON_AddStringToObject(item, "type", "state");
+            cJSON_AddNumberToObject(item, "from", record.arg8);
+            cJSON_AddNumberToObject(item, "to", record.arg16);
+            break;
+        case kFlightEventHeap:
+            cJSON_AddStringToObject(item, "type", "heap");
+            cJSON_AddNumberToObject(item, "internal_free", record.value);
+            cJSON_AddNumberToObject(item, "internal_largest_kb", record.arg16);
+            break;
+        case kFlightEventQueue:
+            cJSON_AddStringToObject(item, "type", "queue");
+            cJSON_AddNumberToObject(item, "encode", record.arg8);
+            cJSON_AddNumberToObject(item, "decode", record.arg16);
+            cJSON_AddNumberToObject(item, "psram_free", record.value);
+            break;
+        case kFlightEventStall:
+            cJSON_AddStringToObject(item, "type", "stall");
+            cJSON_AddNumberToObject(item, "stage", record.arg8);
+            cJSON_AddNumberToObject(item, "cause", record.arg16);
+            cJSON_AddNumberToObject(item, "elapsed_us", record.value);
+            break;
+        case kFlightEventProtocol: {
+            static const char* const kNames[] = {
+                "channel_opened", "channel_closed", "network_error", "tts", "stt", "llm", "mcp", "other",
+            };
+            cJSON_AddStringToObject(item, "type", "protocol");
+            cJSON_AddStringToObject(item, "event",
+                record.arg8 < sizeof(kNames) / sizeof(kNames[0]) ? kNames[record.arg8] : "unknown");
+            if (record.arg8 == kFlightProtocolTts) {
+                cJSON_AddNumberToObject(item, "state", record.arg16);
+            }
+            break;
+        }
+        default:
+            cJSON_AddNumberToObject(item, "type", record.type);
+            break;
+        }
+        cJSON_AddItemToArray(array, item);
+    }
+}
+
+} // namespace
+
+void FlightRecorder::Start() {
+    if (started_.load(std::memory_order_relaxed)) {
+        return;
+    }
+    auto reason = esp_reset_reason();
+    // .noinitの内容が残る異常なリセットだけ記録を残す（deferred_logと同じ判定）
+    if (SystemInfo::IsCrashReset() && s_ring.magic == FLIGHT_RECORDER_MAGIC && s_ring.position > 0) {
+        size_t count = std::min((size_t)s_ring.position, (size_t)CONFIG_FLIGHT_RECORDER_RECORDS);
+        previous_.reset(new (std::nothrow) FlightRecord[count]);
+        if (previous_ != nullptr) {
+            previous_count_ = CopyRing(previous_.get(), count);
+            previous_reason_ = reason;
+            const auto& last = previous_[previous_count_ - 1];
+            ESP_LOGW(TAG, "Reset (reason %d) with %u records, last at %lu ms (type %s)",
+                reason, previous_count_, last.time_ms, TypeName(last.type));
+            // 最後の状態遷移とヒープを要約として出す
+            for (size_t i = previous_count_; i-- > 0;) {
+                if (previous_[i].type == kFlightEventState) {
+                    ESP_LOGW(TAG, "Last state change: %u -> %u at %lu ms",
+                        previous_[i].arg8, previous_[i].arg16, previous_[i].time_ms);
+                    break;
+                }
+            }
+            for (size_t i = previous_count_; i-- > 0;) {
+                if (previous_[i].type == kFlightEventHeap) {
+                    ESP_LOGW(TAG, "Last heap: internal free %lu, largest %u KB at %lu ms",
+                        previous_[i].value, previous_[i].arg16, previous_[i].time_ms);
+                    break;
+                }
+            }
+        }
+    }
+
+    s_ring.position = 0;
+    memset(s_ring.records, 0, sizeof(s_ring.records));
+    s_ring.magic = FLIGHT_RECORDER_MAGIC;
+    started_.store(true, std::memory_order_release);
+    Record(kFlightEventBoot, 0, 0, reason);
+}
+
+void FlightRecorder::Record(FlightEventType type, uint8_t arg8, uint16_t arg16, uint32_t value) {
+    if (!started_.load(std::memory_order_acquire)) {
+        return;
+    }
+    uint32_t position = __atomic_fetch_add(&s_ring.position, 1, __ATOMIC_RELAXED);
+    auto& record = s_ring.records[position % CONFIG_FLIGHT_RECORDER_RECORDS];
+    __atomic_store_n(&record.type, (uint8_t)kFlightEventNone, __ATOMIC_RELAXED);
+    record.time_ms = (uint32_t)(esp_timer_get_time() / 1000);
+    record.arg8 = arg8;
+    record.arg16 = arg16;
+    record.value = value;
+    __atomic_store_n(&record.type, (uint8_t)type, __ATOMIC_RELEASE);
+}
+
+void FlightRecorder::RecordMessage(const char* type, const char* tts_state) {
+    FlightProtocolEvent event = kFlightProtocolOther;
+    uint16_t state = 0;
+    if (strcmp(type, "tts") == 0) {
+        event = kFlightProtocolTts;
+        if (tts_state != nullptr) {
+            state = strcmp(tts_state, "start") == 0 ? 0 : strcmp(tts_state, "stop") == 0 ? 1 : 2;
+        }
+    } else if (strcmp(type, "stt") == 0) {
+        event = kFlightProtocolStt;
+    } else if (strcmp(type, "llm") == 0) {
+        event = kFlightProtocolLlm;
+    } else if (strcmp(type, "mcp") == 0) {
+        event = kFlightProtocolMcp;
+    }
+    Record(kFlightEventProtocol, event, state);
+}
+
+void FlightRecorder::RecordSample(uint8_t encode_depth, uint16_t decode_depth) {
+    size_t largest = heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL);
+    Record(kFlightEventHeap, 0, (uint16_t)std::min<size_t>(largest / 1024, UINT16_MAX),
+        heap_caps_get_free_size(MALLOC_CAP_INTERNAL));
+    Record(kFlightEventQueue, encode_depth, decode_depth, heap_caps_get_free_size(MALLOC_CAP_SPIRAM));
+}
+
+const char* FlightRecorder::TypeName(uint8_t type) {
+    switch (type) {
+    case kFlightEventBoot: return "boot";
+    case kFlightEventState: return "state";
+    case kFlightEventHeap: return "heap";
+    case kFlightEventQueue: return "queue";
+    case kFlightEventStall: return "stall";
+    case kFlightEventProtocol: return "protocol";
+    default: return "unknown";
+    }
+}
+
+std::string FlightRecorder::ToJson() {
+    auto root = cJSON_CreateObject();
+    if (previous_count_ > 0) {
+        auto previous = cJSON_CreateObject();
+        cJSON_AddNumberToObject(previous, "reset_reason", previous_reason_);
+        auto records = cJSON_CreateArray();
+        AddRecords(records, previous_.get(), previous_count_);
+        cJSON_AddItemToObject(previous, "records", records);
+        cJSON_AddItemToObject(root, "previous", previous);
+    } else {
+        cJSON_AddNullToObject(root, "previous");
+    }
+
+    // 今回の起動は直近の分だけ返す
+    FlightRecord current[FLIGHT_RECORDER_CURRENT_JSON];
+    size_t count = CopyRing(current, FLIGHT_RECORDER_CURRENT_JSON);
+    auto records = cJSON_CreateArray();
+    AddRecords(records, current, count);
+    cJSON_AddItemToObject(root, "current", records);
+
+    auto json_str = cJSON_PrintUnformatted(root);
+    std::string json(json_str);
+    cJSON_free(json_str);
+    cJSON_Delete(root);
+    return json;
+}
@@ -0,0 +1,103 @@
+/**
+ * @file flight_recorder.h
+ * @brief 再起動をまたいで残る直近のイベントと計測値の記録（フライトレコーダー）
+ *
+ * 状態遷移、キューの深さ、ヒープの残量、audio_loopの遅延、プロトコルのイベントを
+ * 12バイトの固定長レコードとしてリセットで消えない内部RAM（.noinit）のリングへ書きます。
+ * パニックやウォッチドッグで再起動したとき、次の起動のStart()でリングの内容を退避し、
+ * ログへ要約を出すとともにMCPツール（self.diagnostics.get_flight_record）で取得できます。
+ * 毎秒の計測値は2レコードなので、既定の256レコードで直前の1分以上が残ります。
+ */
+#ifndef FLIGHT_RECORDER_H
+#define FLIGHT_RECORDER_H
+
+#include <esp_system.h>
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+/** @brief レコードの種類 */
+enum FlightEventType : uint8_t {
+    kFlightEventNone = 0,
+    kFlightEventBoot,       /**< 起動（value: リセット要因） */
+    kFlightEventState,      /**< 状態遷移（arg8: 遷移前、arg16: 遷移後のDeviceState） */
+    kFlightEventHeap,       /**< ヒープ（arg16: 内部RAMの最大連続空き KB、value: 内部RAMの空きバイト数） */
+    kFlightEventQueue,      /**< キュー（arg8: エンコード待ち、arg16: デコード待ち、value: PSRAMの空きバイト数） */
+    kFlightEventStall,      /**< audio_loopの遅延（arg8: ステージ、arg16: 原因、value: 経過 us） */
+    kFlightEventProtocol,   /**< プロトコルのイベント（arg8: FlightProtocolEvent） */
+};
+
+/** @brief kFlightEventProtocolの内容 */
+enum FlightProtocolEvent : uint8_t {
+    kFlightProtocolChannelOpened = 0,
+    kFlightProtocolChannelClosed,
+    kFlightProtocolNetworkError,
+    kFlightProtocolTts,     /**< arg16: ttsのstate（0: start、1: stop、2: sentence_start） */
+    kFlightProtocolStt,
+    kFlightProtocolLlm,
+    kFlightProtocolMcp,
+    kFlightProtocolOther,
+};
+
+/** @brief 1件のレコード（12バイト） */
+struct FlightRecord {
+    uint32_t time_ms;       /**< 起動からの時間 */
+    uint8_t type;           /**< FlightEventType */
+    uint8_t arg8;
+    uint16_t arg16;
+    uint32_t value;
+};
+
+/**
+ * @class FlightRecorder
+ * @brief .noinitのリングへ書き込み、前回の起動の記録を保持するシングルトン
+ *
+ * Record()はロックを取らず（位置を原子的に進める）、どのタスクやコールバックからも呼べます。
+ * 同時に書かれたレコードが前後することはありますが、診断用なので許容します。
+ */
+class FlightRecorder {
+public:
+    static FlightRecorder& GetInstance() {
+        static FlightRecorder instance;
+        return instance;
+    }
+
+    FlightRecorder(const FlightRecorder&) = delete;
+    FlightRecorder& operator=(const FlightRecorder&) = delete;
+
+    /**
+     * @brief 前回の起動の記録を退避してリングを初期化する
+     *
+     * app_main()の先頭で1回呼ぶ。呼ぶまでのRecord()は捨てる。
+     */
+    void Start();
+
+    /** @brief レコードを1件書く */
+    void Record(FlightEventType type, uint8_t arg8 = 0, uint16_t arg16 = 0, uint32_t value = 0);
+
+    /** @brief サーバーから届いたJSONメッセージの種類を書く（ttsはstateも書く） */
+    void RecordMessage(const char* type, const char* tts_state);
+
+    /** @brief ヒープとキューの深さを書く（OnClockTimerから毎秒呼ぶ） */
+    void RecordSample(uint8_t encode_depth, uint16_t decode_depth);
+
+    /** @brief 前回の起動の記録があるか（パニックやウォッチドッグのリセットのときだけ残す） */
+    bool has_previous() const { return previous_count_ > 0; }
+
+    /** @brief 前回と今回の記録をJSONで返す（MCPツール用） */
+    std::string ToJson();
+
+private:
+    FlightRecorder() = default;
+
+    static const char* TypeName(uint8_t type);
+
+    std::atomic<bool> started_{false};
+    std::unique_ptr<FlightRecord[]> previous_;          /**< 前回の起動の記録（古い順、Start()の後は変えない） */
+    size_t previous_count_ = 0;
+    esp_reset_reason_t previous_reason_ = ESP_RST_UNKNOWN;
+};
+
+#endif // FLIGHT_RECORDER_H
@@ -0,0 +1,197 @@
+/**
+ * @file heap_monitor.cc
+ * @brief ヒープ計測モードの実装
+ */
+#include "heap_monitor.h"
+#if CONFIG_USE_JSON_ARENA
+#include "json_arena.h"
+#endif
+#if CONFIG_MBEDTLS_CUSTOM_MEM_ALLOC
+#include "tls_memory.h"
+#endif
+
+#include <cJSON.h>
+#include <esp_heap_caps.h>
+#include <esp_log.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <cstdio>
+#include <cstring>
+
+#if CONFIG_HEAP_TASK_TRACKING
+#include <esp_heap_task_info.h>
+#endif
+
+#define TAG "HeapMonitor"
+
+/** @brief タスク別集計で扱う最大タスク数 */
+#define HEAP_MONITOR_MAX_TASKS 48
+
+std::atomic<int32_t> HeapMonitor::json_bytes_{0};
+std::atomic<int32_t> HeapMonitor::json_blocks_{0};
+
+void* HeapMonitor::JsonMalloc(size_t size) {
+    void* ptr = malloc(size);
+    if (ptr != nullptr) {
+        json_bytes_ += heap_caps_get_allocated_size(ptr);
+        json_blocks_++;
+    }
+    return ptr;
+}
+
+void HeapMonitor::JsonFree(void* ptr) {
+    if (ptr == nullptr) {
+        return;
+    }
+    json_bytes_ -= heap_caps_get_allocated_size(ptr);
+    json_blocks_--;
+    free(ptr);
+}
+
+void HeapMonitor::Start() {
+#if CONFIG_USE_JSON_ARENA
+    // アリーナの外で確保した分だけを数える
+    JsonArena::SetFallback(JsonMalloc, JsonFree);
+#else
+    cJSON_Hooks hooks = {
+        .malloc_fn = JsonMalloc,
+        .free_fn = JsonFree,
+    };
+    cJSON_InitHooks(&hooks);
+#endif
+#if !CONFIG_HEAP_TASK_TRACKING
+    ESP_LOGI(TAG, "Enable CONFIG_HEAP_TASK_TRACKING for per-subsystem usage");
+#endif
+}
+
+void HeapMonitor::Sample() {
+    uint32_t free_internal = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+    uint32_t min_free_internal = heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL);
+    uint32_t largest_internal = heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL);
+    uint32_t free_psram = heap_caps_get_free_size(MALLOC_CAP_SPIRAM);
+    uint32_t largest_psram = heap_caps_get_largest_free_block(MALLOC_CAP_SPIRAM);
+    // 断片化率: 空き容量のうち最大ブロックに入らない割合
+    int fragmentation = free_internal > 0 ? 100 - (int)((uint64_t)largest_internal * 100 / free_internal) : 0;
+
+    // 推移：ウィンドウの最古サンプルとの差分
+    int32_t free_delta = 0;
+    int32_t largest_delta = 0;
+    if (trend_count_ > 0) {
+        size_t oldest = (trend_next_ + HEAP_MONITOR_TREND_SAMPLES - trend_count_) % HEAP_MONITOR_TREND_SAMPLES;
+        free_delta = (int32_t)free_internal - (int32_t)trend_[oldest].free;
+        largest_delta = (int32_t)largest_internal - (int32_t)trend_[oldest].largest;
+    }
+    trend_[trend_next_] = {free_internal, largest_internal};
+    trend_next_ = (trend_next_ + 1) % HEAP_MONITOR_TREND_SAMPLES;
+    if (trend_count_ < HEAP_MONITOR_TREND_SAMPLES) {
+        trend_count_++;
+    }
+    samples_++;
+
+    ESP_LOGI(TAG, "internal free %lu min %lu largest %lu frag %d%% (%+ld / %+ld over %us), psram free %lu largest %lu, cjson %ld in %ld blocks",
+        free_internal, min_free_internal, largest_internal, fragmentation,
+        free_delta, largest_delta, (unsigned)(trend_count_ - 1) * 10,
+        free_psram, largest_psram, json_bytes_.load(), json_blocks_.load());
+#if CONFIG_MBEDTLS_CUSTOM_MEM_ALLOC
+    size_t tls_internal;
+    size_t tls_psram;
+    tls_memory::GetUsage(tls_internal, tls_psram);
+    ESP_LOGI(TAG, "tls internal %u (peak %u), psram %u", tls_internal, tls_memory::GetInternalPeak(), tls_psram);
+#endif
+
+    bool low = largest_internal < CONFIG_HEAP_MONITOR_WARN_LARGEST_BLOCK;
+    if (low && (!alerted_ || samples_ - last_alert_sample_ >= HEAP_MONITOR_ALERT_INTERVAL)) {
+        ESP_LOGW(TAG, "Largest internal free block %lu < %d bytes (free %lu, frag %d%%)",
+            largest_internal, CONFIG_HEAP_MONITOR_WARN_LARGEST_BLOCK, free_internal, fragmentation);
+        alerted_ = true;
+        last_alert_sample_ = samples_;
+        LogAttribution();
+    } else if (!low) {
+        alerted_ = false;
+        if (samples_ % HEAP_MONITOR_ATTRIBUTION_INTERVAL == 0) {
+            LogAttribution();
+        }
+    }
+}
+
+#if CONFIG_HEAP_TASK_TRACKING
+namespace {
+
+struct Subsystem {
+    const char* name;
+    const char* prefixes[6];
+};
+
+// タスク名の接頭辞からサブシステムへ振り分ける（該当なしは"other"）
+const Subsystem kSubsystems[] = {
+    {"audio", {"audio_", "afe_", "encode_", "bg_worker", nullptr}},
+    {"protocol", {"main", "ws_standby", "check_version", "ota_writer", "mqtt", "websocket"}},
+    {"network", {"tiT", "wifi", "sys_evt", "esp_timer", nullptr}},
+    {"lvgl", {"taskLVGL", "LVGL", nullptr}},
+    {"mcp", {"mcp_tool", "ctrl_worker", nullptr}},
+    {"camera", {"viewfinder", nullptr}},
+};
+constexpr size_t kSubsystemCount = sizeof(kSubsystems) / sizeof(kSubsystems[0]);
+
+size_t FindSubsystem(const char* task_name) {
+    for (size_t i = 0; i < kSubsystemCount; i++) {
+        for (auto prefix : kSubsystems[i].prefixes) {
+            if (prefix != nullptr && strncmp(task_name, prefix, strlen(prefix)) == 0) {
+                return i;
+            }
+        }
+    }
+    return kSubsystemCount;
+}
+
+} // namespace
+#endif
+
+void HeapMonitor::LogAttribution() {
+#if CONFIG_HEAP_TASK_TRACKING
+    static heap_task_totals_t totals[HEAP_MONITOR_MAX_TASKS];
+    static TaskStatus_t tasks[HEAP_MONITOR_MAX_TASKS];
+    size_t num_totals = 0;
+
+    heap_task_info_params_t params = {};
+    params.caps[0] = MALLOC_CAP_INTERNAL;
+    params.mask[0] = MALLOC_CAP_INTERNAL;
+    params.caps[1] = MALLOC_CAP_SPIRAM;
+    params.mask[1] = MALLOC_CAP_SPIRAM;
+    params.totals = totals;
+    params.num_totals = &num_totals;
+    params.max_totals = HEAP_MONITOR_MAX_TASKS;
+    heap_caps_get_per_task_info(&params);
+
+    // 削除済みタスクのハンドルから名前を引かないよう、生存中のタスク一覧と突き合わせる
+    UBaseType_t task_count = uxTaskGetSystemState(tasks, HEAP_MONITOR_MAX_TASKS, nullptr);
+
+    size_t internal[kSubsystemCount + 2] = {};
+    size_t psram[kSubsystemCount + 2] = {};
+    const size_t deleted = kSubsystemCount + 1;
+    for (size_t i = 0; i < num_totals; i++) {
+        size_t index = deleted;
+        if (totals[i].task == nullptr) {
+            index = kSubsystemCount;    // スケジューラ起動前の確保は"other"
+        } else {
+            for (UBaseType_t j = 0; j < task_count; j++) {
+                if (tasks[j].xHandle == totals[i].task) {
+                    index = FindSubsystem(tasks[j].pcTaskName);
+                    break;
+                }
+            }
+        }
+        internal[index] += totals[i].size[0];
+        psram[index] += totals[i].size[1];
+    }
+
+    char line[256];
+    int len = snprintf(line, sizeof(line), "By subsystem (internal/psram):");
+    for (size_t i = 0; i < kSubsystemCount + 2 && len < (int)sizeof(line); i++) {
+        const char* name = i < kSubsystemCount ? kSubsystems[i].name : (i == kSubsystemCount ? "other" : "deleted_tasks");
+        len += snprintf(line + len, sizeof(line) - len, " %s=%u/%u", name, internal[i], psram[i]);
+    }
+    ESP_LOGI(TAG, "%s", line);
+#endif
+}
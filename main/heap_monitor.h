@@ -0,0 +1,76 @@
+/**
+ * @file heap_monitor.h
+ * @brief ヒープの断片化とサブシステム別の使用量を追跡する計測モード
+ *
+ * 空き容量だけでなく最大連続空きブロックと断片化率の推移を記録し、
+ * BackgroundTaskの警告（空き10KB未満）より手前でしきい値を下回ったら警告します。
+ * 使用量はタスク名からサブシステム（audio、protocol、LVGL、MCPなど）に集計し、
+ * cJSONはアロケータフックで個別に数えます。24時間稼働でのリークや断片化の特定に使います。
+ */
+#ifndef HEAP_MONITOR_H
+#define HEAP_MONITOR_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+/** @brief 推移を保持するサンプル数（OnClockTimerの10秒ごと、約5分） */
+#define HEAP_MONITOR_TREND_SAMPLES 30
+
+/** @brief サブシステム別の集計を出す間隔（サンプル数） */
+#define HEAP_MONITOR_ATTRIBUTION_INTERVAL 6
+
+/** @brief 同じ警告を繰り返さない間隔（サンプル数） */
+#define HEAP_MONITOR_ALERT_INTERVAL 6
+
+/**
+ * @class HeapMonitor
+ * @brief ヒープ計測のシングルトン（CONFIG_USE_HEAP_MONITOR有効時のみ使用）
+ */
+class HeapMonitor {
+public:
+    static HeapMonitor& GetInstance() {
+        static HeapMonitor instance;
+        return instance;
+    }
+
+    HeapMonitor(const HeapMonitor&) = delete;
+    HeapMonitor& operator=(const HeapMonitor&) = delete;
+
+    /** @brief cJSONのアロケータフックを設定（最初のcJSON使用より前に呼ぶ） */
+    void Start();
+
+    /**
+     * @brief 1回分を記録してログに出す（OnClockTimerから10秒ごとに呼ぶ）
+     *
+     * 最大空きブロックがCONFIG_HEAP_MONITOR_WARN_LARGEST_BLOCKを下回ると、
+     * サブシステム別の使用量を添えて警告します。
+     */
+    void Sample();
+
+private:
+    HeapMonitor() = default;
+
+    struct TrendSample {
+        uint32_t free;
+        uint32_t largest;
+    };
+
+    void LogAttribution();
+
+    static void* JsonMalloc(size_t size);
+    static void JsonFree(void* ptr);
+
+    // cJSONが確保中のバイト数と個数
+    static std::atomic<int32_t> json_bytes_;
+    static std::atomic<int32_t> json_blocks_;
+
+    TrendSample trend_[HEAP_MONITOR_TREND_SAMPLES] = {};
+    size_t trend_next_ = 0;
+    size_t trend_count_ = 0;
+    uint32_t samples_ = 0;
+    uint32_t last_alert_sample_ = 0;
+    bool alerted_ = false;
+};
+
+#endif // HEAP_MONITOR_H
@@ -0,0 +1,228 @@
+/**
+ * @file hosted_link.cc
+ * @brief ホスト型Wi-Fiリンクの設定の公開とダウンロード計測の実装
+ */
+#include "hosted_link.h"
+#include "board.h"
+#if CONFIG_USE_METRICS
+#include "metrics.h"
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <cJSON.h>
+#include <esp_heap_caps.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#if CONFIG_LWIP_STATS
+#include <lwip/stats.h>
+#endif
+
+#define TAG "HostedLink"
+
+// ビルドの構成によって存在しない項目は0として扱う
+#ifdef CONFIG_ESP_HOSTED_SDIO_CLOCK_FREQ_KHZ
+#define HOSTED_SDIO_CLOCK_KHZ CONFIG_ESP_HOSTED_SDIO_CLOCK_FREQ_KHZ
+#define HOSTED_SDIO_BUS_WIDTH CONFIG_ESP_HOSTED_SDIO_BUS_WIDTH
+#define HOSTED_TX_QUEUE CONFIG_ESP_HOSTED_SDIO_TX_Q_SIZE
+#define HOSTED_RX_QUEUE CONFIG_ESP_HOSTED_SDIO_RX_Q_SIZE
+#else
+#define HOSTED_SDIO_CLOCK_KHZ 0
+#define HOSTED_SDIO_BUS_WIDTH 0
+#define HOSTED_TX_QUEUE 0
+#define HOSTED_RX_QUEUE 0
+#endif
+
+#ifdef CONFIG_WIFI_RMT_STATIC_RX_BUFFER_NUM
+#define HOSTED_WIFI_STATIC_RX CONFIG_WIFI_RMT_STATIC_RX_BUFFER_NUM
+#define HOSTED_WIFI_DYNAMIC_RX CONFIG_WIFI_RMT_DYNAMIC_RX_BUFFER_NUM
+#else
+#define HOSTED_WIFI_STATIC_RX 0
+#define HOSTED_WIFI_DYNAMIC_RX 0
+#endif
+
+#if defined(CONFIG_WIFI_RMT_STATIC_TX_BUFFER_NUM)
+#define HOSTED_WIFI_TX CONFIG_WIFI_RMT_STATIC_TX_BUFFER_NUM
+#elif defined(CONFIG_WIFI_RMT_DYNAMIC_TX_BUFFER_NUM)
+#define HOSTED_WIFI_TX CONFIG_WIFI_RMT_DYNAMIC_TX_BUFFER_NUM
+#else
+#define HOSTED_WIFI_TX 0
+#endif
+
+#ifdef CONFIG_WIFI_RMT_TX_BA_WIN
+#define HOSTED_WIFI_TX_BA_WIN CONFIG_WIFI_RMT_TX_BA_WIN
+#else
+#define HOSTED_WIFI_TX_BA_WIN 0
+#endif
+
+#ifdef CONFIG_WIFI_RMT_RX_BA_WIN
+#define HOSTED_WIFI_RX_BA_WIN CONFIG_WIFI_RMT_RX_BA_WIN
+#else
+#define HOSTED_WIFI_RX_BA_WIN 0
+#endif
+
+namespace hosted_link {
+
+namespace {
+
+/** @brief 1回のReadで受け取る最大バイト数（OTAと同じ） */
+constexpr size_t kReadSize = 4096;
+
+struct ConfigValue {
+    const char* name;
+    int value;
+};
+
+const ConfigValue kConfigValues[] = {
+    {"sdio_clock_khz", HOSTED_SDIO_CLOCK_KHZ},
+    {"sdio_bus_width", HOSTED_SDIO_BUS_WIDTH},
+    {"sdio_tx_queue", HOSTED_TX_QUEUE},
+    {"sdio_rx_queue", HOSTED_RX_QUEUE},
+    {"wifi_static_rx_buffers", HOSTED_WIFI_STATIC_RX},
+    {"wifi_dynamic_rx_buffers", HOSTED_WIFI_DYNAMIC_RX},
+    {"wifi_tx_buffers", HOSTED_WIFI_TX},
+    {"wifi_tx_ba_win", HOSTED_WIFI_TX_BA_WIN},
+    {"wifi_rx_ba_win", HOSTED_WIFI_RX_BA_WIN},
+    {"tcp_wnd", CONFIG_LWIP_TCP_WND_DEFAULT},
+    {"tcp_snd_buf", CONFIG_LWIP_TCP_SND_BUF_DEFAULT},
+};
+
+std::atomic<uint32_t> s_last_kbps{0};
+std::atomic<uint32_t> s_last_bytes{0};
+std::atomic<uint32_t> s_last_first_byte_ms{0};
+std::atomic<bool> s_running{false};
+
+} // namespace
+
+#if CONFIG_USE_METRICS
+static MetricCallback metric_hosted_config("xiaozhi_hosted_link_config",
+    "Build-time settings of the hosted Wi-Fi link", kMetricGauge, [](MetricSink& sink) {
+        char labels[48];
+        for (auto& item : kConfigValues) {
+            snprintf(labels, sizeof(labels), "param=\"%s\"", item.name);
+            sink.Sample("", labels, item.value);
+        }
+    });
+static MetricCallback metric_hosted_download("xiaozhi_hosted_download_kbps",
+    "Throughput of the last HTTP download test over the hosted link", kMetricGauge, [](MetricSink& sink) {
+        sink.Sample("", "", s_last_kbps.load(std::memory_order_relaxed));
+    });
+#if CONFIG_LWIP_STATS
+static MetricCallback metric_link_packets("xiaozhi_link_packets_total",
+    "Packets passed between lwIP and the network interface", kMetricCounter, [](MetricSink& sink) {
+        sink.Sample("", "dir=\"rx\"", lwip_stats.link.recv);
+        sink.Sample("", "dir=\"tx\"", lwip_stats.link.xmit);
+    });
+static MetricCallback metric_link_drops("xiaozhi_link_drops_total",
+    "Packets dropped at the link layer (including out-of-memory)", kMetricCounter, [](MetricSink& sink) {
+        sink.Sample("", "reason=\"drop\"", lwip_stats.link.drop);
+        sink.Sample("", "reason=\"memerr\"", lwip_stats.link.memerr);
+    });
+#endif
+#endif
+
+std::string GetStatusJson() {
+    auto root = cJSON_CreateObject();
+    auto config = cJSON_CreateObject();
+    for (auto& item : kConfigValues) {
+        cJSON_AddNumberToObject(config, item.name, item.value);
+    }
+    cJSON_AddItemToObject(root, "config", config);
+#if CONFIG_LWIP_STATS
+    auto link = cJSON_CreateObject();
+    cJSON_AddNumberToObject(link, "rx", lwip_stats.link.recv);
+    cJSON_AddNumberToObject(link, "tx", lwip_stats.link.xmit);
+    cJSON_AddNumberToObject(link, "drop", lwip_stats.link.drop);
+    cJSON_AddNumberToObject(link, "memerr", lwip_stats.link.memerr);
+    cJSON_AddItemToObject(root, "link", link);
+#endif
+    if (s_last_bytes.load(std::memory_order_relaxed) > 0) {
+        auto last = cJSON_CreateObject();
+        cJSON_AddNumberToObject(last, "kbps", s_last_kbps.load(std::memory_order_relaxed));
+        cJSON_AddNumberToObject(last, "bytes", s_last_bytes.load(std::memory_order_relaxed));
+        cJSON_AddNumberToObject(last, "first_byte_ms", s_last_first_byte_ms.load(std::memory_order_relaxed));
+        cJSON_AddItemToObject(root, "last_download", last);
+    }
+    auto json_str = cJSON_PrintUnformatted(root);
+    std::string json(json_str);
+    cJSON_free(json_str);
+    cJSON_Delete(root);
+    return json;
+}
+
+std::string RunDownloadTest(const std::string& url, int seconds) {
+    if (s_running.exchange(true)) {
+        return "{\"success\":false,\"message\":\"A download test is running\"}";
+    }
+    ESP_LOGI(TAG, "Download test: %s for %d s (SDIO %d kHz, queues %d/%d, TCP window %d)", url.c_str(), seconds,
+        HOSTED_SDIO_CLOCK_KHZ, HOSTED_TX_QUEUE, HOSTED_RX_QUEUE, CONFIG_LWIP_TCP_WND_DEFAULT);
+
+    int64_t start_us = esp_timer_get_time();
+    std::unique_ptr<Http> http(Board::GetInstance().CreateHttp());
+    if (!http->Open("GET", url)) {
+        s_running = false;
+        return "{\"success\":false,\"message\":\"Failed to open the URL\"}";
+    }
+    int status_code = http->GetStatusCode();
+    if (status_code != 200) {
+        http->Close();
+        s_running = false;
+        return "{\"success\":false,\"message\":\"HTTP status " + std::to_string(status_code) + "\"}";
+    }
+
+    auto buffer = (char*)heap_caps_malloc(kReadSize, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (buffer == nullptr) {
+        buffer = (char*)malloc(kReadSize);
+    }
+    int64_t first_byte_us = 0;
+    int64_t deadline_us = 0;
+    size_t total = 0;
+    bool complete = false;
+    while (true) {
+        int ret = http->Read(buffer, kReadSize);
+        int64_t now = esp_timer_get_time();
+        if (ret <= 0) {
+            complete = ret == 0;
+            break;
+        }
+        // 接続とヘッダの時間を除くため、最初のデータから計り始める
+        if (first_byte_us == 0) {
+            first_byte_us = now;
+            deadline_us = now + (int64_t)seconds * 1000000;
+        }
+        total += ret;
+        if (now >= deadline_us) {
+            break;
+        }
+    }
+    int64_t end_us = esp_timer_get_time();
+    free(buffer);
+    http->Close();
+    s_running = false;
+
+    if (first_byte_us == 0) {
+        return "{\"success\":false,\"message\":\"No data received\"}";
+    }
+    uint32_t elapsed_ms = std::max<int64_t>((end_us - first_byte_us) / 1000, 1);
+    uint32_t first_byte_ms = (first_byte_us - start_us) / 1000;
+    uint32_t kbps = (uint64_t)total * 8 / elapsed_ms;
+    s_last_kbps = kbps;
+    s_last_bytes = total;
+    s_last_first_byte_ms = first_byte_ms;
+    ESP_LOGI(TAG, "Download test: %u bytes in %lu ms, %lu kbps (first byte %lu ms)", total, elapsed_ms, kbps,
+        first_byte_ms);
+    printf("BENCH {\"case\":\"hosted_download\",\"params\":{\"sdio_khz\":%d,\"tx_q\":%d,\"rx_q\":%d,"
+        "\"rx_ba_win\":%d,\"tcp_wnd\":%d},\"bytes\":%u,\"ms\":%lu,\"kbps\":%lu,\"first_byte_ms\":%lu}\n",
+        HOSTED_SDIO_CLOCK_KHZ, HOSTED_TX_QUEUE, HOSTED_RX_QUEUE, HOSTED_WIFI_RX_BA_WIN, CONFIG_LWIP_TCP_WND_DEFAULT,
+        total, elapsed_ms, kbps, first_byte_ms);
+
+    char json[160];
+    snprintf(json, sizeof(json), "{\"success\":true,\"complete\":%s,\"bytes\":%u,\"ms\":%lu,\"kbps\":%lu,"
+        "\"first_byte_ms\":%lu}", complete ? "true" : "false", total, elapsed_ms, kbps, first_byte_ms);
+    return json;
+}
+
+} // namespace hosted_link
@@ -0,0 +1,35 @@
+/**
+ * @file hosted_link.h
+ * @brief ESP32-P4のホスト型Wi-Fi（esp_hosted / esp_wifi_remote）リンクの設定の公開とダウンロード計測
+ *
+ * P4は無線を持たず、SDIOでつないだESP32-C6がWi-Fiを担当します。音声とOTAの速度は
+ * 空中の速度ではなく、SDIOのクロック、ホスト側の送受信キュー、C6側のWi-Fiバッファ数と
+ * Block Ackの窓、lwIPのTCP窓のうち最も小さいところで決まります。
+ * ここでは、これらのビルド時の設定値をメトリクスとMCPツールで公開し、OTAと同じHTTPの経路で
+ * 指定のURLから一定時間ダウンロードして実効スループットを測ります（結果は "BENCH " 行にも出力し、
+ * scripts/bench_compare.py で設定の違いを比べられます）。
+ *
+ * 推奨の設定は sdkconfig.defaults.p4_hosted にまとめています。
+ * CONFIG_LWIP_STATS が有効ならリンク層のパケット数と破棄数も公開します。
+ */
+#ifndef HOSTED_LINK_H
+#define HOSTED_LINK_H
+
+#include <string>
+
+namespace hosted_link {
+
+/** @brief リンクの設定値と直近のダウンロード計測の結果（JSON） */
+std::string GetStatusJson();
+
+/**
+ * @brief urlからseconds秒（または本文の終わりまで）ダウンロードして実効スループットを測る
+ *
+ * 受け取ったデータは捨てます。完了まで戻らないため、メインループ以外のタスクから呼びます。
+ * @return 結果（JSON）。接続できなかった場合はsuccessがfalse
+ */
+std::string RunDownloadTest(const std::string& url, int seconds);
+
+} // namespace hosted_link
+
+#endif // HOSTED_LINK_H
@@ -0,0 +1,130 @@
+/**
+ * @file json_writer.h
+ * @brief 再利用するバッファへ直接書き込むJSONライター
+ *
+ * 区切りのカンマはライターが管理し、文字列はエスケープして書き込みます。
+ * 呼び出し側がバッファを保持して使い回せば、容量が足りている限り再確保は起きません。
+ */
+#ifndef JSON_WRITER_H
+#define JSON_WRITER_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+namespace iot {
+
+class JsonWriter {
+public:
+    /** @brief outの末尾に追記する（クリアは呼び出し側で行う） */
+    explicit JsonWriter(std::string& out) : out_(out) {}
+
+    void BeginObject() { Open('{'); }
+    void EndObject() { Close('}'); }
+    void BeginArray() { Open('['); }
+    void EndArray() { Close(']'); }
+
+    void Key(const std::string& key) {
+        Separator();
+        AppendString(key);
+        out_ += ':';
+        after_key_ = true;
+    }
+
+    void String(const std::string& value) {
+        Separator();
+        AppendString(value);
+    }
+
+    void Bool(bool value) {
+        Separator();
+        out_ += value ? "true" : "false";
+    }
+
+    void Number(int value) {
+        Separator();
+        char buffer[12];
+        int length = snprintf(buffer, sizeof(buffer), "%d", value);
+        out_.append(buffer, length);
+    }
+
+    /** @brief シリアライズ済みのJSON値をそのまま書き込む */
+    void Raw(const std::string& json) {
+        Separator();
+        out_ += json;
+    }
+
+    /** @brief Quote()で作ったキーをエスケープせずに書き込む */
+    void QuotedKey(const std::string& quoted_key) {
+        Separator();
+        out_ += quoted_key;
+        out_ += ':';
+        after_key_ = true;
+    }
+
+    /** @brief エスケープして引用符で囲んだ文字列（登録時に一度だけ作り、QuotedKey/Rawで使う） */
+    static std::string Quote(const std::string& value) {
+        std::string quoted;
+        JsonWriter writer(quoted);
+        writer.String(value);
+        return quoted;
+    }
+
+private:
+    std::string& out_;
+    uint32_t first_ = 0;        // ビットd: 深さdで次の要素が先頭（カンマ不要）
+    int depth_ = 0;
+    bool after_key_ = false;
+
+    void Open(char bracket) {
+        Separator();
+        out_ += bracket;
+        depth_++;
+        first_ |= 1u << depth_;
+    }
+
+    void Close(char bracket) {
+        out_ += bracket;
+        first_ &= ~(1u << depth_);
+        depth_--;
+    }
+
+    void Separator() {
+        if (after_key_) {
+            after_key_ = false;
+            return;
+        }
+        if (first_ & (1u << depth_)) {
+            first_ &= ~(1u << depth_);
+        } else if (depth_ > 0) {
+            out_ += ',';
+        }
+    }
+
+    void AppendString(const std::string& value) {
+        out_ += '"';
+        for (char c : value) {
+            switch (c) {
+                case '"': out_ += "\\\""; break;
+                case '\\': out_ += "\\\\"; break;
+                case '\n': out_ += "\\n"; break;
+                case '\r': out_ += "\\r"; break;
+                case '\t': out_ += "\\t"; break;
+                default:
+                    if ((uint8_t)c < 0x20) {
+                        char buffer[8];
+                        snprintf(buffer, sizeof(buffer), "\\u%04x", c);
+                        out_ += buffer;
+                    } else {
+                        out_ += c;
+                    }
+                    break;
+            }
+        }
+        out_ += '"';
+    }
+};
+
+} // namespace iot
+
+#endif // JSON_WRITER_H
@@ -34,51 +34,98 @@ Thing* CreateThing(const std::string& type) {
 #endif
 }
 
-std::string Thing::GetDescriptorJson() {
-    std::string json_str = "{";
-    json_str += "\"name\":\"" + name_ + "\",";
-    json_str += "\"description\":\"" + description_ + "\",";
-    json_str += "\"properties\":" + properties_.GetDescriptorJson() + ",";
-    json_str += "\"methods\":" + methods_.GetDescriptorJson();
-    json_str += "}";
-    return json_str;
+void Thing::WriteDescriptor(JsonWriter& writer) {
+    writer.BeginObject();
+    writer.Key("name");
+    writer.String(name_);
+    writer.Key("description");
+    writer.String(description_);
+    writer.Key("properties");
+    properties_.WriteDescriptor(writer);
+    writer.Key("methods");
+    methods_.WriteDescriptor(writer);
+    writer.EndObject();
 }
 
-std::string Thing::GetStateJson() {
-    std::string json_str = "{";
-    json_str += "\"name\":\"" + name_ + "\",";
-    json_str += "\"state\":" + properties_.GetStateJson();
-    json_str += "}";
-    return json_str;
+bool Thing::RefreshState(bool all) {
+    if (all) {
+        properties_.MarkDirty();
+    }
+    return properties_.Refresh();
 }
 
-void Thing::Invoke(const cJSON* command) {
+void Thing::WriteState(JsonWriter& writer, bool pending_only) {
+    writer.BeginObject();
+    writer.Key("name");
+    writer.Raw(quoted_name_);
+    writer.Key("state");
+    properties_.WriteState(writer, pending_only);
+    writer.EndObject();
+}
+
+void Thing::NotifyStateChanged(const std::string& property) {
+    if (!properties_.MarkDirty(property)) {
+        ESP_LOGW(TAG, "%s: Unknown property %s", name_.c_str(), property.c_str());
+        return;
+    }
+    if (on_state_changed_) {
+        on_state_changed_();
+    }
+}
+
+Method* Thing::BindCommand(const cJSON* command) {
     auto method_name = cJSON_GetObjectItem(command, "method");
-    auto input_params = cJSON_GetObjectItem(command, "parameters");
-
-    try {
-        auto& method = methods_[method_name->valuestring];
-        for (auto& param : method.parameters()) {
-            auto input_param = cJSON_GetObjectItem(input_params, param.name().c_str());
-            if (param.required() && input_param == nullptr) {
-                throw std::runtime_error("Parameter " + param.name() + " is required");
-            }
-            if (param.type() == kValueTypeNumber) {
-                param.set_number(input_param->valueint);
-            } else if (param.type() == kValueTypeString) {
-                param.set_string(input_param->valuestring);
-            } else if (param.type() == kValueTypeBoolean) {
-                param.set_boolean(input_param->valueint == 1);
-            }
+    if (!cJSON_IsString(method_name)) {
+        ESP_LOGE(TAG, "%s: Missing method name", name_.c_str());
+        return nullptr;
+    }
+    auto method = methods_.Find(method_name->valuestring);
+    if (method == nullptr) {
+        ESP_LOGE(TAG, "Method not found: %s", method_name->valuestring);
+        return nullptr;
+    }
+
+    // 受信した引数を一度だけ走査し、索引で引数の定義に対応させる
+    auto& parameters = method->parameters();
+    uint32_t given = 0;
+    const cJSON* input_param;
+    cJSON_ArrayForEach(input_param, cJSON_GetObjectItem(command, "parameters")) {
+        int index = parameters.IndexOf(input_param->string != nullptr ? input_param->string : "");
+        if (index < 0 || index >= 32) {
+            continue;
+        }
+        auto& param = parameters.at(index);
+        if (param.type() == kValueTypeNumber && cJSON_IsNumber(input_param)) {
+            param.set_number(input_param->valueint);
+        } else if (param.type() == kValueTypeString && cJSON_IsString(input_param)) {
+            param.set_string(input_param->valuestring);
+        } else if (param.type() == kValueTypeBoolean) {
+            param.set_boolean(cJSON_IsTrue(input_param) || (cJSON_IsNumber(input_param) && input_param->valueint == 1));
+        } else {
+            continue;
         }
+        given |= 1u << index;
+    }
+    for (size_t i = 0; i < parameters.size(); i++) {
+        if (parameters.at(i).required() && (i >= 32 || !(given & (1u << i)))) {
+            ESP_LOGE(TAG, "%s.%s: Parameter %s is required", name_.c_str(), method->name().c_str(),
+                parameters.at(i).name().c_str());
+            return nullptr;
+        }
+    }
+    return method;
+}
 
-        Application::GetInstance().Schedule([&method]() {
-            method.Invoke();
-        });
-    } catch (const std::runtime_error& e) {
-        ESP_LOGE(TAG, "Method not found: %s", method_name->valuestring);
+void Thing::Invoke(const cJSON* command) {
+    auto method = BindCommand(command);
+    if (method == nullptr) {
         return;
     }
+    Application::GetInstance().Schedule([this, method]() {
+        method->Invoke();
+        // メソッドは状態を変えることが多いため、すべてのプロパティを読み直す
+        NotifyStateChanged();
+    });
 }
 
 
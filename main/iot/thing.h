@@ -10,14 +10,32 @@
 #define THING_H
 
 #include <string>
+#include <string_view>
 #include <map>
+#include <unordered_map>
 #include <functional>
 #include <vector>
 #include <stdexcept>
 #include <cJSON.h>
 
+#include "json_writer.h"
+
 namespace iot {
 
+/** @brief 名前の索引用ハッシュ（std::string_viewのまま引けるよう透過的にする） */
+struct NameHash {
+    using is_transparent = void;
+    size_t operator()(std::string_view name) const { return std::hash<std::string_view>{}(name); }
+};
+
+/**
+ * @brief 名前から要素を引く索引（登録時に作る）
+ *
+ * 受信したJSONの文字列（cJSONのvaluestring）からstd::stringを作らずに引けます。
+ */
+template <typename T>
+using NameIndex = std::unordered_map<std::string, T, NameHash, std::equal_to<>>;
+
 /**
  * @enum ValueType
  * @brief IoTプロパティの値タイプ
@@ -46,13 +64,18 @@ private:
 
 public:
     Property(const std::string& name, const std::string& description, std::function<bool()> getter) :
-        name_(name), description_(description), type_(kValueTypeBoolean), boolean_getter_(getter) {}
+        name_(name), description_(description), type_(kValueTypeBoolean), boolean_getter_(getter),
+        quoted_name_(JsonWriter::Quote(name)) {}
     Property(const std::string& name, const std::string& description, std::function<int()> getter) :
-        name_(name), description_(description), type_(kValueTypeNumber), number_getter_(getter) {}
+        name_(name), description_(description), type_(kValueTypeNumber), number_getter_(getter),
+        quoted_name_(JsonWriter::Quote(name)) {}
     Property(const std::string& name, const std::string& description, std::function<std::string()> getter) :
-        name_(name), description_(description), type_(kValueTypeString), string_getter_(getter) {}
+        name_(name), description_(description), type_(kValueTypeString), string_getter_(getter),
+        quoted_name_(JsonWriter::Quote(name)) {}
 
     const std::string& name() const { return name_; }
+    /** @brief 状態のJSONのキー（エスケープ済み） */
+    const std::string& quoted_name() const { return quoted_name_; }
     const std::string& description() const { return description_; }
     ValueType type() const { return type_; }
 
@@ -60,30 +83,72 @@ public:
     int number() const { return number_getter_(); }
     std::string string() const { return string_getter_(); }
 
-    std::string GetDescriptorJson() {
-        std::string json_str = "{";
-        json_str += "\"description\":\"" + description_ + "\",";
+    void WriteDescriptor(JsonWriter& writer) const {
+        writer.BeginObject();
+        writer.Key("description");
+        writer.String(description_);
+        writer.Key("type");
+        writer.String(type_ == kValueTypeBoolean ? "boolean" : type_ == kValueTypeNumber ? "number" : "string");
+        writer.EndObject();
+    }
+
+    /** @brief 値が変わった可能性があるとして、次のRefresh()でgetterを読む */
+    void MarkDirty() { dirty_ = true; }
+    bool dirty() const { return dirty_; }
+
+    /** @brief 読み込み済みで未送信の変更がある */
+    bool pending() const { return pending_; }
+
+    /**
+     * @brief getterで現在値を読み、前回読んだ値と型どおりに比較
+     * @return 未送信の変更があればtrue
+     */
+    bool Refresh() {
+        dirty_ = false;
+        bool changed = !has_sent_;
         if (type_ == kValueTypeBoolean) {
-            json_str += "\"type\":\"boolean\"";
+            bool value = boolean_getter_();
+            changed = changed || value != boolean_value_;
+            boolean_value_ = value;
         } else if (type_ == kValueTypeNumber) {
-            json_str += "\"type\":\"number\"";
+            int value = number_getter_();
+            changed = changed || value != number_value_;
+            number_value_ = value;
         } else if (type_ == kValueTypeString) {
-            json_str += "\"type\":\"string\"";
+            std::string value = string_getter_();
+            changed = changed || value != string_value_;
+            string_value_ = std::move(value);
         }
-        json_str += "}";
-        return json_str;
+        pending_ = pending_ || changed;
+        return pending_;
     }
 
-    std::string GetStateJson() {
+    void MarkSent() {
+        has_sent_ = true;
+        pending_ = false;
+    }
+
+    /** @brief Refresh()で読んだ値を書き込む（getterは呼ばない） */
+    void WriteState(JsonWriter& writer) const {
         if (type_ == kValueTypeBoolean) {
-            return boolean_getter_() ? "true" : "false";
+            writer.Bool(boolean_value_);
         } else if (type_ == kValueTypeNumber) {
-            return std::to_string(number_getter_());
-        } else if (type_ == kValueTypeString) {
-            return "\"" + string_getter_() + "\"";
+            writer.Number(number_value_);
+        } else {
+            writer.String(string_value_);
         }
-        return "null";
     }
+
+private:
+    std::string quoted_name_;
+
+    // 最後にRefresh()で読んだ値
+    bool boolean_value_ = false;
+    int number_value_ = 0;
+    std::string string_value_;
+    bool has_sent_ = false;
+    bool dirty_ = true;         // 最初のRefresh()では必ず読む
+    bool pending_ = false;
 };
 
 class PropertyList {
@@ -113,28 +178,72 @@ public:
         throw std::runtime_error("Property not found: " + name);
     }
 
-    std::string GetDescriptorJson() {
-        std::string json_str = "{";
+    void WriteDescriptor(JsonWriter& writer) const {
+        writer.BeginObject();
         for (auto& property : properties_) {
-            json_str += "\"" + property.name() + "\":" + property.GetDescriptorJson() + ",";
+            writer.Key(property.name());
+            property.WriteDescriptor(writer);
         }
-        if (json_str.back() == ',') {
-            json_str.pop_back();
+        writer.EndObject();
+    }
+
+    /** @brief nameのプロパティ（空ならすべて）を変更ありとして記録。該当があればtrue */
+    bool MarkDirty(const std::string& name = "") {
+        bool found = false;
+        for (auto& property : properties_) {
+            if (name.empty() || property.name() == name) {
+                property.MarkDirty();
+                found = true;
+            }
         }
-        json_str += "}";
-        return json_str;
+        return found;
     }
 
-    std::string GetStateJson() {
-        std::string json_str = "{";
+    bool dirty() const {
         for (auto& property : properties_) {
-            json_str += "\"" + property.name() + "\":" + property.GetStateJson() + ",";
+            if (property.dirty()) {
+                return true;
+            }
         }
-        if (json_str.back() == ',') {
-            json_str.pop_back();
+        return false;
+    }
+
+    /** @brief 変更ありのプロパティだけgetterを読み、未送信の変更が1つでもあればtrue */
+    bool Refresh() {
+        bool pending = false;
+        for (auto& property : properties_) {
+            if (property.dirty()) {
+                property.Refresh();
+            }
+            pending = pending || property.pending();
         }
-        json_str += "}";
-        return json_str;
+        return pending;
+    }
+
+    bool pending() const {
+        for (auto& property : properties_) {
+            if (property.pending()) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * @brief 状態を書き込み、書き込んだプロパティを送信済みにする
+     * @param pending_only trueなら未送信の変更があるプロパティのみ
+     */
+    void WriteState(JsonWriter& writer, bool pending_only) {
+        writer.BeginObject();
+        for (auto& property : properties_) {
+            if (pending_only && !property.pending()) {
+                continue;
+            }
+            writer.QuotedKey(property.quoted_name());
+            property.WriteState(writer);
+            property.MarkSent();
+        }
+        writer.EndObject();
     }
 };
 
@@ -165,55 +274,60 @@ public:
     void set_number(int value) { number_ = value; }
     void set_string(const std::string& value) { string_ = value; }
 
-    std::string GetDescriptorJson() {
-        std::string json_str = "{";
-        json_str += "\"description\":\"" + description_ + "\",";
-        if (type_ == kValueTypeBoolean) {
-            json_str += "\"type\":\"boolean\"";
-        } else if (type_ == kValueTypeNumber) {
-            json_str += "\"type\":\"number\"";
-        } else if (type_ == kValueTypeString) {
-            json_str += "\"type\":\"string\"";
-        }
-        json_str += "}";
-        return json_str;
+    void WriteDescriptor(JsonWriter& writer) const {
+        writer.BeginObject();
+        writer.Key("description");
+        writer.String(description_);
+        writer.Key("type");
+        writer.String(type_ == kValueTypeBoolean ? "boolean" : type_ == kValueTypeNumber ? "number" : "string");
+        writer.EndObject();
     }
 };
 
 class ParameterList {
 private:
     std::vector<Parameter> parameters_;
+    NameIndex<size_t> index_;   // 名前 → parameters_の位置
 
 public:
     ParameterList() = default;
-    ParameterList(const std::vector<Parameter>& parameters) : parameters_(parameters) {}
+    ParameterList(const std::vector<Parameter>& parameters) : parameters_(parameters) {
+        for (size_t i = 0; i < parameters_.size(); i++) {
+            index_.emplace(parameters_[i].name(), i);
+        }
+    }
     void AddParameter(const Parameter& parameter) {
+        index_.emplace(parameter.name(), parameters_.size());
         parameters_.push_back(parameter);
     }
 
     const Parameter& operator[](const std::string& name) const {
-        for (auto& parameter : parameters_) {
-            if (parameter.name() == name) {
-                return parameter;
-            }
+        int index = IndexOf(name);
+        if (index < 0) {
+            throw std::runtime_error("Parameter not found: " + name);
         }
-        throw std::runtime_error("Parameter not found: " + name);
+        return parameters_[index];
     }
 
+    /** @brief 名前の位置（なければ-1） */
+    int IndexOf(std::string_view name) const {
+        auto it = index_.find(name);
+        return it != index_.end() ? (int)it->second : -1;
+    }
+    Parameter& at(size_t index) { return parameters_[index]; }
+    size_t size() const { return parameters_.size(); }
+
     // iterator
     auto begin() { return parameters_.begin(); }
     auto end() { return parameters_.end(); }
 
-    std::string GetDescriptorJson() {
-        std::string json_str = "{";
+    void WriteDescriptor(JsonWriter& writer) const {
+        writer.BeginObject();
         for (auto& parameter : parameters_) {
-            json_str += "\"" + parameter.name() + "\":" + parameter.GetDescriptorJson() + ",";
+            writer.Key(parameter.name());
+            parameter.WriteDescriptor(writer);
         }
-        if (json_str.back() == ',') {
-            json_str.pop_back();
-        }
-        json_str += "}";
-        return json_str;
+        writer.EndObject();
     }
 };
 
@@ -232,12 +346,13 @@ public:
     const std::string& description() const { return description_; }
     ParameterList& parameters() { return parameters_; }
 
-    std::string GetDescriptorJson() {
-        std::string json_str = "{";
-        json_str += "\"description\":\"" + description_ + "\",";
-        json_str += "\"parameters\":" + parameters_.GetDescriptorJson();
-        json_str += "}";
-        return json_str;
+    void WriteDescriptor(JsonWriter& writer) const {
+        writer.BeginObject();
+        writer.Key("description");
+        writer.String(description_);
+        writer.Key("parameters");
+        parameters_.WriteDescriptor(writer);
+        writer.EndObject();
     }
 
     void Invoke() {
@@ -248,49 +363,86 @@ public:
 class MethodList {
 private:
     std::vector<Method> methods_;
+    NameIndex<size_t> index_;   // 名前 → methods_の位置（追加で再配置されても変わらない）
 
 public:
     MethodList() = default;
-    MethodList(const std::vector<Method>& methods) : methods_(methods) {}
+    MethodList(const std::vector<Method>& methods) : methods_(methods) {
+        for (size_t i = 0; i < methods_.size(); i++) {
+            index_.emplace(methods_[i].name(), i);
+        }
+    }
 
     void AddMethod(const std::string& name, const std::string& description, const ParameterList& parameters, std::function<void(const ParameterList&)> callback) {
+        index_.emplace(name, methods_.size());
         methods_.push_back(Method(name, description, parameters, callback));
     }
 
+    /** @brief 名前でメソッドを引く（なければnullptr） */
+    Method* Find(std::string_view name) {
+        auto it = index_.find(name);
+        return it != index_.end() ? &methods_[it->second] : nullptr;
+    }
+
     Method& operator[](const std::string& name) {
-        for (auto& method : methods_) {
-            if (method.name() == name) {
-                return method;
-            }
+        auto method = Find(name);
+        if (method == nullptr) {
+            throw std::runtime_error("Method not found: " + name);
         }
-        throw std::runtime_error("Method not found: " + name);
+        return *method;
     }
 
-    std::string GetDescriptorJson() {
-        std::string json_str = "{";
+    void WriteDescriptor(JsonWriter& writer) const {
+        writer.BeginObject();
         for (auto& method : methods_) {
-            json_str += "\"" + method.name() + "\":" + method.GetDescriptorJson() + ",";
-        }
-        if (json_str.back() == ',') {
-            json_str.pop_back();
+            writer.Key(method.name());
+            method.WriteDescriptor(writer);
         }
-        json_str += "}";
-        return json_str;
+        writer.EndObject();
     }
 };
 
 class Thing {
 public:
     Thing(const std::string& name, const std::string& description) :
-        name_(name), description_(description) {}
+        name_(name), description_(description), quoted_name_(JsonWriter::Quote(name)) {}
     virtual ~Thing() = default;
 
-    virtual std::string GetDescriptorJson();
-    virtual std::string GetStateJson();
+    virtual void WriteDescriptor(JsonWriter& writer);
+    /**
+     * @brief 変更ありのプロパティを読み直す（allならすべて）
+     * @return 未送信の変更があればtrue
+     */
+    virtual bool RefreshState(bool all = false);
+    /**
+     * @brief 状態を書き込み、送信済みとして記録
+     * @param pending_only trueなら未送信の変更があるプロパティのみ
+     */
+    virtual void WriteState(JsonWriter& writer, bool pending_only);
     virtual void Invoke(const cJSON* command);
 
+    /**
+     * @brief コマンドのメソッドを引き、引数を設定する（呼び出しはしない）
+     * @return 呼び出すメソッド。メソッドがない・必須の引数がない場合はnullptr
+     */
+    Method* BindCommand(const cJSON* command);
+
     const std::string& name() const { return name_; }
     const std::string& description() const { return description_; }
+    bool dirty() const { return properties_.dirty(); }
+    bool pending() const { return properties_.pending(); }
+
+    /** @brief 状態が変わったときの通知先（ThingManagerが設定する） */
+    void OnStateChanged(std::function<void()> callback) { on_state_changed_ = callback; }
+
+    /**
+     * @brief プロパティの値が変わったことを通知
+     * @param property プロパティ名（空ならすべて）
+     *
+     * 値は通知を受けた後にメインループで読み、変わったプロパティだけを送信します。
+     * getterの読み取り（I2Cなど）が会話開始の経路で発生しなくなります。
+     */
+    void NotifyStateChanged(const std::string& property = "");
 
 protected:
     PropertyList properties_;
@@ -299,6 +451,8 @@ protected:
 private:
     std::string name_;
     std::string description_;
+    std::string quoted_name_;   // 状態のJSONに書く名前（エスケープ済み）
+    std::function<void()> on_state_changed_;
 };
 
 
@@ -1,63 +1,158 @@
 #include "thing_manager.h"
+#include "application.h"
 
 #include <esp_log.h>
 
+#include <algorithm>
+#include <utility>
+
 #define TAG "ThingManager"
 
 namespace iot {
 
+ThingManager::~ThingManager() {
+    if (debounce_timer_ != nullptr) {
+        esp_timer_stop(debounce_timer_);
+        esp_timer_delete(debounce_timer_);
+    }
+}
+
 void ThingManager::AddThing(Thing* thing) {
+    if (!thing_index_.emplace(thing->name(), thing).second) {
+        ESP_LOGW(TAG, "Duplicate thing name: %s", thing->name().c_str());
+    }
     things_.push_back(thing);
+    descriptors_json_.clear();
+    thing->OnStateChanged([this]() {
+        ScheduleNotify();
+    });
+}
+
+void ThingManager::ScheduleNotify() {
+    if (debounce_timer_ == nullptr) {
+        esp_timer_create_args_t timer_args = {
+            .callback = [](void* arg) {
+                auto manager = (ThingManager*)arg;
+                if (manager->on_states_changed_) {
+                    manager->on_states_changed_();
+                }
+            },
+            .arg = this,
+            .dispatch_method = ESP_TIMER_TASK,
+            .name = "iot_state",
+            .skip_unhandled_events = true
+        };
+        esp_timer_create(&timer_args, &debounce_timer_);
+    }
+    // 待ち中の通知があればそれにまとめる
+    if (!esp_timer_is_active(debounce_timer_)) {
+        esp_timer_start_once(debounce_timer_, IOT_STATE_DEBOUNCE_MS * 1000);
+    }
 }
 
-std::string ThingManager::GetDescriptorsJson() {
-    std::string json_str = "[";
+bool ThingManager::RefreshStates() {
+    bool pending = false;
     for (auto& thing : things_) {
-        json_str += thing->GetDescriptorJson() + ",";
+        if (thing->dirty()) {
+            thing->RefreshState();
+        }
+        pending = pending || thing->pending();
     }
-    if (json_str.back() == ',') {
-        json_str.pop_back();
+    return pending;
+}
+
+void ThingManager::MarkAllDirty() {
+    for (auto& thing : things_) {
+        thing->NotifyStateChanged();
     }
-    json_str += "]";
-    return json_str;
 }
 
-bool ThingManager::GetStatesJson(std::string& json, bool delta) {
-    if (!delta) {
-        last_states_.clear();
+const std::string& ThingManager::GetDescriptorsJson() {
+    if (descriptors_json_.empty()) {
+        JsonWriter writer(descriptors_json_);
+        writer.BeginArray();
+        for (auto& thing : things_) {
+            thing->WriteDescriptor(writer);
+        }
+        writer.EndArray();
     }
+    return descriptors_json_;
+}
+
+bool ThingManager::UpdateStatesJson(bool delta) {
     bool changed = false;
-    json = "[";
-    // 枚举thing，获取每个thing的state，如果发生变化，则更新，保存到last_states_
-    // 如果delta为true，则只返回变化的部分
+    states_json_.clear();
+    JsonWriter writer(states_json_);
+    writer.BeginArray();
+    // deltaでは通知の後に読み込んだ値のうち、未送信のプロパティだけを書き込む
     for (auto& thing : things_) {
-        std::string state = thing->GetStateJson();
-        if (delta) {
-            // 如果delta为true，则只返回变化的部分
-            auto it = last_states_.find(thing->name());
-            if (it != last_states_.end() && it->second == state) {
-                continue;
-            }
-            changed = true;
-            last_states_[thing->name()] = state;
+        if (!delta) {
+            thing->RefreshState(true);
+        } else if (!thing->pending()) {
+            continue;
         }
-        json += state + ",";
+        thing->WriteState(writer, delta);
+        changed = true;
     }
-    if (json.back() == ',') {
-        json.pop_back();
-    }
-    json += "]";
+    writer.EndArray();
     return changed;
 }
 
-void ThingManager::Invoke(const cJSON* command) {
+Thing* ThingManager::FindThing(const cJSON* command) {
     auto name = cJSON_GetObjectItem(command, "name");
-    for (auto& thing : things_) {
-        if (thing->name() == name->valuestring) {
-            thing->Invoke(command);
+    if (!cJSON_IsString(name)) {
+        return nullptr;
+    }
+    auto it = thing_index_.find(std::string_view(name->valuestring));
+    if (it == thing_index_.end()) {
+        ESP_LOGW(TAG, "Thing not found: %s", name->valuestring);
+        return nullptr;
+    }
+    return it->second;
+}
+
+void ThingManager::Invoke(const cJSON* command) {
+    auto thing = FindThing(command);
+    if (thing != nullptr) {
+        thing->Invoke(command);
+    }
+}
+
+void ThingManager::InvokeCommands(const cJSON* commands) {
+    std::vector<std::pair<Thing*, Method*>> calls;
+    auto flush = [&calls]() {
+        if (calls.empty()) {
             return;
         }
+        Application::GetInstance().Schedule([calls = std::move(calls)]() {
+            for (auto& [thing, method] : calls) {
+                method->Invoke();
+                // メソッドは状態を変えることが多いため、すべてのプロパティを読み直す
+                thing->NotifyStateChanged();
+            }
+        });
+        calls.clear();
+    };
+
+    const cJSON* command;
+    cJSON_ArrayForEach(command, commands) {
+        auto thing = FindThing(command);
+        if (thing == nullptr) {
+            continue;
+        }
+        // 同じメソッドが続く場合は引数を上書きする前に、それまでの分を送り出す
+        auto method_name = cJSON_GetObjectItem(command, "method");
+        if (cJSON_IsString(method_name) && std::any_of(calls.begin(), calls.end(), [thing, method_name](auto& call) {
+                return call.first == thing && call.second->name() == method_name->valuestring;
+            })) {
+            flush();
+        }
+        auto method = thing->BindCommand(command);
+        if (method != nullptr) {
+            calls.emplace_back(thing, method);
+        }
     }
+    flush();
 }
 
 } // namespace iot
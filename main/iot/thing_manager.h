@@ -5,12 +5,16 @@
 #include "thing.h"
 
 #include <cJSON.h>
+#include <esp_timer.h>
 
 #include <vector>
 #include <memory>
 #include <functional>
 #include <map>
 
+/** @brief 状態変化の通知をまとめる時間（連続した変更を1回の送信にする） */
+#define IOT_STATE_DEBOUNCE_MS 500
+
 namespace iot {
 
 class ThingManager {
@@ -24,16 +28,54 @@ public:
 
     void AddThing(Thing* thing);
 
-    std::string GetDescriptorsJson();
-    bool GetStatesJson(std::string& json, bool delta = false);
+    // 記述子は登録後に変わらないため、最初の呼び出しで作ったものを返す（AddThingで作り直す）
+    const std::string& GetDescriptorsJson();
+    // 保持している記述子を捨てて作り直す（シリアライズのベンチマーク用）
+    const std::string& RebuildDescriptorsJson() {
+        descriptors_json_.clear();
+        return GetDescriptorsJson();
+    }
+    /**
+     * @brief 状態のJSONを内部バッファに作成（states_json()で取得）
+     * @param delta trueなら読み込み済みで未送信の変更があるプロパティのみ（getterは呼ばない）。
+     *              falseならすべてのプロパティを読み直して書き込む
+     * @return 送信すべき状態があればtrue
+     */
+    bool UpdateStatesJson(bool delta = false);
+    const std::string& states_json() const { return states_json_; }
     void Invoke(const cJSON* command);
 
+    /**
+     * @brief "commands"配列をまとめて実行
+     *
+     * 対象と引数は受信したタスクで索引を使って一度に解決し、メソッドの呼び出しは
+     * 1回のScheduleにまとめてメインループで順に行います。
+     */
+    void InvokeCommands(const cJSON* commands);
+
+    /** @brief 変更通知のあったプロパティを読み直す（メインループから呼ぶ）。未送信の変更があればtrue */
+    bool RefreshStates();
+
+    /** @brief 変更を通知しないプロパティ（電池残量など）を定期的に読み直すため、すべてを変更ありにする */
+    void MarkAllDirty();
+
+    /** @brief 通知をIOT_STATE_DEBOUNCE_MSまとめた後に呼ばれる（esp_timerタスクから） */
+    void OnStatesChanged(std::function<void()> callback) { on_states_changed_ = callback; }
+
 private:
     ThingManager() = default;
-    ~ThingManager() = default;
+    ~ThingManager();
 
     std::vector<Thing*> things_;
-    std::map<std::string, std::string> last_states_;
+    NameIndex<Thing*> thing_index_;     // 名前 → Thing（AddThingで登録）
+
+    Thing* FindThing(const cJSON* command);
+    esp_timer_handle_t debounce_timer_ = nullptr;
+    std::function<void()> on_states_changed_;
+
+    void ScheduleNotify();
+    std::string descriptors_json_;
+    std::string states_json_;   // 呼び出しごとに使い回す
 };
 
 
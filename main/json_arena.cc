@@ -0,0 +1,136 @@
+/**
+ * @file json_arena.cc
+ * @brief cJSON用アリーナの実装
+ */
+#include "json_arena.h"
+
+#include <cJSON.h>
+#include <esp_heap_caps.h>
+#include <esp_log.h>
+
+#include <cstdlib>
+
+#define TAG "JsonArena"
+
+/** @brief 切り出しの境界（cJSONのノードはdoubleを含む） */
+#define JSON_ARENA_ALIGN 8
+
+namespace {
+
+std::atomic<JsonArena*> registered_arenas[JSON_ARENA_MAX_COUNT];
+void* (*fallback_malloc)(size_t) = malloc;
+void (*fallback_free)(void*) = free;
+
+// このタスクが区間に入っているアリーナ
+thread_local JsonArena* current_arena = nullptr;
+
+} // namespace
+
+JsonArena::JsonArena(const char* name) : name_(name) {
+    size_t size = CONFIG_JSON_ARENA_SIZE_KB * 1024;
+    buffer_ = (uint8_t*)heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (buffer_ == nullptr) {
+        buffer_ = (uint8_t*)heap_caps_malloc(size, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    }
+    if (buffer_ == nullptr) {
+        ESP_LOGW(TAG, "Arena %s: failed to allocate %u bytes, using the heap", name_, size);
+        return;
+    }
+    size_ = size;
+    for (auto& slot : registered_arenas) {
+        JsonArena* expected = nullptr;
+        if (slot.compare_exchange_strong(expected, this)) {
+            return;
+        }
+    }
+    // 解放時に所属を判定できないアリーナからは切り出さない
+    ESP_LOGW(TAG, "Arena %s: more than %d arenas, using the heap", name_, JSON_ARENA_MAX_COUNT);
+    heap_caps_free(buffer_);
+    buffer_ = nullptr;
+    size_ = 0;
+}
+
+JsonArena::~JsonArena() {
+    for (auto& slot : registered_arenas) {
+        JsonArena* expected = this;
+        slot.compare_exchange_strong(expected, nullptr);
+    }
+    if (buffer_ != nullptr) {
+        heap_caps_free(buffer_);
+    }
+}
+
+void JsonArena::InstallHooks() {
+    cJSON_Hooks hooks = {
+        .malloc_fn = HookMalloc,
+        .free_fn = HookFree,
+    };
+    cJSON_InitHooks(&hooks);
+}
+
+void JsonArena::SetFallback(void* (*malloc_fn)(size_t), void (*free_fn)(void*)) {
+    fallback_malloc = malloc_fn;
+    fallback_free = free_fn;
+}
+
+void* JsonArena::Allocate(size_t size) {
+    size_t aligned = (size + JSON_ARENA_ALIGN - 1) & ~(size_t)(JSON_ARENA_ALIGN - 1);
+    if (used_ + aligned > size_) {
+        if (overflow_count_++ == 0) {
+            ESP_LOGW(TAG, "Arena %s full (%u bytes), falling back to the heap", name_, size_);
+        }
+        return nullptr;
+    }
+    void* ptr = buffer_ + used_;
+    used_ += aligned;
+    return ptr;
+}
+
+void* JsonArena::HookMalloc(size_t size) {
+    JsonArena* arena = current_arena;
+    if (arena != nullptr) {
+        void* ptr = arena->Allocate(size);
+        if (ptr != nullptr) {
+            return ptr;
+        }
+    }
+    return fallback_malloc(size);
+}
+
+void JsonArena::HookFree(void* ptr) {
+    if (ptr == nullptr) {
+        return;
+    }
+    // アリーナの中の領域は区間の終わりにまとめて戻す
+    for (auto& slot : registered_arenas) {
+        JsonArena* arena = slot.load(std::memory_order_relaxed);
+        if (arena != nullptr && arena->Contains(ptr)) {
+            return;
+        }
+    }
+    fallback_free(ptr);
+}
+
+JsonArenaScope::JsonArenaScope(JsonArena& arena) {
+    if (current_arena != nullptr || arena.buffer_ == nullptr) {
+        return;
+    }
+    TaskHandle_t expected = nullptr;
+    if (!arena.owner_.compare_exchange_strong(expected, xTaskGetCurrentTaskHandle())) {
+        return;
+    }
+    arena_ = &arena;
+    current_arena = &arena;
+}
+
+JsonArenaScope::~JsonArenaScope() {
+    if (arena_ == nullptr) {
+        return;
+    }
+    if (arena_->used_ > arena_->peak_) {
+        arena_->peak_ = arena_->used_;
+    }
+    arena_->used_ = 0;
+    current_arena = nullptr;
+    arena_->owner_.store(nullptr);
+}
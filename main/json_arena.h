@@ -0,0 +1,109 @@
+/**
+ * @file json_arena.h
+ * @brief 1メッセージ分のcJSONの確保をまとめるアリーナ
+ *
+ * 受信したテキストフレームのcJSON_Parse()や、送信するメッセージの組み立てでは、
+ * 小さなmallocが数十回起こり、内部SRAMを断片化させます。JSON_ARENA_SCOPE() で囲んだ区間では、
+ * そのタスクからのcJSONの確保をアリーナの先頭から順に切り出し（バンプアロケーション）、
+ * cJSON_Delete()/cJSON_free()は何もしません。区間を抜けるとアリーナ全体をまとめて戻すため、
+ * 後に断片が残りません。
+ *
+ * 区間の外へcJSONのノードや cJSON_Print() の結果を持ち出してはいけません（std::stringへ
+ * コピーしてから解放する既存の書き方はそのまま使えます）。アリーナが足りない分と、
+ * 別のタスクが使用中のときは、通常のヒープから確保します。
+ *
+ * 無効時（CONFIG_USE_JSON_ARENA=n）は JSON_ARENA_SCOPE() が空になり、コストはありません。
+ */
+#ifndef JSON_ARENA_H
+#define JSON_ARENA_H
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#if CONFIG_USE_JSON_ARENA
+#define JSON_ARENA_CONCAT_(a, b) a##b
+#define JSON_ARENA_CONCAT(a, b) JSON_ARENA_CONCAT_(a, b)
+/** @brief スコープの終わりまで、このタスクのcJSONの確保をarenaから行う */
+#define JSON_ARENA_SCOPE(arena) JsonArenaScope JSON_ARENA_CONCAT(json_arena_scope_, __LINE__)(arena)
+#else
+#define JSON_ARENA_SCOPE(arena) do {} while (0)
+#endif
+
+/** @brief 登録できるアリーナの最大数（解放時の所属判定はこの数だけ走査する） */
+#define JSON_ARENA_MAX_COUNT 8
+
+/**
+ * @class JsonArena
+ * @brief 1つのメッセージ経路（受信、送信など）が持つバンプアロケータ
+ *
+ * バッファは生成時にPSRAM（なければ内部SRAM）へ CONFIG_JSON_ARENA_SIZE_KB 確保します。
+ * 同時に使えるのは1つのタスクだけで、使用中に別のタスクが区間に入ると、そのタスクは通常のヒープを使います。
+ */
+class JsonArena {
+public:
+    /** @param name ログ用の名前（文字列リテラル） */
+    explicit JsonArena(const char* name);
+    ~JsonArena();
+
+    JsonArena(const JsonArena&) = delete;
+    JsonArena& operator=(const JsonArena&) = delete;
+
+    /**
+     * @brief cJSONのアロケータフックを設定（最初のcJSON使用より前に1回呼ぶ）
+     *
+     * 区間の外の確保はフォールバック（既定はmalloc/free）へ渡します。
+     */
+    static void InstallHooks();
+
+    /** @brief 区間の外とあふれた分の確保に使う関数を設定（HeapMonitorの計数フックなど） */
+    static void SetFallback(void* (*malloc_fn)(size_t), void (*free_fn)(void*));
+
+    /** @brief これまでの最大使用量（バイト） */
+    size_t peak() const { return peak_; }
+    /** @brief アリーナに入りきらずヒープから確保した回数 */
+    uint32_t overflow_count() const { return overflow_count_; }
+
+private:
+    friend class JsonArenaScope;
+
+    const char* name_;
+    uint8_t* buffer_ = nullptr;
+    size_t size_ = 0;
+    size_t used_ = 0;
+    size_t peak_ = 0;
+    uint32_t overflow_count_ = 0;
+    std::atomic<TaskHandle_t> owner_{nullptr};      /**< 区間に入っているタスク */
+
+    void* Allocate(size_t size);
+    bool Contains(const void* ptr) const {
+        return buffer_ != nullptr && (const uint8_t*)ptr >= buffer_ && (const uint8_t*)ptr < buffer_ + size_;
+    }
+
+    static void* HookMalloc(size_t size);
+    static void HookFree(void* ptr);
+};
+
+/**
+ * @class JsonArenaScope
+ * @brief 区間の間、このタスクのcJSONの確保をアリーナから行う（JSON_ARENA_SCOPE()から使う）
+ *
+ * 入れ子になった区間は外側のアリーナをそのまま使い、外側の区間を抜けるときにだけ戻します。
+ * 内側の区間の結果を外側で使っても、外側が終わるまでは有効です。
+ */
+class JsonArenaScope {
+public:
+    explicit JsonArenaScope(JsonArena& arena);
+    ~JsonArenaScope();
+
+    JsonArenaScope(const JsonArenaScope&) = delete;
+    JsonArenaScope& operator=(const JsonArenaScope&) = delete;
+
+private:
+    JsonArena* arena_ = nullptr;        /**< この区間で使い始めたアリーナ（入れ子や使用中ならnullptr） */
+};
+
+#endif // JSON_ARENA_H
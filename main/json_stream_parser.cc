@@ -0,0 +1,339 @@
+/**
+ * @file json_stream_parser.cc
+ * @brief 逐次JSONパーサーの実装
+ */
+#include "json_stream_parser.h"
+
+#include <esp_log.h>
+
+#include <cstdlib>
+#include <cstring>
+
+#define TAG "JsonStreamParser"
+
+static int HexValue(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+JsonStreamParser::JsonStreamParser(Callback callback)
+    : callback_(callback), value_(new char[JSON_STREAM_MAX_VALUE + 1]) {
+}
+
+bool JsonStreamParser::Feed(const char* data, size_t size) {
+    for (size_t i = 0; i < size && state_ != kStateError; i++) {
+        Consume(data[i]);
+    }
+    return state_ != kStateError;
+}
+
+bool JsonStreamParser::Finish() {
+    // 最上位が数値だけの文書は区切りの文字が来ないので、ここで確定させる
+    if (state_ == kStateLiteral && depth_ == 0) {
+        EndLiteral();
+    }
+    if (state_ != kStateDone) {
+        if (state_ != kStateError) {
+            ESP_LOGE(TAG, "Unexpected end of input at depth %d", depth_);
+        }
+        return false;
+    }
+    return true;
+}
+
+const char* JsonStreamParser::key(int level) const {
+    if (level < 0 || level >= depth_ || !frames_[level].is_object) {
+        return "";
+    }
+    return frames_[level].key;
+}
+
+int JsonStreamParser::index(int level) const {
+    if (level < 0 || level >= depth_ || frames_[level].is_object) {
+        return -1;
+    }
+    return frames_[level].index;
+}
+
+bool JsonStreamParser::Match(std::initializer_list<const char*> keys) const {
+    if ((int)keys.size() != depth_) {
+        return false;
+    }
+    int level = 0;
+    for (auto k : keys) {
+        if (strcmp(key(level++), k) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void JsonStreamParser::Consume(char c) {
+    switch (state_) {
+    case kStateString:
+        if (c == '"') {
+            EndString();
+        } else if (c == '\\') {
+            state_ = kStateEscape;
+        } else if ((uint8_t)c < 0x20) {
+            Fail(c);
+        } else {
+            Append(c);
+        }
+        return;
+    case kStateEscape:
+        state_ = kStateString;
+        switch (c) {
+        case '"':
+        case '\\':
+        case '/':
+            Append(c);
+            break;
+        case 'b':
+            Append('\b');
+            break;
+        case 'f':
+            Append('\f');
+            break;
+        case 'n':
+            Append('\n');
+            break;
+        case 'r':
+            Append('\r');
+            break;
+        case 't':
+            Append('\t');
+            break;
+        case 'u':
+            unicode_ = 0;
+            unicode_digits_ = 0;
+            state_ = kStateUnicode;
+            break;
+        default:
+            Fail(c);
+            break;
+        }
+        return;
+    case kStateUnicode: {
+        int digit = HexValue(c);
+        if (digit < 0) {
+            Fail(c);
+            return;
+        }
+        unicode_ = (unicode_ << 4) | digit;
+        if (++unicode_digits_ == 4) {
+            AppendCodePoint(unicode_);
+            state_ = kStateString;
+        }
+        return;
+    }
+    case kStateLiteral:
+        if ((c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || c == '+' || c == '-' || c == '.' || c == 'E') {
+            Append(c);
+            return;
+        }
+        // リテラルは区切りの文字で終わるので、確定させてからその文字を処理する
+        EndLiteral();
+        if (state_ == kStateError) {
+            return;
+        }
+        break;
+    default:
+        break;
+    }
+
+    if (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+        return;
+    }
+
+    switch (state_) {
+    case kStateValueOrEnd:
+        if (c == ']') {
+            EndContainer();
+            return;
+        }
+        BeginValue(c);
+        return;
+    case kStateValue:
+        BeginValue(c);
+        return;
+    case kStateKeyOrEnd:
+        if (c == '}') {
+            EndContainer();
+            return;
+        }
+        // fallthrough
+    case kStateKey:
+        if (c != '"') {
+            Fail(c);
+            return;
+        }
+        string_is_key_ = true;
+        length_ = 0;
+        overflow_ = false;
+        state_ = kStateString;
+        return;
+    case kStateColon:
+        if (c != ':') {
+            Fail(c);
+            return;
+        }
+        state_ = kStateValue;
+        return;
+    case kStateCommaOrEnd: {
+        auto& frame = frames_[depth_ - 1];
+        if (c == ',') {
+            if (frame.is_object) {
+                state_ = kStateKey;
+            } else {
+                frame.index++;
+                state_ = kStateValue;
+            }
+        } else if (c == (frame.is_object ? '}' : ']')) {
+            EndContainer();
+        } else {
+            Fail(c);
+        }
+        return;
+    }
+    default:
+        // 文書の後に続くデータ
+        Fail(c);
+        return;
+    }
+}
+
+void JsonStreamParser::BeginValue(char c) {
+    if (c == '{' || c == '[') {
+        if (depth_ == JSON_STREAM_MAX_DEPTH) {
+            ESP_LOGE(TAG, "Nesting deeper than %d", JSON_STREAM_MAX_DEPTH);
+            state_ = kStateError;
+            return;
+        }
+        bool is_object = c == '{';
+        Emit(is_object ? kJsonStreamObjectBegin : kJsonStreamArrayBegin, nullptr, 0);
+        auto& frame = frames_[depth_++];
+        frame.is_object = is_object;
+        frame.index = 0;
+        frame.key[0] = '\0';
+        state_ = is_object ? kStateKeyOrEnd : kStateValueOrEnd;
+    } else if (c == '"') {
+        string_is_key_ = false;
+        length_ = 0;
+        overflow_ = false;
+        state_ = kStateString;
+    } else if ((c >= '0' && c <= '9') || c == '-' || c == 't' || c == 'f' || c == 'n') {
+        length_ = 0;
+        overflow_ = false;
+        Append(c);
+        state_ = kStateLiteral;
+    } else {
+        Fail(c);
+    }
+}
+
+void JsonStreamParser::EndString() {
+    value_[length_] = '\0';
+    if (string_is_key_) {
+        auto& frame = frames_[depth_ - 1];
+        size_t length = length_ < JSON_STREAM_MAX_KEY - 1 ? length_ : JSON_STREAM_MAX_KEY - 1;
+        memcpy(frame.key, value_.get(), length);
+        frame.key[length] = '\0';
+        state_ = kStateColon;
+        return;
+    }
+    if (overflow_) {
+        ESP_LOGW(TAG, "Skip a string longer than %d bytes under \"%s\"", JSON_STREAM_MAX_VALUE,
+            depth_ > 0 ? key(depth_ - 1) : "");
+    } else {
+        Emit(kJsonStreamString, value_.get(), length_);
+    }
+    AfterValue();
+}
+
+void JsonStreamParser::EndLiteral() {
+    value_[length_] = '\0';
+    const char* text = value_.get();
+    if (overflow_) {
+        Fail(text[0]);
+        return;
+    }
+    if (strcmp(text, "true") == 0 || strcmp(text, "false") == 0) {
+        Emit(kJsonStreamBool, text, length_);
+    } else if (strcmp(text, "null") == 0) {
+        Emit(kJsonStreamNull, text, length_);
+    } else {
+        char* end;
+        strtod(text, &end);
+        if (end != text + length_) {
+            Fail(text[0]);
+            return;
+        }
+        Emit(kJsonStreamNumber, text, length_);
+    }
+    AfterValue();
+}
+
+void JsonStreamParser::EndContainer() {
+    bool is_object = frames_[--depth_].is_object;
+    Emit(is_object ? kJsonStreamObjectEnd : kJsonStreamArrayEnd, nullptr, 0);
+    AfterValue();
+}
+
+void JsonStreamParser::AfterValue() {
+    state_ = depth_ == 0 ? kStateDone : kStateCommaOrEnd;
+}
+
+void JsonStreamParser::Append(char c) {
+    if (length_ == JSON_STREAM_MAX_VALUE) {
+        overflow_ = true;
+        return;
+    }
+    value_[length_++] = c;
+}
+
+void JsonStreamParser::AppendCodePoint(uint32_t code_point) {
+    // サロゲートペアは上位を覚えておき、下位が来たら1つの文字にまとめる
+    if (code_point >= 0xD800 && code_point < 0xDC00) {
+        high_surrogate_ = code_point;
+        return;
+    }
+    if (code_point >= 0xDC00 && code_point < 0xE000 && high_surrogate_ != 0) {
+        code_point = 0x10000 + ((high_surrogate_ - 0xD800) << 10) + (code_point - 0xDC00);
+    }
+    high_surrogate_ = 0;
+    if (code_point < 0x80) {
+        Append(code_point);
+    } else if (code_point < 0x800) {
+        Append(0xC0 | (code_point >> 6));
+        Append(0x80 | (code_point & 0x3F));
+    } else if (code_point < 0x10000) {
+        Append(0xE0 | (code_point >> 12));
+        Append(0x80 | ((code_point >> 6) & 0x3F));
+        Append(0x80 | (code_point & 0x3F));
+    } else {
+        Append(0xF0 | (code_point >> 18));
+        Append(0x80 | ((code_point >> 12) & 0x3F));
+        Append(0x80 | ((code_point >> 6) & 0x3F));
+        Append(0x80 | (code_point & 0x3F));
+    }
+}
+
+void JsonStreamParser::Emit(JsonStreamEvent event, const char* value, size_t length) {
+    if (callback_) {
+        callback_(*this, event, value, length);
+    }
+}
+
+void JsonStreamParser::Fail(char c) {
+    ESP_LOGE(TAG, "Unexpected character 0x%02x at depth %d", (uint8_t)c, depth_);
+    state_ = kStateError;
+}
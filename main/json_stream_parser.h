@@ -0,0 +1,131 @@
+/**
+ * @file json_stream_parser.h
+ * @brief 受信しながらJSONを解析する逐次パーサー
+ *
+ * HTTPの応答を全て文字列に読み込んでからcJSONの木を作ると、応答の本体と木の両方が
+ * 同時にヒープに載ります。このパーサーは受け取った分だけを1文字ずつ解析し、値が
+ * 確定するたびにコールバックへ渡すため、保持するのは入れ子のキーと値1つ分の
+ * 固定長のバッファだけです。
+ *
+ * コールバックの中ではdepth()/key()/index()で値の位置を調べます。
+ * 例えば {"mqtt": {"endpoint": "x"}} の "x" は depth()==2、key(0)=="mqtt"、key(1)=="endpoint"。
+ * オブジェクトと配列は開始と終了も通知され、その位置は中の値より1段浅くなります。
+ */
+#ifndef JSON_STREAM_PARSER_H
+#define JSON_STREAM_PARSER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+
+/** @brief 入れ子の最大の深さ（超える文書は解析エラー） */
+#define JSON_STREAM_MAX_DEPTH 8
+
+/** @brief 位置の判定に使うキーの最大長（超える分は切り詰める） */
+#define JSON_STREAM_MAX_KEY 32
+
+/** @brief 1つの値の最大長（超える値は通知せずに読み飛ばす） */
+#define JSON_STREAM_MAX_VALUE 1024
+
+/** @brief コールバックに通知する出来事 */
+enum JsonStreamEvent : uint8_t {
+    kJsonStreamString,          /**< 文字列（エスケープ展開済み、UTF-8） */
+    kJsonStreamNumber,          /**< 数値（元の表記のまま） */
+    kJsonStreamBool,            /**< "true" または "false" */
+    kJsonStreamNull,
+    kJsonStreamObjectBegin,
+    kJsonStreamObjectEnd,
+    kJsonStreamArrayBegin,
+    kJsonStreamArrayEnd,
+};
+
+/**
+ * @class JsonStreamParser
+ * @brief 逐次JSONパーサー
+ *
+ * Feed()に受信したデータを順に渡し、最後にFinish()で文書が完結したかを確かめます。
+ * コールバックはFeed()/Finish()の中から呼ばれます。
+ */
+class JsonStreamParser {
+public:
+    /**
+     * @param value 値の文字列（NUL終端、オブジェクトと配列の開始・終了ではnullptr）
+     */
+    using Callback = std::function<void(const JsonStreamParser& parser, JsonStreamEvent event,
+        const char* value, size_t length)>;
+
+    explicit JsonStreamParser(Callback callback);
+    JsonStreamParser(const JsonStreamParser&) = delete;
+    JsonStreamParser& operator=(const JsonStreamParser&) = delete;
+
+    /**
+     * @brief 受信したデータを解析
+     * @return 構文エラーがあればfalse（以後のデータは無視する）
+     */
+    bool Feed(const char* data, size_t size);
+
+    /** @brief 入力の終わりを通知し、1つの文書が完結していればtrue */
+    bool Finish();
+
+    /** @brief 通知中の値を囲むオブジェクトと配列の数 */
+    int depth() const { return depth_; }
+
+    /** @brief level段目のオブジェクト内でのキー（配列なら""） */
+    const char* key(int level) const;
+
+    /** @brief level段目の配列内での添字（オブジェクトなら-1） */
+    int index(int level) const;
+
+    /** @brief 位置がkeysと一致するか（例: Match({"websocket", "urls"})） */
+    bool Match(std::initializer_list<const char*> keys) const;
+
+private:
+    enum State : uint8_t {
+        kStateValue,            /**< 値を待つ */
+        kStateValueOrEnd,       /**< '[' の直後 */
+        kStateKey,              /**< ',' の後のキーを待つ */
+        kStateKeyOrEnd,         /**< '{' の直後 */
+        kStateColon,
+        kStateCommaOrEnd,
+        kStateString,
+        kStateEscape,
+        kStateUnicode,
+        kStateLiteral,          /**< 数値、true、false、null */
+        kStateDone,
+        kStateError,
+    };
+
+    struct Frame {
+        bool is_object;
+        int index;
+        char key[JSON_STREAM_MAX_KEY];
+    };
+
+    Callback callback_;
+    State state_ = kStateValue;
+    Frame frames_[JSON_STREAM_MAX_DEPTH];
+    int depth_ = 0;
+
+    std::unique_ptr<char[]> value_;     /**< 解析中の文字列またはリテラル（JSON_STREAM_MAX_VALUE + 1） */
+    size_t length_ = 0;
+    bool overflow_ = false;
+    bool string_is_key_ = false;
+    uint32_t unicode_ = 0;
+    uint32_t high_surrogate_ = 0;
+    int unicode_digits_ = 0;
+
+    void Consume(char c);
+    void BeginValue(char c);
+    void EndString();
+    void EndLiteral();
+    void EndContainer();
+    void AfterValue();
+    void Append(char c);
+    void AppendCodePoint(uint32_t code_point);
+    void Emit(JsonStreamEvent event, const char* value, size_t length);
+    void Fail(char c);
+};
+
+#endif // JSON_STREAM_PARSER_H
@@ -0,0 +1,164 @@
+/**
+ * @file latency_trace.cc
+ * @brief 会話レイテンシ計測用トレースリングの実装
+ */
+#include "latency_trace.h"
+
+#include <cstdio>
+#include <cJSON.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#if CONFIG_USE_METRICS
+#include "metrics.h"
+#endif
+
+#define TAG "LatencyTrace"
+
+/** @brief tts start で再計測する応答側ステージ */
+#define LATENCY_RESPONSE_STAGES ((1u << kLatencyFirstAudioReceived) | \
+                                 (1u << kLatencyFirstAudioDecoded) | \
+                                 (1u << kLatencyFirstAudioOutput))
+
+#if CONFIG_USE_METRICS
+static const uint32_t kResponseBoundsUs[] = {50000, 100000, 200000, 300000, 500000, 750000, 1000000, 2000000, 5000000};
+static MetricHistogram metric_response_latency("xiaozhi_tts_first_output_latency_us",
+    "Time from tts start to the first decoded audio reaching the codec",
+    kResponseBoundsUs, sizeof(kResponseBoundsUs) / sizeof(kResponseBoundsUs[0]));
+#endif
+
+const char* LatencyTrace::StageName(LatencyStage stage) {
+    switch (stage) {
+    case kLatencyWakeWordDetected:
+        return "wake_word";
+    case kLatencyWakeWordEncoded:
+        return "wake_word_encoded";
+    case kLatencyChannelConnected:
+        return "connected";
+    case kLatencyServerHello:
+        return "server_hello";
+    case kLatencyFirstAudioSent:
+        return "first_audio_sent";
+    case kLatencyTtsStart:
+        return "tts_start";
+    case kLatencyFirstAudioReceived:
+        return "first_audio_received";
+    case kLatencyFirstAudioDecoded:
+        return "first_audio_decoded";
+    case kLatencyFirstAudioOutput:
+        return "first_audio_output";
+    default:
+        return "unknown";
+    }
+}
+
+void LatencyTrace::BeginSession(LatencyStage stage) {
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&lock_);
+    session_++;
+    session_start_us_ = now;
+    portEXIT_CRITICAL(&lock_);
+    first_marks_.store(1u << stage, std::memory_order_relaxed);
+    Record(stage);
+}
+
+void LatencyTrace::Mark(LatencyStage stage) {
+    if (stage == kLatencyTtsStart) {
+        first_marks_.fetch_and(~LATENCY_RESPONSE_STAGES, std::memory_order_relaxed);
+    }
+    Record(stage);
+}
+
+void LatencyTrace::Record(LatencyStage stage) {
+    int64_t now = esp_timer_get_time();
+    int64_t tts_start_us;
+    portENTER_CRITICAL(&lock_);
+    events_[next_] = {session_, stage, now};
+    next_ = (next_ + 1) % LATENCY_TRACE_CAPACITY;
+    if (count_ < LATENCY_TRACE_CAPACITY) {
+        count_++;
+    }
+    if (stage == kLatencyTtsStart) {
+        tts_start_us_ = now;
+    }
+    tts_start_us = tts_start_us_;
+    portEXIT_CRITICAL(&lock_);
+
+#if CONFIG_USE_METRICS
+    if (stage == kLatencyFirstAudioOutput && tts_start_us != 0) {
+        metric_response_latency.Observe((uint32_t)(now - tts_start_us));
+    }
+#else
+    (void)tts_start_us;
+#endif
+}
+
+void LatencyTrace::LogSession() const {
+    Event events[LATENCY_TRACE_CAPACITY];
+    size_t count;
+    size_t start;
+    uint32_t session;
+    int64_t session_start_us;
+    portENTER_CRITICAL(&lock_);
+    count = count_;
+    start = (next_ + LATENCY_TRACE_CAPACITY - count_) % LATENCY_TRACE_CAPACITY;
+    for (size_t i = 0; i < count; ++i) {
+        events[i] = events_[(start + i) % LATENCY_TRACE_CAPACITY];
+    }
+    session = session_;
+    session_start_us = session_start_us_;
+    portEXIT_CRITICAL(&lock_);
+
+    char line[384];
+    int len = snprintf(line, sizeof(line), "Session %lu:", session);
+    for (size_t i = 0; i < count && len < (int)sizeof(line); ++i) {
+        if (events[i].session != session) {
+            continue;
+        }
+        len += snprintf(line + len, sizeof(line) - len, " %s=+%lldms", StageName(events[i].stage),
+            (events[i].time_us - session_start_us) / 1000);
+    }
+    ESP_LOGI(TAG, "%s", line);
+}
+
+std::string LatencyTrace::ToJson() const {
+    Event events[LATENCY_TRACE_CAPACITY];
+    size_t count;
+    size_t start;
+    portENTER_CRITICAL(&lock_);
+    count = count_;
+    start = (next_ + LATENCY_TRACE_CAPACITY - count_) % LATENCY_TRACE_CAPACITY;
+    for (size_t i = 0; i < count; ++i) {
+        events[i] = events_[(start + i) % LATENCY_TRACE_CAPACITY];
+    }
+    portEXIT_CRITICAL(&lock_);
+
+    // セッションごとに開始時刻からの経過時間へ変換する
+    cJSON* root = cJSON_CreateObject();
+    cJSON* sessions = cJSON_CreateArray();
+    cJSON* current = nullptr;
+    uint32_t current_session = 0;
+    int64_t current_start_us = 0;
+    for (size_t i = 0; i < count; ++i) {
+        auto& event = events[i];
+        if (current == nullptr || event.session != current_session) {
+            current = cJSON_CreateObject();
+            cJSON_AddNumberToObject(current, "session", event.session);
+            cJSON_AddNumberToObject(current, "start_ms", event.time_us / 1000);
+            cJSON_AddItemToObject(current, "stages", cJSON_CreateArray());
+            cJSON_AddItemToArray(sessions, current);
+            current_session = event.session;
+            current_start_us = event.time_us;
+        }
+        cJSON* item = cJSON_CreateObject();
+        cJSON_AddStringToObject(item, "stage", StageName(event.stage));
+        cJSON_AddNumberToObject(item, "offset_ms", (event.time_us - current_start_us) / 1000);
+        cJSON_AddItemToArray(cJSON_GetObjectItem(current, "stages"), item);
+    }
+    cJSON_AddItemToObject(root, "sessions", sessions);
+
+    char* json = cJSON_PrintUnformatted(root);
+    std::string result(json);
+    cJSON_free(json);
+    cJSON_Delete(root);
+    return result;
+}
@@ -0,0 +1,99 @@
+/**
+ * @file latency_trace.h
+ * @brief 会話レイテンシ計測用のトレースリング
+ *
+ * ウェイクワード検出から最初のTTS音声出力までの主要ステージに時刻を記録し、
+ * 固定長のリングバッファに保持します。内容はログまたはMCPツールから取得できます。
+ */
+#ifndef LATENCY_TRACE_H
+#define LATENCY_TRACE_H
+
+#include <freertos/FreeRTOS.h>
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+/** @brief 保持するイベント数 */
+#define LATENCY_TRACE_CAPACITY 64
+
+/** @brief 計測ステージ */
+enum LatencyStage : uint8_t {
+    kLatencyWakeWordDetected,     /**< ウェイクワード検出 / 手動開始 */
+    kLatencyWakeWordEncoded,      /**< ウェイクワード音声のエンコード完了 */
+    kLatencyChannelConnected,     /**< サーバー接続完了 */
+    kLatencyServerHello,          /**< サーバーhello受信 */
+    kLatencyFirstAudioSent,       /**< 最初の音声パケット送信 */
+    kLatencyTtsStart,             /**< tts start 受信 */
+    kLatencyFirstAudioReceived,   /**< 最初の受信音声パケット */
+    kLatencyFirstAudioDecoded,    /**< 最初のデコード完了 */
+    kLatencyFirstAudioOutput,     /**< 最初のコーデック出力 */
+    kLatencyStageCount,
+};
+
+/**
+ * @class LatencyTrace
+ * @brief ステージ時刻を記録するシングルトン
+ *
+ * Mark()/MarkFirst()は任意のタスクから呼び出せます。MarkFirst()は同じセッション
+ * （tts start以降のステージは同じ応答）で最初の1回のみ記録するため、音声処理の
+ * ホットパスに置いても2回目以降はアトミック読み出し1回で戻ります。
+ */
+class LatencyTrace {
+public:
+    static LatencyTrace& GetInstance() {
+        static LatencyTrace instance;
+        return instance;
+    }
+
+    LatencyTrace(const LatencyTrace&) = delete;
+    LatencyTrace& operator=(const LatencyTrace&) = delete;
+
+    /** @brief 新しいセッションを開始し、開始ステージを記録 */
+    void BeginSession(LatencyStage stage = kLatencyWakeWordDetected);
+
+    /** @brief ステージを記録（tts startは応答側の「最初」フラグもリセット） */
+    void Mark(LatencyStage stage);
+
+    /** @brief セッション内で最初の1回のみ記録 */
+    void MarkFirst(LatencyStage stage) {
+        uint32_t bit = 1u << stage;
+        if (first_marks_.load(std::memory_order_relaxed) & bit) {
+            return;
+        }
+        if (first_marks_.fetch_or(bit, std::memory_order_relaxed) & bit) {
+            return;
+        }
+        Record(stage);
+    }
+
+    /** @brief 直近のセッションの各ステージをセッション開始からの経過時間でログ出力 */
+    void LogSession() const;
+
+    /** @brief 全イベントをJSON形式で取得（MCPツール用） */
+    std::string ToJson() const;
+
+    static const char* StageName(LatencyStage stage);
+
+private:
+    LatencyTrace() = default;
+
+    struct Event {
+        uint32_t session;
+        LatencyStage stage;
+        int64_t time_us;
+    };
+
+    mutable portMUX_TYPE lock_ = portMUX_INITIALIZER_UNLOCKED;
+    Event events_[LATENCY_TRACE_CAPACITY] = {};
+    size_t next_ = 0;                   /**< 次に書き込む位置 */
+    size_t count_ = 0;                  /**< 有効なイベント数 */
+    uint32_t session_ = 0;              /**< 現在のセッション番号 */
+    int64_t session_start_us_ = 0;      /**< 現在のセッション開始時刻 */
+    int64_t tts_start_us_ = 0;          /**< 直近のtts startの時刻（応答レイテンシのメトリクス用） */
+    std::atomic<uint32_t> first_marks_{0};
+
+    void Record(LatencyStage stage);
+};
+
+#endif // LATENCY_TRACE_H
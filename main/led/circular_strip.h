@@ -10,10 +10,8 @@
 #define _CIRCULAR_STRIP_H_
 
 #include "led.h"
+#include "led_animation.h"
 #include <driver/gpio.h>
-#include <led_strip.h>
-#include <esp_timer.h>
-#include <atomic>
 #include <mutex>
 #include <vector>
 
@@ -21,23 +19,13 @@
 #define DEFAULT_BRIGHTNESS 32  /**< 標準明るさレベル */
 #define LOW_BRIGHTNESS 4       /**< 低明るさレベル */
 
-/**
- * @struct StripColor
- * @brief LEDストリップの色情報を表す構造体
- */
-struct StripColor {
-    uint8_t red = 0;    /**< 赤色成分（0-255） */
-    uint8_t green = 0;  /**< 緑色成分（0-255） */
-    uint8_t blue = 0;   /**< 青色成分（0-255） */
-};
-
 /**
  * @class CircularStrip
  * @brief 円形LEDストリップ制御クラス
  * 
  * WS2812BなどのアドレッサブルLEDストリップを円形に配置した構成で、
  * リッチなLEDアニメーションとデバイス状態表示を実現します。
- * スムーズなアニメーションと精密な色制御が可能です。
+ * アニメーションはフレーム列として事前に計算し、RmtStripPlayerで再生します。
  */
 class CircularStrip : public Led {
 public:
@@ -71,28 +59,18 @@ public:
     void Scroll(StripColor low, StripColor high, int length, int interval_ms);
 
 private:
-    // スレッド安全性とタスク管理
-    std::mutex mutex_;                              /**< LEDストリップアクセス用ミューテックス */
-    TaskHandle_t blink_task_ = nullptr;             /**< 点滅タスクハンドル */
+    // スレッド安全性
+    std::mutex mutex_;                              /**< 色情報アクセス用ミューテックス */
     
-    // ESP-IDF LEDストリップインターフェース
-    led_strip_handle_t led_strip_ = nullptr;        /**< LEDストリップハンドル */
+    // RMTによるLEDストリップ駆動
+    RmtStripPlayer player_;                         /**< LEDストリップのプレーヤー */
     int max_leds_ = 0;                              /**< LED総数 */
     std::vector<StripColor> colors_;                /**< 各LEDの現在の色情報 */
-    
-    // アニメーション制御
-    int blink_counter_ = 0;                         /**< 点滅カウンタ */
-    int blink_interval_ms_ = 0;                     /**< 点滅間隔（ミリ秒） */
-    esp_timer_handle_t strip_timer_ = nullptr;      /**< LEDストリップアニメーションタイマー */
-    std::function<void()> strip_callback_ = nullptr; /**< アニメーションコールバック関数 */
 
     // 明るさ設定
     uint8_t default_brightness_ = DEFAULT_BRIGHTNESS; /**< 標準明るさレベル */
     uint8_t low_brightness_ = LOW_BRIGHTNESS;         /**< 低明るさレベル */
 
-    /** LEDストリップアニメーションタスクを開始 */
-    void StartStripTask(int interval_ms, std::function<void()> cb);
-    
     /** レインボーアニメーション */
     void Rainbow(StripColor low, StripColor high, int interval_ms);
     
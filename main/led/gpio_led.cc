@@ -22,6 +22,8 @@
 
 #define LEDC_DUTY              (8191)
 #define LEDC_FADE_TIME    (1000)
+#define LEDC_FREQ_HZ           (1000)
+#define LEDC_MAX_FADE_CYCLES   (1023)
 // GPIO_LED
 
 GpioLed::GpioLed(gpio_num_t gpio)
@@ -42,10 +44,11 @@ GpioLed::GpioLed(gpio_num_t gpio, int output_invert, ledc_timer_t timer_num, led
      */
     ledc_timer_config_t ledc_timer = {};
     ledc_timer.duty_resolution = LEDC_TIMER_13_BIT;  // resolution of PWM duty
-    ledc_timer.freq_hz = 4000;                      // frequency of PWM signal
+    ledc_timer.freq_hz = LEDC_FREQ_HZ;              // frequency of PWM signal
     ledc_timer.speed_mode = LEDC_LS_MODE;           // timer mode
     ledc_timer.timer_num = timer_num;               // timer index
-    ledc_timer.clk_cfg = LEDC_AUTO_CLK;              // Auto select the source clock
+    // RC_FASTクロックならライトスリープ中もPWMとフェードが動き続ける
+    ledc_timer.clk_cfg = LEDC_USE_RC_FAST_CLK;
 
     ESP_ERROR_CHECK(ledc_timer_config(&ledc_timer));
 
@@ -69,23 +72,10 @@ GpioLed::GpioLed(gpio_num_t gpio, int output_invert, ledc_timer_t timer_num, led
     };
     ledc_cb_register(ledc_channel_.speed_mode, ledc_channel_.channel, &ledc_callbacks, this);
 
-    esp_timer_create_args_t blink_timer_args = {
-        .callback = [](void *arg) {
-            auto led = static_cast<GpioLed*>(arg);
-            led->OnBlinkTimer();
-        },
-        .arg = this,
-        .dispatch_method = ESP_TIMER_TASK,
-        .name = "Blink Timer",
-        .skip_unhandled_events = false,
-    };
-    ESP_ERROR_CHECK(esp_timer_create(&blink_timer_args, &blink_timer_));
-
     ledc_initialized_ = true;
 }
 
 GpioLed::~GpioLed() {
-    esp_timer_stop(blink_timer_);
     if (ledc_initialized_) {
         ledc_fade_stop(ledc_channel_.speed_mode, ledc_channel_.channel);
         ledc_fade_func_uninstall();
@@ -107,7 +97,7 @@ void GpioLed::TurnOn() {
     }
 
     std::lock_guard<std::mutex> lock(mutex_);
-    esp_timer_stop(blink_timer_);
+    animation_ = kAnimationNone;
     ledc_fade_stop(ledc_channel_.speed_mode, ledc_channel_.channel);
     ledc_set_duty(ledc_channel_.speed_mode, ledc_channel_.channel, duty_);
     ledc_update_duty(ledc_channel_.speed_mode, ledc_channel_.channel);
@@ -119,7 +109,7 @@ void GpioLed::TurnOff() {
     }
 
     std::lock_guard<std::mutex> lock(mutex_);
-    esp_timer_stop(blink_timer_);
+    animation_ = kAnimationNone;
     ledc_fade_stop(ledc_channel_.speed_mode, ledc_channel_.channel);
     ledc_set_duty(ledc_channel_.speed_mode, ledc_channel_.channel, 0);
     ledc_update_duty(ledc_channel_.speed_mode, ledc_channel_.channel);
@@ -143,27 +133,28 @@ void GpioLed::StartBlinkTask(int times, int interval_ms) {
     }
 
     std::lock_guard<std::mutex> lock(mutex_);
-    esp_timer_stop(blink_timer_);
     ledc_fade_stop(ledc_channel_.speed_mode, ledc_channel_.channel);
 
+    animation_ = kAnimationBlink;
     blink_counter_ = times * 2;
     blink_interval_ms_ = interval_ms;
-    esp_timer_start_periodic(blink_timer_, interval_ms * 1000);
-}
-
-void GpioLed::OnBlinkTimer() {
-    std::lock_guard<std::mutex> lock(mutex_);
-    blink_counter_--;
-    if (blink_counter_ & 1) {
-        ledc_set_duty(ledc_channel_.speed_mode, ledc_channel_.channel, duty_);
-    } else {
-        ledc_set_duty(ledc_channel_.speed_mode, ledc_channel_.channel, 0);
-
-        if (blink_counter_ == 0) {
-            esp_timer_stop(blink_timer_);
-        }
+    StartBlinkPhase(true);
+}
+
+void GpioLed::StartBlinkPhase(bool on) {
+    // 1段だけのフェードを間隔いっぱいに引き延ばし、点灯/消灯の保持時間をLEDCに計らせる
+    uint32_t duty = on ? duty_ : 0;
+    uint32_t target = duty > 0 ? duty - 1 : 1;
+    uint32_t cycles = blink_interval_ms_ * LEDC_FREQ_HZ / 1000;
+    if (cycles > LEDC_MAX_FADE_CYCLES) {
+        cycles = LEDC_MAX_FADE_CYCLES;
+    } else if (cycles == 0) {
+        cycles = 1;
     }
+    ledc_set_duty(ledc_channel_.speed_mode, ledc_channel_.channel, duty);
     ledc_update_duty(ledc_channel_.speed_mode, ledc_channel_.channel);
+    ledc_set_fade_with_step(ledc_channel_.speed_mode, ledc_channel_.channel, target, 1, cycles);
+    ledc_fade_start(ledc_channel_.speed_mode, ledc_channel_.channel, LEDC_FADE_NO_WAIT);
 }
 
 void GpioLed::StartFadeTask() {
@@ -172,8 +163,8 @@ void GpioLed::StartFadeTask() {
     }
 
     std::lock_guard<std::mutex> lock(mutex_);
-    esp_timer_stop(blink_timer_);
     ledc_fade_stop(ledc_channel_.speed_mode, ledc_channel_.channel);
+    animation_ = kAnimationBreathe;
     fade_up_ = true;
     ledc_set_fade_with_time(ledc_channel_.speed_mode,
                             ledc_channel_.channel, LEDC_DUTY, LEDC_FADE_TIME);
@@ -183,6 +174,21 @@ void GpioLed::StartFadeTask() {
 
 void GpioLed::OnFadeEnd() {
     std::lock_guard<std::mutex> lock(mutex_);
+    if (animation_ == kAnimationBlink) {
+        blink_counter_--;
+        if (blink_counter_ == 0) {
+            animation_ = kAnimationNone;
+            ledc_set_duty(ledc_channel_.speed_mode, ledc_channel_.channel, 0);
+            ledc_update_duty(ledc_channel_.speed_mode, ledc_channel_.channel);
+            return;
+        }
+        // 奇数回目の終了は点灯区間の終わり
+        StartBlinkPhase(!(blink_counter_ & 1));
+        return;
+    }
+    if (animation_ != kAnimationBreathe) {
+        return;
+    }
     fade_up_ = !fade_up_;
     ledc_set_fade_with_time(ledc_channel_.speed_mode,
                             ledc_channel_.channel, fade_up_ ? LEDC_DUTY : 0, LEDC_FADE_TIME);
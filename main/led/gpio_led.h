@@ -14,7 +14,6 @@
 #include "led.h"
 #include <driver/gpio.h>
 #include <driver/ledc.h>
-#include <esp_timer.h>
 #include <atomic>
 #include <mutex>
 
@@ -25,6 +24,7 @@
  * GPIOピンで制御される単一LEDを管理します。
  * ESP32のLEDC（PWM）コントローラーを使用して明るさ制御、
  * 点滅アニメーション、フェード効果などを実現します。
+ * 点滅の保持時間もLEDCのフェードで計るため、タイマーのコールバックは使いません。
  */
 class GpioLed : public Led {
  public:
@@ -74,16 +74,21 @@ class GpioLed : public Led {
     uint32_t duty_ = 0;                             /**< 現在のPWMデューティ比 */
     
     // 点滅アニメーション制御
+    enum Animation {
+        kAnimationNone,
+        kAnimationBlink,
+        kAnimationBreathe,
+    };
+    Animation animation_ = kAnimationNone;          /**< フェード終了時に続けるアニメーション */
     int blink_counter_ = 0;                         /**< 点滅回数カウンタ */
     int blink_interval_ms_ = 0;                     /**< 点滅間隔（ミリ秒） */
-    esp_timer_handle_t blink_timer_ = nullptr;      /**< 点滅タイマー */
     bool fade_up_ = true;                           /**< フェード方向（true:明るく、false:暗く） */
 
     /** 点滅タスクを開始 */
     void StartBlinkTask(int times, int interval_ms);
     
-    /** 点滅タイマーコールバック */
-    void OnBlinkTimer();
+    /** 点灯または消灯の区間を1つ開始（区間の終わりはフェード終了で通知される） */
+    void StartBlinkPhase(bool on);
 
     /** 1回だけ点滅 */
     void BlinkOnce();
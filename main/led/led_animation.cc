@@ -0,0 +1,322 @@
+#include "led_animation.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <soc/soc_caps.h>
+
+#include <algorithm>
+
+#define TAG "LedAnimation"
+
+// WS2812のビットタイミング（10MHz、1tick = 0.1us）
+#define LED_RMT_RESOLUTION_HZ   (10 * 1000 * 1000)
+#define LED_RMT_TICKS_PER_MS    (LED_RMT_RESOLUTION_HZ / 1000)
+#define LED_RMT_T0H             3
+#define LED_RMT_T0L             9
+#define LED_RMT_T1H             9
+#define LED_RMT_T1L             3
+
+/** @brief 1シンボルで保持できる最大tick数（15bitの期間 x 2） */
+#define LED_RMT_MAX_HOLD_TICKS  (2 * 32767 - 1)
+
+/** @brief ラッチに必要な最小のLow期間（tick、300us） */
+#define LED_RMT_RESET_TICKS     3000
+
+void LedFrameSequence::AddFrame(const StripColor* colors, uint32_t hold_ms) {
+    colors_.insert(colors_.end(), colors, colors + leds_);
+    hold_ms_.push_back(hold_ms);
+}
+
+void LedFrameSequence::AddFrame(StripColor color, uint32_t hold_ms) {
+    colors_.insert(colors_.end(), leds_, color);
+    hold_ms_.push_back(hold_ms);
+}
+
+LedFrameSequence LedFrameSequence::Blink(int leds, StripColor color, int interval_ms, int times) {
+    LedFrameSequence sequence(leds);
+    int cycles = times < 0 ? 1 : times;
+    for (int i = 0; i < cycles; i++) {
+        sequence.AddFrame(color, interval_ms);
+        sequence.AddFrame(StripColor{}, interval_ms);
+    }
+    sequence.set_loop(times < 0);
+    return sequence;
+}
+
+LedFrameSequence LedFrameSequence::Breathe(int leds, StripColor low, StripColor high, int interval_ms) {
+    // 各成分を1段ずつ目標に近づける（全成分が揃ったら折り返す）
+    auto step = [](uint8_t value, uint8_t target) -> uint8_t {
+        return value < target ? value + 1 : (value > target ? value - 1 : value);
+    };
+    auto same = [](const StripColor& a, const StripColor& b) {
+        return a.red == b.red && a.green == b.green && a.blue == b.blue;
+    };
+
+    LedFrameSequence sequence(leds);
+    StripColor color = low;
+    do {
+        color = { step(color.red, high.red), step(color.green, high.green), step(color.blue, high.blue) };
+        sequence.AddFrame(color, interval_ms);
+    } while (!same(color, high));
+    do {
+        color = { step(color.red, low.red), step(color.green, low.green), step(color.blue, low.blue) };
+        sequence.AddFrame(color, interval_ms);
+    } while (!same(color, low));
+    return sequence;
+}
+
+LedFrameSequence LedFrameSequence::Scroll(int leds, StripColor low, StripColor high, int length, int interval_ms) {
+    LedFrameSequence sequence(leds);
+    std::vector<StripColor> colors(leds);
+    for (int offset = 0; offset < leds; offset++) {
+        std::fill(colors.begin(), colors.end(), low);
+        for (int j = 0; j < length; j++) {
+            colors[(offset + j) % leds] = high;
+        }
+        sequence.AddFrame(colors.data(), interval_ms);
+    }
+    return sequence;
+}
+
+LedFrameSequence LedFrameSequence::FadeOut(const std::vector<StripColor>& colors, int interval_ms) {
+    LedFrameSequence sequence(colors.size());
+    std::vector<StripColor> current = colors;
+    bool all_off;
+    do {
+        all_off = true;
+        for (auto& color : current) {
+            color = { (uint8_t)(color.red / 2), (uint8_t)(color.green / 2), (uint8_t)(color.blue / 2) };
+            if (color.red != 0 || color.green != 0 || color.blue != 0) {
+                all_off = false;
+            }
+        }
+        sequence.AddFrame(current.data(), interval_ms);
+    } while (!all_off);
+    sequence.set_loop(false);
+    return sequence;
+}
+
+RmtStripPlayer::RmtStripPlayer(gpio_num_t gpio, int leds) : leds_(leds) {
+    rmt_tx_channel_config_t channel_config = {};
+    channel_config.gpio_num = gpio;
+    channel_config.clk_src = RMT_CLK_SRC_DEFAULT;
+    channel_config.resolution_hz = LED_RMT_RESOLUTION_HZ;
+    channel_config.trans_queue_depth = 2;
+#if SOC_RMT_SUPPORT_DMA
+    // DMAの作業バッファを大きく取り、フレーム列の補充割り込みを減らす
+    channel_config.mem_block_symbols = 1024;
+    channel_config.flags.with_dma = true;
+#else
+    channel_config.mem_block_symbols = SOC_RMT_MEM_WORDS_PER_CHANNEL;
+#endif
+    ESP_ERROR_CHECK(rmt_new_tx_channel(&channel_config, &channel_));
+
+    rmt_copy_encoder_config_t encoder_config = {};
+    ESP_ERROR_CHECK(rmt_new_copy_encoder(&encoder_config, &encoder_));
+
+    xTaskCreate([](void* arg) {
+        ((RmtStripPlayer*)arg)->LoopTask();
+    }, "led_anim", 2048, this, 1, &task_);
+
+    rmt_tx_event_callbacks_t callbacks = {
+        .on_trans_done = OnTransDone,
+    };
+    ESP_ERROR_CHECK(rmt_tx_register_event_callbacks(channel_, &callbacks, this));
+}
+
+RmtStripPlayer::~RmtStripPlayer() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        StopLocked();
+    }
+    if (task_ != nullptr) {
+        vTaskDelete(task_);
+    }
+    rmt_del_encoder(encoder_);
+    rmt_del_channel(channel_);
+    heap_caps_free(symbols_);
+}
+
+void RmtStripPlayer::Show(const StripColor* colors) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    StopLocked();
+    if (!Reserve(leds_ * 24 + 1)) {
+        return;
+    }
+    length_ = EncodeFrame(colors, symbols_);
+    length_ += EncodeHold(0, symbols_ + length_);
+
+    // 1回だけ送信してすぐ無効化し、静止表示中は電源管理ロックを持たない
+    ESP_ERROR_CHECK(rmt_enable(channel_));
+    Transmit();
+    rmt_tx_wait_all_done(channel_, 100);
+    rmt_disable(channel_);
+}
+
+void RmtStripPlayer::Show(StripColor color) {
+    std::vector<StripColor> colors(leds_, color);
+    Show(colors.data());
+}
+
+void RmtStripPlayer::Play(const LedFrameSequence& sequence) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    StopLocked();
+    size_t frames = sequence.frame_count();
+    if (frames == 0 || sequence.leds() != leds_) {
+        return;
+    }
+
+    // 上限を超える場合はフレームを間引き、間引いた分の表示時間を前のフレームに足す
+    size_t frame_symbols = leds_ * 24;
+    size_t stride = 1;
+    size_t total = 0;
+    for (; stride <= frames; stride++) {
+        total = 0;
+        for (size_t i = 0; i < frames; i += stride) {
+            uint32_t hold_ms = 0;
+            for (size_t j = i; j < std::min(i + stride, frames); j++) {
+                hold_ms += sequence.hold_ms(j);
+            }
+            total += frame_symbols + HoldSymbols(hold_ms);
+        }
+        if (total <= LED_ANIMATION_MAX_SYMBOLS) {
+            break;
+        }
+    }
+    if (stride > 1) {
+        ESP_LOGW(TAG, "Sequence of %u frames decimated by %u", frames, stride);
+    }
+    if (!Reserve(total)) {
+        return;
+    }
+
+    length_ = 0;
+    for (size_t i = 0; i < frames; i += stride) {
+        uint32_t hold_ms = 0;
+        for (size_t j = i; j < std::min(i + stride, frames); j++) {
+            hold_ms += sequence.hold_ms(j);
+        }
+        length_ += EncodeFrame(sequence.frame(i), symbols_ + length_);
+        length_ += EncodeHold(hold_ms, symbols_ + length_);
+    }
+
+    ESP_ERROR_CHECK(rmt_enable(channel_));
+    enabled_ = true;
+    looping_ = sequence.loop();
+    Transmit();
+}
+
+void RmtStripPlayer::Stop() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    StopLocked();
+}
+
+void RmtStripPlayer::StopLocked() {
+    generation_++;
+    looping_ = false;
+    if (enabled_) {
+        // 無効化で送信中・待機中のデータは破棄される
+        rmt_disable(channel_);
+        enabled_ = false;
+    }
+}
+
+void RmtStripPlayer::Transmit() {
+    rmt_transmit_config_t transmit_config = {};
+    transmit_config.loop_count = 0;
+    ESP_ERROR_CHECK(rmt_transmit(channel_, encoder_, symbols_, length_ * sizeof(rmt_symbol_word_t), &transmit_config));
+}
+
+bool RmtStripPlayer::Reserve(size_t symbols) {
+    if (symbols <= capacity_) {
+        return true;
+    }
+    heap_caps_free(symbols_);
+    capacity_ = 0;
+    size_t size = symbols * sizeof(rmt_symbol_word_t);
+    symbols_ = (rmt_symbol_word_t*)heap_caps_malloc(size, MALLOC_CAP_SPIRAM);
+    if (symbols_ == nullptr) {
+        symbols_ = (rmt_symbol_word_t*)heap_caps_malloc(size, MALLOC_CAP_8BIT);
+    }
+    if (symbols_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate %u symbols", symbols);
+        return false;
+    }
+    capacity_ = symbols;
+    return true;
+}
+
+size_t RmtStripPlayer::EncodeFrame(const StripColor* colors, rmt_symbol_word_t* out) const {
+    rmt_symbol_word_t bit0 = {};
+    bit0.level0 = 1;
+    bit0.duration0 = LED_RMT_T0H;
+    bit0.level1 = 0;
+    bit0.duration1 = LED_RMT_T0L;
+    rmt_symbol_word_t bit1 = {};
+    bit1.level0 = 1;
+    bit1.duration0 = LED_RMT_T1H;
+    bit1.level1 = 0;
+    bit1.duration1 = LED_RMT_T1L;
+
+    size_t count = 0;
+    for (int i = 0; i < leds_; i++) {
+        // WS2812はGRBの順、MSBから送る
+        const uint8_t bytes[3] = { colors[i].green, colors[i].red, colors[i].blue };
+        for (uint8_t byte : bytes) {
+            for (int bit = 7; bit >= 0; bit--) {
+                out[count++] = (byte >> bit) & 1 ? bit1 : bit0;
+            }
+        }
+    }
+    return count;
+}
+
+size_t RmtStripPlayer::HoldSymbols(uint32_t hold_ms) {
+    uint64_t ticks = std::max<uint64_t>((uint64_t)hold_ms * LED_RMT_TICKS_PER_MS, LED_RMT_RESET_TICKS);
+    return (ticks + LED_RMT_MAX_HOLD_TICKS - 1) / LED_RMT_MAX_HOLD_TICKS;
+}
+
+size_t RmtStripPlayer::EncodeHold(uint32_t hold_ms, rmt_symbol_word_t* out) {
+    // Lowのまま待つ。期間0のシンボルは送信終了とみなされるため、各半分を1tick以上にする
+    uint64_t remaining = std::max<uint64_t>((uint64_t)hold_ms * LED_RMT_TICKS_PER_MS, LED_RMT_RESET_TICKS);
+    size_t count = 0;
+    while (remaining > 0) {
+        uint32_t chunk = remaining > LED_RMT_MAX_HOLD_TICKS ? LED_RMT_MAX_HOLD_TICKS : remaining;
+        if (remaining > chunk && remaining - chunk < 2) {
+            chunk -= 2;
+        }
+        rmt_symbol_word_t symbol = {};
+        symbol.level0 = 0;
+        symbol.duration0 = chunk / 2;
+        symbol.level1 = 0;
+        symbol.duration1 = chunk - chunk / 2;
+        out[count++] = symbol;
+        remaining -= chunk;
+    }
+    return count;
+}
+
+void RmtStripPlayer::LoopTask() {
+    while (true) {
+        uint32_t generation = 0;
+        xTaskNotifyWait(0, 0, &generation, portMAX_DELAY);
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (generation != generation_.load() || !enabled_) {
+            continue;
+        }
+        if (looping_) {
+            Transmit();
+        } else {
+            // 繰り返さないアニメーションは最後のフレームを表示したまま無効化する
+            rmt_disable(channel_);
+            enabled_ = false;
+        }
+    }
+}
+
+bool IRAM_ATTR RmtStripPlayer::OnTransDone(rmt_channel_handle_t channel, const rmt_tx_done_event_data_t* event, void* user_ctx) {
+    auto player = (RmtStripPlayer*)user_ctx;
+    BaseType_t higher_priority_task_woken = pdFALSE;
+    xTaskNotifyFromISR(player->task_, player->generation_.load(), eSetValueWithOverwrite, &higher_priority_task_woken);
+    return higher_priority_task_woken == pdTRUE;
+}
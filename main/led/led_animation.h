@@ -0,0 +1,140 @@
+/**
+ * @file led_animation.h
+ * @brief アドレッサブルLEDの事前計算アニメーションとRMTによる再生
+ *
+ * 点滅・呼吸・スクロールなどの効果をフレーム列として先に計算し、
+ * WS2812のビット列と各フレームの表示時間（Lowの保持）を1つのRMTシンボル列に
+ * エンコードして丸ごと送信します。フレームの切り替えはRMTが行うため、
+ * esp_timerのコールバックでフレームごとにストリップを書き直す必要がありません。
+ */
+#ifndef _LED_ANIMATION_H_
+#define _LED_ANIMATION_H_
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <driver/gpio.h>
+#include <driver/rmt_tx.h>
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+/** @brief 1回の送信にエンコードできるRMTシンボル数の上限（超える場合はフレームを間引く） */
+#define LED_ANIMATION_MAX_SYMBOLS 16384
+
+/**
+ * @struct StripColor
+ * @brief LEDストリップの色情報を表す構造体
+ */
+struct StripColor {
+    uint8_t red = 0;    /**< 赤色成分（0-255） */
+    uint8_t green = 0;  /**< 緑色成分（0-255） */
+    uint8_t blue = 0;   /**< 青色成分（0-255） */
+};
+
+/**
+ * @class LedFrameSequence
+ * @brief 全LEDの色と表示時間からなるフレーム列
+ */
+class LedFrameSequence {
+public:
+    explicit LedFrameSequence(int leds) : leds_(leds) {}
+
+    /** @brief 各LEDの色を指定してフレームを追加 */
+    void AddFrame(const StripColor* colors, uint32_t hold_ms);
+
+    /** @brief 全LED同色のフレームを追加 */
+    void AddFrame(StripColor color, uint32_t hold_ms);
+
+    int leds() const { return leds_; }
+    size_t frame_count() const { return hold_ms_.size(); }
+    const StripColor* frame(size_t index) const { return &colors_[index * leds_]; }
+    uint32_t hold_ms(size_t index) const { return hold_ms_[index]; }
+
+    /** @brief 最後のフレームの後に先頭へ戻るか */
+    bool loop() const { return loop_; }
+    void set_loop(bool loop) { loop_ = loop; }
+
+    /**
+     * @brief 点灯と消灯を交互に繰り返す
+     * @param times 点滅回数。負なら無限に繰り返す
+     */
+    static LedFrameSequence Blink(int leds, StripColor color, int interval_ms, int times = -1);
+
+    /** @brief lowとhighの間を1段ずつ往復する */
+    static LedFrameSequence Breathe(int leds, StripColor low, StripColor high, int interval_ms);
+
+    /** @brief length個のhighが1つずつ進む */
+    static LedFrameSequence Scroll(int leds, StripColor low, StripColor high, int length, int interval_ms);
+
+    /** @brief 現在の色から半分ずつ暗くして消灯する（繰り返さない） */
+    static LedFrameSequence FadeOut(const std::vector<StripColor>& colors, int interval_ms);
+
+private:
+    int leds_;
+    bool loop_ = true;
+    std::vector<StripColor> colors_;    /**< フレーム数 x LED数 */
+    std::vector<uint32_t> hold_ms_;
+};
+
+/**
+ * @class RmtStripPlayer
+ * @brief WS2812ストリップをRMTで直接駆動するプレーヤー
+ *
+ * 繰り返すアニメーションは1周期を1回の送信にまとめ、送信完了ごとに
+ * 専用タスクが同じバッファを再送信します（タスクが起きるのは1周期に1回）。
+ * 静止表示では送信後にチャンネルを無効化し、RMTの電源管理ロックを解放します。
+ */
+class RmtStripPlayer {
+public:
+    RmtStripPlayer(gpio_num_t gpio, int leds);
+    ~RmtStripPlayer();
+
+    RmtStripPlayer(const RmtStripPlayer&) = delete;
+    RmtStripPlayer& operator=(const RmtStripPlayer&) = delete;
+
+    /** @brief 再生中のアニメーションを止めて静止表示 */
+    void Show(const StripColor* colors);
+
+    /** @brief 再生中のアニメーションを止めて全LEDを同色で静止表示 */
+    void Show(StripColor color);
+
+    /** @brief フレーム列をエンコードして再生 */
+    void Play(const LedFrameSequence& sequence);
+
+    /** @brief アニメーションを停止（LEDは最後の表示のまま） */
+    void Stop();
+
+    int leds() const { return leds_; }
+
+private:
+    int leds_;
+    std::mutex mutex_;
+    rmt_channel_handle_t channel_ = nullptr;
+    rmt_encoder_handle_t encoder_ = nullptr;
+    bool enabled_ = false;
+    TaskHandle_t task_ = nullptr;
+    std::atomic<uint32_t> generation_{0};       /**< 再生を切り替えるたびに増やす */
+    bool looping_ = false;
+
+    rmt_symbol_word_t* symbols_ = nullptr;
+    size_t capacity_ = 0;                       /**< symbols_の要素数 */
+    size_t length_ = 0;                         /**< エンコード済みの要素数 */
+
+    /** @brief 送信中のデータを破棄してチャンネルを無効化（mutex_保持中に呼ぶ） */
+    void StopLocked();
+
+    void Transmit();
+    bool Reserve(size_t symbols);
+    size_t EncodeFrame(const StripColor* colors, rmt_symbol_word_t* out) const;
+    static size_t EncodeHold(uint32_t hold_ms, rmt_symbol_word_t* out);
+    static size_t HoldSymbols(uint32_t hold_ms);
+
+    /** @brief 繰り返し再生の再送信タスク */
+    void LoopTask();
+
+    static bool IRAM_ATTR OnTransDone(rmt_channel_handle_t channel, const rmt_tx_done_event_data_t* event, void* user_ctx);
+};
+
+#endif // _LED_ANIMATION_H_
@@ -10,11 +10,8 @@
 #define _SINGLE_LED_H_
 
 #include "led.h"
+#include "led_animation.h"
 #include <driver/gpio.h>
-#include <led_strip.h>
-#include <esp_timer.h>
-#include <atomic>
-#include <mutex>
 
 /**
  * @class SingleLed
@@ -22,7 +19,8 @@
  * 
  * WS2812BなどのアドレッサブルLED、1個だけを制御します。
  * RGB色制御、点滅アニメーション、ON/OFF制御などの機能を提供し、
- * シンプルな状態表示に適しています。
+ * シンプルな状態表示に適しています。点滅はRmtStripPlayerが1周期分を
+ * まとめて送信するため、フレームごとのタイマーコールバックはありません。
  */
 class SingleLed : public Led {
 public:
@@ -37,26 +35,14 @@ public:
     void OnStateChanged() override;
 
 private:
-    // スレッド安全性とタスク管理
-    std::mutex mutex_;                              /**< LEDアクセス用ミューテックス */
-    TaskHandle_t blink_task_ = nullptr;             /**< 点滅タスクハンドル */
-    
-    // ESP-IDF LEDストリップインターフェース
-    led_strip_handle_t led_strip_ = nullptr;        /**< LEDストリップハンドル（1個LED用） */
+    // RMTによるLED駆動
+    RmtStripPlayer player_;                         /**< 1個LED用のプレーヤー */
     
     // 色情報
     uint8_t r_ = 0, g_ = 0, b_ = 0;                  /**< 現在のRGB色値 */
-    
-    // 点滅アニメーション制御
-    int blink_counter_ = 0;                         /**< 点滅回数カウンタ */
-    int blink_interval_ms_ = 0;                     /**< 点滅間隔（ミリ秒） */
-    esp_timer_handle_t blink_timer_ = nullptr;      /**< 点滅タイマー */
 
-    /** 点滅タスクを開始 */
+    /** 点滅アニメーションを開始（timesが負なら無限） */
     void StartBlinkTask(int times, int interval_ms);
-    
-    /** 点滅タイマーコールバック */
-    void OnBlinkTimer();
 
     /** 1回だけ点滅 */
     void BlinkOnce();
@@ -15,6 +15,37 @@
 
 #include "application.h"
 #include "system_info.h"
+#include "boot_profile.h"
+#if CONFIG_USE_DEFERRED_LOG
+#include "deferred_log.h"
+#endif
+#if CONFIG_USE_FLIGHT_RECORDER
+#include "flight_recorder.h"
+#endif
+#if CONFIG_USE_JSON_ARENA
+#include "json_arena.h"
+#endif
+#include "task_factory.h"
+#if CONFIG_USE_HEAP_MONITOR
+#include "heap_monitor.h"
+#endif
+#if CONFIG_AUDIO_BENCHMARK_MODE
+#include "audio_benchmark.h"
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#endif
+#if CONFIG_DISPLAY_BENCHMARK_MODE
+#include "board.h"
+#include "display_benchmark.h"
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#endif
+#if CONFIG_SERIALIZATION_BENCHMARK_MODE
+#include "board.h"
+#include "serialization_benchmark.h"
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#endif
 
 #define TAG "main"
 
@@ -26,6 +57,16 @@
  */
 extern "C" void app_main(void)
 {
+    BootProfile::GetInstance().Mark(kBootAppMain);
+#if CONFIG_USE_DEFERRED_LOG
+    // 以降のログはリング経由で出力し、UARTの書き込みで呼び出し元を待たせない
+    DeferredLog::GetInstance().Start();
+#endif
+#if CONFIG_USE_FLIGHT_RECORDER
+    // 前回の起動の記録を退避してから今回の記録を始める
+    FlightRecorder::GetInstance().Start();
+#endif
+
     // デフォルトイベントループを初期化
     ESP_ERROR_CHECK(esp_event_loop_create_default());
 
@@ -37,6 +78,41 @@ extern "C" void app_main(void)
         ret = nvs_flash_init();
     }
     ESP_ERROR_CHECK(ret);
+    LoadTaskCoreOverrides();
+
+#if CONFIG_AUDIO_BENCHMARK_MODE
+    // ベンチマークモードでは通常のアプリケーションを起動しない（結果はシリアルログから回収する）
+    audio_benchmark::Run();
+    while (true) {
+        vTaskDelay(portMAX_DELAY);
+    }
+#endif
+
+#if CONFIG_USE_JSON_ARENA
+    // 以降のcJSONの確保はアリーナの区間内ならアリーナから行う
+    JsonArena::InstallHooks();
+#endif
+#if CONFIG_USE_HEAP_MONITOR
+    // cJSONの確保を数えるため、アプリケーションの生成より前にフックを設定
+    HeapMonitor::GetInstance().Start();
+#endif
+
+#if CONFIG_DISPLAY_BENCHMARK_MODE
+    // ボードと表示だけを初期化して測定する（結果はシリアルログから回収する）
+    display_benchmark::Run(Board::GetInstance().GetDisplay());
+    while (true) {
+        vTaskDelay(portMAX_DELAY);
+    }
+#endif
+
+#if CONFIG_SERIALIZATION_BENCHMARK_MODE
+    // ボードが登録するツールとThingを使うため、ボードを初期化してから測定する
+    Board::GetInstance();
+    serialization_benchmark::Run();
+    while (true) {
+        vTaskDelay(portMAX_DELAY);
+    }
+#endif
 
     // アプリケーションを起動
     Application::GetInstance().Start();
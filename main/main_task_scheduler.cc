@@ -0,0 +1,186 @@
+#include "main_task_scheduler.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#include <algorithm>
+
+#define TAG "MainTaskScheduler"
+
+/** @brief 各リングの初期スロット数 */
+#define MAIN_TASK_RING_INITIAL_SLOTS 8
+
+static const char* const kPriorityNames[kSchedulePriorityCount] = {
+    "audio", "protocol", "ui", "housekeeping"
+};
+
+MainTaskScheduler::MainTaskScheduler() {
+    for (auto& ring : rings_) {
+        ring.slots.resize(MAIN_TASK_RING_INITIAL_SLOTS);
+    }
+}
+
+void MainTaskScheduler::Grow(Ring& ring) {
+    // 先頭から順に新しい配列へ詰め直す（FIFO順を保つ）
+    std::vector<Entry> slots(ring.slots.size() * 2);
+    for (size_t i = 0; i < ring.count; ++i) {
+        slots[i] = std::move(ring.slots[(ring.head + i) % ring.slots.size()]);
+    }
+    ring.slots.swap(slots);
+    ring.head = 0;
+}
+
+void MainTaskScheduler::Push(TaskFunction&& task, SchedulePriority priority) {
+    int64_t now = esp_timer_get_time();
+    std::lock_guard<PriorityMutex> lock(mutex_);
+    PushLocked(std::move(task), priority, now);
+}
+
+void MainTaskScheduler::PushLocked(TaskFunction&& task, SchedulePriority priority, int64_t enqueued_us) {
+    auto& ring = rings_[priority];
+    if (ring.count == ring.slots.size()) {
+        Grow(ring);
+    }
+    auto& entry = ring.slots[(ring.head + ring.count) % ring.slots.size()];
+    entry.task = std::move(task);
+    entry.enqueued_us = enqueued_us;
+    ring.count++;
+}
+
+void MainTaskScheduler::PushAfter(TaskFunction&& task, uint32_t delay_ms, SchedulePriority priority) {
+    int64_t deadline = esp_timer_get_time() + (int64_t)delay_ms * 1000;
+    std::lock_guard<PriorityMutex> lock(mutex_);
+    if (timer_count_ == 0) {
+        // 空の間に進んだ時刻は走査しない
+        wheel_tick_ = esp_timer_get_time() / (MAIN_TASK_TIMER_TICK_MS * 1000);
+    }
+    auto& slot = wheel_[(deadline / (MAIN_TASK_TIMER_TICK_MS * 1000)) % MAIN_TASK_TIMER_SLOTS];
+    slot.push_back(Timer{std::move(task), deadline, priority});
+    timer_count_++;
+    next_deadline_us_ = std::min(next_deadline_us_, deadline);
+}
+
+void MainTaskScheduler::PromoteDueTimers() {
+    int64_t now = esp_timer_get_time();
+    std::lock_guard<PriorityMutex> lock(mutex_);
+    if (timer_count_ == 0 || now < next_deadline_us_) {
+        return;
+    }
+    // 前回のスロットから現在のスロットまでを走査する（一周以上空いたら全スロット）。
+    // 同じスロットには一周先の期限も入るため、期限を過ぎたものだけを移す
+    int64_t current = now / (MAIN_TASK_TIMER_TICK_MS * 1000);
+    int64_t span = std::min<int64_t>(current - wheel_tick_, MAIN_TASK_TIMER_SLOTS - 1);
+    for (int64_t tick = current - span; tick <= current; tick++) {
+        auto& slot = wheel_[tick % MAIN_TASK_TIMER_SLOTS];
+        for (size_t i = 0; i < slot.size();) {
+            if (slot[i].deadline_us > now) {
+                i++;
+                continue;
+            }
+            // 期限はタスクの投入時刻として扱い、待ち時間の統計に遅延を含めない
+            PushLocked(std::move(slot[i].task), slot[i].priority, slot[i].deadline_us);
+            if (i + 1 < slot.size()) {
+                slot[i] = std::move(slot.back());
+            }
+            slot.pop_back();
+            timer_count_--;
+        }
+    }
+    wheel_tick_ = current;
+
+    next_deadline_us_ = INT64_MAX;
+    if (timer_count_ > 0) {
+        for (auto& slot : wheel_) {
+            for (auto& timer : slot) {
+                next_deadline_us_ = std::min(next_deadline_us_, timer.deadline_us);
+            }
+        }
+    }
+}
+
+TickType_t MainTaskScheduler::TicksUntilNextTimer() {
+    std::lock_guard<PriorityMutex> lock(mutex_);
+    if (timer_count_ == 0) {
+        return portMAX_DELAY;
+    }
+    int64_t remaining_us = next_deadline_us_ - esp_timer_get_time();
+    if (remaining_us <= 0) {
+        return 0;
+    }
+    // 期限より前に起きないよう切り上げる
+    return pdMS_TO_TICKS((remaining_us + 999) / 1000) + 1;
+}
+
+bool MainTaskScheduler::RunNext() {
+    TaskFunction task;
+    int64_t enqueued_us = 0;
+    int priority = 0;
+    {
+        std::lock_guard<PriorityMutex> lock(mutex_);
+        while (priority < kSchedulePriorityCount && rings_[priority].count == 0) {
+            priority++;
+        }
+        if (priority == kSchedulePriorityCount) {
+            return false;
+        }
+        auto& ring = rings_[priority];
+        auto& entry = ring.slots[ring.head];
+        task = std::move(entry.task);
+        enqueued_us = entry.enqueued_us;
+        ring.head = (ring.head + 1) % ring.slots.size();
+        ring.count--;
+    }
+
+    bool on_heap = task.on_heap();
+    int64_t start = esp_timer_get_time();
+    task();
+    // キャプチャの破棄も実行時間に含める（大きな文字列の解放など）
+    task.Reset();
+    uint32_t elapsed = esp_timer_get_time() - start;
+    uint32_t wait = start - enqueued_us;
+
+    if (elapsed > MAIN_TASK_SLOW_THRESHOLD_US) {
+        ESP_LOGW(TAG, "Slow %s task: %lums (waited %lums)", kPriorityNames[priority],
+            elapsed / 1000, wait / 1000);
+    }
+
+    std::lock_guard<PriorityMutex> lock(mutex_);
+    auto& stats = stats_[priority];
+    stats.count++;
+    stats.total_us += elapsed;
+    if (elapsed > stats.max_us) {
+        stats.max_us = elapsed;
+    }
+    if (wait > stats.max_wait_us) {
+        stats.max_wait_us = wait;
+    }
+    if (elapsed > MAIN_TASK_SLOW_THRESHOLD_US) {
+        stats.slow_count++;
+    }
+    if (on_heap) {
+        stats.heap_count++;
+    }
+    return true;
+}
+
+void MainTaskScheduler::PrintStats() {
+    Stats snapshot[kSchedulePriorityCount];
+    size_t pending[kSchedulePriorityCount];
+    {
+        std::lock_guard<PriorityMutex> lock(mutex_);
+        for (int i = 0; i < kSchedulePriorityCount; ++i) {
+            snapshot[i] = stats_[i];
+            stats_[i] = Stats();
+            pending[i] = rings_[i].count;
+        }
+    }
+    for (int i = 0; i < kSchedulePriorityCount; ++i) {
+        auto& stats = snapshot[i];
+        if (stats.count == 0 && pending[i] == 0) {
+            continue;
+        }
+        ESP_LOGI(TAG, "%s: %lu tasks, avg %lluus, max %luus, max wait %luus, slow %lu, heap %lu, pending %u",
+            kPriorityNames[i], stats.count, stats.count ? stats.total_us / stats.count : 0,
+            stats.max_us, stats.max_wait_us, stats.slow_count, stats.heap_count, pending[i]);
+    }
+}
@@ -0,0 +1,224 @@
+/**
+ * @file main_task_scheduler.h
+ * @brief メインイベントループ用の優先度付きタスクスケジューラ
+ *
+ * Application::Schedule() で投入されたタスクを優先度クラスごとのリングに保持し、
+ * 高い優先度から1件ずつ取り出して実行します。LVGLのレイアウトなど重いUIタスクが
+ * 溜まっていても、AbortSpeakingのような音声制御が後回しにならないようにします。
+ *
+ * Application::ScheduleAfter() の遅延タスクはタイマーホイールに置き、期限が来たら
+ * 同じリングへ移します。メインループは待つ代わりに継続を登録するため、待機中も
+ * ほかのタスク（JSONの処理など）を実行できます。
+ */
+#ifndef MAIN_TASK_SCHEDULER_H
+#define MAIN_TASK_SCHEDULER_H
+
+#include <freertos/FreeRTOS.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "priority_mutex.h"
+
+/** @brief 実行時間がこの値（マイクロ秒）を超えたタスクを警告として記録する */
+#define MAIN_TASK_SLOW_THRESHOLD_US 50000
+
+/** @brief タイマーホイールの1スロットの時間（ミリ秒）とスロット数 */
+#define MAIN_TASK_TIMER_TICK_MS 10
+#define MAIN_TASK_TIMER_SLOTS 64
+
+/**
+ * @enum SchedulePriority
+ * @brief メインタスクの優先度クラス（値が小さいほど先に実行）
+ */
+enum SchedulePriority {
+    kSchedulePriorityAudio,         // 音声制御（中断、ウェイクワード、会話開始/終了）
+    kSchedulePriorityProtocol,      // プロトコル処理（既定）
+    kSchedulePriorityUi,            // 表示更新
+    kSchedulePriorityHousekeeping,  // 時計表示などの定期処理
+    kSchedulePriorityCount
+};
+
+/**
+ * @class TaskFunction
+ * @brief 小さなキャプチャをヒープ確保せずに保持するムーブ専用の呼び出し可能オブジェクト
+ *
+ * キャプチャが kInlineSize バイト以下ならオブジェクト内に直接構築し、
+ * それを超える場合のみヒープに確保します。std::functionと異なりコピー不可の
+ * キャプチャ（unique_ptrなど）も受け付けます。
+ */
+class TaskFunction {
+public:
+    static constexpr size_t kInlineSize = 48;   /**< インラインバッファのサイズ（バイト） */
+
+    TaskFunction() = default;
+
+    template <typename F, typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, TaskFunction>>>
+    TaskFunction(F&& f) {
+        using Fn = std::decay_t<F>;
+        if constexpr (sizeof(Fn) <= kInlineSize && alignof(Fn) <= alignof(std::max_align_t) &&
+                std::is_nothrow_move_constructible_v<Fn>) {
+            new (storage_) Fn(std::forward<F>(f));
+            ops_ = &kInlineOps<Fn>;
+        } else {
+            *reinterpret_cast<Fn**>(storage_) = new Fn(std::forward<F>(f));
+            ops_ = &kHeapOps<Fn>;
+        }
+    }
+
+    TaskFunction(TaskFunction&& other) noexcept { MoveFrom(other); }
+
+    TaskFunction& operator=(TaskFunction&& other) noexcept {
+        if (this != &other) {
+            Reset();
+            MoveFrom(other);
+        }
+        return *this;
+    }
+
+    TaskFunction(const TaskFunction&) = delete;
+    TaskFunction& operator=(const TaskFunction&) = delete;
+
+    ~TaskFunction() { Reset(); }
+
+    explicit operator bool() const { return ops_ != nullptr; }
+
+    void operator()() { ops_->invoke(storage_); }
+
+    /** @brief 保持している呼び出し可能オブジェクトを破棄 */
+    void Reset() {
+        if (ops_ != nullptr) {
+            ops_->destroy(storage_);
+            ops_ = nullptr;
+        }
+    }
+
+    /** @brief キャプチャがヒープに確保されている場合true */
+    bool on_heap() const { return ops_ != nullptr && ops_->on_heap; }
+
+private:
+    struct Ops {
+        void (*invoke)(void* storage);
+        void (*move)(void* dst, void* src);     // srcからdstへムーブし、srcを破棄する
+        void (*destroy)(void* storage);
+        bool on_heap;
+    };
+
+    template <typename Fn>
+    static constexpr Ops kInlineOps = {
+        [](void* s) { (*static_cast<Fn*>(s))(); },
+        [](void* d, void* s) {
+            new (d) Fn(std::move(*static_cast<Fn*>(s)));
+            static_cast<Fn*>(s)->~Fn();
+        },
+        [](void* s) { static_cast<Fn*>(s)->~Fn(); },
+        false,
+    };
+
+    template <typename Fn>
+    static constexpr Ops kHeapOps = {
+        [](void* s) { (**static_cast<Fn**>(s))(); },
+        [](void* d, void* s) { *static_cast<Fn**>(d) = *static_cast<Fn**>(s); },
+        [](void* s) { delete *static_cast<Fn**>(s); },
+        true,
+    };
+
+    alignas(std::max_align_t) unsigned char storage_[kInlineSize];
+    const Ops* ops_ = nullptr;
+
+    void MoveFrom(TaskFunction& other) {
+        if (other.ops_ != nullptr) {
+            other.ops_->move(storage_, other.storage_);
+            ops_ = other.ops_;
+            other.ops_ = nullptr;
+        }
+    }
+};
+
+/**
+ * @class MainTaskScheduler
+ * @brief 優先度クラスごとのFIFOリングを持つスケジューラ
+ *
+ * リングは必要に応じて倍々に拡張され、縮小しないため定常状態ではメモリ確保が発生しません。
+ * 同じ優先度内では投入順に実行します。Push()は任意のタスクから、RunNext()は
+ * メインイベントループからのみ呼び出します。
+ */
+class MainTaskScheduler {
+public:
+    /** @brief 優先度クラスごとの実行統計 */
+    struct Stats {
+        uint32_t count = 0;             /**< 実行したタスク数 */
+        uint32_t slow_count = 0;        /**< MAIN_TASK_SLOW_THRESHOLD_US を超えたタスク数 */
+        uint32_t heap_count = 0;        /**< キャプチャがインラインに収まらなかったタスク数 */
+        uint64_t total_us = 0;          /**< 合計実行時間 */
+        uint32_t max_us = 0;            /**< 最大実行時間 */
+        uint32_t max_wait_us = 0;       /**< 投入から実行開始までの最大待ち時間 */
+    };
+
+    MainTaskScheduler();
+
+    /** @brief タスクを指定の優先度で投入 */
+    void Push(TaskFunction&& task, SchedulePriority priority);
+
+    /**
+     * @brief delay_ms後にタスクを指定の優先度で投入
+     *
+     * 期限はマイクロ秒で判定し、PromoteDueTimers()で期限を過ぎたものだけをリングへ移します。
+     * ホイールの一周（MAIN_TASK_TIMER_TICK_MS × MAIN_TASK_TIMER_SLOTS）より長い遅延も扱えます。
+     */
+    void PushAfter(TaskFunction&& task, uint32_t delay_ms, SchedulePriority priority);
+
+    /** @brief 期限を過ぎた遅延タスクをリングへ移す（メインイベントループから呼ぶ） */
+    void PromoteDueTimers();
+
+    /** @brief 次の遅延タスクの期限までのティック数（なければportMAX_DELAY） */
+    TickType_t TicksUntilNextTimer();
+
+    /**
+     * @brief 最も優先度の高いタスクを1件取り出して実行
+     * @return タスクを実行した場合true、キューが空ならfalse
+     */
+    bool RunNext();
+
+    /** @brief 統計をログに出力してリセット */
+    void PrintStats();
+
+private:
+    struct Entry {
+        TaskFunction task;
+        int64_t enqueued_us = 0;
+    };
+
+    struct Ring {
+        std::vector<Entry> slots;
+        size_t head = 0;
+        size_t count = 0;
+    };
+
+    /** @brief タイマーホイール上の遅延タスク */
+    struct Timer {
+        TaskFunction task;
+        int64_t deadline_us = 0;
+        SchedulePriority priority = kSchedulePriorityProtocol;
+    };
+
+    PriorityMutex mutex_{"main_scheduler"};         /**< リングと統計の保護 */
+    Ring rings_[kSchedulePriorityCount];
+    Stats stats_[kSchedulePriorityCount];
+
+    // スロットの配列は縮小しないため、定常状態ではメモリ確保が発生しない
+    std::vector<Timer> wheel_[MAIN_TASK_TIMER_SLOTS];
+    int64_t wheel_tick_ = 0;                        /**< 最後に処理したスロットの時刻（ティック） */
+    size_t timer_count_ = 0;
+    int64_t next_deadline_us_ = INT64_MAX;
+
+    static void Grow(Ring& ring);
+    void PushLocked(TaskFunction&& task, SchedulePriority priority, int64_t enqueued_us);
+};
+
+#endif // MAIN_TASK_SCHEDULER_H
@@ -6,20 +6,54 @@
 #include "mcp_server.h"
 #include <esp_log.h>
 #include <esp_app_desc.h>
+#include <esp_timer.h>
 #include <algorithm>
 #include <cstring>
 
 #include "application.h"
 #include "display.h"
 #include "board.h"
+#include "latency_trace.h"
+#include "boot_profile.h"
+#include "trace_recorder.h"
+#include "task_factory.h"
+#if CONFIG_USE_PERF_MONITOR
+#include "perf_monitor.h"
+#endif
+#if CONFIG_USE_AUDIO_TAP
+#include "audio_tap.h"
+#endif
+#if CONFIG_USE_WAKE_WORD_DETECT
+#include "wake_word_config.h"
+#endif
+#if CONFIG_USE_AUDIO_PROCESSOR || CONFIG_USE_WAKE_WORD_DETECT
+#include "afe_profile.h"
+#endif
+#if CONFIG_USE_HOSTED_LINK_DIAGNOSTICS
+#include "hosted_link.h"
+#endif
+#if CONFIG_USE_POWER_GOVERNOR
+#include "power_governor.h"
+#endif
+#if CONFIG_USE_THERMAL_MONITOR
+#include "thermal_monitor.h"
+#endif
+#if CONFIG_USE_FLIGHT_RECORDER
+#include "flight_recorder.h"
+#endif
 
 #define TAG "MCP"
 
 McpServer::McpServer() {
     AddCommonTools();
+    ESP_LOGI(TAG, "%u tools, hash %s", (unsigned)tools_.size(), tools_hash().c_str());
 }
 
 McpServer::~McpServer() {
+    if (workers_ != nullptr) {
+        workers_->WaitForCompletion();
+        delete workers_;
+    }
     for (auto tool : tools_) {
         delete tool;
     }
@@ -29,15 +63,148 @@ McpServer::~McpServer() {
 void McpServer::AddCommonTools() {
     auto& board = Board::GetInstance();
 
-    AddTool("self.get_device_status",
+    // 会話中に何度も呼ばれるため、音量・明るさ・テーマ・ネットワークが変わるまで結果を使い回す
+    AddCachedTool("self.get_device_status",
         "Provides the real-time information of the device, including the current status of the audio speaker, screen, battery, network, etc.\n"
         "Use this tool for: \n"
         "1. Answering questions about current condition (e.g. what is the current volume of the audio speaker?)\n"
         "2. As the first step to control the device (e.g. turn up / down the volume of the audio speaker, etc.)",
-        PropertyList(),
         [&board](const PropertyList& properties) -> ReturnValue {
             return board.GetDeviceStatusJson();
+        }, CONFIG_MCP_DEVICE_STATUS_CACHE_MS);
+
+    AddTool("self.get_latency_trace",
+        "Get the device-side latency trace of recent conversations (wake word, connect, hello, first uplink audio, "
+        "tts start, first downlink audio, first decode, first speaker output) as offsets from each session start.\n"
+        "Use this tool for diagnostics only when the user explicitly asks about response latency.",
+        PropertyList(),
+        [](const PropertyList& properties) -> ReturnValue {
+            return LatencyTrace::GetInstance().ToJson();
+        });
+
+    AddTool("self.get_boot_profile",
+        "Get the device boot timeline (app_main, board constructed, first frame, codec started, network connected, "
+        "version check done, protocol started, first idle) in milliseconds since power-on, for this boot and the "
+        "last few boots with their firmware versions.\n"
+        "Use this tool for diagnostics only when the user explicitly asks about startup time.",
+        PropertyList(),
+        [](const PropertyList& properties) -> ReturnValue {
+            return BootProfile::GetInstance().ToJson();
+        });
+
+#if CONFIG_USE_TRACE_SPANS
+    // 書き出しには数秒かかるため、メインタスクを止めないワーカーで実行する
+    AddAsyncTool("self.dump_trace",
+        "Dump the recorded runtime spans (audio front-end, Opus, resampling, network, display, tools) to the serial "
+        "console in Chrome trace format, and clear them.\n"
+        "Use this tool for diagnostics only when the user explicitly asks for a trace dump.",
+        PropertyList(),
+        [](const PropertyList& properties) -> ReturnValue {
+            return (int)TraceRecorder::GetInstance().DumpToConsole();
+        });
+#endif
+
+#if CONFIG_USE_PERF_MONITOR
+    AddTool("self.get_perf_stats",
+        "Get the device-side performance statistics of the last few minutes: per-task CPU usage (average and peak, "
+        "percent of all cores), minimum free stack bytes per task, free heap samples and lock contention.\n"
+        "Use this tool for diagnostics only when the user explicitly asks about device load or memory.",
+        PropertyList(),
+        [](const PropertyList& properties) -> ReturnValue {
+            return PerfMonitor::GetInstance().ToJson();
         });
+#endif
+
+    AddTool("self.task_placement.get",
+        "Get the CPU core planned for each firmware task and where it came from (kconfig, override or caller), "
+        "and, when available, the latest load of each core, the load of unpinned tasks and the tasks running on a "
+        "core other than planned.\n"
+        "Use this tool for diagnostics only when the user explicitly asks about CPU core usage.",
+        PropertyList(),
+        [](const PropertyList& properties) -> ReturnValue {
+            return GetTaskPlacementJson();
+        });
+
+    AddTool("self.task_placement.set",
+        "Pin a firmware task (by task name, e.g. `audio_send` or `bg_worker`) to a CPU core from the next reboot. "
+        "`core` is -1 for no affinity, or -2 to remove the override and use the build configuration.\n"
+        "Use this tool only when the user explicitly asks to move a task to another core.",
+        PropertyList({
+            Property("name", kPropertyTypeString),
+            Property("core", kPropertyTypeInteger, -2, -2, portNUM_PROCESSORS - 1)
+        }),
+        [](const PropertyList& properties) -> ReturnValue {
+            if (!SetTaskCoreOverride(properties["name"].value<std::string>(), properties["core"].value<int>())) {
+                return "{\"success\": false, \"message\": \"Invalid task name or core\"}";
+            }
+            return "{\"success\": true, \"message\": \"Takes effect after reboot\"}";
+        });
+
+#if CONFIG_USE_AUDIO_LOOPBACK_PROBE
+    AddAsyncTool("self.audio_speaker.measure_loopback",
+        "Play a short sweep tone and measure the speaker-to-microphone latency, the echo reference offset and the "
+        "echo cancellation (ERLE). Takes about 3 seconds and the device must stay quiet meanwhile.\n"
+        "Use this tool for diagnostics only when the user explicitly asks to measure audio latency or echo cancellation.",
+        PropertyList(),
+        [](const PropertyList& properties) -> ReturnValue {
+            return Application::GetInstance().MeasureAudioLoopback();
+        });
+#endif
+
+#if CONFIG_USE_AUDIO_TAP
+    AddTool("self.audio_tap.configure",
+        "Stream the PCM of the audio pipeline stages over UDP to a host running scripts/audio_tap_receiver.py. "
+        "`points` is a bit mask: 1 raw microphone, 2 echo reference, 4 resampled input, 8 audio processor output, "
+        "16 decoded speech, 32 speaker output. An empty host stops streaming. Returns the streaming statistics.\n"
+        "Use this tool for diagnostics only when the user explicitly asks to capture audio for analysis.",
+        PropertyList({
+            Property("host", kPropertyTypeString),
+            Property("port", kPropertyTypeInteger, CONFIG_AUDIO_TAP_PORT, 1, 65535),
+            Property("points", kPropertyTypeInteger, CONFIG_AUDIO_TAP_POINTS, 0, 63)
+        }),
+        [](const PropertyList& properties) -> ReturnValue {
+            auto& tap = AudioTap::GetInstance();
+            if (!tap.Configure(properties["host"].value<std::string>(), properties["port"].value<int>(),
+                    properties["points"].value<int>())) {
+                return "{\"success\": false, \"message\": \"Invalid host address\"}";
+            }
+            return tap.GetStatusJson();
+        });
+#endif
+
+#if CONFIG_USE_NET_BENCHMARK
+    AddAsyncTool("self.network.run_benchmark",
+        "Measure the network to the server: round-trip time percentiles, jitter, packet loss and uplink/downlink "
+        "throughput. Takes about 15 seconds; the conversation audio is paused meanwhile.\n"
+        "Use this tool for diagnostics only when the user explicitly asks to test the network or Wi-Fi quality.",
+        PropertyList(),
+        [](const PropertyList& properties) -> ReturnValue {
+            return Application::GetInstance().RunNetBenchmark();
+        });
+#endif
+
+#if CONFIG_USE_HOSTED_LINK_DIAGNOSTICS
+    AddTool("self.network.get_hosted_link",
+        "Get the settings of the hosted Wi-Fi link (SDIO clock, queue sizes, Wi-Fi buffers, TCP window) "
+        "and the result of the last download test.",
+        PropertyList(),
+        [](const PropertyList& properties) -> ReturnValue {
+            return hosted_link::GetStatusJson();
+        });
+
+    AddAsyncTool("self.network.run_download_test",
+        "Download from the given HTTP(S) URL for a while and report the throughput in kbps, using the same path as "
+        "firmware upgrades. The data is discarded.\n"
+        "Use this tool for diagnostics only when the user explicitly asks to test the download speed.",
+        PropertyList({
+            Property("url", kPropertyTypeString),
+            Property("seconds", kPropertyTypeInteger, CONFIG_HOSTED_DOWNLOAD_TEST_SECONDS, 2, 60)
+        }),
+        [](const PropertyList& properties) -> ReturnValue {
+            return hosted_link::RunDownloadTest(properties["url"].value<std::string>(),
+                properties["seconds"].value<int>());
+        });
+#endif
 
     AddTool("self.audio_speaker.set_volume", 
         "Set the volume of the audio speaker. If the current volume is unknown, you must call `self.get_device_status` tool first and then call this tool.",
@@ -50,6 +217,30 @@ void McpServer::AddCommonTools() {
             return true;
         });
     
+    AddTool("self.audio.get_level_control",
+        "Get whether microphone automatic gain control (AGC) and the speaker limiter are enabled, "
+        "and the CPU cost of the limiter.\n"
+        "Use this tool for diagnostics only when the user explicitly asks about audio level control.",
+        PropertyList(),
+        [](const PropertyList& properties) -> ReturnValue {
+            return Application::GetInstance().GetLevelControlJson();
+        });
+
+    AddTool("self.audio.set_level_control",
+        "Enable or disable microphone automatic gain control (AGC, helps when the user speaks from far away) "
+        "and the speaker limiter (prevents clipping at high volume). The setting is saved.",
+        PropertyList({
+            Property("input_agc", kPropertyTypeBoolean),
+            Property("output_limiter", kPropertyTypeBoolean)
+        }),
+        [](const PropertyList& properties) -> ReturnValue {
+            if (!Application::GetInstance().SetLevelControl(properties["input_agc"].value<bool>(),
+                    properties["output_limiter"].value<bool>())) {
+                return "{\"success\": false, \"message\": \"AGC is not available now, the setting is saved\"}";
+            }
+            return true;
+        });
+
     auto backlight = board.GetBacklight();
     if (backlight) {
         AddTool("self.screen.set_brightness",
@@ -73,40 +264,229 @@ void McpServer::AddCommonTools() {
             }),
             [display](const PropertyList& properties) -> ReturnValue {
                 display->SetTheme(properties["theme"].value<std::string>().c_str());
+                McpToolCache::Invalidate();
                 return true;
             });
     }
 
     auto camera = board.GetCamera();
     if (camera) {
-        AddTool("self.camera.take_photo",
+        AddAsyncTool("self.camera.take_photo",
             "Take a photo and explain it. Use this tool after the user asks you to see something.\n"
             "Args:\n"
             "  `question`: The question that you want to ask about the photo.\n"
+            "  `detail`: `low` sends a smaller, faster image that is enough for coarse questions "
+            "(what is this, what color); `normal` for reading text or small details.\n"
             "Return:\n"
             "  A JSON object that provides the photo information.",
             PropertyList({
-                Property("question", kPropertyTypeString)
+                Property("question", kPropertyTypeString),
+                Property("detail", kPropertyTypeString, std::string("normal"))
             }),
             [camera](const PropertyList& properties) -> ReturnValue {
+#if CONFIG_USE_POWER_GOVERNOR
+                if (!PowerGovernor::GetInstance().limits().camera) {
+                    return "{\"success\": false, \"message\": \"The camera is disabled to save battery\"}";
+                }
+#endif
                 if (!camera->Capture()) {
                     return "{\"success\": false, \"message\": \"Failed to capture photo\"}";
                 }
                 auto question = properties["question"].value<std::string>();
-                return camera->Explain(question);
+                auto detail = properties["detail"].value<std::string>() == "low" ? kExplainDetailLow : kExplainDetailNormal;
+                auto result = camera->Explain(question, detail);
+                // 全画面プレビュー中なら解析が終わった時点で通常の画面へ戻す
+                Board::GetInstance().GetDisplay()->EndPreviewFrames();
+                return result;
+            });
+
+        AddTool("self.camera.start_viewfinder",
+            "Show the live camera image on the screen, e.g. so the user can aim the camera before taking a photo.\n"
+            "Args:\n"
+            "  `fps`: Target frame rate.",
+            PropertyList({
+                Property("fps", kPropertyTypeInteger, 15, 1, CAMERA_VIEWFINDER_MAX_FPS)
+            }),
+            [camera](const PropertyList& properties) -> ReturnValue {
+#if CONFIG_USE_POWER_GOVERNOR
+                if (!PowerGovernor::GetInstance().limits().camera) {
+                    return "{\"success\": false, \"message\": \"The camera is disabled to save battery\"}";
+                }
+#endif
+#if CONFIG_USE_THERMAL_MONITOR
+                if (!ThermalMonitor::GetInstance().limits().camera_preview) {
+                    return "{\"success\": false, \"message\": \"Live preview is paused until the device cools down\"}";
+                }
+#endif
+                if (!camera->StartViewfinder(properties["fps"].value<int>())) {
+                    return "{\"success\": false, \"message\": \"Live preview is not supported on this display\"}";
+                }
+                return true;
+            });
+
+        AddTool("self.camera.stop_viewfinder",
+            "Stop the live camera image and return to the normal screen.",
+            PropertyList(),
+            [camera](const PropertyList& properties) -> ReturnValue {
+                camera->StopViewfinder();
+                return true;
             });
     }
+
+#if CONFIG_USE_AUDIO_PROCESSOR || CONFIG_USE_WAKE_WORD_DETECT
+    AddTool("self.audio.get_afe_profile",
+        "Get the microphone processing profile (`low_cost`, `balanced`, `high_perf` or `auto`), "
+        "the profile in use, and the recent CPU idle percentage.\n"
+        "Use this tool for diagnostics only when the user explicitly asks about audio processing.",
+        PropertyList(),
+        [](const PropertyList& properties) -> ReturnValue {
+            return AfeProfile::GetInstance().ToJson();
+        });
+
+    AddTool("self.audio.set_afe_profile",
+        "Set the microphone processing profile. `low_cost` saves CPU and battery, `high_perf` gives the best "
+        "noise reduction, `auto` chooses by battery level and CPU load. Takes effect after a reboot.",
+        PropertyList({
+            Property("profile", kPropertyTypeString)
+        }),
+        [](const PropertyList& properties) -> ReturnValue {
+            AfeProfileMode mode;
+            if (!AfeProfile::Parse(properties["profile"].value<std::string>(), mode)) {
+                return "{\"success\": false, \"message\": \"Unknown profile\"}";
+            }
+            AfeProfile::GetInstance().SetMode(mode);
+            return "{\"success\": true, \"message\": \"Takes effect after reboot\"}";
+        });
+#endif
+
+#if CONFIG_USE_POWER_GOVERNOR
+    AddTool("self.power.get_governor",
+        "Get the power tier chosen from the battery (`full` on external power, `battery`, or `saver` when low) "
+        "and the limits it applies to screen brightness, display refresh, voice encoding and the camera.\n"
+        "Use this tool for diagnostics only when the user explicitly asks about battery saving.",
+        PropertyList(),
+        [](const PropertyList& properties) -> ReturnValue {
+            return PowerGovernor::GetInstance().ToJson();
+        });
+#endif
+
+#if CONFIG_USE_THERMAL_MONITOR
+    AddTool("self.thermal.get_status",
+        "Get the chip temperature, the thermal level (`normal`, `warm`, `hot` or `critical`) "
+        "and the limits it applies to display refresh, voice processing, CPU frequency and the camera preview.\n"
+        "Use this tool for diagnostics only when the user explicitly asks whether the device is overheating.",
+        PropertyList(),
+        [](const PropertyList& properties) -> ReturnValue {
+            return ThermalMonitor::GetInstance().ToJson();
+        });
+#endif
+
+#if CONFIG_USE_FLIGHT_RECORDER
+    AddTool("self.diagnostics.get_flight_record",
+        "Get the flight recorder: state changes (DeviceState numbers), heap levels, audio queue depths, "
+        "audio loop stalls and protocol events. `previous` holds the records up to the last crash or "
+        "watchdog reset (null if the last reset was normal); `current` holds the latest records of this boot.\n"
+        "Use this tool for diagnostics only when the user explicitly asks why the device restarted.",
+        PropertyList(),
+        [](const PropertyList& properties) -> ReturnValue {
+            return FlightRecorder::GetInstance().ToJson();
+        });
+#endif
+
+#if CONFIG_USE_WAKE_WORD_DETECT
+    AddTool("self.wake_word.get_config",
+        "Get the wake word configuration: whether detection is enabled, the loaded models with their wake words "
+        "and thresholds (0 means the model default), and the models available on the device.",
+        PropertyList(),
+        [](const PropertyList& properties) -> ReturnValue {
+            return WakeWordConfig::GetInstance().ToJson();
+        });
+
+    AddTool("self.wake_word.set_enabled",
+        "Enable or disable wake word detection, e.g. to save battery. Disabling takes effect immediately; "
+        "enabling after booting with detection disabled takes effect after a reboot.",
+        PropertyList({
+            Property("enabled", kPropertyTypeBoolean)
+        }),
+        [](const PropertyList& properties) -> ReturnValue {
+            bool enabled = properties["enabled"].value<bool>();
+            if (!Application::GetInstance().GetWakeWordDetect().SetEnabled(enabled)) {
+                return "{\"success\": true, \"message\": \"Takes effect after reboot\"}";
+            }
+            return true;
+        });
+
+    AddTool("self.wake_word.set_threshold",
+        "Set the detection threshold of a wake word model. Higher is less sensitive.\n"
+        "Args:\n"
+        "  `model`: Model index in `self.wake_word.get_config` (0 or 1).\n"
+        "  `threshold`: " + std::to_string(WAKE_WORD_THRESHOLD_MIN) + "-" + std::to_string(WAKE_WORD_THRESHOLD_MAX) +
+        " percent, or 0 to restore the model default.",
+        PropertyList({
+            Property("model", kPropertyTypeInteger, 0, WAKE_WORD_MAX_MODELS - 1),
+            Property("threshold", kPropertyTypeInteger, 0, WAKE_WORD_THRESHOLD_MAX)
+        }),
+        [](const PropertyList& properties) -> ReturnValue {
+            int threshold = properties["threshold"].value<int>();
+            if (threshold != 0 && threshold < WAKE_WORD_THRESHOLD_MIN) {
+                return "{\"success\": false, \"message\": \"Threshold out of range\"}";
+            }
+            Application::GetInstance().GetWakeWordDetect().SetThreshold(properties["model"].value<int>(), threshold);
+            return true;
+        });
+
+    AddTool("self.wake_word.set_models",
+        "Select up to two wake word models from the available list, separated by `;`. Takes effect after a reboot.",
+        PropertyList({
+            Property("models", kPropertyTypeString)
+        }),
+        [](const PropertyList& properties) -> ReturnValue {
+            WakeWordConfig::GetInstance().SetModels(properties["models"].value<std::string>());
+            return true;
+        });
+#endif
 }
 
 void McpServer::AddTool(McpTool* tool) {
-    ESP_LOGI(TAG, "Add tool: %s", tool->name().c_str());
+    ESP_LOGI(TAG, "Add tool: %s", tool->name());
     tools_.push_back(tool);
+    tools_list_cache_.clear();
+    tools_hash_.clear();
+}
+
+const std::string& McpServer::tools_hash() {
+    if (tools_hash_.empty()) {
+        // tools/listと同じ定義を登録順にFNV-1a（64ビット）でまとめる。構成とファームウェアが同じなら変わらない
+        uint64_t hash = 0xcbf29ce484222325ULL;
+        for (auto tool : tools_) {
+            for (char c : tool->to_json()) {
+                hash = (hash ^ (uint8_t)c) * 0x100000001b3ULL;
+            }
+            hash = (hash ^ ',') * 0x100000001b3ULL;
+        }
+        char buffer[17];
+        snprintf(buffer, sizeof(buffer), "%016llx", (unsigned long long)hash);
+        tools_hash_ = buffer;
+    }
+    return tools_hash_;
 }
 
-void McpServer::AddTool(const std::string& name, const std::string& description, const PropertyList& properties, std::function<ReturnValue(const PropertyList&)> callback) {
+void McpServer::AddTool(const char* name, const char* description, const PropertyList& properties, std::function<ReturnValue(const PropertyList&)> callback) {
     AddTool(new McpTool(name, description, properties, callback));
 }
 
+void McpServer::AddAsyncTool(const char* name, const char* description, const PropertyList& properties, std::function<ReturnValue(const PropertyList&)> callback, bool concurrent) {
+    auto tool = new McpTool(name, description, properties, callback);
+    tool->set_async(concurrent);
+    AddTool(tool);
+}
+
+void McpServer::AddCachedTool(const char* name, const char* description, std::function<ReturnValue(const PropertyList&)> callback, int ttl_ms) {
+    auto tool = new McpTool(name, description, PropertyList(), callback);
+    tool->set_cache_ttl(ttl_ms);
+    AddTool(tool);
+}
+
 void McpServer::ParseMessage(const std::string& message) {
     cJSON* json = cJSON_Parse(message.c_str());
     if (json == nullptr) {
@@ -137,6 +517,27 @@ void McpServer::ParseCapabilities(const cJSON* capabilities) {
 }
 
 void McpServer::ParseMessage(const cJSON* json) {
+    if (!cJSON_IsArray(json)) {
+        ParseRequest(json);
+        return;
+    }
+
+    // JSON-RPCのバッチ。同期で返せる応答（initialize、tools/listなど）は1つの配列にまとめて送る
+    batch_task_ = xTaskGetCurrentTaskHandle();
+    batch_replies_ = "[";
+    const cJSON* request;
+    cJSON_ArrayForEach(request, json) {
+        ParseRequest(request);
+    }
+    batch_task_ = nullptr;
+    if (batch_replies_.size() > 1) {
+        batch_replies_.back() = ']';
+        Application::GetInstance().SendMcpMessage(batch_replies_);
+    }
+    batch_replies_.clear();
+}
+
+void McpServer::ParseRequest(const cJSON* json) {
     // Check JSONRPC version
     auto version = cJSON_GetObjectItem(json, "jsonrpc");
     if (version == nullptr || !cJSON_IsString(version) || strcmp(version->valuestring, "2.0") != 0) {
@@ -178,7 +579,10 @@ void McpServer::ParseMessage(const cJSON* json) {
             }
         }
         auto app_desc = esp_app_get_description();
-        std::string message = "{\"protocolVersion\":\"2024-11-05\",\"capabilities\":{\"tools\":{}},\"serverInfo\":{\"name\":\"" BOARD_NAME "\",\"version\":\"";
+        // toolsHashが保持している一覧と同じならtools/listを送らなくてよい
+        std::string message = "{\"protocolVersion\":\"2024-11-05\",\"capabilities\":{\"tools\":{\"toolsHash\":\"";
+        message += tools_hash();
+        message += "\"}},\"serverInfo\":{\"name\":\"" BOARD_NAME "\",\"version\":\"";
         message += app_desc->version;
         message += "\"}}";
         ReplyResult(id_int, message);
@@ -221,7 +625,7 @@ void McpServer::ReplyResult(int id, const std::string& result) {
     payload += std::to_string(id) + ",\"result\":";
     payload += result;
     payload += "}";
-    Application::GetInstance().SendMcpMessage(payload);
+    SendReply(payload);
 }
 
 void McpServer::ReplyError(int id, const std::string& message) {
@@ -230,18 +634,48 @@ void McpServer::ReplyError(int id, const std::string& message) {
     payload += ",\"error\":{\"message\":\"";
     payload += message;
     payload += "\"}}";
+    SendReply(payload);
+}
+
+void McpServer::SendReply(const std::string& payload) {
+    // バッチを処理中のタスクからの応答だけをまとめる（非同期ツールの応答は個別に送る）
+    if (batch_task_ != nullptr && batch_task_ == xTaskGetCurrentTaskHandle()) {
+        batch_replies_ += payload;
+        batch_replies_ += ',';
+        return;
+    }
     Application::GetInstance().SendMcpMessage(payload);
 }
 
 void McpServer::GetToolsList(int id, const std::string& cursor) {
+    auto cached = tools_list_cache_.find(cursor);
+    if (cached != tools_list_cache_.end()) {
+        ReplyResult(id, cached->second);
+        return;
+    }
+
+    std::string next_cursor;
+    std::string json = BuildToolsList(tools_, cursor, next_cursor);
+    if (json.empty()) {
+        // 如果没有添加任何tool，返回错误
+        ESP_LOGE(TAG, "tools/list: Failed to add tool %s because of payload size limit", next_cursor.c_str());
+        ReplyError(id, "Failed to add tool " + next_cursor + " because of payload size limit");
+        return;
+    }
+
+    ReplyResult(id, json);
+    tools_list_cache_[cursor] = std::move(json);
+}
+
+std::string McpServer::BuildToolsList(const std::vector<McpTool*>& tools, const std::string& cursor, std::string& next_cursor) {
     const int max_payload_size = 8000;
     std::string json = "{\"tools\":[";
     
     bool found_cursor = cursor.empty();
-    auto it = tools_.begin();
-    std::string next_cursor = "";
+    auto it = tools.begin();
+    next_cursor = "";
     
-    while (it != tools_.end()) {
+    while (it != tools.end()) {
         // 如果我们还没有找到起始位置，继续搜索
         if (!found_cursor) {
             if ((*it)->name() == cursor) {
@@ -268,11 +702,8 @@ void McpServer::GetToolsList(int id, const std::string& cursor) {
         json.pop_back();
     }
     
-    if (json.back() == '[' && !tools_.empty()) {
-        // 如果没有添加任何tool，返回错误
-        ESP_LOGE(TAG, "tools/list: Failed to add tool %s because of payload size limit", next_cursor.c_str());
-        ReplyError(id, "Failed to add tool " + next_cursor + " because of payload size limit");
-        return;
+    if (json.back() == '[' && !tools.empty()) {
+        return "";
     }
 
     if (next_cursor.empty()) {
@@ -280,27 +711,15 @@ void McpServer::GetToolsList(int id, const std::string& cursor) {
     } else {
         json += "],\"nextCursor\":\"" + next_cursor + "\"}";
     }
-    
-    ReplyResult(id, json);
+    return json;
 }
 
-void McpServer::DoToolCall(int id, const std::string& tool_name, const cJSON* tool_arguments) {
-    auto tool_iter = std::find_if(tools_.begin(), tools_.end(), 
-                                 [&tool_name](const McpTool* tool) { 
-                                     return tool->name() == tool_name; 
-                                 });
-    
-    if (tool_iter == tools_.end()) {
-        ESP_LOGE(TAG, "tools/call: Unknown tool: %s", tool_name.c_str());
-        ReplyError(id, "Unknown tool: " + tool_name);
-        return;
-    }
-
-    PropertyList arguments = (*tool_iter)->properties();
+bool McpServer::ParseArguments(const McpTool* tool, const cJSON* tool_arguments, PropertyList& arguments, std::string& error) {
+    arguments = tool->properties();
     for (auto& argument : arguments) {
         bool found = false;
         if (cJSON_IsObject(tool_arguments)) {
-            auto value = cJSON_GetObjectItem(tool_arguments, argument.name().c_str());
+            auto value = cJSON_GetObjectItem(tool_arguments, argument.name());
             if (argument.type() == kPropertyTypeBoolean && cJSON_IsBool(value)) {
                 argument.set_value<bool>(value->valueint == 1);
                 found = true;
@@ -314,18 +733,160 @@ void McpServer::DoToolCall(int id, const std::string& tool_name, const cJSON* to
         }
 
         if (!argument.has_default_value() && !found) {
-            ESP_LOGE(TAG, "tools/call: Missing valid argument: %s", argument.name().c_str());
-            ReplyError(id, "Missing valid argument: " + argument.name());
-            return;
+            error = std::string("Missing valid argument: ") + argument.name();
+            return false;
         }
     }
+    return true;
+}
+
+bool McpServer::CallToolLocally(const std::string& tool_name, const char* arguments_json) {
+    auto tool_iter = std::find_if(tools_.begin(), tools_.end(),
+                                 [&tool_name](const McpTool* tool) {
+                                     return tool->name() == tool_name;
+                                 });
+    if (tool_iter == tools_.end()) {
+        ESP_LOGW(TAG, "Local call: Unknown tool: %s", tool_name.c_str());
+        return false;
+    }
+    if ((*tool_iter)->async()) {
+        // 時間のかかるツールはサーバー経由で呼ぶ
+        ESP_LOGW(TAG, "Local call: %s is asynchronous", tool_name.c_str());
+        return false;
+    }
+
+    auto json = cJSON_Parse(arguments_json);
+    PropertyList arguments;
+    std::string error;
+    bool parsed = ParseArguments(*tool_iter, json, arguments, error);
+    cJSON_Delete(json);
+    if (!parsed) {
+        ESP_LOGE(TAG, "Local call: %s", error.c_str());
+        return false;
+    }
+
+    try {
+        TRACE_SPAN((*tool_iter)->name());
+        (*tool_iter)->Call(arguments);
+    } catch (const std::runtime_error& e) {
+        ESP_LOGE(TAG, "Local call: %s", e.what());
+        return false;
+    }
+    return true;
+}
+
+void McpServer::DoToolCall(int id, const std::string& tool_name, const cJSON* tool_arguments) {
+    auto tool_iter = std::find_if(tools_.begin(), tools_.end(), 
+                                 [&tool_name](const McpTool* tool) { 
+                                     return tool->name() == tool_name; 
+                                 });
+    
+    if (tool_iter == tools_.end()) {
+        ESP_LOGE(TAG, "tools/call: Unknown tool: %s", tool_name.c_str());
+        ReplyError(id, "Unknown tool: " + tool_name);
+        return;
+    }
+
+    PropertyList arguments;
+    std::string error;
+    if (!ParseArguments(*tool_iter, tool_arguments, arguments, error)) {
+        ESP_LOGE(TAG, "tools/call: %s", error.c_str());
+        ReplyError(id, error);
+        return;
+    }
+
+    if ((*tool_iter)->async()) {
+        DoAsyncToolCall(id, *tool_iter, std::move(arguments));
+        return;
+    }
 
     Application::GetInstance().Schedule([this, id, tool_iter, arguments = std::move(arguments)]() {
         try {
+            TRACE_SPAN((*tool_iter)->name());
             ReplyResult(id, (*tool_iter)->Call(arguments));
         } catch (const std::runtime_error& e) {
             ESP_LOGE(TAG, "tools/call: %s", e.what());
             ReplyError(id, e.what());
         }
     });
-}
\ No newline at end of file
+}
+
+void McpServer::DoAsyncToolCall(int id, McpTool* tool, PropertyList&& arguments) {
+    {
+        std::lock_guard<std::mutex> lock(calls_mutex_);
+        if (pending_calls_.count(id) > 0) {
+            ESP_LOGE(TAG, "tools/call: Duplicate request id %d", id);
+            ReplyError(id, "Duplicate request id");
+            return;
+        }
+        pending_calls_[id] = esp_timer_get_time() + CONFIG_MCP_TOOL_TIMEOUT_SECONDS * 1000000LL;
+        if (workers_ == nullptr) {
+            workers_ = new BackgroundTaskPool(CONFIG_MCP_TOOL_WORKER_COUNT, 4096 * 2, "mcp_tool", 2);
+        }
+    }
+
+    workers_->Schedule([this, id, tool, arguments = std::move(arguments)]() {
+        {
+            // 待っている間にタイムアウト・キャンセルされたら実行しない
+            std::lock_guard<std::mutex> lock(calls_mutex_);
+            if (pending_calls_.count(id) == 0) {
+                ESP_LOGW(TAG, "tools/call: %s (id %d) dropped before it started", tool->name(), id);
+                return;
+            }
+        }
+        std::string result;
+        std::string error;
+        int64_t start_time = esp_timer_get_time();
+        try {
+            TRACE_SPAN(tool->name());
+            result = tool->Call(arguments);
+        } catch (const std::runtime_error& e) {
+            ESP_LOGE(TAG, "tools/call: %s", e.what());
+            error = e.what();
+        }
+        ESP_LOGI(TAG, "tools/call: %s (id %d) took %lldms", tool->name(), id,
+            (esp_timer_get_time() - start_time) / 1000);
+        if (!FinishCall(id)) {
+            ESP_LOGW(TAG, "tools/call: Dropping the late reply for id %d", id);
+            return;
+        }
+        if (error.empty()) {
+            ReplyResult(id, result);
+        } else {
+            ReplyError(id, error);
+        }
+    }, tool->group());
+}
+
+bool McpServer::FinishCall(int id) {
+    std::lock_guard<std::mutex> lock(calls_mutex_);
+    return pending_calls_.erase(id) > 0;
+}
+
+void McpServer::CancelPendingCalls() {
+    std::lock_guard<std::mutex> lock(calls_mutex_);
+    if (!pending_calls_.empty()) {
+        ESP_LOGW(TAG, "Cancelling %u pending tool calls", pending_calls_.size());
+        pending_calls_.clear();
+    }
+}
+
+void McpServer::CheckTimeouts() {
+    std::vector<int> expired;
+    {
+        std::lock_guard<std::mutex> lock(calls_mutex_);
+        int64_t now = esp_timer_get_time();
+        for (auto it = pending_calls_.begin(); it != pending_calls_.end();) {
+            if (now >= it->second) {
+                expired.push_back(it->first);
+                it = pending_calls_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    for (int id : expired) {
+        ESP_LOGE(TAG, "tools/call: Request id %d timed out", id);
+        ReplyError(id, "Tool call timed out");
+    }
+}
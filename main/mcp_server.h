@@ -8,8 +8,15 @@
 #include <variant>
 #include <optional>
 #include <stdexcept>
+#include <cstring>
+#include <mutex>
+#include <atomic>
 
 #include <cJSON.h>
+#include <esp_timer.h>
+
+#include "background_task.h"
+#include "mcp_tool_cache.h"
 
 // 型エイリアスを追加
 using ReturnValue = std::variant<bool, int, std::string>;
@@ -20,9 +27,10 @@ enum PropertyType {
     kPropertyTypeString
 };
 
+// 名前と説明は文字列リテラル（フラッシュ上）を指し、ヒープにコピーしない
 class Property {
 private:
-    std::string name_;
+    const char* name_;
     PropertyType type_;
     std::variant<bool, int, std::string> value_;
     bool has_default_value_;
@@ -31,24 +39,24 @@ private:
 
 public:
     // Required field constructor
-    Property(const std::string& name, PropertyType type)
+    Property(const char* name, PropertyType type)
         : name_(name), type_(type), has_default_value_(false) {}
 
     // Optional field constructor with default value
     template<typename T>
-    Property(const std::string& name, PropertyType type, const T& default_value)
+    Property(const char* name, PropertyType type, const T& default_value)
         : name_(name), type_(type), has_default_value_(true) {
         value_ = default_value;
     }
 
-    Property(const std::string& name, PropertyType type, int min_value, int max_value)
+    Property(const char* name, PropertyType type, int min_value, int max_value)
         : name_(name), type_(type), has_default_value_(false), min_value_(min_value), max_value_(max_value) {
         if (type != kPropertyTypeInteger) {
             throw std::invalid_argument("Range limits only apply to integer properties");
         }
     }
 
-    Property(const std::string& name, PropertyType type, int default_value, int min_value, int max_value)
+    Property(const char* name, PropertyType type, int default_value, int min_value, int max_value)
         : name_(name), type_(type), has_default_value_(true), min_value_(min_value), max_value_(max_value) {
         if (type != kPropertyTypeInteger) {
             throw std::invalid_argument("Range limits only apply to integer properties");
@@ -59,7 +67,7 @@ public:
         value_ = default_value;
     }
 
-    inline const std::string& name() const { return name_; }
+    inline const char* name() const { return name_; }
     inline PropertyType type() const { return type_; }
     inline bool has_default_value() const { return has_default_value_; }
     inline bool has_range() const { return min_value_.has_value() && max_value_.has_value(); }
@@ -85,7 +93,8 @@ public:
         value_ = value;
     }
 
-    std::string to_json() const {
+    // 呼び出し側が所有するcJSONオブジェクトを返す
+    cJSON* to_cjson() const {
         cJSON *json = cJSON_CreateObject();
         
         if (type_ == kPropertyTypeBoolean) {
@@ -110,7 +119,11 @@ public:
                 cJSON_AddStringToObject(json, "default", value<std::string>().c_str());
             }
         }
-        
+        return json;
+    }
+
+    std::string to_json() const {
+        cJSON *json = to_cjson();
         char *json_str = cJSON_PrintUnformatted(json);
         std::string result(json_str);
         cJSON_free(json_str);
@@ -131,20 +144,21 @@ public:
         properties_.push_back(property);
     }
 
-    const Property& operator[](const std::string& name) const {
+    const Property& operator[](const char* name) const {
         for (const auto& property : properties_) {
-            if (property.name() == name) {
+            // 同じリテラルならポインタの比較で済む
+            if (property.name() == name || strcmp(property.name(), name) == 0) {
                 return property;
             }
         }
-        throw std::runtime_error("Property not found: " + name);
+        throw std::runtime_error(std::string("Property not found: ") + name);
     }
 
     auto begin() { return properties_.begin(); }
     auto end() { return properties_.end(); }
 
-    std::vector<std::string> GetRequired() const {
-        std::vector<std::string> required;
+    std::vector<const char*> GetRequired() const {
+        std::vector<const char*> required;
         for (auto& property : properties_) {
             if (!property.has_default_value()) {
                 required.push_back(property.name());
@@ -153,14 +167,17 @@ public:
         return required;
     }
 
-    std::string to_json() const {
+    // 文字列を経由せずに各プロパティのオブジェクトを組み立てる
+    cJSON* to_cjson() const {
         cJSON *json = cJSON_CreateObject();
-        
         for (const auto& property : properties_) {
-            cJSON *prop_json = cJSON_Parse(property.to_json().c_str());
-            cJSON_AddItemToObject(json, property.name().c_str(), prop_json);
+            cJSON_AddItemToObject(json, property.name(), property.to_cjson());
         }
-        
+        return json;
+    }
+
+    std::string to_json() const {
+        cJSON *json = to_cjson();
         char *json_str = cJSON_PrintUnformatted(json);
         std::string result(json_str);
         cJSON_free(json_str);
@@ -172,14 +189,21 @@ public:
 
 class McpTool {
 private:
-    std::string name_;
-    std::string description_;
+    const char* name_;          // 文字列リテラル
+    const char* description_;   // 文字列リテラル
     PropertyList properties_;
     std::function<ReturnValue(const PropertyList&)> callback_;
+    bool async_ = false;        // MCPワーカーで実行する（falseならメインループ）
+    int cache_ttl_ms_ = 0;      // 0より大きければ結果をこの時間保持する（引数のないツールのみ）
+    std::string cached_result_;
+    int64_t cached_at_us_ = 0;
+    uint32_t cached_generation_ = 0;
+    bool concurrent_ = false;   // 同じツールの呼び出しを並行して実行してよい
+    BackgroundTaskGroup group_{"mcp_tool", true};   // concurrent_でない非同期ツールを1件ずつ実行する
 
 public:
-    McpTool(const std::string& name, 
-            const std::string& description, 
+    McpTool(const char* name, 
+            const char* description, 
             const PropertyList& properties, 
             std::function<ReturnValue(const PropertyList&)> callback)
         : name_(name), 
@@ -187,27 +211,36 @@ public:
         properties_(properties), 
         callback_(callback) {}
 
-    inline const std::string& name() const { return name_; }
-    inline const std::string& description() const { return description_; }
+    inline const char* name() const { return name_; }
+    inline const char* description() const { return description_; }
     inline const PropertyList& properties() const { return properties_; }
+    inline bool async() const { return async_; }
+    inline bool concurrent() const { return concurrent_; }
+    inline BackgroundTaskGroup* group() { return concurrent_ ? nullptr : &group_; }
+
+    void set_async(bool concurrent) {
+        async_ = true;
+        concurrent_ = concurrent;
+    }
+
+    void set_cache_ttl(int ttl_ms) { cache_ttl_ms_ = ttl_ms; }
 
     std::string to_json() const {
-        std::vector<std::string> required = properties_.GetRequired();
+        std::vector<const char*> required = properties_.GetRequired();
         
         cJSON *json = cJSON_CreateObject();
-        cJSON_AddStringToObject(json, "name", name_.c_str());
-        cJSON_AddStringToObject(json, "description", description_.c_str());
+        cJSON_AddStringToObject(json, "name", name_);
+        cJSON_AddStringToObject(json, "description", description_);
         
         cJSON *input_schema = cJSON_CreateObject();
         cJSON_AddStringToObject(input_schema, "type", "object");
         
-        cJSON *properties = cJSON_Parse(properties_.to_json().c_str());
-        cJSON_AddItemToObject(input_schema, "properties", properties);
+        cJSON_AddItemToObject(input_schema, "properties", properties_.to_cjson());
         
         if (!required.empty()) {
             cJSON *required_array = cJSON_CreateArray();
             for (const auto& property : required) {
-                cJSON_AddItemToArray(required_array, cJSON_CreateString(property.c_str()));
+                cJSON_AddItemToArray(required_array, cJSON_CreateString(property));
             }
             cJSON_AddItemToObject(input_schema, "required", required_array);
         }
@@ -223,6 +256,12 @@ public:
     }
 
     std::string Call(const PropertyList& properties) {
+        // 有効期間内で、結果に含まれる値の変更（McpToolCache::Invalidate）もなければ保持した結果を返す
+        if (cache_ttl_ms_ > 0 && !cached_result_.empty() && cached_generation_ == McpToolCache::generation() &&
+                esp_timer_get_time() - cached_at_us_ < cache_ttl_ms_ * 1000LL) {
+            return cached_result_;
+        }
+        uint32_t generation = McpToolCache::generation();
         ReturnValue return_value = callback_(properties);
         // 結果を返す
         cJSON* result = cJSON_CreateObject();
@@ -244,6 +283,12 @@ public:
         std::string result_str(json_str);
         cJSON_free(json_str);
         cJSON_Delete(result);
+        if (cache_ttl_ms_ > 0) {
+            // 実行中に無効化された場合は、古い世代のまま保持して次の呼び出しで作り直す
+            cached_result_ = result_str;
+            cached_at_us_ = esp_timer_get_time();
+            cached_generation_ = generation;
+        }
         return result_str;
     }
 };
@@ -256,9 +301,27 @@ public:
     }
 
     void AddTool(McpTool* tool);
-    void AddTool(const std::string& name, const std::string& description, const PropertyList& properties, std::function<ReturnValue(const PropertyList&)> callback);
+    void AddTool(const char* name, const char* description, const PropertyList& properties, std::function<ReturnValue(const PropertyList&)> callback);
+    // 撮影やHTTP通信のように時間のかかるツール。受信経路やメインループを塞がないようMCPワーカーで実行する
+    void AddAsyncTool(const char* name, const char* description, const PropertyList& properties, std::function<ReturnValue(const PropertyList&)> callback, bool concurrent = false);
+    // 引数がなく副作用のないツール。結果をttl_ms保持し、McpToolCache::Invalidate()で作り直す
+    void AddCachedTool(const char* name, const char* description, std::function<ReturnValue(const PropertyList&)> callback, int ttl_ms);
     void ParseMessage(const cJSON* json);
     void ParseMessage(const std::string& message);
+    // オーディオチャネルが閉じたとき、未完了の非同期呼び出しの応答を破棄する
+    void CancelPendingCalls();
+    // 期限を過ぎた非同期呼び出しにタイムアウトのエラーを返す（定期的に呼ぶ）
+    void CheckTimeouts();
+    // サーバーを介さずにツールを呼ぶ（端末上のコマンド認識用、メインループから呼ぶ）。非同期ツールは対象外
+    bool CallToolLocally(const std::string& tool_name, const char* arguments_json);
+    // 登録済みツールの定義（tools/listの内容）のハッシュ（16桁の16進数）。helloとinitializeの応答に載せ、
+    // 同じハッシュのツール一覧を保持しているサーバーはtools/listを省略できる
+    const std::string& tools_hash();
+    // toolsのtools/listの結果を1ページ分作る（キャッシュしない）。cursorのツールから始め、
+    // 入りきらなければnext_cursorに続きのツール名を設定する。1つも入らなければ空文字列
+    static std::string BuildToolsList(const std::vector<McpTool*>& tools, const std::string& cursor, std::string& next_cursor);
+    // 登録済みのツール（登録順）
+    const std::vector<McpTool*>& tools() const { return tools_; }
 
 private:
     McpServer();
@@ -267,13 +330,32 @@ private:
     void AddCommonTools();
     void ParseCapabilities(const cJSON* capabilities);
 
+    void ParseRequest(const cJSON* json);
     void ReplyResult(int id, const std::string& result);
     void ReplyError(int id, const std::string& message);
+    void SendReply(const std::string& payload);
 
     void GetToolsList(int id, const std::string& cursor);
     void DoToolCall(int id, const std::string& tool_name, const cJSON* tool_arguments);
+    // ツールの引数定義にJSONの値を当てはめる。必須の引数が欠けていればfalse
+    bool ParseArguments(const McpTool* tool, const cJSON* tool_arguments, PropertyList& arguments, std::string& error);
 
     std::vector<McpTool*> tools_;
+
+    std::atomic<TaskHandle_t> batch_task_{nullptr};   // バッチを処理中のタスク
+    std::string batch_replies_;                         // バッチの応答（"[a,b,"の形で追記）
+
+    BackgroundTaskPool* workers_ = nullptr;     // 最初の非同期呼び出しで作成する
+    std::mutex calls_mutex_;
+    std::map<int, int64_t> pending_calls_;      // 非同期呼び出しのid→期限（esp_timer_get_time）
+
+    void DoAsyncToolCall(int id, McpTool* tool, PropertyList&& arguments);
+    // 待ち一覧から外す。すでにタイムアウト・キャンセル済みならfalse（応答を送らない）
+    bool FinishCall(int id);
+
+    // tools/listの応答（カーソル→result）。ツールは起動時に登録されるため、AddToolで破棄すれば十分
+    std::map<std::string, std::string> tools_list_cache_;
+    std::string tools_hash_;    // AddToolで破棄し、次のtools_hash()で作り直す
 };
 
 #endif // MCP_SERVER_H
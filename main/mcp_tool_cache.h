@@ -0,0 +1,28 @@
+/**
+ * @file mcp_tool_cache.h
+ * @brief 結果をキャッシュするMCPツールの無効化
+ *
+ * self.get_device_status のように同じ会話で何度も呼ばれるツールは、結果を有効期間の間
+ * 保持して返します（McpServer::AddCachedTool）。音量や明るさなど結果に含まれる値を
+ * 変えた箇所は McpToolCache::Invalidate() を呼び、次の呼び出しで作り直させます。
+ * McpServerを生成せずに呼べるため、コーデックやバックライトなど起動初期のモジュールからも使えます。
+ */
+#ifndef MCP_TOOL_CACHE_H
+#define MCP_TOOL_CACHE_H
+
+#include <atomic>
+#include <cstdint>
+
+class McpToolCache {
+public:
+    /** @brief すべてのツールの保持している結果を無効にする（任意のタスクから呼べる） */
+    static void Invalidate() { generation_.fetch_add(1, std::memory_order_relaxed); }
+
+    /** @brief 無効化の世代（結果を保持したときの値と異なれば作り直す） */
+    static uint32_t generation() { return generation_.load(std::memory_order_relaxed); }
+
+private:
+    static inline std::atomic<uint32_t> generation_{0};
+};
+
+#endif // MCP_TOOL_CACHE_H
@@ -0,0 +1,170 @@
+/**
+ * @file memory_budget.cc
+ * @brief メモリ予算サービスの実装
+ */
+#include "memory_budget.h"
+#if CONFIG_USE_METRICS
+#include "metrics.h"
+#endif
+
+#include <algorithm>
+#include <cstdio>
+#include <esp_heap_caps.h>
+#include <esp_log.h>
+
+#define TAG "MemoryBudget"
+
+static const char* const kPoolNames[kMemoryPoolCount] = {"internal", "psram"};
+
+static uint32_t PoolCaps(MemoryPool pool) {
+    return pool == kMemoryPoolInternal ? MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT : MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT;
+}
+
+#if CONFIG_USE_METRICS
+static MetricCallback metric_cache_usage("xiaozhi_memory_cache_bytes",
+    "Memory held by caches registered with the memory budget", kMetricGauge, [](MetricSink& sink) {
+        char labels[48];
+        MemoryBudget::GetInstance().ForEachConsumer([&](const char* name, MemoryPool pool, size_t usage, uint64_t) {
+            snprintf(labels, sizeof(labels), "cache=\"%s\",pool=\"%s\"", name, kPoolNames[pool]);
+            sink.Sample("", labels, usage);
+        });
+    });
+static MetricCallback metric_cache_reclaimed("xiaozhi_memory_reclaimed_bytes_total",
+    "Bytes released by caches at the request of the memory budget", kMetricCounter, [](MetricSink& sink) {
+        char labels[48];
+        MemoryBudget::GetInstance().ForEachConsumer([&](const char* name, MemoryPool pool, size_t, uint64_t reclaimed) {
+            snprintf(labels, sizeof(labels), "cache=\"%s\",pool=\"%s\"", name, kPoolNames[pool]);
+            sink.Sample("", labels, reclaimed);
+        });
+    });
+static MetricCallback metric_memory_pressure("xiaozhi_memory_pressure_total",
+    "Times free memory fell below the memory budget watermarks", kMetricCounter, [](MetricSink& sink) {
+        auto& budget = MemoryBudget::GetInstance();
+        sink.Sample("", "pool=\"internal\"", budget.pressure_events(kMemoryPoolInternal));
+        sink.Sample("", "pool=\"psram\"", budget.pressure_events(kMemoryPoolPsram));
+    });
+#endif
+
+int MemoryBudget::Register(const char* name, MemoryPool pool, MemoryPriority priority, UsageCallback usage,
+    ShrinkCallback shrink) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (int i = 0; i < MEMORY_BUDGET_MAX_CONSUMERS; ++i) {
+        auto& consumer = consumers_[i];
+        if (consumer.name != nullptr) {
+            continue;
+        }
+        consumer.name = name;
+        consumer.pool = pool;
+        consumer.priority = priority;
+        consumer.usage = std::move(usage);
+        consumer.shrink = std::move(shrink);
+        consumer.reclaim_count = 0;
+        consumer.reclaimed_bytes = 0;
+        ESP_LOGI(TAG, "Registered %s (%s, priority %d)", name, kPoolNames[pool], priority);
+        return i;
+    }
+    ESP_LOGE(TAG, "No room to register %s", name);
+    return -1;
+}
+
+void MemoryBudget::Unregister(int id) {
+    if (id < 0 || id >= MEMORY_BUDGET_MAX_CONSUMERS) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    consumers_[id] = Consumer();
+}
+
+size_t MemoryBudget::Reclaim(MemoryPool pool, size_t bytes, MemoryPriority max_priority) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t freed = 0;
+    for (int priority = kMemoryPriorityLow; priority <= max_priority && freed < bytes; ++priority) {
+        for (auto& consumer : consumers_) {
+            if (freed >= bytes) {
+                break;
+            }
+            if (consumer.name == nullptr || consumer.pool != pool || consumer.priority != priority) {
+                continue;
+            }
+            size_t released = consumer.shrink(bytes - freed);
+            if (released > 0) {
+                consumer.reclaim_count++;
+                consumer.reclaimed_bytes += released;
+                freed += released;
+                ESP_LOGW(TAG, "Reclaimed %u bytes from %s", (unsigned)released, consumer.name);
+            }
+        }
+    }
+    if (freed < bytes) {
+        failed_reclaims_[pool].fetch_add(1, std::memory_order_relaxed);
+    }
+    return freed;
+}
+
+bool MemoryBudget::Reserve(MemoryPool pool, size_t bytes) {
+    uint32_t caps = PoolCaps(pool);
+    size_t largest = heap_caps_get_largest_free_block(caps);
+    if (largest >= bytes) {
+        return true;
+    }
+    // 空き合計が足りていても断片化で入らないことがあるため、不足分より多めに求める
+    Reclaim(pool, std::max<size_t>(bytes - largest, MEMORY_BUDGET_MIN_RECLAIM_BYTES));
+    return heap_caps_get_largest_free_block(caps) >= bytes;
+}
+
+size_t MemoryBudget::Deficit(MemoryPool pool) {
+    uint32_t caps = PoolCaps(pool);
+    size_t total = heap_caps_get_total_size(caps);
+    if (total == 0) {
+        return 0;
+    }
+    size_t free_low;
+    size_t largest_low;
+    if (pool == kMemoryPoolInternal) {
+        free_low = CONFIG_MEMORY_BUDGET_INTERNAL_LOW_KB * 1024;
+        largest_low = CONFIG_MEMORY_BUDGET_INTERNAL_LARGEST_KB * 1024;
+    } else {
+#if CONFIG_SPIRAM
+        free_low = CONFIG_MEMORY_BUDGET_PSRAM_LOW_KB * 1024;
+        largest_low = free_low / 4;
+#else
+        return 0;
+#endif
+    }
+    size_t free = heap_caps_get_free_size(caps);
+    size_t largest = heap_caps_get_largest_free_block(caps);
+    size_t deficit = 0;
+    if (free < free_low) {
+        deficit = free_low - free;
+    }
+    if (largest < largest_low) {
+        deficit = std::max(deficit, largest_low - largest);
+    }
+    return deficit;
+}
+
+void MemoryBudget::Check() {
+    for (int pool = 0; pool < kMemoryPoolCount; ++pool) {
+        size_t deficit = Deficit((MemoryPool)pool);
+        if (deficit == 0) {
+            continue;
+        }
+        pressure_events_[pool].fetch_add(1, std::memory_order_relaxed);
+        // 水位の維持では、確保の失敗直前まで残すキャッシュには手を付けない
+        size_t freed = Reclaim((MemoryPool)pool, std::max<size_t>(deficit, MEMORY_BUDGET_MIN_RECLAIM_BYTES),
+            kMemoryPriorityNormal);
+        ESP_LOGW(TAG, "%s below watermark by %u bytes, reclaimed %u (free %u, largest %u)", kPoolNames[pool],
+            (unsigned)deficit, (unsigned)freed, heap_caps_get_free_size(PoolCaps((MemoryPool)pool)),
+            heap_caps_get_largest_free_block(PoolCaps((MemoryPool)pool)));
+    }
+}
+
+void MemoryBudget::ForEachConsumer(const std::function<void(const char* name, MemoryPool pool, size_t usage,
+    uint64_t reclaimed_bytes)>& callback) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& consumer : consumers_) {
+        if (consumer.name != nullptr) {
+            callback(consumer.name, consumer.pool, consumer.usage(), consumer.reclaimed_bytes);
+        }
+    }
+}
@@ -0,0 +1,121 @@
+/**
+ * @file memory_budget.h
+ * @brief キャッシュ類のメモリを一か所で見張り、不足時に優先度の低いものから回収するサービス
+ *
+ * TTSキャッシュやグリフキャッシュのように作り直せるメモリを持つサブシステムは、
+ * 使用量と縮小のコールバックを優先度付きで登録します。内部SRAMとPSRAMの空き容量と
+ * 最大連続空きブロックが水位を下回ったら、優先度の低いキャッシュから縮小させます。
+ * 音声経路の確保に失敗しそうなときはReserve()/Reclaim()でその場で回収してから確保し直します。
+ */
+#ifndef MEMORY_BUDGET_H
+#define MEMORY_BUDGET_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+
+/** @brief 登録できるキャッシュの数 */
+#define MEMORY_BUDGET_MAX_CONSUMERS 8
+
+/** @brief 1回の水位チェックで回収を求める最小のバイト数 */
+#define MEMORY_BUDGET_MIN_RECLAIM_BYTES 4096
+
+enum MemoryPool {
+    kMemoryPoolInternal,    // 内部SRAM（MALLOC_CAP_INTERNAL）
+    kMemoryPoolPsram,       // PSRAM（MALLOC_CAP_SPIRAM）
+    kMemoryPoolCount,
+};
+
+enum MemoryPriority {
+    kMemoryPriorityLow,     // 安く作り直せる（グリフなど）：最初に回収する
+    kMemoryPriorityNormal,  // 作り直しに通信などがかかる（TTS音声など）
+    kMemoryPriorityHigh,    // 確保に失敗する直前まで残す
+};
+
+/**
+ * @class MemoryBudget
+ * @brief メモリ予算のシングルトン
+ *
+ * コールバックはMemoryBudgetのロックを持ったまま、回収を求めたタスクから呼ばれます。
+ * 縮小コールバックはブロックしてはいけません（自分のロックはtry_lockで取り、
+ * 取れなければ0を返す）。キャッシュのロックを持つタスクが別のタスクの回収と
+ * 重なってもデッドロックしないようにするためです。コールバックから登録・解除はできません。
+ */
+class MemoryBudget {
+public:
+    /** @brief 現在の使用量（バイト）を返す */
+    using UsageCallback = std::function<size_t()>;
+    /** @brief 少なくとも引数のバイト数を解放するよう試み、解放したバイト数を返す */
+    using ShrinkCallback = std::function<size_t(size_t bytes)>;
+
+    static MemoryBudget& GetInstance() {
+        static MemoryBudget instance;
+        return instance;
+    }
+
+    MemoryBudget(const MemoryBudget&) = delete;
+    MemoryBudget& operator=(const MemoryBudget&) = delete;
+
+    /**
+     * @brief キャッシュを登録
+     * @param name ログとメトリクスに使う名前（静的な文字列）
+     * @return 登録ID。空きがない場合-1
+     */
+    int Register(const char* name, MemoryPool pool, MemoryPriority priority, UsageCallback usage,
+        ShrinkCallback shrink);
+
+    /** @brief 登録を解除（キャッシュの破棄前に呼ぶ） */
+    void Unregister(int id);
+
+    /**
+     * @brief 優先度の低いものから回収
+     * @param bytes 回収したいバイト数
+     * @param max_priority 回収してよい最も高い優先度
+     * @return 回収できたバイト数
+     */
+    size_t Reclaim(MemoryPool pool, size_t bytes, MemoryPriority max_priority = kMemoryPriorityHigh);
+
+    /**
+     * @brief bytesの連続領域を確保できる見込みを作る
+     * @return 最大連続空きブロックがbytes以上になった場合true
+     */
+    bool Reserve(MemoryPool pool, size_t bytes);
+
+    /** @brief 水位を確認し、下回っていれば回収（クロックタイマーから1秒ごとに呼ぶ） */
+    void Check();
+
+    /** @brief 登録されたキャッシュを順に渡す（使用量と累計の回収量） */
+    void ForEachConsumer(const std::function<void(const char* name, MemoryPool pool, size_t usage,
+        uint64_t reclaimed_bytes)>& callback);
+
+    /** @brief 水位を下回った回数 */
+    uint32_t pressure_events(MemoryPool pool) const { return pressure_events_[pool].load(std::memory_order_relaxed); }
+
+    /** @brief 回収しても求めた量に届かなかった回数 */
+    uint32_t failed_reclaims(MemoryPool pool) const { return failed_reclaims_[pool].load(std::memory_order_relaxed); }
+
+private:
+    MemoryBudget() = default;
+
+    struct Consumer {
+        const char* name = nullptr;
+        MemoryPool pool = kMemoryPoolPsram;
+        MemoryPriority priority = kMemoryPriorityLow;
+        UsageCallback usage;
+        ShrinkCallback shrink;
+        uint32_t reclaim_count = 0;
+        uint64_t reclaimed_bytes = 0;
+    };
+
+    /** @brief 水位を下回っている分のバイト数（下回っていなければ0） */
+    static size_t Deficit(MemoryPool pool);
+
+    std::mutex mutex_;
+    Consumer consumers_[MEMORY_BUDGET_MAX_CONSUMERS];
+    std::atomic<uint32_t> pressure_events_[kMemoryPoolCount] = {};
+    std::atomic<uint32_t> failed_reclaims_[kMemoryPoolCount] = {};
+};
+
+#endif // MEMORY_BUDGET_H
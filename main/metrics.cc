@@ -0,0 +1,223 @@
+/**
+ * @file metrics.cc
+ * @brief メトリクスのレジストリの実装
+ */
+#include "metrics.h"
+#if CONFIG_USE_DEBUG_HTTP_SERVER
+#include "debug_http_server.h"
+#endif
+
+#include <esp_heap_caps.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#if CONFIG_USE_TELEMETRY_UPLOAD
+#include <rom/miniz.h>
+#endif
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+
+#define TAG "Metrics"
+
+static MetricCallback metric_heap_free("xiaozhi_heap_internal_free_bytes",
+    "Free internal heap", kMetricGauge, [](MetricSink& sink) {
+        sink.Sample("", "", heap_caps_get_free_size(MALLOC_CAP_INTERNAL));
+    });
+static MetricCallback metric_heap_min_free("xiaozhi_heap_internal_min_free_bytes",
+    "Lowest free internal heap since boot", kMetricGauge, [](MetricSink& sink) {
+        sink.Sample("", "", heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL));
+    });
+static MetricCallback metric_heap_largest("xiaozhi_heap_internal_largest_block_bytes",
+    "Largest free internal heap block", kMetricGauge, [](MetricSink& sink) {
+        sink.Sample("", "", heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL));
+    });
+static MetricCallback metric_psram_free("xiaozhi_heap_psram_free_bytes",
+    "Free PSRAM", kMetricGauge, [](MetricSink& sink) {
+        sink.Sample("", "", heap_caps_get_free_size(MALLOC_CAP_SPIRAM));
+    });
+
+Metric::Metric(const char* name, const char* help, MetricType type) : name_(name), help_(help), type_(type) {
+    Metrics::GetInstance().Register(this);
+}
+
+MetricHistogram::MetricHistogram(const char* name, const char* help, const uint32_t* bounds, size_t bound_count)
+    : Metric(name, help, kMetricHistogram), bounds_(bounds), bound_count_(bound_count < kMaxBuckets ? bound_count : kMaxBuckets) {
+}
+
+void MetricHistogram::Observe(uint32_t value) {
+    size_t bucket = 0;
+    while (bucket < bound_count_ && value > bounds_[bucket]) {
+        bucket++;
+    }
+    buckets_[bucket].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    sum_.fetch_add(value, std::memory_order_relaxed);
+}
+
+void MetricHistogram::Collect(MetricSink& sink) const {
+    // Prometheusのバケットは累積
+    char labels[24];
+    uint32_t cumulative = 0;
+    for (size_t i = 0; i < bound_count_; i++) {
+        cumulative += buckets_[i].load(std::memory_order_relaxed);
+        snprintf(labels, sizeof(labels), "le=\"%" PRIu32 "\"", bounds_[i]);
+        sink.Sample("_bucket", labels, cumulative);
+    }
+    cumulative += buckets_[bound_count_].load(std::memory_order_relaxed);
+    sink.Sample("_bucket", "le=\"+Inf\"", cumulative);
+    sink.Sample("_sum", "", sum_.load(std::memory_order_relaxed));
+    sink.Sample("_count", "", count_.load(std::memory_order_relaxed));
+}
+
+void Metrics::Register(Metric* metric) {
+    metric->next_ = head_.load(std::memory_order_relaxed);
+    while (!head_.compare_exchange_weak(metric->next_, metric, std::memory_order_release, std::memory_order_relaxed)) {
+    }
+}
+
+std::vector<Metric*> Metrics::Snapshot() {
+    std::vector<Metric*> metrics;
+    for (auto metric = head_.load(std::memory_order_acquire); metric != nullptr; metric = metric->next_) {
+        metrics.push_back(metric);
+    }
+    std::reverse(metrics.begin(), metrics.end());
+    return metrics;
+}
+
+/** @brief "name{labels} value" の行を追記する */
+static void AppendSample(std::string& output, const char* name, const char* suffix, const char* labels, double value,
+    const char* format) {
+    char line[160];
+    if (labels[0] != '\0') {
+        snprintf(line, sizeof(line), format, name, suffix, "{", labels, "}", value);
+    } else {
+        snprintf(line, sizeof(line), format, name, suffix, "", "", "", value);
+    }
+    output += line;
+}
+
+std::string Metrics::RenderPrometheus() {
+    class TextSink : public MetricSink {
+    public:
+        TextSink(std::string& output, const char* name) : output_(output), name_(name) {}
+        void Sample(const char* suffix, const char* labels, double value) override {
+            AppendSample(output_, name_, suffix, labels, value, "%s%s%s%s%s %.10g\n");
+        }
+    private:
+        std::string& output_;
+        const char* name_;
+    };
+
+    static const char* const kTypeNames[] = {"counter", "gauge", "histogram"};
+    std::string output;
+    output.reserve(4096);
+    for (auto metric : Snapshot()) {
+        output += "# HELP ";
+        output += metric->name();
+        output += ' ';
+        output += metric->help();
+        output += "\n# TYPE ";
+        output += metric->name();
+        output += ' ';
+        output += kTypeNames[metric->type()];
+        output += '\n';
+        TextSink sink(output, metric->name());
+        metric->Collect(sink);
+    }
+    return output;
+}
+
+void Metrics::StartHttpEndpoint() {
+#if CONFIG_USE_DEBUG_HTTP_SERVER
+    DebugHttpServer::GetInstance().RegisterHandler("/metrics", [](httpd_req_t* req) -> esp_err_t {
+        auto metrics = static_cast<Metrics*>(req->user_ctx);
+        auto text = metrics->RenderPrometheus();
+        httpd_resp_set_type(req, "text/plain; version=0.0.4");
+        return httpd_resp_send(req, text.data(), text.size());
+    }, this);
+#endif
+}
+
+void Metrics::SampleTelemetry(std::function<void(std::string&& payload)> upload) {
+#if CONFIG_USE_TELEMETRY_UPLOAD
+    // {"t":<uptime_s>,"m":{"name{labels}":value,...}}
+    class JsonSink : public MetricSink {
+    public:
+        JsonSink(std::string& output) : output_(output) {}
+        void SetName(const char* name) { name_ = name; }
+        void Sample(const char* suffix, const char* labels, double value) override {
+            if (!first_) {
+                output_ += ',';
+            }
+            first_ = false;
+            // ラベルの二重引用符はJSON用にエスケープする
+            std::string escaped;
+            for (const char* p = labels; *p != '\0'; p++) {
+                if (*p == '"') {
+                    escaped += '\\';
+                }
+                escaped += *p;
+            }
+            AppendSample(output_, name_, suffix, escaped.c_str(), value, "\"%s%s%s%s%s\":%.10g");
+        }
+    private:
+        std::string& output_;
+        const char* name_ = "";
+        bool first_ = true;
+    };
+
+    if (batch_samples_ > 0) {
+        batch_ += ',';
+    }
+    char header[40];
+    snprintf(header, sizeof(header), "{\"t\":%lld,\"m\":{", esp_timer_get_time() / 1000000);
+    batch_ += header;
+    JsonSink sink(batch_);
+    for (auto metric : Snapshot()) {
+        sink.SetName(metric->name());
+        metric->Collect(sink);
+    }
+    batch_ += "}}";
+    if (++batch_samples_ < CONFIG_TELEMETRY_BATCH_SAMPLES) {
+        return;
+    }
+
+    std::string json = "{\"v\":1,\"interval_s\":" + std::to_string(CONFIG_TELEMETRY_SAMPLE_SECONDS) +
+        ",\"samples\":[" + batch_ + "]}";
+    batch_.clear();
+    batch_.shrink_to_fit();
+    batch_samples_ = 0;
+
+    std::string payload;
+    if (!Compress(json, payload)) {
+        ESP_LOGW(TAG, "Failed to compress telemetry, dropping %u bytes", (unsigned)json.size());
+        return;
+    }
+    ESP_LOGI(TAG, "Telemetry batch: %u bytes, %u compressed", (unsigned)json.size(), (unsigned)payload.size());
+    upload(std::move(payload));
+#endif
+}
+
+bool Metrics::Compress(const std::string& input, std::string& output) {
+#if CONFIG_USE_TELEMETRY_UPLOAD
+    // ROMのminizを使う。圧縮器の状態は大きいため、アップロードのたびにPSRAMへ確保して解放する
+    auto compressor = (tdefl_compressor*)heap_caps_malloc(sizeof(tdefl_compressor), MALLOC_CAP_SPIRAM);
+    if (compressor == nullptr) {
+        return false;
+    }
+    tdefl_init(compressor, nullptr, nullptr, TDEFL_WRITE_ZLIB_HEADER | 128);
+    output.resize(input.size() + input.size() / 16 + 64);
+    size_t in_size = input.size();
+    size_t out_size = output.size();
+    auto status = tdefl_compress(compressor, input.data(), &in_size, output.data(), &out_size, TDEFL_FINISH);
+    heap_caps_free(compressor);
+    if (status != TDEFL_STATUS_DONE) {
+        return false;
+    }
+    output.resize(out_size);
+    return true;
+#else
+    return false;
+#endif
+}
@@ -0,0 +1,177 @@
+/**
+ * @file metrics.h
+ * @brief カウンター・ゲージ・ヒストグラムのレジストリ
+ *
+ * 送受信の破棄、再接続、OTAの速度、RSSI、タスクごとのCPU使用率、ヒープなどを一か所に集め、
+ * 診断用HTTPサーバーの GET /metrics（Prometheusのテキスト形式）で公開します。
+ * CONFIG_USE_TELEMETRY_UPLOAD が有効なら一定間隔でスナップショットを取り、まとめてzlib圧縮した
+ * ものを既存のMQTT接続でアップロードして、機体全体のダッシュボードに使えるようにします。
+ */
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <freertos/FreeRTOS.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+/**
+ * @class MetricSink
+ * @brief メトリクスの値の書き出し先（Prometheusのテキスト、テレメトリのJSON）
+ */
+class MetricSink {
+public:
+    virtual ~MetricSink() = default;
+
+    /**
+     * @brief 値を1つ書き出す
+     * @param suffix 名前の接尾辞（ヒストグラムの "_bucket" など、なければ空文字）
+     * @param labels ラベル（"task=\"audio_loop\"" の形、なければ空文字）
+     */
+    virtual void Sample(const char* suffix, const char* labels, double value) = 0;
+};
+
+/** @brief メトリクスの種類（Prometheusの # TYPE） */
+enum MetricType {
+    kMetricCounter,
+    kMetricGauge,
+    kMetricHistogram,
+};
+
+/**
+ * @class Metric
+ * @brief レジストリに登録されるメトリクスの基底
+ *
+ * 静的変数として定義すると構築時にレジストリへ登録されます。名前とヘルプは文字列リテラルを渡します。
+ */
+class Metric {
+public:
+    Metric(const char* name, const char* help, MetricType type);
+    virtual ~Metric() = default;
+
+    Metric(const Metric&) = delete;
+    Metric& operator=(const Metric&) = delete;
+
+    const char* name() const { return name_; }
+    const char* help() const { return help_; }
+    MetricType type() const { return type_; }
+
+    virtual void Collect(MetricSink& sink) const = 0;
+
+private:
+    friend class Metrics;
+
+    const char* name_;
+    const char* help_;
+    MetricType type_;
+    Metric* next_ = nullptr;            /**< レジストリの連結リスト */
+};
+
+/** @brief 単調増加のカウンター */
+class MetricCounter : public Metric {
+public:
+    MetricCounter(const char* name, const char* help) : Metric(name, help, kMetricCounter) {}
+
+    void Increment(uint32_t count = 1) { value_.fetch_add(count, std::memory_order_relaxed); }
+    uint32_t value() const { return value_.load(std::memory_order_relaxed); }
+
+    void Collect(MetricSink& sink) const override { sink.Sample("", "", value()); }
+
+private:
+    std::atomic<uint32_t> value_{0};
+};
+
+/** @brief 最新の値を保持するゲージ */
+class MetricGauge : public Metric {
+public:
+    MetricGauge(const char* name, const char* help) : Metric(name, help, kMetricGauge) {}
+
+    void Set(int32_t value) { value_.store(value, std::memory_order_relaxed); }
+    int32_t value() const { return value_.load(std::memory_order_relaxed); }
+
+    void Collect(MetricSink& sink) const override { sink.Sample("", "", value()); }
+
+private:
+    std::atomic<int32_t> value_{0};
+};
+
+/** @brief 固定の区間を持つヒストグラム（区間の上限は昇順、最後に+Infが付く） */
+class MetricHistogram : public Metric {
+public:
+    /** @param bounds 区間の上限の配列（静的な配列を渡す。最大 kMaxBuckets 個） */
+    MetricHistogram(const char* name, const char* help, const uint32_t* bounds, size_t bound_count);
+
+    void Observe(uint32_t value);
+
+    void Collect(MetricSink& sink) const override;
+
+    static constexpr size_t kMaxBuckets = 12;
+
+private:
+    const uint32_t* bounds_;
+    size_t bound_count_;
+    std::atomic<uint32_t> buckets_[kMaxBuckets + 1] = {};
+    std::atomic<uint32_t> count_{0};
+    std::atomic<uint64_t> sum_{0};
+};
+
+/** @brief 読み出し時に値を計算するメトリクス（既存の統計、ラベル付きの値） */
+class MetricCallback : public Metric {
+public:
+    MetricCallback(const char* name, const char* help, MetricType type, std::function<void(MetricSink& sink)> collect)
+        : Metric(name, help, type), collect_(collect) {}
+
+    void Collect(MetricSink& sink) const override { collect_(sink); }
+
+private:
+    std::function<void(MetricSink& sink)> collect_;
+};
+
+/**
+ * @class Metrics
+ * @brief メトリクスのレジストリ（シングルトン）
+ */
+class Metrics {
+public:
+    static Metrics& GetInstance() {
+        static Metrics instance;
+        return instance;
+    }
+
+    Metrics(const Metrics&) = delete;
+    Metrics& operator=(const Metrics&) = delete;
+
+    /** @brief メトリクスを登録（静的初期化中にも呼ばれるため、ロックもヒープも使わない） */
+    void Register(Metric* metric);
+
+    /** @brief 登録されたすべてのメトリクスをPrometheusのテキスト形式で取得 */
+    std::string RenderPrometheus();
+
+    /** @brief 診断用HTTPサーバーに /metrics を登録 */
+    void StartHttpEndpoint();
+
+    /**
+     * @brief テレメトリ用のスナップショットを取り、バッチがたまったら圧縮して渡す
+     *
+     * CONFIG_TELEMETRY_SAMPLE_SECONDSごとにメインタスクから呼びます。
+     * CONFIG_TELEMETRY_BATCH_SAMPLES 個たまると、zlib圧縮したJSONを upload に渡します。
+     */
+    void SampleTelemetry(std::function<void(std::string&& payload)> upload);
+
+private:
+    Metrics() = default;
+
+    std::atomic<Metric*> head_{nullptr};  /**< 登録済みメトリクスの連結リスト（追加のみ） */
+    std::string batch_;                 /**< テレメトリのサンプル（JSON配列の要素をカンマ区切りで連結） */
+    size_t batch_samples_ = 0;
+
+    /** @brief 登録順にメトリクスを列挙 */
+    std::vector<Metric*> Snapshot();
+    static bool Compress(const std::string& input, std::string& output);
+};
+
+#endif // METRICS_H
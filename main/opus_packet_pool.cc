@@ -0,0 +1,160 @@
+/**
+ * @file opus_packet_pool.cc
+ * @brief Opusパケット用固定サイズバッファプールの実装
+ */
+#include "opus_packet_pool.h"
+#if CONFIG_USE_MEMORY_BUDGET
+#include "memory_budget.h"
+#endif
+
+#include <cstring>
+#include <utility>
+#include <esp_heap_caps.h>
+#include <esp_log.h>
+
+#define TAG "OpusPacketPool"
+
+#if CONFIG_OPUS_PACKET_POOL_IN_PSRAM
+#define OPUS_PACKET_POOL_CAPS (MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT)
+#else
+#define OPUS_PACKET_POOL_CAPS (MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT)
+#endif
+
+// 各ブロックはヘッドルーム + ペイロード容量で構成される
+static constexpr size_t kBlockStride = OPUS_PACKET_HEADROOM + OPUS_PACKET_POOL_BLOCK_SIZE;
+
+OpusPacketPool::OpusPacketPool() {
+    block_count_ = CONFIG_OPUS_PACKET_POOL_SIZE;
+    storage_ = (uint8_t*)heap_caps_malloc(block_count_ * kBlockStride, OPUS_PACKET_POOL_CAPS);
+    free_list_ = (uint8_t**)heap_caps_malloc(block_count_ * sizeof(uint8_t*), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (storage_ == nullptr || free_list_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate %u packet buffers", block_count_);
+        heap_caps_free(storage_);
+        heap_caps_free(free_list_);
+        storage_ = nullptr;
+        free_list_ = nullptr;
+        block_count_ = 0;
+        return;
+    }
+
+    for (size_t i = 0; i < block_count_; i++) {
+        free_list_[i] = storage_ + i * kBlockStride;
+    }
+    free_count_ = block_count_;
+    min_free_count_ = block_count_;
+    ESP_LOGI(TAG, "Packet pool: %u x %u bytes", block_count_, OPUS_PACKET_POOL_BLOCK_SIZE);
+}
+
+OpusPacketPool::~OpusPacketPool() {
+    heap_caps_free(storage_);
+    heap_caps_free(free_list_);
+}
+
+uint8_t* OpusPacketPool::Allocate() {
+    uint8_t* block = nullptr;
+    taskENTER_CRITICAL(&spinlock_);
+    if (free_count_ > 0) {
+        block = free_list_[--free_count_];
+        if (free_count_ < min_free_count_) {
+            min_free_count_ = free_count_;
+        }
+    }
+    taskEXIT_CRITICAL(&spinlock_);
+    return block;
+}
+
+void OpusPacketPool::Free(uint8_t* block) {
+    if (block == nullptr) {
+        return;
+    }
+    taskENTER_CRITICAL(&spinlock_);
+    free_list_[free_count_++] = block;
+    taskEXIT_CRITICAL(&spinlock_);
+}
+
+OpusPacketBuffer::OpusPacketBuffer(OpusPacketBuffer&& other) noexcept
+    : data_(other.data_), size_(other.size_), capacity_(other.capacity_), pooled_(other.pooled_) {
+    other.data_ = nullptr;
+    other.size_ = 0;
+    other.capacity_ = 0;
+    other.pooled_ = false;
+}
+
+OpusPacketBuffer& OpusPacketBuffer::operator=(OpusPacketBuffer&& other) noexcept {
+    if (this != &other) {
+        Release();
+        std::swap(data_, other.data_);
+        std::swap(size_, other.size_);
+        std::swap(capacity_, other.capacity_);
+        std::swap(pooled_, other.pooled_);
+    }
+    return *this;
+}
+
+void OpusPacketBuffer::Release() {
+    if (data_ != nullptr) {
+        uint8_t* block = data_ - OPUS_PACKET_HEADROOM;
+        if (pooled_) {
+            OpusPacketPool::GetInstance().Free(block);
+        } else {
+            heap_caps_free(block);
+        }
+    }
+    data_ = nullptr;
+    size_ = 0;
+    capacity_ = 0;
+    pooled_ = false;
+}
+
+void OpusPacketBuffer::resize(size_t size) {
+    if (size <= capacity_) {
+        size_ = size;
+        return;
+    }
+
+    auto& pool = OpusPacketPool::GetInstance();
+    uint8_t* block = nullptr;
+    size_t capacity = 0;
+    bool pooled = false;
+    if (size <= OPUS_PACKET_POOL_BLOCK_SIZE) {
+        block = pool.Allocate();
+        capacity = OPUS_PACKET_POOL_BLOCK_SIZE;
+        pooled = block != nullptr;
+    }
+    if (block == nullptr) {
+        // プール枯渇またはサイズ超過時はヒープから確保する
+        block = (uint8_t*)heap_caps_malloc(OPUS_PACKET_HEADROOM + size, MALLOC_CAP_8BIT);
+#if CONFIG_USE_MEMORY_BUDGET
+        // 音声を落とす前に、作り直せるキャッシュを捨ててもう一度だけ試す
+        for (int i = 0; block == nullptr && i < kMemoryPoolCount; ++i) {
+            if (MemoryBudget::GetInstance().Reclaim((MemoryPool)i, OPUS_PACKET_HEADROOM + size) > 0) {
+                block = (uint8_t*)heap_caps_malloc(OPUS_PACKET_HEADROOM + size, MALLOC_CAP_8BIT);
+            }
+        }
+#endif
+        capacity = size;
+        pool.CountFallback();
+        if (block == nullptr) {
+            ESP_LOGE(TAG, "Failed to allocate packet buffer of %u bytes", size);
+            size_ = 0;
+            return;
+        }
+    }
+
+    if (size_ > 0) {
+        memcpy(block + OPUS_PACKET_HEADROOM, data_, size_);
+    }
+    Release();
+    data_ = block + OPUS_PACKET_HEADROOM;
+    size_ = size;
+    capacity_ = capacity;
+    pooled_ = pooled;
+}
+
+void OpusPacketBuffer::assign(const uint8_t* data, size_t size) {
+    size_ = 0;
+    resize(size);
+    if (size_ == size && size > 0) {
+        memcpy(data_, data, size);
+    }
+}
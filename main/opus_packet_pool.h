@@ -0,0 +1,139 @@
+/**
+ * @file opus_packet_pool.h
+ * @brief Opusパケット用固定サイズバッファプール
+ *
+ * Opusフレームを格納する固定サイズのバッファを起動時に一括確保し、
+ * パケットごとのヒープ確保による内部SRAMの断片化を防ぎます。
+ * バッファはムーブ専用ハンドル OpusPacketBuffer を通して貸し出され、
+ * ハンドルの破棄時に自動的にプールへ返却されます。
+ */
+#ifndef OPUS_PACKET_POOL_H
+#define OPUS_PACKET_POOL_H
+
+#include <freertos/FreeRTOS.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+/** @brief Opusパケットの最大サイズ（1275バイト、RFC 6716） */
+#define OPUS_PACKET_MAX_SIZE 1275
+
+/** @brief プールの1ブロックあたりのペイロード容量（バイト） */
+#define OPUS_PACKET_POOL_BLOCK_SIZE 1280
+
+/**
+ * @brief ペイロード前方に確保するヘッドルーム（バイト）
+ *
+ * 送信時にプロトコルヘッダ（BinaryProtocol2 は16バイト）を
+ * ペイロードの直前へ書き込み、コピーせずに送信するために使用します。
+ */
+#define OPUS_PACKET_HEADROOM 16
+
+class OpusPacketPool;
+
+/**
+ * @class OpusPacketBuffer
+ * @brief プールから貸し出されたOpusパケットバッファのムーブ専用ハンドル
+ *
+ * std::vector<uint8_t> に近いインターフェースを持ち、既存のコードから
+ * そのまま置き換えられます。プールが枯渇した場合やブロックサイズを
+ * 超える場合はヒープから確保したバッファにフォールバックします。
+ */
+class OpusPacketBuffer {
+public:
+    OpusPacketBuffer() = default;
+    ~OpusPacketBuffer() { Release(); }
+
+    OpusPacketBuffer(OpusPacketBuffer&& other) noexcept;
+    OpusPacketBuffer& operator=(OpusPacketBuffer&& other) noexcept;
+    OpusPacketBuffer(const OpusPacketBuffer&) = delete;
+    OpusPacketBuffer& operator=(const OpusPacketBuffer&) = delete;
+
+    uint8_t* data() { return data_; }
+    const uint8_t* data() const { return data_; }
+    size_t size() const { return size_; }
+    size_t capacity() const { return capacity_; }
+    bool empty() const { return size_ == 0; }
+
+    /**
+     * @brief サイズを変更（必要に応じてバッファを確保）
+     * @note 容量を超える場合は既存データを保持したまま再確保します
+     */
+    void resize(size_t size);
+
+    /** @brief データをコピーして設定 */
+    void assign(const uint8_t* data, size_t size);
+    void assign(const uint8_t* first, const uint8_t* last) { assign(first, last - first); }
+
+    /** @brief サイズを0にする（バッファは保持） */
+    void clear() { size_ = 0; }
+
+    /**
+     * @brief ペイロード直前のヘッドルームを取得
+     * @param header_size 必要なヘッダサイズ（OPUS_PACKET_HEADROOM以下）
+     * @return ヘッダ書き込み先（data() - header_size）。確保できない場合はnullptr
+     * @note ヘッダとペイロードは連続した領域となり、そのまま送信できます
+     */
+    uint8_t* Prepend(size_t header_size) {
+        if (data_ == nullptr || header_size > OPUS_PACKET_HEADROOM) {
+            return nullptr;
+        }
+        return data_ - header_size;
+    }
+
+    /** @brief バッファをプールへ返却 */
+    void Release();
+
+private:
+    uint8_t* data_ = nullptr;     /**< ペイロード先頭（確保領域の先頭 + OPUS_PACKET_HEADROOM） */
+    size_t size_ = 0;             /**< 有効データサイズ */
+    size_t capacity_ = 0;         /**< ペイロード容量 */
+    bool pooled_ = false;         /**< プール由来のバッファかどうか */
+};
+
+/**
+ * @class OpusPacketPool
+ * @brief 固定サイズブロックのスラブアロケータ（シングルトン）
+ *
+ * 配置先（内部SRAM/PSRAM）とブロック数はKconfigで選択します。
+ * 任意のタスクから呼び出し可能です。
+ */
+class OpusPacketPool {
+public:
+    static OpusPacketPool& GetInstance() {
+        static OpusPacketPool instance;
+        return instance;
+    }
+    OpusPacketPool(const OpusPacketPool&) = delete;
+    OpusPacketPool& operator=(const OpusPacketPool&) = delete;
+
+    /**
+     * @brief ブロックを1つ取得
+     * @return 空きがない場合はnullptr
+     */
+    uint8_t* Allocate();
+
+    /** @brief ブロックを返却 */
+    void Free(uint8_t* block);
+
+    size_t block_count() const { return block_count_; }
+    size_t free_count() const { return free_count_; }
+    size_t min_free_count() const { return min_free_count_; }
+    size_t fallback_count() const { return fallback_count_; }
+    void CountFallback() { fallback_count_++; }
+
+private:
+    OpusPacketPool();
+    ~OpusPacketPool();
+
+    portMUX_TYPE spinlock_ = portMUX_INITIALIZER_UNLOCKED;  /**< フリーリスト保護用 */
+    uint8_t* storage_ = nullptr;     /**< ブロック領域 */
+    uint8_t** free_list_ = nullptr;  /**< 空きブロックのスタック */
+    size_t block_count_ = 0;         /**< 総ブロック数 */
+    size_t free_count_ = 0;          /**< 空きブロック数 */
+    size_t min_free_count_ = 0;      /**< 空きブロック数の最小値 */
+    std::atomic<size_t> fallback_count_{0};  /**< ヒープへフォールバックした回数 */
+};
+
+#endif // OPUS_PACKET_POOL_H
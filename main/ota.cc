@@ -1,7 +1,19 @@
 #include "ota.h"
+#include "ota_decoder.h"
 #include "system_info.h"
 #include "settings.h"
+#include "json_stream_parser.h"
+#include "task_factory.h"
+#if CONFIG_MODEL_OTA
+#include "model_loader.h"
+#endif
+#if CONFIG_ASSET_OTA
+#include "asset_bundle.h"
+#endif
 #include "assets/lang_config.h"
+#if CONFIG_USE_METRICS
+#include "metrics.h"
+#endif
 
 #include <cJSON.h>
 #include <esp_log.h>
@@ -10,17 +22,27 @@
 #include <esp_app_format.h>
 #include <esp_efuse.h>
 #include <esp_efuse_table.h>
+#include <esp_heap_caps.h>
+#include <mbedtls/sha256.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
 #ifdef SOC_HMAC_SUPPORTED
 #include <esp_hmac.h>
 #endif
 
 #include <cstring>
+#include <memory>
 #include <vector>
 #include <sstream>
 #include <algorithm>
 
 #define TAG "Ota"
 
+#if CONFIG_USE_METRICS
+static MetricGauge ota_download_speed("xiaozhi_ota_download_bytes_per_second", "Firmware download speed of the last OTA");
+#endif
+
 
 Ota::Ota() {
 #ifdef ESP_EFUSE_BLOCK_USR_DATA
@@ -59,6 +81,15 @@ Http* Ota::SetupHttp() {
     http->SetHeader("Client-Id", board.GetUuid());
     http->SetHeader("User-Agent", std::string(BOARD_NAME "/") + app_desc->version);
     http->SetHeader("Accept-Language", Lang::CODE);
+#if CONFIG_MODEL_OTA
+    {
+        Settings model_settings("model");
+        http->SetHeader("Model-Version", model_settings.GetString("version"));
+    }
+#endif
+#if CONFIG_ASSET_OTA
+    http->SetHeader("Assets-Version", AssetBundle::GetInstance().version());
+#endif
     http->SetHeader("Content-Type", "application/json");
 
     return http;
@@ -95,133 +126,234 @@ bool Ota::CheckVersion() {
         return false;
     }
 
-    data = http->ReadAll();
-    http->Close();
-
-    // Response: { "firmware": { "version": "1.0.0", "url": "http://" } }
-    // Parse the JSON response and check if the version is newer
-    // If it is, set has_new_version_ to true and store the new version and URL
-    
-    cJSON *root = cJSON_Parse(data.c_str());
-    if (root == NULL) {
-        ESP_LOGE(TAG, "Failed to parse JSON response");
-        return false;
-    }
-
+    // 応答は受信しながら解析し、mqtt / websocket の値はそのまま各Settingsの名前空間へ書き込む。
+    // 応答の本体もcJSONの木も持たないので、起動直後の断片化したヒープでも大きな確保が要らない
     has_activation_code_ = false;
     has_activation_challenge_ = false;
-    cJSON *activation = cJSON_GetObjectItem(root, "activation");
-    if (cJSON_IsObject(activation)) {
-        cJSON* message = cJSON_GetObjectItem(activation, "message");
-        if (cJSON_IsString(message)) {
-            activation_message_ = message->valuestring;
-        }
-        cJSON* code = cJSON_GetObjectItem(activation, "code");
-        if (cJSON_IsString(code)) {
-            activation_code_ = code->valuestring;
-            has_activation_code_ = true;
+    activation_long_poll_ = false;
+    activation_payload_.clear();
+    has_mqtt_config_ = false;
+    has_websocket_config_ = false;
+    has_server_time_ = false;
+    has_new_version_ = false;
+
+    std::unique_ptr<Settings> section;
+    std::string websocket_urls;
+    bool has_server_time_section = false;
+    bool has_timestamp = false;
+    double timestamp = 0;
+    int timezone_offset = 0;
+    bool has_firmware = false;
+    firmware_sha256_.clear();
+    bool has_firmware_version = false;
+    bool has_firmware_url = false;
+    bool force_firmware = false;
+#if CONFIG_MODEL_OTA
+    has_new_model_version_ = false;
+    model_version_.clear();
+    model_url_.clear();
+    model_sha256_.clear();
+#endif
+#if CONFIG_ASSET_OTA
+    has_new_assets_version_ = false;
+    assets_version_.clear();
+    assets_url_.clear();
+    assets_sha256_.clear();
+#endif
+
+    JsonStreamParser parser([&](const JsonStreamParser& p, JsonStreamEvent event, const char* value, size_t length) {
+        if (p.depth() == 1) {
+            // 最上位のセクションの開始と終了
+            const char* name = p.key(0);
+            if (event == kJsonStreamObjectBegin) {
+                if (strcmp(name, "mqtt") == 0) {
+                    section = std::make_unique<Settings>("mqtt", true);
+                    has_mqtt_config_ = true;
+                } else if (strcmp(name, "websocket") == 0) {
+                    section = std::make_unique<Settings>("websocket", true);
+                    websocket_urls.clear();
+                    has_websocket_config_ = true;
+                } else if (strcmp(name, "server_time") == 0) {
+                    has_server_time_section = true;
+                } else if (strcmp(name, "firmware") == 0) {
+                    has_firmware = true;
+                }
+            } else if (event == kJsonStreamObjectEnd && section) {
+                if (strcmp(name, "websocket") == 0) {
+                    // 複数のエンドポイントは改行区切りで保存し、WebsocketProtocolが計測して速いものを選ぶ
+                    if (websocket_urls != section->GetString("urls")) {
+                        section->SetString("urls", websocket_urls);
+                        section->EraseKey("best_url");
+                    }
+                }
+                section.reset();
+            }
+            return;
         }
-        cJSON* challenge = cJSON_GetObjectItem(activation, "challenge");
-        if (cJSON_IsString(challenge)) {
-            activation_challenge_ = challenge->valuestring;
-            has_activation_challenge_ = true;
+
+        if (p.depth() == 3 && event == kJsonStreamString && p.Match({"websocket", "urls", ""})) {
+            if (!websocket_urls.empty()) {
+                websocket_urls += '\n';
+            }
+            websocket_urls.append(value, length);
+            return;
         }
-        cJSON* timeout_ms = cJSON_GetObjectItem(activation, "timeout_ms");
-        if (cJSON_IsNumber(timeout_ms)) {
-            activation_timeout_ms_ = timeout_ms->valueint;
+        if (p.depth() != 2) {
+            return;
         }
-    }
 
-    has_mqtt_config_ = false;
-    cJSON *mqtt = cJSON_GetObjectItem(root, "mqtt");
-    if (cJSON_IsObject(mqtt)) {
-        Settings settings("mqtt", true);
-        cJSON *item = NULL;
-        cJSON_ArrayForEach(item, mqtt) {
-            if (cJSON_IsString(item)) {
-                if (settings.GetString(item->string) != item->valuestring) {
-                    settings.SetString(item->string, item->valuestring);
-                }
+        const char* name = p.key(0);
+        const char* item = p.key(1);
+        if (strcmp(name, "mqtt") == 0) {
+            if (event == kJsonStreamString && section->GetString(item) != value) {
+                section->SetString(item, value);
+            }
+        } else if (strcmp(name, "websocket") == 0) {
+            if (event == kJsonStreamString) {
+                section->SetString(item, value);
+            } else if (event == kJsonStreamNumber) {
+                section->SetInt(item, atoi(value));
+            }
+        } else if (strcmp(name, "activation") == 0) {
+            if (event == kJsonStreamString && strcmp(item, "message") == 0) {
+                activation_message_ = value;
+            } else if (event == kJsonStreamString && strcmp(item, "code") == 0) {
+                activation_code_ = value;
+                has_activation_code_ = true;
+            } else if (event == kJsonStreamString && strcmp(item, "challenge") == 0) {
+                activation_challenge_ = value;
+                has_activation_challenge_ = true;
+            } else if (event == kJsonStreamNumber && strcmp(item, "timeout_ms") == 0) {
+                activation_timeout_ms_ = atoi(value);
+            } else if (event == kJsonStreamBool && strcmp(item, "long_poll") == 0) {
+                // サーバーがアクティベーション完了（またはtimeout_ms経過）までレスポンスを保留する
+                activation_long_poll_ = strcmp(value, "true") == 0;
+            }
+        } else if (strcmp(name, "server_time") == 0) {
+            if (event == kJsonStreamNumber && strcmp(item, "timestamp") == 0) {
+                timestamp = strtod(value, nullptr);
+                has_timestamp = true;
+            } else if (event == kJsonStreamNumber && strcmp(item, "timezone_offset") == 0) {
+                timezone_offset = atoi(value);
+            }
+        } else if (strcmp(name, "firmware") == 0) {
+            if (event == kJsonStreamString && strcmp(item, "version") == 0) {
+                firmware_version_ = value;
+                has_firmware_version = true;
+            } else if (event == kJsonStreamString && strcmp(item, "url") == 0) {
+                firmware_url_ = value;
+                has_firmware_url = true;
+            } else if (event == kJsonStreamString && strcmp(item, "sha256") == 0) {
+                firmware_sha256_ = value;
+            } else if (event == kJsonStreamNumber && strcmp(item, "force") == 0) {
+                force_firmware = atoi(value) == 1;
             }
+#if CONFIG_MODEL_OTA
+        } else if (strcmp(name, "model") == 0 && event == kJsonStreamString) {
+            if (strcmp(item, "version") == 0) {
+                model_version_ = value;
+            } else if (strcmp(item, "url") == 0) {
+                model_url_ = value;
+            } else if (strcmp(item, "sha256") == 0) {
+                model_sha256_ = value;
+            }
+#endif
+#if CONFIG_ASSET_OTA
+        } else if (strcmp(name, "assets") == 0 && event == kJsonStreamString) {
+            if (strcmp(item, "version") == 0) {
+                assets_version_ = value;
+            } else if (strcmp(item, "url") == 0) {
+                assets_url_ = value;
+            } else if (strcmp(item, "sha256") == 0) {
+                assets_sha256_ = value;
+            }
+#endif
         }
-        has_mqtt_config_ = true;
-    } else {
-        ESP_LOGI(TAG, "No mqtt section found !");
-    }
+    });
 
-    has_websocket_config_ = false;
-    cJSON *websocket = cJSON_GetObjectItem(root, "websocket");
-    if (cJSON_IsObject(websocket)) {
-        Settings settings("websocket", true);
-        cJSON *item = NULL;
-        cJSON_ArrayForEach(item, websocket) {
-            if (cJSON_IsString(item)) {
-                settings.SetString(item->string, item->valuestring);
-            } else if (cJSON_IsNumber(item)) {
-                settings.SetInt(item->string, item->valueint);
-            }
+    auto buffer = std::make_unique<char[]>(OTA_CHECK_VERSION_READ_SIZE);
+    bool parsed = true;
+    while (parsed) {
+        int ret = http->Read(buffer.get(), OTA_CHECK_VERSION_READ_SIZE);
+        if (ret < 0) {
+            ESP_LOGE(TAG, "Failed to read check version response: %d", ret);
+            parsed = false;
+            break;
         }
-        has_websocket_config_ = true;
-    } else {
+        if (ret == 0) {
+            break;
+        }
+        parsed = parser.Feed(buffer.get(), ret);
+    }
+    http->Close();
+    section.reset();
+    if (!parsed || !parser.Finish()) {
+        ESP_LOGE(TAG, "Failed to parse JSON response");
+        return false;
+    }
+
+    if (!has_mqtt_config_) {
+        ESP_LOGI(TAG, "No mqtt section found !");
+    }
+    if (!has_websocket_config_) {
         ESP_LOGI(TAG, "No websocket section found!");
     }
 
-    has_server_time_ = false;
-    cJSON *server_time = cJSON_GetObjectItem(root, "server_time");
-    if (cJSON_IsObject(server_time)) {
-        cJSON *timestamp = cJSON_GetObjectItem(server_time, "timestamp");
-        cJSON *timezone_offset = cJSON_GetObjectItem(server_time, "timezone_offset");
-        
-        if (cJSON_IsNumber(timestamp)) {
-            // 设置系统时间
-            struct timeval tv;
-            double ts = timestamp->valuedouble;
-            
-            // 如果有时区偏移，计算本地时间
-            if (cJSON_IsNumber(timezone_offset)) {
-                ts += (timezone_offset->valueint * 60 * 1000); // 转换分钟为毫秒
-            }
-            
-            tv.tv_sec = (time_t)(ts / 1000);  // 转换毫秒为秒
-            tv.tv_usec = (suseconds_t)((long long)ts % 1000) * 1000;  // 剩余的毫秒转换为微秒
-            settimeofday(&tv, NULL);
-            has_server_time_ = true;
-        }
-    } else {
+    if (has_timestamp) {
+        // 设置系统时间
+        struct timeval tv;
+        double ts = timestamp + timezone_offset * 60 * 1000; // 时区偏移：分钟转换为毫秒
+        tv.tv_sec = (time_t)(ts / 1000);  // 转换毫秒为秒
+        tv.tv_usec = (suseconds_t)((long long)ts % 1000) * 1000;  // 剩余的毫秒转换为微秒
+        settimeofday(&tv, NULL);
+        has_server_time_ = true;
+    } else if (!has_server_time_section) {
         ESP_LOGW(TAG, "No server_time section found!");
     }
 
-    has_new_version_ = false;
-    cJSON *firmware = cJSON_GetObjectItem(root, "firmware");
-    if (cJSON_IsObject(firmware)) {
-        cJSON *version = cJSON_GetObjectItem(firmware, "version");
-        if (cJSON_IsString(version)) {
-            firmware_version_ = version->valuestring;
-        }
-        cJSON *url = cJSON_GetObjectItem(firmware, "url");
-        if (cJSON_IsString(url)) {
-            firmware_url_ = url->valuestring;
-        }
-
-        if (cJSON_IsString(version) && cJSON_IsString(url)) {
-            // Check if the version is newer, for example, 0.1.0 is newer than 0.0.1
-            has_new_version_ = IsNewVersionAvailable(current_version_, firmware_version_);
-            if (has_new_version_) {
-                ESP_LOGI(TAG, "New version available: %s", firmware_version_.c_str());
+    if (has_firmware_version && has_firmware_url) {
+        // Check if the version is newer, for example, 0.1.0 is newer than 0.0.1
+        has_new_version_ = IsNewVersionAvailable(current_version_, firmware_version_);
+        if (has_new_version_) {
+            ESP_LOGI(TAG, "New version available: %s", firmware_version_.c_str());
+        } else {
+            ESP_LOGI(TAG, "Current is the latest version");
+        }
+        // If the force flag is set to 1, the given version is forced to be installed
+        if (force_firmware) {
+            has_new_version_ = true;
+        }
+    } else if (!has_firmware) {
+        ESP_LOGW(TAG, "No firmware section found!");
+    }
+
+#if CONFIG_MODEL_OTA
+    if (!model_version_.empty() && !model_url_.empty()) {
+        // モデルのバージョンは大小を比べず、サーバーの指定と異なれば入れ替える（戻す場合も同じ）
+        Settings model_settings("model");
+        if (model_version_ != model_settings.GetString("version")) {
+            if (model_sha256_.length() != 64) {
+                ESP_LOGW(TAG, "Model %s has no sha256, skipping", model_version_.c_str());
             } else {
-                ESP_LOGI(TAG, "Current is the latest version");
+                ESP_LOGI(TAG, "New model version available: %s", model_version_.c_str());
+                has_new_model_version_ = true;
             }
-            // If the force flag is set to 1, the given version is forced to be installed
-            cJSON *force = cJSON_GetObjectItem(firmware, "force");
-            if (cJSON_IsNumber(force) && force->valueint == 1) {
-                has_new_version_ = true;
+        }
+    }
+#endif
+#if CONFIG_ASSET_OTA
+    if (!assets_version_.empty() && !assets_url_.empty()) {
+        // モデルと同じく、サーバーの指定と異なれば入れ替える
+        if (assets_version_ != AssetBundle::GetInstance().version()) {
+            if (assets_sha256_.length() != 64) {
+                ESP_LOGW(TAG, "Assets %s have no sha256, skipping", assets_version_.c_str());
+            } else {
+                ESP_LOGI(TAG, "New assets version available: %s", assets_version_.c_str());
+                has_new_assets_version_ = true;
             }
         }
-    } else {
-        ESP_LOGW(TAG, "No firmware section found!");
     }
-
-    cJSON_Delete(root);
+#endif
     return true;
 }
 
@@ -245,7 +377,149 @@ void Ota::MarkCurrentVersionValid() {
     }
 }
 
-void Ota::Upgrade(const std::string& firmware_url) {
+namespace {
+
+/**
+ * @brief 受信したバッファを専用タスクでフラッシュへ書き込む
+ *
+ * OTA_BUFFER_COUNT個のバッファを受信側と書き込みタスクで循環させ、
+ * 片方をフラッシュへ書いている間にもう片方へ受信します。
+ */
+class OtaWriter {
+public:
+    struct Chunk {
+        char* data;     // nullptrで終了
+        size_t size;
+    };
+
+    ~OtaWriter() {
+        Finish();
+        for (auto buffer : buffers_) {
+            heap_caps_free(buffer);
+        }
+        if (free_queue_ != nullptr) {
+            vQueueDelete(free_queue_);
+        }
+        if (write_queue_ != nullptr) {
+            vQueueDelete(write_queue_);
+        }
+        if (done_ != nullptr) {
+            vSemaphoreDelete(done_);
+        }
+    }
+
+    bool Initialize() {
+        free_queue_ = xQueueCreate(OTA_BUFFER_COUNT, sizeof(char*));
+        write_queue_ = xQueueCreate(OTA_BUFFER_COUNT + 1, sizeof(Chunk));
+        done_ = xSemaphoreCreateBinary();
+        if (free_queue_ == nullptr || write_queue_ == nullptr || done_ == nullptr) {
+            return false;
+        }
+        for (int i = 0; i < OTA_BUFFER_COUNT; i++) {
+            auto buffer = (char*)heap_caps_malloc(OTA_BUFFER_SIZE, MALLOC_CAP_SPIRAM);
+            if (buffer == nullptr) {
+                buffer = (char*)heap_caps_malloc(OTA_BUFFER_SIZE, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+            }
+            if (buffer == nullptr) {
+                ESP_LOGE(TAG, "Failed to allocate the OTA buffer");
+                return false;
+            }
+            buffers_.push_back(buffer);
+            xQueueSend(free_queue_, &buffer, 0);
+        }
+        return true;
+    }
+
+    /** @brief esp_ota_begin後に書き込みタスクを起動 */
+    bool Start(esp_ota_handle_t handle) {
+        handle_ = handle;
+        if (CreateTask([](void* arg) {
+            auto writer = (OtaWriter*)arg;
+            writer->WriteLoop();
+            vTaskDelete(NULL);
+        }, "ota_writer", 4096, this, OTA_WRITER_TASK_PRIORITY, nullptr) != pdPASS) {
+            return false;
+        }
+        started_ = true;
+        return true;
+    }
+
+    /** @brief 空きバッファを取得（書き込みが追いつくまで待つ） */
+    char* AcquireBuffer() {
+        char* buffer = nullptr;
+        xQueueReceive(free_queue_, &buffer, portMAX_DELAY);
+        return buffer;
+    }
+
+    void Submit(char* buffer, size_t size) {
+        Chunk chunk = { buffer, size };
+        xQueueSend(write_queue_, &chunk, portMAX_DELAY);
+    }
+
+    /** @brief 書き込み待ちをすべて処理してタスクを終了。書き込みに失敗していればfalse */
+    bool Finish() {
+        if (started_) {
+            Chunk chunk = { nullptr, 0 };
+            xQueueSend(write_queue_, &chunk, portMAX_DELAY);
+            xSemaphoreTake(done_, portMAX_DELAY);
+            started_ = false;
+        }
+        return !failed_;
+    }
+
+    bool failed() const { return failed_; }
+
+private:
+    std::vector<char*> buffers_;
+    QueueHandle_t free_queue_ = nullptr;
+    QueueHandle_t write_queue_ = nullptr;
+    SemaphoreHandle_t done_ = nullptr;
+    esp_ota_handle_t handle_ = 0;
+    bool started_ = false;
+    volatile bool failed_ = false;
+
+    void WriteLoop() {
+        Chunk chunk;
+        while (xQueueReceive(write_queue_, &chunk, portMAX_DELAY) == pdTRUE && chunk.data != nullptr) {
+            if (!failed_) {
+                auto err = esp_ota_write(handle_, chunk.data, chunk.size);
+                if (err != ESP_OK) {
+                    ESP_LOGE(TAG, "Failed to write OTA data: %s", esp_err_to_name(err));
+                    failed_ = true;
+                }
+            }
+            xQueueSend(free_queue_, &chunk.data, portMAX_DELAY);
+        }
+        xSemaphoreGive(done_);
+    }
+};
+
+} // namespace
+
+bool Ota::OpenFirmware(Http* http, const std::string& firmware_url, size_t offset) {
+    if (offset > 0) {
+        http->SetHeader("Range", "bytes=" + std::to_string(offset) + "-");
+    }
+    if (!http->Open("GET", firmware_url)) {
+        ESP_LOGE(TAG, "Failed to open HTTP connection");
+        return false;
+    }
+    int status_code = http->GetStatusCode();
+    if (offset > 0 && status_code != 206) {
+        // Rangeに対応していないサーバーでは先頭から送られてくるため、続きとして使えない
+        ESP_LOGE(TAG, "Server did not resume at %u, status code: %d", offset, status_code);
+        http->Close();
+        return false;
+    }
+    if (offset == 0 && status_code != 200) {
+        ESP_LOGE(TAG, "Failed to download firmware, status code: %d", status_code);
+        http->Close();
+        return false;
+    }
+    return true;
+}
+
+void Ota::Upgrade(const std::string& firmware_url, const std::string& firmware_sha256) {
     ESP_LOGI(TAG, "Upgrading firmware from %s", firmware_url.c_str());
     esp_ota_handle_t update_handle = 0;
     auto update_partition = esp_ota_get_next_update_partition(NULL);
@@ -256,11 +530,10 @@ void Ota::Upgrade(const std::string& firmware_url) {
 
     ESP_LOGI(TAG, "Writing to partition %s at offset 0x%lx", update_partition->label, update_partition->address);
     bool image_header_checked = false;
-    std::string image_header;
+    const size_t image_header_size = sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t) + sizeof(esp_app_desc_t);
 
     auto http = std::unique_ptr<Http>(Board::GetInstance().CreateHttp());
-    if (!http->Open("GET", firmware_url)) {
-        ESP_LOGE(TAG, "Failed to open HTTP connection");
+    if (!OpenFirmware(http.get(), firmware_url, 0)) {
         return;
     }
 
@@ -270,65 +543,159 @@ void Ota::Upgrade(const std::string& firmware_url) {
         return;
     }
 
-    char buffer[512];
-    size_t total_read = 0, recent_read = 0;
-    auto last_calc_time = esp_timer_get_time();
-    while (true) {
-        int ret = http->Read(buffer, sizeof(buffer));
-        if (ret < 0) {
-            ESP_LOGE(TAG, "Failed to read HTTP data: %s", esp_err_to_name(ret));
-            return;
+    OtaWriter writer;
+    if (!writer.Initialize()) {
+        return;
+    }
+    // 失敗時はwriterを先に終了させ、書き込み中のハンドルをabortする
+    auto abort_upgrade = [&]() {
+        writer.Finish();
+        if (image_header_checked) {
+            esp_ota_abort(update_handle);
         }
-
-        // Calculate speed and progress every second
-        recent_read += ret;
-        total_read += ret;
-        if (esp_timer_get_time() - last_calc_time >= 1000000 || ret == 0) {
-            size_t progress = total_read * 100 / content_length;
-            ESP_LOGI(TAG, "Progress: %u%% (%u/%u), Speed: %uB/s", progress, total_read, content_length, recent_read);
-            if (upgrade_callback_) {
-                upgrade_callback_(progress, recent_read);
+    };
+
+    // 展開後のアプリイメージをバッファに詰め、満杯になったら書き込みタスクへ渡す
+    char* buffer = nullptr;
+    size_t filled = 0;
+    OtaDecoder decoder([&](const uint8_t* data, size_t size) -> bool {
+        while (size > 0) {
+            if (buffer == nullptr) {
+                buffer = writer.AcquireBuffer();
+                filled = 0;
             }
-            last_calc_time = esp_timer_get_time();
-            recent_read = 0;
-        }
-
-        if (ret == 0) {
-            break;
-        }
+            if (writer.failed()) {
+                return false;
+            }
+            size_t n = std::min<size_t>(size, OTA_BUFFER_SIZE - filled);
+            memcpy(buffer + filled, data, n);
+            filled += n;
+            data += n;
+            size -= n;
 
-        if (!image_header_checked) {
-            image_header.append(buffer, ret);
-            if (image_header.size() >= sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t) + sizeof(esp_app_desc_t)) {
+            if (!image_header_checked && filled >= image_header_size) {
                 esp_app_desc_t new_app_info;
-                memcpy(&new_app_info, image_header.data() + sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t), sizeof(esp_app_desc_t));
+                memcpy(&new_app_info, buffer + sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t), sizeof(esp_app_desc_t));
                 ESP_LOGI(TAG, "New firmware version: %s", new_app_info.version);
 
                 auto current_version = esp_app_get_description()->version;
                 if (memcmp(new_app_info.version, current_version, sizeof(new_app_info.version)) == 0) {
                     ESP_LOGE(TAG, "Firmware version is the same, skipping upgrade");
-                    return;
+                    return false;
                 }
 
                 if (esp_ota_begin(update_partition, OTA_WITH_SEQUENTIAL_WRITES, &update_handle)) {
                     esp_ota_abort(update_handle);
                     ESP_LOGE(TAG, "Failed to begin OTA");
-                    return;
+                    return false;
                 }
-
                 image_header_checked = true;
-                std::string().swap(image_header);
+                if (!writer.Start(update_handle)) {
+                    ESP_LOGE(TAG, "Failed to start the OTA writer");
+                    return false;
+                }
+            }
+
+            if (image_header_checked && filled == OTA_BUFFER_SIZE) {
+                writer.Submit(buffer, filled);
+                buffer = nullptr;
             }
         }
-        auto err = esp_ota_write(update_handle, buffer, ret);
-        if (err != ESP_OK) {
-            ESP_LOGE(TAG, "Failed to write OTA data: %s", esp_err_to_name(err));
-            esp_ota_abort(update_handle);
+        return true;
+    });
+
+    // 受信したバイト列（展開前）のSHA-256を受信しながら計算する（SHAペリフェラルで処理される）。
+    // 再開時も続きの位置から受け取るので、ハッシュの計算はそのまま続けられる
+    bool verify_sha256 = firmware_sha256.length() == 64;
+    if (!verify_sha256) {
+        ESP_LOGW(TAG, "No firmware sha256 from the server, skipping download verification");
+    }
+    mbedtls_sha256_context sha256;
+    mbedtls_sha256_init(&sha256);
+    mbedtls_sha256_starts(&sha256, 0);
+    std::unique_ptr<mbedtls_sha256_context, void(*)(mbedtls_sha256_context*)> sha256_guard(&sha256, mbedtls_sha256_free);
+
+    auto input = std::make_unique<uint8_t[]>(OTA_READ_SIZE);
+    size_t total_read = 0, recent_read = 0;
+    int resume_attempts = 0;
+    auto last_calc_time = esp_timer_get_time();
+    while (total_read < content_length) {
+        int ret = http->Read((char*)input.get(), std::min<size_t>(OTA_READ_SIZE, content_length - total_read));
+        if (ret <= 0) {
+            // 展開の状態はそのまま、続きの位置から取り直す
+            ESP_LOGW(TAG, "Download interrupted at %u/%u (%d)", total_read, content_length, ret);
+            http->Close();
+            bool resumed = false;
+            while (!resumed && ++resume_attempts <= OTA_MAX_RESUME_ATTEMPTS) {
+                vTaskDelay(pdMS_TO_TICKS(1000 * resume_attempts));
+                ESP_LOGI(TAG, "Resuming download at %u (attempt %d)", total_read, resume_attempts);
+                http.reset(Board::GetInstance().CreateHttp());
+                resumed = OpenFirmware(http.get(), firmware_url, total_read);
+            }
+            if (!resumed) {
+                ESP_LOGE(TAG, "Failed to resume the download");
+                abort_upgrade();
+                return;
+            }
+            continue;
+        }
+        resume_attempts = 0;
+
+        // Calculate speed and progress every second
+        recent_read += ret;
+        total_read += ret;
+        if (esp_timer_get_time() - last_calc_time >= 1000000 || total_read == content_length) {
+            size_t progress = total_read * 100 / content_length;
+            ESP_LOGI(TAG, "Progress: %u%% (%u/%u), Speed: %uB/s", progress, total_read, content_length, recent_read);
+#if CONFIG_USE_METRICS
+            ota_download_speed.Set(recent_read);
+#endif
+            if (upgrade_callback_) {
+                upgrade_callback_(progress, recent_read);
+            }
+            last_calc_time = esp_timer_get_time();
+            recent_read = 0;
+        }
+
+        if (verify_sha256) {
+            mbedtls_sha256_update(&sha256, input.get(), ret);
+        }
+        if (!decoder.Feed(input.get(), ret)) {
+            abort_upgrade();
             return;
         }
     }
     http->Close();
 
+    if (verify_sha256) {
+        // 最後のバッファを書き込む前に照合し、壊れたイメージはesp_ota_end()の読み戻しまで進めない
+        uint8_t digest[32];
+        mbedtls_sha256_finish(&sha256, digest);
+        char hex[65];
+        for (int i = 0; i < 32; i++) {
+            snprintf(hex + i * 2, 3, "%02x", digest[i]);
+        }
+        if (strcasecmp(hex, firmware_sha256.c_str()) != 0) {
+            ESP_LOGE(TAG, "Firmware sha256 mismatch: expected %s, got %s", firmware_sha256.c_str(), hex);
+            abort_upgrade();
+            return;
+        }
+        ESP_LOGI(TAG, "Firmware sha256 verified");
+    }
+
+    if (!decoder.Finish() || !image_header_checked) {
+        ESP_LOGE(TAG, "Firmware image is incomplete");
+        abort_upgrade();
+        return;
+    }
+    if (filled > 0) {
+        writer.Submit(buffer, filled);
+    }
+    if (!writer.Finish()) {
+        esp_ota_abort(update_handle);
+        return;
+    }
+
     esp_err_t err = esp_ota_end(update_handle);
     if (err != ESP_OK) {
         if (err == ESP_ERR_OTA_VALIDATE_FAILED) {
@@ -350,9 +717,140 @@ void Ota::Upgrade(const std::string& firmware_url) {
     esp_restart();
 }
 
+#if CONFIG_MODEL_OTA || CONFIG_ASSET_OTA
+bool Ota::DownloadToPartition(const esp_partition_t* partition, const std::string& url, const std::string& sha256_hex,
+    std::function<void(int progress, size_t speed)> callback) {
+    auto http = std::unique_ptr<Http>(Board::GetInstance().CreateHttp());
+    if (!OpenFirmware(http.get(), url, 0)) {
+        return false;
+    }
+    size_t content_length = http->GetBodyLength();
+    if (content_length == 0 || content_length > partition->size) {
+        ESP_LOGE(TAG, "Size %u does not fit %s (%lu)", content_length, partition->label, partition->size);
+        return false;
+    }
+
+    // 書き込み先は使っていないパーティションなので、途中で失敗しても現在の内容はそのまま使える
+    mbedtls_sha256_context sha256;
+    mbedtls_sha256_init(&sha256);
+    mbedtls_sha256_starts(&sha256, 0);
+    std::unique_ptr<mbedtls_sha256_context, void(*)(mbedtls_sha256_context*)> sha256_guard(&sha256, mbedtls_sha256_free);
+
+    auto input = std::make_unique<uint8_t[]>(OTA_READ_SIZE);
+    size_t total_read = 0, recent_read = 0, erased = 0;
+    auto last_calc_time = esp_timer_get_time();
+    while (total_read < content_length) {
+        int ret = http->Read((char*)input.get(), std::min<size_t>(OTA_READ_SIZE, content_length - total_read));
+        if (ret <= 0) {
+            ESP_LOGE(TAG, "Download interrupted at %u/%u (%d)", total_read, content_length, ret);
+            return false;
+        }
+        while (erased < total_read + ret) {
+            size_t size = std::min<size_t>(OTA_PARTITION_ERASE_SIZE, partition->size - erased);
+            esp_err_t err = esp_partition_erase_range(partition, erased, size);
+            if (err != ESP_OK) {
+                ESP_LOGE(TAG, "Failed to erase %s: %s", partition->label, esp_err_to_name(err));
+                return false;
+            }
+            erased += size;
+        }
+        esp_err_t err = esp_partition_write(partition, total_read, input.get(), ret);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to write %s: %s", partition->label, esp_err_to_name(err));
+            return false;
+        }
+        mbedtls_sha256_update(&sha256, input.get(), ret);
+
+        recent_read += ret;
+        total_read += ret;
+        if (esp_timer_get_time() - last_calc_time >= 1000000 || total_read == content_length) {
+            size_t progress = total_read * 100 / content_length;
+            ESP_LOGI(TAG, "%s progress: %u%% (%u/%u), Speed: %uB/s", partition->label, progress, total_read,
+                content_length, recent_read);
+            if (callback) {
+                callback(progress, recent_read);
+            }
+            last_calc_time = esp_timer_get_time();
+            recent_read = 0;
+        }
+    }
+    http->Close();
+
+    uint8_t digest[32];
+    mbedtls_sha256_finish(&sha256, digest);
+    char hex[65];
+    for (int i = 0; i < 32; i++) {
+        snprintf(hex + i * 2, 3, "%02x", digest[i]);
+    }
+    if (strcasecmp(hex, sha256_hex.c_str()) != 0) {
+        ESP_LOGE(TAG, "%s sha256 mismatch: expected %s, got %s", partition->label, sha256_hex.c_str(), hex);
+        return false;
+    }
+    return true;
+}
+#endif
+
+#if CONFIG_MODEL_OTA
+bool Ota::UpgradeModel(std::function<void(int progress, size_t speed)> callback) {
+    Settings model_settings("model");
+    std::string active = model_settings.GetString("partition", OTA_MODEL_PARTITION_A);
+    const char* target_label = active == OTA_MODEL_PARTITION_B ? OTA_MODEL_PARTITION_A : OTA_MODEL_PARTITION_B;
+    auto partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_SPIFFS, target_label);
+    if (partition == nullptr) {
+        ESP_LOGW(TAG, "No %s partition for the model update", target_label);
+        return false;
+    }
+    ESP_LOGI(TAG, "Downloading model %s from %s to %s", model_version_.c_str(), model_url_.c_str(), target_label);
+    if (!DownloadToPartition(partition, model_url_, model_sha256_, callback)) {
+        return false;
+    }
+
+    // 読み込める形式であることを確かめてから切り替える（圧縮コンテナは展開して確認する）
+    if (!VerifySpeechModels(target_label)) {
+        ESP_LOGE(TAG, "Downloaded model partition %s cannot be loaded", target_label);
+        return false;
+    }
+    ESP_LOGI(TAG, "Model partition %s verified", target_label);
+
+    Settings writable("model", true);
+    writable.SetString("partition", target_label);
+    writable.SetString("version", model_version_);
+    has_new_model_version_ = false;
+    return true;
+}
+#endif
+
+#if CONFIG_ASSET_OTA
+bool Ota::UpgradeAssets(std::function<void(int progress, size_t speed)> callback) {
+    Settings assets_settings("assets");
+    std::string active = assets_settings.GetString("partition", ASSET_PARTITION_A);
+    const char* target_label = active == ASSET_PARTITION_B ? ASSET_PARTITION_A : ASSET_PARTITION_B;
+    auto partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, target_label);
+    if (partition == nullptr) {
+        ESP_LOGW(TAG, "No %s partition for the assets update", target_label);
+        return false;
+    }
+    ESP_LOGI(TAG, "Downloading assets %s from %s to %s", assets_version_.c_str(), assets_url_.c_str(), target_label);
+    if (!DownloadToPartition(partition, assets_url_, assets_sha256_, callback)) {
+        return false;
+    }
+    if (!AssetBundle::Verify(target_label)) {
+        ESP_LOGE(TAG, "Downloaded assets partition %s is not a valid bundle", target_label);
+        return false;
+    }
+    ESP_LOGI(TAG, "Assets partition %s verified", target_label);
+
+    // マップ中のバンドルは再生中の音声が参照しているため、次回の起動で切り替える
+    Settings writable("assets", true);
+    writable.SetString("partition", target_label);
+    has_new_assets_version_ = false;
+    return true;
+}
+#endif
+
 void Ota::StartUpgrade(std::function<void(int progress, size_t speed)> callback) {
     upgrade_callback_ = callback;
-    Upgrade(firmware_url_);
+    Upgrade(firmware_url_, firmware_sha256_);
 }
 
 std::vector<int> Ota::ParseVersion(const std::string& version) {
@@ -434,8 +932,17 @@ esp_err_t Ota::Activate() {
 
     auto http = std::unique_ptr<Http>(SetupHttp());
 
-    std::string data = GetActivationPayload();
+    // チャレンジは変わらないため、HMACの計算は最初の1回だけ行う
+    if (activation_payload_.empty()) {
+        activation_payload_ = GetActivationPayload();
+    }
+    std::string data = activation_payload_;
     http->SetContent(std::move(data));
+    if (activation_long_poll_) {
+        // サーバーが保留する時間より長く待つ
+        http->SetHeader("Activation-Timeout", std::to_string(activation_timeout_ms_));
+        http->SetTimeout(activation_timeout_ms_ + ACTIVATION_LONG_POLL_MARGIN_MS);
+    }
 
     if (!http->Open("POST", url)) {
         ESP_LOGE(TAG, "Failed to open HTTP connection");
@@ -443,11 +950,14 @@ esp_err_t Ota::Activate() {
     }
     
     auto status_code = http->GetStatusCode();
+    // 本文を読み切ると次の問い合わせで接続を再利用できる
+    std::string body = http->ReadAll();
+    http->Close();
     if (status_code == 202) {
         return ESP_ERR_TIMEOUT;
     }
     if (status_code != 200) {
-        ESP_LOGE(TAG, "Failed to activate, code: %d, body: %s", status_code, http->ReadAll().c_str());
+        ESP_LOGE(TAG, "Failed to activate, code: %d, body: %s", status_code, body.c_str());
         return ESP_FAIL;
     }
 
@@ -13,8 +13,35 @@
 #include <string>
 
 #include <esp_err.h>
+#include <esp_partition.h>
 #include "board.h"
 
+/** @brief ダウンロードとフラッシュ書き込みの間で受け渡すバッファのサイズと数（PSRAMに確保） */
+#define OTA_BUFFER_SIZE (16 * 1024)
+#define OTA_BUFFER_COUNT 2
+
+/** @brief 1回のHTTP読み込みの最大サイズ（展開前のデータ） */
+#define OTA_READ_SIZE 4096
+
+/** @brief バージョン確認の応答を1回に読み込むサイズ（受信しながら解析するので応答全体は持たない） */
+#define OTA_CHECK_VERSION_READ_SIZE 512
+
+/** @brief 通信が途切れたとき、Rangeリクエストで続きから再開する最大回数 */
+#define OTA_MAX_RESUME_ATTEMPTS 5
+
+/** @brief フラッシュ書き込みタスクの優先度 */
+#define OTA_WRITER_TASK_PRIORITY 3
+
+/** @brief 音声モデルのA/Bパーティション（esp_srmodel_init()に渡すラベル） */
+#define OTA_MODEL_PARTITION_A "model"
+#define OTA_MODEL_PARTITION_B "model_1"
+
+/** @brief 音声モデルやアセットのパーティションを消去する単位（書き込みに先行して消去する） */
+#define OTA_PARTITION_ERASE_SIZE (64 * 1024)
+
+/** @brief ロングポーリングでサーバーの保留時間に上乗せして待つ時間（ミリ秒） */
+#define ACTIVATION_LONG_POLL_MARGIN_MS 5000
+
 /**
  * @class Ota
  * @brief OTAファームウェア更新システム
@@ -56,6 +83,40 @@ public:
     /** OTAアップグレードを開始（進捗コールバック付き） */
     void StartUpgrade(std::function<void(int progress, size_t speed)> callback);
     
+#if CONFIG_MODEL_OTA
+    /** 音声モデルの新しいバージョンがあるかどうか */
+    bool HasNewModelVersion() { return has_new_model_version_; }
+
+    /**
+     * @brief 音声モデルを使っていない方のパーティションへダウンロード
+     *
+     * SHA-256の照合とesp_srmodel_init()での読み込みを確かめてから、次回の起動で使う
+     * パーティションを切り替えます（Settings "model" の partition / version）。
+     * @return 切り替えた場合true（反映には再起動が必要）
+     */
+    bool UpgradeModel(std::function<void(int progress, size_t speed)> callback);
+
+    /** サーバーから取得した音声モデルのバージョンを取得 */
+    const std::string& GetModelVersion() const { return model_version_; }
+#endif
+
+#if CONFIG_ASSET_OTA
+    /** アセットの新しいバージョンがあるかどうか */
+    bool HasNewAssetsVersion() { return has_new_assets_version_; }
+
+    /**
+     * @brief アセットのバンドルを使っていない方のパーティションへダウンロード
+     *
+     * SHA-256とバンドルのCRCを照合してから、次回の起動で使うパーティションを切り替えます
+     * （Settings "assets" の partition）。
+     * @return 切り替えた場合true（反映には再起動が必要）
+     */
+    bool UpgradeAssets(std::function<void(int progress, size_t speed)> callback);
+
+    /** サーバーから取得したアセットのバージョンを取得 */
+    const std::string& GetAssetsVersion() const { return assets_version_; }
+#endif
+
     /** 現在のバージョンを有効としてマーク */
     void MarkCurrentVersionValid();
 
@@ -69,6 +130,9 @@ public:
     /** アクティベーションメッセージを取得 */
     const std::string& GetActivationMessage() const { return activation_message_; }
     
+    /** アクティベーションをロングポーリングで待つか（trueなら202の後すぐに再要求する） */
+    bool IsActivationLongPoll() const { return activation_long_poll_; }
+
     /** アクティベーションコードを取得 */
     const std::string& GetActivationCode() const { return activation_code_; }
     
@@ -82,6 +146,8 @@ private:
     std::string activation_challenge_;          /**< アクティベーションチャレンジ */
     std::string serial_number_;                 /**< シリアル番号 */
     int activation_timeout_ms_ = 30000;         /**< アクティベーションタイムアウト */
+    bool activation_long_poll_ = false;         /**< サーバーがアクティベーションのロングポーリングに対応 */
+    std::string activation_payload_;            /**< 計算済みのアクティベーション用ペイロード */
     
     // サーバーからの情報取得状態
     bool has_new_version_ = false;              /**< 新バージョン有無 */
@@ -96,12 +162,48 @@ private:
     std::string current_version_;               /**< 現在のファームウェアバージョン */
     std::string firmware_version_;              /**< サーバーの最新バージョン */
     std::string firmware_url_;                  /**< ファームウェアダウンロードURL */
+    std::string firmware_sha256_;               /**< ダウンロードするファイルのSHA-256（16進、サーバーが送らなければ空） */
+
+#if CONFIG_MODEL_OTA
+    // 音声モデル
+    bool has_new_model_version_ = false;        /**< 音声モデルの新バージョン有無 */
+    std::string model_version_;                 /**< サーバーの音声モデルのバージョン */
+    std::string model_url_;                     /**< 音声モデルのダウンロードURL */
+    std::string model_sha256_;                  /**< 音声モデルのSHA-256（16進） */
+#endif
+
+#if CONFIG_ASSET_OTA
+    // アセット
+    bool has_new_assets_version_ = false;       /**< アセットの新バージョン有無 */
+    std::string assets_version_;                /**< サーバーのアセットのバージョン */
+    std::string assets_url_;                    /**< アセットのダウンロードURL */
+    std::string assets_sha256_;                 /**< アセットのSHA-256（16進） */
+#endif
 
     // アップグレード関連
     std::function<void(int progress, size_t speed)> upgrade_callback_;  /**< アップグレード進捗コールバック */
 
-    /** ファームウェアアップグレードを実行 */
-    void Upgrade(const std::string& firmware_url);
+    /**
+     * @brief ファームウェアアップグレードを実行
+     *
+     * 受信は呼び出し元のタスクで、esp_ota_writeは専用タスクで行い、両者を並行して進めます。
+     * 圧縮・差分形式のイメージ（scripts/gen_ota_image.py）は受信しながらOtaDecoderで展開します。
+     * 接続が切れたときは受信済みの位置からRangeリクエストで再開します。
+     * firmware_sha256があれば受信したバイト列と照合し、一致しなければ書き込みを中止します。
+     */
+    void Upgrade(const std::string& firmware_url, const std::string& firmware_sha256);
+
+    /** @brief offsetから本文を要求して接続（offsetが0でなければ206を期待） */
+    bool OpenFirmware(Http* http, const std::string& firmware_url, size_t offset);
+
+#if CONFIG_MODEL_OTA || CONFIG_ASSET_OTA
+    /**
+     * @brief データパーティションへダウンロードし、SHA-256を照合
+     * @param sha256_hex 期待するSHA-256（16進）
+     */
+    bool DownloadToPartition(const esp_partition_t* partition, const std::string& url, const std::string& sha256_hex,
+        std::function<void(int progress, size_t speed)> callback);
+#endif
     
     /** バージョン文字列を解析して数値配列に変換 */
     std::vector<int> ParseVersion(const std::string& version);
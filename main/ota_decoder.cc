@@ -0,0 +1,238 @@
+#include "ota_decoder.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <esp_ota_ops.h>
+#include <esp_app_desc.h>
+#include <rom/miniz.h>
+
+#include <cstring>
+
+#define TAG "OtaDecoder"
+
+static uint32_t ReadLe32(const uint8_t* p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void* AllocateBuffer(size_t size) {
+    void* buffer = heap_caps_malloc(size, MALLOC_CAP_SPIRAM);
+    if (buffer == nullptr) {
+        buffer = heap_caps_malloc(size, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    }
+    return buffer;
+}
+
+OtaDecoder::~OtaDecoder() {
+    heap_caps_free(inflator_);
+    heap_caps_free(dictionary_);
+    heap_caps_free(copy_buffer_);
+}
+
+bool OtaDecoder::Feed(const uint8_t* data, size_t size) {
+    while (size > 0) {
+        switch (state_) {
+            case kStateMagic:
+            case kStateHeader: {
+                size_t need = (state_ == kStateMagic ? 4 : OTA_IMAGE_HEADER_SIZE) - header_size_;
+                size_t n = size < need ? size : need;
+                memcpy(header_ + header_size_, data, n);
+                header_size_ += n;
+                data += n;
+                size -= n;
+                if (state_ == kStateMagic && header_size_ == 4) {
+                    if (memcmp(header_, OTA_IMAGE_MAGIC, 4) != 0) {
+                        // 通常のアプリイメージ。読み込んだ4バイトも出力する
+                        state_ = kStateRaw;
+                        if (!Output(header_, 4)) {
+                            return false;
+                        }
+                    } else {
+                        state_ = kStateHeader;
+                    }
+                } else if (state_ == kStateHeader && header_size_ == OTA_IMAGE_HEADER_SIZE) {
+                    if (!ParseHeader()) {
+                        return false;
+                    }
+                    state_ = kStateBody;
+                }
+                break;
+            }
+            case kStateRaw:
+                return Output(data, size);
+            case kStateBody:
+                if (flags_ & OTA_IMAGE_FLAG_ZLIB) {
+                    return Inflate(data, size);
+                }
+                return Decoded(data, size);
+        }
+    }
+    return true;
+}
+
+bool OtaDecoder::ParseHeader() {
+    flags_ = header_[4];
+    target_size_ = ReadLe32(header_ + 8);
+    source_size_ = ReadLe32(header_ + 12);
+    ESP_LOGI(TAG, "Encoded image: flags 0x%02x, target %lu bytes", flags_, target_size_);
+
+    if (flags_ & OTA_IMAGE_FLAG_ZLIB) {
+        inflator_ = (tinfl_decompressor_tag*)AllocateBuffer(sizeof(tinfl_decompressor));
+        dictionary_ = (uint8_t*)AllocateBuffer(TINFL_LZ_DICT_SIZE);
+        if (inflator_ == nullptr || dictionary_ == nullptr) {
+            ESP_LOGE(TAG, "Failed to allocate the inflate buffers");
+            return false;
+        }
+        tinfl_init((tinfl_decompressor*)inflator_);
+    }
+
+    if (flags_ & OTA_IMAGE_FLAG_DELTA) {
+        // 差分は作成時の元イメージに対してのみ適用できる
+        auto app_desc = esp_app_get_description();
+        if (memcmp(header_ + 16, app_desc->app_elf_sha256, 32) != 0) {
+            ESP_LOGE(TAG, "Delta image was made for a different base firmware");
+            return false;
+        }
+        source_partition_ = esp_ota_get_running_partition();
+        if (source_partition_ == nullptr || source_size_ > source_partition_->size) {
+            ESP_LOGE(TAG, "Invalid delta source size %lu", source_size_);
+            return false;
+        }
+        copy_buffer_ = (uint8_t*)AllocateBuffer(OTA_DELTA_COPY_CHUNK);
+        if (copy_buffer_ == nullptr) {
+            ESP_LOGE(TAG, "Failed to allocate the delta copy buffer");
+            return false;
+        }
+    }
+    return true;
+}
+
+bool OtaDecoder::Inflate(const uint8_t* data, size_t size) {
+    auto inflator = (tinfl_decompressor*)inflator_;
+    while (!inflate_done_) {
+        size_t in_bytes = size;
+        size_t out_bytes = TINFL_LZ_DICT_SIZE - dictionary_offset_;
+        auto status = tinfl_decompress(inflator, data, &in_bytes, dictionary_, dictionary_ + dictionary_offset_, &out_bytes,
+            TINFL_FLAG_PARSE_ZLIB_HEADER | TINFL_FLAG_HAS_MORE_INPUT | TINFL_FLAG_COMPUTE_ADLER32);
+        data += in_bytes;
+        size -= in_bytes;
+        if (out_bytes > 0) {
+            if (!Decoded(dictionary_ + dictionary_offset_, out_bytes)) {
+                return false;
+            }
+            // 辞書は循環バッファとして使う
+            dictionary_offset_ = (dictionary_offset_ + out_bytes) & (TINFL_LZ_DICT_SIZE - 1);
+        }
+        if (status < TINFL_STATUS_DONE) {
+            ESP_LOGE(TAG, "Inflate failed: %d", status);
+            return false;
+        }
+        if (status == TINFL_STATUS_DONE) {
+            inflate_done_ = true;
+        } else if (status == TINFL_STATUS_NEEDS_MORE_INPUT && size == 0) {
+            break;
+        }
+    }
+    return true;
+}
+
+bool OtaDecoder::Decoded(const uint8_t* data, size_t size) {
+    if (flags_ & OTA_IMAGE_FLAG_DELTA) {
+        return ApplyPatch(data, size);
+    }
+    return Output(data, size);
+}
+
+bool OtaDecoder::ApplyPatch(const uint8_t* data, size_t size) {
+    while (size > 0) {
+        if (patch_state_ == kPatchInsert) {
+            size_t n = size < insert_remaining_ ? size : insert_remaining_;
+            if (!Output(data, n)) {
+                return false;
+            }
+            data += n;
+            size -= n;
+            insert_remaining_ -= n;
+            if (insert_remaining_ == 0) {
+                patch_state_ = kPatchOp;
+            }
+            continue;
+        }
+
+        // 命令は受信の区切りをまたぐことがあるため、揃うまで貯める
+        op_[op_size_++] = *data++;
+        size--;
+        size_t op_length = op_[0] == 'C' ? 9 : op_[0] == 'I' ? 5 : 0;
+        if (op_length == 0) {
+            ESP_LOGE(TAG, "Invalid delta op 0x%02x", op_[0]);
+            return false;
+        }
+        if (op_size_ < op_length) {
+            continue;
+        }
+        op_size_ = 0;
+        if (op_[0] == 'C') {
+            if (!Copy(ReadLe32(op_ + 1), ReadLe32(op_ + 5))) {
+                return false;
+            }
+        } else {
+            insert_remaining_ = ReadLe32(op_ + 1);
+            if (insert_remaining_ > 0) {
+                patch_state_ = kPatchInsert;
+            }
+        }
+    }
+    return true;
+}
+
+bool OtaDecoder::Copy(uint32_t offset, uint32_t length) {
+    if (offset > source_size_ || length > source_size_ - offset) {
+        ESP_LOGE(TAG, "Delta copy out of range: %lu+%lu", offset, length);
+        return false;
+    }
+    while (length > 0) {
+        uint32_t n = length < OTA_DELTA_COPY_CHUNK ? length : OTA_DELTA_COPY_CHUNK;
+        auto err = esp_partition_read(source_partition_, offset, copy_buffer_, n);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to read the running partition: %s", esp_err_to_name(err));
+            return false;
+        }
+        if (!Output(copy_buffer_, n)) {
+            return false;
+        }
+        offset += n;
+        length -= n;
+    }
+    return true;
+}
+
+bool OtaDecoder::Output(const uint8_t* data, size_t size) {
+    if (state_ != kStateRaw && output_size_ + size > target_size_) {
+        ESP_LOGE(TAG, "Decoded image exceeds %lu bytes", target_size_);
+        return false;
+    }
+    output_size_ += size;
+    return sink_(data, size);
+}
+
+bool OtaDecoder::Finish() {
+    if (state_ == kStateRaw) {
+        return true;
+    }
+    if (state_ != kStateBody) {
+        ESP_LOGE(TAG, "Image ended inside the header");
+        return false;
+    }
+    if ((flags_ & OTA_IMAGE_FLAG_ZLIB) && !inflate_done_) {
+        ESP_LOGE(TAG, "Compressed stream is truncated");
+        return false;
+    }
+    if (patch_state_ != kPatchOp || op_size_ != 0) {
+        ESP_LOGE(TAG, "Delta stream is truncated");
+        return false;
+    }
+    if (output_size_ != target_size_) {
+        ESP_LOGE(TAG, "Decoded %u bytes, expected %lu", output_size_, target_size_);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,94 @@
+/**
+ * @file ota_decoder.h
+ * @brief 圧縮・差分形式のOTAイメージを受信しながら展開するデコーダ
+ *
+ * scripts/gen_ota_image.py が生成する形式を扱います。先頭がマジックで始まらない
+ * 通常のアプリイメージはそのまま出力します。
+ *
+ * 形式（数値はリトルエンディアン）:
+ *   ヘッダ（48バイト）: "XZD1" | flags(1) | 予約(3) | 展開後サイズ(4) | 元イメージサイズ(4) | 元イメージのapp_elf_sha256(32)
+ *   本体: flagsのbit0が立っていればzlib圧縮。展開後は
+ *     bit1なし: アプリイメージそのもの
+ *     bit1あり: 命令列 'C' offset(4) length(4) ＝ 実行中パーティションからコピー
+ *                      'I' length(4) data ＝ 後続のデータを挿入
+ */
+#ifndef OTA_DECODER_H
+#define OTA_DECODER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+#include <esp_partition.h>
+
+#define OTA_IMAGE_MAGIC "XZD1"
+#define OTA_IMAGE_HEADER_SIZE 48
+#define OTA_IMAGE_FLAG_ZLIB 0x01
+#define OTA_IMAGE_FLAG_DELTA 0x02
+
+/** @brief 差分のコピー命令で実行中パーティションから一度に読む量 */
+#define OTA_DELTA_COPY_CHUNK 4096
+
+struct tinfl_decompressor_tag;
+
+class OtaDecoder {
+public:
+    /** @brief 展開したアプリイメージの出力先。falseを返すと中断 */
+    using Sink = std::function<bool(const uint8_t* data, size_t size)>;
+
+    explicit OtaDecoder(Sink sink) : sink_(sink) {}
+    ~OtaDecoder();
+
+    OtaDecoder(const OtaDecoder&) = delete;
+    OtaDecoder& operator=(const OtaDecoder&) = delete;
+
+    /** @brief 受信したデータを投入。形式エラーや出力の中断でfalse */
+    bool Feed(const uint8_t* data, size_t size);
+
+    /** @brief 入力の終わり。展開が完了し、サイズがヘッダと一致すればtrue */
+    bool Finish();
+
+private:
+    enum State {
+        kStateMagic,        // 先頭4バイトで形式を判定
+        kStateHeader,
+        kStateRaw,          // 通常のイメージ（そのまま出力）
+        kStateBody,
+    };
+    enum PatchState {
+        kPatchOp,
+        kPatchInsert,
+    };
+
+    Sink sink_;
+    State state_ = kStateMagic;
+    uint8_t header_[OTA_IMAGE_HEADER_SIZE];
+    size_t header_size_ = 0;
+    uint8_t flags_ = 0;
+    uint32_t target_size_ = 0;
+    uint32_t source_size_ = 0;
+    size_t output_size_ = 0;
+
+    // zlib展開（ROMのminiz）
+    tinfl_decompressor_tag* inflator_ = nullptr;
+    uint8_t* dictionary_ = nullptr;
+    size_t dictionary_offset_ = 0;
+    bool inflate_done_ = false;
+
+    // 差分の適用
+    const esp_partition_t* source_partition_ = nullptr;
+    uint8_t* copy_buffer_ = nullptr;
+    PatchState patch_state_ = kPatchOp;
+    uint8_t op_[9];
+    size_t op_size_ = 0;
+    uint32_t insert_remaining_ = 0;
+
+    bool ParseHeader();
+    bool Inflate(const uint8_t* data, size_t size);
+    bool Decoded(const uint8_t* data, size_t size);
+    bool ApplyPatch(const uint8_t* data, size_t size);
+    bool Copy(uint32_t offset, uint32_t length);
+    bool Output(const uint8_t* data, size_t size);
+};
+
+#endif // OTA_DECODER_H
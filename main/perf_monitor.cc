@@ -0,0 +1,226 @@
+/**
+ * @file perf_monitor.cc
+ * @brief タスクCPU使用率・スタック・ヒープの常時サンプリングの実装
+ */
+#include "perf_monitor.h"
+#include "priority_mutex.h"
+#include "lvgl_port_config.h"
+#if CONFIG_USE_METRICS
+#include "metrics.h"
+#endif
+#if CONFIG_USE_AUDIO_STALL_WATCHDOG
+#include "audio_stall_watchdog.h"
+#endif
+
+#include <cJSON.h>
+#include <esp_heap_caps.h>
+#include <esp_log.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <map>
+
+#define TAG "PerfMonitor"
+
+#if CONFIG_USE_METRICS
+static MetricCallback metric_task_cpu("xiaozhi_task_cpu_percent",
+    "CPU usage per task in the latest sample, percent of all cores", kMetricGauge, [](MetricSink& sink) {
+        PerfMonitor::GetInstance().ForEachLatestTask([&sink](const char* name, float cpu_percent, uint32_t, int) {
+            char labels[48];
+            snprintf(labels, sizeof(labels), "task=\"%s\"", name);
+            sink.Sample("", labels, cpu_percent);
+        });
+    });
+static MetricCallback metric_task_stack_free("xiaozhi_task_stack_free_bytes",
+    "Minimum free stack per task", kMetricGauge, [](MetricSink& sink) {
+        PerfMonitor::GetInstance().ForEachLatestTask([&sink](const char* name, float, uint32_t stack_free, int) {
+            char labels[48];
+            snprintf(labels, sizeof(labels), "task=\"%s\"", name);
+            sink.Sample("", labels, stack_free);
+        });
+    });
+#endif
+
+void PerfMonitor::Start() {
+    if (timer_ != nullptr) {
+        return;
+    }
+    samples_ = (Sample*)heap_caps_calloc(CONFIG_PERF_MONITOR_WINDOW, sizeof(Sample), MALLOC_CAP_SPIRAM);
+    if (samples_ == nullptr) {
+        samples_ = (Sample*)heap_caps_calloc(CONFIG_PERF_MONITOR_WINDOW, sizeof(Sample), MALLOC_CAP_DEFAULT);
+    }
+    status_ = (TaskStatus_t*)heap_caps_malloc(sizeof(TaskStatus_t) * PERF_MONITOR_MAX_TASKS, MALLOC_CAP_SPIRAM);
+    if (status_ == nullptr) {
+        status_ = (TaskStatus_t*)heap_caps_malloc(sizeof(TaskStatus_t) * PERF_MONITOR_MAX_TASKS, MALLOC_CAP_DEFAULT);
+    }
+    if (samples_ == nullptr || status_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate sample buffers");
+        return;
+    }
+
+    esp_timer_create_args_t timer_args = {
+        .callback = [](void* arg) {
+            static_cast<PerfMonitor*>(arg)->TakeSample();
+        },
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "perf_monitor",
+        .skip_unhandled_events = true,
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&timer_args, &timer_));
+    // 最初のサンプルは差分の基準だけを取る
+    TakeSample();
+    ESP_ERROR_CHECK(esp_timer_start_periodic(timer_, CONFIG_PERF_MONITOR_INTERVAL_SECONDS * 1000000LL));
+}
+
+void PerfMonitor::TakeSample() {
+    configRUN_TIME_COUNTER_TYPE total = 0;
+    UBaseType_t task_count = uxTaskGetSystemState(status_, PERF_MONITOR_MAX_TASKS, &total);
+    if (task_count == 0) {
+        // タスク数がPERF_MONITOR_MAX_TASKSを超えると0が返る
+        ESP_LOGW(TAG, "Too many tasks to sample");
+        return;
+    }
+
+    bool has_previous = previous_total_ != 0;
+    configRUN_TIME_COUNTER_TYPE elapsed = (total - previous_total_) * CONFIG_FREERTOS_NUMBER_OF_CORES;
+
+    // esp_timerタスクのスタックは小さいため、リングの次の位置へ直接書き込む
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& sample = samples_[next_];
+    sample.time_us = esp_timer_get_time();
+    sample.internal_free = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+    sample.internal_min_free = heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL);
+    sample.internal_largest = heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL);
+    sample.psram_free = heap_caps_get_free_size(MALLOC_CAP_SPIRAM);
+    sample.task_count = 0;
+
+    for (UBaseType_t i = 0; i < task_count; i++) {
+        auto& status = status_[i];
+        if (has_previous && elapsed > 0) {
+            for (size_t j = 0; j < previous_count_; j++) {
+                if (previous_[j].handle != status.xHandle) {
+                    continue;
+                }
+                // 新しく作られたタスクは次のサンプルから記録する
+                auto& task = sample.tasks[sample.task_count++];
+                strncpy(task.name, status.pcTaskName, sizeof(task.name) - 1);
+                task.name[sizeof(task.name) - 1] = '\0';
+                uint64_t run_time = status.ulRunTimeCounter - previous_[j].run_time;
+                task.cpu_permille = (uint16_t)(run_time * 1000 / elapsed);
+                task.stack_free = status.usStackHighWaterMark;
+#if CONFIG_FREERTOS_VTASKLIST_INCLUDE_COREID
+                task.core = status.xCoreID < portNUM_PROCESSORS ? status.xCoreID : -1;
+#else
+                task.core = -1;
+#endif
+                break;
+            }
+        }
+        previous_[i] = {status.xHandle, status.ulRunTimeCounter};
+    }
+    previous_count_ = task_count;
+    previous_total_ = total;
+    if (!has_previous || elapsed == 0) {
+        return;
+    }
+
+    next_ = (next_ + 1) % CONFIG_PERF_MONITOR_WINDOW;
+    if (count_ < CONFIG_PERF_MONITOR_WINDOW) {
+        count_++;
+    }
+}
+
+void PerfMonitor::ForEachLatestTask(std::function<void(const char* name, float cpu_percent, uint32_t stack_free, int core)> callback) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (count_ == 0) {
+        return;
+    }
+    auto& sample = samples_[(next_ + CONFIG_PERF_MONITOR_WINDOW - 1) % CONFIG_PERF_MONITOR_WINDOW];
+    for (size_t i = 0; i < sample.task_count; i++) {
+        auto& task = sample.tasks[i];
+        callback(task.name, task.cpu_permille / 10.0f, task.stack_free, task.core);
+    }
+}
+
+std::string PerfMonitor::ToJson() {
+    struct TaskStats {
+        uint32_t cpu_sum = 0;
+        uint16_t cpu_max = 0;
+        uint16_t samples = 0;
+        uint32_t stack_free = UINT32_MAX;
+    };
+    std::map<std::string, TaskStats> tasks;
+
+    cJSON* root = cJSON_CreateObject();
+    cJSON_AddNumberToObject(root, "interval_s", CONFIG_PERF_MONITOR_INTERVAL_SECONDS);
+    cJSON* heap = cJSON_CreateArray();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        size_t start = (next_ + CONFIG_PERF_MONITOR_WINDOW - count_) % CONFIG_PERF_MONITOR_WINDOW;
+        for (size_t i = 0; i < count_; i++) {
+            auto& sample = samples_[(start + i) % CONFIG_PERF_MONITOR_WINDOW];
+            cJSON* item = cJSON_CreateObject();
+            cJSON_AddNumberToObject(item, "uptime_s", sample.time_us / 1000000);
+            cJSON_AddNumberToObject(item, "internal_free", sample.internal_free);
+            cJSON_AddNumberToObject(item, "internal_min_free", sample.internal_min_free);
+            cJSON_AddNumberToObject(item, "internal_largest", sample.internal_largest);
+            cJSON_AddNumberToObject(item, "psram_free", sample.psram_free);
+            cJSON_AddItemToArray(heap, item);
+
+            for (size_t j = 0; j < sample.task_count; j++) {
+                auto& task = sample.tasks[j];
+                auto& stats = tasks[task.name];
+                stats.cpu_sum += task.cpu_permille;
+                stats.cpu_max = std::max(stats.cpu_max, task.cpu_permille);
+                stats.samples++;
+                stats.stack_free = std::min(stats.stack_free, task.stack_free);
+            }
+        }
+        cJSON_AddNumberToObject(root, "samples", count_);
+    }
+    cJSON_AddItemToObject(root, "heap", heap);
+
+    // CPU使用率は全コア合計に対する%（小数1桁）
+    cJSON* task_array = cJSON_CreateArray();
+    for (auto& [name, stats] : tasks) {
+        cJSON* item = cJSON_CreateObject();
+        cJSON_AddStringToObject(item, "name", name.c_str());
+        cJSON_AddNumberToObject(item, "cpu_avg", stats.cpu_sum / stats.samples / 10.0);
+        cJSON_AddNumberToObject(item, "cpu_max", stats.cpu_max / 10.0);
+        cJSON_AddNumberToObject(item, "stack_free", stats.stack_free);
+        cJSON_AddItemToArray(task_array, item);
+    }
+    cJSON_AddItemToObject(root, "tasks", task_array);
+
+#if CONFIG_USE_LOCK_CONTENTION_STATS
+    // 起動からの累計。待ち時間はマイクロ秒
+    cJSON* lock_array = cJSON_CreateArray();
+    PriorityMutex::ForEach([lock_array](const PriorityMutex& mutex) {
+        auto stats = mutex.stats();
+        cJSON* item = cJSON_CreateObject();
+        cJSON_AddStringToObject(item, "name", mutex.name());
+        cJSON_AddNumberToObject(item, "acquisitions", stats.acquisitions);
+        cJSON_AddNumberToObject(item, "contended", stats.contended);
+        cJSON_AddNumberToObject(item, "wait_total_us", stats.wait_total_us);
+        cJSON_AddNumberToObject(item, "wait_max_us", stats.wait_max_us);
+        if (stats.contended > 0) {
+            cJSON_AddStringToObject(item, "max_holder", stats.max_holder);
+            cJSON_AddStringToObject(item, "max_waiter", stats.max_waiter);
+        }
+        cJSON_AddItemToArray(lock_array, item);
+    });
+    cJSON_AddItemToObject(root, "locks", lock_array);
+#endif
+#if CONFIG_USE_AUDIO_STALL_WATCHDOG
+    AudioStallWatchdog::GetInstance().AddToJson(root);
+#endif
+    LvglRenderMonitor::GetInstance().AddToJson(root);
+
+    char* json = cJSON_PrintUnformatted(root);
+    std::string result(json);
+    cJSON_free(json);
+    cJSON_Delete(root);
+    return result;
+}
@@ -0,0 +1,99 @@
+/**
+ * @file perf_monitor.h
+ * @brief タスクCPU使用率・スタック・ヒープの常時サンプリング
+ *
+ * 一定間隔でuxTaskGetSystemState()の実行時間カウンタを前回と差分し、
+ * 直近PERF_MONITOR_WINDOW回分をリングに保持します。内容はMCPツールから取得でき、
+ * シリアル接続なしで現場のaudio_loopやbackground_taskの負荷を確認できます。
+ */
+#ifndef PERF_MONITOR_H
+#define PERF_MONITOR_H
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_timer.h>
+
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+
+/** @brief 1回のサンプルで記録する最大タスク数 */
+#define PERF_MONITOR_MAX_TASKS 40
+
+/**
+ * @class PerfMonitor
+ * @brief 実行時統計のローリングウィンドウを保持するシングルトン
+ *
+ * サンプリングはesp_timerタスクで数十マイクロ秒程度です。
+ * 記録用のリングはPSRAMがあればPSRAMに確保します。
+ */
+class PerfMonitor {
+public:
+    static PerfMonitor& GetInstance() {
+        static PerfMonitor instance;
+        return instance;
+    }
+
+    PerfMonitor(const PerfMonitor&) = delete;
+    PerfMonitor& operator=(const PerfMonitor&) = delete;
+
+    /** @brief CONFIG_PERF_MONITOR_INTERVAL_SECONDSごとのサンプリングを開始 */
+    void Start();
+
+    /**
+     * @brief ウィンドウ内の統計をJSON形式で取得（MCPツール用）
+     *
+     * タスクごとの平均・最大CPU使用率（全コア合計に対する%）と最小スタック空き、
+     * サンプルごとのヒープ空き量を返します。
+     */
+    std::string ToJson();
+
+    /**
+     * @brief 最新のサンプルのタスクごとの値を列挙（メトリクス用）
+     * @param callback タスク名、CPU使用率（全コア合計に対する%）、最小スタック空き（バイト）、
+     *                 固定されたコア（-1: コア指定なし）
+     */
+    void ForEachLatestTask(std::function<void(const char* name, float cpu_percent, uint32_t stack_free, int core)> callback);
+
+private:
+    PerfMonitor() = default;
+
+    struct TaskSample {
+        char name[configMAX_TASK_NAME_LEN];
+        uint16_t cpu_permille;          /**< 全コア合計に対する使用率（0.1%単位） */
+        uint32_t stack_free;            /**< スタックの最小空き（バイト） */
+        int8_t core;                    /**< 固定されたコア（-1: コア指定なし） */
+    };
+
+    struct Sample {
+        int64_t time_us;
+        uint32_t internal_free;
+        uint32_t internal_min_free;
+        uint32_t internal_largest;
+        uint32_t psram_free;
+        uint16_t task_count;
+        TaskSample tasks[PERF_MONITOR_MAX_TASKS];
+    };
+
+    struct Counter {
+        TaskHandle_t handle;
+        configRUN_TIME_COUNTER_TYPE run_time;
+    };
+
+    void TakeSample();
+
+    std::mutex mutex_;
+    esp_timer_handle_t timer_ = nullptr;
+    Sample* samples_ = nullptr;         /**< CONFIG_PERF_MONITOR_WINDOW個のリング */
+    size_t next_ = 0;
+    size_t count_ = 0;
+
+    // 前回のカウンタ（サンプリングタスク専用）
+    TaskStatus_t* status_ = nullptr;
+    Counter previous_[PERF_MONITOR_MAX_TASKS] = {};
+    size_t previous_count_ = 0;
+    configRUN_TIME_COUNTER_TYPE previous_total_ = 0;
+};
+
+#endif // PERF_MONITOR_H
@@ -0,0 +1,167 @@
+/**
+ * @file power_governor.cc
+ * @brief 電池残量と充電状態に応じた電力段階の実装
+ */
+#include "power_governor.h"
+#include "board.h"
+#include "backlight.h"
+#include "camera.h"
+#include "lvgl_port_config.h"
+#if CONFIG_USE_METRICS
+#include "metrics.h"
+#endif
+
+#include <cJSON.h>
+#include <esp_log.h>
+
+#define TAG "PowerGovernor"
+
+#if CONFIG_USE_METRICS
+static MetricCallback metric_power_tier("xiaozhi_power_tier",
+    "Power tier chosen from the battery state (0: full, 1: battery, 2: saver)", kMetricGauge, [](MetricSink& sink) {
+        sink.Sample("", "", PowerGovernor::GetInstance().tier());
+    });
+#endif
+
+bool PowerGovernor::Sample() {
+    PowerTier target = ReadTarget();
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!initialized_) {
+        initialized_ = true;
+        tier_ = target;
+        ESP_LOGI(TAG, "Initial tier %s (battery %d%%, discharging %d)", Name(tier_), level_, discharging_);
+        return true;
+    }
+    if (target == tier_) {
+        pending_windows_ = 0;
+        return false;
+    }
+    if (target != pending_) {
+        pending_ = target;
+        pending_windows_ = 0;
+    }
+    // 充電器をつないだ場合はすぐ戻し、電池側への切り替えだけ判定が続くのを待つ
+    if (target != kPowerTierFull && ++pending_windows_ < CONFIG_POWER_GOVERNOR_SWITCH_SECONDS) {
+        return false;
+    }
+    ESP_LOGI(TAG, "Tier %s -> %s (battery %d%%, discharging %d)", Name(tier_), Name(target), level_, discharging_);
+    tier_ = target;
+    pending_windows_ = 0;
+    return true;
+}
+
+void PowerGovernor::Apply() {
+    auto limits = this->limits();
+    auto& board = Board::GetInstance();
+    auto backlight = board.GetBacklight();
+    if (backlight != nullptr) {
+        backlight->SetCeiling(limits.max_brightness);
+    }
+    LvglRenderMonitor::GetInstance().SetRefreshPeriod(kLvglRefreshLimitPower, limits.refresh_period_ms);
+    if (!limits.camera) {
+        auto camera = board.GetCamera();
+        if (camera != nullptr) {
+            camera->StopViewfinder();
+        }
+    }
+    board.RefreshNetworkPowerProfile();
+}
+
+PowerTier PowerGovernor::tier() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (initialized_) {
+            return tier_;
+        }
+    }
+    // AFEの作成などクロックタイマーの開始前に呼ばれた場合
+    PowerTier target = ReadTarget();
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!initialized_) {
+        initialized_ = true;
+        tier_ = target;
+        ESP_LOGI(TAG, "Initial tier %s (battery %d%%, discharging %d)", Name(tier_), level_, discharging_);
+    }
+    return tier_;
+}
+
+PowerTier PowerGovernor::Evaluate(int level, bool discharging) const {
+    if (!discharging) {
+        return kPowerTierFull;
+    }
+    // 節約段階から抜けるには、しきい値よりヒステリシス分だけ多く残っている必要がある
+    int threshold = CONFIG_POWER_GOVERNOR_SAVER_LEVEL;
+    if (tier_ == kPowerTierSaver) {
+        threshold += CONFIG_POWER_GOVERNOR_HYSTERESIS_PERCENT;
+    }
+    return level <= threshold ? kPowerTierSaver : kPowerTierBattery;
+}
+
+PowerTier PowerGovernor::ReadTarget() {
+    int level = 0;
+    bool charging = false;
+    bool discharging = false;
+    bool available = Board::GetInstance().GetBatteryLevel(level, charging, discharging);
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!available) {
+        level_ = -1;
+        discharging_ = false;
+        return kPowerTierFull;
+    }
+    level_ = level;
+    discharging_ = discharging;
+    return Evaluate(level, discharging);
+}
+
+PowerTierLimits PowerGovernor::Limits(PowerTier tier) {
+    switch (tier) {
+        case kPowerTierBattery:
+            return {CONFIG_POWER_GOVERNOR_BATTERY_BRIGHTNESS, POWER_GOVERNOR_BATTERY_REFRESH_MS,
+                POWER_GOVERNOR_BATTERY_COMPLEXITY, 0, true};
+        case kPowerTierSaver:
+            return {CONFIG_POWER_GOVERNOR_SAVER_BRIGHTNESS, POWER_GOVERNOR_SAVER_REFRESH_MS,
+                0, CONFIG_POWER_GOVERNOR_SAVER_BITRATE_KBPS * 1000, false};
+        case kPowerTierFull:
+        default:
+            return {100, 0, 10, 0, true};
+    }
+}
+
+const char* PowerGovernor::Name(PowerTier tier) {
+    switch (tier) {
+        case kPowerTierBattery:
+            return "battery";
+        case kPowerTierSaver:
+            return "saver";
+        case kPowerTierFull:
+        default:
+            return "full";
+    }
+}
+
+std::string PowerGovernor::ToJson() {
+    auto current = tier();
+    auto limits = Limits(current);
+    auto root = cJSON_CreateObject();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        cJSON_AddStringToObject(root, "tier", Name(current));
+        cJSON_AddNumberToObject(root, "battery_level", level_);
+        cJSON_AddBoolToObject(root, "discharging", discharging_);
+        if (pending_windows_ > 0) {
+            cJSON_AddStringToObject(root, "pending", Name(pending_));
+        }
+    }
+    auto json_limits = cJSON_CreateObject();
+    cJSON_AddNumberToObject(json_limits, "max_brightness", limits.max_brightness);
+    cJSON_AddNumberToObject(json_limits, "refresh_period_ms", limits.refresh_period_ms);
+    cJSON_AddNumberToObject(json_limits, "max_complexity", limits.max_complexity);
+    cJSON_AddNumberToObject(json_limits, "bitrate", limits.bitrate);
+    cJSON_AddBoolToObject(json_limits, "camera", limits.camera);
+    cJSON_AddItemToObject(root, "limits", json_limits);
+    auto json_str = cJSON_PrintUnformatted(root);
+    std::string json(json_str);
+    cJSON_free(json_str);
+    cJSON_Delete(root);
+    return json;
+}
@@ -0,0 +1,95 @@
+/**
+ * @file power_governor.h
+ * @brief 電池残量と充電状態に応じて各サブシステムの設定をまとめて切り替えるガバナー
+ *
+ * PMICの電池残量と充電状態から3段階の電力段階（通常 / 電池 / 節約）を決め、
+ * バックライトの上限、LVGLの描画周期、Opusの演算量とビットレート、カメラの使用可否、
+ * Wi-Fiのスリープ種別、自動モードのAFEプロファイルへ同じ段階を反映します。
+ * 残量のしきい値にはヒステリシスを持たせ、同じ判定が続いた場合だけ段階を変えます。
+ */
+#ifndef POWER_GOVERNOR_H
+#define POWER_GOVERNOR_H
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+/** @brief 電池段階でのOpus演算量の上限 */
+#define POWER_GOVERNOR_BATTERY_COMPLEXITY 3
+
+/** @brief 電池段階でのLVGLの描画周期（ミリ秒） */
+#define POWER_GOVERNOR_BATTERY_REFRESH_MS 50
+
+/** @brief 節約段階でのLVGLの描画周期（ミリ秒） */
+#define POWER_GOVERNOR_SAVER_REFRESH_MS 100
+
+enum PowerTier {
+    kPowerTierFull,         // 外部電源（または電池なし）：各モジュールの既定値
+    kPowerTierBattery,      // 放電中：画面の明るさと描画周期、演算量を控えめにする
+    kPowerTierSaver,        // 放電中で残量が少ない：カメラを止め、通信も最小限にする
+};
+
+/** @brief 段階ごとの各サブシステムの上限 */
+struct PowerTierLimits {
+    uint8_t max_brightness;     /**< バックライトの上限（%） */
+    int refresh_period_ms;      /**< LVGLの描画周期（0はKconfigの既定） */
+    int max_complexity;         /**< Opusの演算量の上限 */
+    int bitrate;                /**< Opusのビットレート（bps、0は自動） */
+    bool camera;                /**< カメラを使えるか */
+};
+
+/**
+ * @class PowerGovernor
+ * @brief 電力段階のシングルトン
+ *
+ * Sample()はクロックタイマーから1秒ごとに呼び出し、trueが返ったらApply()をメインタスクで
+ * 呼び出してください（LVGLのロックを取るため）。Opusの設定はエンコードグループで行う必要が
+ * あるため、Applicationがlimits()を読んで反映します。
+ */
+class PowerGovernor {
+public:
+    static PowerGovernor& GetInstance() {
+        static PowerGovernor instance;
+        return instance;
+    }
+
+    PowerGovernor(const PowerGovernor&) = delete;
+    PowerGovernor& operator=(const PowerGovernor&) = delete;
+
+    /** @brief 電池の状態を読み、段階が変わった場合true */
+    bool Sample();
+
+    /** @brief バックライト、LVGL、カメラ、Wi-Fiへ現在の段階を反映（メインタスクから呼ぶ） */
+    void Apply();
+
+    /** @brief 現在の段階（初回は待たずに電池の状態から決める） */
+    PowerTier tier();
+
+    /** @brief 現在の段階の上限 */
+    PowerTierLimits limits() { return Limits(tier()); }
+
+    static PowerTierLimits Limits(PowerTier tier);
+    static const char* Name(PowerTier tier);
+
+    /** @brief 段階、電池の状態と各上限をJSONで取得 */
+    std::string ToJson();
+
+private:
+    PowerGovernor() = default;
+
+    /** @brief 電池の状態から目指す段階を決める（現在の段階を基準にヒステリシスをかける） */
+    PowerTier Evaluate(int level, bool discharging) const;
+
+    /** @brief 電池の状態を読んで目指す段階を返す。読めない場合は通常 */
+    PowerTier ReadTarget();
+
+    std::mutex mutex_;
+    bool initialized_ = false;
+    PowerTier tier_ = kPowerTierFull;
+    PowerTier pending_ = kPowerTierFull;    /**< 切り替え待ちの段階 */
+    int pending_windows_ = 0;               /**< pending_が続いた区間数 */
+    int level_ = -1;                        /**< 直近の電池残量（%） */
+    bool discharging_ = false;
+};
+
+#endif // POWER_GOVERNOR_H
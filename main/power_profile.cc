@@ -0,0 +1,57 @@
+/**
+ * @file power_profile.cc
+ * @brief デバイス状態に応じたCPU周波数（DFS）の設定の実装
+ */
+#include "power_profile.h"
+
+#include <algorithm>
+#include <esp_log.h>
+#include <esp_pm.h>
+
+#define TAG "PowerProfile"
+
+void PowerProfile::SetActive(bool active) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    active_ = active;
+    Apply();
+}
+
+void PowerProfile::SetSleepMode(bool sleep_mode) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    sleep_mode_ = sleep_mode;
+    Apply();
+}
+
+void PowerProfile::SetMaxFreqLimit(int max_freq_mhz) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    max_freq_limit_ = max_freq_mhz;
+    Apply();
+}
+
+void PowerProfile::Apply() {
+#if CONFIG_USE_DFS_PROFILES
+    bool light_sleep = sleep_mode_ && !active_;
+    int max_freq = active_ ? CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ : CONFIG_DFS_IDLE_MAX_FREQ_MHZ;
+    if (max_freq_limit_ > 0) {
+        max_freq = std::min(max_freq, max_freq_limit_);
+    }
+    if (applied_ && applied_max_freq_ == max_freq && applied_sleep_mode_ == light_sleep) {
+        return;
+    }
+    esp_pm_config_t pm_config = {
+        .max_freq_mhz = max_freq,
+        .min_freq_mhz = std::min(CONFIG_DFS_MIN_FREQ_MHZ, max_freq),
+        .light_sleep_enable = light_sleep,
+    };
+    esp_err_t ret = esp_pm_configure(&pm_config);
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to configure DFS: %s", esp_err_to_name(ret));
+        return;
+    }
+    applied_ = true;
+    applied_max_freq_ = max_freq;
+    applied_sleep_mode_ = light_sleep;
+    ESP_LOGI(TAG, "CPU %d-%d MHz%s", pm_config.min_freq_mhz, pm_config.max_freq_mhz,
+        light_sleep ? ", light sleep" : "");
+#endif
+}
@@ -0,0 +1,53 @@
+/**
+ * @file power_profile.h
+ * @brief デバイス状態に応じたCPU周波数（DFS）の設定
+ *
+ * 待機中（WakeNetのみ）は最大周波数を下げ、会話中（AFE・Opus）は既定の最大周波数に戻します。
+ * DFSでは周波数ロックを持つタスクだけが最大周波数で動くため、音声処理の各ステージ
+ * （AFE、WakeNet、Opusのエンコード・デコード）は処理中だけロックを保持します。
+ */
+#ifndef POWER_PROFILE_H
+#define POWER_PROFILE_H
+
+#include <mutex>
+
+/**
+ * @class PowerProfile
+ * @brief esp_pm_configure()の設定を一か所で管理するシングルトン
+ *
+ * CONFIG_USE_DFS_PROFILESが無効な場合は何もしません。
+ * PowerSaveTimerのスリープモードもここを経由してライトスリープを許可します。
+ */
+class PowerProfile {
+public:
+    static PowerProfile& GetInstance() {
+        static PowerProfile instance;
+        return instance;
+    }
+
+    PowerProfile(const PowerProfile&) = delete;
+    PowerProfile& operator=(const PowerProfile&) = delete;
+
+    /** @brief 会話中（接続・聞き取り・発話・アップグレード）かどうか */
+    void SetActive(bool active);
+
+    /** @brief PowerSaveTimerのスリープモード（待機中のみライトスリープを許可） */
+    void SetSleepMode(bool sleep_mode);
+
+    /** @brief 最大周波数の上限（MHz、0は上限なし）。ThermalMonitorが高温時に下げる */
+    void SetMaxFreqLimit(int max_freq_mhz);
+
+private:
+    PowerProfile() = default;
+    void Apply();
+
+    std::mutex mutex_;
+    bool active_ = true;            // 起動中は既定の周波数のまま
+    bool sleep_mode_ = false;
+    int max_freq_limit_ = 0;
+    bool applied_ = false;
+    int applied_max_freq_ = 0;
+    bool applied_sleep_mode_ = false;
+};
+
+#endif // POWER_PROFILE_H
@@ -0,0 +1,108 @@
+#include "priority_mutex.h"
+#if CONFIG_USE_AUDIO_STALL_WATCHDOG
+#include "audio_stall_watchdog.h"
+#endif
+
+#include <esp_timer.h>
+
+#include <cstring>
+
+static PriorityMutex* s_registered[PRIORITY_MUTEX_MAX_REGISTERED] = {};
+static portMUX_TYPE s_registry_lock = portMUX_INITIALIZER_UNLOCKED;
+
+PriorityMutex::PriorityMutex(const char* name) : name_(name) {
+    // xSemaphoreCreateMutexは優先度継承付き。静的確保なのでヒープを使わない
+    handle_ = xSemaphoreCreateMutexStatic(&buffer_);
+#if CONFIG_USE_LOCK_CONTENTION_STATS
+    taskENTER_CRITICAL(&s_registry_lock);
+    for (auto& slot : s_registered) {
+        if (slot == nullptr) {
+            slot = this;
+            break;
+        }
+    }
+    taskEXIT_CRITICAL(&s_registry_lock);
+#endif
+}
+
+PriorityMutex::~PriorityMutex() {
+#if CONFIG_USE_LOCK_CONTENTION_STATS
+    taskENTER_CRITICAL(&s_registry_lock);
+    for (auto& slot : s_registered) {
+        if (slot == this) {
+            slot = nullptr;
+        }
+    }
+    taskEXIT_CRITICAL(&s_registry_lock);
+#endif
+    vSemaphoreDelete(handle_);
+}
+
+void PriorityMutex::lock() {
+#if CONFIG_USE_LOCK_CONTENTION_STATS
+    if (xSemaphoreTake(handle_, 0) == pdTRUE) {
+        acquisitions_.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    // 待ちに入る前に保持者を記録する（取得後には分からない）
+    TaskHandle_t holder = xSemaphoreGetMutexHolder(handle_);
+    int64_t start = esp_timer_get_time();
+    xSemaphoreTake(handle_, portMAX_DELAY);
+    uint32_t wait_us = esp_timer_get_time() - start;
+
+    acquisitions_.fetch_add(1, std::memory_order_relaxed);
+    contended_.fetch_add(1, std::memory_order_relaxed);
+    wait_total_us_.fetch_add(wait_us, std::memory_order_relaxed);
+    const char* holder_name = holder != nullptr ? pcTaskGetName(holder) : "?";
+    if (wait_us > wait_max_us_.load(std::memory_order_relaxed)) {
+        wait_max_us_.store(wait_us, std::memory_order_relaxed);
+        strlcpy(max_holder_, holder_name, sizeof(max_holder_));
+        strlcpy(max_waiter_, pcTaskGetName(nullptr), sizeof(max_waiter_));
+    }
+#if CONFIG_USE_AUDIO_STALL_WATCHDOG
+    AudioStallWatchdog::GetInstance().OnLockWait(name_, holder_name, wait_us);
+#endif
+#else
+    xSemaphoreTake(handle_, portMAX_DELAY);
+#endif
+}
+
+bool PriorityMutex::try_lock() {
+    if (xSemaphoreTake(handle_, 0) != pdTRUE) {
+        return false;
+    }
+#if CONFIG_USE_LOCK_CONTENTION_STATS
+    acquisitions_.fetch_add(1, std::memory_order_relaxed);
+#endif
+    return true;
+}
+
+void PriorityMutex::unlock() {
+    xSemaphoreGive(handle_);
+}
+
+PriorityMutex::Stats PriorityMutex::stats() const {
+    Stats stats = {};
+#if CONFIG_USE_LOCK_CONTENTION_STATS
+    stats.acquisitions = acquisitions_.load(std::memory_order_relaxed);
+    stats.contended = contended_.load(std::memory_order_relaxed);
+    stats.wait_total_us = wait_total_us_.load(std::memory_order_relaxed);
+    stats.wait_max_us = wait_max_us_.load(std::memory_order_relaxed);
+    // 名前は更新中に読むと崩れることがあるが、統計表示用なので許容する
+    strlcpy(stats.max_holder, max_holder_, sizeof(stats.max_holder));
+    strlcpy(stats.max_waiter, max_waiter_, sizeof(stats.max_waiter));
+#endif
+    return stats;
+}
+
+void PriorityMutex::ForEach(std::function<void(const PriorityMutex& mutex)> callback) {
+    PriorityMutex* registered[PRIORITY_MUTEX_MAX_REGISTERED];
+    taskENTER_CRITICAL(&s_registry_lock);
+    memcpy(registered, s_registered, sizeof(registered));
+    taskEXIT_CRITICAL(&s_registry_lock);
+    for (auto mutex : registered) {
+        if (mutex != nullptr) {
+            callback(*mutex);
+        }
+    }
+}
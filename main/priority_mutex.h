@@ -0,0 +1,77 @@
+/**
+ * @file priority_mutex.h
+ * @brief 優先度継承ミューテックスと競合の計測
+ *
+ * 優先度8のaudio_loopと優先度2のワーカー、ネットワークのコールバックが同じロックを取るため、
+ * 低優先度のタスクが保持したままプリエンプトされると音声が遅れます（優先度逆転）。
+ * FreeRTOSのミューテックス（優先度継承あり）を静的に確保して直接使い、
+ * CONFIG_USE_LOCK_CONTENTION_STATS が有効なら待ち時間と待たせたタスクを記録します。
+ * 統計は self.get_perf_stats の "locks" に含まれます。
+ */
+#ifndef PRIORITY_MUTEX_H
+#define PRIORITY_MUTEX_H
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+
+/** @brief 統計を取るロックの最大数 */
+#define PRIORITY_MUTEX_MAX_REGISTERED 16
+
+/**
+ * @class PriorityMutex
+ * @brief std::lock_guard / std::unique_lock で使える優先度継承ミューテックス
+ *
+ * 再帰ロックはできません。std::condition_variable と組み合わせる場合は
+ * std::condition_variable_any を使います。
+ */
+class PriorityMutex {
+public:
+    struct Stats {
+        uint32_t acquisitions;              /**< 取得回数 */
+        uint32_t contended;                 /**< 待たされた回数 */
+        uint64_t wait_total_us;             /**< 待ち時間の合計 */
+        uint32_t wait_max_us;               /**< 最長の待ち時間 */
+        char max_holder[configMAX_TASK_NAME_LEN];   /**< 最長の待ちのときロックを持っていたタスク */
+        char max_waiter[configMAX_TASK_NAME_LEN];   /**< 最長の待ちをしたタスク */
+    };
+
+    /** @param name 統計に出す名前（文字列リテラル） */
+    explicit PriorityMutex(const char* name);
+    ~PriorityMutex();
+
+    PriorityMutex(const PriorityMutex&) = delete;
+    PriorityMutex& operator=(const PriorityMutex&) = delete;
+
+    void lock();
+    bool try_lock();
+    void unlock();
+
+    const char* name() const { return name_; }
+
+    /** @brief 統計のスナップショット（計測無効時はすべて0） */
+    Stats stats() const;
+
+    /** @brief 統計を取っているすべてのロックを列挙 */
+    static void ForEach(std::function<void(const PriorityMutex& mutex)> callback);
+
+private:
+    const char* name_;
+    StaticSemaphore_t buffer_;
+    SemaphoreHandle_t handle_ = nullptr;
+#if CONFIG_USE_LOCK_CONTENTION_STATS
+    // 取得後（ロック保持中）に更新するため書き込みは直列化される
+    std::atomic<uint32_t> acquisitions_{0};
+    std::atomic<uint32_t> contended_{0};
+    std::atomic<uint64_t> wait_total_us_{0};
+    std::atomic<uint32_t> wait_max_us_{0};
+    char max_holder_[configMAX_TASK_NAME_LEN] = {};
+    char max_waiter_[configMAX_TASK_NAME_LEN] = {};
+#endif
+};
+
+#endif // PRIORITY_MUTEX_H
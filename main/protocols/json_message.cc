@@ -0,0 +1,278 @@
+#include "json_message.h"
+
+#include <esp_log.h>
+#include <cstring>
+
+#define TAG "JsonMessage"
+
+static const char* SkipSpace(const char* p, const char* end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) {
+        p++;
+    }
+    return p;
+}
+
+// 開始の引用符の次を受け取り、終わりの引用符の位置を返す
+static const char* ScanString(const char* p, const char* end, bool& escaped) {
+    escaped = false;
+    while (p < end && *p != '"') {
+        if (*p == '\\') {
+            escaped = true;
+            p++;
+        }
+        p++;
+    }
+    return p < end ? p : nullptr;
+}
+
+static void AppendUtf8(std::string& out, uint32_t code) {
+    if (code < 0x80) {
+        out += (char)code;
+    } else if (code < 0x800) {
+        out += (char)(0xC0 | (code >> 6));
+        out += (char)(0x80 | (code & 0x3F));
+    } else if (code < 0x10000) {
+        out += (char)(0xE0 | (code >> 12));
+        out += (char)(0x80 | ((code >> 6) & 0x3F));
+        out += (char)(0x80 | (code & 0x3F));
+    } else {
+        out += (char)(0xF0 | (code >> 18));
+        out += (char)(0x80 | ((code >> 12) & 0x3F));
+        out += (char)(0x80 | ((code >> 6) & 0x3F));
+        out += (char)(0x80 | (code & 0x3F));
+    }
+}
+
+static bool ParseHex4(const char* p, const char* end, uint32_t& code) {
+    if (end - p < 4) {
+        return false;
+    }
+    code = 0;
+    for (int i = 0; i < 4; i++) {
+        char c = p[i];
+        code <<= 4;
+        if (c >= '0' && c <= '9') {
+            code |= c - '0';
+        } else if (c >= 'a' && c <= 'f') {
+            code |= c - 'a' + 10;
+        } else if (c >= 'A' && c <= 'F') {
+            code |= c - 'A' + 10;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool JsonMessage::Parse(const char* data, size_t length) {
+    count_ = 0;
+    const char* p = data;
+    const char* end = data + length;
+
+    p = SkipSpace(p, end);
+    if (p == end || *p != '{') {
+        return false;
+    }
+    p = SkipSpace(p + 1, end);
+    if (p < end && *p == '}') {
+        return SkipSpace(p + 1, end) == end;
+    }
+
+    while (p < end) {
+        if (*p != '"' || count_ == JSON_MESSAGE_MAX_FIELDS) {
+            return false;
+        }
+        bool escaped;
+        const char* key_end = ScanString(p + 1, end, escaped);
+        if (key_end == nullptr || escaped) {
+            return false;
+        }
+        Field& field = fields_[count_];
+        field.key = std::string_view(p + 1, key_end - p - 1);
+
+        p = SkipSpace(key_end + 1, end);
+        if (p == end || *p != ':') {
+            return false;
+        }
+        p = SkipSpace(p + 1, end);
+        if (p == end) {
+            return false;
+        }
+
+        if (*p == '"') {
+            const char* value_end = ScanString(p + 1, end, escaped);
+            if (value_end == nullptr) {
+                return false;
+            }
+            field.value = std::string_view(p + 1, value_end - p - 1);
+            field.type = kValueString;
+            field.escaped = escaped;
+            p = value_end + 1;
+        } else if (*p == '{' || *p == '[') {
+            // ネストした値はcJSONに任せる
+            return false;
+        } else {
+            const char* value_start = p;
+            while (p < end && *p != ',' && *p != '}' && *p != ' ' && *p != '\t' && *p != '\n' && *p != '\r') {
+                p++;
+            }
+            if (p == value_start) {
+                return false;
+            }
+            field.value = std::string_view(value_start, p - value_start);
+            field.type = kValueLiteral;
+            field.escaped = false;
+        }
+        count_++;
+
+        p = SkipSpace(p, end);
+        if (p == end) {
+            return false;
+        }
+        if (*p == '}') {
+            return SkipSpace(p + 1, end) == end;
+        }
+        if (*p != ',') {
+            return false;
+        }
+        p = SkipSpace(p + 1, end);
+    }
+    return false;
+}
+
+const JsonMessage::Field* JsonMessage::Find(const char* key) const {
+    for (size_t i = 0; i < count_; i++) {
+        if (fields_[i].key == key) {
+            return &fields_[i];
+        }
+    }
+    return nullptr;
+}
+
+bool JsonMessage::AddString(std::string_view key, std::string_view value) {
+    if (count_ >= JSON_MESSAGE_MAX_FIELDS) {
+        return false;
+    }
+    fields_[count_++] = Field{key, value, kValueString, false};
+    return true;
+}
+
+std::string_view JsonMessage::Raw(const char* key) const {
+    auto field = Find(key);
+    if (field == nullptr || field->type != kValueString) {
+        return std::string_view();
+    }
+    return field->value;
+}
+
+bool JsonMessage::Equals(const char* key, const char* value) const {
+    auto field = Find(key);
+    return field != nullptr && field->type == kValueString && !field->escaped && field->value == value;
+}
+
+std::string JsonMessage::GetString(const char* key) const {
+    auto field = Find(key);
+    if (field == nullptr || field->type != kValueString) {
+        return std::string();
+    }
+    if (!field->escaped) {
+        return std::string(field->value);
+    }
+
+    std::string out;
+    out.reserve(field->value.size());
+    const char* p = field->value.data();
+    const char* end = p + field->value.size();
+    while (p < end) {
+        if (*p != '\\' || p + 1 == end) {
+            out += *p++;
+            continue;
+        }
+        char c = p[1];
+        p += 2;
+        switch (c) {
+            case 'b': out += '\b'; break;
+            case 'f': out += '\f'; break;
+            case 'n': out += '\n'; break;
+            case 'r': out += '\r'; break;
+            case 't': out += '\t'; break;
+            case 'u': {
+                uint32_t code;
+                if (!ParseHex4(p, end, code)) {
+                    break;
+                }
+                p += 4;
+                // サロゲートペア（絵文字など）は後続の\uXXXXと組み合わせる
+                uint32_t low;
+                if (code >= 0xD800 && code < 0xDC00 && end - p >= 6 && p[0] == '\\' && p[1] == 'u' &&
+                    ParseHex4(p + 2, end, low) && low >= 0xDC00 && low < 0xE000) {
+                    code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                    p += 6;
+                }
+                AppendUtf8(out, code);
+                break;
+            }
+            default: out += c; break;
+        }
+    }
+    return out;
+}
+
+uint32_t JsonMessageRouter::Hash(std::string_view type, std::string_view state) {
+    // FNV-1a。typeとstateの間に区切りとして0を挟む
+    uint32_t hash = 2166136261u;
+    for (char c : type) {
+        hash = (hash ^ (uint8_t)c) * 16777619u;
+    }
+    hash = (hash ^ 0) * 16777619u;
+    for (char c : state) {
+        hash = (hash ^ (uint8_t)c) * 16777619u;
+    }
+    return hash;
+}
+
+void JsonMessageRouter::Add(const char* type, const char* state, Handler handler) {
+    uint32_t hash = Hash(type, state != nullptr ? state : "");
+    for (size_t i = 0; i < JSON_ROUTER_SLOTS; i++) {
+        Route& route = routes_[(hash + i) & (JSON_ROUTER_SLOTS - 1)];
+        if (route.type == nullptr) {
+            route.hash = hash;
+            route.type = type;
+            route.state = state;
+            route.handler = handler;
+            return;
+        }
+    }
+    ESP_LOGE(TAG, "Route table is full, %s/%s is not registered", type, state != nullptr ? state : "*");
+}
+
+const JsonMessageRouter::Route* JsonMessageRouter::Find(std::string_view type, std::string_view state) const {
+    uint32_t hash = Hash(type, state);
+    for (size_t i = 0; i < JSON_ROUTER_SLOTS; i++) {
+        const Route& route = routes_[(hash + i) & (JSON_ROUTER_SLOTS - 1)];
+        if (route.type == nullptr) {
+            return nullptr;
+        }
+        if (route.hash == hash && type == route.type && state == (route.state != nullptr ? route.state : "")) {
+            return &route;
+        }
+    }
+    return nullptr;
+}
+
+bool JsonMessageRouter::Dispatch(const JsonMessage& message) const {
+    auto type = message.Raw("type");
+    if (type.empty()) {
+        return false;
+    }
+    auto state = message.Raw("state");
+    const Route* route = state.empty() ? nullptr : Find(type, state);
+    if (route == nullptr) {
+        route = Find(type, "");
+    }
+    if (route == nullptr) {
+        return false;
+    }
+    route->handler(message);
+    return true;
+}
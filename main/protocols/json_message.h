@@ -0,0 +1,108 @@
+/**
+ * @file json_message.h
+ * @brief 受信バッファ上で動くフラットなJSONメッセージの走査とルーティング
+ *
+ * tts / stt / llm などの頻繁に届くメッセージは、ネストのない小さなオブジェクトです。
+ * cJSON_Parse()でヒープ上にDOMを作らず、受信バッファ内のキーと値の位置だけを記録し、
+ * type/stateのハッシュで登録済みのハンドラへ振り分けます。
+ * ネストを含むメッセージ（MCP、hello、iotなど）は走査に失敗し、従来のcJSONの経路で処理されます。
+ */
+#ifndef JSON_MESSAGE_H
+#define JSON_MESSAGE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+
+/** @brief 1メッセージで記録できるフィールド数（超える場合はcJSONで処理） */
+#define JSON_MESSAGE_MAX_FIELDS 16
+
+/** @brief ルーティング表の大きさ（2の累乗） */
+#define JSON_ROUTER_SLOTS 16
+
+/**
+ * @class JsonMessage
+ * @brief トップレベルがフラットなJSONオブジェクトのビュー
+ *
+ * 値は受信バッファを指すため、Parse()に渡したバッファが有効な間のみ使えます。
+ */
+class JsonMessage {
+public:
+    /**
+     * @brief オブジェクトを走査
+     * @return 値がすべて文字列・数値・true/false/nullのオブジェクトならtrue
+     */
+    bool Parse(const char* data, size_t length);
+
+    /** @brief 文字列値をエスケープを解いて取得（キーがない・文字列でない場合は空） */
+    std::string GetString(const char* key) const;
+
+    /** @brief エスケープを含まない文字列値を比較（type/stateの判定用） */
+    bool Equals(const char* key, const char* value) const;
+
+    /** @brief 文字列値の生の範囲（エスケープは解かない） */
+    std::string_view Raw(const char* key) const;
+
+    /**
+     * @brief エスケープを含まない文字列フィールドを追加（JSONを経由しない制御メッセージ用）
+     * @note keyとvalueの指す領域はメッセージを使い終わるまで有効である必要があります
+     * @return 記録できるフィールド数を超えた場合false
+     */
+    bool AddString(std::string_view key, std::string_view value);
+
+private:
+    enum ValueType : uint8_t {
+        kValueString,
+        kValueLiteral,      /**< 数値・true・false・null */
+    };
+
+    struct Field {
+        std::string_view key;
+        std::string_view value;
+        ValueType type;
+        bool escaped;       /**< 値にバックスラッシュを含む */
+    };
+
+    Field fields_[JSON_MESSAGE_MAX_FIELDS];
+    size_t count_ = 0;
+
+    const Field* Find(const char* key) const;
+};
+
+/**
+ * @class JsonMessageRouter
+ * @brief type/stateの組からハンドラを引く固定サイズのハッシュ表
+ *
+ * 登録は起動時（受信開始前）に行い、以降は受信タスクから読み取りのみ行います。
+ */
+class JsonMessageRouter {
+public:
+    using Handler = std::function<void(const JsonMessage& message)>;
+
+    /**
+     * @brief ハンドラを登録
+     * @param type メッセージのtype（文字列リテラル）
+     * @param state stateの値。nullptrならstateによらずtypeのみで一致
+     */
+    void Add(const char* type, const char* state, Handler handler);
+
+    /** @brief 一致するハンドラを呼び出す。なければfalse（呼び出し側はcJSONで処理） */
+    bool Dispatch(const JsonMessage& message) const;
+
+private:
+    struct Route {
+        uint32_t hash = 0;
+        const char* type = nullptr;
+        const char* state = nullptr;
+        Handler handler;
+    };
+
+    Route routes_[JSON_ROUTER_SLOTS];
+
+    static uint32_t Hash(std::string_view type, std::string_view state);
+    const Route* Find(std::string_view type, std::string_view state) const;
+};
+
+#endif // JSON_MESSAGE_H
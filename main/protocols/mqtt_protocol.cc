@@ -2,6 +2,11 @@
 #include "board.h"
 #include "application.h"
 #include "settings.h"
+#include "latency_trace.h"
+#include "mcp_server.h"
+#if CONFIG_USE_METRICS
+#include "metrics.h"
+#endif
 
 #include <esp_log.h>
 #include <ml307_mqtt.h>
@@ -12,15 +17,17 @@
 
 #define TAG "MQTT"
 
+#if CONFIG_USE_METRICS
+static MetricCounter mqtt_disconnects("xiaozhi_mqtt_disconnects_total", "MQTT connections lost");
+#endif
+
 MqttProtocol::MqttProtocol() {
     event_group_handle_ = xEventGroupCreate();
 }
 
 MqttProtocol::~MqttProtocol() {
     ESP_LOGI(TAG, "MqttProtocol deinit");
-    if (udp_ != nullptr) {
-        delete udp_;
-    }
+    udp_.Close();
     if (mqtt_ != nullptr) {
         delete mqtt_;
     }
@@ -43,6 +50,7 @@ bool MqttProtocol::StartMqttClient(bool report_error) {
     auto username = settings.GetString("username");
     auto password = settings.GetString("password");
     publish_topic_ = settings.GetString("publish_topic");
+    telemetry_topic_ = settings.GetString("telemetry_topic");
 
     if (endpoint.empty()) {
         ESP_LOGW(TAG, "MQTT endpoint is not specified");
@@ -57,9 +65,26 @@ bool MqttProtocol::StartMqttClient(bool report_error) {
 
     mqtt_->OnDisconnected([this]() {
         ESP_LOGI(TAG, "Disconnected from endpoint");
+#if CONFIG_USE_METRICS
+        mqtt_disconnects.Increment();
+#endif
     });
 
     mqtt_->OnMessage([this](const std::string& topic, const std::string& payload) {
+        JsonMessage message;
+        if (message.Parse(payload.data(), payload.size())) {
+            // 発話の末尾がウィンドウに残らないよう、tts stopの前に吐き出す
+            if (message.Equals("type", "tts") && message.Equals("state", "stop")) {
+                udp_.Flush();
+            }
+            if (router_.Dispatch(message)) {
+                last_incoming_time_ = std::chrono::steady_clock::now();
+                return;
+            }
+        }
+
+        // ハンドラの処理を含めて1メッセージ分をアリーナから確保する
+        JSON_ARENA_SCOPE(incoming_json_arena_);
         cJSON* root = cJSON_Parse(payload.c_str());
         if (root == nullptr) {
             ESP_LOGE(TAG, "Failed to parse json message %s", payload.c_str());
@@ -83,6 +108,13 @@ bool MqttProtocol::StartMqttClient(bool report_error) {
                 });
             }
         } else if (on_incoming_json_ != nullptr) {
+            if (strcmp(type->valuestring, "tts") == 0) {
+                // 発話の末尾がウィンドウに残らないよう、tts stopの前に吐き出す
+                auto state = cJSON_GetObjectItem(root, "state");
+                if (cJSON_IsString(state) && strcmp(state->valuestring, "stop") == 0) {
+                    udp_.Flush();
+                }
+            }
             on_incoming_json_(root);
         }
         cJSON_Delete(root);
@@ -109,52 +141,36 @@ bool MqttProtocol::StartMqttClient(bool report_error) {
     return true;
 }
 
-bool MqttProtocol::SendText(const std::string& text) {
-    if (publish_topic_.empty()) {
+bool MqttProtocol::SendTelemetry(const std::string& payload) {
+    if (telemetry_topic_.empty() || mqtt_ == nullptr || !mqtt_->IsConnected()) {
         return false;
     }
-    if (!mqtt_->Publish(publish_topic_, text)) {
-        ESP_LOGE(TAG, "Failed to publish message: %s", text.c_str());
-        SetError(Lang::Strings::SERVER_ERROR);
+    // 失敗しても会話には影響しないため、エラー表示はしない
+    if (!mqtt_->Publish(telemetry_topic_, payload)) {
+        ESP_LOGW(TAG, "Failed to publish telemetry (%u bytes)", (unsigned)payload.size());
         return false;
     }
     return true;
 }
 
-bool MqttProtocol::SendAudio(const AudioStreamPacket& packet) {
-    std::lock_guard<std::mutex> lock(channel_mutex_);
-    if (udp_ == nullptr) {
+bool MqttProtocol::SendText(const std::string& text) {
+    if (publish_topic_.empty()) {
         return false;
     }
-
-    std::string nonce(aes_nonce_);
-    *(uint16_t*)&nonce[2] = htons(packet.payload.size());
-    *(uint32_t*)&nonce[8] = htonl(packet.timestamp);
-    *(uint32_t*)&nonce[12] = htonl(++local_sequence_);
-
-    std::string encrypted;
-    encrypted.resize(aes_nonce_.size() + packet.payload.size());
-    memcpy(encrypted.data(), nonce.data(), nonce.size());
-
-    size_t nc_off = 0;
-    uint8_t stream_block[16] = {0};
-    if (mbedtls_aes_crypt_ctr(&aes_ctx_, packet.payload.size(), &nc_off, (uint8_t*)nonce.c_str(), stream_block,
-        (uint8_t*)packet.payload.data(), (uint8_t*)&encrypted[nonce.size()]) != 0) {
-        ESP_LOGE(TAG, "Failed to encrypt audio data");
+    if (!mqtt_->Publish(publish_topic_, text)) {
+        ESP_LOGE(TAG, "Failed to publish message: %s", text.c_str());
+        SetError(Lang::Strings::SERVER_ERROR);
         return false;
     }
+    return true;
+}
 
-    return udp_->Send(encrypted) > 0;
+bool MqttProtocol::SendAudio(AudioStreamPacket& packet) {
+    return udp_.Send(packet);
 }
 
 void MqttProtocol::CloseAudioChannel() {
-    {
-        std::lock_guard<std::mutex> lock(channel_mutex_);
-        if (udp_ != nullptr) {
-            delete udp_;
-            udp_ = nullptr;
-        }
-    }
+    udp_.Close();
 
     std::string message = "{";
     message += "\"session_id\":\"" + session_id_ + "\",";
@@ -174,6 +190,7 @@ bool MqttProtocol::OpenAudioChannel() {
             return false;
         }
     }
+    LatencyTrace::GetInstance().Mark(kLatencyChannelConnected);
 
     error_occurred_ = false;
     session_id_ = "";
@@ -192,56 +209,16 @@ bool MqttProtocol::OpenAudioChannel() {
         return false;
     }
 
-    std::lock_guard<std::mutex> lock(channel_mutex_);
-    if (udp_ != nullptr) {
-        delete udp_;
-    }
-    udp_ = Board::GetInstance().CreateUdp();
-    udp_->OnMessage([this](const std::string& data) {
-        /*
-         * UDP Encrypted OPUS Packet Format:
-         * |type 1u|flags 1u|payload_len 2u|ssrc 4u|timestamp 4u|sequence 4u|
-         * |payload payload_len|
-         */
-        if (data.size() < sizeof(aes_nonce_)) {
-            ESP_LOGE(TAG, "Invalid audio packet size: %u", data.size());
-            return;
-        }
-        if (data[0] != 0x01) {
-            ESP_LOGE(TAG, "Invalid audio packet type: %x", data[0]);
-            return;
-        }
-        uint32_t timestamp = ntohl(*(uint32_t*)&data[8]);
-        uint32_t sequence = ntohl(*(uint32_t*)&data[12]);
-        if (sequence < remote_sequence_) {
-            ESP_LOGW(TAG, "Received audio packet with old sequence: %lu, expected: %lu", sequence, remote_sequence_);
-            return;
-        }
-        if (sequence != remote_sequence_ + 1) {
-            ESP_LOGW(TAG, "Received audio packet with wrong sequence: %lu, expected: %lu", sequence, remote_sequence_ + 1);
-        }
-
-        size_t decrypted_size = data.size() - aes_nonce_.size();
-        size_t nc_off = 0;
-        uint8_t stream_block[16] = {0};
-        auto nonce = (uint8_t*)data.data();
-        auto encrypted = (uint8_t*)data.data() + aes_nonce_.size();
-        AudioStreamPacket packet;
-        packet.timestamp = timestamp;
-        packet.payload.resize(decrypted_size);
-        int ret = mbedtls_aes_crypt_ctr(&aes_ctx_, decrypted_size, &nc_off, nonce, stream_block, encrypted, (uint8_t*)packet.payload.data());
-        if (ret != 0) {
-            ESP_LOGE(TAG, "Failed to decrypt audio data, ret: %d", ret);
-            return;
-        }
+    bool opened = udp_.Open(server_frame_duration_, [this](const AudioStreamView& view) {
         if (on_incoming_audio_ != nullptr) {
-            on_incoming_audio_(std::move(packet));
+            on_incoming_audio_(view);
         }
-        remote_sequence_ = sequence;
         last_incoming_time_ = std::chrono::steady_clock::now();
     });
-
-    udp_->Connect(udp_server_, udp_port_);
+    if (!opened) {
+        SetError(Lang::Strings::SERVER_NOT_CONNECTED);
+        return false;
+    }
 
     if (on_audio_channel_opened_ != nullptr) {
         on_audio_channel_opened_();
@@ -251,6 +228,7 @@ bool MqttProtocol::OpenAudioChannel() {
 
 std::string MqttProtocol::GetHelloMessage() {
     // 发送 hello 消息申请 UDP 通道
+    JSON_ARENA_SCOPE(outgoing_json_arena_);
     cJSON* root = cJSON_CreateObject();
     cJSON_AddStringToObject(root, "type", "hello");
     cJSON_AddNumberToObject(root, "version", 3);
@@ -261,14 +239,16 @@ std::string MqttProtocol::GetHelloMessage() {
 #endif
 #if CONFIG_IOT_PROTOCOL_MCP
     cJSON_AddBoolToObject(features, "mcp", true);
+#endif
+#if CONFIG_USE_TTS_CACHE
+    cJSON_AddBoolToObject(features, "tts_cache", true);
 #endif
     cJSON_AddItemToObject(root, "features", features);
-    cJSON* audio_params = cJSON_CreateObject();
-    cJSON_AddStringToObject(audio_params, "format", "opus");
-    cJSON_AddNumberToObject(audio_params, "sample_rate", 16000);
-    cJSON_AddNumberToObject(audio_params, "channels", 1);
-    cJSON_AddNumberToObject(audio_params, "frame_duration", OPUS_FRAME_DURATION_MS);
-    cJSON_AddItemToObject(root, "audio_params", audio_params);
+#if CONFIG_IOT_PROTOCOL_MCP
+    // 同じツール一覧をキャッシュしているサーバーはtools/listを省略できる
+    cJSON_AddStringToObject(root, "mcp_tools_hash", McpServer::GetInstance().tools_hash().c_str());
+#endif
+    cJSON_AddItemToObject(root, "audio_params", CreateHelloAudioParams());
     auto json_str = cJSON_PrintUnformatted(root);
     std::string message(json_str);
     cJSON_free(json_str);
@@ -301,46 +281,23 @@ void MqttProtocol::ParseServerHello(const cJSON* root) {
             server_frame_duration_ = frame_duration->valueint;
         }
     }
+    ParseUplinkFrameDuration(audio_params);
+
+    auto features = cJSON_GetObjectItem(root, "features");
+    tts_cache_enabled_ = cJSON_IsObject(features) && cJSON_IsTrue(cJSON_GetObjectItem(features, "tts_cache"));
 
     auto udp = cJSON_GetObjectItem(root, "udp");
     if (!cJSON_IsObject(udp)) {
         ESP_LOGE(TAG, "UDP is not specified");
         return;
     }
-    udp_server_ = cJSON_GetObjectItem(udp, "server")->valuestring;
-    udp_port_ = cJSON_GetObjectItem(udp, "port")->valueint;
-    auto key = cJSON_GetObjectItem(udp, "key")->valuestring;
-    auto nonce = cJSON_GetObjectItem(udp, "nonce")->valuestring;
-
-    // auto encryption = cJSON_GetObjectItem(udp, "encryption")->valuestring;
-    // ESP_LOGI(TAG, "UDP server: %s, port: %d, encryption: %s", udp_server_.c_str(), udp_port_, encryption);
-    aes_nonce_ = DecodeHexString(nonce);
-    mbedtls_aes_init(&aes_ctx_);
-    mbedtls_aes_setkey_enc(&aes_ctx_, (const unsigned char*)DecodeHexString(key).c_str(), 128);
-    local_sequence_ = 0;
-    remote_sequence_ = 0;
-    xEventGroupSetBits(event_group_handle_, MQTT_PROTOCOL_SERVER_HELLO_EVENT);
-}
-
-static const char hex_chars[] = "0123456789ABCDEF";
-// 辅助函数，将单个十六进制字符转换为对应的数值
-static inline uint8_t CharToHex(char c) {
-    if (c >= '0' && c <= '9') return c - '0';
-    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
-    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
-    return 0;  // 对于无效输入，返回0
-}
-
-std::string MqttProtocol::DecodeHexString(const std::string& hex_string) {
-    std::string decoded;
-    decoded.reserve(hex_string.size() / 2);
-    for (size_t i = 0; i < hex_string.size(); i += 2) {
-        char byte = (CharToHex(hex_string[i]) << 4) | CharToHex(hex_string[i + 1]);
-        decoded.push_back(byte);
+    if (!udp_.Configure(udp)) {
+        return;
     }
-    return decoded;
+    LatencyTrace::GetInstance().Mark(kLatencyServerHello);
+    xEventGroupSetBits(event_group_handle_, MQTT_PROTOCOL_SERVER_HELLO_EVENT);
 }
 
 bool MqttProtocol::IsAudioChannelOpened() const {
-    return udp_ != nullptr && !error_occurred_ && !IsTimeout();
+    return udp_.IsOpened() && !error_occurred_ && !IsTimeout();
 }
@@ -11,10 +11,9 @@
 
 
 #include "protocol.h"
+#include "udp_audio_channel.h"
 #include <mqtt.h>
-#include <udp.h>
 #include <cJSON.h>
-#include <mbedtls/aes.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/event_groups.h>
 
@@ -22,6 +21,7 @@
 #include <string>
 #include <map>
 #include <mutex>
+#include <vector>
 
 // MQTT通信パラメータ
 #define MQTT_PING_INTERVAL_SECONDS 90       /**< MQTTキープアライブ間隔（秒） */
@@ -47,7 +47,7 @@ public:
     bool Start() override;
     
     /** 音声データパケットをUDPで送信 */
-    bool SendAudio(const AudioStreamPacket& packet) override;
+    bool SendAudio(AudioStreamPacket& packet) override;
     
     /** 音声チャンネルをオープン */
     bool OpenAudioChannel() override;
@@ -58,29 +58,21 @@ public:
     /** 音声チャンネルがオープンされているかどうかを確認 */
     bool IsAudioChannelOpened() const override;
 
+    /** テレメトリをテレメトリ用トピックへパブリッシュ */
+    bool SendTelemetry(const std::string& payload) override;
+    bool IsAudioOverUdp() const override { return true; }
+
 private:
     // FreeRTOSイベント管理
     EventGroupHandle_t event_group_handle_;         /**< プロトコルイベント管理用 */
 
     // MQTT設定
     std::string publish_topic_;                     /**< MQTTパブリッシュトピック */
+    std::string telemetry_topic_;                   /**< テレメトリのトピック（空なら送らない） */
 
-    // スレッド安全性とネットワーク接続
-    std::mutex channel_mutex_;                      /**< チャンネルアクセス用ミューテックス */
+    // ネットワーク接続
     Mqtt* mqtt_ = nullptr;                          /**< MQTTクライアントインスタンス */
-    Udp* udp_ = nullptr;                            /**< UDPクライアントインスタンス */
-    
-    // AES暗号化関連
-    mbedtls_aes_context aes_ctx_;                   /**< AES暗号化コンテキスト */
-    std::string aes_nonce_;                         /**< AES暗号化nonce値 */
-    
-    // UDP接続情報
-    std::string udp_server_;                        /**< UDPサーバーアドレス */
-    int udp_port_;                                  /**< UDPサーバーポート番号 */
-    
-    // パケットシーケンス管理
-    uint32_t local_sequence_;                       /**< ローカルシーケンス番号 */
-    uint32_t remote_sequence_;                      /**< リモートシーケンス番号 */
+    UdpAudioChannel udp_;                           /**< 暗号化UDP音声チャンネル */
 
     /** MQTTクライアントを開始 */
     bool StartMqttClient(bool report_error=false);
@@ -88,9 +80,6 @@ private:
     /** サーバーからのHelloメッセージを解析 */
     void ParseServerHello(const cJSON* root);
     
-    /** 16進数文字列をバイナリデータに変換 */
-    std::string DecodeHexString(const std::string& hex_string);
-
     /** テキストメッセージをMQTTで送信 */
     bool SendText(const std::string& text) override;
     
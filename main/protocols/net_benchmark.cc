@@ -0,0 +1,259 @@
+/**
+ * @file net_benchmark.cc
+ * @brief スループットと往復遅延の計測の実装
+ */
+#include "net_benchmark.h"
+
+#include <esp_app_desc.h>
+#include <esp_idf_version.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/task.h>
+#include <arpa/inet.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#define TAG "NetBenchmark"
+
+#define NET_BENCH_READY_EVENT (1 << 0)
+#define NET_BENCH_UPLINK_REPORT_EVENT (1 << 1)
+
+NetBenchmark::NetBenchmark() {
+    events_ = xEventGroupCreate();
+}
+
+NetBenchmark::~NetBenchmark() {
+    vEventGroupDelete(events_);
+}
+
+const char* NetBenchmark::PhaseName(Phase phase) {
+    switch (phase) {
+        case kPhaseEcho: return "echo";
+        case kPhaseUplink: return "uplink";
+        default: return "downlink";
+    }
+}
+
+bool NetBenchmark::StartPhase(Protocol* protocol, Phase phase, int duration_ms, int packet_bytes) {
+    xEventGroupClearBits(events_, NET_BENCH_READY_EVENT | NET_BENCH_UPLINK_REPORT_EVENT);
+    phase_.store(phase);
+    protocol->SendNetBench("start", PhaseName(phase), duration_ms, packet_bytes);
+    auto bits = xEventGroupWaitBits(events_, NET_BENCH_READY_EVENT, pdTRUE, pdFALSE,
+        pdMS_TO_TICKS(NET_BENCH_READY_TIMEOUT_MS));
+    if (!(bits & NET_BENCH_READY_EVENT)) {
+        ESP_LOGW(TAG, "Server did not acknowledge the %s phase", PhaseName(phase));
+        return false;
+    }
+    return true;
+}
+
+void NetBenchmark::StopPhase(Protocol* protocol, Phase phase) {
+    protocol->SendNetBench("stop", PhaseName(phase), 0, 0);
+}
+
+bool NetBenchmark::SendPacket(Protocol* protocol, Phase phase, uint32_t sequence, size_t size) {
+    uint8_t buffer[NET_BENCH_BULK_PACKET_BYTES] = {};
+    size = std::clamp(size, sizeof(Header), sizeof(buffer));
+    auto header = (Header*)buffer;
+    header->magic = htons(NET_BENCH_MAGIC);
+    header->phase = phase;
+    header->sequence = htonl(sequence);
+    header->send_time_us = htonl((uint32_t)esp_timer_get_time());
+
+    AudioStreamPacket packet;
+    packet.timestamp = sequence;
+    packet.payload.assign(buffer, size);
+    bool sent = protocol->SendAudio(packet);
+    packet.payload.Release();
+    return sent;
+}
+
+NetBenchmarkResult NetBenchmark::Run(Protocol* protocol) {
+    NetBenchmarkResult result;
+    result.udp = protocol->IsAudioOverUdp();
+    // エコーは上りの実際のフレーム間隔と、16kbpsのOpus相当の大きさで送る
+    int frame_ms = std::max(protocol->uplink_frame_duration(), 10);
+    size_t echo_bytes = std::max<size_t>(frame_ms * 2, sizeof(Header));
+    uint32_t echo_count = CONFIG_NET_BENCH_ECHO_SECONDS * 1000 / frame_ms;
+
+    rtts_us_.assign(echo_count, 0);
+    rtt_count_.store(0);
+    jitter_us_ = 0;
+    has_transit_ = false;
+    downlink_bytes_.store(0);
+    downlink_first_us_ = 0;
+    downlink_last_us_.store(0);
+    uplink_received_bytes_.store(0);
+    running_.store(true);
+
+    // echo: 往復遅延、ジッタ、損失
+    if (!StartPhase(protocol, kPhaseEcho, CONFIG_NET_BENCH_ECHO_SECONDS * 1000, echo_bytes)) {
+        running_.store(false);
+        return result;
+    }
+    result.supported = true;
+    TickType_t wake = xTaskGetTickCount();
+    for (uint32_t i = 0; i < echo_count; i++) {
+        if (SendPacket(protocol, kPhaseEcho, i, echo_bytes)) {
+            result.echo_sent++;
+        }
+        xTaskDelayUntil(&wake, pdMS_TO_TICKS(frame_ms));
+    }
+    vTaskDelay(pdMS_TO_TICKS(NET_BENCH_DRAIN_MS));
+    StopPhase(protocol, kPhaseEcho);
+
+    size_t count = std::min<size_t>(rtt_count_.load(std::memory_order_acquire), rtts_us_.size());
+    result.echo_received = count;
+    if (result.echo_sent > 0) {
+        result.loss_percent = 100.0f * (result.echo_sent - std::min<uint32_t>(count, result.echo_sent)) / result.echo_sent;
+    }
+    if (count > 0) {
+        std::sort(rtts_us_.begin(), rtts_us_.begin() + count);
+        auto percentile = [&](int p) { return rtts_us_[std::min(count - 1, count * p / 100)] / 1000.0f; };
+        result.rtt_p50_ms = percentile(50);
+        result.rtt_p90_ms = percentile(90);
+        result.rtt_p99_ms = percentile(99);
+        result.jitter_ms = jitter_us_ / 1000.0f;
+    }
+
+    // uplink: 送信できる限り速く送り、サーバーが数えた受信量で評価する
+    if (StartPhase(protocol, kPhaseUplink, CONFIG_NET_BENCH_BULK_SECONDS * 1000, NET_BENCH_BULK_PACKET_BYTES)) {
+        uint64_t sent_bytes = 0;
+        uint32_t sequence = 0;
+        int64_t start = esp_timer_get_time();
+        int64_t end = start + CONFIG_NET_BENCH_BULK_SECONDS * 1000000LL;
+        while (esp_timer_get_time() < end) {
+            if (SendPacket(protocol, kPhaseUplink, sequence++, NET_BENCH_BULK_PACKET_BYTES)) {
+                sent_bytes += NET_BENCH_BULK_PACKET_BYTES;
+            } else {
+                // UDPの送信バッファが埋まった場合など。少し待って再送する
+                vTaskDelay(1);
+            }
+        }
+        float seconds = (esp_timer_get_time() - start) / 1000000.0f;
+        StopPhase(protocol, kPhaseUplink);
+        auto bits = xEventGroupWaitBits(events_, NET_BENCH_UPLINK_REPORT_EVENT, pdTRUE, pdFALSE,
+            pdMS_TO_TICKS(NET_BENCH_DRAIN_MS));
+        result.uplink_confirmed = (bits & NET_BENCH_UPLINK_REPORT_EVENT) != 0;
+        uint64_t bytes = result.uplink_confirmed ? uplink_received_bytes_.load() : sent_bytes;
+        result.uplink_kbps = bytes * 8 / 1000.0f / seconds;
+    }
+
+    // downlink: サーバーが送る一括データの受信量を、最初と最後の到着の間で割る
+    if (StartPhase(protocol, kPhaseDownlink, CONFIG_NET_BENCH_BULK_SECONDS * 1000, NET_BENCH_BULK_PACKET_BYTES)) {
+        vTaskDelay(pdMS_TO_TICKS(CONFIG_NET_BENCH_BULK_SECONDS * 1000 + NET_BENCH_DRAIN_MS));
+        StopPhase(protocol, kPhaseDownlink);
+        int64_t elapsed = downlink_last_us_.load() - downlink_first_us_;
+        if (elapsed > 0) {
+            result.downlink_kbps = downlink_bytes_.load() * 8 * 1000.0f / elapsed;
+        }
+    }
+
+    running_.store(false);
+    ESP_LOGI(TAG, "RTT p50/p90/p99 %.0f/%.0f/%.0f ms, jitter %.1f ms, loss %.1f%%, up %.0f kbps, down %.0f kbps",
+        result.rtt_p50_ms, result.rtt_p90_ms, result.rtt_p99_ms, result.jitter_ms, result.loss_percent,
+        result.uplink_kbps, result.downlink_kbps);
+    return result;
+}
+
+void NetBenchmark::OnIncomingAudio(const AudioStreamView& view) {
+    if (view.payload_size < sizeof(Header)) {
+        return;
+    }
+    Header header;
+    memcpy(&header, view.payload, sizeof(header));
+    if (ntohs(header.magic) != NET_BENCH_MAGIC) {
+        return;
+    }
+    int64_t now = esp_timer_get_time();
+    if (header.phase == kPhaseEcho && phase_.load() == kPhaseEcho) {
+        uint32_t rtt = (uint32_t)now - ntohl(header.send_time_us);
+        size_t index = rtt_count_.load(std::memory_order_relaxed);
+        if (index < rtts_us_.size()) {
+            rtts_us_[index] = rtt;
+            rtt_count_.store(index + 1, std::memory_order_release);
+        }
+        // 往復のため、送信と受信の時刻は同じ時計（RFC 3550の相対遅延の差）
+        int64_t transit = rtt;
+        if (has_transit_) {
+            jitter_us_ += (std::abs(transit - last_transit_us_) - jitter_us_) / 16.0f;
+        }
+        last_transit_us_ = transit;
+        has_transit_ = true;
+    } else if (header.phase == kPhaseDownlink && phase_.load() == kPhaseDownlink) {
+        // 最初のパケットは計測の開始点なので数えない
+        if (downlink_first_us_ == 0) {
+            downlink_first_us_ = now;
+            return;
+        }
+        downlink_bytes_.fetch_add(view.payload_size, std::memory_order_relaxed);
+        downlink_last_us_.store(now);
+    }
+}
+
+void NetBenchmark::OnControl(const JsonMessage& message) {
+    if (message.Equals("state", "ready")) {
+        xEventGroupSetBits(events_, NET_BENCH_READY_EVENT);
+    } else if (message.Equals("state", "stop") && message.Equals("phase", "uplink")) {
+        auto received = message.Raw("received_bytes");
+        if (!received.empty()) {
+            uplink_received_bytes_.store(strtoul(std::string(received).c_str(), nullptr, 10));
+            xEventGroupSetBits(events_, NET_BENCH_UPLINK_REPORT_EVENT);
+        }
+    }
+}
+
+std::string NetBenchmark::ToJson(const NetBenchmarkResult& result) {
+    if (!result.supported) {
+        return "{\"success\":false,\"message\":\"The server does not support the network benchmark\"}";
+    }
+    char json[512];
+    snprintf(json, sizeof(json),
+        "{\"success\":true,\"transport\":\"%s\",\"echo_sent\":%lu,\"echo_received\":%lu,\"loss_percent\":%.1f,"
+        "\"rtt_ms\":{\"p50\":%.1f,\"p90\":%.1f,\"p99\":%.1f},\"jitter_ms\":%.1f,"
+        "\"uplink_kbps\":%.0f,\"uplink_confirmed_by_server\":%s,\"downlink_kbps\":%.0f}",
+        result.udp ? "udp" : "tcp", (unsigned long)result.echo_sent, (unsigned long)result.echo_received,
+        result.loss_percent, result.rtt_p50_ms, result.rtt_p90_ms, result.rtt_p99_ms, result.jitter_ms,
+        result.uplink_kbps, result.uplink_confirmed ? "true" : "false", result.downlink_kbps);
+    return json;
+}
+
+std::string NetBenchmark::ToSummary(const NetBenchmarkResult& result) {
+    if (!result.supported) {
+        return "Network benchmark not supported";
+    }
+    char text[96];
+    snprintf(text, sizeof(text), "RTT %.0fms/%.0fms loss %.0f%% up %.0f down %.0fkbps",
+        result.rtt_p50_ms, result.rtt_p99_ms, result.loss_percent, result.uplink_kbps, result.downlink_kbps);
+    return text;
+}
+
+void NetBenchmark::PrintBenchLines(const NetBenchmarkResult& result) {
+    if (!result.supported) {
+        return;
+    }
+#if CONFIG_NETWORK_PROFILE_REALTIME_VOICE
+    const char* profile = "realtime_voice";
+#else
+    const char* profile = "default";
+#endif
+#if CONFIG_USE_AUDIO_DSCP
+    int dscp = CONFIG_AUDIO_DSCP;
+#else
+    int dscp = 0;
+#endif
+    auto app_desc = esp_app_get_description();
+    const char* transport = result.udp ? "udp" : "tcp";
+    printf("BENCH {\"case\":\"meta\",\"version\":\"%s\",\"idf\":\"%s\",\"cpu_mhz\":%d,"
+        "\"network_profile\":\"%s\",\"dscp\":%d}\n",
+        app_desc->version, esp_get_idf_version(), CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ, profile, dscp);
+    printf("BENCH {\"case\":\"net_echo\",\"params\":{\"transport\":\"%s\"},\"rtt_p50_us\":%lu,"
+        "\"rtt_p99_us\":%lu,\"jitter_us\":%lu,\"loss_permille\":%lu}\n",
+        transport, (unsigned long)(result.rtt_p50_ms * 1000), (unsigned long)(result.rtt_p99_ms * 1000),
+        (unsigned long)(result.jitter_ms * 1000), (unsigned long)(result.loss_percent * 10));
+    printf("BENCH {\"case\":\"done\"}\n");
+}
@@ -0,0 +1,145 @@
+/**
+ * @file net_benchmark.h
+ * @brief 設定済みのサーバーに対するスループットと往復遅延の計測
+ *
+ * 設置先のWi-Fiでリアルタイム会話が成り立つかを事前に確かめるための診断モードです。
+ * 計測用のパケットは通常の音声と同じSendAudio()で送るため、BinaryProtocol2/3のヘッダや
+ * MQTTのUDP（AES-CTR）の暗号化を含めた本番と同じ形式になります。
+ *
+ * サーバーとの取り決め（JSON、typeは "net_bench"）:
+ *   デバイス→サーバー {"type":"net_bench","state":"start","phase":<phase>,"duration_ms":<n>,"packet_bytes":<n>}
+ *   サーバー→デバイス {"type":"net_bench","state":"ready","phase":<phase>}
+ *   デバイス→サーバー {"type":"net_bench","state":"stop","phase":<phase>}
+ *   サーバー→デバイス {"type":"net_bench","state":"stop","phase":"uplink","received_bytes":<n>}（任意）
+ * phaseごとのサーバーの動作:
+ *   echo     受け取った音声パケットのペイロードをそのまま送り返す
+ *   uplink   受け取った音声パケットのバイト数を数え、stopで返す
+ *   downlink duration_msの間、packet_bytesのペイロードをできるだけ速く送る（先頭は計測用ヘッダ）
+ * readyが返らないサーバーは未対応とみなします。
+ */
+#ifndef NET_BENCHMARK_H
+#define NET_BENCHMARK_H
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/event_groups.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "protocol.h"
+#include "json_message.h"
+
+/** @brief 計測用ペイロードの先頭を示す値（"NB"） */
+#define NET_BENCH_MAGIC 0x4e42
+
+/** @brief 各フェーズの開始をサーバーが確認するまでの待ち時間（ミリ秒） */
+#define NET_BENCH_READY_TIMEOUT_MS 2000
+
+/** @brief 送信を終えてから遅れて届く応答を待つ時間（ミリ秒） */
+#define NET_BENCH_DRAIN_MS 1000
+
+/** @brief 一括送受信のペイロードの大きさ（バイト） */
+#define NET_BENCH_BULK_PACKET_BYTES 1000
+
+/**
+ * @struct NetBenchmarkResult
+ * @brief 計測結果
+ */
+struct NetBenchmarkResult {
+    bool supported = false;         // サーバーが計測に応答した
+    bool udp = false;               // 音声がUDPで送受信されている（損失はUDPでのみ意味を持つ）
+    uint32_t echo_sent = 0;
+    uint32_t echo_received = 0;
+    float loss_percent = 0;
+    float rtt_p50_ms = 0;
+    float rtt_p90_ms = 0;
+    float rtt_p99_ms = 0;
+    float jitter_ms = 0;            // RFC 3550の到着間隔ジッタ
+    float uplink_kbps = 0;
+    bool uplink_confirmed = false;  // サーバーが受信バイト数を返した（falseなら送信できた量）
+    float downlink_kbps = 0;
+};
+
+/**
+ * @class NetBenchmark
+ * @brief 計測の実行と受信パケットの集計
+ *
+ * Run()は計測を行うタスクから、OnIncomingAudio()とOnControl()は受信タスクから呼びます。
+ * 実行中は呼び出し側が通常の音声の送受信を止めます（running()で判定）。
+ */
+class NetBenchmark {
+public:
+    NetBenchmark();
+    ~NetBenchmark();
+    NetBenchmark(const NetBenchmark&) = delete;
+    NetBenchmark& operator=(const NetBenchmark&) = delete;
+
+    bool running() const { return running_.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief echo、uplink、downlinkの順に計測（合計で十数秒ブロックする）
+     * @param protocol 音声チャンネルが開いているプロトコル
+     */
+    NetBenchmarkResult Run(Protocol* protocol);
+
+    /** @brief 受信した音声パケット（計測用ヘッダのないものは捨てる） */
+    void OnIncomingAudio(const AudioStreamView& view);
+
+    /** @brief サーバーからの "net_bench" メッセージ */
+    void OnControl(const JsonMessage& message);
+
+    /** @brief 結果をJSON文字列に変換 */
+    static std::string ToJson(const NetBenchmarkResult& result);
+
+    /** @brief 画面の通知用の短い要約 */
+    static std::string ToSummary(const NetBenchmarkResult& result);
+
+    /**
+     * @brief 結果を "BENCH {json}" 行としてログに出力
+     *
+     * 先頭の "meta" 行にネットワークプロファイルを含めるため、プロファイルを変えた
+     * 2つのビルドの結果を scripts/bench_compare.py で比較できます（A/B比較）。
+     */
+    static void PrintBenchLines(const NetBenchmarkResult& result);
+
+private:
+    enum Phase : uint8_t {
+        kPhaseEcho,
+        kPhaseUplink,
+        kPhaseDownlink,
+    };
+
+    /** @brief ペイロードの先頭に置く計測用ヘッダ（ネットワークバイトオーダー） */
+    struct Header {
+        uint16_t magic;
+        uint8_t phase;
+        uint8_t reserved;
+        uint32_t sequence;
+        uint32_t send_time_us;      /**< esp_timer_get_time()の下位32ビット */
+    } __attribute__((packed));
+
+    std::atomic<bool> running_{false};
+    std::atomic<uint8_t> phase_{kPhaseEcho};
+    EventGroupHandle_t events_ = nullptr;
+    std::atomic<uint32_t> uplink_received_bytes_{0};
+
+    // 受信タスクが更新する集計
+    std::vector<uint32_t> rtts_us_;     /**< エコーの往復時間（Run()で容量を確保し、受信側は追加のみ） */
+    std::atomic<size_t> rtt_count_{0};
+    float jitter_us_ = 0;
+    int64_t last_transit_us_ = 0;
+    bool has_transit_ = false;
+    std::atomic<uint32_t> downlink_bytes_{0};
+    int64_t downlink_first_us_ = 0;
+    std::atomic<int64_t> downlink_last_us_{0};
+
+    bool StartPhase(Protocol* protocol, Phase phase, int duration_ms, int packet_bytes);
+    void StopPhase(Protocol* protocol, Phase phase);
+    bool SendPacket(Protocol* protocol, Phase phase, uint32_t sequence, size_t size);
+    static const char* PhaseName(Phase phase);
+};
+
+#endif // NET_BENCHMARK_H
@@ -8,7 +8,46 @@ void Protocol::OnIncomingJson(std::function<void(const cJSON* root)> callback) {
     on_incoming_json_ = callback;
 }
 
-void Protocol::OnIncomingAudio(std::function<void(AudioStreamPacket&& packet)> callback) {
+void Protocol::OnIncomingMessage(const char* type, const char* state, JsonMessageRouter::Handler handler) {
+    router_.Add(type, state, handler);
+}
+
+bool Protocol::DispatchFastPath(const char* data, size_t length) {
+    JsonMessage message;
+    if (!message.Parse(data, length)) {
+        return false;
+    }
+    return router_.Dispatch(message);
+}
+
+bool Protocol::DispatchControl(const uint8_t* payload, size_t size) {
+    if (size < 2) {
+        return false;
+    }
+    std::string_view text((const char*)payload + 2, size - 2);
+    JsonMessage message;
+    switch (payload[0]) {
+    case kControlTtsStart:
+        message.AddString("type", "tts");
+        message.AddString("state", "start");
+        break;
+    case kControlTtsStop:
+        message.AddString("type", "tts");
+        message.AddString("state", "stop");
+        break;
+    case kControlTtsSentenceStart:
+        message.AddString("type", "tts");
+        message.AddString("state", "sentence_start");
+        message.AddString("text", text);
+        break;
+    default:
+        ESP_LOGW(TAG, "Unknown control event: 0x%02x", payload[0]);
+        return false;
+    }
+    return router_.Dispatch(message);
+}
+
+void Protocol::OnIncomingAudio(std::function<void(const AudioStreamView& view)> callback) {
     on_incoming_audio_ = callback;
 }
 
@@ -32,6 +71,9 @@ void Protocol::SetError(const std::string& message) {
 }
 
 void Protocol::SendAbortSpeaking(AbortReason reason) {
+    if (SendControl(kControlAbort, reason)) {
+        return;
+    }
     std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"abort\"";
     if (reason == kAbortReasonWakeWordDetected) {
         message += ",\"reason\":\"wake_word_detected\"";
@@ -41,12 +83,18 @@ void Protocol::SendAbortSpeaking(AbortReason reason) {
 }
 
 void Protocol::SendWakeWordDetected(const std::string& wake_word) {
+    if (SendControl(kControlListenDetect, 0, wake_word)) {
+        return;
+    }
     std::string json = "{\"session_id\":\"" + session_id_ + 
                       "\",\"type\":\"listen\",\"state\":\"detect\",\"text\":\"" + wake_word + "\"}";
     SendText(json);
 }
 
 void Protocol::SendStartListening(ListeningMode mode) {
+    if (SendControl(kControlListenStart, mode)) {
+        return;
+    }
     std::string message = "{\"session_id\":\"" + session_id_ + "\"";
     message += ",\"type\":\"listen\",\"state\":\"start\"";
     if (mode == kListeningModeRealtime) {
@@ -61,11 +109,30 @@ void Protocol::SendStartListening(ListeningMode mode) {
 }
 
 void Protocol::SendStopListening() {
+    if (SendControl(kControlListenStop, 0)) {
+        return;
+    }
     std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"listen\",\"state\":\"stop\"}";
     SendText(message);
 }
 
+void Protocol::SendTtsCached(const std::string& key) {
+    std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"tts\",\"state\":\"cached\",\"key\":\"" + key + "\"}";
+    SendText(message);
+}
+
+void Protocol::SendNetBench(const char* state, const char* phase, int duration_ms, int packet_bytes) {
+    std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"net_bench\",\"state\":\"" + state +
+        "\",\"phase\":\"" + phase + "\"";
+    if (duration_ms > 0) {
+        message += ",\"duration_ms\":" + std::to_string(duration_ms) + ",\"packet_bytes\":" + std::to_string(packet_bytes);
+    }
+    message += "}";
+    SendText(message);
+}
+
 void Protocol::SendIotDescriptors(const std::string& descriptors) {
+    JSON_ARENA_SCOPE(outgoing_json_arena_);
     cJSON* root = cJSON_Parse(descriptors.c_str());
     if (root == nullptr) {
         ESP_LOGE(TAG, "Failed to parse IoT descriptors: %s", descriptors.c_str());
@@ -115,11 +182,72 @@ void Protocol::SendIotStates(const std::string& states) {
     SendText(message);
 }
 
+bool Protocol::SendAudioBatch(AudioStreamPacket* packets, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        if (!SendAudio(packets[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
 void Protocol::SendMcpMessage(const std::string& payload) {
     std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"mcp\",\"payload\":" + payload + "}";
     SendText(message);
 }
 
+cJSON* Protocol::CreateHelloAudioParams() const {
+    cJSON* audio_params = cJSON_CreateObject();
+    cJSON_AddStringToObject(audio_params, "format", "opus");
+    cJSON_AddNumberToObject(audio_params, "sample_rate", 16000);
+    cJSON_AddNumberToObject(audio_params, "channels", 1);
+    cJSON_AddNumberToObject(audio_params, "frame_duration", CONFIG_UPLINK_FRAME_DURATION_MS);
+
+    // Opusがデコードできるレートのうち、コーデックの出力レートを最優先にする
+    static const int kDownlinkRates[] = {24000, 16000, 48000};
+    cJSON* rates = cJSON_CreateArray();
+    int preferred = preferred_output_sample_rate_;
+    bool opus_rate = preferred == 8000 || preferred == 12000 || preferred == 16000 ||
+        preferred == 24000 || preferred == 48000;
+    if (opus_rate) {
+        cJSON_AddItemToArray(rates, cJSON_CreateNumber(preferred));
+    }
+    for (int rate : kDownlinkRates) {
+        if (rate != preferred) {
+            cJSON_AddItemToArray(rates, cJSON_CreateNumber(rate));
+        }
+    }
+    cJSON_AddItemToObject(audio_params, "downlink_sample_rates", rates);
+
+    static const int kDownlinkFrameDurations[] = {20, 40, 60};
+    cJSON* durations = cJSON_CreateArray();
+    for (int duration : kDownlinkFrameDurations) {
+        cJSON_AddItemToArray(durations, cJSON_CreateNumber(duration));
+    }
+    cJSON_AddItemToObject(audio_params, "downlink_frame_durations", durations);
+    return audio_params;
+}
+
+void Protocol::ParseUplinkFrameDuration(const cJSON* audio_params) {
+    uplink_frame_duration_ = CONFIG_UPLINK_FRAME_DURATION_MS;
+    auto duration = cJSON_GetObjectItem(audio_params, "uplink_frame_duration");
+    if (!cJSON_IsNumber(duration)) {
+        return;
+    }
+    if (duration->valueint == 20 || duration->valueint == 40 || duration->valueint == 60) {
+        uplink_frame_duration_ = duration->valueint;
+    } else {
+        ESP_LOGW(TAG, "Unsupported uplink frame duration: %d", duration->valueint);
+    }
+}
+
+void Protocol::UpdateRtt(int sample_ms) {
+    int rtt = rtt_ms_;
+    rtt = rtt < 0 ? sample_ms : (rtt * 7 + sample_ms) / 8;
+    rtt_ms_ = rtt;
+    ESP_LOGD(TAG, "RTT sample %d ms, smoothed %d ms", sample_ms, rtt);
+}
+
 bool Protocol::IsTimeout() const {
     const int kTimeoutSeconds = 120;
     auto now = std::chrono::steady_clock::now();
@@ -10,17 +10,35 @@
 
 #include <cJSON.h>
 #include <string>
+#include <string_view>
 #include <functional>
 #include <chrono>
+#include <atomic>
 #include <vector>
 
+#include "opus_packet_pool.h"
+#include "json_message.h"
+#include "json_arena.h"
+
 /**
  * @struct AudioStreamPacket
- * @brief 音声ストリームパケット構造体
+ * @brief 音声ストリームパケット構造体（ムーブ専用）
  */
 struct AudioStreamPacket {
     uint32_t timestamp = 0;        // タイムスタンプ（ミリ秒）
-    std::vector<uint8_t> payload;  // 音声データ（Opusエンコード済み）
+    OpusPacketBuffer payload;      // 音声データ（Opusエンコード済み、プールから確保）
+};
+
+/**
+ * @struct AudioStreamView
+ * @brief 受信バッファ内の音声データを指すビュー
+ *
+ * 受信コールバックの実行中のみ有効です。保持する場合はコピーしてください。
+ */
+struct AudioStreamView {
+    uint32_t timestamp = 0;            // タイムスタンプ（ミリ秒）
+    const uint8_t* payload = nullptr;  // 音声データ（Opusエンコード済み）
+    size_t payload_size = 0;           // 音声データサイズ
 };
 
 /**
@@ -47,6 +65,43 @@ struct BinaryProtocol3 {
     uint8_t payload[];      // ペイロードデータ
 } __attribute__((packed));
 
+/** @brief 1メッセージにまとめる音声フレームの最大数 */
+#define AUDIO_BATCH_MAX_FRAMES 8
+
+/** @brief BinaryProtocol3のメッセージタイプ：複数Opusフレームの一括送信 */
+#define BINARY_PROTOCOL3_TYPE_OPUS_BATCH 2
+
+/*
+ * 一括送信メッセージのペイロード（BinaryProtocol3、type = BINARY_PROTOCOL3_TYPE_OPUS_BATCH）
+ *   uint8_t  frame_count;                 // フレーム数（1～AUDIO_BATCH_MAX_FRAMES）
+ *   uint16_t frame_sizes[frame_count];    // 各フレームのサイズ（ビッグエンディアン）
+ *   uint8_t  frames[];                    // Opusフレームを順に連結
+ * サーバーがhelloの features.audio_batch で対応を示した場合のみ使用します。
+ */
+
+/** @brief BinaryProtocol3のメッセージタイプ：バイナリ制御メッセージ */
+#define BINARY_PROTOCOL3_TYPE_CONTROL 3
+
+/*
+ * 制御メッセージのペイロード（BinaryProtocol3、type = BINARY_PROTOCOL3_TYPE_CONTROL）
+ *   uint8_t  event;     // BinaryControlEvent
+ *   uint8_t  arg;       // イベントごとの引数（ListeningMode、AbortReasonなど）
+ *   uint8_t  text[];    // 任意のUTF-8文字列（ウェイクワード、読み上げ文など。終端なし）
+ * 会話の開始・中断など遅延に効くイベントだけをJSONの代わりに送受信します。
+ * セッションは接続に紐づくためsession_idは含めません。
+ * サーバーがhelloの features.binary_control で対応を示した場合のみ使用し、
+ * それ以外はJSONで送信します。
+ */
+enum BinaryControlEvent : uint8_t {
+    kControlListenStart = 0x01,      // デバイス→サーバー、arg: ListeningMode
+    kControlListenStop = 0x02,       // デバイス→サーバー
+    kControlListenDetect = 0x03,     // デバイス→サーバー、text: ウェイクワード
+    kControlAbort = 0x04,            // デバイス→サーバー、arg: AbortReason
+    kControlTtsStart = 0x81,         // サーバー→デバイス
+    kControlTtsStop = 0x82,          // サーバー→デバイス
+    kControlTtsSentenceStart = 0x83, // サーバー→デバイス、text: 読み上げる文
+};
+
 /**
  * @enum AbortReason
  * @brief 音声録音中断理由
@@ -84,21 +139,68 @@ public:
     inline int server_frame_duration() const {
         return server_frame_duration_;
     }
+    /** @brief hello交換で決定した上り音声のフレーム長（ミリ秒） */
+    inline int uplink_frame_duration() const {
+        return uplink_frame_duration_;
+    }
     inline const std::string& session_id() const {
         return session_id_;
     }
+    /** @brief サーバーとの往復遅延の平滑値（ミリ秒）。接続がないか未計測なら-1 */
+    inline int rtt_ms() const {
+        return rtt_ms_;
+    }
+    /** @brief サーバーがTTSキャッシュ（キャッシュ済みの文の音声を省略）に対応しているか */
+    inline bool tts_cache_enabled() const {
+        return tts_cache_enabled_;
+    }
 
-    void OnIncomingAudio(std::function<void(AudioStreamPacket&& packet)> callback);
+    void OnIncomingAudio(std::function<void(const AudioStreamView& view)> callback);
     void OnIncomingJson(std::function<void(const cJSON* root)> callback);
+    /**
+     * @brief フラットなメッセージをcJSONを使わずに受け取るハンドラを登録（Start()の前に呼ぶ）
+     * @param state stateの値。nullptrならtypeのみで一致
+     *
+     * 一致しないメッセージやネストを含むメッセージは、従来どおりOnIncomingJsonへ渡されます。
+     */
+    void OnIncomingMessage(const char* type, const char* state, JsonMessageRouter::Handler handler);
     void OnAudioChannelOpened(std::function<void()> callback);
     void OnAudioChannelClosed(std::function<void()> callback);
     void OnNetworkError(std::function<void(const std::string& message)> callback);
+    /**
+     * @brief 下り音声として希望するサンプリングレートを設定（Start()の前に呼ぶ）
+     *
+     * helloで通知し、サーバーが同じレートのストリームを選べばリサンプルが不要になります。
+     */
+    void SetPreferredOutputSampleRate(int sample_rate) {
+        preferred_output_sample_rate_ = sample_rate;
+    }
 
     virtual bool Start() = 0;
     virtual bool OpenAudioChannel() = 0;
     virtual void CloseAudioChannel() = 0;
     virtual bool IsAudioChannelOpened() const = 0;
-    virtual bool SendAudio(const AudioStreamPacket& packet) = 0;
+    /** @brief 会話外でサーバー接続を保持してよいか（省電力ポリシー）。既定では何もしない */
+    virtual void SetStandbyAllowed(bool allowed) {}
+    /**
+     * @brief 会話が始まりそうなとき、音声チャンネル用の接続を先に用意する。既定では何もしない
+     * @param seconds OpenAudioChannel()が呼ばれなければ閉じるまでの秒数
+     * @return 接続の準備を始めた（または既存の待機接続を延長した）場合true
+     */
+    virtual bool PrewarmAudioChannel(int seconds) { return false; }
+    /** @brief 接続の死活確認（メインタスクから1秒ごとに呼ぶ）。既定では何もしない */
+    virtual void Keepalive() {}
+    /**
+     * @brief 音声パケットを送信
+     * @note 実装はpayloadのヘッドルームにプロトコルヘッダを書き込み、
+     *       ペイロードをその場で暗号化することがあります（送信後の内容は未定義）
+     */
+    virtual bool SendAudio(AudioStreamPacket& packet) = 0;
+    /**
+     * @brief 複数の音声パケットを送信（送信待ちが溜まった場合に使用）
+     * @note 既定の実装はSendAudio()を順に呼び出します
+     */
+    virtual bool SendAudioBatch(AudioStreamPacket* packets, size_t count);
     virtual void SendWakeWordDetected(const std::string& wake_word);
     virtual void SendStartListening(ListeningMode mode);
     virtual void SendStopListening();
@@ -106,21 +208,67 @@ public:
     virtual void SendIotDescriptors(const std::string& descriptors);
     virtual void SendIotStates(const std::string& states);
     virtual void SendMcpMessage(const std::string& message);
+    /** @brief 端末のキャッシュで再生する文を通知し、その文の音声を送らないよう求める */
+    virtual void SendTtsCached(const std::string& key);
+    /**
+     * @brief 圧縮済みのテレメトリ（メトリクスのバッチ）を送信
+     * @return 送信しなかった場合false。既定では常にfalse（MQTTのみ対応）
+     */
+    virtual bool SendTelemetry(const std::string& payload) { return false; }
+    /** @brief ネットワーク計測の制御メッセージを送信（net_benchmark.h の取り決めを参照） */
+    virtual void SendNetBench(const char* state, const char* phase, int duration_ms, int packet_bytes);
+    /** @brief 音声パケットをUDPで送受信しているか */
+    virtual bool IsAudioOverUdp() const { return false; }
 
 protected:
     std::function<void(const cJSON* root)> on_incoming_json_;
-    std::function<void(AudioStreamPacket&& packet)> on_incoming_audio_;
+    JsonMessageRouter router_;
+    std::function<void(const AudioStreamView& view)> on_incoming_audio_;
     std::function<void()> on_audio_channel_opened_;
     std::function<void()> on_audio_channel_closed_;
     std::function<void(const std::string& message)> on_network_error_;
 
     int server_sample_rate_ = 24000;
     int server_frame_duration_ = 60;
+    int uplink_frame_duration_ = CONFIG_UPLINK_FRAME_DURATION_MS;
+    int preferred_output_sample_rate_ = 0;     /**< 0なら下りのレートを指定しない */
     bool error_occurred_ = false;
     std::string session_id_;
     std::chrono::time_point<std::chrono::steady_clock> last_incoming_time_;
+    std::atomic<int> rtt_ms_{-1};
+    bool tts_cache_enabled_ = false;
+#if CONFIG_USE_JSON_ARENA
+    JsonArena incoming_json_arena_{"incoming"};     /**< 受信メッセージの解析（受信タスク） */
+    JsonArena outgoing_json_arena_{"outgoing"};     /**< helloなど送信メッセージの組み立て */
+#endif
+
+    /** @brief 往復遅延の計測値を平滑値に反映（TCPのSRTTと同じく1/8の重み） */
+    void UpdateRtt(int sample_ms);
 
     virtual bool SendText(const std::string& text) = 0;
+    /**
+     * @brief バイナリ制御メッセージを送信
+     * @return 送信しなかった場合false（呼び出し側はJSONで送信する）。既定では常にfalse
+     */
+    virtual bool SendControl(BinaryControlEvent event, uint8_t arg, std::string_view text = std::string_view()) {
+        return false;
+    }
+    /** @brief 登録済みのハンドラで処理できればtrue（falseならcJSONで処理する） */
+    bool DispatchFastPath(const char* data, size_t length);
+    /**
+     * @brief 受信したバイナリ制御メッセージを、同等のJSONメッセージのハンドラへ渡す
+     * @return 未知のイベントなど、処理できなかった場合false
+     */
+    bool DispatchControl(const uint8_t* payload, size_t size);
+    /**
+     * @brief クライアントhelloのaudio_paramsを作成
+     *
+     * 上りの形式に加えて、下りで受け付けるサンプリングレート（希望順）とフレーム長を通知します。
+     * 対応していないサーバーは追加のキーを無視し、従来どおりの形式で送信します。
+     */
+    cJSON* CreateHelloAudioParams() const;
+    /** @brief サーバーhelloのaudio_paramsから上りフレーム長を取り出す（未指定なら設定値） */
+    void ParseUplinkFrameDuration(const cJSON* audio_params);
     virtual void SetError(const std::string& message);
     virtual bool IsTimeout() const;
 };
@@ -0,0 +1,339 @@
+/**
+ * @file replay_protocol.cc
+ * @brief 記録した会話セッションを再生するプロトコルの実装
+ */
+#include "replay_protocol.h"
+#include "application.h"
+#include "latency_trace.h"
+
+#include <cstring>
+#include <cJSON.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#define TAG "Replay"
+
+#define REPLAY_TASK_DONE_EVENT (1 << 0)
+
+/** @brief この時間を超えて予定より遅れたレコードを遅延として数える */
+#define REPLAY_LATE_THRESHOLD_MS 10
+
+// CMakeLists.txtでCONFIG_REPLAY_TRACE_FILEをreplay_trace.binとして埋め込む
+extern const uint8_t replay_trace_start[] asm("_binary_replay_trace_bin_start");
+extern const uint8_t replay_trace_end[] asm("_binary_replay_trace_bin_end");
+
+static uint32_t ReadBe32(const uint8_t* p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static uint16_t ReadBe16(const uint8_t* p) {
+    return ((uint16_t)p[0] << 8) | p[1];
+}
+
+void ReplayProtocol::TransitionStats::Add(uint32_t ms) {
+    count++;
+    total_ms += ms;
+    if (ms > max_ms) {
+        max_ms = ms;
+    }
+}
+
+ReplayProtocol::ReplayProtocol() {
+    trace_ = replay_trace_start;
+    trace_size_ = replay_trace_end - replay_trace_start;
+    event_group_ = xEventGroupCreate();
+    xEventGroupSetBits(event_group_, REPLAY_TASK_DONE_EVENT);
+}
+
+ReplayProtocol::~ReplayProtocol() {
+    stop_requested_ = true;
+    xEventGroupWaitBits(event_group_, REPLAY_TASK_DONE_EVENT, pdFALSE, pdTRUE, portMAX_DELAY);
+    vEventGroupDelete(event_group_);
+}
+
+bool ReplayProtocol::Start() {
+    if (ValidateTrace() == 0) {
+        ESP_LOGE(TAG, "Invalid replay trace (%u bytes)", trace_size_);
+        return false;
+    }
+    ESP_LOGI(TAG, "Replay trace %u bytes, speed %d%%, %d run(s)", trace_size_, CONFIG_REPLAY_SPEED_PERCENT, runs_left_);
+    return true;
+}
+
+size_t ReplayProtocol::ValidateTrace() const {
+    if (trace_size_ < 8 || memcmp(trace_, REPLAY_TRACE_MAGIC, 4) != 0) {
+        return 0;
+    }
+    if (ReadBe16(trace_ + 4) != REPLAY_TRACE_VERSION) {
+        return 0;
+    }
+    return 8;
+}
+
+void ReplayProtocol::ApplyServerHello() {
+    size_t offset = ValidateTrace();
+    while (offset + 8 <= trace_size_) {
+        const uint8_t* record = trace_ + offset;
+        uint16_t size = ReadBe16(record + 6);
+        if (offset + 8 + size > trace_size_) {
+            break;
+        }
+        if (record[4] == REPLAY_RECORD_JSON) {
+            std::string text((const char*)record + 8, size);
+            auto root = cJSON_Parse(text.c_str());
+            auto type = cJSON_GetObjectItem(root, "type");
+            bool hello = cJSON_IsString(type) && strcmp(type->valuestring, "hello") == 0;
+            if (hello) {
+                auto audio_params = cJSON_GetObjectItem(root, "audio_params");
+                if (cJSON_IsObject(audio_params)) {
+                    auto sample_rate = cJSON_GetObjectItem(audio_params, "sample_rate");
+                    if (cJSON_IsNumber(sample_rate)) {
+                        server_sample_rate_ = sample_rate->valueint;
+                    }
+                    auto frame_duration = cJSON_GetObjectItem(audio_params, "frame_duration");
+                    if (cJSON_IsNumber(frame_duration)) {
+                        server_frame_duration_ = frame_duration->valueint;
+                    }
+                }
+                ParseUplinkFrameDuration(audio_params);
+                auto session_id = cJSON_GetObjectItem(root, "session_id");
+                if (cJSON_IsString(session_id)) {
+                    session_id_ = session_id->valuestring;
+                }
+            }
+            cJSON_Delete(root);
+            if (hello) {
+                return;
+            }
+        }
+        offset += 8 + size;
+    }
+}
+
+bool ReplayProtocol::OpenAudioChannel() {
+    // 前回の再生タスクの終了を待つ
+    xEventGroupWaitBits(event_group_, REPLAY_TASK_DONE_EVENT, pdFALSE, pdTRUE, portMAX_DELAY);
+    if (ValidateTrace() == 0) {
+        SetError("Invalid replay trace");
+        return false;
+    }
+    ApplyServerHello();
+    error_occurred_ = false;
+    stop_requested_ = false;
+    last_incoming_time_ = std::chrono::steady_clock::now();
+    channel_opened_ = true;
+    LatencyTrace::GetInstance().Mark(kLatencyServerHello);
+    if (on_audio_channel_opened_ != nullptr) {
+        on_audio_channel_opened_();
+    }
+
+    xEventGroupClearBits(event_group_, REPLAY_TASK_DONE_EVENT);
+    xTaskCreate([](void* arg) {
+        auto protocol = (ReplayProtocol*)arg;
+        protocol->ReplayTask();
+        xEventGroupSetBits(protocol->event_group_, REPLAY_TASK_DONE_EVENT);
+        vTaskDelete(NULL);
+    }, "replay", 4096 * 2, this, 5, &replay_task_);
+    return true;
+}
+
+void ReplayProtocol::CloseAudioChannel() {
+    if (!channel_opened_.exchange(false)) {
+        return;
+    }
+    stop_requested_ = true;
+    // 再生タスク自身から呼ばれた場合は終了を待たない
+    if (xTaskGetCurrentTaskHandle() != replay_task_) {
+        xEventGroupWaitBits(event_group_, REPLAY_TASK_DONE_EVENT, pdFALSE, pdTRUE, portMAX_DELAY);
+    }
+    if (on_audio_channel_closed_ != nullptr) {
+        on_audio_channel_closed_();
+    }
+}
+
+bool ReplayProtocol::IsAudioChannelOpened() const {
+    return channel_opened_ && !error_occurred_;
+}
+
+bool ReplayProtocol::SendAudio(AudioStreamPacket& packet) {
+    uplink_packets_++;
+    return true;
+}
+
+bool ReplayProtocol::SendText(const std::string& text) {
+    uplink_messages_++;
+    ESP_LOGD(TAG, "Uplink: %s", text.c_str());
+    return true;
+}
+
+void ReplayProtocol::InjectJson(const uint8_t* payload, size_t size, RunStats& stats) {
+    std::string text((const char*)payload, size);
+    JSON_ARENA_SCOPE(incoming_json_arena_);
+    auto root = cJSON_Parse(text.c_str());
+    auto type = cJSON_GetObjectItem(root, "type");
+    if (!cJSON_IsString(type)) {
+        ESP_LOGE(TAG, "Missing message type, data: %s", text.c_str());
+        cJSON_Delete(root);
+        return;
+    }
+    if (strcmp(type->valuestring, "hello") == 0) {
+        // OpenAudioChannel()で適用済み
+        cJSON_Delete(root);
+        return;
+    }
+
+    PendingTransition pending = kPendingNone;
+    if (strcmp(type->valuestring, "tts") == 0) {
+        auto state = cJSON_GetObjectItem(root, "state");
+        if (cJSON_IsString(state) && strcmp(state->valuestring, "start") == 0) {
+            pending = kPendingTtsStart;
+        } else if (cJSON_IsString(state) && strcmp(state->valuestring, "stop") == 0) {
+            pending = kPendingTtsStop;
+        }
+    }
+
+    int64_t now = esp_timer_get_time();
+    if (!DispatchFastPath(text.data(), text.size()) && on_incoming_json_ != nullptr) {
+        on_incoming_json_(root);
+    }
+    cJSON_Delete(root);
+    stats.json_messages++;
+
+    if (pending != kPendingNone) {
+        // 前の遷移が完了していなければ失敗として数える
+        if (pending_ != kPendingNone) {
+            (pending_ == kPendingTtsStart ? stats.tts_start : stats.tts_stop).timeouts++;
+        }
+        pending_ = pending;
+        pending_since_us_ = now;
+    }
+}
+
+void ReplayProtocol::CheckTransition(RunStats& stats) {
+    if (pending_ == kPendingNone) {
+        return;
+    }
+    auto state = Application::GetInstance().GetDeviceState();
+    bool reached = pending_ == kPendingTtsStart ? state == kDeviceStateSpeaking : state != kDeviceStateSpeaking;
+    uint32_t elapsed_ms = (esp_timer_get_time() - pending_since_us_) / 1000;
+    auto& transition = pending_ == kPendingTtsStart ? stats.tts_start : stats.tts_stop;
+    if (reached) {
+        transition.Add(elapsed_ms);
+        pending_ = kPendingNone;
+    } else if (elapsed_ms > REPLAY_TRANSITION_TIMEOUT_MS) {
+        transition.timeouts++;
+        pending_ = kPendingNone;
+    }
+}
+
+void ReplayProtocol::ReplayTask() {
+    auto& app = Application::GetInstance();
+    auto baseline = app.GetAudioQueueStats();
+    uplink_packets_ = 0;
+    uplink_messages_ = 0;
+    pending_ = kPendingNone;
+
+    RunStats stats;
+    uint32_t trace_ms = 0;
+    int64_t start_us = esp_timer_get_time();
+    size_t offset = ValidateTrace();
+    while (!stop_requested_ && offset + 8 <= trace_size_) {
+        const uint8_t* record = trace_ + offset;
+        uint32_t time_ms = ReadBe32(record);
+        uint8_t type = record[4];
+        uint16_t size = ReadBe16(record + 6);
+        if (offset + 8 + size > trace_size_) {
+            ESP_LOGE(TAG, "Truncated record at offset %u", offset);
+            break;
+        }
+
+        // 速度に応じて予定時刻まで待つ（待つ間も状態遷移を確認する）
+        int64_t due_us = (int64_t)time_ms * 1000 * 100 / CONFIG_REPLAY_SPEED_PERCENT;
+        while (!stop_requested_ && esp_timer_get_time() - start_us < due_us) {
+            CheckTransition(stats);
+            vTaskDelay(1);
+        }
+        if (stop_requested_) {
+            break;
+        }
+        uint32_t lag_ms = (esp_timer_get_time() - start_us - due_us) / 1000;
+        if (lag_ms > REPLAY_LATE_THRESHOLD_MS) {
+            stats.late_records++;
+        }
+        if (lag_ms > stats.max_lag_ms) {
+            stats.max_lag_ms = lag_ms;
+        }
+
+        if (type == REPLAY_RECORD_OPUS) {
+            if (on_incoming_audio_ != nullptr) {
+                AudioStreamView view;
+                view.timestamp = time_ms;
+                view.payload = record + 8;
+                view.payload_size = size;
+                on_incoming_audio_(view);
+            }
+            stats.audio_packets++;
+        } else if (type == REPLAY_RECORD_JSON) {
+            InjectJson(record + 8, size, stats);
+        }
+        last_incoming_time_ = std::chrono::steady_clock::now();
+
+        size_t depth = app.GetAudioQueueStats().decode_queue_depth;
+        if (depth > stats.max_decode_queue) {
+            stats.max_decode_queue = depth;
+        }
+        CheckTransition(stats);
+        trace_ms = time_ms;
+        offset += 8 + size;
+    }
+
+    // 最後の遷移（tts stop後の再生終了など）を待つ
+    while (!stop_requested_ && pending_ != kPendingNone) {
+        CheckTransition(stats);
+        vTaskDelay(1);
+    }
+    stats.uplink_packets = uplink_packets_;
+    stats.uplink_messages = uplink_messages_;
+
+    auto current = app.GetAudioQueueStats();
+    current.incoming_dropped -= baseline.incoming_dropped;
+    current.outgoing_dropped -= baseline.outgoing_dropped;
+    current.underruns -= baseline.underruns;
+    current.late_packets -= baseline.late_packets;
+    int64_t elapsed_ms = (esp_timer_get_time() - start_us) / 1000;
+
+    ESP_LOGI(TAG, "Replayed %lu json, %lu audio in %lld ms (trace %lu ms), uplink %lu audio / %lu text",
+        stats.json_messages, stats.audio_packets, elapsed_ms, trace_ms, stats.uplink_packets, stats.uplink_messages);
+    ESP_LOGI(TAG, "Decode queue max %u (player max %u), dropped in %lu / out %lu, underruns %lu, late %lu, injection lag max %lu ms (%lu late)",
+        stats.max_decode_queue, current.decode_queue_max, current.incoming_dropped, current.outgoing_dropped,
+        current.underruns, current.late_packets, stats.max_lag_ms, stats.late_records);
+    ESP_LOGI(TAG, "tts start -> speaking: %lu x avg %lu max %lu ms (%lu timeouts), tts stop -> done: %lu x avg %lu max %lu ms (%lu timeouts)",
+        stats.tts_start.count, stats.tts_start.count ? stats.tts_start.total_ms / stats.tts_start.count : 0,
+        stats.tts_start.max_ms, stats.tts_start.timeouts,
+        stats.tts_stop.count, stats.tts_stop.count ? stats.tts_stop.total_ms / stats.tts_stop.count : 0,
+        stats.tts_stop.max_ms, stats.tts_stop.timeouts);
+    printf("REPLAY {\"speed\":%d,\"elapsed_ms\":%lld,\"trace_ms\":%lu,\"json\":%lu,\"audio\":%lu,"
+        "\"uplink_audio\":%lu,\"max_decode_queue\":%u,\"incoming_dropped\":%lu,\"outgoing_dropped\":%lu,"
+        "\"underruns\":%lu,\"late_packets\":%lu,\"max_lag_ms\":%lu,"
+        "\"tts_start_ms\":{\"count\":%lu,\"max\":%lu,\"timeouts\":%lu},"
+        "\"tts_stop_ms\":{\"count\":%lu,\"max\":%lu,\"timeouts\":%lu}}\n",
+        CONFIG_REPLAY_SPEED_PERCENT, elapsed_ms, trace_ms, stats.json_messages, stats.audio_packets,
+        stats.uplink_packets, stats.max_decode_queue, current.incoming_dropped, current.outgoing_dropped,
+        current.underruns, current.late_packets, stats.max_lag_ms,
+        stats.tts_start.count, stats.tts_start.max_ms, stats.tts_start.timeouts,
+        stats.tts_stop.count, stats.tts_stop.max_ms, stats.tts_stop.timeouts);
+
+    if (stop_requested_) {
+        return;
+    }
+    // 再生が終わったらサーバーが切断した場合と同じようにチャンネルを閉じる
+    if (channel_opened_.exchange(false) && on_audio_channel_closed_ != nullptr) {
+        on_audio_channel_closed_();
+    }
+    if (--runs_left_ > 0) {
+        vTaskDelay(pdMS_TO_TICKS(REPLAY_RESTART_DELAY_MS));
+        app.Schedule([&app]() {
+            app.ToggleChatState();
+        });
+    }
+}
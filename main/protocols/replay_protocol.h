@@ -0,0 +1,120 @@
+/**
+ * @file replay_protocol.h
+ * @brief 記録した会話セッションを再生するプロトコル（計測用）
+ *
+ * サーバーの代わりに、ファームウェアに埋め込んだトレース（JSONメッセージとOpusパケット）を
+ * 記録時のタイミングで、または加速して受信側に流し込みます。サーバーなしで
+ * Applicationの状態遷移・音声キュー・スケジューリングの変更を同じ入力で繰り返し検証できます。
+ * トレースは scripts/gen_replay_trace.py で作成します。
+ */
+#ifndef _REPLAY_PROTOCOL_H_
+#define _REPLAY_PROTOCOL_H_
+
+#include "protocol.h"
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/event_groups.h>
+#include <freertos/task.h>
+
+#include <atomic>
+
+/** @brief トレースファイルの先頭 */
+#define REPLAY_TRACE_MAGIC "XZRP"
+#define REPLAY_TRACE_VERSION 1
+
+/** @brief レコード種別（BinaryProtocol3のtypeと同じ値） */
+#define REPLAY_RECORD_OPUS 0
+#define REPLAY_RECORD_JSON 1
+
+/** @brief 状態遷移を待つ最大時間。超えたら遷移失敗として数える */
+#define REPLAY_TRANSITION_TIMEOUT_MS 3000
+
+/** @brief 1回の再生が終わってから次の会話を始めるまでの時間 */
+#define REPLAY_RESTART_DELAY_MS 1000
+
+/**
+ * @class ReplayProtocol
+ * @brief トレースを再生するProtocol実装
+ *
+ * トレースの形式（数値はビッグエンディアン）:
+ *   char     magic[4];             // "XZRP"
+ *   uint16_t version;              // REPLAY_TRACE_VERSION
+ *   uint16_t reserved;
+ *   レコードの繰り返し:
+ *     uint32_t time_ms;            // セッション開始からの時刻
+ *     uint8_t  type;               // REPLAY_RECORD_OPUS / REPLAY_RECORD_JSON
+ *     uint8_t  reserved;
+ *     uint16_t size;
+ *     uint8_t  payload[size];
+ *
+ * typeが"hello"のJSONはOpenAudioChannel()で音声パラメータとして使い、再生はしません。
+ * 再生が終わると受信キューの最大深さ、捨てたパケット数、tts start/stopから状態遷移までの
+ * 時間をログと "REPLAY {json}" 行に出力し、チャンネルを閉じます。
+ */
+class ReplayProtocol : public Protocol {
+public:
+    ReplayProtocol();
+    ~ReplayProtocol();
+
+    bool Start() override;
+    bool SendAudio(AudioStreamPacket& packet) override;
+    bool OpenAudioChannel() override;
+    void CloseAudioChannel() override;
+    bool IsAudioChannelOpened() const override;
+
+private:
+    /** @brief 状態遷移の計測結果 */
+    struct TransitionStats {
+        uint32_t count = 0;
+        uint32_t timeouts = 0;
+        uint32_t total_ms = 0;
+        uint32_t max_ms = 0;
+
+        void Add(uint32_t ms);
+    };
+
+    /** @brief 1回の再生の計測結果 */
+    struct RunStats {
+        uint32_t json_messages = 0;
+        uint32_t audio_packets = 0;
+        uint32_t uplink_packets = 0;
+        uint32_t uplink_messages = 0;
+        size_t max_decode_queue = 0;
+        uint32_t late_records = 0;      /**< 予定時刻より遅れて流し込んだレコード数 */
+        uint32_t max_lag_ms = 0;        /**< 予定時刻からの最大遅れ */
+        TransitionStats tts_start;      /**< tts start → Speaking */
+        TransitionStats tts_stop;       /**< tts stop → Speaking以外 */
+    };
+
+    const uint8_t* trace_ = nullptr;
+    size_t trace_size_ = 0;
+    EventGroupHandle_t event_group_ = nullptr;
+    TaskHandle_t replay_task_ = nullptr;
+    std::atomic<bool> channel_opened_{false};
+    std::atomic<bool> stop_requested_{false};
+    std::atomic<uint32_t> uplink_packets_{0};
+    std::atomic<uint32_t> uplink_messages_{0};
+    int runs_left_ = CONFIG_REPLAY_ITERATIONS;
+
+    // 待機中の状態遷移（ReplayTask専用）
+    enum PendingTransition {
+        kPendingNone,
+        kPendingTtsStart,
+        kPendingTtsStop,
+    };
+    PendingTransition pending_ = kPendingNone;
+    int64_t pending_since_us_ = 0;
+
+    bool SendText(const std::string& text) override;
+
+    /** @brief トレースの先頭を検証し、最初のレコードの位置を返す（不正なら0） */
+    size_t ValidateTrace() const;
+    /** @brief 最初のhelloメッセージから音声パラメータを読み込む */
+    void ApplyServerHello();
+    void ReplayTask();
+    void InjectJson(const uint8_t* payload, size_t size, RunStats& stats);
+    /** @brief 待機中の状態遷移が起きたかを確認して記録 */
+    void CheckTransition(RunStats& stats);
+};
+
+#endif // _REPLAY_PROTOCOL_H_
@@ -0,0 +1,269 @@
+#include "udp_audio_channel.h"
+#include "board.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <algorithm>
+#include <cstring>
+#include <arpa/inet.h>
+
+#define TAG "UdpAudio"
+
+// 辅助函数，将单个十六进制字符转换为对应的数值
+static inline uint8_t CharToHex(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return 0;  // 对于无效输入，返回0
+}
+
+static std::string DecodeHexString(const std::string& hex_string) {
+    std::string decoded;
+    decoded.reserve(hex_string.size() / 2);
+    for (size_t i = 0; i + 1 < hex_string.size(); i += 2) {
+        char byte = (CharToHex(hex_string[i]) << 4) | CharToHex(hex_string[i + 1]);
+        decoded.push_back(byte);
+    }
+    return decoded;
+}
+
+UdpAudioChannel::UdpAudioChannel() {
+    mbedtls_aes_init(&aes_ctx_);
+}
+
+UdpAudioChannel::~UdpAudioChannel() {
+    Close();
+    mbedtls_aes_free(&aes_ctx_);
+}
+
+bool UdpAudioChannel::Configure(const cJSON* udp) {
+    auto server = cJSON_GetObjectItem(udp, "server");
+    auto port = cJSON_GetObjectItem(udp, "port");
+    auto key = cJSON_GetObjectItem(udp, "key");
+    auto nonce = cJSON_GetObjectItem(udp, "nonce");
+    if (!cJSON_IsString(server) || !cJSON_IsNumber(port) || !cJSON_IsString(key) || !cJSON_IsString(nonce)) {
+        ESP_LOGE(TAG, "Incomplete UDP parameters");
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(channel_mutex_);
+    server_ = server->valuestring;
+    port_ = port->valueint;
+    nonce_ = DecodeHexString(nonce->valuestring);
+    mbedtls_aes_setkey_enc(&aes_ctx_, (const unsigned char*)DecodeHexString(key->valuestring).c_str(), 128);
+    local_sequence_ = 0;
+    {
+        std::lock_guard<std::mutex> reorder_lock(reorder_mutex_);
+        remote_sequence_ = 0;
+        concealed_frames_ = 0;
+        last_delivered_timestamp_ = 0;
+        for (auto& slot : reorder_slots_) {
+            slot.valid = false;
+        }
+    }
+    return true;
+}
+
+bool UdpAudioChannel::Open(int frame_duration, std::function<void(const AudioStreamView& view)> callback) {
+    std::lock_guard<std::mutex> lock(channel_mutex_);
+    if (udp_ != nullptr) {
+        delete udp_;
+    }
+    frame_duration_ = frame_duration;
+    on_audio_ = callback;
+    send_buffer_.reserve(UDP_AUDIO_NONCE_SIZE + OPUS_PACKET_MAX_SIZE);
+    receive_buffer_.reserve(OPUS_PACKET_MAX_SIZE);
+    udp_ = Board::GetInstance().CreateUdp();
+    udp_->OnMessage([this](const std::string& data) {
+        OnDatagram(data);
+    });
+    if (!udp_->Connect(server_, port_)) {
+        ESP_LOGE(TAG, "Failed to connect to %s:%d", server_.c_str(), port_);
+        delete udp_;
+        udp_ = nullptr;
+        return false;
+    }
+    return true;
+}
+
+void UdpAudioChannel::Close() {
+    std::lock_guard<std::mutex> lock(channel_mutex_);
+    if (udp_ != nullptr) {
+        delete udp_;
+        udp_ = nullptr;
+    }
+    if (send_count_ > 0) {
+        ESP_LOGI(TAG, "Sent %lu packets, send time avg %lld us, max %lld us",
+            send_count_, send_time_total_us_ / send_count_, send_time_max_us_);
+        send_count_ = 0;
+        send_time_total_us_ = 0;
+        send_time_max_us_ = 0;
+    }
+}
+
+bool UdpAudioChannel::Send(AudioStreamPacket& packet) {
+    std::lock_guard<std::mutex> lock(channel_mutex_);
+    if (udp_ == nullptr) {
+        return false;
+    }
+
+    // ヘッダ（nonce）はペイロード直前のヘッドルームに書き込み、ペイロードはその場で暗号化する
+    size_t payload_size = packet.payload.size();
+    uint8_t* header = packet.payload.Prepend(UDP_AUDIO_NONCE_SIZE);
+    if (header == nullptr || nonce_.size() != UDP_AUDIO_NONCE_SIZE) {
+        return false;
+    }
+    memcpy(header, nonce_.data(), UDP_AUDIO_NONCE_SIZE);
+    *(uint16_t*)&header[2] = htons(payload_size);
+    *(uint32_t*)&header[8] = htonl(packet.timestamp);
+    *(uint32_t*)&header[12] = htonl(++local_sequence_);
+
+    // カウンタブロックはmbedtlsが更新するため、ヘッダとは別にコピーする
+    uint8_t counter[UDP_AUDIO_NONCE_SIZE];
+    memcpy(counter, header, sizeof(counter));
+    size_t nc_off = 0;
+    uint8_t stream_block[16];
+    if (mbedtls_aes_crypt_ctr(&aes_ctx_, payload_size, &nc_off, counter, stream_block,
+        packet.payload.data(), packet.payload.data()) != 0) {
+        ESP_LOGE(TAG, "Failed to encrypt audio data");
+        return false;
+    }
+
+    // Udp::Send()はstd::stringを受け取るため、容量を再利用する送信バッファへ1回だけコピーする
+    send_buffer_.assign((const char*)header, UDP_AUDIO_NONCE_SIZE + payload_size);
+    int64_t start_time = esp_timer_get_time();
+    bool sent = udp_->Send(send_buffer_) > 0;
+    int64_t elapsed = esp_timer_get_time() - start_time;
+    send_count_++;
+    send_time_total_us_ += elapsed;
+    send_time_max_us_ = std::max(send_time_max_us_, elapsed);
+    return sent;
+}
+
+void UdpAudioChannel::OnDatagram(const std::string& data) {
+    if (data.size() < UDP_AUDIO_NONCE_SIZE) {
+        ESP_LOGE(TAG, "Invalid audio packet size: %u", data.size());
+        return;
+    }
+    if (data[0] != 0x01) {
+        ESP_LOGE(TAG, "Invalid audio packet type: %x", data[0]);
+        return;
+    }
+    uint32_t timestamp = ntohl(*(uint32_t*)&data[8]);
+    uint32_t sequence = ntohl(*(uint32_t*)&data[12]);
+
+    // 受信タスク専用の復号バッファを再利用し、データグラムごとの確保を避ける
+    size_t decrypted_size = data.size() - UDP_AUDIO_NONCE_SIZE;
+    size_t nc_off = 0;
+    uint8_t stream_block[16];
+    uint8_t counter[UDP_AUDIO_NONCE_SIZE];
+    memcpy(counter, data.data(), sizeof(counter));
+    auto encrypted = (const uint8_t*)data.data() + UDP_AUDIO_NONCE_SIZE;
+    receive_buffer_.resize(decrypted_size);
+    int ret = mbedtls_aes_crypt_ctr(&aes_ctx_, decrypted_size, &nc_off, counter, stream_block, encrypted, receive_buffer_.data());
+    if (ret != 0) {
+        ESP_LOGE(TAG, "Failed to decrypt audio data, ret: %d", ret);
+        return;
+    }
+    ReceiveAudio(sequence, timestamp, receive_buffer_.data(), decrypted_size);
+}
+
+void UdpAudioChannel::ReceiveAudio(uint32_t sequence, uint32_t timestamp, const uint8_t* payload, size_t size) {
+    std::lock_guard<std::mutex> lock(reorder_mutex_);
+    if (remote_sequence_ == 0) {
+        // セッション最初のパケット
+        remote_sequence_ = sequence - 1;
+    } else if ((int32_t)(sequence - remote_sequence_) <= 0) {
+        ESP_LOGW(TAG, "Dropped late audio packet: %lu, last delivered: %lu", sequence, remote_sequence_);
+        return;
+    }
+
+    uint32_t distance = sequence - remote_sequence_;
+    if (distance > UDP_AUDIO_REORDER_WINDOW * 4) {
+        // 大きく飛んだ場合は補間せずに保持分を吐き出して追従する
+        ESP_LOGW(TAG, "Audio sequence jumped from %lu to %lu", remote_sequence_, sequence);
+        FlushLocked();
+        remote_sequence_ = sequence - 1;
+    } else {
+        // ウィンドウに収まるまで先頭を進める。到着していないフレームはPLCで補間する
+        while (sequence - remote_sequence_ > UDP_AUDIO_REORDER_WINDOW) {
+            AdvanceReorderWindow();
+        }
+    }
+
+    if (sequence == remote_sequence_ + 1) {
+        DeliverAudio(timestamp, payload, size);
+        remote_sequence_ = sequence;
+        // 後続の到着済みパケットを順に渡す
+        while (true) {
+            auto& slot = reorder_slots_[(remote_sequence_ + 1) % UDP_AUDIO_REORDER_WINDOW];
+            if (!slot.valid || slot.sequence != remote_sequence_ + 1) {
+                break;
+            }
+            slot.valid = false;
+            DeliverAudio(slot.timestamp, slot.payload.data(), slot.payload.size());
+            remote_sequence_++;
+        }
+        return;
+    }
+
+    auto& slot = reorder_slots_[sequence % UDP_AUDIO_REORDER_WINDOW];
+    if (slot.valid && slot.sequence == sequence) {
+        return;  // 重複
+    }
+    slot.valid = true;
+    slot.sequence = sequence;
+    slot.timestamp = timestamp;
+    slot.payload.assign(payload, payload + size);
+}
+
+void UdpAudioChannel::AdvanceReorderWindow() {
+    uint32_t next = remote_sequence_ + 1;
+    auto& slot = reorder_slots_[next % UDP_AUDIO_REORDER_WINDOW];
+    if (slot.valid && slot.sequence == next) {
+        slot.valid = false;
+        DeliverAudio(slot.timestamp, slot.payload.data(), slot.payload.size());
+    } else if (concealed_frames_ < UDP_AUDIO_MAX_CONCEALED_FRAMES) {
+        // 空のペイロードはデコーダでパケットロスとして扱われ、PLCで補間される
+        concealed_frames_++;
+        uint32_t timestamp = last_delivered_timestamp_ != 0 ? last_delivered_timestamp_ + frame_duration_ : 0;
+        last_delivered_timestamp_ = timestamp;
+        if (on_audio_ != nullptr) {
+            on_audio_(AudioStreamView{
+                .timestamp = timestamp,
+                .payload = nullptr,
+                .payload_size = 0
+            });
+        }
+    }
+    remote_sequence_ = next;
+}
+
+void UdpAudioChannel::DeliverAudio(uint32_t timestamp, const uint8_t* payload, size_t size) {
+    concealed_frames_ = 0;
+    last_delivered_timestamp_ = timestamp;
+    if (on_audio_ != nullptr) {
+        on_audio_(AudioStreamView{
+            .timestamp = timestamp,
+            .payload = payload,
+            .payload_size = size
+        });
+    }
+}
+
+void UdpAudioChannel::Flush() {
+    std::lock_guard<std::mutex> lock(reorder_mutex_);
+    FlushLocked();
+}
+
+void UdpAudioChannel::FlushLocked() {
+    uint32_t base = remote_sequence_;
+    for (uint32_t i = 1; i <= UDP_AUDIO_REORDER_WINDOW; ++i) {
+        auto& slot = reorder_slots_[(base + i) % UDP_AUDIO_REORDER_WINDOW];
+        if (slot.valid && slot.sequence == base + i) {
+            slot.valid = false;
+            DeliverAudio(slot.timestamp, slot.payload.data(), slot.payload.size());
+            remote_sequence_ = base + i;
+        }
+    }
+}
@@ -0,0 +1,116 @@
+/**
+ * @file udp_audio_channel.h
+ * @brief AES-CTRで暗号化したUDP音声チャンネル
+ *
+ * サーバーhelloの udp オブジェクトで指定された宛先と鍵を使い、Opusフレームを
+ * データグラム1つずつ送受信します。受信側は並べ替えウィンドウで順序を揃え、
+ * 欠けたフレームはPLC用の空フレームで補間します。
+ * MqttProtocolと、UDP音声を併用するWebsocketProtocolで共通に使います。
+ */
+#ifndef UDP_AUDIO_CHANNEL_H
+#define UDP_AUDIO_CHANNEL_H
+
+#include "protocol.h"
+
+#include <udp.h>
+#include <cJSON.h>
+#include <mbedtls/aes.h>
+
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#define UDP_AUDIO_NONCE_SIZE 16             /**< UDP音声パケットのヘッダ（nonce）サイズ */
+#define UDP_AUDIO_REORDER_WINDOW 4          /**< UDP音声の並べ替えウィンドウ（パケット数） */
+#define UDP_AUDIO_MAX_CONCEALED_FRAMES 3    /**< 連続してPLCで補間する最大フレーム数 */
+
+/**
+ * @class UdpAudioChannel
+ * @brief 暗号化UDP音声の送受信と受信順序の整列
+ *
+ * パケット形式（ヘッダはnonceを元に作り、AES-CTRのカウンタ初期値を兼ねる）:
+ * |type 1u|flags 1u|payload_len 2u|ssrc 4u|timestamp 4u|sequence 4u|
+ * |payload payload_len|
+ */
+class UdpAudioChannel {
+public:
+    UdpAudioChannel();
+    ~UdpAudioChannel();
+
+    /**
+     * @brief helloの udp オブジェクト（server、port、key、nonce）を読み取り、シーケンスを初期化
+     * @return 必要な項目が揃っていない場合false
+     */
+    bool Configure(const cJSON* udp);
+
+    /**
+     * @brief 設定済みの宛先へ接続
+     * @param frame_duration サーバーのフレーム長（ミリ秒）。補間フレームのタイムスタンプ算出用
+     * @param callback 順序を揃えたフレームを受け取る（UDP受信タスクから呼ばれる）
+     */
+    bool Open(int frame_duration, std::function<void(const AudioStreamView& view)> callback);
+
+    /** 接続を閉じる */
+    void Close();
+
+    /** 接続中かどうか */
+    bool IsOpened() const { return udp_ != nullptr; }
+
+    /** パケットをその場で暗号化して送信（ヘッダはペイロード直前のヘッドルームに書き込む） */
+    bool Send(AudioStreamPacket& packet);
+
+    /** ウィンドウに残っているパケットを順に渡す（発話の末尾を取り残さないため、tts stopの前に呼ぶ） */
+    void Flush();
+
+private:
+    std::mutex channel_mutex_;                      /**< udp_と送信状態の保護 */
+    Udp* udp_ = nullptr;                            /**< UDPクライアントインスタンス */
+    std::string server_;                            /**< UDPサーバーアドレス */
+    int port_ = 0;                                  /**< UDPサーバーポート番号 */
+
+    // AES暗号化関連
+    mbedtls_aes_context aes_ctx_;                   /**< AES暗号化コンテキスト */
+    std::string nonce_;                             /**< AES暗号化nonce値 */
+    std::string send_buffer_;                       /**< 暗号化済みデータグラムの送信バッファ（容量を再利用） */
+    std::vector<uint8_t> receive_buffer_;           /**< 復号バッファ（UDP受信タスク専用、容量を再利用） */
+
+    // 送信時間の計測（ML307ではATコマンドの往復を含む。Close()でログに出す）
+    uint32_t send_count_ = 0;
+    int64_t send_time_total_us_ = 0;
+    int64_t send_time_max_us_ = 0;
+
+    // パケットシーケンス管理
+    uint32_t local_sequence_ = 0;                   /**< ローカルシーケンス番号 */
+    uint32_t remote_sequence_ = 0;                  /**< 最後に渡したリモートシーケンス番号 */
+
+    // 受信の並べ替えウィンドウ（reorder_mutex_で保護）
+    struct ReorderSlot {
+        bool valid = false;
+        uint32_t sequence = 0;
+        uint32_t timestamp = 0;
+        std::vector<uint8_t> payload;               /**< 容量を再利用する */
+    };
+    ReorderSlot reorder_slots_[UDP_AUDIO_REORDER_WINDOW];
+    uint32_t last_delivered_timestamp_ = 0;         /**< 補間フレームのタイムスタンプ算出用 */
+    int concealed_frames_ = 0;                      /**< 連続して補間したフレーム数 */
+    int frame_duration_ = 60;
+    std::function<void(const AudioStreamView& view)> on_audio_;
+    std::mutex reorder_mutex_;
+
+    /** 受信したデータグラムを復号し、並べ替えウィンドウへ入れる */
+    void OnDatagram(const std::string& data);
+
+    /** 受信したパケットを並べ替えウィンドウへ入れ、順序が揃ったものから渡す */
+    void ReceiveAudio(uint32_t sequence, uint32_t timestamp, const uint8_t* payload, size_t size);
+
+    /** ウィンドウ先頭を1つ進める（未到着ならPLC用の空フレームを渡す） */
+    void AdvanceReorderWindow();
+
+    /** 音声フレームを渡す */
+    void DeliverAudio(uint32_t timestamp, const uint8_t* payload, size_t size);
+
+    void FlushLocked();
+};
+
+#endif // UDP_AUDIO_CHANNEL_H
@@ -12,15 +12,29 @@
 #include "system_info.h"
 #include "application.h"
 #include "settings.h"
+#include "latency_trace.h"
+#include "mcp_server.h"
+#include "task_factory.h"
 
+#include <algorithm>
 #include <cstring>
 #include <cJSON.h>
 #include <esp_log.h>
+#include <esp_timer.h>
 #include <arpa/inet.h>
 #include "assets/lang_config.h"
 
 #define TAG "WS"
 
+/** @brief 待機接続の状態確認間隔（ミリ秒） */
+#define WEBSOCKET_STANDBY_CHECK_MS 1000
+
+/** @brief 待機接続の再接続間隔（ミリ秒） */
+#define WEBSOCKET_STANDBY_RETRY_MS 10000
+
+/** @brief pingの応答を待つ時間（ミリ秒）。この間に何も受信しなければ切断済みとみなす */
+#define WEBSOCKET_PING_TIMEOUT_MS 5000
+
 /**
  * @brief WebsocketProtocolコンストラクタ
  * 
@@ -54,47 +68,95 @@ WebsocketProtocol::~WebsocketProtocol() {
  */
 bool WebsocketProtocol::Start() {
     // 音声チャンネルが必要な時のみサーバーに接続
+    // 複数のエンドポイントがある場合は、バックグラウンドで接続時間を計測して最速のものを先に試す
+    StartEndpointProbe();
     return true;
 }
 
-bool WebsocketProtocol::SendAudio(const AudioStreamPacket& packet) {
-    if (websocket_ == nullptr) {
+bool WebsocketProtocol::SendAudio(AudioStreamPacket& packet) {
+    if (udp_audio_.IsOpened()) {
+        return udp_audio_.Send(packet);
+    }
+    // websocket_の確認から送信まで、破棄されないようにsend_mutex_を保持する
+    std::lock_guard<std::mutex> lock(send_mutex_);
+    if (websocket_ == nullptr || standby_) {
         return false;
     }
 
+    // ヘッダはペイロード直前のヘッドルームに書き込み、ペイロードをコピーせずに送信する
     if (version_ == 2) {
-        std::string serialized;
-        serialized.resize(sizeof(BinaryProtocol2) + packet.payload.size());
-        auto bp2 = (BinaryProtocol2*)serialized.data();
+        auto bp2 = (BinaryProtocol2*)packet.payload.Prepend(sizeof(BinaryProtocol2));
+        if (bp2 == nullptr) {
+            return false;
+        }
         bp2->version = htons(version_);
         bp2->type = 0;
         bp2->reserved = 0;
         bp2->timestamp = htonl(packet.timestamp);
         bp2->payload_size = htonl(packet.payload.size());
-        memcpy(bp2->payload, packet.payload.data(), packet.payload.size());
 
-        return websocket_->Send(serialized.data(), serialized.size(), true);
+        return websocket_->Send(bp2, sizeof(BinaryProtocol2) + packet.payload.size(), true);
     } else if (version_ == 3) {
-        std::string serialized;
-        serialized.resize(sizeof(BinaryProtocol3) + packet.payload.size());
-        auto bp3 = (BinaryProtocol3*)serialized.data();
+        auto bp3 = (BinaryProtocol3*)packet.payload.Prepend(sizeof(BinaryProtocol3));
+        if (bp3 == nullptr) {
+            return false;
+        }
         bp3->type = 0;
         bp3->reserved = 0;
         bp3->payload_size = htons(packet.payload.size());
-        memcpy(bp3->payload, packet.payload.data(), packet.payload.size());
 
-        return websocket_->Send(serialized.data(), serialized.size(), true);
+        return websocket_->Send(bp3, sizeof(BinaryProtocol3) + packet.payload.size(), true);
     } else {
         return websocket_->Send(packet.payload.data(), packet.payload.size(), true);
     }
 }
 
-bool WebsocketProtocol::SendText(const std::string& text) {
-    if (websocket_ == nullptr) {
+bool WebsocketProtocol::SendAudioBatch(AudioStreamPacket* packets, size_t count) {
+    if (!audio_batch_enabled_ || version_ != 3 || count > AUDIO_BATCH_MAX_FRAMES || udp_audio_.IsOpened()) {
+        return Protocol::SendAudioBatch(packets, count);
+    }
+
+    size_t total = sizeof(BinaryProtocol3) + 1 + count * sizeof(uint16_t);
+    for (size_t i = 0; i < count; ++i) {
+        total += packets[i].payload.size();
+    }
+    if (total - sizeof(BinaryProtocol3) > UINT16_MAX) {
+        return Protocol::SendAudioBatch(packets, count);
+    }
+
+    std::lock_guard<std::mutex> lock(send_mutex_);
+    if (websocket_ == nullptr || standby_) {
         return false;
     }
+    batch_buffer_.resize(total);
+    auto bp3 = (BinaryProtocol3*)batch_buffer_.data();
+    bp3->type = BINARY_PROTOCOL3_TYPE_OPUS_BATCH;
+    bp3->reserved = 0;
+    bp3->payload_size = htons(total - sizeof(BinaryProtocol3));
+    uint8_t* p = bp3->payload;
+    *p++ = count;
+    for (size_t i = 0; i < count; ++i) {
+        uint16_t size = htons(packets[i].payload.size());
+        memcpy(p, &size, sizeof(size));
+        p += sizeof(size);
+    }
+    for (size_t i = 0; i < count; ++i) {
+        memcpy(p, packets[i].payload.data(), packets[i].payload.size());
+        p += packets[i].payload.size();
+    }
+    return websocket_->Send(batch_buffer_.data(), total, true);
+}
 
-    if (!websocket_->Send(text)) {
+bool WebsocketProtocol::SendText(const std::string& text) {
+    bool sent;
+    {
+        std::lock_guard<std::mutex> lock(send_mutex_);
+        if (websocket_ == nullptr || standby_) {
+            return false;
+        }
+        sent = websocket_->Send(text);
+    }
+    if (!sent) {
         ESP_LOGE(TAG, "Failed to send text: %s", text.c_str());
         SetError(Lang::Strings::SERVER_ERROR);
         return false;
@@ -103,89 +165,344 @@ bool WebsocketProtocol::SendText(const std::string& text) {
     return true;
 }
 
+bool WebsocketProtocol::SendControl(BinaryControlEvent event, uint8_t arg, std::string_view text) {
+    if (!binary_control_enabled_ || version_ != 3 || text.size() > UINT16_MAX - 2) {
+        return false;
+    }
+
+    size_t total = sizeof(BinaryProtocol3) + 2 + text.size();
+    bool sent;
+    {
+        std::lock_guard<std::mutex> lock(send_mutex_);
+        if (websocket_ == nullptr || standby_) {
+            return false;
+        }
+        control_buffer_.resize(total);
+        auto bp3 = (BinaryProtocol3*)control_buffer_.data();
+        bp3->type = BINARY_PROTOCOL3_TYPE_CONTROL;
+        bp3->reserved = 0;
+        bp3->payload_size = htons(total - sizeof(BinaryProtocol3));
+        bp3->payload[0] = event;
+        bp3->payload[1] = arg;
+        memcpy(bp3->payload + 2, text.data(), text.size());
+        sent = websocket_->Send(control_buffer_.data(), total, true);
+    }
+    if (!sent) {
+        ESP_LOGE(TAG, "Failed to send control event: 0x%02x", event);
+        SetError(Lang::Strings::SERVER_ERROR);
+    }
+    // 送信に失敗した場合もJSONで再送はしない（接続自体が使えないため）
+    return true;
+}
+
 bool WebsocketProtocol::IsAudioChannelOpened() const {
-    return websocket_ != nullptr && websocket_->IsConnected() && !error_occurred_ && !IsTimeout();
+    return websocket_ != nullptr && !standby_ && websocket_->IsConnected() && !error_occurred_ && !IsTimeout();
 }
 
 void WebsocketProtocol::CloseAudioChannel() {
-    if (websocket_ != nullptr) {
-        delete websocket_;
-        websocket_ = nullptr;
+    udp_audio_.Close();
+    {
+        std::lock_guard<std::mutex> lock(channel_mutex_);
+        DestroyWebsocket();
+        standby_ = false;
+        rtt_ms_ = -1;
     }
+#if CONFIG_WEBSOCKET_WARM_STANDBY
+    StartStandby(CONFIG_WEBSOCKET_WARM_STANDBY_SECONDS);
+#endif
 }
 
 bool WebsocketProtocol::OpenAudioChannel() {
-    if (websocket_ != nullptr) {
-        delete websocket_;
+    {
+        std::lock_guard<std::mutex> lock(channel_mutex_);
+        if (standby_ && websocket_ != nullptr && websocket_->IsConnected()) {
+            // 待機接続をそのまま昇格する。hello交換済みのためlisten startだけで会話を始められる
+            ESP_LOGI(TAG, "Promoting warm standby connection");
+            standby_ = false;
+            error_occurred_ = false;
+            last_incoming_time_ = std::chrono::steady_clock::now();
+            LatencyTrace::GetInstance().Mark(kLatencyServerHello);
+        } else {
+            standby_ = false;
+            if (!Connect(true)) {
+                return false;
+            }
+        }
+    }
+
+    if (udp_audio_configured_) {
+        bool opened = udp_audio_.Open(server_frame_duration_, [this](const AudioStreamView& view) {
+            if (on_incoming_audio_ != nullptr) {
+                on_incoming_audio_(view);
+            }
+            last_incoming_time_ = std::chrono::steady_clock::now();
+        });
+        if (!opened) {
+            // 音声はWebSocketで送受信を続ける
+            ESP_LOGW(TAG, "UDP audio unavailable, falling back to websocket audio");
+        }
     }
 
+    // コールバック内でSendText()が呼ばれるため、ロックの外で通知する
+    if (on_audio_channel_opened_ != nullptr) {
+        on_audio_channel_opened_();
+    }
+    return true;
+}
+
+void WebsocketProtocol::SetStandbyAllowed(bool allowed) {
+    standby_allowed_ = allowed;
+    ESP_LOGI(TAG, "Warm standby %s", allowed ? "allowed" : "disallowed");
+}
+
+bool WebsocketProtocol::PrewarmAudioChannel(int seconds) {
+    if (!standby_allowed_ || IsAudioChannelOpened()) {
+        return false;
+    }
+    StartStandby(seconds, true);
+    return true;
+}
+
+void WebsocketProtocol::StartStandby(int seconds, bool immediate) {
+    if (!standby_allowed_) {
+        return;
+    }
+    int64_t deadline = esp_timer_get_time() + (int64_t)seconds * 1000000;
+    if (standby_task_running_.exchange(true)) {
+        // 動作中のタスクの期限を延ばす（短い期限で縮めない）
+        int64_t current = standby_deadline_us_;
+        while (deadline > current && !standby_deadline_us_.compare_exchange_weak(current, deadline)) {
+        }
+        return;
+    }
+    standby_deadline_us_ = deadline;
+    standby_immediate_ = immediate;
+    // TLSハンドシェイクを行うため、スタックはPSRAMではなく内部RAMに確保する
+    if (CreateTask([](void* arg) {
+        auto protocol = (WebsocketProtocol*)arg;
+        protocol->StandbyTask();
+        vTaskDelete(NULL);
+    }, "ws_standby", 4096 * 2, this, 2, nullptr) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create standby task");
+        standby_task_running_ = false;
+    }
+}
+
+void WebsocketProtocol::StandbyTask() {
+    bool immediate = standby_immediate_;
+    int64_t next_attempt = esp_timer_get_time() + (immediate ? 0 : WEBSOCKET_STANDBY_CHECK_MS * 1000);
+    while (standby_allowed_ && esp_timer_get_time() < standby_deadline_us_) {
+        if (immediate) {
+            immediate = false;
+        } else {
+            vTaskDelay(pdMS_TO_TICKS(WEBSOCKET_STANDBY_CHECK_MS));
+        }
+
+        std::lock_guard<std::mutex> lock(channel_mutex_);
+        if (websocket_ != nullptr && !standby_) {
+            if (websocket_->IsConnected()) {
+                // 待機接続が昇格された、または通常のチャンネルが開かれた
+                break;
+            }
+            // サーバー側から切断された古いチャンネルは再利用できない
+        } else if (standby_ && websocket_ != nullptr && websocket_->IsConnected()) {
+            continue;
+        }
+        if (!standby_allowed_ || esp_timer_get_time() < next_attempt) {
+            continue;
+        }
+
+        ESP_LOGI(TAG, "Opening warm standby connection");
+        standby_ = true;
+        if (!Connect(false)) {
+            ESP_LOGW(TAG, "Warm standby connection failed, retry in %d ms", WEBSOCKET_STANDBY_RETRY_MS);
+            DestroyWebsocket();
+            next_attempt = esp_timer_get_time() + WEBSOCKET_STANDBY_RETRY_MS * 1000;
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(channel_mutex_);
+        if (standby_) {
+            ESP_LOGI(TAG, "Closing warm standby connection");
+            DestroyWebsocket();
+            standby_ = false;
+            rtt_ms_ = -1;
+        }
+    }
+    standby_task_running_ = false;
+}
+
+void WebsocketProtocol::DestroyWebsocket() {
+    // 送信タスクが使用中なら、その送信が終わってから破棄する
+    std::lock_guard<std::mutex> lock(send_mutex_);
+    delete websocket_;
+    websocket_ = nullptr;
+}
+
+std::vector<std::string> WebsocketProtocol::GetEndpoints() {
     Settings settings("websocket", false);
-    std::string url = settings.GetString("url");
-    std::string token = settings.GetString("token");
-    int version = settings.GetInt("version");
-    if (version != 0) {
-        version_ = version;
+    std::vector<std::string> endpoints;
+    auto add = [&endpoints](const std::string& url) {
+        if (!url.empty() && std::find(endpoints.begin(), endpoints.end(), url) == endpoints.end()) {
+            endpoints.push_back(url);
+        }
+    };
+
+    std::vector<std::string> urls;
+    std::string list = settings.GetString("urls");
+    size_t start = 0;
+    while (start < list.size()) {
+        size_t end = list.find('\n', start);
+        if (end == std::string::npos) {
+            end = list.size();
+        }
+        urls.push_back(list.substr(start, end - start));
+        start = end + 1;
     }
 
-    error_occurred_ = false;
+    // 計測済みの最速エンドポイントは、現在の一覧に含まれる場合のみ使う
+    std::string best_url = settings.GetString("best_url");
+    if (std::find(urls.begin(), urls.end(), best_url) != urls.end()) {
+        add(best_url);
+    }
+    add(settings.GetString("url"));
+    for (auto& url : urls) {
+        add(url);
+    }
+    return endpoints;
+}
 
-    websocket_ = Board::GetInstance().CreateWebSocket();
-    
+WebSocket* WebsocketProtocol::CreateWebSocket(std::string token) {
+    auto websocket = Board::GetInstance().CreateWebSocket();
     if (!token.empty()) {
         // If token not has a space, add "Bearer " prefix
         if (token.find(" ") == std::string::npos) {
             token = "Bearer " + token;
         }
-        websocket_->SetHeader("Authorization", token.c_str());
+        websocket->SetHeader("Authorization", token.c_str());
+    }
+    websocket->SetHeader("Protocol-Version", std::to_string(version_).c_str());
+    websocket->SetHeader("Device-Id", SystemInfo::GetMacAddress().c_str());
+    websocket->SetHeader("Client-Id", Board::GetInstance().GetUuid().c_str());
+    return websocket;
+}
+
+void WebsocketProtocol::StartEndpointProbe() {
+    if (GetEndpoints().size() < 2) {
+        return;
+    }
+    // TLSハンドシェイクを行うため、スタックはPSRAMではなく内部RAMに確保する
+    if (CreateTask([](void* arg) {
+        auto protocol = (WebsocketProtocol*)arg;
+        protocol->ProbeEndpoints();
+        vTaskDelete(NULL);
+    }, "ws_probe", 4096 * 2, this, 1, nullptr) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create endpoint probe task");
+    }
+}
+
+void WebsocketProtocol::ProbeEndpoints() {
+    std::string token = Settings("websocket", false).GetString("token");
+    std::string best_url;
+    int64_t best_time = INT64_MAX;
+    for (auto& url : GetEndpoints()) {
+        // 接続（TCP・TLS・アップグレード）にかかる時間を計測する。helloは送らない
+        auto websocket = CreateWebSocket(token);
+        int64_t start = esp_timer_get_time();
+        bool connected = websocket->Connect(url.c_str());
+        int64_t elapsed = esp_timer_get_time() - start;
+        delete websocket;
+        if (!connected) {
+            ESP_LOGW(TAG, "Probe %s: failed", url.c_str());
+            continue;
+        }
+        ESP_LOGI(TAG, "Probe %s: %lld ms", url.c_str(), elapsed / 1000);
+        if (elapsed < best_time) {
+            best_time = elapsed;
+            best_url = url;
+        }
     }
-    websocket_->SetHeader("Protocol-Version", std::to_string(version_).c_str());
-    websocket_->SetHeader("Device-Id", SystemInfo::GetMacAddress().c_str());
-    websocket_->SetHeader("Client-Id", Board::GetInstance().GetUuid().c_str());
 
+    Settings settings("websocket", true);
+    if (!best_url.empty() && best_url != settings.GetString("best_url")) {
+        ESP_LOGI(TAG, "Fastest endpoint: %s", best_url.c_str());
+        settings.SetString("best_url", best_url);
+    }
+}
+
+void WebsocketProtocol::AttachHandlers() {
     websocket_->OnData([this](const char* data, size_t len, bool binary) {
         if (binary) {
-            if (on_incoming_audio_ != nullptr) {
+            if (version_ == 3 && len >= sizeof(BinaryProtocol3) &&
+                ((const BinaryProtocol3*)data)->type == BINARY_PROTOCOL3_TYPE_CONTROL) {
+                auto bp3 = (const BinaryProtocol3*)data;
+                size_t payload_size = ntohs(bp3->payload_size);
+                if (payload_size > len - sizeof(BinaryProtocol3)) {
+                    ESP_LOGE(TAG, "Invalid control message size: %u", len);
+                    return;
+                }
+                if (payload_size > 0 && bp3->payload[0] == kControlTtsStop) {
+                    // 発話の末尾がUDPの並べ替えウィンドウに残らないよう、tts stopの前に吐き出す
+                    udp_audio_.Flush();
+                }
+                DispatchControl(bp3->payload, payload_size);
+            } else if (on_incoming_audio_ != nullptr) {
+                // 受信バッファはそのままに、ヘッダを読み取ってペイロード部分のビューを渡す
                 if (version_ == 2) {
-                    BinaryProtocol2* bp2 = (BinaryProtocol2*)data;
-                    bp2->version = ntohs(bp2->version);
-                    bp2->type = ntohs(bp2->type);
-                    bp2->timestamp = ntohl(bp2->timestamp);
-                    bp2->payload_size = ntohl(bp2->payload_size);
-                    auto payload = (uint8_t*)bp2->payload;
-                    on_incoming_audio_(AudioStreamPacket{
-                        .timestamp = bp2->timestamp,
-                        .payload = std::vector<uint8_t>(payload, payload + bp2->payload_size)
+                    auto bp2 = (const BinaryProtocol2*)data;
+                    // ヘッダのフィールドはフレーム長を確かめてから読む
+                    if (len < sizeof(BinaryProtocol2) || ntohl(bp2->payload_size) > len - sizeof(BinaryProtocol2)) {
+                        ESP_LOGE(TAG, "Invalid audio frame size: %u", len);
+                        return;
+                    }
+                    size_t payload_size = ntohl(bp2->payload_size);
+                    on_incoming_audio_(AudioStreamView{
+                        .timestamp = ntohl(bp2->timestamp),
+                        .payload = bp2->payload,
+                        .payload_size = payload_size
                     });
                 } else if (version_ == 3) {
-                    BinaryProtocol3* bp3 = (BinaryProtocol3*)data;
-                    bp3->type = bp3->type;
-                    bp3->payload_size = ntohs(bp3->payload_size);
-                    auto payload = (uint8_t*)bp3->payload;
-                    on_incoming_audio_(AudioStreamPacket{
+                    auto bp3 = (const BinaryProtocol3*)data;
+                    // ヘッダのフィールドはフレーム長を確かめてから読む
+                    if (len < sizeof(BinaryProtocol3) || ntohs(bp3->payload_size) > len - sizeof(BinaryProtocol3)) {
+                        ESP_LOGE(TAG, "Invalid audio frame size: %u", len);
+                        return;
+                    }
+                    size_t payload_size = ntohs(bp3->payload_size);
+                    on_incoming_audio_(AudioStreamView{
                         .timestamp = 0,
-                        .payload = std::vector<uint8_t>(payload, payload + bp3->payload_size)
+                        .payload = bp3->payload,
+                        .payload_size = payload_size
                     });
                 } else {
-                    on_incoming_audio_(AudioStreamPacket{
+                    on_incoming_audio_(AudioStreamView{
                         .timestamp = 0,
-                        .payload = std::vector<uint8_t>((uint8_t*)data, (uint8_t*)data + len)
+                        .payload = (const uint8_t*)data,
+                        .payload_size = len
                     });
                 }
             }
+        } else if (DispatchText(data, len)) {
+            // tts / stt / llmなどのフラットなメッセージはDOMを作らずに処理済み
         } else {
-            // Parse JSON data
-            auto root = cJSON_Parse(data);
+            // Parse JSON data（ハンドラの処理を含めて1メッセージ分をアリーナから確保する）
+            JSON_ARENA_SCOPE(incoming_json_arena_);
+            // 受信したメッセージの上でそのまま解析する（終端文字に頼らない）
+            auto root = cJSON_ParseWithLength(data, len);
             auto type = cJSON_GetObjectItem(root, "type");
             if (cJSON_IsString(type)) {
                 if (strcmp(type->valuestring, "hello") == 0) {
                     ParseServerHello(root);
+                } else if (strcmp(type->valuestring, "pong") == 0) {
+                    HandlePong(root);
                 } else {
                     if (on_incoming_json_ != nullptr) {
                         on_incoming_json_(root);
                     }
                 }
             } else {
-                ESP_LOGE(TAG, "Missing message type, data: %s", data);
+                ESP_LOGE(TAG, "Missing message type, data: %.*s", (int)len, data);
             }
             cJSON_Delete(root);
         }
@@ -194,21 +511,81 @@ bool WebsocketProtocol::OpenAudioChannel() {
 
     websocket_->OnDisconnected([this]() {
         ESP_LOGI(TAG, "Websocket disconnected");
+        rtt_ms_ = -1;
+        if (standby_) {
+            // 待機接続の切断は会話に影響しない。管理タスクが再接続する
+            return;
+        }
+        udp_audio_.Close();
         if (on_audio_channel_closed_ != nullptr) {
             on_audio_channel_closed_();
         }
+#if CONFIG_WEBSOCKET_WARM_STANDBY
+        StartStandby(CONFIG_WEBSOCKET_WARM_STANDBY_SECONDS);
+#endif
     });
+}
+
+bool WebsocketProtocol::Connect(bool report_errors) {
+    DestroyWebsocket();
 
-    ESP_LOGI(TAG, "Connecting to websocket server: %s with version: %d", url.c_str(), version_);
-    if (!websocket_->Connect(url.c_str())) {
+    Settings settings("websocket", false);
+    std::string token = settings.GetString("token");
+    int version = settings.GetInt("version");
+    if (version != 0) {
+        version_ = version;
+    }
+
+    error_occurred_ = false;
+
+    // 前回選んだエンドポイントから順に試し、失敗したら待たずに次へ切り替える
+    auto endpoints = GetEndpoints();
+    bool connected = false;
+    for (size_t i = 0; i < endpoints.size(); ++i) {
+        DestroyWebsocket();
+        auto websocket = CreateWebSocket(token);
+        {
+            std::lock_guard<std::mutex> lock(send_mutex_);
+            websocket_ = websocket;
+        }
+        AttachHandlers();
+
+        ESP_LOGI(TAG, "Connecting to websocket server: %s with version: %d", endpoints[i].c_str(), version_);
+        if (websocket_->Connect(endpoints[i].c_str())) {
+            connected = true;
+            if (i > 0) {
+                // 次回もつながったエンドポイントから試す
+                Settings("websocket", true).SetString("best_url", endpoints[i]);
+            }
+            break;
+        }
+        ESP_LOGW(TAG, "Failed to connect to %s", endpoints[i].c_str());
+    }
+    if (!connected) {
         ESP_LOGE(TAG, "Failed to connect to websocket server");
-        SetError(Lang::Strings::SERVER_NOT_CONNECTED);
+        if (report_errors) {
+            SetError(Lang::Strings::SERVER_NOT_CONNECTED);
+        }
         return false;
     }
+    if (!standby_) {
+        LatencyTrace::GetInstance().Mark(kLatencyChannelConnected);
+    }
 
     // Send hello message to describe the client
+    audio_batch_enabled_ = false;
+    binary_control_enabled_ = false;
+    udp_audio_configured_ = false;
+    ping_enabled_ = false;
+    tts_cache_enabled_ = false;
+    xEventGroupClearBits(event_group_handle_, WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT);
     auto message = GetHelloMessage();
-    if (!SendText(message)) {
+    auto hello_sent_time = std::chrono::steady_clock::now();
+    if (!websocket_->Send(message)) {
+        ESP_LOGE(TAG, "Failed to send hello");
+        if (report_errors) {
+            SetError(Lang::Strings::SERVER_ERROR);
+        }
         return false;
     }
 
@@ -216,19 +593,108 @@ bool WebsocketProtocol::OpenAudioChannel() {
     EventBits_t bits = xEventGroupWaitBits(event_group_handle_, WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT, pdTRUE, pdFALSE, pdMS_TO_TICKS(10000));
     if (!(bits & WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT)) {
         ESP_LOGE(TAG, "Failed to receive server hello");
-        SetError(Lang::Strings::SERVER_TIMEOUT);
+        if (report_errors) {
+            SetError(Lang::Strings::SERVER_TIMEOUT);
+        }
         return false;
     }
 
-    if (on_audio_channel_opened_ != nullptr) {
-        on_audio_channel_opened_();
+    // helloの往復を最初の計測値とし、次のpingは送信間隔の経過後に送る
+    auto now = std::chrono::steady_clock::now();
+    rtt_ms_ = -1;
+    UpdateRtt(std::chrono::duration_cast<std::chrono::milliseconds>(now - hello_sent_time).count());
+    {
+        std::lock_guard<std::mutex> lock(ping_mutex_);
+        ping_pending_ = false;
+        ping_sent_time_ = now;
     }
-
     return true;
 }
 
+void WebsocketProtocol::Keepalive() {
+#if CONFIG_WEBSOCKET_PING_INTERVAL_SECONDS > 0
+    bool closed = false;
+    {
+        // 接続処理中（hello待ち）はロックが保持されているため、この周期は見送る
+        std::unique_lock<std::mutex> lock(channel_mutex_, std::try_to_lock);
+        if (!lock.owns_lock() || websocket_ == nullptr || !ping_enabled_ || !websocket_->IsConnected()) {
+            return;
+        }
+
+        bool dead = false;
+        auto now = std::chrono::steady_clock::now();
+        {
+            std::lock_guard<std::mutex> ping_lock(ping_mutex_);
+            if (ping_pending_ && now - ping_sent_time_ >= std::chrono::milliseconds(WEBSOCKET_PING_TIMEOUT_MS)) {
+                ping_pending_ = false;
+                // pongが来なくても、送信後に何か受信していれば接続は生きている
+                dead = last_incoming_time_ < ping_sent_time_;
+                if (!dead) {
+                    ESP_LOGW(TAG, "Ping %lu not answered, connection still receiving", ping_id_);
+                }
+            }
+            if (!dead && !ping_pending_ &&
+                now - ping_sent_time_ >= std::chrono::seconds(CONFIG_WEBSOCKET_PING_INTERVAL_SECONDS)) {
+                ping_id_++;
+                std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"ping\",\"id\":" +
+                    std::to_string(ping_id_) + "}";
+                ping_sent_time_ = now;
+                ping_pending_ = true;
+                // SendText()は失敗時にエラー表示を出すため、死活確認では直接送る
+                std::lock_guard<std::mutex> send_lock(send_mutex_);
+                dead = !websocket_->Send(message);
+            }
+        }
+        if (!dead) {
+            return;
+        }
+
+        ESP_LOGW(TAG, "No response from server, closing %s connection", standby_ ? "standby" : "audio");
+        closed = !standby_;
+        DestroyWebsocket();
+        standby_ = false;
+        rtt_ms_ = -1;
+    }
+
+    // 会話中の接続はサーバーから切断された場合と同じく閉じ、次の発話を失う前に作り直す
+    if (closed && on_audio_channel_closed_ != nullptr) {
+        on_audio_channel_closed_();
+    }
+#if CONFIG_WEBSOCKET_WARM_STANDBY
+    StartStandby(CONFIG_WEBSOCKET_WARM_STANDBY_SECONDS);
+#endif
+#endif
+}
+
+bool WebsocketProtocol::DispatchText(const char* data, size_t length) {
+    JsonMessage message;
+    if (!message.Parse(data, length)) {
+        return false;
+    }
+    // 発話の末尾がUDPの並べ替えウィンドウに残らないよう、tts stopの前に吐き出す
+    if (message.Equals("type", "tts") && message.Equals("state", "stop")) {
+        udp_audio_.Flush();
+    }
+    return router_.Dispatch(message);
+}
+
+void WebsocketProtocol::HandlePong(const cJSON* root) {
+    auto id = cJSON_GetObjectItem(root, "id");
+    if (!cJSON_IsNumber(id)) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(ping_mutex_);
+    if (!ping_pending_ || (uint32_t)id->valuedouble != ping_id_) {
+        return;
+    }
+    ping_pending_ = false;
+    auto elapsed = std::chrono::steady_clock::now() - ping_sent_time_;
+    UpdateRtt(std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count());
+}
+
 std::string WebsocketProtocol::GetHelloMessage() {
     // keys: message type, version, audio_params (format, sample_rate, channels)
+    JSON_ARENA_SCOPE(outgoing_json_arena_);
     cJSON* root = cJSON_CreateObject();
     cJSON_AddStringToObject(root, "type", "hello");
     cJSON_AddNumberToObject(root, "version", version_);
@@ -238,15 +704,27 @@ std::string WebsocketProtocol::GetHelloMessage() {
 #endif
 #if CONFIG_IOT_PROTOCOL_MCP
     cJSON_AddBoolToObject(features, "mcp", true);
+#endif
+    if (version_ == 3) {
+        cJSON_AddBoolToObject(features, "audio_batch", true);
+        cJSON_AddBoolToObject(features, "binary_control", true);
+    }
+#if CONFIG_WEBSOCKET_PING_INTERVAL_SECONDS > 0
+    cJSON_AddBoolToObject(features, "ping", true);
+#endif
+#if CONFIG_WEBSOCKET_UDP_AUDIO
+    cJSON_AddBoolToObject(features, "udp_audio", true);
+#endif
+#if CONFIG_USE_TTS_CACHE
+    cJSON_AddBoolToObject(features, "tts_cache", true);
 #endif
     cJSON_AddItemToObject(root, "features", features);
+#if CONFIG_IOT_PROTOCOL_MCP
+    // 同じツール一覧をキャッシュしているサーバーはtools/listを省略できる
+    cJSON_AddStringToObject(root, "mcp_tools_hash", McpServer::GetInstance().tools_hash().c_str());
+#endif
     cJSON_AddStringToObject(root, "transport", "websocket");
-    cJSON* audio_params = cJSON_CreateObject();
-    cJSON_AddStringToObject(audio_params, "format", "opus");
-    cJSON_AddNumberToObject(audio_params, "sample_rate", 16000);
-    cJSON_AddNumberToObject(audio_params, "channels", 1);
-    cJSON_AddNumberToObject(audio_params, "frame_duration", OPUS_FRAME_DURATION_MS);
-    cJSON_AddItemToObject(root, "audio_params", audio_params);
+    cJSON_AddItemToObject(root, "audio_params", CreateHelloAudioParams());
     auto json_str = cJSON_PrintUnformatted(root);
     std::string message(json_str);
     cJSON_free(json_str);
@@ -278,6 +756,24 @@ void WebsocketProtocol::ParseServerHello(const cJSON* root) {
             server_frame_duration_ = frame_duration->valueint;
         }
     }
+    ParseUplinkFrameDuration(audio_params);
 
+    auto features = cJSON_GetObjectItem(root, "features");
+    if (cJSON_IsObject(features)) {
+        audio_batch_enabled_ = cJSON_IsTrue(cJSON_GetObjectItem(features, "audio_batch"));
+        binary_control_enabled_ = cJSON_IsTrue(cJSON_GetObjectItem(features, "binary_control"));
+        ping_enabled_ = cJSON_IsTrue(cJSON_GetObjectItem(features, "ping"));
+        tts_cache_enabled_ = cJSON_IsTrue(cJSON_GetObjectItem(features, "tts_cache"));
+    }
+
+#if CONFIG_WEBSOCKET_UDP_AUDIO
+    // UDPの宛先と鍵はMqttProtocolのhelloと同じ形式の udp オブジェクトで受け取る
+    auto udp = cJSON_GetObjectItem(root, "udp");
+    udp_audio_configured_ = cJSON_IsObject(udp) && udp_audio_.Configure(udp);
+#endif
+
+    if (!standby_) {
+        LatencyTrace::GetInstance().Mark(kLatencyServerHello);
+    }
     xEventGroupSetBits(event_group_handle_, WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT);
 }
@@ -11,10 +11,17 @@
 
 
 #include "protocol.h"
+#include "udp_audio_channel.h"
 
 #include <web_socket.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/event_groups.h>
+#include <freertos/task.h>
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
 
 // イベントビットマスク定義
 #define WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT (1 << 0)  /**< サーバーからのHelloメッセージ受信イベント */
@@ -26,6 +33,13 @@
  * WebSocketを使用してサーバーと双方向通信を行います。
  * 音声データはOpusエンコードされ、バイナリプロトコルで送信されます。
  * 制御メッセージはJSONフォーマットで交換されます。
+ *
+ * CONFIG_WEBSOCKET_UDP_AUDIO が有効でサーバーがhelloで udp を返した場合、音声はMqttProtocolと
+ * 同じ形式の暗号化UDPで送受信し、WebSocketは制御メッセージのみに使います。
+ *
+ * CONFIG_WEBSOCKET_WARM_STANDBY が有効な場合、会話終了後にバックグラウンドで
+ * hello交換済みの待機接続を一定時間保持し、次のOpenAudioChannel()で即座に昇格させます。
+ * 待機接続はPrewarmAudioChannel()でウェイクワードの確認前にも開けます。
  */
 class WebsocketProtocol : public Protocol {
 public:
@@ -36,7 +50,10 @@ public:
     bool Start() override;
     
     /** 音声データパケットをサーバーに送信 */
-    bool SendAudio(const AudioStreamPacket& packet) override;
+    bool SendAudio(AudioStreamPacket& packet) override;
+
+    /** 複数の音声パケットを1つのバイナリメッセージにまとめて送信（v3かつサーバー対応時） */
+    bool SendAudioBatch(AudioStreamPacket* packets, size_t count) override;
     
     /** 音声チャンネルをオープン */
     bool OpenAudioChannel() override;
@@ -46,6 +63,19 @@ public:
     
     /** 音声チャンネルがオープンされているかどうかを確認 */
     bool IsAudioChannelOpened() const override;
+    bool IsAudioOverUdp() const override { return udp_audio_.IsOpened(); }
+
+    /** 待機接続の保持を許可/禁止（省電力モード連携） */
+    void SetStandbyAllowed(bool allowed) override;
+
+    /** 待機接続を今すぐ開き、secondsの間だけ保持する（保持中なら期限を延ばす） */
+    bool PrewarmAudioChannel(int seconds) override;
+
+    /** pingの送信と応答の確認。応答のない接続は切断して早めに作り直す */
+    void Keepalive() override;
+
+    /** クライアントHelloメッセージを生成（接続前でも作れる） */
+    std::string GetHelloMessage();
 
 private:
     // FreeRTOSイベント管理
@@ -54,15 +84,77 @@ private:
     // WebSocket接続
     WebSocket* websocket_ = nullptr;                /**< WebSocketインスタンス */
     int version_ = 1;                               /**< プロトコルバージョン */
+    bool audio_batch_enabled_ = false;              /**< サーバーが一括送信に対応しているか */
+    std::vector<uint8_t> batch_buffer_;             /**< 一括送信用の作業バッファ（容量を再利用） */
+    std::atomic<bool> binary_control_enabled_{false};  /**< サーバーがバイナリ制御メッセージに対応しているか */
+    std::vector<uint8_t> control_buffer_;           /**< 制御メッセージ用の作業バッファ（容量を再利用） */
+    std::atomic<bool> udp_audio_configured_{false}; /**< サーバーがhelloでUDP音声の宛先と鍵を返したか */
+    UdpAudioChannel udp_audio_;                     /**< 音声用の暗号化UDPチャンネル（開いている間は音声をこちらで送受信） */
+    std::mutex channel_mutex_;                      /**< websocket_の生成・破棄と待機状態の保護（send_mutex_より先に取る） */
+    std::mutex send_mutex_;                         /**< 送信タスクとメインタスクの書き込みが1メッセージ内で混ざらないようにする。websocket_の差し替えもこれを保持して行う */
+
+    // 待機接続（ウォームスタンバイ）
+    std::atomic<bool> standby_{false};              /**< websocket_が待機接続（チャンネル未使用）かどうか */
+    std::atomic<bool> standby_allowed_{true};       /**< 省電力ポリシーによる許可 */
+    std::atomic<bool> standby_task_running_{false}; /**< 待機接続管理タスクが動作中かどうか */
+    std::atomic<int64_t> standby_deadline_us_{0};   /**< 待機接続を閉じる時刻 */
+    std::atomic<bool> standby_immediate_{false};    /**< 管理タスクの最初の接続を待たずに始める */
+
+    // 死活確認（サーバーがhelloの features.ping で対応を示した場合のみ）
+    std::atomic<bool> ping_enabled_{false};         /**< サーバーがpingに応答するか */
+    std::mutex ping_mutex_;                         /**< 以下のping状態の保護 */
+    uint32_t ping_id_ = 0;                          /**< 最後に送ったpingのID */
+    bool ping_pending_ = false;                     /**< 応答待ちのpingがあるか */
+    std::chrono::steady_clock::time_point ping_sent_time_;  /**< 最後にpingを送った時刻（接続時は接続時刻） */
+
+    /**
+     * @brief 接続してhelloを交換する（channel_mutex_を保持して呼び出す）
+     * @param report_errors falseの場合、失敗してもSetError()を呼ばない（バックグラウンド接続用）
+     */
+    bool Connect(bool report_errors);
+
+    /** @brief websocket_を破棄する（channel_mutex_を保持して呼び出す） */
+    void DestroyWebsocket();
+
+    /** 接続を試す順のエンドポイント（計測済みの最速、url、urlsの順。重複は除く） */
+    std::vector<std::string> GetEndpoints();
+
+    /** 認証とデバイス情報のヘッダを付けたWebSocketを生成 */
+    WebSocket* CreateWebSocket(std::string token);
+
+    /** websocket_に受信・切断のハンドラを登録 */
+    void AttachHandlers();
+
+    /** エンドポイントが複数ある場合、計測タスクを開始 */
+    void StartEndpointProbe();
+
+    /** 各エンドポイントへの接続時間を計測し、最速のものをSettingsに保存 */
+    void ProbeEndpoints();
+
+    /**
+     * @brief 待機接続管理タスクを開始（既に動作中なら期限を延ばすだけ）
+     * @param seconds 待機接続を保持する秒数
+     * @param immediate trueなら最初の接続を待たずに始める
+     */
+    void StartStandby(int seconds, bool immediate = false);
+
+    /** 待機接続を維持し、期限切れ・禁止・昇格で終了するタスク */
+    void StandbyTask();
+
+    /** フラットなテキストメッセージを登録済みのハンドラへ渡す（UDP音声の並べ替えウィンドウも吐き出す） */
+    bool DispatchText(const char* data, size_t length);
+
+    /** pongを受け取り往復遅延を計測 */
+    void HandlePong(const cJSON* root);
 
     /** サーバーからのHelloメッセージを解析 */
     void ParseServerHello(const cJSON* root);
     
     /** テキストメッセージをサーバーに送信 */
     bool SendText(const std::string& text) override;
-    
-    /** クライアントHelloメッセージを生成 */
-    std::string GetHelloMessage();
+
+    /** バイナリ制御メッセージをサーバーに送信（v3かつサーバー対応時） */
+    bool SendControl(BinaryControlEvent event, uint8_t arg, std::string_view text) override;
 };
 
 #endif
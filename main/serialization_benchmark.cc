@@ -0,0 +1,280 @@
+/**
+ * @file serialization_benchmark.cc
+ * @brief MCP・IoT・helloのJSON組み立てのオンデバイスベンチマークの実装
+ */
+#include "serialization_benchmark.h"
+#include "mcp_server.h"
+#include "iot/thing_manager.h"
+#include "websocket_protocol.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include <esp_app_desc.h>
+#include <esp_cpu.h>
+#include <esp_heap_caps.h>
+#include <esp_idf_version.h>
+#include <esp_log.h>
+#include <esp_pm.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#define TAG "SerializationBenchmark"
+
+namespace serialization_benchmark {
+
+namespace {
+
+struct Result {
+    uint32_t cycles_median;
+    uint32_t cycles_max;
+    uint32_t us_median;
+    uint32_t peak_heap;         /**< 1回の組み立ての間に減った空きヒープの最大値 */
+    size_t bytes;               /**< 出力のバイト数 */
+};
+
+/**
+ * @brief body()を1回ずつ計測（bodyは出力のバイト数を返す）
+ *
+ * 中央値を代表値にし、ヒープの最大使用量は測定区間の局所的な最小空き容量から求めます。
+ */
+Result Measure(const std::function<size_t()>& body) {
+    std::vector<uint32_t> cycles;
+    std::vector<uint32_t> us;
+    Result result = {};
+    for (int i = 0; i < SERIALIZATION_BENCHMARK_WARMUP + SERIALIZATION_BENCHMARK_ITERATIONS; ++i) {
+        bool measured = i >= SERIALIZATION_BENCHMARK_WARMUP;
+        size_t free_before = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+        if (measured) {
+            heap_caps_monitor_local_minimum_free_size_start();
+        }
+        int64_t start_us = esp_timer_get_time();
+        uint32_t start = esp_cpu_get_cycle_count();
+        result.bytes = body();
+        uint32_t elapsed = esp_cpu_get_cycle_count() - start;
+        int64_t elapsed_us = esp_timer_get_time() - start_us;
+        if (measured) {
+            size_t minimum = heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT);
+            heap_caps_monitor_local_minimum_free_size_stop();
+            if (free_before > minimum) {
+                result.peak_heap = std::max<uint32_t>(result.peak_heap, free_before - minimum);
+            }
+            cycles.push_back(elapsed);
+            us.push_back((uint32_t)elapsed_us);
+        }
+    }
+    result.cycles_max = *std::max_element(cycles.begin(), cycles.end());
+    std::nth_element(cycles.begin(), cycles.begin() + cycles.size() / 2, cycles.end());
+    std::nth_element(us.begin(), us.begin() + us.size() / 2, us.end());
+    result.cycles_median = cycles[cycles.size() / 2];
+    result.us_median = us[us.size() / 2];
+    return result;
+}
+
+/**
+ * @brief 1ケースを1行のJSONで出力
+ * @param params ケース固有のパラメータ（JSONオブジェクトの中身）
+ */
+void Report(const char* name, const char* params, const Result& result) {
+    printf("BENCH {\"case\":\"%s\",\"params\":{%s},\"iterations\":%d,\"cycles\":%lu,\"cycles_max\":%lu,"
+        "\"us\":%lu,\"peak_heap\":%lu,\"bytes\":%u}\n",
+        name, params, SERIALIZATION_BENCHMARK_ITERATIONS, result.cycles_median, result.cycles_max,
+        result.us_median, result.peak_heap, result.bytes);
+}
+
+/** @brief tools/listのすべてのページを作る（サーバーがカーソルをたどる場合と同じ） */
+size_t BuildAllPages(const std::vector<McpTool*>& tools) {
+    size_t bytes = 0;
+    std::string cursor;
+    do {
+        std::string next_cursor;
+        bytes += McpServer::BuildToolsList(tools, cursor, next_cursor).size();
+        cursor = next_cursor;
+    } while (!cursor.empty());
+    return bytes;
+}
+
+void BenchmarkStockMcp() {
+    auto& server = McpServer::GetInstance();
+    const auto& tools = server.tools();
+    char params[32];
+    snprintf(params, sizeof(params), "\"tools\":%u", tools.size());
+    Report("mcp_tools_list_stock", params, Measure([&tools]() {
+        return BuildAllPages(tools);
+    }));
+}
+
+/** @brief 合成のツール（名前はMcpToolが参照するため呼び出し側で保持する） */
+struct SyntheticTools {
+    std::vector<std::string> names;
+    std::vector<std::unique_ptr<McpTool>> owned;
+    std::vector<McpTool*> tools;
+
+    explicit SyntheticTools(int count) {
+        names.reserve(count);
+        for (int i = 0; i < count; ++i) {
+            names.push_back("self.synthetic.tool_" + std::to_string(i));
+            PropertyList properties(std::vector<Property>{
+                Property("level", kPropertyTypeInteger, 50, 0, 100),
+                Property("name", kPropertyTypeString),
+                Property("enabled", kPropertyTypeBoolean, true),
+            });
+            owned.emplace_back(new McpTool(names.back().c_str(),
+                "A synthetic tool used by the serialization benchmark. It sets the level of a named channel "
+                "and optionally enables it; typical of the device control tools registered by boards.",
+                properties, [](const PropertyList&) -> ReturnValue { return true; }));
+            tools.push_back(owned.back().get());
+        }
+    }
+};
+
+void BenchmarkSyntheticMcp() {
+    for (int count : {10, 40, 100}) {
+        SyntheticTools synthetic(count);
+        char params[32];
+        snprintf(params, sizeof(params), "\"tools\":%d", count);
+        Report("mcp_tools_list", params, Measure([&synthetic]() {
+            return BuildAllPages(synthetic.tools);
+        }));
+    }
+
+    // Propertyは名前のポインタを保持するため、リテラルの配列から取る
+    static const char* const kPropertyNames[] = {
+        "p0", "p1", "p2", "p3", "p4", "p5", "p6", "p7", "p8", "p9", "p10", "p11", "p12", "p13", "p14", "p15",
+    };
+    for (int count : {1, 4, 16}) {
+        std::vector<Property> list;
+        for (int i = 0; i < count; ++i) {
+            list.push_back(Property(kPropertyNames[i], kPropertyTypeInteger, i, 0, 1000));
+        }
+        PropertyList properties(list);
+        char params[32];
+        snprintf(params, sizeof(params), "\"properties\":%d", count);
+        Report("mcp_property_list_to_json", params, Measure([&properties]() {
+            return properties.to_json().size();
+        }));
+    }
+}
+
+/** @brief 件数を変えられる合成のThing */
+class SyntheticThing : public iot::Thing {
+public:
+    SyntheticThing(int index, int properties, int methods) :
+        Thing("Synthetic" + std::to_string(index), "A synthetic device used by the serialization benchmark") {
+        for (int i = 0; i < properties; ++i) {
+            std::string name = "value_" + std::to_string(i);
+            switch (i % 3) {
+            case 0:
+                properties_.AddNumberProperty(name, "Current level of the channel", [i]() -> int { return i * 7; });
+                break;
+            case 1:
+                properties_.AddBooleanProperty(name, "Whether the channel is enabled", [i]() -> bool { return i % 2; });
+                break;
+            default:
+                properties_.AddStringProperty(name, "Label of the channel", []() -> std::string { return "living room"; });
+                break;
+            }
+        }
+        for (int i = 0; i < methods; ++i) {
+            methods_.AddMethod("set_value_" + std::to_string(i), "Set the level of the channel",
+                iot::ParameterList(std::vector<iot::Parameter>{
+                    iot::Parameter("level", "Level between 0 and 100", iot::kValueTypeNumber, true),
+                }), [](const iot::ParameterList&) {});
+        }
+    }
+};
+
+void BenchmarkStockIot() {
+    auto& manager = iot::ThingManager::GetInstance();
+    Report("iot_descriptors_stock", "", Measure([&manager]() {
+        return manager.RebuildDescriptorsJson().size();
+    }));
+    Report("iot_states_stock", "", Measure([&manager]() {
+        manager.UpdateStatesJson(false);
+        return manager.states_json().size();
+    }));
+}
+
+void BenchmarkSyntheticIot() {
+    for (int count : {4, 16, 32}) {
+        std::vector<std::unique_ptr<SyntheticThing>> things;
+        for (int i = 0; i < count; ++i) {
+            things.emplace_back(new SyntheticThing(i, 4, 3));
+        }
+        char params[48];
+        snprintf(params, sizeof(params), "\"things\":%d,\"properties\":4,\"methods\":3", count);
+        Report("iot_descriptors", params, Measure([&things]() {
+            std::string json;
+            iot::JsonWriter writer(json);
+            writer.BeginArray();
+            for (auto& thing : things) {
+                thing->WriteDescriptor(writer);
+            }
+            writer.EndArray();
+            return json.size();
+        }));
+        // ThingManager::UpdateStatesJson(false)と同じく、すべてを読み直して書き込む
+        Report("iot_states", params, Measure([&things]() {
+            std::string json;
+            iot::JsonWriter writer(json);
+            writer.BeginArray();
+            for (auto& thing : things) {
+                thing->RefreshState(true);
+                thing->WriteState(writer, false);
+            }
+            writer.EndArray();
+            return json.size();
+        }));
+    }
+}
+
+void BenchmarkHello() {
+    WebsocketProtocol protocol;
+    Report("ws_hello", "", Measure([&protocol]() {
+        return protocol.GetHelloMessage().size();
+    }));
+}
+
+void RunAll() {
+    auto app_desc = esp_app_get_description();
+#if CONFIG_USE_JSON_ARENA
+    int json_arena = 1;
+#else
+    int json_arena = 0;
+#endif
+    printf("BENCH {\"case\":\"meta\",\"version\":\"%s\",\"idf\":\"%s\",\"cpu_mhz\":%d,\"core\":%d,\"json_arena\":%d}\n",
+        app_desc->version, esp_get_idf_version(), CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ, xPortGetCoreID(), json_arena);
+
+    BenchmarkStockMcp();
+    BenchmarkSyntheticMcp();
+    BenchmarkStockIot();
+    BenchmarkSyntheticIot();
+    BenchmarkHello();
+
+    printf("BENCH {\"case\":\"done\"}\n");
+}
+
+} // namespace
+
+void Run() {
+    ESP_LOGI(TAG, "Running serialization benchmark");
+    // DFSでクロックが変わるとサイクルと時間の関係が崩れるため、最大周波数に固定する
+    esp_pm_lock_handle_t pm_lock = nullptr;
+    if (esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "benchmark", &pm_lock) == ESP_OK) {
+        esp_pm_lock_acquire(pm_lock);
+    }
+
+    RunAll();
+
+    if (pm_lock != nullptr) {
+        esp_pm_lock_release(pm_lock);
+        esp_pm_lock_delete(pm_lock);
+    }
+    ESP_LOGI(TAG, "Benchmark finished");
+}
+
+} // namespace serialization_benchmark
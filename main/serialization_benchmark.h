@@ -0,0 +1,31 @@
+/**
+ * @file serialization_benchmark.h
+ * @brief MCP・IoT・helloのJSON組み立てのオンデバイスベンチマーク
+ *
+ * 会話の開始時に作るJSON（MCPのtools/list、McpTool/PropertyListのto_json、IoTの記述子と状態、
+ * WebSocketのhello）を、ボードに登録された実際のツールとThingに加え、件数を増やした
+ * 合成のツールとThingで測定し、1ケース1行のJSON（"BENCH "接頭辞付き）としてログに出力します。
+ * 各ケースは時間に加えて、1回の組み立ての間のヒープの最大使用量と出力のバイト数を含みます。
+ * scripts/bench_compare.py で基準値と比較できます。
+ */
+#ifndef SERIALIZATION_BENCHMARK_H
+#define SERIALIZATION_BENCHMARK_H
+
+/** @brief 1ケースあたりの測定回数（ウォームアップを除く） */
+#define SERIALIZATION_BENCHMARK_ITERATIONS 30
+
+/** @brief 測定前に捨てる回数（初回の確保やキャッシュの作成を除く） */
+#define SERIALIZATION_BENCHMARK_WARMUP 3
+
+namespace serialization_benchmark {
+
+/**
+ * @brief すべてのケースを測定して結果をログに出力（完了まで戻らない）
+ *
+ * ボードの初期化後（登録済みのツールとThingがある状態）に呼びます。
+ */
+void Run();
+
+} // namespace serialization_benchmark
+
+#endif // SERIALIZATION_BENCHMARK_H
@@ -0,0 +1,120 @@
+#include "session_snapshot.h"
+
+#include <esp_log.h>
+#include <esp_attr.h>
+#include <esp_system.h>
+#include <esp_app_desc.h>
+#include <esp_rom_crc.h>
+
+#include <cstddef>
+#include <cstring>
+#include <ctime>
+
+#define TAG "SessionSnapshot"
+
+/** @brief 構造体の配置を変えたら値を変える */
+#define SESSION_SNAPSHOT_MAGIC 0x53534e31  // "SSN1"
+
+struct SessionSnapshotData {
+    uint32_t magic;
+    uint32_t crc;                   /**< firmware以降のCRC32 */
+    char firmware[32];              /**< 保存したファームウェアのバージョン */
+    uint8_t protocol;
+    uint8_t time_synced;
+    uint8_t server_frame_duration;
+    uint8_t uplink_frame_duration;
+    uint32_t server_sample_rate;    /**< 0ならhelloを未受信 */
+    int64_t version_checked_at;     /**< バージョン確認を終えた時刻（time()、0なら不明） */
+};
+
+static RTC_NOINIT_ATTR SessionSnapshotData s_snapshot;
+
+static uint32_t SnapshotCrc() {
+    auto data = (const uint8_t*)&s_snapshot + offsetof(SessionSnapshotData, firmware);
+    return esp_rom_crc32_le(0, data, sizeof(SessionSnapshotData) - offsetof(SessionSnapshotData, firmware));
+}
+
+bool SessionSnapshot::Load() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto reason = esp_reset_reason();
+    // RTC_NOINITメモリが残るのはソフトウェア要因のリセットとディープスリープからの復帰
+    bool retained = reason == ESP_RST_SW || reason == ESP_RST_PANIC || reason == ESP_RST_INT_WDT ||
+        reason == ESP_RST_TASK_WDT || reason == ESP_RST_WDT || reason == ESP_RST_DEEPSLEEP;
+    warm_ = retained && s_snapshot.magic == SESSION_SNAPSHOT_MAGIC && s_snapshot.crc == SnapshotCrc();
+
+    const char* version = esp_app_get_description()->version;
+    if (!warm_) {
+        memset(&s_snapshot, 0, sizeof(s_snapshot));
+        s_snapshot.magic = SESSION_SNAPSHOT_MAGIC;
+    } else if (strncmp(s_snapshot.firmware, version, sizeof(s_snapshot.firmware) - 1) != 0) {
+        // OTA直後はアクティベーションや設定が変わり得るため、バージョン確認は省かない
+        ESP_LOGI(TAG, "Firmware changed from %s, version check required", s_snapshot.firmware);
+        s_snapshot.version_checked_at = 0;
+    }
+    strncpy(s_snapshot.firmware, version, sizeof(s_snapshot.firmware) - 1);
+    s_snapshot.firmware[sizeof(s_snapshot.firmware) - 1] = '\0';
+    Commit();
+
+    if (warm_) {
+        ESP_LOGI(TAG, "Warm boot (reset reason %d): protocol %d, server %luHz/%dms, time synced %d",
+            reason, s_snapshot.protocol, s_snapshot.server_sample_rate, s_snapshot.server_frame_duration,
+            s_snapshot.time_synced);
+    }
+    return warm_;
+}
+
+SessionProtocolType SessionSnapshot::protocol() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return warm_ ? (SessionProtocolType)s_snapshot.protocol : kSessionProtocolNone;
+}
+
+bool SessionSnapshot::GetServerAudio(int& sample_rate, int& frame_duration, int& uplink_frame_duration) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!warm_ || s_snapshot.server_sample_rate == 0) {
+        return false;
+    }
+    sample_rate = s_snapshot.server_sample_rate;
+    frame_duration = s_snapshot.server_frame_duration;
+    uplink_frame_duration = s_snapshot.uplink_frame_duration;
+    return true;
+}
+
+bool SessionSnapshot::time_synced() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return warm_ && s_snapshot.time_synced;
+}
+
+bool SessionSnapshot::VersionCheckedWithin(int seconds) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!warm_ || !s_snapshot.time_synced || s_snapshot.version_checked_at == 0) {
+        return false;
+    }
+    int64_t elapsed = (int64_t)time(NULL) - s_snapshot.version_checked_at;
+    return elapsed >= 0 && elapsed < seconds;
+}
+
+void SessionSnapshot::SetProtocol(SessionProtocolType protocol) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    s_snapshot.protocol = protocol;
+    Commit();
+}
+
+void SessionSnapshot::SetServerAudio(int sample_rate, int frame_duration, int uplink_frame_duration) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    s_snapshot.server_sample_rate = sample_rate;
+    s_snapshot.server_frame_duration = frame_duration;
+    s_snapshot.uplink_frame_duration = uplink_frame_duration;
+    Commit();
+}
+
+void SessionSnapshot::SetVersionChecked(bool time_synced) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    // 温起動で時刻設定を待たずに確認を省いた場合も、システム時刻は前回の同期のまま有効
+    s_snapshot.time_synced = time_synced || s_snapshot.time_synced;
+    s_snapshot.version_checked_at = s_snapshot.time_synced ? (int64_t)time(NULL) : 0;
+    Commit();
+}
+
+void SessionSnapshot::Commit() {
+    s_snapshot.crc = SnapshotCrc();
+}
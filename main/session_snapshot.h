@@ -0,0 +1,75 @@
+/**
+ * @file session_snapshot.h
+ * @brief 再起動をまたいで保持するセッション状態の小さなスナップショット
+ *
+ * ウォッチドッグやesp_restart()による再起動（温起動）ではRTCメモリとシステム時刻が残るため、
+ * 前回の起動で決まったプロトコル、サーバーの音声パラメータ、時刻同期の有無、
+ * 最後にバージョン確認を終えた時刻をRTC_NOINITメモリに保存しておき、
+ * 次の起動で不要なネットワーク往復を省きます。電源投入やブラウンアウトでは無効になります。
+ */
+#ifndef SESSION_SNAPSHOT_H
+#define SESSION_SNAPSHOT_H
+
+#include <cstdint>
+#include <mutex>
+
+enum SessionProtocolType {
+    kSessionProtocolNone,
+    kSessionProtocolMqtt,
+    kSessionProtocolWebsocket,
+};
+
+/**
+ * @class SessionSnapshot
+ * @brief RTCメモリ上のスナップショットへのアクセス（シングルトン）
+ *
+ * Load()は起動時に1回だけ呼び出してください。Set系の関数はCRCを更新するため、
+ * いつ再起動しても次の起動で壊れた内容を使うことはありません。
+ */
+class SessionSnapshot {
+public:
+    static SessionSnapshot& GetInstance() {
+        static SessionSnapshot instance;
+        return instance;
+    }
+
+    SessionSnapshot(const SessionSnapshot&) = delete;
+    SessionSnapshot& operator=(const SessionSnapshot&) = delete;
+
+    /**
+     * @brief リセット要因とCRCを確認してスナップショットを読み込む
+     * @return 温起動で有効なスナップショットがあればtrue
+     */
+    bool Load();
+
+    bool warm() const { return warm_; }
+
+    /** @brief 前回の起動で使ったプロトコル（温起動でなければkSessionProtocolNone） */
+    SessionProtocolType protocol();
+
+    /** @brief 前回のhelloで受け取った音声パラメータ。温起動でないか未受信ならfalse */
+    bool GetServerAudio(int& sample_rate, int& frame_duration, int& uplink_frame_duration);
+
+    /** @brief 前回の起動でサーバー時刻を設定済みか（システム時刻は温起動を越えて保持される） */
+    bool time_synced();
+
+    /** @brief 同じファームウェアで、seconds秒以内にバージョン確認を終えているか */
+    bool VersionCheckedWithin(int seconds);
+
+    void SetProtocol(SessionProtocolType protocol);
+    void SetServerAudio(int sample_rate, int frame_duration, int uplink_frame_duration);
+
+    /** @brief バージョン確認の完了を記録（時刻はサーバー時刻を設定済みの場合のみ有効） */
+    void SetVersionChecked(bool time_synced);
+
+private:
+    SessionSnapshot() = default;
+
+    /** @brief CRCを更新（mutex_保持中に呼ぶ） */
+    void Commit();
+
+    std::mutex mutex_;
+    bool warm_ = false;
+};
+
+#endif // SESSION_SNAPSHOT_H
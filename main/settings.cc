@@ -4,40 +4,295 @@
  * 
  * ESP32のNVS（Non-Volatile Storage）を使用した設定管理システムの実装です。
  * WiFi設定、音量、明るさなどのユーザー設定を永続化して保存します。
+ * 値はネームスペースごとにRAMへキャッシュし、NVSへの書き込みは遅延してまとめます。
  */
 
 #include "settings.h"
 
 #include <esp_log.h>
+#include <esp_system.h>
+#include <esp_timer.h>
 #include <nvs_flash.h>
 
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <set>
+
 #define TAG "Settings"
 
+namespace {
+
+/** @brief キャッシュした値（SettingsはNVSの文字列・i32・BLOBを扱う） */
+struct SettingsValue {
+    nvs_type_t type = NVS_TYPE_I32;
+    int32_t number = 0;
+    std::string string;     /**< 文字列、またはBLOBのバイト列 */
+};
+
+struct SettingsNamespace {
+    std::map<std::string, SettingsValue> values;
+    nvs_handle_t handle = 0;    /**< 最初の書き込みで開き、以後は開いたまま使う */
+    bool loaded = false;
+    std::set<std::string> pending;  /**< キャッシュだけ更新した（nvs_set/nvs_erase_key待ちの）キー */
+    bool dirty = false;         /**< nvs_set済みで未コミット */
+};
+
+/**
+ * @class SettingsCache
+ * @brief プロセス全体で共有する設定キャッシュ
+ *
+ * 読み取り専用でしか使われないネームスペースはNVS上に作らないよう、
+ * 読み込みは一時的な読み取り専用ハンドルで行い、書き込み用ハンドルは必要になってから開きます。
+ *
+ * 書き込みはキャッシュだけを更新し、最後の書き込みからSETTINGS_WRITE_DELAY_MS後
+ * （書き込みが続いてもSETTINGS_WRITE_MAX_DELAY_MS以内）にキーごとの最新値だけをNVSへ書きます。
+ * 音量スライダーのように連続する変更は1回の書き込みになり、フラッシュの消耗を抑えます。
+ */
+class SettingsCache {
+public:
+    static SettingsCache& GetInstance() {
+        static SettingsCache instance;
+        return instance;
+    }
+
+    bool Get(const std::string& ns, const std::string& key, SettingsValue& value) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto& space = Load(ns);
+        auto it = space.values.find(key);
+        if (it == space.values.end()) {
+            return false;
+        }
+        value = it->second;
+        return true;
+    }
+
+    void Set(const std::string& ns, const std::string& key, SettingsValue value) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto& space = Load(ns);
+        auto it = space.values.find(key);
+        if (it != space.values.end() && it->second.type == value.type &&
+            it->second.number == value.number && it->second.string == value.string) {
+            return;     // 同じ値は書き込まない
+        }
+        space.values[key] = std::move(value);
+        space.pending.insert(key);
+        ScheduleWrite();
+    }
+
+    void Erase(const std::string& ns, const std::string& key) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto& space = Load(ns);
+        // キャッシュはNVSの内容と同じなので、ないキーはNVSにもない
+        if (space.values.erase(key) == 0) {
+            return;
+        }
+        space.pending.insert(key);
+        ScheduleWrite();
+    }
+
+    void EraseAll(const std::string& ns) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto& space = spaces_[ns];
+        if (!OpenForWrite(ns, space)) {
+            return;
+        }
+        ESP_ERROR_CHECK(nvs_erase_all(space.handle));
+        space.values.clear();
+        space.pending.clear();
+        space.loaded = true;
+        space.dirty = true;
+        ScheduleWrite();
+    }
+
+    void Invalidate(const std::string& ns) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = spaces_.find(ns);
+        if (it != spaces_.end()) {
+            // 保留中の値を先に書いてから読み直す
+            WritePending(ns, it->second);
+            it->second.values.clear();
+            it->second.loaded = false;
+        }
+    }
+
+    /** @brief 保留中の値をNVSへ書き、未コミットのネームスペースをすべてコミット */
+    void Flush() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        esp_timer_stop(write_timer_);
+        first_pending_us_ = 0;
+        for (auto& [ns, space] : spaces_) {
+            WritePending(ns, space);
+            if (!space.dirty) {
+                continue;
+            }
+            auto ret = nvs_commit(space.handle);
+            if (ret != ESP_OK) {
+                // 失敗したネームスペースは次の書き込みかFlushで再試行する
+                ESP_LOGE(TAG, "Failed to commit namespace %s: %s", ns.c_str(), esp_err_to_name(ret));
+                continue;
+            }
+            space.dirty = false;
+        }
+    }
+
+private:
+    std::mutex mutex_;
+    std::map<std::string, SettingsNamespace> spaces_;
+    esp_timer_handle_t write_timer_ = nullptr;
+    int64_t first_pending_us_ = 0;  /**< 今の遅延期間で最初に書き込まれた時刻（0なら保留なし） */
+
+    SettingsCache() {
+        esp_timer_create_args_t timer_args = {
+            .callback = [](void* arg) {
+                static_cast<SettingsCache*>(arg)->Flush();
+            },
+            .arg = this,
+            .dispatch_method = ESP_TIMER_TASK,
+            .name = "settings_write",
+            .skip_unhandled_events = true,
+        };
+        ESP_ERROR_CHECK(esp_timer_create(&timer_args, &write_timer_));
+        // 遅延中の書き込みを再起動で失わないようにする
+        esp_register_shutdown_handler([]() {
+            SettingsCache::GetInstance().Flush();
+        });
+    }
+
+    /** @brief 呼び出し側でmutex_を保持すること */
+    SettingsNamespace& Load(const std::string& ns) {
+        auto& space = spaces_[ns];
+        if (space.loaded) {
+            return space;
+        }
+        space.loaded = true;
+
+        nvs_handle_t handle = space.handle;
+        if (handle == 0 && nvs_open(ns.c_str(), NVS_READONLY, &handle) != ESP_OK) {
+            return space;   // ネームスペースがまだない
+        }
+
+        nvs_iterator_t it = nullptr;
+        auto ret = nvs_entry_find(NVS_DEFAULT_PART_NAME, ns.c_str(), NVS_TYPE_ANY, &it);
+        while (ret == ESP_OK) {
+            nvs_entry_info_t info;
+            nvs_entry_info(it, &info);
+            SettingsValue value;
+            if (info.type == NVS_TYPE_I32) {
+                if (nvs_get_i32(handle, info.key, &value.number) == ESP_OK) {
+                    space.values[info.key] = std::move(value);
+                }
+            } else if (info.type == NVS_TYPE_STR) {
+                size_t length = 0;
+                if (nvs_get_str(handle, info.key, nullptr, &length) == ESP_OK && length > 0) {
+                    value.type = NVS_TYPE_STR;
+                    value.string.resize(length);
+                    if (nvs_get_str(handle, info.key, value.string.data(), &length) == ESP_OK) {
+                        // 末尾のnull文字を除去
+                        while (!value.string.empty() && value.string.back() == '\0') {
+                            value.string.pop_back();
+                        }
+                        space.values[info.key] = std::move(value);
+                    }
+                }
+            } else if (info.type == NVS_TYPE_BLOB) {
+                size_t length = 0;
+                if (nvs_get_blob(handle, info.key, nullptr, &length) == ESP_OK) {
+                    value.type = NVS_TYPE_BLOB;
+                    value.string.resize(length);
+                    if (nvs_get_blob(handle, info.key, value.string.data(), &length) == ESP_OK) {
+                        space.values[info.key] = std::move(value);
+                    }
+                }
+            }
+            ret = nvs_entry_next(&it);
+        }
+        nvs_release_iterator(it);
+
+        if (handle != space.handle) {
+            nvs_close(handle);
+        }
+        ESP_LOGD(TAG, "Loaded namespace %s (%u keys)", ns.c_str(), space.values.size());
+        return space;
+    }
+
+    bool OpenForWrite(const std::string& ns, SettingsNamespace& space) {
+        if (space.handle != 0) {
+            return true;
+        }
+        auto ret = nvs_open(ns.c_str(), NVS_READWRITE, &space.handle);
+        if (ret != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to open namespace %s: %s", ns.c_str(), esp_err_to_name(ret));
+            space.handle = 0;
+            return false;
+        }
+        return true;
+    }
+
+    /** @brief 保留中のキーをNVSへ書く（呼び出し側でmutex_を保持すること） */
+    void WritePending(const std::string& ns, SettingsNamespace& space) {
+        if (space.pending.empty() || !OpenForWrite(ns, space)) {
+            return;
+        }
+        for (auto& key : space.pending) {
+            auto it = space.values.find(key);
+            if (it == space.values.end()) {
+                auto ret = nvs_erase_key(space.handle, key.c_str());
+                // キーが存在しない場合はエラーとしない
+                if (ret != ESP_ERR_NVS_NOT_FOUND) {
+                    ESP_ERROR_CHECK(ret);
+                }
+            } else if (it->second.type == NVS_TYPE_STR) {
+                ESP_ERROR_CHECK(nvs_set_str(space.handle, key.c_str(), it->second.string.c_str()));
+            } else if (it->second.type == NVS_TYPE_BLOB) {
+                ESP_ERROR_CHECK(nvs_set_blob(space.handle, key.c_str(), it->second.string.data(), it->second.string.size()));
+            } else {
+                ESP_ERROR_CHECK(nvs_set_i32(space.handle, key.c_str(), it->second.number));
+            }
+        }
+        ESP_LOGD(TAG, "Wrote %u keys to namespace %s", space.pending.size(), ns.c_str());
+        space.pending.clear();
+        space.dirty = true;
+    }
+
+    /**
+     * @brief 書き込みタイマーを最後の書き込みから数え直す
+     *
+     * 書き込みが続いても、最初の書き込みからSETTINGS_WRITE_MAX_DELAY_MSで書き出します。
+     */
+    void ScheduleWrite() {
+        int64_t now = esp_timer_get_time();
+        if (first_pending_us_ == 0) {
+            first_pending_us_ = now;
+        }
+        int64_t delay_us = SETTINGS_WRITE_DELAY_MS * 1000LL;
+        int64_t remaining_us = first_pending_us_ + SETTINGS_WRITE_MAX_DELAY_MS * 1000LL - now;
+        if (remaining_us < delay_us) {
+            delay_us = remaining_us > 0 ? remaining_us : 0;
+        }
+        esp_timer_stop(write_timer_);
+        esp_timer_start_once(write_timer_, delay_us);
+    }
+};
+
+} // namespace
+
 /**
  * @brief Settingsクラスコンストラクタ
  * @param ns NVSネームスペース名
  * @param read_write 書き込み権限の有無
  * 
- * 指定されたネームスペースでNVSハンドルを開きます。
+ * NVSはここでは開かず、最初の読み書きでネームスペースをキャッシュへ読み込みます。
  */
 Settings::Settings(const std::string& ns, bool read_write) : ns_(ns), read_write_(read_write) {
-    // NVSハンドルを開く（読み取り専用または読み書き可能）
-    nvs_open(ns.c_str(), read_write_ ? NVS_READWRITE : NVS_READONLY, &nvs_handle_);
 }
 
 /**
  * @brief Settingsクラスデストラクタ
  * 
- * 変更がある場合はNVSにコミットし、ハンドルを閉じます。
+ * NVSへの書き込みはSETTINGS_WRITE_DELAY_MS後にまとめて行うため、ここでは何もしません。
  */
 Settings::~Settings() {
-    if (nvs_handle_ != 0) {
-        // 書き込み権限があり変更がある場合はコミット
-        if (read_write_ && dirty_) {
-            ESP_ERROR_CHECK(nvs_commit(nvs_handle_));
-        }
-        nvs_close(nvs_handle_);
-    }
 }
 
 /**
@@ -47,27 +302,11 @@ Settings::~Settings() {
  * @return 設定値またはデフォルト値
  */
 std::string Settings::GetString(const std::string& key, const std::string& default_value) {
-    // ハンドルが無効な場合はデフォルト値を返す
-    if (nvs_handle_ == 0) {
-        return default_value;
-    }
-
-    // まず文字列の長さを取得
-    size_t length = 0;
-    if (nvs_get_str(nvs_handle_, key.c_str(), nullptr, &length) != ESP_OK) {
+    SettingsValue value;
+    if (!SettingsCache::GetInstance().Get(ns_, key, value) || value.type != NVS_TYPE_STR) {
         return default_value;
     }
-
-    // 文字列データを読み取り
-    std::string value;
-    value.resize(length);
-    ESP_ERROR_CHECK(nvs_get_str(nvs_handle_, key.c_str(), value.data(), &length));
-    
-    // 末尾のnull文字を除去
-    while (!value.empty() && value.back() == '\0') {
-        value.pop_back();
-    }
-    return value;
+    return value.string;
 }
 
 /**
@@ -77,9 +316,10 @@ std::string Settings::GetString(const std::string& key, const std::string& defau
  */
 void Settings::SetString(const std::string& key, const std::string& value) {
     if (read_write_) {
-        // NVSに文字列を保存
-        ESP_ERROR_CHECK(nvs_set_str(nvs_handle_, key.c_str(), value.c_str()));
-        dirty_ = true;  // 変更フラグを設定
+        SettingsValue entry;
+        entry.type = NVS_TYPE_STR;
+        entry.string = value;
+        SettingsCache::GetInstance().Set(ns_, key, std::move(entry));
     } else {
         ESP_LOGW(TAG, "Namespace %s is not open for writing", ns_.c_str());
     }
@@ -92,16 +332,11 @@ void Settings::SetString(const std::string& key, const std::string& value) {
  * @return 設定値またはデフォルト値
  */
 int32_t Settings::GetInt(const std::string& key, int32_t default_value) {
-    // ハンドルが無効な場合はデフォルト値を返す
-    if (nvs_handle_ == 0) {
-        return default_value;
-    }
-
-    int32_t value;
-    if (nvs_get_i32(nvs_handle_, key.c_str(), &value) != ESP_OK) {
+    SettingsValue value;
+    if (!SettingsCache::GetInstance().Get(ns_, key, value) || value.type != NVS_TYPE_I32) {
         return default_value;
     }
-    return value;
+    return value.number;
 }
 
 /**
@@ -111,25 +346,77 @@ int32_t Settings::GetInt(const std::string& key, int32_t default_value) {
  */
 void Settings::SetInt(const std::string& key, int32_t value) {
     if (read_write_) {
-        // NVSに整数を保存
-        ESP_ERROR_CHECK(nvs_set_i32(nvs_handle_, key.c_str(), value));
-        dirty_ = true;  // 変更フラグを設定
+        SettingsValue entry;
+        entry.number = value;
+        SettingsCache::GetInstance().Set(ns_, key, std::move(entry));
+    } else {
+        ESP_LOGW(TAG, "Namespace %s is not open for writing", ns_.c_str());
+    }
+}
+
+/**
+ * @brief バイナリ設定値を取得
+ * @param key 設定キー
+ * @return 保存されたバイト列（キーがない場合は空）
+ */
+std::vector<uint8_t> Settings::GetBlob(const std::string& key) {
+    SettingsValue value;
+    if (!SettingsCache::GetInstance().Get(ns_, key, value) || value.type != NVS_TYPE_BLOB) {
+        return {};
+    }
+    return std::vector<uint8_t>(value.string.begin(), value.string.end());
+}
+
+/**
+ * @brief バイナリ設定値を保存
+ * @param key 設定キー
+ * @param data 保存するデータ
+ * @param size データサイズ（バイト）
+ */
+void Settings::SetBlob(const std::string& key, const void* data, size_t size) {
+    if (read_write_) {
+        SettingsValue entry;
+        entry.type = NVS_TYPE_BLOB;
+        entry.string.assign(static_cast<const char*>(data), size);
+        SettingsCache::GetInstance().Set(ns_, key, std::move(entry));
     } else {
         ESP_LOGW(TAG, "Namespace %s is not open for writing", ns_.c_str());
     }
 }
 
+bool Settings::ReadVersionedBlob(const std::string& key, uint16_t version, void* data, size_t size) {
+    SettingsValue value;
+    if (!SettingsCache::GetInstance().Get(ns_, key, value) || value.type != NVS_TYPE_BLOB) {
+        return false;
+    }
+    BlobHeader header;
+    if (value.string.size() != sizeof(header) + size) {
+        ESP_LOGW(TAG, "Blob %s/%s has unexpected size %u", ns_.c_str(), key.c_str(), value.string.size());
+        return false;
+    }
+    memcpy(&header, value.string.data(), sizeof(header));
+    if (header.version != version || header.size != size) {
+        ESP_LOGW(TAG, "Blob %s/%s version %u, expected %u", ns_.c_str(), key.c_str(), header.version, version);
+        return false;
+    }
+    memcpy(data, value.string.data() + sizeof(header), size);
+    return true;
+}
+
+void Settings::WriteVersionedBlob(const std::string& key, uint16_t version, const void* data, size_t size) {
+    BlobHeader header = { version, static_cast<uint16_t>(size) };
+    std::string buffer(reinterpret_cast<const char*>(&header), sizeof(header));
+    buffer.append(static_cast<const char*>(data), size);
+    SetBlob(key, buffer.data(), buffer.size());
+}
+
 /**
  * @brief 指定されたキーを削除
  * @param key 削除するキー
  */
 void Settings::EraseKey(const std::string& key) {
     if (read_write_) {
-        auto ret = nvs_erase_key(nvs_handle_, key.c_str());
-        // キーが存在しない場合はエラーとしない
-        if (ret != ESP_ERR_NVS_NOT_FOUND) {
-            ESP_ERROR_CHECK(ret);
-        }
+        SettingsCache::GetInstance().Erase(ns_, key);
     } else {
         ESP_LOGW(TAG, "Namespace %s is not open for writing", ns_.c_str());
     }
@@ -140,9 +427,16 @@ void Settings::EraseKey(const std::string& key) {
  */
 void Settings::EraseAll() {
     if (read_write_) {
-        // ネームスペース内のすべてのキーを削除
-        ESP_ERROR_CHECK(nvs_erase_all(nvs_handle_));
+        SettingsCache::GetInstance().EraseAll(ns_);
     } else {
         ESP_LOGW(TAG, "Namespace %s is not open for writing", ns_.c_str());
     }
 }
+
+void Settings::Flush() {
+    SettingsCache::GetInstance().Flush();
+}
+
+void Settings::Invalidate(const std::string& ns) {
+    SettingsCache::GetInstance().Invalidate(ns);
+}
@@ -10,15 +10,29 @@
 #define SETTINGS_H
 
 #include <string>
+#include <vector>
+#include <type_traits>
 #include <nvs_flash.h>
 
+/** @brief 最後の書き込みからNVSへ書き出すまでの待ち時間（この間の変更は1回の書き込みにまとめる） */
+#define SETTINGS_WRITE_DELAY_MS 2000
+/** @brief 書き込みが続いても、最初の書き込みからこの時間以内に書き出す */
+#define SETTINGS_WRITE_MAX_DELAY_MS 10000
+
 /**
  * @class Settings
  * @brief NVSを使用したデバイス設定管理クラス
  * 
  * ESP32のNVS（Non-Volatile Storage）をラップして、シンプルな
  * キーバリューストアインターフェースを提供します。
- * 文字列、整数の保存・読み込みが可能で、ネームスペースで管理されます。
+ * 文字列、整数、バイナリ（バージョン付き構造体を含む）の保存・読み込みが可能で、
+ * ネームスペースで管理されます。
+ *
+ * ネームスペースは最初に使われたときに一度だけRAMへ読み込み、以降の読み取りは
+ * メモリから返します。書き込みはキャッシュだけを即時に更新し、NVSへの書き込みとコミットは
+ * 最後の変更からSETTINGS_WRITE_DELAY_MS後にまとめて行います（待ち受けに入ったときと
+ * esp_restart時には必ず書き出す）。
+ * Settingsオブジェクトの生成はNVSを開かないため、接続のたびに作っても軽量です。
  */
 class Settings {
 public:
@@ -60,6 +74,50 @@ public:
      */
     void SetInt(const std::string& key, int32_t value);
     
+    /**
+     * @brief バイナリ設定を取得
+     * @param key 設定キー
+     * @return 保存されたバイト列（キーがない場合は空）
+     */
+    std::vector<uint8_t> GetBlob(const std::string& key);
+
+    /**
+     * @brief バイナリ設定を保存
+     * @param key 設定キー
+     * @param data 保存するデータ
+     * @param size データサイズ（バイト）
+     */
+    void SetBlob(const std::string& key, const void* data, size_t size);
+
+    /**
+     * @brief バージョン付きで保存した構造体を読み込む
+     * @param key 設定キー
+     * @param value 読み込み先（失敗時は変更しない）
+     * @param version 期待するバージョン
+     * @return キーがあり、バージョンとサイズが一致したときtrue
+     *
+     * 構造体のレイアウトを変えたときはversionを上げてください。
+     * 古い形式の値は読み込まれず、呼び出し側は既定値で動作します。
+     */
+    template <typename T>
+    bool GetStruct(const std::string& key, T& value, uint16_t version) {
+        static_assert(std::is_trivially_copyable<T>::value, "T must be trivially copyable");
+        return ReadVersionedBlob(key, version, &value, sizeof(T));
+    }
+
+    /**
+     * @brief 構造体をバージョン付きで保存
+     * @param key 設定キー
+     * @param value 保存する値
+     * @param version 構造体のバージョン
+     */
+    template <typename T>
+    void SetStruct(const std::string& key, const T& value, uint16_t version) {
+        static_assert(std::is_trivially_copyable<T>::value, "T must be trivially copyable");
+        static_assert(sizeof(T) <= UINT16_MAX, "T is too large");
+        WriteVersionedBlob(key, version, &value, sizeof(T));
+    }
+
     /**
      * @brief 特定のキーを削除
      * @param key 削除するキー
@@ -69,11 +127,29 @@ public:
     /** すべての設定を削除 */
     void EraseAll();
 
+    /** @brief 保留中の書き込みをすぐにNVSへ書き出してコミット（待ち受け、電源オフ、ディープスリープ前など） */
+    static void Flush();
+
+    /**
+     * @brief ネームスペースのキャッシュを破棄し、次の読み取りでNVSから読み直す
+     * @param ns NVSネームスペース名
+     *
+     * Settingsを経由せずにNVSへ書き込むコンポーネント（WiFi設定など）の後に使います。
+     */
+    static void Invalidate(const std::string& ns);
+
 private:
+    /** @brief GetStruct/SetStructのBLOB先頭に置くヘッダー */
+    struct BlobHeader {
+        uint16_t version;
+        uint16_t size;
+    };
+
+    bool ReadVersionedBlob(const std::string& key, uint16_t version, void* data, size_t size);
+    void WriteVersionedBlob(const std::string& key, uint16_t version, const void* data, size_t size);
+
     std::string ns_;                /**< NVSネームスペース名 */
-    nvs_handle_t nvs_handle_ = 0;   /**< NVSハンドル */
     bool read_write_ = false;       /**< 書き込み権限フラグ */
-    bool dirty_ = false;            /**< 変更フラグ（未使用） */
 };
 
 #endif
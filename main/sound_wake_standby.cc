@@ -0,0 +1,68 @@
+/**
+ * @file sound_wake_standby.cc
+ * @brief 音で起きるディープスリープ待機の実装
+ */
+#include "sound_wake_standby.h"
+#include "settings.h"
+
+#include <esp_log.h>
+#include <esp_sleep.h>
+#include <ulp_riscv.h>
+#include <ulp_riscv_adc.h>
+
+#include "ulp_sound_wake.h"
+
+#define TAG "SoundWakeStandby"
+
+extern const uint8_t ulp_sound_wake_bin_start[] asm("_binary_ulp_sound_wake_bin_start");
+extern const uint8_t ulp_sound_wake_bin_end[] asm("_binary_ulp_sound_wake_bin_end");
+
+bool SoundWakeStandby::WokeBySound() {
+    return esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_ULP;
+}
+
+uint32_t SoundWakeStandby::wake_level() {
+    return ulp_wake_level;
+}
+
+bool SoundWakeStandby::Enter() {
+    ulp_riscv_adc_cfg_t adc_config = {
+        .adc_n = ADC_UNIT_1,
+        .channel = (adc_channel_t)CONFIG_SOUND_WAKE_ADC_CHANNEL,
+        .atten = ADC_ATTEN_DB_12,
+        .width = ADC_BITWIDTH_12,
+        .ulp_mode = ADC_ULP_MODE_RISCV,
+    };
+    auto ret = ulp_riscv_adc_init(&adc_config);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to initialize the ULP ADC: %s", esp_err_to_name(ret));
+        return false;
+    }
+
+    ret = ulp_riscv_load_binary(ulp_sound_wake_bin_start, ulp_sound_wake_bin_end - ulp_sound_wake_bin_start);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to load the ULP program: %s", esp_err_to_name(ret));
+        return false;
+    }
+    ulp_channel = CONFIG_SOUND_WAKE_ADC_CHANNEL;
+    ulp_threshold = CONFIG_SOUND_WAKE_THRESHOLD;
+    ulp_trigger_runs = CONFIG_SOUND_WAKE_TRIGGER_RUNS;
+    ulp_baseline = 0;
+    ulp_runs_over = 0;
+    ulp_wake_level = 0;
+
+    ulp_set_wakeup_period(0, CONFIG_SOUND_WAKE_PERIOD_MS * 1000);
+    ret = ulp_riscv_run();
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start the ULP program: %s", esp_err_to_name(ret));
+        return false;
+    }
+    ESP_ERROR_CHECK(esp_sleep_enable_ulp_wakeup());
+
+    // 遅延中の設定はディープスリープで失われるため書き出す
+    Settings::Flush();
+    ESP_LOGI(TAG, "Entering deep sleep, ADC1 channel %d, threshold %d", CONFIG_SOUND_WAKE_ADC_CHANNEL,
+        CONFIG_SOUND_WAKE_THRESHOLD);
+    esp_deep_sleep_start();
+    return true;
+}
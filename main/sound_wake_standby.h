@@ -0,0 +1,36 @@
+/**
+ * @file sound_wake_standby.h
+ * @brief 音で起きるディープスリープ待機（バッテリー駆動の長期待機用）
+ *
+ * ライトスリープ中もI2SのDMA割り込みでメインCPUが起き続けるため、長時間使わない端末は
+ * ディープスリープに入り、ULP-RISC-VがADC1に接続したアナログマイク（サウンドセンサー）の
+ * 音量を監視します。音を検出するとメインCPUが起き、通常どおり起動してウェイクワードの待ち受けに戻ります。
+ * ディープスリープからの復帰は再起動になるため、起こした音そのもの（ウェイクワード）は聞き取れません。
+ */
+#ifndef SOUND_WAKE_STANDBY_H
+#define SOUND_WAKE_STANDBY_H
+
+#include <cstdint>
+
+/**
+ * @class SoundWakeStandby
+ * @brief ULPによる音の監視とディープスリープへの移行
+ */
+class SoundWakeStandby {
+public:
+    /** @brief 今回の起動がULPによる音の検出からか */
+    static bool WokeBySound();
+
+    /** @brief 音の検出で起きたときの平均絶対偏差（ADCの生値、WokeBySound()がtrueのときだけ有効） */
+    static uint32_t wake_level();
+
+    /**
+     * @brief ULPの監視を開始してディープスリープに入る
+     * @return ULPを開始できなかった場合false（成功した場合は戻らない）
+     *
+     * 呼び出し側で、ディープスリープ中も電源が残る周辺回路（バックライトなど）を先に止めておきます。
+     */
+    static bool Enter();
+};
+
+#endif // SOUND_WAKE_STANDBY_H
@@ -47,6 +47,14 @@ public:
     
     /** ヒープメモリ統計を出力 */
     static void PrintHeapStats();
+
+    /**
+     * @brief 直前のリセットが異常終了（パニック、ウォッチドッグ）で、.noinitの内容が残っているか
+     *
+     * 再起動をまたいで診断情報を残すモジュールが共通に使う。ブラウンアウトではRAMの内容が
+     * 保証されないため含めず、OTAの後などの通常の再起動（ESP_RST_SW）も含めない。
+     */
+    static bool IsCrashReset();
 };
 
 #endif // _SYSTEM_INFO_H_
@@ -0,0 +1,371 @@
+#include "task_factory.h"
+#include "settings.h"
+#if CONFIG_USE_PERF_MONITOR
+#include "perf_monitor.h"
+#endif
+
+#include <cJSON.h>
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <freertos/idf_additions.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <utility>
+#include <vector>
+
+#define TAG "TaskFactory"
+
+/**
+ * タスク名ごとのスタック配置と実行コア
+ * PSRAMに置けるのは常駐し、フラッシュ操作（NVS、OTA、モデルパーティションの読み込み）を
+ * 行わないタスクだけ。mcp_tool と ctrl_worker（ツールが設定を読み書きする）、main、afe_init、
+ * check_new_version などは内部SRAMのままにする。
+ * コアは、Wi-Fi/lwIPがいるコア0にネットワーク・デコード・描画を、コア1にキャプチャとAFEを置くのが既定
+ */
+struct TaskPlacement {
+    const char* name;
+    TaskStackPlacement placement;
+    int core;                   /**< 実行コア（-1: コア指定なし、TASK_CORE_CALLER: 呼び出し元に従う） */
+};
+
+/** @brief 配置表のコアを呼び出し元の指定に任せる */
+#define TASK_CORE_CALLER (-2)
+
+#if CONFIG_AUDIO_WRITE_TASK_CORE < 0
+#define AUDIO_WRITE_CORE CONFIG_AUDIO_DECODE_TASK_CORE
+#else
+#define AUDIO_WRITE_CORE CONFIG_AUDIO_WRITE_TASK_CORE
+#endif
+
+// Opusの作業領域は呼び出したタスクのスタックに取られる
+#if CONFIG_OPUS_SCRATCH_INTERNAL
+#define OPUS_TASK_STACK kTaskStackInternal
+#else
+#define OPUS_TASK_STACK kTaskStackPsram
+#endif
+
+static const TaskPlacement kTaskPlacements[] = {
+    // 上りOpusエンコード（ワーカー番号でコアに振り分け）。制御メッセージ（設定を読むMCPツールなど）は
+    // 内部SRAMのスタックのctrl_workerで処理するため、ここではフラッシュ操作を行わない
+    {"bg_worker",               OPUS_TASK_STACK,    TASK_CORE_CALLER},
+    {"audio_decode",            OPUS_TASK_STACK,    CONFIG_AUDIO_DECODE_TASK_CORE},
+    {"audio_write",             kTaskStackInternal, AUDIO_WRITE_CORE},
+    {"audio_send",              kTaskStackInternal, CONFIG_AUDIO_SEND_TASK_CORE},   // TLSの書き込み
+    {"afe",                     kTaskStackInternal, CONFIG_AFE_TASK_CORE},  // AFE内部のタスク（afe_perferred_core）
+    {"afe_init",                kTaskStackInternal, CONFIG_AFE_TASK_CORE},  // モデルの読み込み
+    {"audio_communication",     kTaskStackPsram,    CONFIG_AFE_TASK_CORE},  // AFEのfetch
+    {"audio_detection",         kTaskStackPsram,    CONFIG_AFE_TASK_CORE},  // WakeNetのfetch
+    {"encode_detect_packets",   OPUS_TASK_STACK,    TASK_CORE_CALLER},      // ウェイクワードのプリロールエンコード
+    {"emotion_decode",          kTaskStackPsram,    TASK_CORE_CALLER},      // 表情スプライトの展開
+    {"taskLVGL",                kTaskStackInternal, TASK_CORE_CALLER},      // esp_lvgl_portが作成（GetLvglTaskCore()）
+    {"ws_standby",              kTaskStackInternal, CONFIG_NETWORK_TASK_CORE},
+    {"ws_probe",                kTaskStackInternal, CONFIG_NETWORK_TASK_CORE},
+    {"ota_writer",              kTaskStackInternal, CONFIG_NETWORK_TASK_CORE},
+#if CONFIG_AUDIO_REALTIME_PROFILE
+    // IRAMに置いた定常経路がPSRAMのスタックで待たされないよう、キャプチャは内部SRAMに残す
+    {"audio_loop",              kTaskStackInternal, CONFIG_AUDIO_CAPTURE_TASK_CORE},
+#else
+    {"audio_loop",              kTaskStackPsram,    CONFIG_AUDIO_CAPTURE_TASK_CORE},
+#endif
+};
+
+/** @brief LoadTaskCoreOverrides()で読み込んだ上書き（以後は読み出しのみ） */
+static std::vector<std::pair<std::string, int>> task_core_overrides;
+
+/** @brief 完全一致か、プールの "<entry>_<番号>" のみ */
+static bool MatchTaskName(const char* name, const char* entry) {
+    size_t length = strlen(entry);
+    if (strncmp(name, entry, length) != 0) {
+        return false;
+    }
+    if (name[length] == '\0') {
+        return true;
+    }
+    if (name[length] != '_' || name[length + 1] == '\0') {
+        return false;
+    }
+    for (const char* p = name + length + 1; *p != '\0'; p++) {
+        if (!isdigit((unsigned char)*p)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static const TaskPlacement* FindTaskPlacement(const char* name) {
+    for (auto& entry : kTaskPlacements) {
+        if (MatchTaskName(name, entry.name)) {
+            return &entry;
+        }
+    }
+    return nullptr;
+}
+
+/** @brief 上書きを探す（完全一致を連番なしの名前より優先する） */
+static bool FindTaskCoreOverride(const char* name, int* core) {
+    const std::pair<std::string, int>* found = nullptr;
+    for (auto& entry : task_core_overrides) {
+        if (entry.first == name) {
+            *core = entry.second;
+            return true;
+        }
+        if (found == nullptr && MatchTaskName(name, entry.first.c_str())) {
+            found = &entry;
+        }
+    }
+    if (found != nullptr) {
+        *core = found->second;
+        return true;
+    }
+    return false;
+}
+
+TaskStackPlacement GetTaskStackPlacement(const char* name) {
+#if CONFIG_TASK_STACK_IN_PSRAM
+    auto entry = FindTaskPlacement(name);
+    if (entry != nullptr) {
+        return entry->placement;
+    }
+#endif
+    return kTaskStackInternal;
+}
+
+int GetTaskCore(const char* name, int default_core) {
+    int core = default_core;
+    auto entry = FindTaskPlacement(name);
+    if (entry != nullptr && entry->core != TASK_CORE_CALLER) {
+        core = entry->core;
+    }
+    FindTaskCoreOverride(name, &core);
+    return core < portNUM_PROCESSORS ? core : -1;
+}
+
+/** @brief 保存形式は "<タスク名>=<コア>;..." */
+void LoadTaskCoreOverrides() {
+    Settings settings("task_cores");
+    std::string value = settings.GetString("overrides");
+    task_core_overrides.clear();
+    size_t position = 0;
+    while (position < value.size()) {
+        size_t end = value.find(';', position);
+        if (end == std::string::npos) {
+            end = value.size();
+        }
+        std::string item = value.substr(position, end - position);
+        size_t separator = item.find('=');
+        if (separator != std::string::npos && separator > 0) {
+            int core = atoi(item.c_str() + separator + 1);
+            task_core_overrides.emplace_back(item.substr(0, separator), core);
+            ESP_LOGI(TAG, "Task %s: core overridden to %d", item.substr(0, separator).c_str(), core);
+        }
+        position = end + 1;
+    }
+}
+
+bool SetTaskCoreOverride(const std::string& name, int core) {
+    if (name.empty() || name.size() >= configMAX_TASK_NAME_LEN || name.find_first_of("=;") != std::string::npos) {
+        return false;
+    }
+    if (core < -2 || core >= portNUM_PROCESSORS) {
+        return false;
+    }
+    // 実行中のタスクは移せないため、保存だけ行い次の起動から反映する
+    Settings settings("task_cores", true);
+    std::string value = settings.GetString("overrides");
+    std::string result;
+    size_t position = 0;
+    while (position < value.size()) {
+        size_t end = value.find(';', position);
+        if (end == std::string::npos) {
+            end = value.size();
+        }
+        std::string item = value.substr(position, end - position);
+        if (!item.empty() && item.compare(0, item.find('='), name) != 0) {
+            result += item + ";";
+        }
+        position = end + 1;
+    }
+    if (core != -2) {
+        result += name + "=" + std::to_string(core) + ";";
+    }
+    if (result.empty()) {
+        settings.EraseKey("overrides");
+    } else {
+        settings.SetString("overrides", result);
+    }
+    return true;
+}
+
+#if CONFIG_USE_PERF_MONITOR
+/** @brief 最新のサンプルのコアごとの負荷（いずれも1コアに対する%） */
+struct CoreLoad {
+    float load[portNUM_PROCESSORS] = {};        /**< IDLEタスク以外の割合 */
+    float pinned[portNUM_PROCESSORS] = {};      /**< そのコアに固定されたタスクの合計 */
+    float floating = 0;                         /**< コア指定のないタスクの合計 */
+    bool valid = false;
+};
+
+/** @brief configMAX_TASK_NAME_LENで切り詰められたタスク名を配置表の名前に戻す */
+static const char* ResolveTaskName(const char* name) {
+    size_t length = strlen(name);
+    if (length == configMAX_TASK_NAME_LEN - 1 && FindTaskPlacement(name) == nullptr) {
+        for (auto& entry : kTaskPlacements) {
+            if (strncmp(entry.name, name, length) == 0) {
+                return entry.name;
+            }
+        }
+    }
+    return name;
+}
+
+/**
+ * @brief 最新のサンプルからコアごとの負荷を求める
+ * @param on_task IDLE以外のタスクごとに呼ぶ（名前、CPU使用率、実際のコア、計画したコア（TASK_CORE_CALLER: 配置表になし））
+ */
+static CoreLoad SampleCoreLoad(std::function<void(const char* name, float cpu, int core, int planned)> on_task) {
+    CoreLoad result;
+    float idle[portNUM_PROCESSORS] = {};
+    PerfMonitor::GetInstance().ForEachLatestTask([&](const char* name, float cpu_percent, uint32_t, int core) {
+        // 全コア合計に対する%を1コアに対する%にする
+        float cpu = cpu_percent * portNUM_PROCESSORS;
+        result.valid = true;
+        if (strncmp(name, "IDLE", 4) == 0) {
+            int index = atoi(name + 4);
+            if (index >= 0 && index < portNUM_PROCESSORS) {
+                idle[index] += cpu;
+            }
+            return;
+        }
+        if (core >= 0) {
+            result.pinned[core] += cpu;
+        } else {
+            result.floating += cpu;
+        }
+        if (on_task) {
+            on_task(name, cpu, core, GetTaskCore(ResolveTaskName(name), TASK_CORE_CALLER));
+        }
+    });
+    for (int i = 0; i < portNUM_PROCESSORS; i++) {
+        result.load[i] = std::max(0.0f, 100.0f - idle[i]);
+    }
+    return result;
+}
+#endif
+
+std::string GetTaskPlacementJson() {
+    cJSON* root = cJSON_CreateObject();
+    cJSON* plan = cJSON_CreateArray();
+    for (auto& entry : kTaskPlacements) {
+        cJSON* item = cJSON_CreateObject();
+        cJSON_AddStringToObject(item, "name", entry.name);
+        int core;
+        if (FindTaskCoreOverride(entry.name, &core)) {
+            cJSON_AddNumberToObject(item, "core", core);
+            cJSON_AddStringToObject(item, "source", "override");
+        } else if (entry.core != TASK_CORE_CALLER) {
+            cJSON_AddNumberToObject(item, "core", entry.core);
+            cJSON_AddStringToObject(item, "source", "kconfig");
+        } else {
+            cJSON_AddStringToObject(item, "source", "caller");
+        }
+        cJSON_AddItemToArray(plan, item);
+    }
+    for (auto& entry : task_core_overrides) {
+        if (FindTaskPlacement(entry.first.c_str()) == nullptr) {
+            cJSON* item = cJSON_CreateObject();
+            cJSON_AddStringToObject(item, "name", entry.first.c_str());
+            cJSON_AddNumberToObject(item, "core", entry.second);
+            cJSON_AddStringToObject(item, "source", "override");
+            cJSON_AddItemToArray(plan, item);
+        }
+    }
+    cJSON_AddItemToObject(root, "plan", plan);
+
+#if CONFIG_USE_PERF_MONITOR
+    // 負荷は1コアに対する%（小数1桁）
+    cJSON* tasks = cJSON_CreateArray();
+    cJSON* mismatches = cJSON_CreateArray();
+    auto load = SampleCoreLoad([tasks, mismatches](const char* name, float cpu, int core, int planned) {
+        cJSON* item = cJSON_CreateObject();
+        cJSON_AddStringToObject(item, "name", name);
+        cJSON_AddNumberToObject(item, "core", core);
+        cJSON_AddNumberToObject(item, "cpu", (int)(cpu * 10) / 10.0);
+        cJSON_AddItemToArray(tasks, item);
+        if (planned != TASK_CORE_CALLER && planned != core) {
+            cJSON_AddItemToArray(mismatches, cJSON_CreateString(name));
+        }
+    });
+    cJSON* cores = cJSON_CreateArray();
+    for (int i = 0; i < portNUM_PROCESSORS && load.valid; i++) {
+        cJSON* item = cJSON_CreateObject();
+        cJSON_AddNumberToObject(item, "core", i);
+        cJSON_AddNumberToObject(item, "load", (int)(load.load[i] * 10) / 10.0);
+        cJSON_AddNumberToObject(item, "pinned", (int)(load.pinned[i] * 10) / 10.0);
+        cJSON_AddItemToArray(cores, item);
+    }
+    cJSON_AddItemToObject(root, "cores", cores);
+    cJSON_AddNumberToObject(root, "floating", (int)(load.floating * 10) / 10.0);
+    cJSON_AddItemToObject(root, "tasks", tasks);
+    cJSON_AddItemToObject(root, "mismatches", mismatches);
+#endif
+
+    char* json = cJSON_PrintUnformatted(root);
+    std::string result(json);
+    cJSON_free(json);
+    cJSON_Delete(root);
+    return result;
+}
+
+#if CONFIG_TASK_PLACEMENT_VALIDATE
+void LogTaskPlacement() {
+    auto load = SampleCoreLoad([](const char* name, float cpu, int core, int planned) {
+        if (planned != TASK_CORE_CALLER && planned != core) {
+            ESP_LOGW(TAG, "Task %s runs on core %d, planned %d", name, core, planned);
+        }
+    });
+    if (!load.valid) {
+        return;
+    }
+    for (int i = 0; i < portNUM_PROCESSORS; i++) {
+        ESP_LOGI(TAG, "Core %d: load %.1f%%, pinned tasks %.1f%%", i, load.load[i], load.pinned[i]);
+        if (load.load[i] > CONFIG_TASK_PLACEMENT_LOAD_WARN_PERCENT) {
+            ESP_LOGW(TAG, "Core %d is overloaded (%.1f%%)", i, load.load[i]);
+        }
+    }
+    ESP_LOGI(TAG, "Unpinned tasks: %.1f%%", load.floating);
+}
+#endif
+
+BaseType_t CreateTask(TaskFunction_t function, const char* name, uint32_t stack_size, void* arg,
+    UBaseType_t priority, TaskHandle_t* handle, int core_id) {
+    core_id = GetTaskCore(name, core_id);
+    BaseType_t core = core_id < 0 ? tskNO_AFFINITY : core_id;
+    if (GetTaskStackPlacement(name) == kTaskStackPsram) {
+        auto ret = xTaskCreatePinnedToCoreWithCaps(function, name, stack_size, arg, priority, handle, core,
+            MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        if (ret == pdPASS) {
+            ESP_LOGI(TAG, "Task %s: %lu bytes stack in PSRAM", name, (unsigned long)stack_size);
+            return ret;
+        }
+        ESP_LOGW(TAG, "Task %s: PSRAM stack unavailable, falling back to internal RAM", name);
+    }
+    return xTaskCreatePinnedToCore(function, name, stack_size, arg, priority, handle, core);
+}
+
+void DeleteTask(TaskHandle_t handle) {
+    if (handle == nullptr) {
+        return;
+    }
+    // WithCapsで作成したタスクだけが静的バッファを持つ
+    StackType_t* stack = nullptr;
+    StaticTask_t* tcb = nullptr;
+    if (xTaskGetStaticBuffers(handle, &stack, &tcb) == pdTRUE) {
+        vTaskDeleteWithCaps(handle);
+    } else {
+        vTaskDelete(handle);
+    }
+}
@@ -0,0 +1,85 @@
+/**
+ * @file task_factory.h
+ * @brief スタックの配置先と実行コアを選んでFreeRTOSタスクを作成する
+ *
+ * 内部SRAMは長時間稼働で最初に足りなくなる資源のため、フラッシュ操作を行わない
+ * タスクのスタックはPSRAMに置きます。どのタスクをPSRAMに置くか、どのコアで動かすかは
+ * task_factory.cc の配置表でタスク名ごとに決め、表にないタスクは内部SRAMに作成します。
+ *
+ * コアの既定値はKconfig（Task Core Placement）から取り、NVSの上書き（SetTaskCoreOverride()）が
+ * あれば次の起動からそちらを使います。ESP-IDFのタスク（Wi-Fi、lwIP）やesp_lvgl_portの
+ * LVGLタスクは自前で作成されるため、LVGLはGetTaskCore()で作成前にコアを決め、
+ * それ以外は GetTaskPlacementJson() の実測にだけ現れます。
+ */
+#ifndef TASK_FACTORY_H
+#define TASK_FACTORY_H
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <string>
+
+/**
+ * @enum TaskStackPlacement
+ * @brief タスクスタックの配置先
+ */
+enum TaskStackPlacement {
+    kTaskStackInternal,     /**< 内部SRAM（フラッシュ操作を行うタスク、リアルタイム性が必要なタスク） */
+    kTaskStackPsram,        /**< PSRAM（フラッシュのキャッシュ無効中は動けないため、NVSやOTAの書き込みは不可） */
+};
+
+/**
+ * @brief 配置表からタスクのスタック配置先を取得
+ * @param name タスク名（"bg_worker_0" のような連番の接尾辞は無視して照合する）
+ */
+TaskStackPlacement GetTaskStackPlacement(const char* name);
+
+/**
+ * @brief 配置表と上書きからタスクの実行コアを取得
+ * @param name タスク名（上書きは "bg_worker_0" のような完全一致を連番なしの名前より優先する）
+ * @param default_core 配置表にないか、表が呼び出し元に任せているときのコア（-1: コア指定なし）
+ * @return 実行コア（-1: コア指定なし）
+ */
+int GetTaskCore(const char* name, int default_core);
+
+/** @brief NVSに保存したコアの上書きを読み込む（NVSの初期化後、最初のタスク作成より前に1回呼ぶ） */
+void LoadTaskCoreOverrides();
+
+/**
+ * @brief タスクの実行コアの上書きを保存（次の起動から有効）
+ * @param core 実行コア（-1: コア指定なし、-2: 上書きを削除）
+ * @return タスク名かコアが不正なときfalse
+ */
+bool SetTaskCoreOverride(const std::string& name, int core);
+
+/**
+ * @brief 配置表と各コアの負荷をJSON形式で取得（MCPツール用）
+ *
+ * 配置表の各タスクのコアとその出どころ（Kconfig/上書き/呼び出し元）に加え、
+ * CONFIG_USE_PERF_MONITORが有効なら、最新のサンプルのコアごとの負荷、固定されていない
+ * タスクの負荷、実際のコアが配置表と異なるタスクを返します。
+ */
+std::string GetTaskPlacementJson();
+
+#if CONFIG_TASK_PLACEMENT_VALIDATE
+/** @brief コアごとの負荷をログに出し、配置表との不一致と偏りを警告する */
+void LogTaskPlacement();
+#endif
+
+/**
+ * @brief 配置表に従ってタスクを作成
+ * @param core_id 配置表にないときの実行コア（-1: コア指定なし）
+ * @return xTaskCreatePinnedToCoreと同じ（PSRAMに確保できない場合は内部SRAMで作成する）
+ */
+BaseType_t CreateTask(TaskFunction_t function, const char* name, uint32_t stack_size, void* arg,
+    UBaseType_t priority, TaskHandle_t* handle = nullptr, int core_id = -1);
+
+/**
+ * @brief CreateTask()で作成したタスクを他のタスクから削除する
+ *
+ * PSRAMに置いたスタックとTCBも解放します。PSRAMに置くタスクは常駐するものに限るため、
+ * タスク自身の vTaskDelete(NULL) は使いません。
+ */
+void DeleteTask(TaskHandle_t handle);
+
+#endif // TASK_FACTORY_H
@@ -0,0 +1,164 @@
+/**
+ * @file thermal_monitor.cc
+ * @brief チップ温度に応じた温度段階の実装
+ */
+#include "thermal_monitor.h"
+#include "board.h"
+#include "camera.h"
+#include "power_profile.h"
+#include "lvgl_port_config.h"
+#if CONFIG_USE_METRICS
+#include "metrics.h"
+#endif
+
+#include <algorithm>
+#include <climits>
+#include <cJSON.h>
+#include <esp_log.h>
+
+#define TAG "ThermalMonitor"
+
+#if CONFIG_USE_METRICS
+static MetricCallback metric_chip_temperature("xiaozhi_chip_temperature_celsius",
+    "Chip temperature reported by the board", kMetricGauge, [](MetricSink& sink) {
+        float celsius;
+        if (ThermalMonitor::GetInstance().temperature(celsius)) {
+            sink.Sample("", "", celsius);
+        }
+    });
+static MetricCallback metric_thermal_level("xiaozhi_thermal_level",
+    "Thermal level chosen from the chip temperature (0: normal, 1: warm, 2: hot, 3: critical)", kMetricGauge,
+    [](MetricSink& sink) {
+        sink.Sample("", "", ThermalMonitor::GetInstance().level());
+    });
+#endif
+
+bool ThermalMonitor::Sample() {
+    float celsius;
+    if (!Board::GetInstance().GetTemperature(celsius)) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    celsius_ = celsius;
+    max_celsius_ = valid_ ? std::max(max_celsius_, celsius) : celsius;
+    valid_ = true;
+    ThermalLevel target = Evaluate(celsius);
+    if (target == level_) {
+        return false;
+    }
+    if (target > level_) {
+        ESP_LOGW(TAG, "Level %s -> %s (%.1f C)", Name(level_), Name(target), celsius);
+    } else {
+        ESP_LOGI(TAG, "Level %s -> %s (%.1f C)", Name(level_), Name(target), celsius);
+    }
+    level_ = target;
+    return true;
+}
+
+void ThermalMonitor::Apply() {
+    auto limits = this->limits();
+    LvglRenderMonitor::GetInstance().SetRefreshPeriod(kLvglRefreshLimitThermal, limits.refresh_period_ms);
+    PowerProfile::GetInstance().SetMaxFreqLimit(limits.max_cpu_mhz);
+    if (!limits.camera_preview) {
+        auto camera = Board::GetInstance().GetCamera();
+        if (camera != nullptr) {
+            camera->StopViewfinder();
+        }
+    }
+}
+
+ThermalLevel ThermalMonitor::level() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return level_;
+}
+
+bool ThermalMonitor::temperature(float& celsius) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    celsius = celsius_;
+    return valid_;
+}
+
+int ThermalMonitor::Threshold(ThermalLevel level) {
+    switch (level) {
+        case kThermalLevelWarm:
+            return CONFIG_THERMAL_WARM_CELSIUS;
+        case kThermalLevelHot:
+            return CONFIG_THERMAL_HOT_CELSIUS;
+        case kThermalLevelCritical:
+            return CONFIG_THERMAL_CRITICAL_CELSIUS;
+        case kThermalLevelNormal:
+        default:
+            return INT_MIN;
+    }
+}
+
+ThermalLevel ThermalMonitor::Evaluate(float celsius) const {
+    // 上の段階へはしきい値ですぐ移り、今の段階以下へはヒステリシス分だけ下がるまで留まる
+    int level = kThermalLevelNormal;
+    for (int i = kThermalLevelWarm; i <= kThermalLevelCritical; ++i) {
+        int threshold = Threshold((ThermalLevel)i);
+        if (i <= level_) {
+            threshold -= CONFIG_THERMAL_HYSTERESIS_CELSIUS;
+        }
+        if (celsius >= threshold) {
+            level = i;
+        }
+    }
+    return (ThermalLevel)level;
+}
+
+ThermalLimits ThermalMonitor::Limits(ThermalLevel level) {
+    switch (level) {
+        case kThermalLevelWarm:
+            return {THERMAL_WARM_REFRESH_MS, false, 0, true};
+        case kThermalLevelHot:
+            return {THERMAL_HOT_REFRESH_MS, true, CONFIG_THERMAL_HOT_CPU_FREQ_MHZ, true};
+        case kThermalLevelCritical:
+            return {THERMAL_HOT_REFRESH_MS, true, CONFIG_THERMAL_HOT_CPU_FREQ_MHZ, false};
+        case kThermalLevelNormal:
+        default:
+            return {0, false, 0, true};
+    }
+}
+
+const char* ThermalMonitor::Name(ThermalLevel level) {
+    switch (level) {
+        case kThermalLevelWarm:
+            return "warm";
+        case kThermalLevelHot:
+            return "hot";
+        case kThermalLevelCritical:
+            return "critical";
+        case kThermalLevelNormal:
+        default:
+            return "normal";
+    }
+}
+
+std::string ThermalMonitor::ToJson() {
+    auto root = cJSON_CreateObject();
+    ThermalLevel current;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        current = level_;
+        cJSON_AddStringToObject(root, "level", Name(current));
+        if (valid_) {
+            cJSON_AddNumberToObject(root, "temperature", celsius_);
+            cJSON_AddNumberToObject(root, "max_temperature", max_celsius_);
+        } else {
+            cJSON_AddNullToObject(root, "temperature");
+        }
+    }
+    auto limits = Limits(current);
+    auto json_limits = cJSON_CreateObject();
+    cJSON_AddNumberToObject(json_limits, "refresh_period_ms", limits.refresh_period_ms);
+    cJSON_AddBoolToObject(json_limits, "afe_low_cost", limits.afe_low_cost);
+    cJSON_AddNumberToObject(json_limits, "max_cpu_mhz", limits.max_cpu_mhz);
+    cJSON_AddBoolToObject(json_limits, "camera_preview", limits.camera_preview);
+    cJSON_AddItemToObject(root, "limits", json_limits);
+    auto json_str = cJSON_PrintUnformatted(root);
+    std::string json(json_str);
+    cJSON_free(json_str);
+    cJSON_Delete(root);
+    return json;
+}
@@ -0,0 +1,90 @@
+/**
+ * @file thermal_monitor.h
+ * @brief チップ温度に応じて負荷を段階的に下げるサーマルモニター
+ *
+ * Board::GetTemperature()の温度から4段階の温度段階（通常 / 温暖 / 高温 / 危険）を決め、
+ * 段階が上がるごとにLVGLの描画周期を延ばし、自動モードのAFEプロファイルを低負荷にし、
+ * CPUの最大周波数を下げ、カメラのプレビューを止めます。温度はすぐに上の段階へ移し、
+ * 下の段階へはしきい値よりヒステリシス分だけ下がってから戻します。
+ */
+#ifndef THERMAL_MONITOR_H
+#define THERMAL_MONITOR_H
+
+#include <mutex>
+#include <string>
+
+/** @brief 温暖段階でのLVGLの描画周期（ミリ秒） */
+#define THERMAL_WARM_REFRESH_MS 50
+
+/** @brief 高温段階以上でのLVGLの描画周期（ミリ秒） */
+#define THERMAL_HOT_REFRESH_MS 100
+
+enum ThermalLevel {
+    kThermalLevelNormal,    // 制限なし
+    kThermalLevelWarm,      // 描画周期を延ばす
+    kThermalLevelHot,       // さらにAFEを低負荷にし、CPUの最大周波数を下げる
+    kThermalLevelCritical,  // さらにカメラのプレビューを止める
+};
+
+/** @brief 温度段階ごとの各サブシステムの上限 */
+struct ThermalLimits {
+    int refresh_period_ms;      /**< LVGLの描画周期（0はKconfigの既定） */
+    bool afe_low_cost;          /**< 自動モードのAFEを低負荷にするか */
+    int max_cpu_mhz;            /**< CPUの最大周波数（0は上限なし） */
+    bool camera_preview;        /**< カメラのプレビューを使えるか */
+};
+
+/**
+ * @class ThermalMonitor
+ * @brief 温度段階のシングルトン
+ *
+ * Sample()はクロックタイマーから CONFIG_THERMAL_SAMPLE_SECONDS ごとに呼び出し、
+ * trueが返ったらApply()をメインタスクで呼び出してください（LVGLのロックを取るため）。
+ */
+class ThermalMonitor {
+public:
+    static ThermalMonitor& GetInstance() {
+        static ThermalMonitor instance;
+        return instance;
+    }
+
+    ThermalMonitor(const ThermalMonitor&) = delete;
+    ThermalMonitor& operator=(const ThermalMonitor&) = delete;
+
+    /** @brief 温度を読み、段階が変わった場合true */
+    bool Sample();
+
+    /** @brief 描画周期、CPU周波数、カメラへ現在の段階を反映（メインタスクから呼ぶ） */
+    void Apply();
+
+    ThermalLevel level();
+
+    /** @brief 直近の温度（摂氏）。読めていない場合false */
+    bool temperature(float& celsius);
+
+    /** @brief 現在の段階の上限 */
+    ThermalLimits limits() { return Limits(level()); }
+
+    static ThermalLimits Limits(ThermalLevel level);
+    static const char* Name(ThermalLevel level);
+
+    /** @brief 段階、温度、最高温度と各上限をJSONで取得 */
+    std::string ToJson();
+
+private:
+    ThermalMonitor() = default;
+
+    /** @brief 温度から段階を決める（現在の段階を基準にヒステリシスをかける） */
+    ThermalLevel Evaluate(float celsius) const;
+
+    /** @brief 段階に入るしきい値（摂氏） */
+    static int Threshold(ThermalLevel level);
+
+    std::mutex mutex_;
+    ThermalLevel level_ = kThermalLevelNormal;
+    bool valid_ = false;                /**< 温度を読めたことがある */
+    float celsius_ = 0;                 /**< 直近の温度 */
+    float max_celsius_ = 0;             /**< 起動後の最高温度 */
+};
+
+#endif // THERMAL_MONITOR_H
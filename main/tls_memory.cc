@@ -0,0 +1,87 @@
+/**
+ * @file tls_memory.cc
+ * @brief mbedTLSのカスタムアロケータ（esp_mbedtls_mem_calloc / esp_mbedtls_mem_free）の実装
+ */
+#include "tls_memory.h"
+#if CONFIG_USE_METRICS
+#include "metrics.h"
+#endif
+
+#include <esp_heap_caps.h>
+#include <esp_memory_utils.h>
+
+#include <atomic>
+
+namespace {
+
+std::atomic<size_t> s_internal{0};
+std::atomic<size_t> s_psram{0};
+std::atomic<size_t> s_internal_peak{0};
+
+void Account(void* ptr, bool allocated) {
+    size_t size = heap_caps_get_allocated_size(ptr);
+    auto& counter = esp_ptr_external_ram(ptr) ? s_psram : s_internal;
+    if (!allocated) {
+        counter.fetch_sub(size, std::memory_order_relaxed);
+        return;
+    }
+    size_t total = counter.fetch_add(size, std::memory_order_relaxed) + size;
+    if (&counter == &s_internal) {
+        size_t peak = s_internal_peak.load(std::memory_order_relaxed);
+        while (total > peak && !s_internal_peak.compare_exchange_weak(peak, total, std::memory_order_relaxed)) {
+        }
+    }
+}
+
+} // namespace
+
+#if CONFIG_USE_METRICS
+static MetricCallback metric_tls_heap("xiaozhi_tls_heap_bytes",
+    "Heap held by mbedTLS per memory region", kMetricGauge, [](MetricSink& sink) {
+        sink.Sample("", "region=\"internal\"", s_internal.load(std::memory_order_relaxed));
+        sink.Sample("", "region=\"psram\"", s_psram.load(std::memory_order_relaxed));
+    });
+static MetricCallback metric_tls_internal_peak("xiaozhi_tls_internal_peak_bytes",
+    "Highest internal heap held by mbedTLS since boot", kMetricGauge, [](MetricSink& sink) {
+        sink.Sample("", "", s_internal_peak.load(std::memory_order_relaxed));
+    });
+#endif
+
+extern "C" void* esp_mbedtls_mem_calloc(size_t n, size_t size) {
+    size_t bytes = n * size;
+    bool large = bytes >= CONFIG_TLS_PSRAM_THRESHOLD;
+    bool internal_low = heap_caps_get_free_size(MALLOC_CAP_INTERNAL) < CONFIG_TLS_INTERNAL_RESERVE_KB * 1024;
+    void* ptr;
+    if (large || internal_low) {
+        ptr = heap_caps_calloc_prefer(n, size, 2, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT,
+            MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    } else {
+        ptr = heap_caps_calloc_prefer(n, size, 2, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT,
+            MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    }
+    if (ptr != nullptr) {
+        Account(ptr, true);
+    }
+    return ptr;
+}
+
+extern "C" void esp_mbedtls_mem_free(void* ptr) {
+    if (ptr == nullptr) {
+        return;
+    }
+    Account(ptr, false);
+    heap_caps_free(ptr);
+}
+
+namespace tls_memory {
+
+void GetUsage(size_t& internal, size_t& psram) {
+    internal = s_internal.load(std::memory_order_relaxed);
+    psram = s_psram.load(std::memory_order_relaxed);
+}
+
+size_t GetInternalPeak() {
+    return s_internal_peak.load(std::memory_order_relaxed);
+}
+
+} // namespace tls_memory
@@ -0,0 +1,33 @@
+/**
+ * @file tls_memory.h
+ * @brief mbedTLSの確保先を大きさで振り分けるアロケータ
+ *
+ * TLS接続ごとのレコードバッファ（受信16KB強、送信はCONFIG_MBEDTLS_SSL_OUT_CONTENT_LEN）は、
+ * 待機接続やkeep-aliveのプールで同時に複数存在すると内部SRAMを大きく占め、音声処理の確保を
+ * 失敗させます。CONFIG_MBEDTLS_CUSTOM_MEM_ALLOC を有効にすると、mbedTLSの確保はすべてここを通り、
+ * CONFIG_TLS_PSRAM_THRESHOLD 以上の確保（レコードバッファ、証明書）はPSRAMに、
+ * 小さな確保（多倍長整数、コンテキスト）はハンドシェイクの速度のため内部SRAMに置きます。
+ * 内部SRAMの空きが CONFIG_TLS_INTERNAL_RESERVE_KB を下回ったら小さな確保もPSRAMへ回します。
+ *
+ * 設定は sdkconfig.defaults.tls_memory にまとめています（動的バッファ、送信レコード長の縮小を含む）。
+ */
+#ifndef TLS_MEMORY_H
+#define TLS_MEMORY_H
+
+#include <cstddef>
+
+namespace tls_memory {
+
+/**
+ * @brief 現在mbedTLSが保持しているバイト数
+ * @param internal 内部SRAMの分
+ * @param psram PSRAMの分
+ */
+void GetUsage(size_t& internal, size_t& psram);
+
+/** @brief 起動から現在までの内部SRAMの最大保持量 */
+size_t GetInternalPeak();
+
+} // namespace tls_memory
+
+#endif // TLS_MEMORY_H
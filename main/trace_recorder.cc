@@ -0,0 +1,133 @@
+/**
+ * @file trace_recorder.cc
+ * @brief スパンの記録とChromeトレース形式での出力の実装
+ */
+#include "trace_recorder.h"
+
+#if CONFIG_USE_DEBUG_HTTP_SERVER
+#include "debug_http_server.h"
+#endif
+
+#include <esp_heap_caps.h>
+#include <esp_log.h>
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#define TAG "TraceRecorder"
+
+/** @brief 出力時にまとめて書き出す単位（バイト） */
+#define TRACE_EXPORT_CHUNK_SIZE 2048
+
+void TraceRecorder::Start() {
+    if (spans_ != nullptr) {
+        return;
+    }
+    spans_ = (Span*)heap_caps_calloc(CONFIG_TRACE_BUFFER_SPANS, sizeof(Span), MALLOC_CAP_SPIRAM);
+    if (spans_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate %d spans", CONFIG_TRACE_BUFFER_SPANS);
+        return;
+    }
+    capacity_ = CONFIG_TRACE_BUFFER_SPANS;
+    recording_ = true;
+    ESP_LOGI(TAG, "Recording up to %d spans", CONFIG_TRACE_BUFFER_SPANS);
+#if CONFIG_USE_DEBUG_HTTP_SERVER
+    StartHttpServer();
+#endif
+}
+
+size_t TraceRecorder::Export(std::function<void(const char* data, size_t size)> sink) {
+    if (spans_ == nullptr) {
+        return 0;
+    }
+    // 書き出し中のスパンが上書きされないよう記録を止める。書き込み途中のスパンが落ち着くまで少し待つ
+    recording_ = false;
+    vTaskDelay(pdMS_TO_TICKS(1));
+
+    std::string buffer;
+    buffer.reserve(TRACE_EXPORT_CHUNK_SIZE + 256);
+    auto flush = [&](bool force) {
+        if (!buffer.empty() && (force || buffer.size() >= TRACE_EXPORT_CHUNK_SIZE)) {
+            sink(buffer.data(), buffer.size());
+            buffer.clear();
+        }
+    };
+    char line[192];
+
+    buffer += "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    bool first = true;
+    auto append = [&](int length) {
+        if (!first) {
+            buffer += ',';
+        }
+        first = false;
+        buffer.append(line, std::min<size_t>(length, sizeof(line) - 1));
+        flush(false);
+    };
+
+    // コアをプロセス、タスクをスレッドとして表示する
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        append(snprintf(line, sizeof(line),
+            "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"core %d\"}}", core, core));
+    }
+    UBaseType_t task_count = uxTaskGetNumberOfTasks() + 4;
+    std::vector<TaskStatus_t> tasks(task_count);
+    task_count = uxTaskGetSystemState(tasks.data(), task_count, nullptr);
+    for (UBaseType_t i = 0; i < task_count; i++) {
+        for (int core = 0; core < portNUM_PROCESSORS; core++) {
+            append(snprintf(line, sizeof(line),
+                "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%" PRIuPTR ",\"args\":{\"name\":\"%s\"}}",
+                core, (uintptr_t)tasks[i].xHandle, tasks[i].pcTaskName));
+        }
+    }
+
+    size_t total = next_.load();
+    size_t count = std::min(total, capacity_);
+    for (size_t i = total - count; i < total; i++) {
+        auto& span = spans_[i % capacity_];
+        append(snprintf(line, sizeof(line),
+            "{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%" PRId64 ",\"dur\":%" PRIu32 ",\"pid\":%u,\"tid\":%" PRIuPTR "}",
+            span.name, span.start_us, span.duration_us, span.core, (uintptr_t)span.task));
+    }
+    buffer += "]}";
+    flush(true);
+
+    next_ = 0;
+    recording_ = true;
+    return count;
+}
+
+size_t TraceRecorder::DumpToConsole() {
+    printf("TRACE_BEGIN\n");
+    size_t count = Export([](const char* data, size_t size) {
+        fwrite(data, 1, size, stdout);
+    });
+    printf("\nTRACE_END\n");
+    fflush(stdout);
+    ESP_LOGI(TAG, "Dumped %u spans", (unsigned)count);
+    return count;
+}
+
+#if CONFIG_USE_DEBUG_HTTP_SERVER
+void TraceRecorder::StartHttpServer() {
+    DebugHttpServer::GetInstance().RegisterHandler("/trace.json", [](httpd_req_t* req) -> esp_err_t {
+        auto recorder = static_cast<TraceRecorder*>(req->user_ctx);
+        httpd_resp_set_type(req, "application/json");
+        httpd_resp_set_hdr(req, "Content-Disposition", "attachment; filename=\"trace.json\"");
+        // 送信に失敗したら残りは捨てる（記録の再開はExport()が行う）
+        bool ok = true;
+        recorder->Export([req, &ok](const char* data, size_t size) {
+            if (ok && httpd_resp_send_chunk(req, data, size) != ESP_OK) {
+                ok = false;
+            }
+        });
+        if (!ok) {
+            return ESP_FAIL;
+        }
+        return httpd_resp_send_chunk(req, nullptr, 0);
+    }, this);
+}
+#endif
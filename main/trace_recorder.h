@@ -0,0 +1,113 @@
+/**
+ * @file trace_recorder.h
+ * @brief 実行区間（スパン）の記録とChromeトレース形式での出力
+ *
+ * AFEのfetch、Opusのエンコード・デコード、リサンプル、SendAudio、OnIncomingJson、LVGLのflush、
+ * MCPツールの呼び出しを TRACE_SPAN() で囲み、開始時刻・長さ・タスク・コアをPSRAMのリングに記録します。
+ * 内容はChromeのtrace event形式（chrome://tracing、Perfetto）で、診断用HTTPサーバー（DebugHttpServer）の
+ * GET /trace.json またはシリアルへのダンプ（MCPツール self.dump_trace）で取り出せます。
+ * コアごとにプロセスとして表示されるため、audio_loopやワーカーのコア割り当ての調整に使えます。
+ */
+#ifndef TRACE_RECORDER_H
+#define TRACE_RECORDER_H
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_timer.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+#if CONFIG_USE_TRACE_SPANS
+#define TRACE_SPAN_CONCAT_(a, b) a##b
+#define TRACE_SPAN_CONCAT(a, b) TRACE_SPAN_CONCAT_(a, b)
+/** @brief スコープの終わりまでをスパンとして記録（nameは文字列リテラル） */
+#define TRACE_SPAN(name) TraceSpanScope TRACE_SPAN_CONCAT(trace_span_, __LINE__)(name)
+#else
+#define TRACE_SPAN(name) do {} while (0)
+#endif
+
+/**
+ * @class TraceRecorder
+ * @brief スパンのリングバッファを持つシングルトン
+ *
+ * Record()は任意のタスクからロックなしで呼べます。出力中は記録を止めます。
+ */
+class TraceRecorder {
+public:
+    static TraceRecorder& GetInstance() {
+        static TraceRecorder instance;
+        return instance;
+    }
+
+    TraceRecorder(const TraceRecorder&) = delete;
+    TraceRecorder& operator=(const TraceRecorder&) = delete;
+
+    /** @brief リングを確保して記録を開始し、診断用HTTPサーバーに /trace.json を登録 */
+    void Start();
+
+    /** @brief スパンを記録 */
+    void Record(const char* name, int64_t start_us, int64_t end_us) {
+        if (!recording_.load(std::memory_order_relaxed)) {
+            return;
+        }
+        size_t index = next_.fetch_add(1, std::memory_order_relaxed) % capacity_;
+        auto& span = spans_[index];
+        span.name = name;
+        span.start_us = start_us;
+        span.duration_us = end_us - start_us;
+        span.task = xTaskGetCurrentTaskHandle();
+        span.core = xPortGetCoreID();
+    }
+
+    /**
+     * @brief 記録済みのスパンをChromeトレースのJSONとして書き出す
+     * @param sink 書き出し先（数百バイトずつ呼ばれる）
+     * @return 書き出したスパン数
+     */
+    size_t Export(std::function<void(const char* data, size_t size)> sink);
+
+    /** @brief シリアル（標準出力）へ書き出す。"TRACE_BEGIN"と"TRACE_END"の行で囲む */
+    size_t DumpToConsole();
+
+private:
+    TraceRecorder() = default;
+
+    struct Span {
+        const char* name;
+        int64_t start_us;
+        uint32_t duration_us;
+        TaskHandle_t task;
+        uint8_t core;
+    };
+
+    Span* spans_ = nullptr;             /**< CONFIG_TRACE_BUFFER_SPANS個のリング（PSRAM） */
+    size_t capacity_ = 1;
+    std::atomic<size_t> next_{0};
+    std::atomic<bool> recording_{false};
+
+    void StartHttpServer();
+};
+
+/**
+ * @class TraceSpanScope
+ * @brief コンストラクタからデストラクタまでをスパンとして記録
+ */
+class TraceSpanScope {
+public:
+    explicit TraceSpanScope(const char* name) : name_(name), start_us_(esp_timer_get_time()) {}
+    ~TraceSpanScope() {
+        TraceRecorder::GetInstance().Record(name_, start_us_, esp_timer_get_time());
+    }
+
+    TraceSpanScope(const TraceSpanScope&) = delete;
+    TraceSpanScope& operator=(const TraceSpanScope&) = delete;
+
+private:
+    const char* name_;
+    int64_t start_us_;
+};
+
+#endif // TRACE_RECORDER_H
@@ -0,0 +1,185 @@
+#include "tts_cache.h"
+#if CONFIG_USE_MEMORY_BUDGET
+#include "memory_budget.h"
+#endif
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+
+#include <algorithm>
+#include <cstring>
+
+#define TAG "TtsCache"
+
+/** @brief 1エントリの最大サイズ（バイト）。長い応答はキャッシュしない */
+#define TTS_CACHE_MAX_ENTRY_SIZE (CONFIG_TTS_CACHE_MAX_ENTRY_KB * 1024)
+
+/** @brief バッファを拡張する単位（バイト） */
+#define TTS_CACHE_GROW_SIZE 2048
+
+TtsCache::TtsCache() {
+#if CONFIG_USE_MEMORY_BUDGET
+    budget_id_ = MemoryBudget::GetInstance().Register("tts", kMemoryPoolPsram, kMemoryPriorityNormal,
+        [this]() { return total_size_; },
+        [this](size_t bytes) { return Shrink(bytes); });
+#endif
+}
+
+TtsCache::~TtsCache() {
+#if CONFIG_USE_MEMORY_BUDGET
+    MemoryBudget::GetInstance().Unregister(budget_id_);
+#endif
+    for (auto& entry : entries_) {
+        Free(entry);
+    }
+    Free(recording_);
+}
+
+std::string TtsCache::MakeKey(const std::string& text) {
+    uint32_t hash = 2166136261u;
+    for (unsigned char c : text) {
+        hash = (hash ^ c) * 16777619u;
+    }
+    char key[9];
+    snprintf(key, sizeof(key), "%08lx", (unsigned long)hash);
+    return key;
+}
+
+void TtsCache::Free(Entry& entry) {
+    heap_caps_free(entry.data);
+    entry.data = nullptr;
+    entry.size = 0;
+    entry.capacity = 0;
+}
+
+bool TtsCache::Play(const std::string& key, int sample_rate, std::function<void(const AudioStreamView& view)> callback) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+        if (it->key != key) {
+            continue;
+        }
+        if (it->sample_rate != sample_rate) {
+            return false;
+        }
+        entries_.splice(entries_.begin(), entries_, it);
+        auto& entry = entries_.front();
+        size_t offset = 0;
+        while (offset + 2 <= entry.size) {
+            size_t size = (entry.data[offset] << 8) | entry.data[offset + 1];
+            offset += 2;
+            callback(AudioStreamView{
+                .timestamp = 0,
+                .payload = entry.data + offset,
+                .payload_size = size
+            });
+            offset += size;
+        }
+        return true;
+    }
+    return false;
+}
+
+void TtsCache::BeginRecording(const std::string& key, int sample_rate) {
+    EndRecording();
+    std::lock_guard<std::mutex> lock(mutex_);
+    recording_.key = key;
+    recording_.sample_rate = sample_rate;
+    recording_.size = 0;
+    recording_active_ = true;
+}
+
+bool TtsCache::Append(Entry& entry, const uint8_t* payload, size_t size) {
+    size_t needed = entry.size + 2 + size;
+    if (size > UINT16_MAX || needed > TTS_CACHE_MAX_ENTRY_SIZE) {
+        return false;
+    }
+    if (needed > entry.capacity) {
+        size_t capacity = std::min<size_t>(needed + TTS_CACHE_GROW_SIZE, TTS_CACHE_MAX_ENTRY_SIZE);
+        auto data = (uint8_t*)heap_caps_realloc(entry.data, capacity, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        if (data == nullptr) {
+            return false;
+        }
+        entry.data = data;
+        entry.capacity = capacity;
+    }
+    entry.data[entry.size] = size >> 8;
+    entry.data[entry.size + 1] = size & 0xff;
+    memcpy(entry.data + entry.size + 2, payload, size);
+    entry.size = needed;
+    return true;
+}
+
+void TtsCache::Record(const AudioStreamView& view) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!recording_active_ || view.payload_size == 0) {
+        return;
+    }
+    if (!Append(recording_, view.payload, view.payload_size)) {
+        // 長すぎる応答やメモリ不足は記録をやめる（次の文から再開する）
+        recording_active_ = false;
+        recording_.size = 0;
+    }
+}
+
+void TtsCache::EndRecording() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!recording_active_) {
+        return;
+    }
+    recording_active_ = false;
+    if (recording_.size == 0) {
+        return;
+    }
+    for (auto& entry : entries_) {
+        if (entry.key == recording_.key) {
+            // 再生中に同じ文が記録された場合（サーバーが省略しなかった）は既存を残す
+            recording_.size = 0;
+            return;
+        }
+    }
+
+    // 確保しすぎた分を返してから入れる
+    auto data = (uint8_t*)heap_caps_realloc(recording_.data, recording_.size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (data != nullptr) {
+        recording_.data = data;
+        recording_.capacity = recording_.size;
+    }
+    Evict(recording_.capacity);
+    total_size_ += recording_.capacity;
+    ESP_LOGI(TAG, "Cached %s (%u bytes), %u entries, %u bytes total", recording_.key.c_str(),
+        (unsigned)recording_.size, (unsigned)entries_.size() + 1, (unsigned)total_size_);
+    entries_.push_front(std::move(recording_));
+    recording_ = Entry();
+}
+
+void TtsCache::CancelRecording() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    recording_active_ = false;
+    recording_.size = 0;
+}
+
+void TtsCache::Evict(size_t incoming) {
+    while (!entries_.empty() && total_size_ + incoming > CONFIG_TTS_CACHE_SIZE_KB * 1024) {
+        auto& entry = entries_.back();
+        total_size_ -= entry.capacity;
+        Free(entry);
+        entries_.pop_back();
+    }
+}
+
+size_t TtsCache::Shrink(size_t bytes) {
+    // 受信タスクが記録中ならロックを待たずに諦める（Reclaimはブロックしてはいけない）
+    std::unique_lock<std::mutex> lock(mutex_, std::try_to_lock);
+    if (!lock.owns_lock()) {
+        return 0;
+    }
+    size_t freed = 0;
+    while (!entries_.empty() && freed < bytes) {
+        auto& entry = entries_.back();
+        freed += entry.capacity;
+        total_size_ -= entry.capacity;
+        Free(entry);
+        entries_.pop_back();
+    }
+    return freed;
+}
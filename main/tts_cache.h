@@ -0,0 +1,82 @@
+/**
+ * @file tts_cache.h
+ * @brief 繰り返し届くTTS音声のキャッシュ
+ *
+ * 挨拶や確認、エラーの案内のように同じ短い応答は、毎回サーバーから同じOpusが送られてきます。
+ * sentence_startの文（またはサーバーが付けたid）をキーに下りのOpusパケットをPSRAMに保存し、
+ * 次に同じ文が来たときは端末上で再生して、サーバーにはその文の音声の送信を省いてもらいます。
+ */
+#ifndef TTS_CACHE_H
+#define TTS_CACHE_H
+
+#include "protocol.h"
+
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <string>
+
+/**
+ * @class TtsCache
+ * @brief 文ごとのOpusパケット列をLRUで保持するキャッシュ
+ *
+ * 記録と再生は受信タスクから呼ばれます。エントリの合計が CONFIG_TTS_CACHE_SIZE_KB を
+ * 超えると、最も長く使われていないものから破棄します。
+ */
+class TtsCache {
+public:
+    TtsCache();
+    ~TtsCache();
+
+    /** @brief 文からキーを作る（FNV-1aの16進表記） */
+    static std::string MakeKey(const std::string& text);
+
+    /**
+     * @brief キャッシュ済みの音声を先頭から順に渡す
+     * @param sample_rate 現在の下り音声のサンプリングレート（異なるエントリは使わない）
+     * @return 見つかった場合true
+     */
+    bool Play(const std::string& key, int sample_rate, std::function<void(const AudioStreamView& view)> callback);
+
+    /** @brief 文の音声の記録を始める（記録中のものは確定する） */
+    void BeginRecording(const std::string& key, int sample_rate);
+
+    /** @brief 受信した音声パケットを記録中のエントリに追加 */
+    void Record(const AudioStreamView& view);
+
+    /** @brief 記録中のエントリを確定してキャッシュに入れる */
+    void EndRecording();
+
+    /** @brief 記録中のエントリを捨てる（中断された文は保存しない） */
+    void CancelRecording();
+
+private:
+    struct Entry {
+        std::string key;
+        int sample_rate = 0;
+        uint8_t* data = nullptr;    /**< |size 2u|payload size|... の並び（PSRAM） */
+        size_t size = 0;
+        size_t capacity = 0;
+    };
+
+    std::mutex mutex_;
+    std::list<Entry> entries_;      /**< 先頭が最近使ったもの */
+    size_t total_size_ = 0;
+    Entry recording_;
+    bool recording_active_ = false;
+    int budget_id_ = -1;            /**< MemoryBudgetの登録ID */
+
+    /** @brief エントリのバッファに追記（上限を超える場合false） */
+    static bool Append(Entry& entry, const uint8_t* payload, size_t size);
+
+    /** @brief 合計が上限に収まるまで古いエントリを破棄 */
+    void Evict(size_t incoming);
+
+    /** @brief メモリ予算からの回収要求。古いエントリから破棄する */
+    size_t Shrink(size_t bytes);
+
+    static void Free(Entry& entry);
+};
+
+#endif // TTS_CACHE_H
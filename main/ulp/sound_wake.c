@@ -0,0 +1,65 @@
+/**
+ * @file sound_wake.c
+ * @brief ULP-RISC-Vで動く音の検出（ディープスリープ中の待機用）
+ *
+ * メインCPUがディープスリープしている間、ULPタイマーで周期的に起動し、
+ * ADC1のチャンネル（アナログマイクやサウンドセンサーの出力）を短く連続で読みます。
+ * 直流分からの平均絶対偏差が threshold を trigger_runs 回続けて超えたらメインCPUを起こします。
+ * 変数はメインCPUから ulp_<名前> として読み書きします（sound_wake_standby.cc）。
+ */
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "ulp_riscv_utils.h"
+#include "ulp_riscv_adc_ulp_core.h"
+
+/** @brief 1回の起動で読むサンプル数 */
+#define SAMPLES_PER_RUN 32
+
+/* メインCPUが設定する */
+uint32_t channel;       /**< ADC1のチャンネル */
+uint32_t threshold;     /**< 平均絶対偏差のしきい値（ADCの生値） */
+uint32_t trigger_runs;  /**< 連続で超えたらメインCPUを起こす回数 */
+
+/* ULPが更新する */
+int32_t baseline;       /**< 直流分（16倍の固定小数点、0なら未初期化） */
+uint32_t level;         /**< 直近の平均絶対偏差 */
+uint32_t runs_over;     /**< しきい値を連続で超えた回数 */
+uint32_t wake_level;    /**< メインCPUを起こしたときの平均絶対偏差 */
+
+int main(void)
+{
+    int32_t samples[SAMPLES_PER_RUN];
+    int32_t sum = 0;
+    for (int i = 0; i < SAMPLES_PER_RUN; i++) {
+        samples[i] = ulp_riscv_adc_read_channel(ADC_UNIT_1, channel);
+        sum += samples[i];
+    }
+    int32_t mean = sum / SAMPLES_PER_RUN;
+    if (baseline == 0) {
+        baseline = mean << 4;
+    }
+
+    int32_t center = baseline >> 4;
+    uint32_t deviation = 0;
+    for (int i = 0; i < SAMPLES_PER_RUN; i++) {
+        deviation += abs(samples[i] - center);
+    }
+    level = deviation / SAMPLES_PER_RUN;
+
+    // 直流分はゆっくり追従させ、温度などによるずれを吸収する
+    baseline += ((mean << 4) - baseline) >> 4;
+
+    if (level > threshold) {
+        if (++runs_over >= trigger_runs) {
+            wake_level = level;
+            runs_over = 0;
+            ulp_riscv_wakeup_main_processor();
+        }
+    } else {
+        runs_over = 0;
+    }
+
+    // 戻ると停止し、次のULPタイマーで再び起動する
+    return 0;
+}
@@ -0,0 +1,104 @@
+#!/usr/bin/env python3
+"""音声パイプラインのタップ（CONFIG_USE_AUDIO_TAP）をUDPで受信してWAVに保存する
+
+端末の main/audio_processing/audio_tap.h の形式のデータグラムを受け取り、段ごとに
+<出力先>/<段>.wav へ書き込む。連番の欠け（端末側のリングあふれ、UDPの欠落）は
+その長さの無音で埋めるため、段の間で時刻をそろえて比較できる。
+各データグラムの連番と時刻は <出力先>/<段>.csv に残す（段の間の遅延の確認用）。
+
+例:
+    python scripts/audio_tap_receiver.py -o taps
+    （端末側は CONFIG_AUDIO_TAP_HOST を設定するか、MCPツール self.audio_tap.configure を使う）
+    Ctrl+C で終了すると段ごとの受信数と欠落数を表示する
+"""
+import argparse
+import os
+import socket
+import struct
+import wave
+
+MAGIC = 0x4154
+HEADER = struct.Struct("<HBBIQIHH")
+POINT_NAMES = ["mic_raw", "reference", "resampled", "afe_output", "decoded", "speaker"]
+
+
+class PointWriter:
+    """1段分のWAVとCSV"""
+
+    def __init__(self, directory, name, sample_rate, channels):
+        self.name = name
+        self.sample_rate = sample_rate
+        self.channels = channels
+        self.wav = wave.open(os.path.join(directory, name + ".wav"), "wb")
+        self.wav.setnchannels(channels)
+        self.wav.setsampwidth(2)
+        self.wav.setframerate(sample_rate)
+        self.csv = open(os.path.join(directory, name + ".csv"), "w", encoding="utf-8")
+        self.csv.write("sequence,timestamp_us,samples\n")
+        self.next_sequence = None
+        self.last_samples = 0
+        self.received = 0
+        self.lost = 0
+
+    def write(self, sequence, timestamp_us, samples, pcm):
+        if self.next_sequence is not None and sequence != self.next_sequence:
+            missing = (sequence - self.next_sequence) & 0xFFFFFFFF
+            if missing < 0x80000000:
+                # 欠けた分は直前と同じ長さとみなして無音で埋める
+                self.lost += missing
+                self.wav.writeframes(b"\0" * (missing * self.last_samples * 2 * self.channels))
+        self.next_sequence = (sequence + 1) & 0xFFFFFFFF
+        self.last_samples = samples
+        self.received += 1
+        self.wav.writeframes(pcm)
+        self.csv.write("{},{},{}\n".format(sequence, timestamp_us, samples))
+
+    def close(self):
+        self.wav.close()
+        self.csv.close()
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Receive audio tap streams and save them as WAV")
+    parser.add_argument("-o", "--output", default="audio_taps", help="输出目录")
+    parser.add_argument("--port", type=int, default=9930, help="UDP 端口（CONFIG_AUDIO_TAP_PORT）")
+    args = parser.parse_args()
+
+    os.makedirs(args.output, exist_ok=True)
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 4 * 1024 * 1024)
+    sock.bind(("0.0.0.0", args.port))
+    print("Listening on UDP port {}, writing to {}".format(args.port, args.output))
+
+    writers = {}
+    try:
+        while True:
+            data, _ = sock.recvfrom(2048)
+            if len(data) < HEADER.size:
+                continue
+            magic, point, channels, sequence, timestamp_us, sample_rate, samples, _ = HEADER.unpack_from(data)
+            if magic != MAGIC or point >= len(POINT_NAMES):
+                continue
+            pcm = data[HEADER.size:HEADER.size + samples * 2]
+            writer = writers.get(point)
+            if writer is None or writer.sample_rate != sample_rate or writer.channels != channels:
+                if writer is not None:
+                    # 形式が変わったら別のファイルにする
+                    writer.close()
+                    name = "{}_{}".format(POINT_NAMES[point], timestamp_us)
+                else:
+                    name = POINT_NAMES[point]
+                writer = PointWriter(args.output, name, sample_rate, channels)
+                writers[point] = writer
+                print("{}: {} Hz, {} ch".format(name, sample_rate, channels))
+            writer.write(sequence, timestamp_us, samples // channels, pcm)
+    except KeyboardInterrupt:
+        pass
+    finally:
+        for writer in writers.values():
+            print("{:<12} received {:>8}  lost {:>6}".format(writer.name, writer.received, writer.lost))
+            writer.close()
+
+
+if __name__ == "__main__":
+    main()
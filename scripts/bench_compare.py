@@ -0,0 +1,142 @@
+#!/usr/bin/env python3
+"""音声パイプライン（CONFIG_AUDIO_BENCHMARK_MODE）、表示（CONFIG_DISPLAY_BENCHMARK_MODE）、
+JSONの組み立て（CONFIG_SERIALIZATION_BENCHMARK_MODE）のベンチマーク、ネットワーク計測
+（self.network.run_benchmark）の結果を基準値と比較する
+
+シリアルログから "BENCH {json}" 行を抜き出し、ケースとパラメータが一致する基準値と
+中央値のサイクル数を比較する。しきい値を超えて遅くなったケースがあれば終了コード1を返すため、
+リリース前のチェックに使える。
+
+例:
+    idf.py monitor | tee bench.log
+    python scripts/bench_compare.py bench.log --save baseline.json
+    python scripts/bench_compare.py bench.log --baseline baseline.json --threshold 5
+    python scripts/bench_compare.py ui.log --baseline ui_baseline.json --metric refresh_p95_us
+    （表示のケースは描画バッファの設定が meta 行にあるため、設定の異なる結果同士も比較できる）
+    python scripts/bench_compare.py voice.log --baseline default_net.json --metric rtt_p99_us
+    （ネットワークプロファイルのA/B比較。meta 行にプロファイルとDSCPが出る）
+    python scripts/bench_compare.py bench.log --rank opus_encode_placement
+    （Opusの状態と作業領域の配置の組み合わせを速い順に並べ、ボードごとの設定を選ぶ）
+"""
+import argparse
+import json
+import sys
+
+PREFIX = "BENCH "
+
+
+def parse_log(path):
+    """ログからベンチマーク結果を {キー: 結果} で返す（meta/done行は除く）"""
+    results = {}
+    meta = None
+    with open(path, encoding="utf-8", errors="replace") as f:
+        for line in f:
+            pos = line.find(PREFIX)
+            if pos < 0:
+                continue
+            try:
+                entry = json.loads(line[pos + len(PREFIX):].strip())
+            except json.JSONDecodeError:
+                continue
+            case = entry.get("case")
+            if case == "meta":
+                meta = entry
+            elif case != "done":
+                results[case_key(entry)] = entry
+    return meta, results
+
+
+def case_key(entry):
+    params = ",".join("{}={}".format(k, v) for k, v in sorted(entry.get("params", {}).items()))
+    return "{}[{}]".format(entry["case"], params)
+
+
+def compare(baseline, current, threshold, metric="cycles"):
+    """しきい値（%）を超えて遅くなったケースの数を返す（metric は cycles か cycles_max）"""
+    regressions = 0
+    print("{:<52} {:>10} {:>10} {:>8}".format("case", "baseline", "current", "delta"))
+    for key in sorted(current):
+        if metric not in current[key]:
+            continue    # 指標を持たない種類のケース（音声と表示の結果が混在する場合）
+        cycles = current[key][metric]
+        if key not in baseline:
+            print("{:<52} {:>10} {:>10} {:>8}".format(key, "-", cycles, "new"))
+            continue
+        base = baseline[key][metric]
+        delta = (cycles - base) * 100.0 / base if base else 0.0
+        mark = ""
+        if delta > threshold:
+            regressions += 1
+            mark = "  REGRESSION"
+        print("{:<52} {:>10} {:>10} {:>+7.1f}%{}".format(key, base, cycles, delta, mark))
+    for key in sorted(k for k in set(baseline) - set(current) if metric in baseline[k]):
+        print("{:<52} {:>10} {:>10} {:>8}".format(key, baseline[key][metric], "-", "missing"))
+    return regressions
+
+
+def rank(results, case, metric="cycles"):
+    """指定したケースの結果を指標の小さい順に表示する"""
+    entries = [e for e in results.values() if e["case"] == case and metric in e]
+    if not entries:
+        print("No {} results with {}".format(case, metric), file=sys.stderr)
+        return
+    entries.sort(key=lambda e: e[metric])
+    best = entries[0][metric]
+    print("{:<60} {:>10} {:>8}".format(case, metric, "vs best"))
+    for entry in entries:
+        params = ",".join("{}={}".format(k, v) for k, v in sorted(entry.get("params", {}).items()))
+        delta = (entry[metric] - best) * 100.0 / best if best else 0.0
+        print("{:<60} {:>10} {:>+7.1f}%".format(params, entry[metric], delta))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Compare audio/display benchmark results against a baseline")
+    parser.add_argument("log", help="包含 BENCH 行的串口日志")
+    parser.add_argument("--baseline", help="基准结果 JSON 文件")
+    parser.add_argument("--save", help="将本次结果保存为基准 JSON 文件")
+    parser.add_argument("--threshold", type=float, default=5.0, help="允许的指标增长百分比")
+    parser.add_argument("--metric", choices=["cycles", "cycles_max", "refresh_us", "refresh_p95_us", "render_us",
+                                             "flush_us", "lvgl_load", "peak_heap", "rtt_p50_us", "rtt_p99_us",
+                                             "jitter_us"], default="cycles",
+                        help="比较的指标：音频用例为周期数中位数或最大值（cache_pressure 用例用最大值比较抖动），"
+                             "界面用例（ui_*）为刷新耗时中位数/P95、渲染耗时、flush 耗时或 LVGL 占用率，"
+                             "JSON 用例也可比较堆峰值（peak_heap），网络用例（net_echo）为 RTT 与抖动")
+    parser.add_argument("--rank", metavar="CASE", help="按指标从小到大列出指定用例的所有参数组合（如 opus_encode_placement）")
+    args = parser.parse_args()
+
+    meta, results = parse_log(args.log)
+    if not results:
+        print("No BENCH lines found in {}".format(args.log), file=sys.stderr)
+        return 2
+    if meta:
+        print("version {} / idf {} / {} MHz".format(meta.get("version"), meta.get("idf"), meta.get("cpu_mhz")))
+        if "draw_buffer" in meta:
+            print("board {} / {}x{} / draw buffer {} {} lines x{} / refresh {} ms".format(
+                meta.get("board"), meta.get("width"), meta.get("height"), meta.get("draw_buffer"),
+                meta.get("buffer_lines"), 2 if meta.get("double_buffer") else 1, meta.get("refresh_period_ms")))
+        if "network_profile" in meta:
+            print("network profile {} / dscp {}".format(meta.get("network_profile"), meta.get("dscp")))
+
+    if args.rank:
+        rank(results, args.rank, args.metric)
+
+    if args.save:
+        with open(args.save, "w", encoding="utf-8") as f:
+            json.dump({"meta": meta, "results": results}, f, indent=2, sort_keys=True)
+        print("Saved {} cases to {}".format(len(results), args.save))
+
+    if args.baseline:
+        with open(args.baseline, encoding="utf-8") as f:
+            baseline = json.load(f)
+        base_meta = baseline.get("meta") or {}
+        if meta and base_meta.get("cpu_mhz") != meta.get("cpu_mhz"):
+            print("Warning: CPU frequency differs from baseline ({} MHz)".format(base_meta.get("cpu_mhz")))
+        regressions = compare(baseline["results"], results, args.threshold, args.metric)
+        if regressions:
+            print("{} case(s) regressed by more than {}%".format(regressions, args.threshold))
+            return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,82 @@
+#!/usr/bin/env python3
+"""アセットパーティション（CONFIG_USE_ASSET_PARTITION）用のバンドルを作成する
+
+入力ファイルをファイル名（ディレクトリを除く）で索引付けし、1つのバンドルにまとめる。
+同じ名前のファイルは後に指定したものを使う（言語ごとの音声で共通の音声を上書きできる）。
+バージョンを指定しない場合は内容のSHA-256の先頭8桁をバージョンにする。
+出力形式はmain/asset_bundle.hを参照。
+
+出力はassetsパーティションへ書き込むか（idf.py flash で自動的に書き込まれる）、
+アセットのOTA（CheckVersionの "assets"）で配信する。
+
+例:
+  python scripts/gen_asset_bundle.py main/assets/common/*.p3 main/assets/zh-CN/*.p3 \\
+      --version 1.0.0 -o assets.bin
+"""
+import argparse
+import hashlib
+import os
+import struct
+import zlib
+
+MAGIC = b"XZAS"
+FORMAT = 1
+HEADER_FORMAT = "<4sHHII16s"
+ENTRY_FORMAT = "<32sII"
+NAME_SIZE = 32
+ALIGN = 4
+DEFAULT_PARTITION_SIZE = 0x100000
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Generate the asset bundle")
+    parser.add_argument("inputs", nargs="+", help="打包的文件（以文件名为索引）")
+    parser.add_argument("-o", "--output", required=True, help="输出文件路径")
+    parser.add_argument("--version", default="", help="资源版本（最多16字节，默认取内容摘要）")
+    parser.add_argument("--partition-size", type=lambda v: int(v, 0), default=DEFAULT_PARTITION_SIZE,
+                        help="资源分区大小（超出时报错）")
+    args = parser.parse_args()
+
+    files = {}
+    for path in args.inputs:
+        name = os.path.basename(path)
+        if len(name.encode("utf-8")) >= NAME_SIZE:
+            raise ValueError("asset name too long: {}".format(name))
+        files[name] = path
+    version = args.version.encode("utf-8")
+    if len(version) > 16:
+        raise ValueError("version is longer than 16 bytes: {}".format(args.version))
+
+    names = sorted(files, key=lambda n: n.encode("utf-8"))
+    header_size = struct.calcsize(HEADER_FORMAT)
+    offset = header_size + struct.calcsize(ENTRY_FORMAT) * len(names)
+    index = b""
+    data = b""
+    for name in names:
+        with open(files[name], "rb") as f:
+            content = f.read()
+        padding = (-offset) % ALIGN
+        data += b"\0" * padding
+        offset += padding
+        index += struct.pack(ENTRY_FORMAT, name.encode("utf-8"), offset, len(content))
+        data += content
+        offset += len(content)
+
+    body = index + data
+    if not version:
+        # 未指定时用内容的摘要，内容不变则版本不变
+        version = hashlib.sha256(body).hexdigest()[:8].encode("ascii")
+    size = header_size + len(body)
+    if size > args.partition_size:
+        raise ValueError("bundle is {} bytes, partition is {} bytes".format(size, args.partition_size))
+    bundle = struct.pack(HEADER_FORMAT, MAGIC, FORMAT, len(names), size, zlib.crc32(body), version) + body
+
+    with open(args.output, "wb") as f:
+        f.write(bundle)
+    print("Generated {}: {} assets, {} bytes, version {}".format(
+        args.output, len(names), len(bundle), version.decode("utf-8")))
+    print("sha256: {}".format(hashlib.sha256(bundle).hexdigest()))
+
+
+if __name__ == "__main__":
+    main()
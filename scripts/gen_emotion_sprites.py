@@ -0,0 +1,109 @@
+#!/usr/bin/env python3
+"""表情アニメーション（CONFIG_USE_EMOTION_ANIMATION）用のスプライトのパックを作成する
+
+入力ディレクトリの <表情名>.gif（または <表情名>/ 以下の連番PNG）を指定の大きさに縮小し、
+各フレームをRGB565（--alphaならRGB565A8）へ変換してzlib圧縮し、1つのパックにまとめる。
+表情名はDisplay::SetEmotion()に渡される名前（happy、sad など）と同じにする。
+出力形式はmain/display/emotion_animation.hを参照。
+
+例:
+  python scripts/gen_emotion_sprites.py emotions/ --size 96 --alpha
+
+Pillow が必要（pip install pillow）。
+"""
+import argparse
+import glob
+import os
+import struct
+import zlib
+
+from PIL import Image, ImageSequence
+
+MAGIC = b"XZEM"
+VERSION = 1
+FORMAT_RGB565 = 0
+FORMAT_RGB565A8 = 1
+ENTRY_FORMAT = "<16sHHHHB3xI"
+DEFAULT_FRAME_MS = 100
+
+
+def load_frames(path):
+    """(RGBA画像のリスト, 1フレームのミリ秒) を返す"""
+    if os.path.isdir(path):
+        files = sorted(glob.glob(os.path.join(path, "*.png")))
+        return [Image.open(f).convert("RGBA") for f in files], DEFAULT_FRAME_MS
+    image = Image.open(path)
+    frames = [frame.convert("RGBA") for frame in ImageSequence.Iterator(image)]
+    return frames, int(image.info.get("duration", DEFAULT_FRAME_MS)) or DEFAULT_FRAME_MS
+
+
+def encode_frame(image, size, alpha, background):
+    image = image.resize((size, size), Image.LANCZOS)
+    if not alpha:
+        flat = Image.new("RGBA", image.size, background)
+        flat.alpha_composite(image)
+        image = flat
+    rgb = bytearray()
+    a8 = bytearray()
+    for r, g, b, a in image.getdata():
+        # LVGLのRGB565はリトルエンディアン
+        rgb += struct.pack("<H", ((r & 0xF8) << 8) | ((g & 0xFC) << 3) | (b >> 3))
+        a8.append(a)
+    return zlib.compress(bytes(rgb + a8) if alpha else bytes(rgb), 9)
+
+
+def build_pack(sprites, output_path):
+    header_size = 8 + len(sprites) * struct.calcsize(ENTRY_FORMAT)
+    table_size = sum(len(frames) * 8 for _, _, _, frames in sprites)
+    offset = header_size + table_size
+    entries = b""
+    tables = b""
+    data = b""
+    table_offset = header_size
+    for name, size, (frame_ms, fmt), frames in sprites:
+        entries += struct.pack(ENTRY_FORMAT, name.encode("utf-8"), size, size, len(frames), frame_ms, fmt, table_offset)
+        for frame in frames:
+            tables += struct.pack("<II", offset + len(data), len(frame))
+            data += frame
+        table_offset += len(frames) * 8
+    os.makedirs(os.path.dirname(os.path.abspath(output_path)), exist_ok=True)
+    with open(output_path, "wb") as f:
+        f.write(MAGIC + struct.pack("<HH", VERSION, len(sprites)))
+        f.write(entries + tables + data)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Generate the emotion sprite pack")
+    default_output = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "assets", "emotions.xzem")
+    parser.add_argument("input", help="包含 <表情名>.gif 或 <表情名>/*.png 的目录")
+    parser.add_argument("--size", type=int, default=64, help="精灵图边长（像素）")
+    parser.add_argument("--alpha", action="store_true", help="保留透明通道（RGB565A8）")
+    parser.add_argument("--background", default="#FFFFFF", help="不保留透明通道时的背景色")
+    parser.add_argument("--output", default=default_output, help="输出文件路径")
+    args = parser.parse_args()
+
+    sprites = []
+    decoded_bytes = 0
+    for path in sorted(glob.glob(os.path.join(args.input, "*"))):
+        name = os.path.splitext(os.path.basename(path))[0]
+        if not (os.path.isdir(path) or path.lower().endswith(".gif")):
+            continue
+        if len(name.encode("utf-8")) > 15:
+            raise ValueError("emotion name too long: " + name)
+        frames, frame_ms = load_frames(path)
+        if not frames:
+            continue
+        encoded = [encode_frame(frame, args.size, args.alpha, args.background) for frame in frames]
+        fmt = FORMAT_RGB565A8 if args.alpha else FORMAT_RGB565
+        sprites.append((name, args.size, (frame_ms, fmt), encoded))
+        decoded_bytes += len(frames) * args.size * args.size * (3 if args.alpha else 2)
+        print("{}: {} frames, {} ms/frame, {} bytes compressed".format(
+            name, len(frames), frame_ms, sum(len(f) for f in encoded)))
+
+    build_pack(sprites, args.output)
+    print("Generated {} ({} sprites, {} KB when all decoded)".format(
+        os.path.normpath(args.output), len(sprites), decoded_bytes // 1024))
+
+
+if __name__ == "__main__":
+    main()
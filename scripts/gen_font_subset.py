@@ -0,0 +1,98 @@
+#!/usr/bin/env python3
+"""チャット表示用フォントのサブセットを生成する
+
+main/assets/*/language.json の文字列と、サーバーの頻出フレーズ（テキストファイル）から
+使用文字を集め、lv_font_conv でその文字だけを含むLVGLフォントを生成する。
+常用の漢字・かなを丸ごと含む font_puhui_20_4 よりフラッシュ使用量が小さくなる。
+
+例:
+  python scripts/gen_font_subset.py --font NotoSansSC-Regular.ttf --size 20 --bpp 4 \\
+      --phrases phrases.txt --name font_puhui_subset_20_4 \\
+      --output main/display/font_puhui_subset_20_4.c
+
+lv_font_conv が無い場合は --symbols-out で文字リストだけを書き出せる
+（npm install -g lv_font_conv）。
+"""
+import argparse
+import glob
+import json
+import os
+import shutil
+import subprocess
+import sys
+
+# 必ず含める範囲: ASCII、全角記号、CJK記号・句読点、ひらがな・カタカナ
+BASE_RANGES = [
+    (0x20, 0x7E),
+    (0x3000, 0x303F),
+    (0x3040, 0x309F),
+    (0x30A0, 0x30FF),
+    (0xFF00, 0xFFEF),
+]
+
+
+def collect_language_strings(assets_dir):
+    chars = set()
+    for path in sorted(glob.glob(os.path.join(assets_dir, '*', 'language.json'))):
+        with open(path, 'r', encoding='utf-8') as f:
+            data = json.load(f)
+        for value in data.get('strings', {}).values():
+            chars.update(value)
+    return chars
+
+
+def collect_phrases(paths):
+    chars = set()
+    for path in paths:
+        with open(path, 'r', encoding='utf-8') as f:
+            chars.update(f.read())
+    return chars
+
+
+def build_symbols(assets_dir, phrase_paths):
+    chars = collect_language_strings(assets_dir) | collect_phrases(phrase_paths)
+    # 範囲で含める文字と制御文字は個別指定から除く
+    in_base = lambda c: any(lo <= ord(c) <= hi for lo, hi in BASE_RANGES)
+    return ''.join(sorted(c for c in chars if c.isprintable() and not in_base(c)))
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--assets", default=os.path.join(os.path.dirname(__file__), '..', 'main', 'assets'),
+                        help="language.json を含むディレクトリ")
+    parser.add_argument("--phrases", nargs='*', default=[], help="頻出フレーズのテキストファイル")
+    parser.add_argument("--symbols-out", help="収集した文字リストの出力先")
+    parser.add_argument("--font", help="元のTTF/OTFフォント")
+    parser.add_argument("--size", type=int, default=20, help="フォントサイズ(px)")
+    parser.add_argument("--bpp", type=int, default=4, choices=[1, 2, 4, 8], help="1ピクセルあたりのビット数")
+    parser.add_argument("--name", default="font_puhui_subset_20_4", help="生成するlv_font_tの名前")
+    parser.add_argument("--output", help="生成するCファイル")
+    parser.add_argument("--no-compress", action="store_true",
+                        help="ビットマップを圧縮しない（フラッシュは増えるが展開が速い）")
+    args = parser.parse_args()
+
+    symbols = build_symbols(args.assets, args.phrases)
+    print(f"{len(symbols)} glyphs outside the base ranges", file=sys.stderr)
+
+    if args.symbols_out:
+        with open(args.symbols_out, 'w', encoding='utf-8') as f:
+            f.write(symbols)
+
+    if args.font is None or args.output is None:
+        return
+
+    lv_font_conv = shutil.which('lv_font_conv')
+    if lv_font_conv is None:
+        sys.exit("lv_font_conv not found, install it with: npm install -g lv_font_conv")
+
+    ranges = ','.join(f'0x{lo:X}-0x{hi:X}' for lo, hi in BASE_RANGES)
+    cmd = [lv_font_conv, '--font', args.font, '--size', str(args.size), '--bpp', str(args.bpp),
+           '--format', 'lvgl', '--lv-font-name', args.name, '-r', ranges, '--symbols', symbols,
+           '-o', args.output]
+    if args.no_compress:
+        cmd.append('--no-compress')
+    subprocess.run(cmd, check=True)
+
+
+if __name__ == "__main__":
+    main()
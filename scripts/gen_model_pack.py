@@ -0,0 +1,49 @@
+#!/usr/bin/env python3
+"""音声モデルの圧縮コンテナを生成する
+
+esp-srのビルドが作る srmodels.bin（build/srmodels/srmodels.bin）をzlib圧縮し、
+main/audio_processing/model_loader.h の形式で出力する。端末は起動時にPSRAMへ展開する。
+出力はmodelパーティションへ書き込むか、モデルのOTA（CheckVersionの "model"）で配信する。
+
+例:
+  python scripts/gen_model_pack.py build/srmodels/srmodels.bin -o model.pack.bin
+  esptool.py write_flash 0x10000 model.pack.bin
+"""
+import argparse
+import hashlib
+import struct
+import zlib
+
+MAGIC = b"XZMC"
+VERSION = 1
+DEFAULT_PARTITION_SIZE = 0xF0000
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Generate the compressed speech model pack")
+    parser.add_argument("input", help="srmodels.bin")
+    parser.add_argument("-o", "--output", required=True, help="输出文件路径")
+    parser.add_argument("--partition-size", type=lambda v: int(v, 0), default=DEFAULT_PARTITION_SIZE,
+                        help="模型分区大小（超出时报错）")
+    args = parser.parse_args()
+
+    with open(args.input, "rb") as f:
+        raw = f.read()
+    model_num = struct.unpack_from("<I", raw)[0]
+    if model_num == 0 or model_num > 64:
+        raise ValueError("not a srmodels.bin: model count {}".format(model_num))
+
+    compressed = zlib.compress(raw, 9)
+    pack = MAGIC + struct.pack("<HHII", VERSION, 0, len(raw), len(compressed)) + compressed
+    if len(pack) > args.partition_size:
+        raise ValueError("pack is {} bytes, partition is {} bytes".format(len(pack), args.partition_size))
+
+    with open(args.output, "wb") as f:
+        f.write(pack)
+    print("Generated {}: {} models, {} -> {} bytes ({:.0%}), {} KB of PSRAM when loaded".format(
+        args.output, model_num, len(raw), len(pack), len(pack) / len(raw), len(raw) // 1024))
+    print("sha256: {}".format(hashlib.sha256(pack).hexdigest()))
+
+
+if __name__ == "__main__":
+    main()
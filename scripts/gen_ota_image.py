@@ -0,0 +1,112 @@
+#!/usr/bin/env python3
+"""圧縮・差分形式のOTAイメージを生成する
+
+main/ota_decoder.h の形式で出力する。--base を指定すると、端末で実行中の
+ファームウェア（同じビルドの .bin）からの差分になり、変更の少ない更新ほど小さくなる。
+差分は作成元のファームウェアでしか適用できない（app_elf_sha256 で照合）。
+
+例:
+  python scripts/gen_ota_image.py build/xiaozhi.bin -o xiaozhi.ota.bin
+  python scripts/gen_ota_image.py build/xiaozhi.bin --base old/xiaozhi.bin -o xiaozhi.delta.bin
+"""
+import argparse
+import struct
+import sys
+import zlib
+
+MAGIC = b'XZD1'
+FLAG_ZLIB = 0x01
+FLAG_DELTA = 0x02
+
+# esp_image_header_t(24) + esp_image_segment_header_t(8) の後に esp_app_desc_t が続く
+APP_DESC_OFFSET = 24 + 8
+# esp_app_desc_t 内の app_elf_sha256 の位置
+# （magic_word, secure_version, reserv1[2], version, project_name, time, date, idf_ver の後）
+APP_ELF_SHA256_OFFSET = APP_DESC_OFFSET + 4 + 4 + 8 + 32 + 32 + 16 + 16 + 32
+
+# 差分の一致を探す単位。短い一致は命令のほうが大きくなるため採用しない
+BLOCK_SIZE = 32
+MIN_MATCH = 48
+
+
+def make_delta(base, target):
+    index = {}
+    for offset in range(0, len(base) - BLOCK_SIZE + 1, BLOCK_SIZE):
+        index.setdefault(base[offset:offset + BLOCK_SIZE], offset)
+
+    ops = bytearray()
+    pending = bytearray()
+    copied = 0
+
+    def flush_insert():
+        if pending:
+            ops.extend(b'I' + struct.pack('<I', len(pending)))
+            ops.extend(pending)
+            pending.clear()
+
+    i = 0
+    while i < len(target):
+        src = index.get(target[i:i + BLOCK_SIZE]) if i + BLOCK_SIZE <= len(target) else None
+        if src is None:
+            pending.append(target[i])
+            i += 1
+            continue
+        # 一致を前後に広げる（前は挿入待ちのデータから取り戻す）
+        start, src_start = i, src
+        while pending and src_start > 0 and base[src_start - 1] == pending[-1]:
+            pending.pop()
+            start -= 1
+            src_start -= 1
+        end, src_end = i + BLOCK_SIZE, src + BLOCK_SIZE
+        while end < len(target) and src_end < len(base) and target[end] == base[src_end]:
+            end += 1
+            src_end += 1
+        if end - start < MIN_MATCH:
+            pending.extend(target[start:i + 1])
+            i += 1
+            continue
+        flush_insert()
+        ops.extend(b'C' + struct.pack('<II', src_start, end - start))
+        copied += end - start
+        i = end
+    flush_insert()
+    print(f"delta: {copied}/{len(target)} bytes copied from base", file=sys.stderr)
+    return bytes(ops)
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("target", help="新しいファームウェア（.bin）")
+    parser.add_argument("--base", help="端末で実行中のファームウェア（.bin）。指定すると差分を生成")
+    parser.add_argument("--no-compress", action="store_true", help="zlib圧縮しない")
+    parser.add_argument("-o", "--output", required=True, help="出力ファイル")
+    args = parser.parse_args()
+
+    with open(args.target, 'rb') as f:
+        target = f.read()
+
+    flags = 0
+    body = target
+    source_size = 0
+    source_sha256 = bytes(32)
+    if args.base:
+        with open(args.base, 'rb') as f:
+            base = f.read()
+        source_size = len(base)
+        source_sha256 = base[APP_ELF_SHA256_OFFSET:APP_ELF_SHA256_OFFSET + 32]
+        body = make_delta(base, target)
+        flags |= FLAG_DELTA
+    if not args.no_compress:
+        body = zlib.compress(body, 9)
+        flags |= FLAG_ZLIB
+
+    header = MAGIC + struct.pack('<B3xII', flags, len(target), source_size) + source_sha256
+    assert len(header) == 48
+    with open(args.output, 'wb') as f:
+        f.write(header)
+        f.write(body)
+    print(f"{args.output}: {len(header) + len(body)} bytes ({len(target)} bytes decoded)", file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,94 @@
+#!/usr/bin/env python3
+"""ReplayProtocol（CONFIG_USE_REPLAY_PROTOCOL）用のトレースを作成する
+
+入力はサーバーから受信した内容を1行1レコードで記録したJSON Lines:
+    {"t": 0,    "json": {"type": "hello", "transport": "websocket", "audio_params": {...}}}
+    {"t": 900,  "json": {"type": "stt", "text": "..."}}
+    {"t": 1000, "json": {"type": "tts", "state": "start"}}
+    {"t": 1050, "p3": "reply.p3", "frame_ms": 60}
+    {"t": 4000, "opus": "<hex>"}
+    {"t": 4100, "json": {"type": "tts", "state": "stop"}}
+tはセッション開始（hello）からのミリ秒。p3はファイル内の各フレームをframe_ms間隔で
+展開する（パスはJSON Linesファイルからの相対）。出力形式はmain/protocols/replay_protocol.hを参照。
+"""
+import argparse
+import json
+import os
+import struct
+
+MAGIC = b"XZRP"
+VERSION = 1
+RECORD_OPUS = 0
+RECORD_JSON = 1
+
+
+def read_p3(path):
+    """p3ファイルのOpusフレームを順に返す"""
+    frames = []
+    with open(path, "rb") as f:
+        while True:
+            header = f.read(4)
+            if len(header) < 4:
+                break
+            _, _, size = struct.unpack(">BBH", header)
+            data = f.read(size)
+            if len(data) < size:
+                break
+            frames.append(data)
+    return frames
+
+
+def load_records(session_path):
+    base_dir = os.path.dirname(os.path.abspath(session_path))
+    records = []
+    with open(session_path, encoding="utf-8") as f:
+        for line_no, line in enumerate(f, 1):
+            line = line.strip()
+            if not line or line.startswith("#"):
+                continue
+            entry = json.loads(line)
+            t = int(entry["t"])
+            if "json" in entry:
+                payload = json.dumps(entry["json"], ensure_ascii=False, separators=(",", ":")).encode("utf-8")
+                records.append((t, RECORD_JSON, payload))
+            elif "p3" in entry:
+                frame_ms = int(entry.get("frame_ms", 60))
+                for i, frame in enumerate(read_p3(os.path.join(base_dir, entry["p3"]))):
+                    records.append((t + i * frame_ms, RECORD_OPUS, frame))
+            elif "opus" in entry:
+                records.append((t, RECORD_OPUS, bytes.fromhex(entry["opus"])))
+            else:
+                raise ValueError("line {}: expected json, p3 or opus".format(line_no))
+    # 同時刻のレコードは記録順を保つ
+    records.sort(key=lambda r: r[0])
+    return records
+
+
+def write_trace(records, output_path):
+    os.makedirs(os.path.dirname(os.path.abspath(output_path)), exist_ok=True)
+    with open(output_path, "wb") as f:
+        f.write(MAGIC + struct.pack(">HH", VERSION, 0))
+        for t, record_type, payload in records:
+            if len(payload) > 0xFFFF:
+                raise ValueError("record at {} ms is too large ({} bytes)".format(t, len(payload)))
+            f.write(struct.pack(">IBBH", t, record_type, 0, len(payload)))
+            f.write(payload)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Generate a replay trace for ReplayProtocol")
+    default_output = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "replay", "session.xzrp")
+    parser.add_argument("session", help="会话记录（JSON Lines）")
+    parser.add_argument("--output", default=default_output, help="输出的回放文件路径")
+    args = parser.parse_args()
+
+    records = load_records(args.session)
+    write_trace(records, args.output)
+    audio = sum(1 for r in records if r[1] == RECORD_OPUS)
+    duration = records[-1][0] if records else 0
+    print("Generated {} ({} json, {} audio, {} ms)".format(
+        os.path.normpath(args.output), len(records) - audio, audio, duration))
+
+
+if __name__ == "__main__":
+    main()
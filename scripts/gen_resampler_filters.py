@@ -0,0 +1,82 @@
+#!/usr/bin/env python3
+"""PolyphaseResampler 用のQ15ポリフェーズ係数テーブルを生成する
+
+出力: main/audio_processing/resampler_filters.h
+係数はL倍補間後のレートで設計したBlackman窓付きsincで、補間によるゲイン低下を
+L倍して補償している。各フェーズpの係数 h[j*L + p] は内積を入力の古い順に
+計算できるよう時間逆順に並べる。
+"""
+import argparse
+import math
+import os
+
+# (入力レート, 出力レート, 1フェーズあたりのタップ数, カットオフ周波数Hz)
+FILTERS = [
+    (24000, 16000, 32, 6800),
+    (16000, 24000, 24, 7000),
+    (48000, 24000, 48, 11000),
+]
+
+HEADER_TEMPLATE = """// Auto-generated by scripts/gen_resampler_filters.py
+#pragma once
+
+#include <cstdint>
+
+namespace resampler_filters {{
+{tables}
+}} // namespace resampler_filters
+"""
+
+
+def design(in_rate, out_rate, taps_per_phase, cutoff_hz):
+    g = math.gcd(in_rate, out_rate)
+    up = out_rate // g
+    down = in_rate // g
+    taps = taps_per_phase * up
+    fc = cutoff_hz / (in_rate * up)
+    center = (taps - 1) / 2.0
+    h = []
+    for n in range(taps):
+        x = n - center
+        sinc = 2.0 * fc if x == 0 else math.sin(2.0 * math.pi * fc * x) / (math.pi * x)
+        w = (0.42 - 0.5 * math.cos(2.0 * math.pi * n / (taps - 1))
+             + 0.08 * math.cos(4.0 * math.pi * n / (taps - 1)))
+        h.append(up * sinc * w)
+    phases = []
+    for p in range(up):
+        coeffs = [0] * taps_per_phase
+        for j in range(taps_per_phase):
+            v = int(round(h[j * up + p] * 32768.0))
+            coeffs[taps_per_phase - 1 - j] = max(-32768, min(32767, v))
+        phases.append(coeffs)
+    return up, down, phases
+
+
+def generate_header(output_path):
+    tables = []
+    for in_rate, out_rate, taps_per_phase, cutoff_hz in FILTERS:
+        up, down, phases = design(in_rate, out_rate, taps_per_phase, cutoff_hz)
+        name = "k{}kTo{}k".format(in_rate // 1000, out_rate // 1000)
+        lines = ["    // {} Hz -> {} Hz (L={}, M={}, cutoff {} Hz)".format(in_rate, out_rate, up, down, cutoff_hz)]
+        lines.append("    constexpr int {}Up = {};".format(name, up))
+        lines.append("    constexpr int {}Down = {};".format(name, down))
+        lines.append("    constexpr int {}Taps = {};".format(name, taps_per_phase))
+        lines.append("    constexpr int16_t {}[{} * {}] = {{".format(name, up, taps_per_phase))
+        for coeffs in phases:
+            for i in range(0, len(coeffs), 8):
+                lines.append("        " + ", ".join("{:6d}".format(c) for c in coeffs[i:i + 8]) + ",")
+        lines.append("    };")
+        tables.append("\n".join(lines))
+
+    with open(output_path, 'w', encoding='utf-8') as f:
+        f.write(HEADER_TEMPLATE.format(tables="\n\n".join(tables)))
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Generate polyphase resampler filter tables")
+    default_output = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                                  "..", "main", "audio_processing", "resampler_filters.h")
+    parser.add_argument("--output", default=default_output, help="输出头文件路径")
+    args = parser.parse_args()
+    generate_header(args.output)
+    print("Generated {}".format(os.path.normpath(args.output)))
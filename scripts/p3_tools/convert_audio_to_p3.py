@@ -1,14 +1,15 @@
 # convert audio files to protocol v3 stream
 import librosa
 import opuslib
-import struct
 import sys
 import tqdm
 import numpy as np
 import argparse
 import pyloudnorm as pyln
+from p3_format import write_p3, DEFAULT_SAMPLE_RATE, DEFAULT_FRAME_DURATION
 
-def encode_audio_to_opus(input_file, output_file, target_lufs=None):
+def encode_audio_to_opus(input_file, output_file, target_lufs=None,
+                         target_sample_rate=DEFAULT_SAMPLE_RATE, duration=DEFAULT_FRAME_DURATION):
     # Load audio file using librosa
     audio, sample_rate = librosa.load(input_file, sr=None, mono=False, dtype=np.float32)
     
@@ -26,8 +27,7 @@ def encode_audio_to_opus(input_file, output_file, target_lufs=None):
         audio = pyln.normalize.loudness(audio, current_loudness, target_lufs)
         print(f"Adjusted loudness: {current_loudness:.1f} LUFS -> {target_lufs} LUFS")
 
-    # Convert sample rate to 16000Hz if necessary
-    target_sample_rate = 16000
+    # Convert sample rate to the target rate (16000Hz by default) if necessary
     if sample_rate != target_sample_rate:
         audio = librosa.resample(audio, orig_sr=sample_rate, target_sr=target_sample_rate)
         sample_rate = target_sample_rate
@@ -38,15 +38,13 @@ def encode_audio_to_opus(input_file, output_file, target_lufs=None):
     # Initialize Opus encoder
     encoder = opuslib.Encoder(sample_rate, 1, opuslib.APPLICATION_AUDIO)
 
-    # Encode and save
-    with open(output_file, 'wb') as f:
-        duration = 60  # 60ms per frame
-        frame_size = int(sample_rate * duration / 1000)
-        for i in tqdm.tqdm(range(0, len(audio) - frame_size, frame_size)):
-            frame = audio[i:i + frame_size]
-            opus_data = encoder.encode(frame.tobytes(), frame_size=frame_size)
-            packet = struct.pack('>BBH', 0, 0, len(opus_data)) + opus_data
-            f.write(packet)
+    # Encode and save (a header frame is written for non-default formats)
+    frame_size = int(sample_rate * duration / 1000)
+    frames = []
+    for i in tqdm.tqdm(range(0, len(audio) - frame_size, frame_size)):
+        frame = audio[i:i + frame_size]
+        frames.append(encoder.encode(frame.tobytes(), frame_size=frame_size))
+    write_p3(output_file, frames, sample_rate, duration)
 
 if __name__ == "__main__":
     parser = argparse.ArgumentParser(description='Convert audio to Opus with loudness normalization')
@@ -56,7 +54,11 @@ if __name__ == "__main__":
                        help='Target loudness in LUFS (default: -16)')
     parser.add_argument('-d', '--disable-loudnorm', action='store_true',
                        help='Disable loudness normalization')
+    parser.add_argument('-r', '--sample-rate', type=int, default=DEFAULT_SAMPLE_RATE,
+                       help='Output sample rate, e.g. the board AUDIO_OUTPUT_SAMPLE_RATE (default: 16000)')
+    parser.add_argument('-f', '--frame-duration', type=int, default=DEFAULT_FRAME_DURATION,
+                       choices=[20, 40, 60, 120], help='Opus frame duration in ms (default: 60)')
     args = parser.parse_args()
 
     target_lufs = None if args.disable_loudnorm else args.lufs
-    encode_audio_to_opus(args.input_file, args.output_file, target_lufs)
\ No newline at end of file
+    encode_audio_to_opus(args.input_file, args.output_file, target_lufs, args.sample_rate, args.frame_duration)
\ No newline at end of file
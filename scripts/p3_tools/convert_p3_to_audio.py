@@ -1,39 +1,21 @@
-import struct
 import sys
 import opuslib
 import numpy as np
 from tqdm import tqdm
 import soundfile as sf
+from p3_format import read_p3
 
 
 def decode_p3_to_audio(input_file, output_file):
-    sample_rate = 16000
+    sample_rate, frame_duration, frames = read_p3(input_file)
     channels = 1
     decoder = opuslib.Decoder(sample_rate, channels)
+    frame_size = int(sample_rate * frame_duration / 1000)
 
     pcm_frames = []
-    frame_size = int(sample_rate * 60 / 1000)
-
-    with open(input_file, "rb") as f:
-        f.seek(0, 2)
-        total_size = f.tell()
-        f.seek(0)
-
-        with tqdm(total=total_size, unit="B", unit_scale=True) as pbar:
-            while True:
-                header = f.read(4)
-                if not header or len(header) < 4:
-                    break
-
-                pkt_type, reserved, opus_len = struct.unpack(">BBH", header)
-                opus_data = f.read(opus_len)
-                if len(opus_data) != opus_len:
-                    break
-
-                pcm = decoder.decode(opus_data, frame_size)
-                pcm_frames.append(np.frombuffer(pcm, dtype=np.int16))
-
-                pbar.update(4 + opus_len)
+    for opus_data in tqdm(frames, unit="frame"):
+        pcm = decoder.decode(opus_data, frame_size)
+        pcm_frames.append(np.frombuffer(pcm, dtype=np.int16))
 
     if not pcm_frames:
         raise ValueError("No valid audio data found")
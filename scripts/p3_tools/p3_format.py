@@ -0,0 +1,45 @@
+# p3格式的读写
+# p3格式: [1字节类型, 1字节保留, 2字节长度(大端), 数据] 的重复
+# 类型 0 为 Opus 帧；类型 0x80 为可选的头部帧，放在文件开头，
+# 数据为 采样率(uint32) + 帧长毫秒(uint16)，均为大端。没有头部时为 16000Hz / 60ms
+import struct
+
+FRAME_TYPE_OPUS = 0
+FRAME_TYPE_HEADER = 0x80
+DEFAULT_SAMPLE_RATE = 16000
+DEFAULT_FRAME_DURATION = 60
+
+
+def read_p3(input_file):
+    """读取p3文件，返回 (采样率, 帧长毫秒, Opus帧列表)"""
+    sample_rate = DEFAULT_SAMPLE_RATE
+    frame_duration = DEFAULT_FRAME_DURATION
+    frames = []
+    with open(input_file, "rb") as f:
+        while True:
+            header = f.read(4)
+            if len(header) < 4:
+                break
+            frame_type, _, size = struct.unpack(">BBH", header)
+            data = f.read(size)
+            if len(data) < size:
+                break
+            if frame_type == FRAME_TYPE_HEADER:
+                if not frames and size >= 6:
+                    sample_rate, frame_duration = struct.unpack(">IH", data[:6])
+                continue
+            frames.append(data)
+    return sample_rate, frame_duration, frames
+
+
+def write_p3(output_file, frames, sample_rate=DEFAULT_SAMPLE_RATE, frame_duration=DEFAULT_FRAME_DURATION,
+             header=None):
+    """写入p3文件。header为None时，仅在非默认格式时写入头部帧"""
+    if header is None:
+        header = sample_rate != DEFAULT_SAMPLE_RATE or frame_duration != DEFAULT_FRAME_DURATION
+    with open(output_file, "wb") as f:
+        if header:
+            payload = struct.pack(">IH", sample_rate, frame_duration)
+            f.write(struct.pack(">BBH", FRAME_TYPE_HEADER, 0, len(payload)) + payload)
+        for data in frames:
+            f.write(struct.pack(">BBH", FRAME_TYPE_OPUS, 0, len(data)) + data)
@@ -3,7 +3,7 @@ from tkinter import filedialog, messagebox
 import threading
 import time
 import opuslib
-import struct
+from p3_format import read_p3
 import numpy as np
 import sounddevice as sd
 import os
@@ -13,14 +13,16 @@ def play_p3_file(input_file, stop_event=None, pause_event=None):
     """
     播放p3格式的音频文件
     p3格式: [1字节类型, 1字节保留, 2字节长度, Opus数据]
+    采样率和帧长取自文件开头的头部帧，没有头部时为16000Hz / 60ms
     """
+    sample_rate, frame_duration, frames = read_p3(input_file)
+
     # 初始化Opus解码器
-    sample_rate = 16000  # 采样率固定为16000Hz
     channels = 1  # 单声道
     decoder = opuslib.Decoder(sample_rate, channels)
     
-    # 帧大小 (60ms)
-    frame_size = int(sample_rate * 60 / 1000)
+    # 帧大小
+    frame_size = int(sample_rate * frame_duration / 1000)
     
     # 打开音频流
     stream = sd.OutputStream(
@@ -31,39 +33,28 @@ def play_p3_file(input_file, stop_event=None, pause_event=None):
     stream.start()
     
     try:
-        with open(input_file, 'rb') as f:
-            print(f"正在播放: {input_file}")
+        print(f"正在播放: {input_file}")
+        index = 0
+        while index < len(frames):
+            if stop_event and stop_event.is_set():
+                break
+
+            if pause_event and pause_event.is_set():
+                time.sleep(0.1)
+                continue
+
+            opus_data = frames[index]
+            index += 1
+
+            # 解码Opus数据
+            pcm_data = decoder.decode(opus_data, frame_size)
+            
+            # 将字节转换为numpy数组
+            audio_array = np.frombuffer(pcm_data, dtype=np.int16)
+            
+            # 播放音频
+            stream.write(audio_array)
             
-            while True:
-                if stop_event and stop_event.is_set():
-                    break
-
-                if pause_event and pause_event.is_set():
-                    time.sleep(0.1)
-                    continue
-
-                # 读取头部 (4字节)
-                header = f.read(4)
-                if not header or len(header) < 4:
-                    break
-                
-                # 解析头部
-                packet_type, reserved, data_len = struct.unpack('>BBH', header)
-                
-                # 读取Opus数据
-                opus_data = f.read(data_len)
-                if not opus_data or len(opus_data) < data_len:
-                    break
-                
-                # 解码Opus数据
-                pcm_data = decoder.decode(opus_data, frame_size)
-                
-                # 将字节转换为numpy数组
-                audio_array = np.frombuffer(pcm_data, dtype=np.int16)
-                
-                # 播放音频
-                stream.write(audio_array)
-                
     except KeyboardInterrupt:
         print("\n播放已停止")
     finally:
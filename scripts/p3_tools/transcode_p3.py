@@ -0,0 +1,60 @@
+# 将p3文件转码为指定的采样率和帧长（例如开发板的输出采样率），
+# 使设备播放提示音时不需要重采样
+import argparse
+import os
+import sys
+import numpy as np
+import opuslib
+import librosa
+from p3_format import read_p3, write_p3, DEFAULT_FRAME_DURATION
+
+
+def transcode_p3(input_file, output_file, target_sample_rate, target_duration=DEFAULT_FRAME_DURATION):
+    sample_rate, frame_duration, frames = read_p3(input_file)
+
+    # 解码为PCM
+    decoder = opuslib.Decoder(sample_rate, 1)
+    frame_size = int(sample_rate * frame_duration / 1000)
+    pcm = np.concatenate([np.frombuffer(decoder.decode(data, frame_size), dtype=np.int16) for data in frames]) \
+        if frames else np.zeros(0, dtype=np.int16)
+
+    # 重采样
+    if sample_rate != target_sample_rate and len(pcm) > 0:
+        audio = librosa.resample(pcm.astype(np.float32) / 32768, orig_sr=sample_rate, target_sr=target_sample_rate)
+        pcm = (np.clip(audio, -1, 1) * 32767).astype(np.int16)
+
+    # 重新编码，最后不足一帧的部分补零
+    encoder = opuslib.Encoder(target_sample_rate, 1, opuslib.APPLICATION_AUDIO)
+    out_frame_size = int(target_sample_rate * target_duration / 1000)
+    remainder = len(pcm) % out_frame_size
+    if remainder:
+        pcm = np.concatenate([pcm, np.zeros(out_frame_size - remainder, dtype=np.int16)])
+    out_frames = [encoder.encode(pcm[i:i + out_frame_size].tobytes(), frame_size=out_frame_size)
+                  for i in range(0, len(pcm), out_frame_size)]
+
+    write_p3(output_file, out_frames, target_sample_rate, target_duration, header=True)
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description='Transcode p3 files to a target sample rate and frame duration')
+    parser.add_argument('input_files', nargs='+', help='Input p3 file(s)')
+    parser.add_argument('-o', '--output', help='Output p3 file (single input only)')
+    parser.add_argument('--output-dir', help='Output directory, file names are kept')
+    parser.add_argument('-r', '--sample-rate', type=int, required=True,
+                        help='Target sample rate, e.g. the board AUDIO_OUTPUT_SAMPLE_RATE')
+    parser.add_argument('-f', '--frame-duration', type=int, default=DEFAULT_FRAME_DURATION,
+                        choices=[20, 40, 60, 120], help='Opus frame duration in ms (default: 60)')
+    args = parser.parse_args()
+
+    if args.output and len(args.input_files) != 1:
+        sys.exit("--output can only be used with a single input file")
+    if not args.output and not args.output_dir:
+        sys.exit("Either --output or --output-dir is required")
+
+    for input_file in args.input_files:
+        if args.output:
+            output_file = args.output
+        else:
+            os.makedirs(args.output_dir, exist_ok=True)
+            output_file = os.path.join(args.output_dir, os.path.basename(input_file))
+        transcode_p3(input_file, output_file, args.sample_rate, args.frame_duration)
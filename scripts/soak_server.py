@@ -0,0 +1,865 @@
+#!/usr/bin/env python3
+"""長時間（24時間など）の耐久試験用の合成サーバー
+
+端末と同じ手順（hello、listen、tts start/sentence_start/stop、mcp）を話す最小限のサーバーで、
+本物のASR/LLM/TTSの代わりに、上り音声を一定フレーム数受け取るたびに決まった応答
+（stt、llm、tts start、sentence_start と Opus 音声、tts stop）を返す。
+自動停止モード（auto）の端末は tts stop の後に再び聞き取りを始めるため、1回の接続で会話が続く。
+下りの音声は指定の速度（実時間の倍率）で送り、欠落・ジッター・並べ替えと、会話途中の切断を注入できる。
+
+接続方式:
+    websocket  … WebSocketサーバーとして待ち受ける（バイナリ形式 v1/v2/v3、v3の音声バッチと制御メッセージ）。
+                 --udp-port を指定すると、端末が udp_audio に対応していれば音声をUDPで送受信する
+    mqtt       … 既存のブローカーに接続し、端末の publish_topic を購読して応答を --mqtt-reply-topic へ送る。
+                 音声は AES-CTR で暗号化したUDP（端末の main/protocols/udp_audio_channel.h と同じ形式）
+
+端末側は CONFIG_USE_DEBUG_HTTP_SERVER と CONFIG_USE_SOAK_TRIGGER を有効にしておくと、
+切断の後や会話が止まった時に GET /soak/wake で次の会話を始め、GET /metrics から
+ヒープ、キューの破棄数、応答レイテンシを定期的に取得して CSV に記録する。
+終了時（指定の会話数・時間、または Ctrl+C）にヒープの推移（1時間あたりの減少量）と
+各カウンタの増分をまとめて表示し、--max-heap-drop を超えて減っていれば終了コード1を返す。
+
+例:
+    python scripts/soak_server.py websocket --port 8000 --device http://192.168.1.50:8080 \\
+        --p3 main/assets/common/success.p3 --cycles 5000 --loss 0.02 --jitter 40 --disconnect-rate 0.01
+    （端末のWebSocket URLを ws://<このPC>:8000/ に設定する）
+    python scripts/soak_server.py mqtt --mqtt-broker 192.168.1.10:1883 --mqtt-device-topic device-server \\
+        --mqtt-reply-topic devices/p2p/<client_id> --udp-host 192.168.1.20 --udp-port 8884 \\
+        --device http://192.168.1.50:8080 --hours 24 --rate 1.5 -o soak
+"""
+import argparse
+import asyncio
+import csv
+import json
+import math
+import os
+import random
+import re
+import signal
+import struct
+import sys
+import time
+import urllib.request
+import uuid
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "p3_tools"))
+from p3_format import read_p3  # noqa: E402
+
+# バイナリ形式（main/protocols/protocol.h）
+BP2_HEADER = struct.Struct(">HHIII")
+BP3_HEADER = struct.Struct(">BBH")
+BP3_TYPE_AUDIO = 0
+BP3_TYPE_AUDIO_BATCH = 2
+BP3_TYPE_CONTROL = 3
+CONTROL_LISTEN_START = 0x01
+CONTROL_LISTEN_STOP = 0x02
+CONTROL_LISTEN_DETECT = 0x03
+CONTROL_ABORT = 0x04
+CONTROL_TTS_START = 0x81
+CONTROL_TTS_STOP = 0x82
+CONTROL_TTS_SENTENCE_START = 0x83
+LISTEN_MODES = ["auto", "manual", "realtime"]
+
+UDP_NONCE_SIZE = 16
+
+# /metrics から記録する系列（ヒストグラムは _sum と _count から平均を求める）
+METRIC_COLUMNS = [
+    "xiaozhi_heap_internal_free_bytes",
+    "xiaozhi_heap_internal_min_free_bytes",
+    "xiaozhi_heap_internal_largest_block_bytes",
+    "xiaozhi_heap_psram_free_bytes",
+    "xiaozhi_audio_incoming_dropped_total",
+    "xiaozhi_audio_outgoing_dropped_total",
+    "xiaozhi_audio_underruns_total",
+    "xiaozhi_audio_late_packets_total",
+    "xiaozhi_audio_decode_queue_depth",
+    "xiaozhi_audio_channel_opens_total",
+    "xiaozhi_network_errors_total",
+    "xiaozhi_mqtt_disconnects_total",
+    "xiaozhi_tts_first_output_latency_us_sum",
+    "xiaozhi_tts_first_output_latency_us_count",
+    "xiaozhi_send_audio_duration_us_sum",
+    "xiaozhi_send_audio_duration_us_count",
+]
+COUNTER_SUMMARY = [
+    "xiaozhi_audio_incoming_dropped_total",
+    "xiaozhi_audio_outgoing_dropped_total",
+    "xiaozhi_audio_underruns_total",
+    "xiaozhi_audio_late_packets_total",
+    "xiaozhi_audio_channel_opens_total",
+    "xiaozhi_network_errors_total",
+    "xiaozhi_mqtt_disconnects_total",
+]
+METRIC_LINE = re.compile(r"^([a-zA-Z_:][a-zA-Z0-9_:]*)(\{[^}]*\})?\s+(\S+)")
+
+
+def percentile(values, p):
+    if not values:
+        return 0
+    ordered = sorted(values)
+    return ordered[min(len(ordered) - 1, int(len(ordered) * p / 100))]
+
+
+class AesCtr:
+    """UDP音声のAES-CTR（カウンタの初期値はパケットのヘッダ）"""
+
+    def __init__(self, key):
+        from cryptography.hazmat.primitives.ciphers import Cipher, algorithms, modes
+        self._cipher = lambda nonce: Cipher(algorithms.AES(key), modes.CTR(nonce))
+
+    def apply(self, nonce, data):
+        context = self._cipher(nonce).encryptor()
+        return context.update(data) + context.finalize()
+
+
+class UdpAudio(asyncio.DatagramProtocol):
+    """暗号化UDPの音声チャネル（端末の宛先は最初に受け取ったデータグラムで覚える）"""
+
+    def __init__(self, host, port):
+        self.host = host
+        self.port = port
+        self.transport = None
+        self.session = None
+        self.key = b""
+        self.nonce = b""
+        self.crypto = None
+        self.remote = None
+        self.sequence = 0
+
+    async def start(self):
+        loop = asyncio.get_running_loop()
+        await loop.create_datagram_endpoint(lambda: self, local_addr=("0.0.0.0", self.port))
+
+    def connection_made(self, transport):
+        self.transport = transport
+
+    def attach(self, session):
+        """新しいセッション用の鍵とnonceを作り、helloに載せる udp オブジェクトを返す"""
+        self.session = session
+        self.key = os.urandom(16)
+        # |type 1u|flags 1u|payload_len 2u|ssrc 4u|timestamp 4u|sequence 4u|
+        self.nonce = struct.pack(">BBHIII", 1, 0, 0, random.getrandbits(32), 0, 0)
+        self.crypto = AesCtr(self.key)
+        self.remote = None
+        self.sequence = 0
+        return {"server": self.host, "port": self.port, "key": self.key.hex(), "nonce": self.nonce.hex()}
+
+    def detach(self, session):
+        if self.session is session:
+            self.session = None
+
+    def datagram_received(self, data, addr):
+        if self.session is None or len(data) < UDP_NONCE_SIZE or data[0] != 1:
+            return
+        # 上りは数えるだけなので復号しない
+        self.remote = addr
+        self.session.on_audio(1)
+
+    def send(self, frame, timestamp):
+        if self.remote is None:
+            return False
+        self.sequence = (self.sequence + 1) & 0xFFFFFFFF
+        header = bytearray(self.nonce)
+        struct.pack_into(">H", header, 2, len(frame))
+        struct.pack_into(">II", header, 8, timestamp & 0xFFFFFFFF, self.sequence)
+        self.transport.sendto(bytes(header) + self.crypto.apply(bytes(header), frame), self.remote)
+        return True
+
+
+class Stats:
+    """会話の回数とホスト側で測る時間"""
+
+    def __init__(self):
+        self.sessions = 0
+        self.turns = 0
+        self.aborts = 0
+        self.disconnects = 0
+        self.wakes = 0
+        self.wake_failures = 0
+        self.frames_sent = 0
+        self.frames_lost = 0
+        self.frames_reordered = 0
+        self.mcp_calls = 0
+        self.mcp_timeouts = 0
+        self.setup_ms = []          # /soak/wake から hello まで
+        self.relisten_ms = []       # tts stop から次の listen start まで
+        self.mcp_ms = []            # tools/call の往復
+
+
+class Session:
+    """1回の接続（hello から切断まで）の会話を進める"""
+
+    def __init__(self, soak, transport):
+        self.soak = soak
+        self.args = soak.args
+        self.transport = transport
+        self.session_id = uuid.uuid4().hex[:16]
+        self.version = 1
+        self.binary_control = False
+        self.mode = "auto"
+        self.listening = False
+        self.uplink_frames = 0
+        self.speaking = None
+        self.tts_stop_time = None
+        self.turns = 0
+        self.mcp_id = 0
+        self.mcp_pending = {}
+        self.closed = False
+
+    # ---- 上り ----
+    def on_json(self, message):
+        kind = message.get("type")
+        if kind == "listen":
+            state = message.get("state")
+            if state == "start":
+                self.on_listen_start(message.get("mode", "auto"))
+            elif state == "stop":
+                self.on_listen_stop()
+        elif kind == "abort":
+            self.on_abort()
+        elif kind == "mcp":
+            self.on_mcp(message.get("payload", {}))
+        elif kind == "ping":
+            self.soak.spawn(self.send_json({"type": "pong", "id": message.get("id")}))
+
+    def on_control(self, event, arg):
+        if event == CONTROL_LISTEN_START:
+            self.on_listen_start(LISTEN_MODES[arg] if arg < len(LISTEN_MODES) else "auto")
+        elif event == CONTROL_LISTEN_STOP:
+            self.on_listen_stop()
+        elif event == CONTROL_ABORT:
+            self.on_abort()
+
+    def on_listen_start(self, mode):
+        self.mode = mode
+        self.listening = True
+        self.uplink_frames = 0
+        if self.tts_stop_time is not None:
+            self.soak.stats.relisten_ms.append((time.monotonic() - self.tts_stop_time) * 1000)
+            self.tts_stop_time = None
+
+    def on_listen_stop(self):
+        if self.listening and self.speaking is None:
+            self.start_turn()
+
+    def on_abort(self):
+        self.soak.stats.aborts += 1
+        if self.speaking is not None:
+            self.speaking.cancel()
+
+    def on_audio(self, count):
+        if not self.listening or self.speaking is not None:
+            return
+        self.uplink_frames += count
+        if self.uplink_frames >= self.args.utterance_frames:
+            self.start_turn()
+
+    def on_mcp(self, payload):
+        started = self.mcp_pending.pop(payload.get("id"), None)
+        if started is not None:
+            self.soak.stats.mcp_ms.append((time.monotonic() - started) * 1000)
+
+    # ---- 下り ----
+    async def send_json(self, message):
+        message.setdefault("session_id", self.session_id)
+        await self.transport.send_text(json.dumps(message, ensure_ascii=False))
+
+    async def send_tts(self, state, text=None):
+        if self.binary_control:
+            event = {"start": CONTROL_TTS_START, "stop": CONTROL_TTS_STOP,
+                     "sentence_start": CONTROL_TTS_SENTENCE_START}[state]
+            body = bytes([event, 0]) + (text or "").encode("utf-8")
+            await self.transport.send_binary(BP3_HEADER.pack(BP3_TYPE_CONTROL, 0, len(body)) + body)
+            return
+        message = {"type": "tts", "state": state}
+        if text is not None:
+            message["text"] = text
+        await self.send_json(message)
+
+    async def send_audio(self, frame, timestamp):
+        await self.transport.send_audio(frame, timestamp)
+
+    def start_turn(self):
+        self.listening = self.mode == "realtime"
+        self.speaking = self.soak.spawn(self.turn())
+
+    async def turn(self):
+        """1回の応答（stt → llm → tts start → 文ごとの音声 → tts stop）"""
+        args = self.args
+        stats = self.soak.stats
+        frames = self.soak.frames
+        try:
+            self.turns += 1
+            await self.send_json({"type": "stt", "text": "soak turn {}".format(stats.turns + 1)})
+            await self.send_json({"type": "llm", "emotion": random.choice(["happy", "neutral", "thinking"])})
+            await self.send_tts("start")
+            if args.mcp_every and self.turns % args.mcp_every == 0:
+                await self.call_mcp()
+            # 切断する場合は、どの文の何フレーム目で切るかを先に決める
+            cut_sentence = random.randrange(args.sentences) if random.random() < args.disconnect_rate else -1
+            for sentence in range(args.sentences):
+                await self.send_tts("sentence_start", "Soak sentence {} of turn {}.".format(sentence + 1, self.turns))
+                limit = random.randrange(len(frames)) if sentence == cut_sentence else len(frames)
+                await self.stream(frames, sentence * len(frames), limit)
+                if sentence == cut_sentence:
+                    stats.disconnects += 1
+                    await self.transport.close()
+                    return
+            await self.send_tts("stop")
+            self.tts_stop_time = time.monotonic()
+            stats.turns += 1
+            self.soak.on_turn_done()
+            if self.mode == "manual" or (args.turns_per_session and self.turns >= args.turns_per_session):
+                # 手動モードの端末は自分で聞き取りを始めないため、セッションを閉じて次の起床を待つ
+                await self.transport.goodbye(self)
+        except asyncio.CancelledError:
+            # 端末からのabort。接続が閉じた後は何も送らない
+            if not self.closed:
+                await self.send_tts("stop")
+                self.tts_stop_time = time.monotonic()
+        except Exception:
+            if not self.closed:
+                raise
+        finally:
+            self.speaking = None
+            self.uplink_frames = 0
+
+    async def stream(self, frames, offset, limit):
+        """先頭からlimitフレームを、送る時刻に欠落・ジッター・並べ替えを加えて送る"""
+        args = self.args
+        stats = self.soak.stats
+        interval = self.soak.frame_duration / 1000.0 / args.rate
+        schedule = []
+        for i, frame in enumerate(frames[:limit]):
+            if random.random() < args.loss:
+                stats.frames_lost += 1
+                continue
+            at = i * interval + random.uniform(0, args.jitter / 1000.0)
+            schedule.append([at, i, frame])
+        for i in range(len(schedule) - 1):
+            if random.random() < args.reorder:
+                schedule[i][0], schedule[i + 1][0] = schedule[i + 1][0], schedule[i][0]
+                stats.frames_reordered += 1
+        schedule.sort(key=lambda item: item[0])
+        start = time.monotonic()
+        for at, index, frame in schedule:
+            delay = start + at - time.monotonic()
+            if delay > 0:
+                await asyncio.sleep(delay)
+            await self.send_audio(frame, (offset + index) * self.soak.frame_duration)
+            stats.frames_sent += 1
+        # 送った分が再生し終わる時刻まで待ってから次の文へ進む
+        remaining = start + limit * interval - time.monotonic()
+        if remaining > 0:
+            await asyncio.sleep(remaining)
+
+    async def call_mcp(self):
+        """tools/call で端末の状態を読み、往復時間を測る（応答は on_mcp で受け取る）"""
+        self.mcp_id += 1
+        request_id = self.mcp_id
+        self.mcp_pending[request_id] = time.monotonic()
+        self.soak.stats.mcp_calls += 1
+        await self.send_json({"type": "mcp", "payload": {
+            "jsonrpc": "2.0", "id": request_id, "method": "tools/call",
+            "params": {"name": "self.get_device_status", "arguments": {}}}})
+
+    def expire_mcp(self, timeout):
+        now = time.monotonic()
+        for request_id, started in list(self.mcp_pending.items()):
+            if now - started > timeout:
+                del self.mcp_pending[request_id]
+                self.soak.stats.mcp_timeouts += 1
+
+    def hello(self, device_hello, udp=None):
+        """端末のhelloに対するサーバーhello"""
+        features = {}
+        device_features = device_hello.get("features", {})
+        if self.version == 3 and self.args.audio_batch and device_features.get("audio_batch"):
+            features["audio_batch"] = True
+        if self.version == 3 and self.args.binary_control and device_features.get("binary_control"):
+            features["binary_control"] = True
+            self.binary_control = True
+        if device_features.get("ping"):
+            features["ping"] = True
+        reply = {
+            "type": "hello",
+            "transport": device_hello.get("transport", "websocket"),
+            "session_id": self.session_id,
+            "audio_params": {"format": "opus", "sample_rate": self.soak.sample_rate, "channels": 1,
+                             "frame_duration": self.soak.frame_duration},
+            "features": features,
+        }
+        if udp is not None:
+            reply["udp"] = udp
+        return reply
+
+    async def initialize_mcp(self):
+        await self.send_json({"type": "mcp", "payload": {
+            "jsonrpc": "2.0", "id": 0, "method": "initialize",
+            "params": {"capabilities": {}}}})
+
+
+class WebsocketTransport:
+    def __init__(self, websocket, udp):
+        self.websocket = websocket
+        self.udp = udp
+        self.session = None
+
+    async def send_text(self, text):
+        await self.websocket.send(text)
+
+    async def send_binary(self, data):
+        await self.websocket.send(data)
+
+    async def send_audio(self, frame, timestamp):
+        if self.udp is not None and self.udp.session is self.session and self.udp.send(frame, timestamp):
+            return
+        version = self.session.version
+        if version == 2:
+            await self.websocket.send(BP2_HEADER.pack(2, 0, 0, timestamp & 0xFFFFFFFF, len(frame)) + frame)
+        elif version == 3:
+            await self.websocket.send(BP3_HEADER.pack(BP3_TYPE_AUDIO, 0, len(frame)) + frame)
+        else:
+            await self.websocket.send(frame)
+
+    async def close(self):
+        # 相手に閉じる手順を踏ませない切断（回線断に近い）
+        self.websocket.transport.abort()
+
+    async def goodbye(self, session):
+        await self.websocket.close()
+
+
+class MqttTransport:
+    def __init__(self, client, topic, udp):
+        self.client = client
+        self.topic = topic
+        self.udp = udp
+        self.session = None
+
+    async def send_text(self, text):
+        self.client.publish(self.topic, text)
+
+    async def send_binary(self, data):
+        raise ConnectionError("binary messages are not supported over MQTT")
+
+    async def send_audio(self, frame, timestamp):
+        self.udp.send(frame, timestamp)
+
+    async def close(self):
+        # MQTTの接続は端末と共有しているため、音声チャネルだけを閉じる
+        await self.goodbye(self.session)
+
+    async def goodbye(self, session):
+        await session.send_json({"type": "goodbye"})
+        self.udp.detach(session)
+        session.soak.end_session(session)
+
+
+class Soak:
+    """会話の繰り返し、端末の起床、メトリクスの記録と終了判定"""
+
+    def __init__(self, args):
+        self.args = args
+        self.stats = Stats()
+        self.session = None
+        self.last_session_end = 0.0
+        self.wake_sent = None
+        self.started = time.monotonic()
+        self.done = asyncio.Event()
+        self.tasks = set()
+        self.metrics_rows = []
+        self.udp = None
+        self.load_frames()
+
+    def load_frames(self):
+        if self.args.p3:
+            self.sample_rate, self.frame_duration, self.frames = read_p3(self.args.p3)
+        else:
+            self.sample_rate, self.frame_duration, self.frames = synthesize_frames(
+                self.args.sample_rate, self.args.frame_duration, self.args.sentence_ms)
+        if not self.frames:
+            raise SystemExit("no Opus frames to stream")
+
+    def spawn(self, coroutine):
+        task = asyncio.ensure_future(coroutine)
+        self.tasks.add(task)
+        task.add_done_callback(self.tasks.discard)
+        return task
+
+    # ---- セッション ----
+    def begin_session(self, session):
+        if self.session is not None and not self.session.closed:
+            self.end_session(self.session)
+        self.session = session
+        self.stats.sessions += 1
+        if self.wake_sent is not None:
+            self.stats.setup_ms.append((time.monotonic() - self.wake_sent) * 1000)
+            self.wake_sent = None
+
+    def end_session(self, session):
+        if session.closed:
+            return
+        session.closed = True
+        if session.speaking is not None:
+            session.speaking.cancel()
+        if self.udp is not None:
+            self.udp.detach(session)
+        if self.session is session:
+            self.session = None
+            self.last_session_end = time.monotonic()
+
+    def on_turn_done(self):
+        args = self.args
+        if args.cycles and self.stats.turns >= args.cycles:
+            self.done.set()
+        elif self.stats.turns % 100 == 0:
+            self.print_progress()
+
+    # ---- 端末のHTTP ----
+    def http_get(self, path):
+        with urllib.request.urlopen(self.args.device.rstrip("/") + path, timeout=5) as response:
+            return response.read().decode("utf-8", errors="replace")
+
+    async def wake_loop(self):
+        """会話していない時間が続いたら /soak/wake で次の会話を始める"""
+        loop = asyncio.get_running_loop()
+        while not self.done.is_set():
+            await asyncio.sleep(1)
+            if self.session is not None:
+                self.session.expire_mcp(self.args.mcp_timeout)
+                continue
+            now = time.monotonic()
+            if self.wake_sent is not None:
+                if now - self.wake_sent < self.args.wake_timeout:
+                    continue
+                self.stats.wake_failures += 1
+                self.wake_sent = None
+            if now - self.last_session_end < self.args.idle:
+                continue
+            try:
+                state = await loop.run_in_executor(None, self.http_get, "/soak/wake")
+                self.stats.wakes += 1
+                self.wake_sent = time.monotonic()
+                if state.strip() != "idle":
+                    print("wake: device is {}".format(state.strip()))
+            except OSError as e:
+                print("wake failed: {}".format(e))
+                self.stats.wake_failures += 1
+                self.last_session_end = time.monotonic()
+
+    async def metrics_loop(self, writer):
+        loop = asyncio.get_running_loop()
+        while not self.done.is_set():
+            try:
+                text = await loop.run_in_executor(None, self.http_get, "/metrics")
+                row = parse_metrics(text)
+                row["elapsed_s"] = round(time.monotonic() - self.started, 1)
+                row["turns"] = self.stats.turns
+                row["sessions"] = self.stats.sessions
+                self.metrics_rows.append(row)
+                writer.writerow(row)
+            except OSError as e:
+                print("metrics failed: {}".format(e))
+            try:
+                await asyncio.wait_for(self.done.wait(), self.args.metrics_interval)
+            except asyncio.TimeoutError:
+                pass
+
+    async def deadline(self):
+        if self.args.hours:
+            try:
+                await asyncio.wait_for(self.done.wait(), self.args.hours * 3600)
+            except asyncio.TimeoutError:
+                self.done.set()
+
+    # ---- 結果 ----
+    def print_progress(self):
+        stats = self.stats
+        print("[{:.0f}s] turns={} sessions={} disconnects={} aborts={} frames={} lost={}".format(
+            time.monotonic() - self.started, stats.turns, stats.sessions, stats.disconnects, stats.aborts,
+            stats.frames_sent, stats.frames_lost))
+
+    def summarize(self):
+        """結果を表示し、ヒープの減少がしきい値を超えていればFalseを返す"""
+        stats = self.stats
+        hours = (time.monotonic() - self.started) / 3600
+        print("==== soak summary ({:.2f} h) ====".format(hours))
+        print("turns {}  sessions {}  disconnects {}  aborts {}  wakes {} (failed {})".format(
+            stats.turns, stats.sessions, stats.disconnects, stats.aborts, stats.wakes, stats.wake_failures))
+        print("frames sent {}  lost {}  reordered {}".format(stats.frames_sent, stats.frames_lost,
+                                                            stats.frames_reordered))
+        for name, values in (("setup_ms", stats.setup_ms), ("relisten_ms", stats.relisten_ms),
+                             ("mcp_ms", stats.mcp_ms)):
+            if values:
+                print("{:12s} n={} p50={:.0f} p95={:.0f} max={:.0f}".format(
+                    name, len(values), percentile(values, 50), percentile(values, 95), max(values)))
+        if stats.mcp_calls:
+            print("mcp calls {}  timeouts {}".format(stats.mcp_calls, stats.mcp_timeouts))
+
+        rows = [row for row in self.metrics_rows if "xiaozhi_heap_internal_free_bytes" in row]
+        if len(rows) < 2:
+            return True
+        first, last = rows[0], rows[-1]
+        for name in COUNTER_SUMMARY:
+            if name in last:
+                print("{:40s} +{:.0f}".format(name, last[name] - first.get(name, 0)))
+        latency_count = last.get("xiaozhi_tts_first_output_latency_us_count", 0) - \
+            first.get("xiaozhi_tts_first_output_latency_us_count", 0)
+        if latency_count > 0:
+            latency_sum = last["xiaozhi_tts_first_output_latency_us_sum"] - \
+                first.get("xiaozhi_tts_first_output_latency_us_sum", 0)
+            print("{:40s} {:.0f} ms (n={:.0f})".format("tts first output latency (mean)",
+                                                        latency_sum / latency_count / 1000, latency_count))
+
+        # 起動直後の確保を除くため、最初の1割を捨てて空きヒープの傾きを最小二乗で求める
+        ok = True
+        steady = rows[len(rows) // 10:]
+        for name in ("xiaozhi_heap_internal_free_bytes", "xiaozhi_heap_psram_free_bytes"):
+            points = [(row["elapsed_s"] / 3600, row[name]) for row in steady if name in row]
+            if len(points) < 2:
+                continue
+            slope = linear_slope(points)
+            minimum = min(value for _, value in points)
+            print("{:40s} start {:.0f}  end {:.0f}  min {:.0f}  slope {:+.0f} B/h".format(
+                name, points[0][1], points[-1][1], minimum, slope))
+            if self.args.max_heap_drop and -slope > self.args.max_heap_drop:
+                print("FAIL: {} drops {:.0f} B/h (limit {})".format(name, -slope, self.args.max_heap_drop))
+                ok = False
+        if "xiaozhi_heap_internal_min_free_bytes" in last:
+            print("{:40s} {:.0f}".format("internal heap low-water mark", last["xiaozhi_heap_internal_min_free_bytes"]))
+        return ok
+
+
+def linear_slope(points):
+    n = len(points)
+    mean_x = sum(x for x, _ in points) / n
+    mean_y = sum(y for _, y in points) / n
+    denominator = sum((x - mean_x) ** 2 for x, _ in points)
+    if denominator == 0:
+        return 0.0
+    return sum((x - mean_x) * (y - mean_y) for x, y in points) / denominator
+
+
+def parse_metrics(text):
+    """Prometheusのテキストから METRIC_COLUMNS の値を取り出す（ラベル付きの系列は合計する）"""
+    row = {}
+    for line in text.splitlines():
+        if not line or line.startswith("#"):
+            continue
+        match = METRIC_LINE.match(line)
+        if match is None or match.group(1) not in METRIC_COLUMNS:
+            continue
+        try:
+            value = float(match.group(3))
+        except ValueError:
+            continue
+        row[match.group(1)] = row.get(match.group(1), 0) + value
+    return row
+
+
+def synthesize_frames(sample_rate, frame_duration, duration_ms):
+    """p3を指定しない場合、opuslibで正弦波をエンコードする"""
+    try:
+        import opuslib
+    except ImportError:
+        raise SystemExit("--p3 is required when opuslib is not installed")
+    encoder = opuslib.Encoder(sample_rate, 1, opuslib.APPLICATION_VOIP)
+    samples = sample_rate * frame_duration // 1000
+    frames = []
+    for index in range(max(1, duration_ms // frame_duration)):
+        pcm = bytearray()
+        for i in range(samples):
+            t = (index * samples + i) / sample_rate
+            pcm += struct.pack("<h", int(6000 * math.sin(2 * math.pi * 440 * t)))
+        frames.append(encoder.encode(bytes(pcm), samples))
+    return sample_rate, frame_duration, frames
+
+
+async def serve_websocket(soak):
+    import websockets
+    args = soak.args
+    udp = soak.udp
+
+    async def handler(websocket, path=None):
+        transport = WebsocketTransport(websocket, udp)
+        session = Session(soak, transport)
+        transport.session = session
+        headers = getattr(websocket, "request_headers", None) or websocket.request.headers
+        session.version = int(headers.get("Protocol-Version", "1"))
+        try:
+            async for message in websocket:
+                if isinstance(message, bytes):
+                    receive_binary(session, message)
+                    continue
+                data = json.loads(message)
+                if data.get("type") == "hello":
+                    udp_params = None
+                    if udp is not None and data.get("features", {}).get("udp_audio"):
+                        udp_params = udp.attach(session)
+                    soak.begin_session(session)
+                    await websocket.send(json.dumps(session.hello(data, udp_params)))
+                    await session.initialize_mcp()
+                else:
+                    session.on_json(data)
+        except websockets.ConnectionClosed:
+            pass
+        finally:
+            soak.end_session(session)
+
+    async with websockets.serve(handler, "0.0.0.0", args.port, max_size=None):
+        print("websocket: listening on port {}".format(args.port))
+        await soak.done.wait()
+
+
+def receive_binary(session, data):
+    """上り音声のフレーム数を数える（v3の制御メッセージは解釈する）"""
+    if session.version == 3:
+        if len(data) < BP3_HEADER.size:
+            return
+        kind, _, size = BP3_HEADER.unpack_from(data)
+        payload = data[BP3_HEADER.size:BP3_HEADER.size + size]
+        if kind == BP3_TYPE_CONTROL and len(payload) >= 2:
+            session.on_control(payload[0], payload[1])
+        elif kind == BP3_TYPE_AUDIO_BATCH and payload:
+            session.on_audio(payload[0])
+        elif kind == BP3_TYPE_AUDIO:
+            session.on_audio(1)
+    else:
+        session.on_audio(1)
+
+
+async def serve_mqtt(soak):
+    import paho.mqtt.client as mqtt
+    args = soak.args
+    loop = asyncio.get_running_loop()
+    queue = asyncio.Queue()
+    host, _, port = args.mqtt_broker.partition(":")
+
+    client = mqtt.Client(client_id="soak-{}".format(uuid.uuid4().hex[:8]))
+    if args.mqtt_username:
+        client.username_pw_set(args.mqtt_username, args.mqtt_password)
+    client.on_connect = lambda c, userdata, flags, rc, *rest: c.subscribe(args.mqtt_device_topic)
+    client.on_message = lambda c, userdata, message: loop.call_soon_threadsafe(queue.put_nowait, message.payload)
+    client.connect(host, int(port or 1883), keepalive=60)
+    client.loop_start()
+    print("mqtt: subscribed to {}, replying on {}".format(args.mqtt_device_topic, args.mqtt_reply_topic))
+
+    transport = MqttTransport(client, args.mqtt_reply_topic, soak.udp)
+    try:
+        while not soak.done.is_set():
+            get = asyncio.ensure_future(queue.get())
+            finished, _ = await asyncio.wait([get, asyncio.ensure_future(soak.done.wait())],
+                                             return_when=asyncio.FIRST_COMPLETED)
+            if get not in finished:
+                get.cancel()
+                break
+            try:
+                data = json.loads(get.result())
+            except ValueError:
+                continue
+            kind = data.get("type")
+            if kind == "hello":
+                session = Session(soak, transport)
+                session.version = 3
+                transport.session = session
+                soak.begin_session(session)
+                await session.send_json(session.hello(data, soak.udp.attach(session)))
+                await session.initialize_mcp()
+            elif soak.session is not None and data.get("session_id") == soak.session.session_id:
+                if kind == "goodbye":
+                    soak.end_session(soak.session)
+                else:
+                    soak.session.on_json(data)
+    finally:
+        client.loop_stop()
+        client.disconnect()
+
+
+async def run(args):
+    soak = Soak(args)
+    try:
+        # Ctrl+C でも集計を出してから終わる
+        asyncio.get_running_loop().add_signal_handler(signal.SIGINT, soak.done.set)
+    except NotImplementedError:
+        pass
+    if args.udp_port:
+        soak.udp = UdpAudio(args.udp_host, args.udp_port)
+        await soak.udp.start()
+    elif args.transport == "mqtt":
+        raise SystemExit("--udp-port is required for mqtt")
+
+    os.makedirs(args.output, exist_ok=True)
+    path = os.path.join(args.output, "metrics.csv")
+    with open(path, "w", newline="", encoding="utf-8") as f:
+        writer = csv.DictWriter(f, fieldnames=["elapsed_s", "turns", "sessions"] + METRIC_COLUMNS)
+        writer.writeheader()
+        background = [soak.spawn(soak.deadline())]
+        if args.device:
+            background.append(soak.spawn(soak.wake_loop()))
+            background.append(soak.spawn(soak.metrics_loop(writer)))
+        try:
+            if args.transport == "websocket":
+                await serve_websocket(soak)
+            else:
+                await serve_mqtt(soak)
+        finally:
+            soak.done.set()
+            for task in list(soak.tasks):
+                task.cancel()
+    ok = soak.summarize()
+    with open(os.path.join(args.output, "summary.json"), "w", encoding="utf-8") as f:
+        stats = dict(vars(soak.stats))
+        json.dump(stats, f)
+    print("metrics written to {}".format(path))
+    return ok
+
+
+def main():
+    parser = argparse.ArgumentParser(description="用于长时间稳定性测试的合成服务器")
+    parser.add_argument("transport", choices=["websocket", "mqtt"], help="连接方式")
+    parser.add_argument("--port", type=int, default=8000, help="WebSocket 监听端口")
+    parser.add_argument("--udp-host", default="127.0.0.1", help="写入 hello 的 UDP 服务器地址（设备可访问的本机地址）")
+    parser.add_argument("--udp-port", type=int, default=0, help="UDP 音频端口（MQTT 必需；WebSocket 可选）")
+    parser.add_argument("--mqtt-broker", default="127.0.0.1:1883", help="MQTT 代理地址 host:port")
+    parser.add_argument("--mqtt-username", default="", help="MQTT 用户名")
+    parser.add_argument("--mqtt-password", default="", help="MQTT 密码")
+    parser.add_argument("--mqtt-device-topic", default="device-server", help="设备发布消息的主题（publish_topic）")
+    parser.add_argument("--mqtt-reply-topic", default="", help="发往设备的主题（需与代理的转发设置一致）")
+    parser.add_argument("--device", default="", help="设备诊断 HTTP 服务器地址，如 http://192.168.1.50:8080")
+    parser.add_argument("--p3", default="", help="TTS 使用的 p3 文件（未指定时用 opuslib 生成正弦波）")
+    parser.add_argument("--sample-rate", type=int, default=24000, help="生成音频的采样率")
+    parser.add_argument("--frame-duration", type=int, default=60, help="生成音频的帧长（毫秒）")
+    parser.add_argument("--sentence-ms", type=int, default=3000, help="生成音频每句的长度（毫秒）")
+    parser.add_argument("--sentences", type=int, default=2, help="每轮回复的句数")
+    parser.add_argument("--rate", type=float, default=1.0, help="下行音频的发送速度（相对实时的倍数）")
+    parser.add_argument("--utterance-frames", type=int, default=25, help="收到多少帧上行音频后回复")
+    parser.add_argument("--loss", type=float, default=0.0, help="下行音频丢包率（0-1）")
+    parser.add_argument("--jitter", type=float, default=0.0, help="下行音频的最大抖动（毫秒）")
+    parser.add_argument("--reorder", type=float, default=0.0, help="相邻两帧交换顺序的概率（0-1）")
+    parser.add_argument("--disconnect-rate", type=float, default=0.0, help="每轮在播放中途断开连接的概率（0-1）")
+    parser.add_argument("--turns-per-session", type=int, default=0, help="每次连接的轮数，达到后发送 goodbye（0 为不限）")
+    parser.add_argument("--mcp-every", type=int, default=10, help="每隔多少轮调用一次 MCP 工具（0 为不调用）")
+    parser.add_argument("--mcp-timeout", type=float, default=10.0, help="MCP 调用超时（秒）")
+    parser.add_argument("--audio-batch", action="store_true", help="允许 v3 的上行音频批量发送")
+    parser.add_argument("--binary-control", action="store_true", help="使用 v3 的二进制控制消息发送 tts 事件")
+    parser.add_argument("--idle", type=float, default=3.0, help="会话结束后等待多少秒再唤醒设备")
+    parser.add_argument("--wake-timeout", type=float, default=30.0, help="唤醒后等待 hello 的超时（秒）")
+    parser.add_argument("--metrics-interval", type=float, default=30.0, help="读取 /metrics 的间隔（秒）")
+    parser.add_argument("--cycles", type=int, default=0, help="完成多少轮后结束（0 为不限）")
+    parser.add_argument("--hours", type=float, default=0.0, help="运行多少小时后结束（0 为不限）")
+    parser.add_argument("--max-heap-drop", type=float, default=0.0, help="空闲堆每小时下降超过该字节数时判为失败")
+    parser.add_argument("-o", "--output", default="soak", help="输出目录（metrics.csv 与 summary.json）")
+    args = parser.parse_args()
+    if args.transport == "mqtt" and not args.mqtt_reply_topic:
+        parser.error("--mqtt-reply-topic is required for mqtt")
+
+    try:
+        ok = asyncio.run(run(args))
+    except KeyboardInterrupt:
+        ok = True
+    sys.exit(0 if ok else 1)
+
+
+if __name__ == "__main__":
+    main()